@@ -0,0 +1,294 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "bridge.hpp"
+
+#include "asio.hpp"
+#include "client.hpp"
+#include "proquint.hpp"
+#include "status_error.hpp"
+#include "wire.hpp"
+
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace partake::bridge {
+
+namespace {
+
+using tcp = asio::ip::tcp;
+
+constexpr std::size_t skip_chunk_size = 65536;
+
+auto is_status_error(std::error_code ec) noexcept -> bool {
+    return ec.category() == client::the_status_error_category;
+}
+
+auto failed_reply(std::error_code ec) noexcept -> reply {
+    return {ec.value(), 0};
+}
+
+auto connect_partaked(client::client &cl, std::string const &socket)
+    -> tl::expected<void, std::string> {
+    auto const conn =
+        cl.connect(socket, "partake-bridge", protocol::QosClass::BULK).get();
+    if (not conn)
+        return tl::unexpected("cannot connect to partaked: " +
+                              conn.error().message());
+    return {};
+}
+
+// Read and discard 'size' bytes, keeping the stream in sync after an object
+// could not be allocated.
+auto skip(tcp::socket &sock, std::uint64_t size) -> std::error_code {
+    std::vector<std::uint8_t> scratch(static_cast<std::size_t>(
+        std::min<std::uint64_t>(size, skip_chunk_size)));
+    boost::system::error_code ec;
+    while (size > 0 && not ec) {
+        auto const n = static_cast<std::size_t>(
+            std::min<std::uint64_t>(size, scratch.size()));
+        asio::read(sock, asio::buffer(scratch.data(), n), ec);
+        size -= n;
+    }
+    return ec;
+}
+
+// Return the reply to send, or an error if the connection (to the peer or to
+// partaked) can no longer be used.
+auto receive_object(client::client &cl, tcp::socket &sock, std::uint64_t size)
+    -> tl::expected<reply, std::error_code> {
+    auto const obj = cl.alloc(size).get();
+    if (not obj) {
+        if (not is_status_error(obj.error()))
+            return tl::unexpected(obj.error());
+        if (auto const ec = skip(sock, size))
+            return tl::unexpected(ec);
+        return failed_reply(obj.error());
+    }
+
+    auto const result = [&]() -> tl::expected<reply, std::error_code> {
+        auto const addr = cl.map(*obj).get();
+        if (not addr)
+            return tl::unexpected(addr.error());
+        // The bytes are read directly into the object, with no intermediate
+        // buffer.
+        boost::system::error_code ec;
+        asio::read(sock,
+                   asio::buffer(*addr, static_cast<std::size_t>(obj->size)),
+                   ec);
+        if (ec)
+            return tl::unexpected(std::error_code(ec));
+        auto const vchr = cl.share_and_create_voucher(obj->key).get();
+        if (not vchr) {
+            if (not is_status_error(vchr.error()))
+                return tl::unexpected(vchr.error());
+            return failed_reply(vchr.error());
+        }
+        return reply{static_cast<std::int32_t>(protocol::Status::OK), *vchr};
+    }();
+    (void)cl.close(obj->key).get();
+    return result;
+}
+
+void serve_peer(client::client &cl, tcp::socket sock) {
+    boost::system::error_code ec;
+    auto const ep = sock.remote_endpoint(ec);
+    auto const peer =
+        ep.address().to_string() + ':' + std::to_string(ep.port());
+    spdlog::info("{}: connected", peer);
+    for (;;) {
+        std::array<std::uint8_t, header_size> hdr_buf{};
+        asio::read(sock, asio::buffer(hdr_buf), ec);
+        if (ec) {
+            if (ec == asio::error::eof)
+                spdlog::info("{}: disconnected", peer);
+            else
+                spdlog::error("{}: {}", peer, ec.message());
+            return;
+        }
+        auto const hdr = decode_header(
+            gsl::span<std::uint8_t const, header_size>(hdr_buf));
+        if (not hdr) {
+            spdlog::error("{}: invalid object header", peer);
+            return;
+        }
+
+        auto const rep = receive_object(cl, sock, hdr->size);
+        if (not rep) {
+            spdlog::error("{}: {}", peer, rep.error().message());
+            return;
+        }
+        spdlog::debug("{}: received {} bytes as {}", peer, hdr->size,
+                      std::string(common::proquint64(rep->key)));
+
+        std::array<std::uint8_t, reply_size> rep_buf{};
+        encode_reply(*rep, rep_buf);
+        asio::write(sock, asio::buffer(rep_buf), ec);
+        if (ec) {
+            spdlog::error("{}: {}", peer, ec.message());
+            return;
+        }
+    }
+}
+
+auto listen(tcp::acceptor &acceptor, serve_config const &cfg)
+    -> tl::expected<void, std::string> {
+    boost::system::error_code ec;
+    auto const addr = asio::ip::make_address(cfg.bind_address, ec);
+    if (ec)
+        return tl::unexpected("invalid bind address: " + cfg.bind_address);
+    auto const ep = tcp::endpoint(addr, cfg.port);
+    acceptor.open(ep.protocol(), ec);
+    if (not ec)
+        acceptor.set_option(tcp::acceptor::reuse_address(true), ec);
+    if (not ec)
+        acceptor.bind(ep, ec);
+    if (not ec)
+        acceptor.listen(asio::socket_base::max_listen_connections, ec);
+    if (ec)
+        return tl::unexpected("cannot listen on " + cfg.bind_address + ':' +
+                              std::to_string(cfg.port) + ": " +
+                              ec.message());
+    return {};
+}
+
+// Return the remote key.
+auto forward_object(client::client &cl, tcp::socket &sock, std::uint64_t key)
+    -> tl::expected<std::uint64_t, std::string> {
+    auto const obj = cl.open(key).get();
+    if (not obj)
+        return tl::unexpected(obj.error().message());
+
+    auto const result = [&]() -> tl::expected<std::uint64_t, std::string> {
+        auto const addr = cl.map(*obj).get();
+        if (not addr)
+            return tl::unexpected(addr.error().message());
+
+        // Gather write, so that the object's bytes go from the mapping to
+        // the socket without an intermediate buffer.
+        std::array<std::uint8_t, header_size> hdr_buf{};
+        encode_header({obj->size}, hdr_buf);
+        std::array<asio::const_buffer, 2> const bufs{
+            asio::buffer(hdr_buf),
+            asio::buffer(*addr, static_cast<std::size_t>(obj->size))};
+        boost::system::error_code ec;
+        asio::write(sock, bufs, ec);
+        if (ec)
+            return tl::unexpected("peer: " + ec.message());
+
+        std::array<std::uint8_t, reply_size> rep_buf{};
+        asio::read(sock, asio::buffer(rep_buf), ec);
+        if (ec)
+            return tl::unexpected("peer: " + ec.message());
+        auto const rep =
+            decode_reply(gsl::span<std::uint8_t const, reply_size>(rep_buf));
+        if (rep.status != static_cast<std::int32_t>(protocol::Status::OK)) {
+            return tl::unexpected(
+                "peer: " +
+                client::make_status_error(
+                    static_cast<protocol::Status>(rep.status))
+                    .message());
+        }
+        return rep.key;
+    }();
+    (void)cl.close(obj->key).get();
+    return result;
+}
+
+} // namespace
+
+auto serve(serve_config const &cfg) -> tl::expected<void, std::string> {
+    client::client cl;
+    if (auto const conn = connect_partaked(cl, cfg.socket); not conn)
+        return conn;
+
+    asio::io_context ctx;
+    tcp::acceptor acceptor(ctx);
+    if (auto const lsn = listen(acceptor, cfg); not lsn)
+        return lsn;
+    spdlog::info("listening on {}:{}", cfg.bind_address,
+                 acceptor.local_endpoint().port());
+
+    // Each peer is served (with blocking I/O) on its own thread; threads are
+    // joined once finished.
+    struct peer_thread {
+        std::shared_ptr<std::atomic<bool>> done;
+        std::thread thread;
+    };
+    std::list<peer_thread> peers;
+    boost::system::error_code ec;
+    for (;;) {
+        tcp::socket sock(ctx);
+        acceptor.accept(sock, ec);
+        if (ec)
+            break;
+        sock.set_option(tcp::no_delay(true), ec);
+
+        for (auto it = peers.begin(); it != peers.end();) {
+            if (it->done->load()) {
+                it->thread.join();
+                it = peers.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        peers.push_back(
+            {done, std::thread([&cl, done, s = std::move(sock)]() mutable {
+                 serve_peer(cl, std::move(s));
+                 done->store(true);
+             })});
+    }
+    for (auto &p : peers)
+        p.thread.join();
+    return tl::unexpected("accept failed: " + ec.message());
+}
+
+auto forward(forward_config const &cfg)
+    -> tl::expected<std::vector<std::uint64_t>, std::string> {
+    client::client cl;
+    if (auto const conn = connect_partaked(cl, cfg.socket); not conn)
+        return tl::unexpected(conn.error());
+
+    asio::io_context ctx;
+    tcp::resolver resolver(ctx);
+    boost::system::error_code ec;
+    auto const endpoints =
+        resolver.resolve(cfg.peer_host, std::to_string(cfg.peer_port), ec);
+    if (ec)
+        return tl::unexpected("cannot resolve " + cfg.peer_host + ": " +
+                              ec.message());
+    tcp::socket sock(ctx);
+    asio::connect(sock, endpoints, ec);
+    if (ec)
+        return tl::unexpected("cannot connect to peer: " + ec.message());
+    sock.set_option(tcp::no_delay(true), ec);
+
+    std::vector<std::uint64_t> ret;
+    ret.reserve(cfg.keys.size());
+    for (auto const key : cfg.keys) {
+        auto const remote = forward_object(cl, sock, key);
+        if (not remote)
+            return tl::unexpected(std::string(common::proquint64(key)) +
+                                  ": " + remote.error());
+        ret.push_back(*remote);
+    }
+    return ret;
+}
+
+} // namespace partake::bridge
@@ -0,0 +1,41 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <tl/expected.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace partake::bridge {
+
+struct serve_config {
+    std::string socket; // Local partaked
+    std::string bind_address = "0.0.0.0";
+    std::uint16_t port = 0;
+};
+
+struct forward_config {
+    std::string socket; // Local partaked
+    std::string peer_host;
+    std::uint16_t peer_port = 0;
+    std::vector<std::uint64_t> keys; // Objects or vouchers to forward
+};
+
+// Accept connections from peer bridges and, for each object received,
+// allocate it in the local partaked, read its bytes directly into the
+// mapping, and reply with a voucher (count 1) for it. Runs until a fatal
+// error.
+auto serve(serve_config const &cfg) -> tl::expected<void, std::string>;
+
+// Open each key in the local partaked and write its bytes directly from the
+// mapping to the peer bridge. Return the remote voucher keys, in order.
+auto forward(forward_config const &cfg)
+    -> tl::expected<std::vector<std::uint64_t>, std::string>;
+
+} // namespace partake::bridge
@@ -0,0 +1,220 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "cli.hpp"
+
+#include "proquint.hpp"
+
+#include <CLI/CLI.hpp>
+#include <doctest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace partake::bridge {
+
+namespace {
+
+struct cli_args {
+    std::string socket;
+    bool serve = false;
+    std::string bind_address = "0.0.0.0";
+    unsigned port = 0;
+    std::string peer;
+    std::vector<std::string> keys;
+};
+
+constexpr auto partake_version =
+#ifdef PARTAKE_VERSION
+#define PARTAKE_STRINGIFY_INTERNAL(s) #s                   // NOLINT
+#define PARTAKE_STRINGIFY(s) PARTAKE_STRINGIFY_INTERNAL(s) // NOLINT
+    PARTAKE_STRINGIFY(PARTAKE_VERSION);
+#else
+    "development build";
+#endif
+
+constexpr auto extra_help =
+    R"(Forwarding:
+  On the receiving host, run 'partake-bridge serve' against the local
+  partaked. On the sending host, 'partake-bridge forward' opens each
+  KEY (object or voucher, in proquint form) in the local partaked and
+  sends its bytes to the peer, which allocates and shares a copy and
+  returns a voucher for it. The remote vouchers are printed, one per
+  line, in the order of the keys.
+)";
+
+auto parse_cli_args_unvalidated(int argc, char const *const *argv)
+    -> tl::expected<cli_args, int> {
+    using namespace std::string_literals;
+
+    cli_args ret;
+
+    CLI::App app;
+    app.option_defaults()->disable_flag_override();
+    app.description("Forward partake objects between hosts over TCP.\n");
+    app.footer(extra_help);
+    app.get_formatter()->column_width(26); // NOLINT(readability-magic-numbers)
+    app.require_subcommand(1);
+    app.fallthrough(); // Allow --socket after subcommand
+
+    app.add_option("-s,--socket", ret.socket,
+                   "Filename of socket for connecting to partaked")
+        ->type_name("NAME")
+        ->required();
+
+    auto *serve_cmd =
+        app.add_subcommand("serve", "Receive objects from peer bridges");
+    serve_cmd->add_option("--bind", ret.bind_address,
+                          "Address to listen on (default: 0.0.0.0)")
+        ->type_name("ADDRESS");
+    serve_cmd->add_option("-p,--port", ret.port, "TCP port to listen on")
+        ->type_name("PORT")
+        ->required();
+
+    auto *forward_cmd =
+        app.add_subcommand("forward", "Send objects to a peer bridge");
+    forward_cmd
+        ->add_option("--peer", ret.peer, "Peer bridge to send objects to")
+        ->type_name("HOST:PORT")
+        ->required();
+    forward_cmd->add_option("keys", ret.keys, "Keys of objects to send")
+        ->type_name("KEY")
+        ->required();
+
+    app.set_help_flag("-h,--help", "Display this help and exit"s);
+    app.set_version_flag("-V,--version",
+                         "partake-bridge "s + partake_version);
+
+    try {
+        app.parse(argc, argv);
+        ret.serve = serve_cmd->parsed();
+        return ret;
+    } catch (CLI::ParseError const &err) { // Includes --help, --version
+        return tl::unexpected(app.exit(err));
+    }
+}
+
+auto validate_port(unsigned port) -> tl::expected<std::uint16_t, std::string> {
+    using namespace std::string_literals;
+    if (port == 0 || port > std::numeric_limits<std::uint16_t>::max())
+        return tl::unexpected("port must be in the range 1-65535"s);
+    return static_cast<std::uint16_t>(port);
+}
+
+auto validate_cli_args(cli_args const &args)
+    -> tl::expected<bridge_command, std::string> {
+    using namespace std::string_literals;
+
+    if (args.socket.empty())
+        return tl::unexpected("--socket is required"s);
+
+    if (args.serve) {
+        serve_config ret;
+        ret.socket = args.socket;
+        ret.bind_address = args.bind_address;
+        auto const port = validate_port(args.port);
+        if (not port)
+            return tl::unexpected(port.error());
+        ret.port = *port;
+        return ret;
+    }
+
+    forward_config ret;
+    ret.socket = args.socket;
+    auto const colon = args.peer.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+        return tl::unexpected("--peer must be HOST:PORT"s);
+    ret.peer_host = args.peer.substr(0, colon);
+    unsigned port = 0;
+    try {
+        std::size_t end = 0;
+        auto const p = std::stoul(args.peer.substr(colon + 1), &end);
+        if (end != args.peer.size() - colon - 1)
+            return tl::unexpected("--peer must be HOST:PORT"s);
+        port = static_cast<unsigned>(
+            std::min<unsigned long>(p, std::numeric_limits<unsigned>::max()));
+    } catch (std::logic_error const &) {
+        return tl::unexpected("--peer must be HOST:PORT"s);
+    }
+    auto const peer_port = validate_port(port);
+    if (not peer_port)
+        return tl::unexpected(peer_port.error());
+    ret.peer_port = *peer_port;
+
+    if (args.keys.empty())
+        return tl::unexpected("at least one key is required"s);
+    for (auto const &k : args.keys) {
+        auto const pq = common::proquint64::validate(k);
+        if (not pq)
+            return tl::unexpected("invalid key: "s + k);
+        ret.keys.push_back(*pq);
+    }
+    return ret;
+}
+
+} // namespace
+
+TEST_CASE("bridge: validate_cli_args") {
+    cli_args args;
+    CHECK_FALSE(validate_cli_args(args).has_value());
+    args.socket = "sock";
+
+    SUBCASE("serve") {
+        args.serve = true;
+        CHECK_FALSE(validate_cli_args(args).has_value());
+        args.port = 65536;
+        CHECK_FALSE(validate_cli_args(args).has_value());
+        args.port = 5555;
+        auto const cmd = validate_cli_args(args);
+        REQUIRE(cmd.has_value());
+        REQUIRE(std::holds_alternative<serve_config>(*cmd));
+        CHECK(std::get<serve_config>(*cmd).port == 5555);
+        CHECK(std::get<serve_config>(*cmd).bind_address == "0.0.0.0");
+    }
+
+    SUBCASE("forward") {
+        args.keys = {"babab-babab-babab-babad"};
+        CHECK_FALSE(validate_cli_args(args).has_value());
+        args.peer = "host";
+        CHECK_FALSE(validate_cli_args(args).has_value());
+        args.peer = "host:";
+        CHECK_FALSE(validate_cli_args(args).has_value());
+        args.peer = "host:55x";
+        CHECK_FALSE(validate_cli_args(args).has_value());
+        args.peer = "::1:5555";
+        auto cmd = validate_cli_args(args);
+        REQUIRE(cmd.has_value());
+        REQUIRE(std::holds_alternative<forward_config>(*cmd));
+        auto const &fwd = std::get<forward_config>(*cmd);
+        CHECK(fwd.peer_host == "::1");
+        CHECK(fwd.peer_port == 5555);
+        CHECK(fwd.keys == std::vector<std::uint64_t>{1});
+
+        args.keys.emplace_back("not-a-key");
+        CHECK_FALSE(validate_cli_args(args).has_value());
+    }
+}
+
+auto parse_cli_args(int argc, char const *const *argv)
+    -> tl::expected<bridge_command, int> {
+    return parse_cli_args_unvalidated(argc, argv)
+        .and_then([](cli_args const &args) {
+            return validate_cli_args(args).map_error(
+                [](std::string const &msg) {
+                    std::cerr << msg << '\n';
+                    std::cerr << "Run with --help for more information.\n";
+                    return 1;
+                });
+        });
+}
+
+} // namespace partake::bridge
@@ -0,0 +1,23 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "bridge.hpp"
+
+#include <tl/expected.hpp>
+
+#include <variant>
+
+namespace partake::bridge {
+
+using bridge_command = std::variant<serve_config, forward_config>;
+
+// On error or help/version, prints message and returns exit code.
+[[nodiscard]] auto parse_cli_args(int argc, char const *const *argv)
+    -> tl::expected<bridge_command, int>;
+
+} // namespace partake::bridge
@@ -0,0 +1,46 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "bridge.hpp"
+#include "cli.hpp"
+#include "overloaded.hpp"
+#include "proquint.hpp"
+
+#include <iostream>
+#include <string>
+#include <variant>
+
+namespace {
+
+using namespace partake::bridge;
+
+auto run(bridge_command const &cmd) -> tl::expected<void, int> {
+    auto const result = std::visit(
+        partake::common::overloaded{
+            [](serve_config const &cfg) { return serve(cfg); },
+            [](forward_config const &cfg) {
+                return forward(cfg).map([](auto const &keys) {
+                    for (auto const k : keys)
+                        std::cout
+                            << std::string(partake::common::proquint64(k))
+                            << '\n';
+                });
+            },
+        },
+        cmd);
+    if (not result) {
+        std::cerr << result.error() << '\n';
+        return tl::unexpected(1);
+    }
+    return {};
+}
+
+} // namespace
+
+auto main(int argc, char const *const argv[]) -> int {
+    auto const result = parse_cli_args(argc, argv).and_then(run);
+    return result.has_value() ? 0 : result.error();
+}
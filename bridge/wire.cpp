@@ -0,0 +1,92 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wire.hpp"
+
+#include <doctest.h>
+
+#include <array>
+
+namespace partake::bridge {
+
+namespace {
+
+template <typename T, std::size_t N>
+void put_le(gsl::span<std::uint8_t, N> dest, std::size_t offset,
+            T value) noexcept {
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        dest[offset + i] = static_cast<std::uint8_t>(value >> (8 * i));
+}
+
+template <typename T, std::size_t N>
+auto get_le(gsl::span<std::uint8_t const, N> src, std::size_t offset) noexcept
+    -> T {
+    T ret = 0;
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        ret |= static_cast<T>(T(src[offset + i]) << (8 * i));
+    return ret;
+}
+
+} // namespace
+
+void encode_header(object_header const &hdr,
+                   gsl::span<std::uint8_t, header_size> dest) noexcept {
+    put_le(dest, 0, wire_magic);
+    put_le(dest, 4, wire_version);
+    put_le(dest, 8, hdr.size);
+}
+
+auto decode_header(gsl::span<std::uint8_t const, header_size> src) noexcept
+    -> std::optional<object_header> {
+    if (get_le<std::uint32_t>(src, 0) != wire_magic ||
+        get_le<std::uint32_t>(src, 4) != wire_version)
+        return std::nullopt;
+    return object_header{get_le<std::uint64_t>(src, 8)};
+}
+
+void encode_reply(reply const &rep,
+                  gsl::span<std::uint8_t, reply_size> dest) noexcept {
+    put_le(dest, 0, static_cast<std::uint32_t>(rep.status));
+    put_le(dest, 4, std::uint32_t(0));
+    put_le(dest, 8, rep.key);
+}
+
+auto decode_reply(gsl::span<std::uint8_t const, reply_size> src) noexcept
+    -> reply {
+    return {static_cast<std::int32_t>(get_le<std::uint32_t>(src, 0)),
+            get_le<std::uint64_t>(src, 8)};
+}
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("bridge: object header round trip") {
+    std::array<std::uint8_t, header_size> buf{};
+    encode_header({0x0102'0304'0506'0708}, buf);
+    CHECK(buf[0] == 0x50); // 'P'
+    CHECK(buf[8] == 0x08); // Little-endian size
+    CHECK(buf[15] == 0x01);
+    auto const hdr =
+        decode_header(gsl::span<std::uint8_t const, header_size>(buf));
+    REQUIRE(hdr.has_value());
+    CHECK(hdr->size == 0x0102'0304'0506'0708);
+
+    buf[4] = 2; // Unknown version
+    CHECK_FALSE(decode_header(gsl::span<std::uint8_t const, header_size>(buf))
+                    .has_value());
+}
+
+TEST_CASE("bridge: reply round trip") {
+    std::array<std::uint8_t, reply_size> buf{};
+    encode_reply({-3, 0xfedc'ba98'7654'3210}, buf);
+    auto const rep =
+        decode_reply(gsl::span<std::uint8_t const, reply_size>(buf));
+    CHECK(rep.status == -3);
+    CHECK(rep.key == 0xfedc'ba98'7654'3210);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::bridge
@@ -0,0 +1,62 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <gsl/span>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace partake::bridge {
+
+/*
+ * The bridge protocol, spoken over TCP between partake-bridge instances, is
+ * deliberately minimal: the sender writes a fixed-size object header followed
+ * by the object's bytes (taken directly from the shared memory mapping), and
+ * the receiver writes a fixed-size reply once the bytes are in an object in
+ * its local partaked. Any number of objects may be forwarded, one after
+ * another, over a connection.
+ *
+ * All fields are little-endian.
+ *
+ * Object header (16 bytes): magic (u32), version (u32), size (u64).
+ * Reply (16 bytes): status (i32; a protocol::Status), reserved (u32; zero),
+ * key (u64; a voucher for the object on the remote partaked, or zero).
+ */
+
+inline constexpr std::uint32_t wire_magic = 0x5242'4B50; // "PKBR"
+inline constexpr std::uint32_t wire_version = 1;
+
+inline constexpr std::size_t header_size = 16;
+inline constexpr std::size_t reply_size = 16;
+
+struct object_header {
+    std::uint64_t size = 0;
+};
+
+struct reply {
+    std::int32_t status = 0;
+    std::uint64_t key = 0;
+};
+
+void encode_header(object_header const &hdr,
+                   gsl::span<std::uint8_t, header_size> dest) noexcept;
+
+// Return nullopt if magic or version does not match.
+[[nodiscard]] auto
+decode_header(gsl::span<std::uint8_t const, header_size> src) noexcept
+    -> std::optional<object_header>;
+
+void encode_reply(reply const &rep,
+                  gsl::span<std::uint8_t, reply_size> dest) noexcept;
+
+[[nodiscard]] auto
+decode_reply(gsl::span<std::uint8_t const, reply_size> src) noexcept
+    -> reply;
+
+} // namespace partake::bridge
@@ -0,0 +1,180 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "client.hpp"
+
+#include "testing.hpp"
+
+#include <doctest.h>
+
+#include <filesystem>
+
+namespace partake::client {
+
+client::client()
+    : conn(connection::socket_type(ctx)), work(asio::make_work_guard(ctx)),
+      io_thread([this] { ctx.run(); }) {}
+
+client::~client() {
+    asio::post(ctx, [this] { conn.close(); });
+    work.reset();
+    io_thread.join();
+}
+
+auto client::connect(std::string socket_path, std::string name,
+                     protocol::QosClass qos, bool read_only,
+                     std::string sub_pool, int cpu)
+    -> std::future<result<std::uint32_t>> {
+    return call<std::uint32_t>([this, path = std::move(socket_path),
+                                n = std::move(name), qos, read_only,
+                                sp = std::move(sub_pool), cpu](auto handler) {
+        conn.async_connect(path, [this, n, qos, read_only, sp, cpu,
+                                  handler](std::error_code ec) {
+            if (ec)
+                return handler(tl::unexpected(ec));
+            conn.async_hello(n, qos, handler, read_only, sp, cpu);
+        });
+    });
+}
+
+auto client::ping() -> std::future<result<void>> {
+    return call<void>([this](auto handler) { conn.async_ping(handler); });
+}
+
+auto client::get_allocator_info() -> std::future<result<allocator_info>> {
+    return call<allocator_info>(
+        [this](auto handler) { conn.async_get_allocator_info(handler); });
+}
+
+auto client::alloc(std::uint64_t size, protocol::Policy policy,
+                   std::uint64_t alignment, bool wait)
+    -> std::future<result<object_info>> {
+    return call<object_info>(
+        [this, size, policy, alignment, wait](auto handler) {
+            conn.async_alloc(size, policy, alignment, wait, handler);
+        });
+}
+
+auto client::open(std::uint64_t key, protocol::Policy policy, bool wait,
+                  std::uint32_t timeout_ms, std::uint32_t lease_ms)
+    -> std::future<result<object_info>> {
+    return call<object_info>(
+        [this, key, policy, wait, timeout_ms, lease_ms](auto handler) {
+            conn.async_open(key, policy, wait, timeout_ms, lease_ms,
+                            handler);
+        });
+}
+
+auto client::clone(std::uint64_t key, protocol::Policy policy)
+    -> std::future<result<object_info>> {
+    return call<object_info>([this, key, policy](auto handler) {
+        conn.async_clone(key, policy, handler);
+    });
+}
+
+auto client::ring(std::uint32_t slot_size, std::uint32_t slot_count)
+    -> std::future<result<object_info>> {
+    return call<object_info>([this, slot_size, slot_count](auto handler) {
+        conn.async_ring(slot_size, slot_count, handler);
+    });
+}
+
+auto client::close(std::uint64_t key) -> std::future<result<void>> {
+    return call<void>(
+        [this, key](auto handler) { conn.async_close(key, handler); });
+}
+
+auto client::renew_leases(std::uint32_t lease_ms)
+    -> std::future<result<bool>> {
+    return call<bool>([this, lease_ms](auto handler) {
+        conn.async_renew_leases(lease_ms, handler);
+    });
+}
+
+auto client::share(std::uint64_t key) -> std::future<result<void>> {
+    return call<void>(
+        [this, key](auto handler) { conn.async_share(key, handler); });
+}
+
+auto client::unshare(std::uint64_t key, bool wait, std::uint32_t timeout_ms)
+    -> std::future<result<object_info>> {
+    return call<object_info>([this, key, wait, timeout_ms](auto handler) {
+        conn.async_unshare(key, wait, timeout_ms, handler);
+    });
+}
+
+auto client::resize(std::uint64_t key, std::uint64_t size)
+    -> std::future<result<object_info>> {
+    return call<object_info>([this, key, size](auto handler) {
+        conn.async_resize(key, size, handler);
+    });
+}
+
+auto client::create_voucher(std::uint64_t key, std::uint32_t count)
+    -> std::future<result<std::uint64_t>> {
+    return call<std::uint64_t>([this, key, count](auto handler) {
+        conn.async_create_voucher(key, count, handler);
+    });
+}
+
+auto client::share_and_create_voucher(std::uint64_t key, std::uint32_t count)
+    -> std::future<result<std::uint64_t>> {
+    return call<std::uint64_t>([this, key, count](auto handler) {
+        conn.async_share_and_create_voucher(key, count, handler);
+    });
+}
+
+auto client::discard_voucher(std::uint64_t key)
+    -> std::future<result<std::uint64_t>> {
+    return call<std::uint64_t>([this, key](auto handler) {
+        conn.async_discard_voucher(key, handler);
+    });
+}
+
+auto client::fill(std::uint64_t key, std::uint64_t offset,
+                  std::uint64_t size, std::vector<std::uint8_t> pattern)
+    -> std::future<result<void>> {
+    return call<void>([this, key, offset, size,
+                       pat = std::move(pattern)](auto handler) {
+        conn.async_fill(key, offset, size, pat, handler);
+    });
+}
+
+auto client::copy_range(std::uint64_t dest_key, std::uint64_t dest_offset,
+                        std::uint64_t source_key, std::uint64_t source_offset,
+                        std::uint64_t size) -> std::future<result<void>> {
+    return call<void>([this, dest_key, dest_offset, source_key,
+                       source_offset, size](auto handler) {
+        conn.async_copy_range(dest_key, dest_offset, source_key,
+                              source_offset, size, handler);
+    });
+}
+
+auto client::prefetch(std::uint64_t key, bool touch)
+    -> std::future<result<void>> {
+    return call<void>([this, key, touch](auto handler) {
+        conn.async_prefetch(key, touch, handler);
+    });
+}
+
+auto client::map(object_info const &object)
+    -> std::future<result<std::uint8_t *>> {
+    return call<std::uint8_t *>([this, object](auto handler) {
+        conn.async_map(object, handler);
+    });
+}
+
+TEST_CASE("client: connection failure") {
+    testing::tempdir const td;
+    auto const path = (td.path() / "no_such_socket").string();
+    client c;
+    auto hello = c.connect(path, "test");
+    auto ping = c.ping();
+    CHECK_FALSE(hello.get().has_value());
+    CHECK_FALSE(ping.get().has_value());
+}
+
+} // namespace partake::client
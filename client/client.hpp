@@ -0,0 +1,120 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "asio.hpp"
+#include "connection.hpp"
+#include "partake_protocol_generated.h"
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace partake::client {
+
+// A thread-safe client that runs a pipelined connection on its own I/O
+// thread. Every call returns immediately with a future; calls made in quick
+// succession (from any threads) are sent to partaked in the same message, so
+// issuing several calls before waiting on any of them costs one round trip.
+class client {
+    asio::io_context ctx;
+    connection conn;
+    asio::executor_work_guard<asio::io_context::executor_type> work;
+    std::thread io_thread;
+
+  public:
+    client();
+
+    // Pending calls complete with an error (operation_canceled).
+    ~client();
+
+    client(client const &) = delete;
+    auto operator=(client const &) = delete;
+    client(client &&) = delete;
+    auto operator=(client &&) = delete;
+
+    // Connect and send Hello; the result is the connection number. A
+    // 'read_only' client maps segments read-only and cannot allocate or
+    // write objects. A non-empty 'sub_pool' names the partaked sub-pool to
+    // allocate from. A client pinned to a CPU should pass it as 'cpu'.
+    auto connect(std::string socket_path, std::string name,
+                 protocol::QosClass qos = protocol::QosClass::NORMAL,
+                 bool read_only = false, std::string sub_pool = {},
+                 int cpu = -1) -> std::future<result<std::uint32_t>>;
+
+    // The placement of this client's CPU as found by partaked; valid once
+    // the result of connect() has been obtained (it is set before then, on
+    // the I/O thread, and not changed afterwards).
+    [[nodiscard]] auto placement() const noexcept -> placement_info const & {
+        return conn.placement();
+    }
+
+    auto ping() -> std::future<result<void>>;
+    auto get_allocator_info() -> std::future<result<allocator_info>>;
+    // 'alignment' (bytes, power of 2) of 0 requests the default alignment.
+    // If 'wait', partaked waits for memory to become available.
+    auto alloc(std::uint64_t size,
+               protocol::Policy policy = protocol::Policy::DEFAULT,
+               std::uint64_t alignment = 0, bool wait = false)
+        -> std::future<result<object_info>>;
+    // A nonzero 'timeout_ms' bounds the wait; a nonzero 'lease_ms' makes
+    // the open leased (see OpenRequest).
+    auto open(std::uint64_t key,
+              protocol::Policy policy = protocol::Policy::DEFAULT,
+              bool wait = true, std::uint32_t timeout_ms = 0,
+              std::uint32_t lease_ms = 0) -> std::future<result<object_info>>;
+    auto clone(std::uint64_t key,
+               protocol::Policy policy = protocol::Policy::DEFAULT)
+        -> std::future<result<object_info>>;
+    // The object can be accessed with common::ring_buffer once mapped.
+    auto ring(std::uint32_t slot_size, std::uint32_t slot_count)
+        -> std::future<result<object_info>>;
+    auto close(std::uint64_t key) -> std::future<result<void>>;
+    auto renew_leases(std::uint32_t lease_ms) -> std::future<result<bool>>;
+    auto share(std::uint64_t key) -> std::future<result<void>>;
+    auto unshare(std::uint64_t key, bool wait = true,
+                 std::uint32_t timeout_ms = 0)
+        -> std::future<result<object_info>>;
+    auto resize(std::uint64_t key, std::uint64_t size)
+        -> std::future<result<object_info>>;
+    auto create_voucher(std::uint64_t key, std::uint32_t count = 1)
+        -> std::future<result<std::uint64_t>>;
+    auto share_and_create_voucher(std::uint64_t key, std::uint32_t count = 1)
+        -> std::future<result<std::uint64_t>>;
+    auto discard_voucher(std::uint64_t key)
+        -> std::future<result<std::uint64_t>>;
+    auto fill(std::uint64_t key, std::uint64_t offset, std::uint64_t size,
+              std::vector<std::uint8_t> pattern = {})
+        -> std::future<result<void>>;
+    auto copy_range(std::uint64_t dest_key, std::uint64_t dest_offset,
+                    std::uint64_t source_key, std::uint64_t source_offset,
+                    std::uint64_t size) -> std::future<result<void>>;
+    auto prefetch(std::uint64_t key, bool touch = false)
+        -> std::future<result<void>>;
+
+    // Address of the object's data, valid while the client exists.
+    auto map(object_info const &object) -> std::future<result<std::uint8_t *>>;
+
+  private:
+    // Run 'start(handler)' on the I/O thread and return the future result.
+    template <typename T, typename F>
+    auto call(F start) -> std::future<result<T>> {
+        auto promise = std::make_shared<std::promise<result<T>>>();
+        auto ret = promise->get_future();
+        asio::post(ctx, [promise, s = std::move(start)] {
+            s([promise](result<T> r) { promise->set_value(std::move(r)); });
+        });
+        return ret;
+    }
+};
+
+} // namespace partake::client
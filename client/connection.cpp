@@ -0,0 +1,600 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "connection.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <optional>
+#include <string>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace partake::client {
+
+namespace {
+
+auto current_pid() -> std::uint32_t {
+#ifdef _WIN32
+    return static_cast<std::uint32_t>(::_getpid());
+#else
+    return static_cast<std::uint32_t>(::getpid());
+#endif
+}
+
+// Return the response if OK, or else the error.
+auto checked(std::error_code ec, protocol::Response const *resp)
+    -> result<protocol::Response const *> {
+    if (ec)
+        return tl::unexpected(ec);
+    if (resp->status() != protocol::Status::OK)
+        return tl::unexpected(make_status_error(resp->status()));
+    return resp;
+}
+
+auto malformed() -> tl::unexpected<std::error_code> {
+    return tl::unexpected(std::error_code(common::errc::invalid_message));
+}
+
+auto object_of(protocol::Mapping const *m, bool zeroed = false)
+    -> object_info {
+    return {m->key(), m->segment(), m->offset(), m->size(), zeroed};
+}
+
+auto void_handler(std::function<void(result<void>)> handler)
+    -> connection::response_handler {
+    return [h = std::move(handler)](std::error_code ec,
+                                    protocol::Response const *resp) {
+        h(checked(ec, resp).map([](auto const *) {}));
+    };
+}
+
+auto key_handler(std::function<void(result<std::uint64_t>)> handler)
+    -> connection::response_handler {
+    return [h = std::move(handler)](std::error_code ec,
+                                    protocol::Response const *resp) {
+        h(checked(ec, resp).and_then(
+            [](protocol::Response const *r) -> result<std::uint64_t> {
+                if (auto const *cv = r->response_as_CreateVoucherResponse())
+                    return cv->key();
+                if (auto const *scv =
+                        r->response_as_ShareAndCreateVoucherResponse())
+                    return scv->key();
+                if (auto const *dv = r->response_as_DiscardVoucherResponse())
+                    return dv->key();
+                return malformed();
+            }));
+    };
+}
+
+} // namespace
+
+connection::connection(socket_type &&socket)
+    : sock(std::move(socket)),
+      reader(
+          sock,
+          [this](gsl::span<std::uint8_t const> bytes) {
+              return handle_message(bytes);
+          },
+          [this](std::error_code ec) {
+              fail(ec ? ec : std::make_error_code(std::errc::not_connected));
+          }),
+      writer(sock, [this](std::error_code ec) {
+          if (ec)
+              fail(ec);
+      }) {}
+
+void connection::async_connect(std::string_view socket_path,
+                               std::function<void(std::error_code)> handler) {
+    sock.async_connect(
+        asio::local::stream_protocol::endpoint(socket_path),
+        [this, h = std::move(handler)](boost::system::error_code err) {
+            if (err)
+                fail(err);
+            else
+                start();
+            h(err);
+        });
+}
+
+void connection::start() { reader.start(); }
+
+void connection::close() {
+    fail(std::make_error_code(std::errc::operation_canceled));
+}
+
+void connection::async_hello(
+    std::string_view name, protocol::QosClass qos,
+    std::function<void(result<std::uint32_t>)> handler, bool read_only,
+    std::string_view sub_pool, int cpu) {
+    auto const name_str = fbb.CreateString(name.data(), name.size());
+    auto const pool_str =
+        sub_pool.empty()
+            ? flatbuffers::Offset<flatbuffers::String>()
+            : fbb.CreateString(sub_pool.data(), sub_pool.size());
+    // Responses may be as large as granted, from the Hello response on.
+    reader.set_max_frame_len(requested_max_frame_len);
+    submit(protocol::CreateHelloRequest(fbb, current_pid(), name_str, false,
+                                        qos, read_only,
+                                        requested_max_frame_len, pool_str,
+                                        cpu),
+           [this, h = std::move(handler)](std::error_code ec,
+                                          protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [this](protocol::Response const *r)
+                       -> result<std::uint32_t> {
+                       auto const *hr = r->response_as_HelloResponse();
+                       if (hr == nullptr)
+                           return malformed();
+                       if (auto const *segs = hr->segments()) {
+                           for (auto const *s : *segs)
+                               segments.add_spec(s->segment(), *s->spec());
+                       }
+                       auto const frame_len = std::clamp<std::size_t>(
+                           hr->max_frame_len(), common::max_message_frame_len,
+                           requested_max_frame_len);
+                       max_queued_bytes = frame_len / 2;
+                       reader.set_max_frame_len(frame_len);
+                       placement_hints.cpu = hr->cpu();
+                       placement_hints.numa_node = hr->numa_node();
+                       placement_hints.l3_cache = hr->l3_cache();
+                       if (auto const *cpus = hr->l3_cpus())
+                           placement_hints.l3_cpus.assign(cpus->begin(),
+                                                          cpus->end());
+                       return hr->conn_no();
+                   }));
+           });
+}
+
+void connection::async_ping(std::function<void(result<void>)> handler) {
+    submit(protocol::CreatePingRequest(fbb), void_handler(std::move(handler)));
+}
+
+void connection::async_get_allocator_info(
+    std::function<void(result<allocator_info>)> handler) {
+    submit(protocol::CreateGetAllocatorInfoRequest(fbb),
+           [h = std::move(handler)](std::error_code ec,
+                                    protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [](protocol::Response const *r) -> result<allocator_info> {
+                       auto const *ar =
+                           r->response_as_GetAllocatorInfoResponse();
+                       if (ar == nullptr)
+                           return malformed();
+                       allocator_info ret;
+                       ret.granularity = ar->granularity();
+                       ret.max_allocation_size = ar->max_allocation_size();
+                       if (auto const *classes = ar->size_classes())
+                           ret.size_classes.assign(classes->begin(),
+                                                   classes->end());
+                       return ret;
+                   }));
+           });
+}
+
+void connection::async_alloc(
+    std::uint64_t size, protocol::Policy policy, std::uint64_t alignment,
+    bool wait, std::function<void(result<object_info>)> handler) {
+    submit(protocol::CreateAllocRequest(fbb, size, policy, -1, alignment,
+                                        wait),
+           [this, h = std::move(handler)](std::error_code ec,
+                                          protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [this](protocol::Response const *r) -> result<object_info> {
+                       auto const *ar = r->response_as_AllocResponse();
+                       if (ar == nullptr || ar->object() == nullptr)
+                           return malformed();
+                       if (auto const *spec = ar->segment())
+                           segments.add_spec(ar->object()->segment(), *spec);
+                       auto ret = object_of(ar->object(), ar->zeroed());
+                       ret.wake_word_offset = ar->wake_word();
+                       return ret;
+                   }));
+           });
+}
+
+void connection::async_open(std::uint64_t key, protocol::Policy policy,
+                            bool wait, std::uint32_t timeout_ms,
+                            std::uint32_t lease_ms,
+                            std::function<void(result<object_info>)> handler) {
+    submit(protocol::CreateOpenRequest(fbb, key, policy, wait, false,
+                                       timeout_ms, lease_ms),
+           [this, h = std::move(handler)](std::error_code ec,
+                                          protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [this](protocol::Response const *r) -> result<object_info> {
+                       auto const *op = r->response_as_OpenResponse();
+                       if (op == nullptr || op->object() == nullptr)
+                           return malformed();
+                       if (auto const *spec = op->segment())
+                           segments.add_spec(op->object()->segment(), *spec);
+                       auto ret = object_of(op->object());
+                       ret.wake_word_offset = op->wake_word();
+                       return ret;
+                   }));
+           });
+}
+
+void connection::async_clone(
+    std::uint64_t key, protocol::Policy policy,
+    std::function<void(result<object_info>)> handler) {
+    submit(protocol::CreateCloneRequest(fbb, key, policy),
+           [this, h = std::move(handler)](std::error_code ec,
+                                          protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [this](protocol::Response const *r) -> result<object_info> {
+                       auto const *cr = r->response_as_CloneResponse();
+                       if (cr == nullptr || cr->object() == nullptr)
+                           return malformed();
+                       if (auto const *spec = cr->segment())
+                           segments.add_spec(cr->object()->segment(), *spec);
+                       return object_of(cr->object());
+                   }));
+           });
+}
+
+void connection::async_ring(std::uint32_t slot_size, std::uint32_t slot_count,
+                            std::function<void(result<object_info>)> handler) {
+    submit(protocol::CreateRingRequest(fbb, slot_size, slot_count),
+           [this, h = std::move(handler)](std::error_code ec,
+                                          protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [this](protocol::Response const *r) -> result<object_info> {
+                       auto const *rr = r->response_as_RingResponse();
+                       if (rr == nullptr || rr->object() == nullptr)
+                           return malformed();
+                       if (auto const *spec = rr->segment())
+                           segments.add_spec(rr->object()->segment(), *spec);
+                       auto ret = object_of(rr->object());
+                       ret.wake_word_offset = rr->wake_word();
+                       return ret;
+                   }));
+           });
+}
+
+void connection::async_fill(std::uint64_t key, std::uint64_t offset,
+                            std::uint64_t size,
+                            gsl::span<std::uint8_t const> pattern,
+                            std::function<void(result<void>)> handler) {
+    auto const pat = pattern.empty()
+                         ? flatbuffers::Offset<flatbuffers::Vector<uint8_t>>()
+                         : fbb.CreateVector(pattern.data(), pattern.size());
+    submit(protocol::CreateFillRequest(fbb, key, offset, size, pat),
+           void_handler(std::move(handler)));
+}
+
+void connection::async_copy_range(std::uint64_t dest_key,
+                                  std::uint64_t dest_offset,
+                                  std::uint64_t source_key,
+                                  std::uint64_t source_offset,
+                                  std::uint64_t size,
+                                  std::function<void(result<void>)> handler) {
+    submit(protocol::CreateCopyRangeRequest(fbb, dest_key, dest_offset,
+                                            source_key, source_offset, size),
+           void_handler(std::move(handler)));
+}
+
+void connection::async_prefetch(std::uint64_t key, bool touch,
+                                std::function<void(result<void>)> handler) {
+    submit(protocol::CreatePrefetchRequest(fbb, key, touch),
+           void_handler(std::move(handler)));
+}
+
+void connection::async_close(std::uint64_t key,
+                             std::function<void(result<void>)> handler) {
+    submit(protocol::CreateCloseRequest(fbb, key),
+           void_handler(std::move(handler)));
+}
+
+void connection::async_renew_leases(
+    std::uint32_t lease_ms, std::function<void(result<bool>)> handler) {
+    submit(protocol::CreateRenewLeasesRequest(fbb, lease_ms),
+           [h = std::move(handler)](std::error_code ec,
+                                    protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [](protocol::Response const *r) -> result<bool> {
+                       auto const *rr = r->response_as_RenewLeasesResponse();
+                       if (rr == nullptr)
+                           return malformed();
+                       return rr->renewed();
+                   }));
+           });
+}
+
+void connection::async_share(std::uint64_t key,
+                             std::function<void(result<void>)> handler) {
+    submit(protocol::CreateShareRequest(fbb, key),
+           void_handler(std::move(handler)));
+}
+
+void connection::async_unshare(
+    std::uint64_t key, bool wait, std::uint32_t timeout_ms,
+    std::function<void(result<object_info>)> handler) {
+    submit(protocol::CreateUnshareRequest(fbb, key, wait, timeout_ms),
+           [h = std::move(handler)](std::error_code ec,
+                                    protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [](protocol::Response const *r) -> result<object_info> {
+                       auto const *ur = r->response_as_UnshareResponse();
+                       if (ur == nullptr)
+                           return malformed();
+                       object_info ret;
+                       ret.key = ur->key();
+                       ret.zeroed = ur->zeroed();
+                       return ret;
+                   }));
+           });
+}
+
+void connection::async_resize(
+    std::uint64_t key, std::uint64_t size,
+    std::function<void(result<object_info>)> handler) {
+    submit(protocol::CreateResizeRequest(fbb, key, size),
+           [h = std::move(handler)](std::error_code ec,
+                                    protocol::Response const *resp) {
+               h(checked(ec, resp).and_then(
+                   [](protocol::Response const *r) -> result<object_info> {
+                       auto const *rr = r->response_as_ResizeResponse();
+                       if (rr == nullptr || rr->object() == nullptr)
+                           return malformed();
+                       return object_of(rr->object());
+                   }));
+           });
+}
+
+void connection::async_create_voucher(
+    std::uint64_t key, std::uint32_t count,
+    std::function<void(result<std::uint64_t>)> handler) {
+    submit(protocol::CreateCreateVoucherRequest(fbb, key, count),
+           key_handler(std::move(handler)));
+}
+
+void connection::async_share_and_create_voucher(
+    std::uint64_t key, std::uint32_t count,
+    std::function<void(result<std::uint64_t>)> handler) {
+    submit(protocol::CreateShareAndCreateVoucherRequest(fbb, key, count),
+           key_handler(std::move(handler)));
+}
+
+void connection::async_discard_voucher(
+    std::uint64_t key, std::function<void(result<std::uint64_t>)> handler) {
+    submit(protocol::CreateDiscardVoucherRequest(fbb, key),
+           key_handler(std::move(handler)));
+}
+
+void connection::async_map(
+    object_info const &object,
+    std::function<void(result<std::uint8_t *>)> handler) {
+    auto const offset = object.offset;
+    if (auto *base = segments.find(object.segment); base != nullptr)
+        return handler(base + offset);
+    if (segments.is_known(object.segment)) {
+        return handler(segments.map(object.segment)
+                           .map([offset](std::uint8_t *b) {
+                               return b + offset;
+                           }));
+    }
+
+    auto &waiters = segment_waiters[object.segment];
+    waiters.emplace_back(
+        [h = std::move(handler), offset](result<std::uint8_t *> base) {
+            h(base.map([offset](std::uint8_t *b) { return b + offset; }));
+        });
+    if (waiters.size() > 1)
+        return; // GetSegment already in flight
+
+    auto const seg = object.segment;
+    submit(protocol::CreateGetSegmentRequest(fbb, seg),
+           [this, seg](std::error_code ec, protocol::Response const *resp) {
+               auto base = checked(ec, resp).and_then(
+                   [&](protocol::Response const *r)
+                       -> result<std::uint8_t *> {
+                       auto const *gs = r->response_as_GetSegmentResponse();
+                       if (gs == nullptr || gs->segment() == nullptr)
+                           return malformed();
+                       return segments.map(seg, *gs->segment());
+                   });
+               auto ws = std::move(segment_waiters[seg]);
+               segment_waiters.erase(seg);
+               for (auto &w : ws)
+                   w(base);
+           });
+}
+
+void connection::flush() {
+    if (queued.empty())
+        return;
+    fbb.FinishSizePrefixed(
+        protocol::CreateRequestMessage(fbb, fbb.CreateVector(queued)));
+    queued.clear();
+    writer.async_write_message(fbb.Release());
+}
+
+auto connection::handle_message(gsl::span<std::uint8_t const> bytes)
+    -> bool {
+    auto verifier = flatbuffers::Verifier(bytes.data(), bytes.size());
+    if (not verifier.VerifySizePrefixedBuffer<protocol::ResponseMessage>(
+            nullptr)) {
+        fail(common::errc::invalid_message);
+        return true;
+    }
+    auto const *msg =
+        flatbuffers::GetSizePrefixedRoot<protocol::ResponseMessage>(
+            bytes.data());
+    auto const *resps = msg->responses();
+    if (resps == nullptr)
+        return false;
+    for (auto const *resp : *resps) {
+        // Unknown seqnos (such as repeated notifications for subscriptions,
+        // which this class does not support) are ignored.
+        auto it = in_flight.find(resp->seqno());
+        if (it == in_flight.end())
+            continue;
+        auto h = std::move(it->second);
+        in_flight.erase(it);
+        h({}, resp);
+        if (failure)
+            return true;
+    }
+    return false;
+}
+
+void connection::fail(std::error_code ec) {
+    if (failure)
+        return;
+    failure = ec;
+    queued.clear();
+    fbb.Clear();
+    auto handlers = std::exchange(in_flight, {});
+    for (auto &[seqno, h] : handlers)
+        h(ec, nullptr);
+    boost::system::error_code ignored;
+    sock.shutdown(socket_type::shutdown_both, ignored);
+    sock.close(ignored);
+}
+
+// Tests use a socket pair, with the test acting as partaked on the other end.
+
+namespace {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+using peer_socket = asio::local::stream_protocol::socket;
+
+template <typename Pred>
+void run_until(asio::io_context &ctx, Pred pred) {
+    ctx.restart();
+    for (int i = 0; i < 100 && not pred(); ++i)
+        ctx.run_one_for(std::chrono::milliseconds(100));
+    REQUIRE(pred());
+}
+
+// Read one RequestMessage frame from the peer end.
+auto read_request(peer_socket &peer) -> std::vector<std::uint8_t> {
+    std::vector<std::uint8_t> buf(sizeof(flatbuffers::uoffset_t));
+    asio::read(peer, asio::buffer(buf));
+    auto const frame_size = common::internal::read_message_frame_size(buf);
+    buf.resize(frame_size);
+    auto const prefix_size = sizeof(flatbuffers::uoffset_t);
+    asio::read(peer, asio::buffer(buf.data() + prefix_size,
+                                  frame_size - prefix_size));
+    auto verifier = flatbuffers::Verifier(buf.data(), buf.size());
+    REQUIRE(verifier.VerifySizePrefixedBuffer<protocol::RequestMessage>(
+        nullptr));
+    return buf;
+}
+
+template <typename AddResponses>
+void write_responses(peer_socket &peer, AddResponses add_responses) {
+    flatbuffers::FlatBufferBuilder b;
+    std::vector<flatbuffers::Offset<protocol::Response>> resps;
+    add_responses(b, resps);
+    b.FinishSizePrefixed(
+        protocol::CreateResponseMessage(b, b.CreateVector(resps)));
+    std::array<std::uint8_t, common::message_frame_alignment> const zeros{};
+    auto const pad =
+        common::internal::round_size_up_to_alignment(b.GetSize()) -
+        b.GetSize();
+    asio::write(peer, std::array<asio::const_buffer, 2>{
+                          asio::buffer(b.GetBufferPointer(), b.GetSize()),
+                          asio::buffer(zeros.data(), pad)});
+}
+
+} // namespace
+
+TEST_CASE("connection: requests are coalesced and matched by seqno") {
+    asio::io_context ctx;
+    peer_socket client_sock(ctx);
+    peer_socket peer(ctx);
+    asio::local::connect_pair(client_sock, peer);
+    connection conn(std::move(client_sock));
+    conn.start();
+
+    std::optional<result<void>> ping_result;
+    std::optional<result<object_info>> alloc_result;
+    std::optional<result<void>> close_result;
+    conn.async_ping([&](result<void> r) { ping_result = r; });
+    conn.async_alloc(100, protocol::Policy::DEFAULT, 0, false,
+                     [&](result<object_info> r) { alloc_result = r; });
+    conn.async_close(42, [&](result<void> r) { close_result = r; });
+    CHECK(conn.in_flight_count() == 3);
+    ctx.poll();
+
+    auto const req_buf = read_request(peer);
+    auto const *reqs =
+        flatbuffers::GetSizePrefixedRoot<protocol::RequestMessage>(
+            req_buf.data())
+            ->requests();
+    REQUIRE(reqs->size() == 3); // All in one message
+    CHECK(reqs->Get(0)->request_type() == protocol::AnyRequest::PingRequest);
+    CHECK(reqs->Get(1)->request_type() == protocol::AnyRequest::AllocRequest);
+    CHECK(reqs->Get(2)->request_type() == protocol::AnyRequest::CloseRequest);
+    auto const ping_seqno = reqs->Get(0)->seqno();
+    auto const alloc_seqno = reqs->Get(1)->seqno();
+    auto const close_seqno = reqs->Get(2)->seqno();
+
+    // Respond out of order, in two messages.
+    write_responses(peer, [&](auto &b, auto &resps) {
+        resps.push_back(protocol::CreateResponse(
+            b, close_seqno, protocol::Status::NO_SUCH_OBJECT));
+        auto const mapping = protocol::Mapping(7, 1, 4096, 100);
+        resps.push_back(protocol::CreateResponse(
+            b, alloc_seqno, protocol::Status::OK,
+            protocol::AnyResponse::AllocResponse,
+            protocol::CreateAllocResponse(b, &mapping, true).Union()));
+    });
+    run_until(ctx, [&] { return close_result && alloc_result; });
+    CHECK_FALSE(ping_result);
+    CHECK(close_result->error() ==
+          make_status_error(protocol::Status::NO_SUCH_OBJECT));
+    REQUIRE(alloc_result->has_value());
+    CHECK((*alloc_result)->key == 7);
+    CHECK((*alloc_result)->segment == 1);
+    CHECK((*alloc_result)->offset == 4096);
+    CHECK((*alloc_result)->zeroed);
+
+    write_responses(peer, [&](auto &b, auto &resps) {
+        resps.push_back(protocol::CreateResponse(
+            b, ping_seqno, protocol::Status::OK,
+            protocol::AnyResponse::PingResponse,
+            protocol::CreatePingResponse(b).Union()));
+    });
+    run_until(ctx, [&] { return ping_result.has_value(); });
+    CHECK(ping_result->has_value());
+    CHECK(conn.in_flight_count() == 0);
+}
+
+TEST_CASE("connection: failure completes pending requests") {
+    asio::io_context ctx;
+    peer_socket client_sock(ctx);
+    peer_socket peer(ctx);
+    asio::local::connect_pair(client_sock, peer);
+    connection conn(std::move(client_sock));
+    conn.start();
+
+    std::optional<result<void>> r0;
+    std::optional<result<void>> r1;
+    conn.async_ping([&](result<void> r) { r0 = r; });
+    ctx.poll();
+    peer.close();
+    run_until(ctx, [&] { return r0.has_value(); });
+    CHECK_FALSE(r0->has_value());
+
+    conn.async_ping([&](result<void> r) { r1 = r; });
+    run_until(ctx, [&] { return r1.has_value(); });
+    CHECK(r1->error() == r0->error());
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::client
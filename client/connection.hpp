@@ -0,0 +1,262 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "asio.hpp"
+#include "errors.hpp"
+#include "message.hpp"
+#include "partake_protocol_generated.h"
+#include "segment_cache.hpp"
+#include "status_error.hpp"
+
+#include <flatbuffers/flatbuffers.h>
+#include <gsl/span>
+#include <tl/expected.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace partake::client {
+
+template <typename T> using result = tl::expected<T, std::error_code>;
+
+struct object_info {
+    std::uint64_t key = 0;
+    std::uint32_t segment = 0;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+    bool zeroed = false; // Only set for Alloc and Unshare
+    // Segment offset of the wake word of a PRIMITIVE object, if partaked
+    // reserves them (--wake-words); only set for Alloc and Open. See
+    // common/wake_word.hpp.
+    std::uint64_t wake_word_offset = 0;
+};
+
+// See GetAllocatorInfoRequest in the protocol.
+struct allocator_info {
+    std::uint64_t granularity = 0;
+    std::uint64_t max_allocation_size = 0;
+    std::vector<std::uint64_t> size_classes;
+};
+
+// Placement of the client's CPU, from HelloResponse (see there). Members are
+// -1 (or empty) where unknown.
+struct placement_info {
+    int cpu = -1;
+    int numa_node = -1;
+    int l3_cache = -1;
+    std::vector<int> l3_cpus;
+};
+
+// A pipelined connection to partaked. Requests are not sent immediately but
+// queued, and all requests queued before the executor next gets to run are
+// sent together in one RequestMessage. Any number of requests may be in
+// flight; responses are matched to requests by seqno, so they may arrive in
+// any order (as they do when, e.g., an Open waits for sharing).
+//
+// All member functions must be called (and all completion handlers are
+// called) on the socket's executor, which must not run handlers
+// concurrently (use a single-threaded io_context or a strand). The
+// connection must outlive the completion of all handlers (typically by
+// stopping the io_context before destroying it).
+//
+// When the connection fails, all pending and subsequent requests complete
+// with the error.
+class connection {
+  public:
+    using socket_type = asio::local::stream_protocol::socket;
+    using response_handler =
+        std::function<void(std::error_code, protocol::Response const *)>;
+
+  private:
+    socket_type sock;
+    common::async_message_reader<socket_type> reader;
+    common::async_message_writer<socket_type, flatbuffers::DetachedBuffer>
+        writer;
+
+    // Requests queued for the next message are built in 'fbb'.
+    flatbuffers::FlatBufferBuilder fbb;
+    std::vector<flatbuffers::Offset<protocol::Request>> queued;
+    bool flush_posted = false;
+
+    // Largest message frame asked for at hello; partaked may grant less.
+    static constexpr std::size_t requested_max_frame_len = 1024 * 1024;
+
+    // Send early (before the executor runs the posted flush) to stay well
+    // within the maximum message frame length (raised once granted).
+    std::size_t max_queued_bytes = common::max_message_frame_len / 2;
+
+    std::uint64_t next_seqno = 1;
+    std::unordered_map<std::uint64_t, response_handler> in_flight;
+    std::error_code failure;
+
+    segment_cache segments;
+    placement_info placement_hints; // Set at hello
+    using segment_waiter = std::function<void(result<std::uint8_t *>)>;
+    std::unordered_map<std::uint32_t, std::vector<segment_waiter>>
+        segment_waiters;
+
+  public:
+    // The socket may be connected already (then call start()) or not (then
+    // call async_connect()).
+    explicit connection(socket_type &&socket);
+
+    ~connection() = default;
+    connection(connection const &) = delete;
+    auto operator=(connection const &) = delete;
+    connection(connection &&) = delete;
+    auto operator=(connection &&) = delete;
+
+    [[nodiscard]] auto get_executor() -> socket_type::executor_type {
+        return sock.get_executor();
+    }
+
+    void async_connect(std::string_view socket_path,
+                       std::function<void(std::error_code)> handler);
+
+    // Start reading responses; call once, on a connected socket.
+    void start();
+
+    // Fail all pending requests with operation_canceled and close.
+    void close();
+
+    // Typed requests. Non-OK statuses are reported as make_status_error().
+    // Hello must be the first request; its result is the connection number.
+    // If 'read_only', segments are mapped read-only and requests that write
+    // to shared memory fail with READ_ONLY_CONNECTION (a safeguard, not a
+    // security boundary). If 'sub_pool' is not empty, objects are allocated
+    // from the partaked sub-pool of that name.
+    // A client pinned to a CPU should pass it as 'cpu'; the placement found
+    // by partaked is then available from placement().
+    void async_hello(std::string_view name, protocol::QosClass qos,
+                     std::function<void(result<std::uint32_t>)> handler,
+                     bool read_only = false, std::string_view sub_pool = {},
+                     int cpu = -1);
+
+    [[nodiscard]] auto placement() const noexcept -> placement_info const & {
+        return placement_hints;
+    }
+
+    void async_ping(std::function<void(result<void>)> handler);
+    void async_get_allocator_info(
+        std::function<void(result<allocator_info>)> handler);
+    // If 'wait', partaked waits for memory to be freed instead of failing
+    // with OUT_OF_SHMEM.
+    void async_alloc(std::uint64_t size, protocol::Policy policy,
+                     std::uint64_t alignment, bool wait,
+                     std::function<void(result<object_info>)> handler);
+    // A nonzero 'timeout_ms' bounds the wait (if 'wait'), after which the
+    // result is a status error of TIMED_OUT. A nonzero 'lease_ms' makes the
+    // open leased: partaked closes it when the connection's lease expires,
+    // unless renewed with async_renew_leases().
+    void async_open(std::uint64_t key, protocol::Policy policy, bool wait,
+                    std::uint32_t timeout_ms, std::uint32_t lease_ms,
+                    std::function<void(result<object_info>)> handler);
+    // Copy an object open by this connection, in partaked; the result is
+    // the new object, open as if by Alloc.
+    void async_clone(std::uint64_t key, protocol::Policy policy,
+                     std::function<void(result<object_info>)> handler);
+    // Allocate a PRIMITIVE object laid out as a common::ring_buffer with
+    // the given geometry.
+    void async_ring(std::uint32_t slot_size, std::uint32_t slot_count,
+                    std::function<void(result<object_info>)> handler);
+    void async_close(std::uint64_t key,
+                     std::function<void(result<void>)> handler);
+    // Extend the lease on all leased opens to 'lease_ms' from now. The
+    // result is false if there was no lease to renew (it had expired).
+    void async_renew_leases(std::uint32_t lease_ms,
+                            std::function<void(result<bool>)> handler);
+    void async_share(std::uint64_t key,
+                     std::function<void(result<void>)> handler);
+    // Result carries the new key and whether the object is zero-filled.
+    // 'timeout_ms' is as with async_open().
+    void async_unshare(std::uint64_t key, bool wait, std::uint32_t timeout_ms,
+                       std::function<void(result<object_info>)> handler);
+    // Grow or shrink an object this connection has allocated (and not yet
+    // shared) without moving it; growing fails with OUT_OF_SHMEM unless the
+    // space after the object is free. The result has the new size.
+    void async_resize(std::uint64_t key, std::uint64_t size,
+                      std::function<void(result<object_info>)> handler);
+    void async_create_voucher(
+        std::uint64_t key, std::uint32_t count,
+        std::function<void(result<std::uint64_t>)> handler);
+    void async_share_and_create_voucher(
+        std::uint64_t key, std::uint32_t count,
+        std::function<void(result<std::uint64_t>)> handler);
+    void async_discard_voucher(
+        std::uint64_t key, std::function<void(result<std::uint64_t>)> handler);
+    // Performed by partaked; an empty pattern fills with zeros.
+    void async_fill(std::uint64_t key, std::uint64_t offset,
+                    std::uint64_t size,
+                    gsl::span<std::uint8_t const> pattern,
+                    std::function<void(result<void>)> handler);
+    void async_copy_range(std::uint64_t dest_key, std::uint64_t dest_offset,
+                          std::uint64_t source_key,
+                          std::uint64_t source_offset, std::uint64_t size,
+                          std::function<void(result<void>)> handler);
+    // Ask partaked to bring the object's pages into memory (and, if
+    // 'touch', fault them in) before this process accesses it. The key may
+    // be of a shared object or a voucher that is not yet opened.
+    void async_prefetch(std::uint64_t key, bool touch,
+                        std::function<void(result<void>)> handler);
+
+    // Get the address of an object's data in this process, mapping its
+    // segment the first time it is needed. GetSegment is only sent if
+    // partaked has not already sent the segment's spec (with Hello, Alloc,
+    // or Open); otherwise the handler is called immediately.
+    void async_map(object_info const &object,
+                   std::function<void(result<std::uint8_t *>)> handler);
+
+    // Queue a request built with builder(). For requests not covered above.
+    template <typename R>
+    void submit(flatbuffers::Offset<R> request, response_handler handler) {
+        if (failure) {
+            fbb.Clear();
+            asio::post(sock.get_executor(),
+                       [h = std::move(handler), ec = failure] {
+                           h(ec, nullptr);
+                       });
+            return;
+        }
+        auto const seqno = next_seqno++;
+        queued.push_back(protocol::CreateRequest(
+            fbb, seqno, protocol::AnyRequestTraits<R>::enum_value,
+            request.Union()));
+        in_flight.emplace(seqno, std::move(handler));
+        if (fbb.GetSize() >= max_queued_bytes) {
+            flush();
+        } else if (not flush_posted) {
+            flush_posted = true;
+            asio::post(sock.get_executor(), [this] {
+                flush_posted = false;
+                flush();
+            });
+        }
+    }
+
+    [[nodiscard]] auto builder() noexcept -> flatbuffers::FlatBufferBuilder & {
+        return fbb;
+    }
+
+    // Number of requests awaiting a response.
+    [[nodiscard]] auto in_flight_count() const noexcept -> std::size_t {
+        return in_flight.size();
+    }
+
+  private:
+    void flush();
+    auto handle_message(gsl::span<std::uint8_t const> bytes) -> bool;
+    void fail(std::error_code ec);
+};
+
+} // namespace partake::client
@@ -0,0 +1,386 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "segment_cache.hpp"
+
+#ifdef _WIN32
+#include "win32.hpp"
+#else
+#include "posix.hpp"
+#endif
+
+#include "testing.hpp"
+
+#include <doctest.h>
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+namespace partake::client {
+
+namespace {
+
+auto last_error() -> std::error_code {
+#ifdef _WIN32
+    return {static_cast<int>(GetLastError()), std::system_category()};
+#else
+    return {errno, std::generic_category()};
+#endif
+}
+
+// Deep copy, so that the spec outlives the message it came in.
+auto copy_spec(protocol::SegmentSpec const &spec)
+    -> flatbuffers::DetachedBuffer {
+    flatbuffers::FlatBufferBuilder b;
+    flatbuffers::Offset<void> mapping_spec;
+    if (auto const *mm = spec.spec_as_PosixMmapSpec(); mm != nullptr) {
+        mapping_spec = protocol::CreatePosixMmapSpecDirect(
+                           b, mm->name()->c_str(), mm->use_shm_open())
+                           .Union();
+    } else if (auto const *sv = spec.spec_as_SystemVSharedMemorySpec();
+               sv != nullptr) {
+        mapping_spec =
+            protocol::CreateSystemVSharedMemorySpec(b, sv->shm_id()).Union();
+    } else if (auto const *fm = spec.spec_as_Win32FileMappingSpec();
+               fm != nullptr) {
+        mapping_spec = protocol::CreateWin32FileMappingSpecDirect(
+                           b, fm->name()->c_str(), fm->use_large_pages(),
+                           fm->numa_node())
+                           .Union();
+    } else if (auto const *fp = spec.spec_as_FdPassingSpec(); fp != nullptr) {
+        mapping_spec =
+            protocol::CreateFdPassingSpecDirect(b, fp->socket()->c_str())
+                .Union();
+    }
+    b.Finish(protocol::CreateSegmentSpec(
+        b, spec.size(),
+        mapping_spec.IsNull() ? protocol::SegmentMappingSpec::NONE
+                              : spec.spec_type(),
+        mapping_spec, spec.identity(), spec.read_only()));
+    return b.Release();
+}
+
+#ifndef _WIN32
+
+// Connect to the daemon's socket for the segment and receive the descriptor
+// of the shared memory.
+auto receive_segment_fd(char const *socket_path)
+    -> tl::expected<common::posix::file_descriptor, std::error_code> {
+    ::sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    auto const len = std::strlen(socket_path);
+    if (len >= sizeof(addr.sun_path))
+        return tl::unexpected(
+            std::make_error_code(std::errc::filename_too_long));
+    std::memcpy(&addr.sun_path[0], socket_path, len);
+
+    errno = 0;
+    int const sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0)
+        return tl::unexpected(last_error());
+    auto const s = common::posix::file_descriptor(sock);
+    errno = 0;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    if (::connect(s.get(), reinterpret_cast<::sockaddr const *>(&addr),
+                  sizeof(addr)) != 0)
+        return tl::unexpected(last_error());
+    auto fd = common::posix::receive_fd(s.get());
+    if (not fd.is_valid())
+        return tl::unexpected(std::make_error_code(std::errc::protocol_error));
+    return fd;
+}
+
+#endif
+
+} // namespace
+
+segment_cache::~segment_cache() {
+    for (auto &[id, seg] : segments) {
+#ifdef _WIN32
+        (void)UnmapViewOfFile(seg.addr);
+#else
+        if (seg.is_sysv)
+            (void)::shmdt(seg.addr);
+        else
+            (void)::munmap(seg.addr, seg.size);
+#endif
+    }
+}
+
+auto segment_cache::find(std::uint32_t segment) const noexcept
+    -> std::uint8_t * {
+    auto it = segments.find(segment);
+    if (it == segments.end())
+        return nullptr;
+    return static_cast<std::uint8_t *>(it->second.addr);
+}
+
+auto segment_cache::map(std::uint32_t segment,
+                        protocol::SegmentSpec const &spec)
+    -> tl::expected<std::uint8_t *, std::error_code> {
+    if (auto *addr = find(segment); addr != nullptr)
+        return addr;
+
+    auto const size = static_cast<std::size_t>(spec.size());
+    bool const read_only = spec.read_only();
+    segment_mapping seg;
+    seg.size = size;
+#ifdef _WIN32
+    if (auto const *fm = spec.spec_as_Win32FileMappingSpec(); fm != nullptr) {
+        auto const *name = fm->name()->c_str();
+        DWORD const large = fm->use_large_pages() ? FILE_MAP_LARGE_PAGES : 0;
+        DWORD const access =
+            read_only ? FILE_MAP_READ : FILE_MAP_READ | FILE_MAP_WRITE;
+        HANDLE h = OpenFileMappingA(access, FALSE, name);
+        if (h == nullptr)
+            return tl::unexpected(last_error());
+        auto const mapping = common::win32::win32_handle(h);
+        DWORD const node = fm->numa_node() >= 0
+                               ? static_cast<DWORD>(fm->numa_node())
+                               : NUMA_NO_PREFERRED_NODE;
+        void *addr = MapViewOfFileExNuma(mapping.get(), access | large, 0, 0,
+                                         size, nullptr, node);
+        if (addr == nullptr)
+            return tl::unexpected(last_error());
+        seg.addr = addr;
+    } else {
+        return tl::unexpected(std::make_error_code(std::errc::not_supported));
+    }
+#else
+    int const prot = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    if (auto const *mm = spec.spec_as_PosixMmapSpec(); mm != nullptr) {
+        auto const *name = mm->name()->c_str();
+        int const oflag = read_only ? O_RDONLY : O_RDWR;
+        errno = 0;
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+        int const fd = mm->use_shm_open() ? ::shm_open(name, oflag, 0)
+                                          : ::open(name, oflag);
+        if (fd < 0)
+            return tl::unexpected(last_error());
+        auto const file = common::posix::file_descriptor(fd);
+        errno = 0;
+        void *addr = ::mmap(nullptr, size, prot, MAP_SHARED, file.get(), 0);
+        if (addr == MAP_FAILED) // NOLINT(performance-no-int-to-ptr)
+            return tl::unexpected(last_error());
+        seg.addr = addr;
+    } else if (auto const *sv = spec.spec_as_SystemVSharedMemorySpec();
+               sv != nullptr) {
+        errno = 0;
+        void *addr =
+            ::shmat(sv->shm_id(), nullptr, read_only ? SHM_RDONLY : 0);
+        if (addr == reinterpret_cast<void *>(-1)) // NOLINT
+            return tl::unexpected(last_error());
+        seg.addr = addr;
+        seg.is_sysv = true;
+    } else if (auto const *fp = spec.spec_as_FdPassingSpec(); fp != nullptr) {
+        auto const file = receive_segment_fd(fp->socket()->c_str());
+        if (not file)
+            return tl::unexpected(file.error());
+        errno = 0;
+        void *addr = ::mmap(nullptr, size, prot, MAP_SHARED, file->get(), 0);
+        if (addr == MAP_FAILED) // NOLINT(performance-no-int-to-ptr)
+            return tl::unexpected(last_error());
+        seg.addr = addr;
+    } else {
+        return tl::unexpected(std::make_error_code(std::errc::not_supported));
+    }
+#endif
+    segments.emplace(segment, seg);
+    specs.erase(segment);
+    return static_cast<std::uint8_t *>(seg.addr);
+}
+
+void segment_cache::add_spec(std::uint32_t segment,
+                             protocol::SegmentSpec const &spec) {
+    if (segments.count(segment) == 0)
+        specs.insert_or_assign(segment, copy_spec(spec));
+}
+
+auto segment_cache::is_known(std::uint32_t segment) const noexcept -> bool {
+    return segments.count(segment) > 0 || specs.count(segment) > 0;
+}
+
+auto segment_cache::map(std::uint32_t segment)
+    -> tl::expected<std::uint8_t *, std::error_code> {
+    if (auto *addr = find(segment); addr != nullptr)
+        return addr;
+    auto it = specs.find(segment);
+    if (it == specs.end())
+        return tl::unexpected(std::make_error_code(std::errc::no_such_device));
+    auto buf = std::move(it->second);
+    specs.erase(it);
+    auto ret = map(segment,
+                   *flatbuffers::GetRoot<protocol::SegmentSpec>(buf.data()));
+    if (not ret) // Keep the spec so that mapping can be retried.
+        specs.emplace(segment, std::move(buf));
+    return ret;
+}
+
+TEST_CASE("segment_cache") {
+    segment_cache c;
+    CHECK(c.find(0) == nullptr);
+
+    flatbuffers::FlatBufferBuilder b;
+    b.Finish(protocol::CreateSegmentSpec(b, 4096));
+    auto const *spec =
+        flatbuffers::GetRoot<protocol::SegmentSpec>(b.GetBufferPointer());
+    CHECK_FALSE(c.map(0, *spec).has_value()); // No mapping spec
+    CHECK(c.find(0) == nullptr);
+}
+
+#ifndef _WIN32
+TEST_CASE("segment_cache: posix file") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    testing::tempdir const td;
+    std::vector<std::uint8_t> const data(4096, 42);
+    testing::unique_file_with_data const file(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), data);
+    auto const path = file.path().string();
+
+    flatbuffers::FlatBufferBuilder b;
+    b.Finish(protocol::CreateSegmentSpec(
+        b, 4096, protocol::SegmentMappingSpec::PosixMmapSpec,
+        protocol::CreatePosixMmapSpecDirect(b, path.c_str(), false).Union()));
+    auto const *spec =
+        flatbuffers::GetRoot<protocol::SegmentSpec>(b.GetBufferPointer());
+
+    segment_cache c;
+    auto const addr = c.map(3, *spec);
+    REQUIRE(addr.has_value());
+    CHECK((*addr)[4095] == 42);
+    CHECK(c.find(3) == *addr);
+    CHECK(c.map(3, *spec) == addr);
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("segment_cache: read-only posix file") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    testing::tempdir const td;
+    std::vector<std::uint8_t> const data(4096, 42);
+    testing::unique_file_with_data const file(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), data);
+    auto const path = file.path().string();
+    REQUIRE(::chmod(path.c_str(), 0400) == 0); // Not writable
+
+    flatbuffers::FlatBufferBuilder b;
+    b.Finish(protocol::CreateSegmentSpec(
+        b, 4096, protocol::SegmentMappingSpec::PosixMmapSpec,
+        protocol::CreatePosixMmapSpecDirect(b, path.c_str(), false).Union(),
+        0, true));
+    auto const *spec =
+        flatbuffers::GetRoot<protocol::SegmentSpec>(b.GetBufferPointer());
+
+    segment_cache c;
+    auto const addr = c.map(3, *spec);
+    REQUIRE(addr.has_value());
+    CHECK((*addr)[4095] == 42);
+
+    // The read-only flag survives copying of added specs.
+    c.add_spec(4, *spec);
+    auto const addr2 = c.map(4);
+    REQUIRE(addr2.has_value());
+    CHECK((*addr2)[0] == 42);
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("segment_cache: added spec") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    testing::tempdir const td;
+    std::vector<std::uint8_t> const data(4096, 42);
+    testing::unique_file_with_data const file(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), data);
+    auto const path = file.path().string();
+
+    segment_cache c;
+    CHECK_FALSE(c.is_known(5));
+    CHECK(c.map(5).error() == std::errc::no_such_device);
+
+    {
+        // The added spec must outlive the message buffer.
+        flatbuffers::FlatBufferBuilder b;
+        b.Finish(protocol::CreateSegmentSpec(
+            b, 4096, protocol::SegmentMappingSpec::PosixMmapSpec,
+            protocol::CreatePosixMmapSpecDirect(b, path.c_str(), false)
+                .Union()));
+        c.add_spec(
+            5, *flatbuffers::GetRoot<protocol::SegmentSpec>(
+                   b.GetBufferPointer()));
+    }
+    CHECK(c.is_known(5));
+    CHECK(c.find(5) == nullptr); // Not mapped until needed
+    auto const addr = c.map(5);
+    REQUIRE(addr.has_value());
+    CHECK((*addr)[0] == 42);
+    CHECK(c.find(5) == *addr);
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("segment_cache: fd passing") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    testing::tempdir const td;
+    std::vector<std::uint8_t> const data(4096, 42);
+    testing::unique_file_with_data const file(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), data);
+    auto const sock_path =
+        testing::unique_path(td.path(),
+                             testing::make_test_filename(__FILE__, __LINE__))
+            .string();
+
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    auto const fd = common::posix::file_descriptor(
+        ::open(file.path().string().c_str(), O_RDWR));
+    REQUIRE(fd.is_valid());
+    auto const listener =
+        common::posix::file_descriptor(::socket(AF_UNIX, SOCK_STREAM, 0));
+    REQUIRE(listener.is_valid());
+    ::sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    REQUIRE(sock_path.size() < sizeof(addr.sun_path));
+    std::memcpy(&addr.sun_path[0], sock_path.c_str(), sock_path.size());
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    REQUIRE(::bind(listener.get(), reinterpret_cast<::sockaddr *>(&addr),
+                   sizeof(addr)) == 0);
+    testing::auto_delete_file const adf(sock_path);
+    REQUIRE(::listen(listener.get(), 1) == 0);
+    std::thread server([&] {
+        auto const conn = common::posix::file_descriptor(
+            ::accept(listener.get(), nullptr, nullptr));
+        if (conn.is_valid())
+            (void)common::posix::send_fd(conn.get(), fd.get());
+    });
+
+    flatbuffers::FlatBufferBuilder b;
+    b.Finish(protocol::CreateSegmentSpec(
+        b, 4096, protocol::SegmentMappingSpec::FdPassingSpec,
+        protocol::CreateFdPassingSpecDirect(b, sock_path.c_str()).Union()));
+    auto const *spec =
+        flatbuffers::GetRoot<protocol::SegmentSpec>(b.GetBufferPointer());
+
+    segment_cache c;
+    auto const addr2 = c.map(2, *spec);
+    server.join();
+    REQUIRE(addr2.has_value());
+    CHECK((*addr2)[4095] == 42);
+    // NOLINTEND(readability-magic-numbers)
+}
+#endif
+
+} // namespace partake::client
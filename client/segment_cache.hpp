@@ -0,0 +1,69 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "partake_protocol_generated.h"
+
+#include <flatbuffers/flatbuffers.h>
+#include <tl/expected.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+#include <unordered_map>
+
+namespace partake::client {
+
+// Maps partaked shared memory segments into this process, keyed by the
+// segment id given in protocol::Mapping, for use by a single connection.
+// Mappings remain valid until destruction.
+//
+// Segment specs sent by partaked ahead of need (in HelloResponse, or with the
+// first AllocResponse or OpenResponse for a segment) can be added, so that
+// the segment is mapped without a GetSegment request when first used.
+class segment_cache {
+    struct segment_mapping {
+        void *addr = nullptr;
+        std::size_t size = 0;
+        bool is_sysv = false;
+    };
+
+    std::unordered_map<std::uint32_t, segment_mapping> segments;
+
+    // Specs of segments not yet mapped (each a SegmentSpec root).
+    std::unordered_map<std::uint32_t, flatbuffers::DetachedBuffer> specs;
+
+  public:
+    segment_cache() noexcept = default;
+    ~segment_cache();
+    segment_cache(segment_cache const &) = delete;
+    auto operator=(segment_cache const &) = delete;
+    segment_cache(segment_cache &&) = delete;
+    auto operator=(segment_cache &&) = delete;
+
+    // Return the base address of the segment, or nullptr if not mapped.
+    [[nodiscard]] auto find(std::uint32_t segment) const noexcept
+        -> std::uint8_t *;
+
+    // Map the segment (if not already mapped) and return its base address.
+    // Errors are errno (or Win32 error) values.
+    auto map(std::uint32_t segment, protocol::SegmentSpec const &spec)
+        -> tl::expected<std::uint8_t *, std::error_code>;
+
+    // Keep a copy of the spec for mapping later (no-op if already mapped).
+    void add_spec(std::uint32_t segment, protocol::SegmentSpec const &spec);
+
+    // True if the segment is mapped or its spec has been added.
+    [[nodiscard]] auto is_known(std::uint32_t segment) const noexcept -> bool;
+
+    // Map the segment (if not already mapped) using the added spec; the
+    // error is std::errc::no_such_device if the segment is not known.
+    auto map(std::uint32_t segment)
+        -> tl::expected<std::uint8_t *, std::error_code>;
+};
+
+} // namespace partake::client
@@ -0,0 +1,26 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "status_error.hpp"
+
+#include <doctest.h>
+
+#include <ostream> // operator<< used by doctest
+
+namespace partake::client {
+
+TEST_CASE("make_status_error") {
+    auto const ok = make_status_error(protocol::Status::OK);
+    CHECK_FALSE(ok);
+    auto const ec = make_status_error(protocol::Status::NO_SUCH_OBJECT);
+    CHECK(ec);
+    CHECK(ec == make_status_error(protocol::Status::NO_SUCH_OBJECT));
+    CHECK(ec.message() == "NO_SUCH_OBJECT");
+    CHECK(std::error_code(-1, the_status_error_category).message() ==
+          "Unknown status");
+}
+
+} // namespace partake::client
@@ -0,0 +1,38 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "partake_protocol_generated.h"
+
+#include <string>
+#include <system_error>
+
+namespace partake::client {
+
+// Error category for non-OK protocol::Status values returned by partaked, so
+// that they can be reported alongside connection errors as std::error_code.
+struct status_error_category : std::error_category {
+    [[nodiscard]] auto name() const noexcept -> char const * override {
+        return "partake-status";
+    }
+
+    [[nodiscard]] auto message(int c) const -> std::string override {
+        auto const status = static_cast<protocol::Status>(c);
+        if (status < protocol::Status::MIN || status > protocol::Status::MAX)
+            return "Unknown status";
+        return protocol::EnumNameStatus(status);
+    }
+};
+
+inline status_error_category const the_status_error_category;
+
+inline auto make_status_error(protocol::Status status) noexcept
+    -> std::error_code {
+    return {static_cast<int>(status), the_status_error_category};
+}
+
+} // namespace partake::client
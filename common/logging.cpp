@@ -5,3 +5,69 @@
  */
 
 #include "logging.hpp"
+
+#include <doctest.h>
+#include <spdlog/async.h>
+
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <string_view>
+
+namespace partake::common {
+
+void use_async_default_logger(std::size_t queue_size,
+                              log_overflow_policy policy) {
+    auto const old = spdlog::default_logger();
+    spdlog::init_thread_pool(queue_size, 1);
+    auto lgr = std::make_shared<spdlog::async_logger>(
+        old->name(), old->sinks().begin(), old->sinks().end(),
+        spdlog::thread_pool(),
+        policy == log_overflow_policy::block
+            ? spdlog::async_overflow_policy::block
+            : spdlog::async_overflow_policy::overrun_oldest);
+    lgr->set_level(old->level());
+    lgr->flush_on(old->flush_level());
+    spdlog::set_default_logger(std::move(lgr));
+}
+
+auto log_rate_limiter::allow(std::string_view category,
+                             clock::time_point now) -> bool {
+    if (allowed == 0 || now - window_start >= intvl) {
+        if (suppressed > 0) {
+            spdlog::warn("{}: {} similar messages were suppressed", category,
+                         suppressed);
+            suppressed = 0;
+        }
+        window_start = now;
+        allowed = 0;
+    }
+    if (allowed < max_msgs) {
+        ++allowed;
+        return true;
+    }
+    ++suppressed;
+    return false;
+}
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("log_rate_limiter") {
+    using namespace std::chrono_literals;
+    auto lim = log_rate_limiter(2, 1s);
+    auto const t0 = log_rate_limiter::clock::now();
+    CHECK(lim.allow("test", t0));
+    CHECK(lim.allow("test", t0 + 100ms));
+    CHECK_FALSE(lim.allow("test", t0 + 200ms));
+    CHECK_FALSE(lim.allow("test", t0 + 999ms));
+    CHECK(lim.suppressed_count() == 2);
+    CHECK(lim.allow("test", t0 + 1s));
+    CHECK(lim.suppressed_count() == 0);
+    CHECK(lim.allow("test", t0 + 1500ms));
+    CHECK_FALSE(lim.allow("test", t0 + 1900ms));
+    CHECK(lim.allow("test", t0 + 3s));
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::common
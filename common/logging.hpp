@@ -9,7 +9,10 @@
 #include <spdlog/sinks/null_sink.h>
 #include <spdlog/spdlog.h>
 
+#include <chrono>
+#include <cstddef>
 #include <memory>
+#include <string_view>
 
 namespace partake::common {
 
@@ -19,4 +22,50 @@ namespace partake::common {
     return lgr;
 }
 
+enum class log_overflow_policy {
+    block,       // Wait for the logging thread to make room
+    drop_oldest, // Discard the oldest queued message
+};
+
+// Replace the default logger with one (writing to the same destination)
+// that only enqueues messages, which are formatted and written by a
+// background thread, so that logging does not block the calling (e.g., I/O)
+// thread on the terminal or file. At most 'queue_size' messages are queued;
+// 'policy' determines what happens when the queue is full. Call
+// spdlog::shutdown() before exiting to write any queued messages.
+void use_async_default_logger(std::size_t queue_size,
+                              log_overflow_policy policy);
+
+// Limit on the rate of messages of one category (such as errors that every
+// client connection can cause), so that a burst of identical failures does
+// not flood the log: at most 'max_messages' are allowed per 'interval'. The
+// number of messages suppressed is logged when the next one is allowed. Not
+// thread-safe.
+class log_rate_limiter {
+  public:
+    using clock = std::chrono::steady_clock;
+
+  private:
+    std::size_t max_msgs;
+    clock::duration intvl;
+    clock::time_point window_start{};
+    std::size_t allowed = 0;
+    std::size_t suppressed = 0;
+
+  public:
+    explicit log_rate_limiter(
+        std::size_t max_messages = 10,
+        clock::duration interval = std::chrono::seconds(1)) noexcept
+        : max_msgs(max_messages), intvl(interval) {}
+
+    // Return true if a message of 'category' (used when reporting suppressed
+    // messages) may be logged now.
+    auto allow(std::string_view category, clock::time_point now = clock::now())
+        -> bool;
+
+    [[nodiscard]] auto suppressed_count() const noexcept -> std::size_t {
+        return suppressed;
+    }
+};
+
 } // namespace partake::common
@@ -16,6 +16,8 @@
 #include <cstddef>
 #include <cstdint>
 #include <fstream>
+#include <functional>
+#include <optional>
 #include <system_error>
 #include <utility>
 #include <vector>
@@ -232,8 +234,10 @@ TEST_CASE("async_message_writer") {
     SUBCASE("aligned") {
         std::vector<std::uint8_t> v{'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h'};
         writer.async_write_message(std::move(v));
+        CHECK(writer.queued_bytes() == 8);
         ctx.run();
         CHECK(done);
+        CHECK(writer.queued_bytes() == 0);
         auto data = get_file_contents(path);
         CHECK(data == std::vector<std::uint8_t>{'a', 'b', 'c', 'd', 'e', 'f',
                                                 'g', 'h'});
@@ -321,6 +325,107 @@ TEST_CASE("async_message_reader: large message") {
     // NOLINTEND(readability-magic-numbers)
 }
 
+TEST_CASE("async_message_reader: many messages") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    // Frames of varying sizes, so that partial frames land at various
+    // positions in the read buffer.
+    std::vector<std::uint8_t> v;
+    std::vector<std::size_t> frame_sizes;
+    for (std::size_t i = 0; v.size() < 300'000; ++i) {
+        auto const frame_size = 8 * (1 + (i * 37) % 1000);
+        auto const prefix = frame_size - 4;
+        auto const off = v.size();
+        v.resize(off + frame_size);
+        v[off] = static_cast<std::uint8_t>(prefix & 0xff);
+        v[off + 1] = static_cast<std::uint8_t>(prefix >> 8);
+        v[off + 4] = static_cast<std::uint8_t>(i % 256);
+        frame_sizes.push_back(frame_size);
+    }
+
+    testing::tempdir const td;
+    auto f = testing::unique_file_with_data(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), v);
+    asio::io_context ctx;
+    auto s = readable_asio_stream_for_file(ctx, f.path());
+
+    std::size_t message_count = 0;
+    bool ended = false;
+    async_message_reader r(
+        s,
+        [&](gsl::span<std::uint8_t const> msg) -> bool {
+            REQUIRE(message_count < frame_sizes.size());
+            CHECK(msg.size() == frame_sizes[message_count]);
+            CHECK(msg[4] == message_count % 256);
+            ++message_count;
+            return false;
+        },
+        [&](std::error_code ec) {
+            CHECK_FALSE(ec);
+            ended = true;
+        },
+        1); // Rounded up to the minimum
+    CHECK(r.buffer_size() == max_message_frame_len);
+    r.start();
+    ctx.run();
+    CHECK(ended);
+    CHECK(message_count == frame_sizes.size());
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("async_message_reader: messages per turn") {
+    // Four messages with size header 0, padded to 8 bytes each
+    std::vector<std::uint8_t> v(32, 0);
+
+    testing::tempdir const td;
+    auto f = testing::unique_file_with_data(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), v);
+    asio::io_context ctx;
+    auto s = readable_asio_stream_for_file(ctx, f.path());
+
+    // Count turns of the event loop with a handler that reposts itself.
+    unsigned turns = 0;
+    bool ended = false;
+    std::function<void()> tick = [&] {
+        ++turns;
+        if (not ended)
+            asio::post(ctx, tick);
+    };
+    asio::post(ctx, tick);
+
+    std::vector<unsigned> turns_at_message;
+    async_message_reader r(
+        s,
+        [&](gsl::span<std::uint8_t const> msg) -> bool {
+            CHECK(msg.size() == 8);
+            turns_at_message.push_back(turns);
+            return false;
+        },
+        [&](std::error_code ec) {
+            CHECK_FALSE(ec);
+            ended = true;
+        });
+    std::size_t per_turn = 0;
+    SUBCASE("unlimited") {}
+    SUBCASE("1 per turn") { per_turn = 1; }
+    SUBCASE("2 per turn") { per_turn = 2; }
+    r.set_messages_per_turn(per_turn);
+    r.start();
+    ctx.run();
+    CHECK(ended);
+    REQUIRE(turns_at_message.size() == 4);
+    if (per_turn == 0) {
+        CHECK(turns_at_message[3] == turns_at_message[0]);
+    } else if (per_turn == 1) {
+        CHECK(turns_at_message[1] > turns_at_message[0]);
+        CHECK(turns_at_message[2] > turns_at_message[1]);
+        CHECK(turns_at_message[3] > turns_at_message[2]);
+    } else {
+        CHECK(turns_at_message[1] == turns_at_message[0]);
+        CHECK(turns_at_message[2] > turns_at_message[1]);
+        CHECK(turns_at_message[3] == turns_at_message[2]);
+    }
+}
+
 TEST_CASE("async_message_reader: quit by handler") {
     // Two messages with size header 0, padded to 8 bytes each
     std::vector<std::uint8_t> v(16, 0);
@@ -345,6 +450,154 @@ TEST_CASE("async_message_reader: quit by handler") {
     CHECK(message_count == 1);
 }
 
+TEST_CASE("async_message_reader: larger max frame length") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    // A small message, then one of 100000 bytes (prefix 99996)
+    std::vector<std::uint8_t> v(8, 0);
+    v.insert(v.end(), {0x9c, 0x86, 0x01, 0});
+    v.resize(8 + 100'000);
+    v.back() = 42;
+
+    testing::tempdir const td;
+    auto f = testing::unique_file_with_data(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), v);
+    asio::io_context ctx;
+    auto s = readable_asio_stream_for_file(ctx, f.path());
+
+    std::vector<std::size_t> sizes;
+    std::optional<std::error_code> end_err;
+    async_message_reader r(
+        s,
+        [&](gsl::span<std::uint8_t const> msg) -> bool {
+            sizes.push_back(msg.size());
+            if (msg.size() == 100'000)
+                CHECK(msg.back() == 42);
+            return false;
+        },
+        [&](std::error_code ec) { end_err = ec; });
+
+    SUBCASE("default") {
+        r.start();
+        ctx.run();
+        CHECK(sizes.size() == 1);
+        REQUIRE(end_err.has_value());
+        CHECK(*end_err == std::error_code(errc::message_too_long));
+    }
+
+    SUBCASE("raised") {
+        r.set_max_frame_len(128 * 1024);
+        r.start();
+        ctx.run();
+        CHECK(sizes == std::vector<std::size_t>{8, 100'000});
+        REQUIRE(end_err.has_value());
+        CHECK_FALSE(*end_err);
+        CHECK(r.buffer_size() >= 100'000);
+    }
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("async_message_reader: complete frame over max length") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    // A small message, then one of 40000 bytes (prefix 39996), which is
+    // over the default limit but fits in the default read buffer
+    std::vector<std::uint8_t> v(8, 0);
+    v.insert(v.end(), {0x3c, 0x9c, 0, 0});
+    v.resize(8 + 40'000);
+
+    testing::tempdir const td;
+    auto f = testing::unique_file_with_data(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), v);
+    asio::io_context ctx;
+    auto s = readable_asio_stream_for_file(ctx, f.path());
+
+    std::vector<std::size_t> sizes;
+    std::optional<std::error_code> end_err;
+    async_message_reader r(
+        s,
+        [&](gsl::span<std::uint8_t const> msg) -> bool {
+            sizes.push_back(msg.size());
+            return false;
+        },
+        [&](std::error_code ec) { end_err = ec; });
+    REQUIRE(r.buffer_size() > v.size());
+
+    SUBCASE("default") {
+        r.start();
+        ctx.run();
+        CHECK(sizes == std::vector<std::size_t>{8});
+        REQUIRE(end_err.has_value());
+        CHECK(*end_err == std::error_code(errc::message_too_long));
+    }
+
+    SUBCASE("raised") {
+        r.set_max_frame_len(48 * 1024);
+        r.start();
+        ctx.run();
+        CHECK(sizes == std::vector<std::size_t>{8, 40'000});
+        REQUIRE(end_err.has_value());
+        CHECK_FALSE(*end_err);
+    }
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("async_message_reader: pause and resume") {
+    // Three messages with size header 0, padded to 8 bytes each
+    std::vector<std::uint8_t> v(24, 0);
+
+    testing::tempdir const td;
+    auto f = testing::unique_file_with_data(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), v);
+    asio::io_context ctx;
+    auto s = readable_asio_stream_for_file(ctx, f.path());
+
+    unsigned message_count = 0;
+    std::optional<std::error_code> end_err;
+    async_message_reader<decltype(s)> *rp = nullptr;
+    async_message_reader r(
+        s,
+        [&](gsl::span<std::uint8_t const> msg) -> bool {
+            CHECK(msg.size() == 8);
+            ++message_count;
+            rp->pause();
+            return false;
+        },
+        [&](std::error_code ec) { end_err = ec; });
+    rp = &r;
+    r.start();
+    ctx.run();
+    CHECK(message_count == 1);
+    CHECK(r.is_paused());
+    CHECK_FALSE(end_err.has_value());
+
+    SUBCASE("resume") {
+        r.resume();
+        ctx.restart();
+        ctx.run();
+        CHECK(message_count == 2);
+        r.resume();
+        ctx.restart();
+        ctx.run();
+        CHECK(message_count == 3);
+        r.resume();
+        ctx.restart();
+        ctx.run();
+        CHECK(message_count == 3);
+        REQUIRE(end_err.has_value());
+        CHECK_FALSE(*end_err);
+    }
+
+    SUBCASE("abandon") {
+        std::error_code const aborted =
+            boost::system::error_code(asio::error::operation_aborted);
+        r.abandon_if_paused(aborted);
+        ctx.restart();
+        ctx.run();
+        CHECK(message_count == 1);
+        REQUIRE(end_err.has_value());
+        CHECK(*end_err == aborted);
+    }
+}
+
 TEST_CASE("async_message_reader: message too long") {
     // Max message frame is 32k (including size prefix and padding).
     // When (size prefix) > (32768 - 4), the limit is exceeded.
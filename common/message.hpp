@@ -8,6 +8,7 @@
 
 #include "asio.hpp"
 #include "errors.hpp"
+#include "tracing.hpp"
 
 #include <doctest.h>
 #include <flatbuffers/flatbuffers.h>
@@ -17,6 +18,7 @@
 
 #include <algorithm>
 #include <array>
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -30,7 +32,10 @@
 namespace partake::common {
 
 constexpr std::size_t message_frame_alignment = 8;
-constexpr std::size_t max_message_frame_len = 32768;
+constexpr std::size_t max_message_frame_len = 32768; // Unless negotiated
+
+// Upper limit on a negotiated maximum frame length (see HelloRequest).
+constexpr std::size_t max_negotiable_frame_len = 16 * 1024 * 1024;
 
 namespace internal {
 
@@ -88,6 +93,7 @@ template <typename Socket, typename Buffer> class async_message_writer {
     std::vector<buffer_type> buffers_being_written;
     std::vector<asio::const_buffer> asio_buffers;
     std::vector<std::size_t> end_offsets;
+    std::size_t bytes_queued = 0;
 
   public:
     explicit async_message_writer(
@@ -106,11 +112,25 @@ template <typename Socket, typename Buffer> class async_message_writer {
             return asio::defer(sock->get_executor(),
                                [this] { handle_cmpl({}); });
 
+        bytes_queued += buffer.size();
         buffers_to_write_next.push_back(std::move(buffer));
         if (not is_write_in_progress())
             start_writing();
     }
 
+    // Number of messages queued or being written.
+    [[nodiscard]] auto queued_message_count() const noexcept -> std::size_t {
+        return buffers_to_write_next.size() + buffers_being_written.size();
+    }
+
+    // Total size of the messages queued or being written. This is up to
+    // date when the completion handler is called (for messages whose write
+    // has finished), so that the handler can check whether the queue has
+    // drained enough.
+    [[nodiscard]] auto queued_bytes() const noexcept -> std::size_t {
+        return bytes_queued;
+    }
+
   private:
     [[nodiscard]] auto is_write_in_progress() const noexcept -> bool {
         return not buffers_being_written.empty();
@@ -155,7 +175,10 @@ template <typename Socket, typename Buffer> class async_message_writer {
                 static const boost::system::error_code canceled =
                     asio::error::operation_aborted;
 
+                PARTAKE_TRACE2(message_written, end_offsets.size(), written);
                 asio_buffers.clear();
+                for (buffer_type const &buf : buffers_being_written)
+                    bytes_queued -= buf.size();
                 buffers_being_written.clear();
 
                 bool had_error = false;
@@ -178,6 +201,7 @@ template <typename Socket, typename Buffer> class async_message_writer {
                     for ([[maybe_unused]] auto &b : buffers_to_write_next)
                         handle_cmpl(canceled);
                     buffers_to_write_next.clear();
+                    bytes_queued = 0;
                 } else if (not buffers_to_write_next.empty()) {
                     start_writing();
                 }
@@ -188,29 +212,58 @@ template <typename Socket, typename Buffer> class async_message_writer {
 // Continuously (and asynchronously) read from socket and delimit messages.
 // Stop only when there is a read error (including because the socket was shut
 // down) or the message handler indicated end of processing.
-// Any message (appearing to be) larger than the allowed maximum is treated as
-// a read error.
+// Any message (appearing to be) larger than the allowed maximum (by default
+// max_message_frame_len) is treated as a read error.
+//
+// The read buffer has a fixed size (at least max_message_frame_len) and is
+// filled from front to back; messages are handled in place. A trailing
+// partial frame stays where it is while the rest of it can be read into the
+// buffer; it is moved to the front only when the space after it runs low
+// (so that at most one partial frame is copied per buffer-full). A larger
+// buffer allows more pipelined messages to be read with a single system
+// call. If a larger maximum frame length has been set, the buffer grows
+// (and stays grown) when a frame that does not fit arrives.
+//
+// Reading can be paused (e.g., while responses to the messages already
+// handled have yet to be written) and resumed. Pausing takes effect before
+// the next message is handled; no more data is read from the socket until
+// resumed.
 template <typename Socket> class async_message_reader {
   public:
     using socket_type = Socket;
 
+    static constexpr std::size_t default_buffer_size =
+        2 * max_message_frame_len;
+
   private:
     gsl::not_null<socket_type *> sock;
     std::function<auto(gsl::span<std::uint8_t const>)->bool> handle_msg;
     std::function<void(std::error_code)> handle_ed;
 
-    // Read buffer only grows, up to a maximum of max_message_frame_len.
     std::vector<std::uint8_t> readbuf;
-    static constexpr std::size_t initial_readbuf_size = 1024;
+    std::size_t data_start = 0; // Start of unhandled data
+    std::size_t data_end = 0;   // End of data read so far
+    bool at_eof = false;
+    std::size_t max_frame_len = max_message_frame_len;
+
+    bool paused = false;
+    bool stalled = false; // Paused, with no read or handling scheduled
+
+    std::size_t max_messages_per_turn = 0; // Unlimited if zero
+
+    // Compact before reading if less than this much space would remain.
+    static constexpr std::size_t min_read_size = 4096;
 
   public:
     explicit async_message_reader(
         socket_type &socket,
         std::function<auto(gsl::span<std::uint8_t const>)->bool>
             handle_message,
-        std::function<void(std::error_code)> handle_end)
+        std::function<void(std::error_code)> handle_end,
+        std::size_t buffer_size = default_buffer_size)
         : sock(&socket), handle_msg(std::move(handle_message)),
-          handle_ed(std::move(handle_end)), readbuf(initial_readbuf_size) {}
+          handle_ed(std::move(handle_end)),
+          readbuf(std::max(buffer_size, max_message_frame_len)) {}
 
     ~async_message_reader() = default;
     async_message_reader(async_message_reader const &) = delete;
@@ -220,54 +273,136 @@ template <typename Socket> class async_message_reader {
 
     void start() { schedule_read(); }
 
+    [[nodiscard]] auto buffer_size() const noexcept -> std::size_t {
+        return readbuf.size();
+    }
+
+    // After handling 'count' messages (0 for no limit) received in one
+    // read, yield to other handlers (by posting to the socket's executor)
+    // before handling more, so that a client sending many messages does not
+    // delay others.
+    void set_messages_per_turn(std::size_t count) noexcept {
+        max_messages_per_turn = count;
+    }
+
+    // Allow frames of up to 'len' bytes (between max_message_frame_len and
+    // max_negotiable_frame_len), from the next message on.
+    void set_max_frame_len(std::size_t len) noexcept {
+        assert(len >= max_message_frame_len);
+        assert(len <= max_negotiable_frame_len);
+        max_frame_len = len;
+    }
+
+    // Stop handling messages and reading, before the next message.
+    void pause() noexcept { paused = true; }
+
+    void resume() {
+        paused = false;
+        if (stalled) {
+            stalled = false;
+            asio::post(sock->get_executor(), [this] { handle_messages(); });
+        }
+    }
+
+    [[nodiscard]] auto is_paused() const noexcept -> bool { return paused; }
+
+    // If paused, end reading now, calling the end handler with 'err'
+    // (otherwise the end handler would not be called until resumed, even if
+    // the socket has been closed).
+    void abandon_if_paused(std::error_code err) {
+        if (not paused)
+            return;
+        paused = false;
+        if (stalled) {
+            stalled = false;
+            asio::post(sock->get_executor(), [this, err] { handle_ed(err); });
+        }
+    }
+
   private:
-    void schedule_read(std::size_t start = 0) {
-        auto new_read = gsl::span(readbuf).subspan(start);
+    void schedule_read() {
+        auto new_read = gsl::span(readbuf).subspan(data_end);
         sock->async_read_some(
             asio::buffer(new_read.data(), new_read.size()),
-            [this, start](boost::system::error_code err,
-                          std::size_t bytes_read) {
+            [this](boost::system::error_code err, std::size_t bytes_read) {
                 if (err && err.value() != asio::error::eof)
                     return handle_ed(err);
+                data_end += bytes_read;
+                at_eof = bool(err);
+                handle_messages();
+            });
+    }
 
-                auto remaining = gsl::span(std::as_const(readbuf))
-                                     .first(start + bytes_read);
-                std::size_t frame_size = 0;
-                for (;;) {
-                    frame_size = internal::read_message_frame_size(remaining);
-                    if (frame_size == 0 || frame_size > remaining.size())
-                        break; // Complete frame not yet available
-                    bool const done = handle_msg(remaining.first(frame_size));
-                    if (done)
-                        return handle_ed({});
-                    remaining = remaining.subspan(frame_size);
-                }
-                auto const remaining_size = remaining.size();
-                std::copy(remaining.begin(), remaining.end(), readbuf.begin());
-
-                // Ensure the rest of any partial frame will fit in the buffer
-                // on next read.
-                if (frame_size > max_message_frame_len)
-                    return handle_ed(std::error_code(errc::message_too_long));
-
-                if (frame_size > readbuf.size()) {
-                    // Grow to fit the next message frame, but to at least 1.5x
-                    // of current size to keep resizing infrequent.
-                    readbuf.resize(std::max(frame_size,
-                                            std::min(max_message_frame_len,
-                                                     3 * readbuf.size() / 2)));
-                }
+    void handle_messages() {
+        auto remaining = gsl::span(std::as_const(readbuf))
+                             .subspan(data_start, data_end - data_start);
+        std::size_t frame_size = 0;
+        std::size_t handled = 0;
+        for (;;) {
+            frame_size = internal::read_message_frame_size(remaining);
+            // Checked before completeness, because the read buffer may be
+            // larger than the frame length limit.
+            if (frame_size > max_frame_len) {
+                data_start = data_end - remaining.size();
+                return handle_ed(std::error_code(errc::message_too_long));
+            }
+            if (frame_size == 0 || frame_size > remaining.size())
+                break; // Complete frame not yet available
+            if (paused) {
+                data_start = data_end - remaining.size();
+                stalled = true;
+                return;
+            }
+            if (handled == max_messages_per_turn && handled > 0) {
+                data_start = data_end - remaining.size();
+                asio::post(sock->get_executor(),
+                           [this] { handle_messages(); });
+                return;
+            }
+            PARTAKE_TRACE1(message_received, frame_size);
+            bool const done = handle_msg(remaining.first(frame_size));
+            if (done)
+                return handle_ed({});
+            ++handled;
+            remaining = remaining.subspan(frame_size);
+        }
+        data_start = data_end - remaining.size();
 
-                if (err) { // EOF was reached.
-                    if (remaining_size > 0) {
-                        return handle_ed(
-                            std::error_code(errc::eof_in_message));
-                    }
-                    return handle_ed({});
-                }
+        if (at_eof) {
+            if (not remaining.empty())
+                return handle_ed(std::error_code(errc::eof_in_message));
+            return handle_ed({});
+        }
 
-                schedule_read(remaining_size);
-            });
+        if (paused) {
+            stalled = true;
+            return;
+        }
+
+        prepare_for_read(frame_size);
+        schedule_read();
+    }
+
+    // Ensure that the rest of the partial frame (whose size is 'frame_size',
+    // or unknown if zero) will fit, moving it to the front if necessary.
+    void prepare_for_read(std::size_t frame_size) {
+        if (data_start == data_end) {
+            data_start = data_end = 0;
+            return;
+        }
+        auto const needed =
+            std::max(frame_size, internal::round_size_up_to_alignment(
+                                     sizeof(flatbuffers::uoffset_t)));
+        if (readbuf.size() - data_start < needed ||
+            readbuf.size() - data_end < min_read_size) {
+            std::copy(readbuf.data() + data_start, readbuf.data() + data_end,
+                      readbuf.data());
+            data_end -= data_start;
+            data_start = 0;
+        }
+        if (readbuf.size() < needed)
+            readbuf.resize(std::min(std::max(needed, 2 * readbuf.size()),
+                                    max_frame_len));
     }
 };
 
@@ -15,10 +15,13 @@
 #include <fmt/core.h>
 #include <spdlog/spdlog.h>
 
+#include <array>
 #include <cstdlib> // mkstemp
 #include <cstring> // strerror_r
 #include <filesystem>
 
+#include <fcntl.h>
+#include <sys/socket.h>
 #include <unistd.h>
 
 namespace partake::common::posix {
@@ -132,6 +135,136 @@ TEST_CASE("posix::unlinkable") {
     REQUIRE(unlk.unlink());
     CHECK_FALSE(std::filesystem::exists(f.path().string()));
     CHECK(unlk.unlink()); // Idempotent
+
+    auto g = testing::unique_file_with_data(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), {});
+    {
+        unlinkable kept(g.path().string());
+        kept.keep();
+    }
+    CHECK(std::filesystem::exists(g.path().string()));
+}
+
+auto send_fd(int socket, int fd, std::shared_ptr<spdlog::logger> logger)
+    -> bool {
+    auto lgr = logger ? std::move(logger) : null_logger();
+
+    // At least one byte of ordinary data must accompany the descriptor.
+    char byte = 0;
+    ::iovec iov{};
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    alignas(::cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+    ::msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-cstyle-cast)
+    ::cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    // NOLINTEND(cppcoreguidelines-pro-type-cstyle-cast)
+
+    errno = 0;
+    if (::sendmsg(socket, &msg, 0) != 1) {
+        auto err = errno;
+        auto errmsg = strerror(err);
+        lgr->error("sendmsg: socket {}, fd {}: {} ({})", socket, fd, errmsg,
+                   err);
+        return false;
+    }
+    lgr->info("sendmsg: socket {}, fd {}: success", socket, fd);
+    return true;
+}
+
+auto receive_fd(int socket, std::shared_ptr<spdlog::logger> logger)
+    -> file_descriptor {
+    auto lgr = logger ? std::move(logger) : null_logger();
+
+    char byte = 0;
+    ::iovec iov{};
+    iov.iov_base = &byte;
+    iov.iov_len = 1;
+    alignas(::cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+    ::msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+#ifdef MSG_CMSG_CLOEXEC
+    int const flags = MSG_CMSG_CLOEXEC;
+#else
+    int const flags = 0;
+#endif
+    errno = 0;
+    auto const received = ::recvmsg(socket, &msg, flags);
+    if (received < 0) {
+        auto err = errno;
+        auto errmsg = strerror(err);
+        lgr->error("recvmsg: socket {}: {} ({})", socket, errmsg, err);
+        return {};
+    }
+
+    int fd = file_descriptor::invalid_fd;
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-cstyle-cast)
+    for (::cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+            std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    }
+    // NOLINTEND(cppcoreguidelines-pro-type-cstyle-cast)
+    if (fd == file_descriptor::invalid_fd ||
+        (msg.msg_flags & MSG_CTRUNC) != 0) {
+        lgr->error("recvmsg: socket {}: no descriptor received", socket);
+        return {};
+    }
+    lgr->info("recvmsg: socket {}: received fd {}", socket, fd);
+    auto ret = file_descriptor(fd, lgr);
+
+#ifndef MSG_CMSG_CLOEXEC
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    if (::fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+        auto err = errno;
+        auto errmsg = strerror(err);
+        lgr->warn("fcntl: F_SETFD: fd {}: {} ({})", fd, errmsg, err);
+    }
+#endif
+    return ret;
+}
+
+TEST_CASE("posix::send_fd") {
+    std::array<int, 2> sv{};
+    REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM, 0, sv.data()) == 0);
+    file_descriptor sock0(sv[0]);
+    file_descriptor const sock1(sv[1]);
+
+    testing::tempdir const td;
+    std::array<std::uint8_t, 1> const data{'x'};
+    auto f = testing::unique_file_with_data(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__), data);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    file_descriptor const fd(::open(f.path().string().c_str(), O_RDONLY));
+    REQUIRE(fd.is_valid());
+
+    SUBCASE("descriptor received") {
+        REQUIRE(send_fd(sock0.get(), fd.get()));
+        auto const received = receive_fd(sock1.get());
+        REQUIRE(received.is_valid());
+        CHECK(received.get() != fd.get());
+        char c = 0;
+        CHECK(::read(received.get(), &c, 1) == 1);
+        CHECK(c == 'x');
+    }
+
+    SUBCASE("peer closed") {
+        REQUIRE(sock0.close());
+        CHECK_FALSE(receive_fd(sock1.get()).is_valid());
+    }
 }
 
 } // namespace partake::common::posix
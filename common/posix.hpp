@@ -76,6 +76,7 @@ class unlinkable {
     unlink_func unlink_fn = nullptr;
     std::string fn_name;
     std::shared_ptr<spdlog::logger> lgr;
+    bool kept = false;
 
   public:
     unlinkable() noexcept = default;
@@ -92,7 +93,10 @@ class unlinkable {
         assert(not func_name.empty());
     }
 
-    ~unlinkable() { unlink(); }
+    ~unlinkable() {
+        if (not kept)
+            unlink();
+    }
 
     unlinkable(unlinkable const &) = delete;
     auto operator=(unlinkable const &) = delete;
@@ -101,17 +105,23 @@ class unlinkable {
         : nm(std::exchange(other.nm, {})),
           unlink_fn(std::exchange(other.unlink_fn, nullptr)),
           fn_name(std::exchange(other.fn_name, {})),
-          lgr(std::exchange(other.lgr, {})) {}
+          lgr(std::exchange(other.lgr, {})),
+          kept(std::exchange(other.kept, false)) {}
 
     auto operator=(unlinkable &&rhs) noexcept -> unlinkable & {
-        unlink();
+        if (not kept)
+            unlink();
         nm = std::exchange(rhs.nm, {});
         unlink_fn = std::exchange(rhs.unlink_fn, nullptr);
         fn_name = std::exchange(rhs.fn_name, {});
         lgr = std::exchange(rhs.lgr, {});
+        kept = std::exchange(rhs.kept, false);
         return *this;
     }
 
+    // Do not unlink upon destruction (explicit unlink() still works).
+    void keep() noexcept { kept = true; }
+
     [[nodiscard]] auto is_valid() const noexcept -> bool {
         return not nm.empty();
     }
@@ -136,6 +146,17 @@ class unlinkable {
     }
 };
 
+// Send a duplicate of 'fd' over the connected Unix domain socket 'socket'
+// (SCM_RIGHTS). Log and return false on failure.
+auto send_fd(int socket, int fd, std::shared_ptr<spdlog::logger> logger = {})
+    -> bool;
+
+// Receive a descriptor sent with send_fd() over 'socket', blocking until it
+// arrives. The received descriptor is close-on-exec. Log and return an
+// invalid file_descriptor on failure or if the peer sent no descriptor.
+auto receive_fd(int socket, std::shared_ptr<spdlog::logger> logger = {})
+    -> file_descriptor;
+
 } // namespace partake::common::posix
 
 #endif // _WIN32
@@ -37,6 +37,11 @@ auto random_string(std::size_t len) -> std::string {
     return ret;
 }
 
+auto random_uint64() -> std::uint64_t {
+    auto &rd = randev();
+    return std::uniform_int_distribution<std::uint64_t>()(rd);
+}
+
 TEST_CASE("random_string") {
     CHECK(random_string(0).empty());
 
@@ -50,4 +55,9 @@ TEST_CASE("random_string") {
                       [](char c) { return std::isalnum(c); }));
 }
 
+TEST_CASE("random_uint64") {
+    // Chance of false failure is negligible.
+    CHECK(random_uint64() != random_uint64());
+}
+
 } // namespace partake::common
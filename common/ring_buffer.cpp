@@ -0,0 +1,135 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "ring_buffer.hpp"
+
+#include <doctest.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace partake::common {
+
+namespace {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+struct alignas(64) ring_region {
+    std::array<std::uint8_t, basic_ring_buffer::required_size(8, 4)> bytes{};
+};
+
+} // namespace
+
+TEST_CASE("basic_ring_buffer") {
+    CHECK(basic_ring_buffer::slot_stride(1) == 24);
+    CHECK(basic_ring_buffer::slot_stride(8) == 24);
+    CHECK(basic_ring_buffer::slot_stride(9) == 32);
+    CHECK(basic_ring_buffer::is_valid_geometry(8, 4));
+    CHECK_FALSE(basic_ring_buffer::is_valid_geometry(0, 4));
+    CHECK_FALSE(basic_ring_buffer::is_valid_geometry(8, 0));
+    CHECK_FALSE(basic_ring_buffer::is_valid_geometry(8, 3));
+
+    ring_region region;
+    CHECK_FALSE(basic_ring_buffer::attach(region.bytes).is_valid());
+
+    auto prod = basic_ring_buffer::create(region.bytes, 8, 4);
+    auto cons = basic_ring_buffer::attach(region.bytes);
+    REQUIRE(cons.is_valid());
+    CHECK(cons.slot_size() == 8);
+    CHECK(cons.slot_count() == 4);
+    CHECK_FALSE(basic_ring_buffer::attach(
+                    gsl::span(region.bytes).first(region.bytes.size() - 1))
+                    .is_valid());
+
+    std::array<std::uint8_t, 8> buf{};
+    CHECK_FALSE(cons.try_pop(buf).has_value());
+
+    SUBCASE("records are read in order") {
+        std::array<std::uint8_t, 3> const r0{1, 2, 3};
+        std::array<std::uint8_t, 8> const r1{4, 5, 6, 7, 8, 9, 10, 11};
+        REQUIRE(prod.try_push(r0));
+        REQUIRE(prod.try_push(r1));
+        auto len = cons.try_pop(buf);
+        REQUIRE(len.has_value());
+        CHECK(*len == 3);
+        CHECK(buf[2] == 3);
+        len = cons.try_pop(buf);
+        REQUIRE(len.has_value());
+        CHECK(*len == 8);
+        CHECK(buf == r1);
+        CHECK_FALSE(cons.try_pop(buf).has_value());
+    }
+
+    SUBCASE("full ring rejects pushes and wraps around") {
+        std::array<std::uint8_t, 1> rec{};
+        for (std::uint8_t i = 0; i < 4; ++i) {
+            rec[0] = i;
+            REQUIRE(prod.try_push(rec));
+        }
+        CHECK_FALSE(prod.try_push(rec));
+        REQUIRE(cons.try_pop(buf).has_value());
+        CHECK(buf[0] == 0);
+        rec[0] = 4;
+        REQUIRE(prod.try_push(rec));
+        for (std::uint8_t i = 1; i < 5; ++i) {
+            REQUIRE(cons.try_pop(buf).has_value());
+            CHECK(buf[0] == i);
+        }
+        CHECK_FALSE(cons.try_pop(buf).has_value());
+    }
+}
+
+TEST_CASE("ring_buffer: concurrent producers and consumers") {
+    using ring_type = ring_buffer<std::uint64_t>;
+    struct alignas(64) {
+        std::array<std::uint8_t, ring_type::required_size(16)> bytes{};
+    } region;
+    auto ring = ring_type::create(region.bytes, 16);
+    REQUIRE(ring.is_valid());
+    CHECK(ring.capacity() == 16);
+    CHECK_FALSE(ring_buffer<std::uint32_t>::attach(region.bytes).is_valid());
+
+    constexpr std::uint64_t per_producer = 10000;
+    std::vector<std::thread> producers;
+    for (std::uint64_t p = 0; p < 2; ++p) {
+        producers.emplace_back([&, p] {
+            auto r = ring_type::attach(region.bytes);
+            for (std::uint64_t i = 1; i <= per_producer; ++i) {
+                while (not r.try_push(p * per_producer + i))
+                    std::this_thread::yield();
+            }
+        });
+    }
+    std::array<std::uint64_t, 2> sums{};
+    std::vector<std::thread> consumers;
+    for (std::size_t c = 0; c < 2; ++c) {
+        consumers.emplace_back([&, c] {
+            auto r = ring_type::attach(region.bytes);
+            for (std::uint64_t n = 0; n < per_producer; ++n) {
+                auto v = r.try_pop();
+                while (not v.has_value()) {
+                    std::this_thread::yield();
+                    v = r.try_pop();
+                }
+                sums[c] += *v;
+            }
+        });
+    }
+    for (auto &t : producers)
+        t.join();
+    for (auto &t : consumers)
+        t.join();
+    auto const n = 2 * per_producer;
+    CHECK(sums[0] + sums[1] == n * (n + 1) / 2);
+    CHECK_FALSE(ring.try_pop().has_value());
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::common
@@ -0,0 +1,291 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <gsl/span>
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace partake::common {
+
+// A bounded multi-producer, multi-consumer queue of fixed-size slots, placed
+// in a caller-provided memory region. This is the layout of the objects
+// created by RingRequest, so that processes sharing the object can stream
+// small records to each other with no requests to partaked per record.
+//
+// The region starts with a header holding the slot geometry and the
+// enqueue and dequeue positions (each on its own cache line), followed by
+// the slots. Each slot holds a sequence number, the record length, and up
+// to slot_size() bytes of data. The sequence number says whether the slot is
+// ready to be written or read at a given position, so that producers and
+// consumers only contend on their own position (D. Vyukov's bounded MPMC
+// queue). With a single producer and a single consumer, no operation ever
+// retries.
+//
+// Waking up a consumer that is blocked (e.g., when the ring was found empty)
+// is not handled here; the object's wake word (see wake_word.hpp) can be
+// used for that.
+class basic_ring_buffer {
+    static constexpr std::size_t cache_line_size = 64;
+    static constexpr std::uint32_t ring_magic = 0x4752'4b50; // "PKRG"
+
+    struct header {
+        std::uint32_t magic;
+        std::uint32_t slot_size;
+        std::uint32_t slot_count;
+        alignas(cache_line_size) std::atomic<std::uint64_t> enqueue_pos;
+        alignas(cache_line_size) std::atomic<std::uint64_t> dequeue_pos;
+    };
+
+    struct slot_header {
+        std::atomic<std::uint64_t> seq;
+        std::uint32_t length;
+    };
+
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+    header *hdr = nullptr;
+    std::uint8_t *slots = nullptr;
+    std::size_t stride = 0;
+    std::uint64_t mask = 0;
+
+    explicit basic_ring_buffer(gsl::span<std::uint8_t> region) {
+        assert(reinterpret_cast<std::uintptr_t>(region.data()) %
+                   alignof(header) ==
+               0);
+        hdr = reinterpret_cast<header *>(region.data());
+        slots = region.data() + header_size;
+    }
+
+    void set_geometry() noexcept {
+        stride = slot_stride(hdr->slot_size);
+        mask = hdr->slot_count - 1;
+    }
+
+    [[nodiscard]] auto slot(std::uint64_t pos) const noexcept
+        -> slot_header * {
+        return reinterpret_cast<slot_header *>(
+            slots + static_cast<std::size_t>(pos & mask) * stride);
+    }
+
+    [[nodiscard]] static auto data_of(slot_header *s) noexcept
+        -> std::uint8_t * {
+        return reinterpret_cast<std::uint8_t *>(s) + sizeof(slot_header);
+    }
+
+  public:
+    static constexpr std::size_t header_size = sizeof(header);
+
+    // Required alignment of the region.
+    static constexpr std::size_t alignment = alignof(header);
+
+    // Largest slot size and count accepted by create().
+    static constexpr std::uint32_t max_slot_size = 1u << 20;
+    static constexpr std::uint32_t max_slot_count = 1u << 24;
+
+    // Construct in empty state, on which the only valid operations are
+    // destruction, assignment, and is_valid().
+    basic_ring_buffer() noexcept = default;
+
+    [[nodiscard]] static constexpr auto slot_stride(std::size_t slot_size)
+        -> std::size_t {
+        auto const align = alignof(slot_header);
+        return (sizeof(slot_header) + slot_size + align - 1) & ~(align - 1);
+    }
+
+    // Whether create() accepts the geometry: the slot count must be a power
+    // of 2.
+    [[nodiscard]] static constexpr auto
+    is_valid_geometry(std::size_t slot_size, std::size_t slot_count) -> bool {
+        return slot_size > 0 && slot_size <= max_slot_size &&
+               slot_count > 0 && slot_count <= max_slot_count &&
+               (slot_count & (slot_count - 1)) == 0;
+    }
+
+    // Size of the region needed for a ring of the given (valid) geometry.
+    [[nodiscard]] static constexpr auto required_size(std::size_t slot_size,
+                                                      std::size_t slot_count)
+        -> std::size_t {
+        return header_size + slot_stride(slot_size) * slot_count;
+    }
+
+    // Initialize a new, empty ring in 'region', which must be aligned to a
+    // cache line and at least required_size() bytes long. Only one side
+    // (normally partaked) should do this, before others attach.
+    [[nodiscard]] static auto create(gsl::span<std::uint8_t> region,
+                                     std::uint32_t slot_size,
+                                     std::uint32_t slot_count)
+        -> basic_ring_buffer {
+        assert(is_valid_geometry(slot_size, slot_count));
+        assert(region.size() >= required_size(slot_size, slot_count));
+        auto ring = basic_ring_buffer(region);
+        new (ring.hdr) header{ring_magic, slot_size, slot_count, {0}, {0}};
+        ring.set_geometry();
+        for (std::uint32_t i = 0; i < slot_count; ++i)
+            new (ring.slot(i)) slot_header{{i}, 0};
+        return ring;
+    }
+
+    // Attach to a ring previously created in 'region' (which may be at a
+    // different address). The result is not valid if the region does not
+    // hold a ring that fits in it.
+    [[nodiscard]] static auto attach(gsl::span<std::uint8_t> region)
+        -> basic_ring_buffer {
+        if (region.size() < header_size)
+            return {};
+        auto ring = basic_ring_buffer(region);
+        auto const *h = ring.hdr;
+        if (h->magic != ring_magic ||
+            not is_valid_geometry(h->slot_size, h->slot_count) ||
+            region.size() < required_size(h->slot_size, h->slot_count))
+            return {};
+        ring.set_geometry();
+        return ring;
+    }
+
+    [[nodiscard]] auto is_valid() const noexcept -> bool {
+        return hdr != nullptr;
+    }
+
+    [[nodiscard]] auto slot_size() const noexcept -> std::size_t {
+        assert(is_valid());
+        return hdr->slot_size;
+    }
+
+    [[nodiscard]] auto slot_count() const noexcept -> std::size_t {
+        assert(is_valid());
+        return hdr->slot_count;
+    }
+
+    // Producer side. Append the record, which must not be longer than
+    // slot_size(). Return false if the ring is full.
+    [[nodiscard]] auto try_push(gsl::span<std::uint8_t const> record)
+        -> bool {
+        assert(is_valid());
+        assert(record.size() <= hdr->slot_size);
+        auto pos = hdr->enqueue_pos.load(std::memory_order_relaxed);
+        slot_header *s = nullptr;
+        for (;;) {
+            s = slot(pos);
+            auto const seq = s->seq.load(std::memory_order_acquire);
+            auto const diff = static_cast<std::int64_t>(seq - pos);
+            if (diff == 0) {
+                if (hdr->enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = hdr->enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        std::memcpy(data_of(s), record.data(), record.size());
+        s->length = static_cast<std::uint32_t>(record.size());
+        s->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. If a record is available, copy it into 'buffer' (which
+    // must be at least slot_size() long), consume it, and return its length.
+    // Otherwise return nullopt.
+    [[nodiscard]] auto try_pop(gsl::span<std::uint8_t> buffer)
+        -> std::optional<std::size_t> {
+        assert(is_valid());
+        assert(buffer.size() >= hdr->slot_size);
+        auto pos = hdr->dequeue_pos.load(std::memory_order_relaxed);
+        slot_header *s = nullptr;
+        for (;;) {
+            s = slot(pos);
+            auto const seq = s->seq.load(std::memory_order_acquire);
+            auto const diff = static_cast<std::int64_t>(seq - (pos + 1));
+            if (diff == 0) {
+                if (hdr->dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return std::nullopt;
+            } else {
+                pos = hdr->dequeue_pos.load(std::memory_order_relaxed);
+            }
+        }
+        // A misbehaving producer could have stored an invalid length.
+        auto const len = std::min<std::size_t>(s->length, hdr->slot_size);
+        std::memcpy(buffer.data(), data_of(s), len);
+        s->seq.store(pos + mask + 1, std::memory_order_release);
+        return len;
+    }
+};
+
+// Typed access to a ring whose slot size is sizeof(T).
+template <typename T> class ring_buffer {
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(std::is_default_constructible_v<T>);
+
+    basic_ring_buffer ring;
+
+    explicit ring_buffer(basic_ring_buffer &&r) noexcept
+        : ring(std::move(r)) {}
+
+  public:
+    ring_buffer() noexcept = default;
+
+    // Geometry to request for a ring of 'count' elements.
+    static constexpr std::uint32_t slot_size = sizeof(T);
+    [[nodiscard]] static constexpr auto required_size(std::size_t count)
+        -> std::size_t {
+        return basic_ring_buffer::required_size(sizeof(T), count);
+    }
+
+    [[nodiscard]] static auto create(gsl::span<std::uint8_t> region,
+                                     std::uint32_t count) -> ring_buffer {
+        return ring_buffer(
+            basic_ring_buffer::create(region, slot_size, count));
+    }
+
+    // The result is not valid if the region does not hold a ring of T.
+    [[nodiscard]] static auto attach(gsl::span<std::uint8_t> region)
+        -> ring_buffer {
+        auto r = basic_ring_buffer::attach(region);
+        if (r.is_valid() && r.slot_size() != sizeof(T))
+            return {};
+        return ring_buffer(std::move(r));
+    }
+
+    [[nodiscard]] auto is_valid() const noexcept -> bool {
+        return ring.is_valid();
+    }
+
+    [[nodiscard]] auto capacity() const noexcept -> std::size_t {
+        return ring.slot_count();
+    }
+
+    [[nodiscard]] auto try_push(T const &value) -> bool {
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        return ring.try_push({reinterpret_cast<std::uint8_t const *>(&value),
+                              sizeof(T)});
+    }
+
+    [[nodiscard]] auto try_pop() -> std::optional<T> {
+        T value;
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        if (not ring.try_pop({reinterpret_cast<std::uint8_t *>(&value),
+                              sizeof(T)}))
+            return std::nullopt;
+        return value;
+    }
+};
+
+} // namespace partake::common
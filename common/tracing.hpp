@@ -0,0 +1,39 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+// Static tracepoints (USDT probes, under the provider name 'partake'), for
+// correlating the timing of message handling with that of other processes
+// using tools such as bpftrace, perf, or SystemTap (which record their own
+// timestamps). Enabled by building with -Dusdt=enabled (which requires
+// <sys/sdt.h>); otherwise the macros expand to nothing and their arguments
+// are not evaluated. An enabled probe costs a no-op instruction until a
+// tracer attaches to it.
+//
+// Probes (all arguments are 64-bit unsigned integers):
+//   message_received(frame_size)     - async_message_reader, before handling
+//   message_written(count, bytes)    - async_message_writer, upon completion
+//   request_dispatch(type, seqno)    - partaked, before handling a request
+//   share_resume(count)              - partaked, resuming requests waiting
+//                                      for an object to be shared
+
+#ifdef PARTAKE_USDT
+
+#include <sys/sdt.h>
+
+#include <cstdint>
+
+#define PARTAKE_TRACE1(name, a) DTRACE_PROBE1(partake, name, std::uint64_t(a))
+#define PARTAKE_TRACE2(name, a, b)                                            \
+    DTRACE_PROBE2(partake, name, std::uint64_t(a), std::uint64_t(b))
+
+#else // PARTAKE_USDT
+
+#define PARTAKE_TRACE1(name, a) ((void)sizeof(a))
+#define PARTAKE_TRACE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+
+#endif // PARTAKE_USDT
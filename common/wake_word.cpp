@@ -0,0 +1,125 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wake_word.hpp"
+
+#include <doctest.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <thread>
+
+#ifdef __linux__
+#include <cerrno>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace partake::common {
+
+#ifdef __linux__
+
+namespace {
+
+auto futex(std::atomic<std::uint32_t> &word, int op, std::uint32_t val,
+           timespec const *timeout) -> long {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    return ::syscall(SYS_futex, &word, op, val, timeout, nullptr, 0);
+}
+
+} // namespace
+
+auto wait_on_wake_word(std::atomic<std::uint32_t> &word,
+                       std::uint32_t expected,
+                       std::chrono::microseconds timeout) -> bool {
+    timespec ts{};
+    timespec const *pts = nullptr;
+    if (timeout.count() > 0) {
+        auto const secs =
+            std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        ts.tv_sec = static_cast<time_t>(secs.count());
+        ts.tv_nsec = static_cast<long>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(timeout -
+                                                                 secs)
+                .count());
+        pts = &ts;
+    }
+    // EAGAIN (word did not equal 'expected') and EINTR are treated as
+    // (spurious) wakeups.
+    return not(futex(word, FUTEX_WAIT, expected, pts) != 0 &&
+               errno == ETIMEDOUT);
+}
+
+void wake_one(std::atomic<std::uint32_t> &word) {
+    futex(word, FUTEX_WAKE, 1, nullptr);
+}
+
+void wake_all(std::atomic<std::uint32_t> &word) {
+    futex(word, FUTEX_WAKE, INT_MAX, nullptr);
+}
+
+#else // __linux__
+
+auto wait_on_wake_word(std::atomic<std::uint32_t> &word,
+                       std::uint32_t expected,
+                       std::chrono::microseconds timeout) -> bool {
+    // There is no portable cross-process address wait (Win32 WaitOnAddress
+    // only works within a process), so poll.
+    static constexpr auto poll_interval = std::chrono::microseconds(50);
+    auto const deadline = std::chrono::steady_clock::now() + timeout;
+    while (word.load(std::memory_order_acquire) == expected) {
+        if (timeout.count() > 0 &&
+            std::chrono::steady_clock::now() >= deadline)
+            return false;
+        std::this_thread::sleep_for(poll_interval);
+    }
+    return true;
+}
+
+void wake_one(std::atomic<std::uint32_t> & /* word */) {}
+
+void wake_all(std::atomic<std::uint32_t> & /* word */) {}
+
+#endif // __linux__
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("wake_word") {
+    std::array<std::uint32_t, 4> region{};
+    auto &word = wake_word_at(region.data(), 8);
+    CHECK(static_cast<void *>(&word) == static_cast<void *>(&region[2]));
+
+    SUBCASE("no wait if value differs") {
+        word.store(1);
+        CHECK(wait_on_wake_word(word, 0, std::chrono::milliseconds(100)));
+    }
+
+    SUBCASE("timeout") {
+        CHECK_FALSE(wait_on_wake_word(word, 0, std::chrono::milliseconds(1)));
+    }
+
+    SUBCASE("wake") {
+        std::thread t([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            word.store(1, std::memory_order_release);
+            wake_all(word);
+        });
+        while (word.load(std::memory_order_acquire) == 0)
+            (void)wait_on_wake_word(word, 0);
+        CHECK(word.load() == 1);
+        t.join();
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::common
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+
+namespace partake::common {
+
+// Blocking and waking on a 32-bit word in shared memory, such as the wake
+// word that partaked reserves for each PRIMITIVE object when run with
+// --wake-words. This lets processes sharing an object (e.g., a flag or a
+// queue) signal each other directly, without spinning and without going
+// through partaked.
+//
+// On Linux this is a (non-private, so cross-process) futex. Elsewhere,
+// waiting falls back to polling the word with short sleeps, and waking is a
+// no-op.
+
+static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t));
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free);
+
+// The wake word at 'offset' in the segment mapped at 'segment_base'.
+[[nodiscard]] inline auto wake_word_at(void *segment_base,
+                                       std::uint64_t offset) noexcept
+    -> std::atomic<std::uint32_t> & {
+    assert(offset % sizeof(std::uint32_t) == 0);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    return *reinterpret_cast<std::atomic<std::uint32_t> *>(
+        static_cast<char *>(segment_base) + offset);
+}
+
+// Block while 'word' equals 'expected', until woken by wake_one() or
+// wake_all(), or until 'timeout' (if positive) has elapsed. Spurious
+// wakeups are possible, so callers should re-check the word (or what it
+// guards) in a loop. Return false if the timeout elapsed.
+auto wait_on_wake_word(std::atomic<std::uint32_t> &word,
+                       std::uint32_t expected,
+                       std::chrono::microseconds timeout =
+                           std::chrono::microseconds(0)) -> bool;
+
+// Wake up to one process or thread blocked on 'word'. The caller should
+// have modified the word beforehand.
+void wake_one(std::atomic<std::uint32_t> &word);
+
+// Wake all processes and threads blocked on 'word'.
+void wake_all(std::atomic<std::uint32_t> &word);
+
+} // namespace partake::common
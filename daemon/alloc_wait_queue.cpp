@@ -0,0 +1,84 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "alloc_wait_queue.hpp"
+
+#include <doctest.h>
+
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("alloc_wait_queue") {
+    alloc_wait_queue q;
+    int const owner1 = 0;
+    int const owner2 = 0;
+    std::vector<int> retried;
+    int available = 0; // Number of waiters that can complete
+    auto const waiter = [&](int i) {
+        return [&, i] {
+            retried.push_back(i);
+            if (available == 0)
+                return false;
+            --available;
+            return true;
+        };
+    };
+    q.enqueue(&owner1, waiter(1));
+    q.enqueue(&owner2, waiter(2));
+    q.enqueue(&owner1, waiter(3));
+    CHECK(q.size() == 3);
+
+    SUBCASE("not retried until freed") {
+        available = 3;
+        q.retry();
+        CHECK(retried.empty());
+    }
+
+    SUBCASE("retried in order until one cannot complete") {
+        q.notify_freed();
+        q.retry();
+        CHECK(retried == std::vector<int>{1});
+        CHECK(q.size() == 3);
+        q.retry(); // Not freed since last retry
+        CHECK(retried.size() == 1);
+
+        available = 2;
+        q.notify_freed();
+        q.retry();
+        CHECK(retried == std::vector<int>{1, 1, 2, 3});
+        CHECK(q.size() == 1);
+    }
+
+    SUBCASE("drop") {
+        q.drop(&owner1);
+        CHECK(q.size() == 1);
+        available = 3;
+        q.notify_freed();
+        q.retry();
+        CHECK(retried == std::vector<int>{2});
+        CHECK(q.size() == 0);
+    }
+
+    SUBCASE("hold") {
+        available = 3;
+        q.hold();
+        CHECK(q.is_held());
+        q.notify_freed();
+        q.retry();
+        CHECK(retried.empty());
+        q.release();
+        CHECK_FALSE(q.is_held());
+        q.retry(); // Retried even though nothing was freed
+        CHECK(retried == std::vector<int>{1, 2, 3});
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
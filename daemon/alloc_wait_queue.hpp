@@ -0,0 +1,103 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "small_function.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <utility>
+
+namespace partake::daemon {
+
+// FIFO of allocations (from all sessions) waiting for shared memory to be
+// freed. When retry() is called, after notify_freed() has been called at
+// least once since the last retry, waiters are retried in order, stopping at
+// the first one that still cannot allocate. Thus a large request is not
+// starved by smaller ones that could fit in its place.
+//
+// Retrying is deferred to retry() (called during housekeeping), because
+// memory is freed when objects are destroyed, which can happen during
+// arbitrary operations on sessions and handles.
+//
+// The queue can also be put on hold (while shared memory is not yet ready for
+// use, at startup), in which case sessions enqueue all allocations and retry()
+// does nothing until release() is called.
+//
+// Retry functions must not enqueue or drop waiters.
+class alloc_wait_queue {
+  public:
+    // Return true if the waiter is done (whether or not it succeeded), or
+    // false to keep waiting.
+    using retry_func = small_function<bool()>;
+
+  private:
+    struct waiter {
+        void const *owner;
+        retry_func retry;
+    };
+
+    std::deque<waiter> waiters;
+    bool freed = false;
+    bool retrying = false;
+    bool held = false;
+
+  public:
+    alloc_wait_queue() = default;
+
+    // No move or copy (retry functions may refer to the queue's owner)
+    ~alloc_wait_queue() = default;
+    alloc_wait_queue(alloc_wait_queue const &) = delete;
+    auto operator=(alloc_wait_queue const &) = delete;
+    alloc_wait_queue(alloc_wait_queue &&) = delete;
+    auto operator=(alloc_wait_queue &&) = delete;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return waiters.size();
+    }
+
+    void enqueue(void const *owner, retry_func retry) {
+        assert(not retrying);
+        waiters.push_back({owner, std::move(retry)});
+    }
+
+    // Remove all waiters of 'owner', without calling them.
+    void drop(void const *owner) {
+        assert(not retrying);
+        waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                                     [owner](waiter const &w) {
+                                         return w.owner == owner;
+                                     }),
+                      waiters.end());
+    }
+
+    void notify_freed() noexcept { freed = true; }
+
+    [[nodiscard]] auto is_held() const noexcept -> bool { return held; }
+
+    void hold() noexcept { held = true; }
+
+    // Waiters are retried at the next retry().
+    void release() noexcept {
+        held = false;
+        freed = true;
+    }
+
+    void retry() {
+        if (not freed || retrying || held)
+            return;
+        freed = false;
+        retrying = true;
+        while (not waiters.empty() && waiters.front().retry())
+            waiters.pop_front();
+        retrying = false;
+    }
+};
+
+} // namespace partake::daemon
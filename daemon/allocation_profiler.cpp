@@ -0,0 +1,101 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "allocation_profiler.hpp"
+
+#include "sizes.hpp"
+
+#include <doctest.h>
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+namespace partake::daemon {
+
+void log_allocation_profiles(allocation_profiler const &profiler) {
+    if (profiler.sample_interval() == 0) {
+        spdlog::info("allocation profiling is not enabled");
+        return;
+    }
+    spdlog::info("allocation profile (1 in {} allocations sampled):",
+                 profiler.sample_interval());
+    for (auto const &prof : profiler.profiles()) {
+        auto const mean =
+            prof.sampled_allocations > 0
+                ? std::size_t(prof.sampled_bytes / prof.sampled_allocations)
+                : std::size_t(0);
+        auto const lifetime_ms = [&](double q) {
+            return std::chrono::duration<double, std::milli>(
+                       prof.lifetimes.quantile(q))
+                .count();
+        };
+        spdlog::info(
+            "  {} (pid {}): {} sampled, mean size {}, {} live; lifetime p50 {:.3f} ms, p99 {:.3f} ms",
+            prof.client_name.empty() ? "(other clients)" : prof.client_name,
+            prof.client_pid, prof.sampled_allocations,
+            human_readable_size(mean), prof.live_samples, lifetime_ms(0.5),
+            lifetime_ms(0.99));
+    }
+}
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("allocation_profiler") {
+    allocation_profiler prof;
+    CHECK_FALSE(prof.should_sample());
+
+    SUBCASE("sample interval") {
+        prof.set_sample_interval(3);
+        CHECK_FALSE(prof.should_sample());
+        CHECK_FALSE(prof.should_sample());
+        CHECK(prof.should_sample());
+        CHECK_FALSE(prof.should_sample());
+        CHECK_FALSE(prof.should_sample());
+        CHECK(prof.should_sample());
+        prof.set_sample_interval(0);
+        CHECK_FALSE(prof.should_sample());
+    }
+
+    SUBCASE("per-client aggregation") {
+        prof.set_sample_interval(1);
+        auto const a0 = prof.record_allocation("a", 10, 1);
+        auto const b0 = prof.record_allocation("b", 20, 4096);
+        auto const a1 = prof.record_allocation("a", 10, 3);
+        CHECK(a0 == a1);
+        CHECK(a0 != b0);
+        CHECK(prof.record_allocation("a", 11, 5) != a0); // Different pid
+
+        prof.record_free(a0, std::chrono::milliseconds(2));
+        auto const &profs = prof.profiles();
+        REQUIRE(profs.size() == 3);
+        CHECK(profs[0].client_name == "a");
+        CHECK(profs[0].client_pid == 10);
+        CHECK(profs[0].sampled_allocations == 2);
+        CHECK(profs[0].sampled_bytes == 4);
+        CHECK(profs[0].live_samples == 1);
+        CHECK(profs[0].size_log2_counts[0] == 1);
+        CHECK(profs[0].size_log2_counts[2] == 1);
+        CHECK(profs[0].lifetimes.count() == 1);
+        CHECK(profs[1].size_log2_counts[12] == 1);
+        CHECK(profs[1].lifetimes.count() == 0);
+    }
+
+    SUBCASE("clients beyond the maximum share a profile") {
+        for (std::uint32_t pid = 0; pid < max_profiled_clients; ++pid)
+            (void)prof.record_allocation("c", pid + 1, 1);
+        auto const i = prof.record_allocation("c", 5000, 1);
+        CHECK(i == max_profiled_clients);
+        CHECK(prof.record_allocation("d", 1, 1) == i);
+        CHECK(prof.profiles()[i].client_name.empty());
+        CHECK(prof.profiles()[i].sampled_allocations == 2);
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
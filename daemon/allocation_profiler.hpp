@@ -0,0 +1,141 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "config.hpp"
+#include "stats.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+// Sampled allocations of one client (identified by name and pid), or of all
+// clients beyond max_profiled_clients (with empty name and pid 0).
+struct client_allocation_profile {
+    std::string client_name;
+    std::uint32_t client_pid = 0;
+    std::uint64_t sampled_allocations = 0;
+    std::uint64_t sampled_bytes = 0;
+    std::uint64_t live_samples = 0; // Sampled objects not yet destroyed
+
+    // Element i counts the sampled allocations whose size is in
+    // (2^(i-1), 2^i] (element 0: sizes 0 and 1).
+    std::array<std::uint64_t, 8 * sizeof(std::size_t) + 1> size_log2_counts{};
+
+    // Of the sampled objects that have been destroyed.
+    latency_histogram lifetimes;
+};
+
+// Records 1 in every sample_interval() allocations made by sessions, with
+// the lifetime of the object once it is destroyed, aggregated per client.
+// This shows which clients allocate which sizes and for how long they hold
+// them, to guide the choice of granularity and allocator (and to find the
+// clients that fragment shared memory). Every Nth allocation, rather than a
+// random one, is sampled, so that deciding costs a decrement.
+//
+// Profiles are kept after their clients disconnect, so that short-lived
+// clients are counted.
+class allocation_profiler {
+    std::size_t interval = 0; // Disabled if zero
+    std::size_t countdown = 0;
+    std::vector<client_allocation_profile> profs;
+    std::map<std::pair<std::string, std::uint32_t>, std::size_t> index;
+
+  public:
+    allocation_profiler() = default;
+
+    // No move or copy (recyclers of sampled objects keep a pointer)
+    ~allocation_profiler() = default;
+    allocation_profiler(allocation_profiler const &) = delete;
+    auto operator=(allocation_profiler const &) = delete;
+    allocation_profiler(allocation_profiler &&) = delete;
+    auto operator=(allocation_profiler &&) = delete;
+
+    [[nodiscard]] auto sample_interval() const noexcept -> std::size_t {
+        return interval;
+    }
+
+    // Sample 1 in every 'n' allocations; disable sampling if 'n' is zero.
+    void set_sample_interval(std::size_t n) noexcept {
+        interval = n;
+        countdown = n;
+    }
+
+    // Return true if the allocation about to be made should be sampled.
+    [[nodiscard]] auto should_sample() noexcept -> bool {
+        if (interval == 0 || --countdown != 0)
+            return false;
+        countdown = interval;
+        return true;
+    }
+
+    // Record a sampled allocation and return the index of the client's
+    // profile, to be passed to record_free() when the object is destroyed.
+    auto record_allocation(std::string_view client_name,
+                           std::uint32_t client_pid, std::size_t size)
+        -> std::size_t {
+        auto const i = profile_index(client_name, client_pid);
+        auto &prof = profs[i];
+        ++prof.sampled_allocations;
+        prof.sampled_bytes += size;
+        ++prof.live_samples;
+        ++prof.size_log2_counts[size_bin(size)];
+        return i;
+    }
+
+    void record_free(std::size_t profile_index,
+                     std::chrono::nanoseconds lifetime) noexcept {
+        auto &prof = profs[profile_index];
+        --prof.live_samples;
+        prof.lifetimes.record(lifetime);
+    }
+
+    // In order of each client's first sampled allocation.
+    [[nodiscard]] auto profiles() const noexcept
+        -> std::vector<client_allocation_profile> const & {
+        return profs;
+    }
+
+  private:
+    static auto size_bin(std::size_t size) noexcept -> std::size_t {
+        if (size <= 1)
+            return 0;
+        return 8 * sizeof(std::size_t) -
+               static_cast<std::size_t>(internal::countl_zero(size - 1));
+    }
+
+    auto profile_index(std::string_view client_name,
+                       std::uint32_t client_pid) -> std::size_t {
+        auto key = std::make_pair(std::string(client_name), client_pid);
+        if (auto it = index.find(key); it != index.end())
+            return it->second;
+        if (profs.size() >= max_profiled_clients) {
+            // One more profile, shared by all remaining clients.
+            key = {std::string(), 0};
+            if (auto it = index.find(key); it != index.end())
+                return it->second;
+        }
+        auto &prof = profs.emplace_back();
+        prof.client_name = key.first;
+        prof.client_pid = key.second;
+        index.emplace(std::move(key), profs.size() - 1);
+        return profs.size() - 1;
+    }
+};
+
+// Log a summary of each profile (e.g., upon SIGUSR1).
+void log_allocation_profiles(allocation_profiler const &profiler);
+
+} // namespace partake::daemon
@@ -9,6 +9,10 @@
 #include <doctest.h>
 #include <trompeloeil.hpp>
 
+#include <tuple>
+#include <utility>
+#include <vector>
+
 namespace {
 
 using namespace partake::daemon;
@@ -57,11 +61,495 @@ TEST_CASE("arena: large sizes") {
     CHECK_FALSE(c.allocate(std::size_t(-1)));
 }
 
+TEST_CASE("arena: segregated fit") {
+    using internal::arena;
+
+    SUBCASE("whole arena of non-bin-aligned size") {
+        auto a = arena(101);
+        auto a0 = a.allocate(101);
+        REQUIRE(a0);
+        CHECK(a0.count() == 101);
+    }
+
+    SUBCASE("chunk in higher bin is used without scanning") {
+        // Free chunks of 33 and 40 blocks (separated by chunks in use).
+        auto a = arena(100);
+        auto f0 = a.allocate(33);
+        auto u0 = a.allocate(1);
+        auto f1 = a.allocate(40);
+        auto u1 = a.allocate(26);
+        REQUIRE(u1);
+        CHECK_FALSE(a.allocate(1));
+        auto const f1_start = f1.start();
+        { auto discard = std::move(f0); }
+        { auto discard = std::move(f1); }
+
+        // 35 rounds up to the bin [36, 38), so the 40-block chunk is used.
+        auto a0 = a.allocate(35);
+        REQUIRE(a0);
+        CHECK(a0.start() == f1_start);
+
+        // 33 rounds up to the bin [34, 36), which is empty; the 33-block
+        // chunk is found by scanning the bin [32, 34).
+        auto a1 = a.allocate(33);
+        REQUIRE(a1);
+        CHECK(a1.start() == 0);
+    }
+
+    SUBCASE("fallback to bin containing the count") {
+        auto a = arena(100);
+        auto f0 = a.allocate(35);
+        auto u0 = a.allocate(65);
+        REQUIRE(u0);
+        { auto discard = std::move(f0); }
+        // The only free chunk (35) is in the same bin [34, 36) as 35.
+        auto a0 = a.allocate(35);
+        REQUIRE(a0);
+        CHECK(a0.start() == 0);
+    }
+    SUBCASE("removal from the middle of a free list") {
+        // Four free chunks of 2 blocks (each in the same bin), separated by
+        // chunks in use.
+        auto a = arena(16);
+        std::vector<arena::allocation> free;
+        std::vector<arena::allocation> used;
+        for (int i = 0; i < 4; ++i) {
+            free.push_back(a.allocate(2));
+            used.push_back(a.allocate(2));
+        }
+        CHECK_FALSE(a.allocate(1));
+        for (auto &f : free) {
+            auto discard = std::move(f);
+        }
+        CHECK(a.free_chunk_count() == 4);
+
+        // Coalescing removes the chunk at start 2 from the middle of the
+        // free list; the others must remain findable.
+        { auto discard = std::move(used[0]); }
+        CHECK(a.free_chunk_count() == 3);
+        auto a0 = a.allocate(6);
+        REQUIRE(a0);
+        CHECK(a0.start() == 0);
+        auto a1 = a.allocate(2);
+        auto a2 = a.allocate(2);
+        REQUIRE(a2);
+        CHECK(a1.start() + a2.start() == 8 + 12);
+        CHECK(a.free_count() == 0);
+    }
+}
+
+TEST_CASE("arena: zero-fill tracking") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::arena;
+
+    SUBCASE("not initially zero-filled") {
+        auto a = arena(8);
+        CHECK_FALSE(a.allocate(1).is_zeroed());
+    }
+
+    SUBCASE("freed chunks are dirty") {
+        auto a = arena(8, true);
+        auto a0 = a.allocate(2);
+        REQUIRE(a0);
+        CHECK(a0.is_zeroed());
+        { auto discard = std::move(a0); }
+        auto a1 = a.allocate(2);
+        REQUIRE(a1);
+        CHECK(a1.start() == 0);
+        CHECK_FALSE(a1.is_zeroed());
+        // Blocks beyond the freed ones are still zeroed.
+        auto a2 = a.allocate(6);
+        REQUIRE(a2);
+        CHECK(a2.is_zeroed());
+    }
+
+    SUBCASE("split of partially dirty chunk") {
+        auto a = arena(8, true);
+        auto a0 = a.allocate(2);
+        auto a1 = a.allocate(2);
+        REQUIRE(a1);
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a1); }
+        // Free chunk [0, 8) with dirty range [0, 4).
+        auto a2 = a.allocate(3);
+        auto a3 = a.allocate(1);
+        auto a4 = a.allocate(4);
+        REQUIRE(a4);
+        CHECK_FALSE(a2.is_zeroed());
+        CHECK_FALSE(a3.is_zeroed());
+        CHECK(a4.start() == 4);
+        CHECK(a4.is_zeroed());
+    }
+
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("arena: statistics") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::arena;
+    CHECK(arena(0).free_count() == 0);
+    CHECK(arena(0).largest_free_count() == 0);
+
+    auto a = arena(100);
+    CHECK(a.free_count() == 100);
+    CHECK(a.free_chunk_count() == 1);
+    CHECK(a.largest_free_count() == 100);
+    auto a0 = a.allocate(10);
+    auto a1 = a.allocate(30);
+    auto a2 = a.allocate(5);
+    REQUIRE(a2);
+    CHECK(a.free_count() == 55);
+    CHECK(a.largest_free_count() == 55);
+    { auto discard = std::move(a1); }
+    // Free chunks: [10, 40), [45, 100).
+    CHECK(a.free_count() == 85);
+    CHECK(a.free_chunk_count() == 2);
+    CHECK(a.largest_free_count() == 55);
+    auto a3 = a.allocate(50);
+    REQUIRE(a3);
+    CHECK(a.largest_free_count() == 30);
+    { auto discard = std::move(a2); }
+    CHECK(a.free_chunk_count() == 2);
+    CHECK(a.largest_free_count() == 35);
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("arena: release_free_chunks") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::arena;
+    std::vector<std::pair<std::size_t, std::size_t>> released;
+    auto const release = [&](std::size_t start, std::size_t count) {
+        released.emplace_back(start, count);
+        return true;
+    };
+
+    SUBCASE("zero-filled chunks are not released") {
+        auto a = arena(100, true);
+        CHECK(a.release_free_chunks(1, release) == 0);
+        CHECK(released.empty());
+    }
+
+    SUBCASE("only the dirty part of large chunks is released") {
+        auto a = arena(100, true);
+        auto a0 = a.allocate(10);
+        auto a1 = a.allocate(40);
+        auto a2 = a.allocate(5);
+        auto a3 = a.allocate(20);
+        REQUIRE(a3);
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a1); }
+        { auto discard = std::move(a3); }
+        // Free chunks: [0, 50) (dirty), [55, 100) (dirty [55, 75)).
+        CHECK(a.release_free_chunks(30, release) == 50);
+        CHECK(released ==
+              std::vector<std::pair<std::size_t, std::size_t>>{{0, 50}});
+        released.clear();
+        CHECK(a.release_free_chunks(1, release) == 20);
+        CHECK(released ==
+              std::vector<std::pair<std::size_t, std::size_t>>{{55, 20}});
+        released.clear();
+        CHECK(a.release_free_chunks(1, release) == 0);
+        CHECK(a.allocate(50).is_zeroed());
+    }
+
+    SUBCASE("chunks are not marked if release fails") {
+        auto a = arena(100);
+        CHECK(a.release_free_chunks(
+                  200, [](std::size_t, std::size_t) { return true; }) == 0);
+        CHECK(a.release_free_chunks(
+                  1, [](std::size_t, std::size_t) { return false; }) == 0);
+        CHECK_FALSE(a.allocate(100).is_zeroed());
+    }
+
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("arena: scan_chunks") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::arena;
+    using chunk_list = std::vector<std::tuple<std::size_t, std::size_t, bool>>;
+    chunk_list passed;
+    auto const f = [&](std::size_t start, std::size_t count, bool in_use) {
+        passed.emplace_back(start, count, in_use);
+    };
+
+    auto a = arena(100);
+    auto a0 = a.allocate(10);
+    auto a1 = a.allocate(20);
+    auto a2 = a.allocate(30);
+    REQUIRE(a2);
+
+    SUBCASE("whole map in one call") {
+        CHECK_FALSE(a.scan_chunks(10, f));
+        CHECK(passed == chunk_list{{0, 10, true},
+                                   {10, 20, true},
+                                   {30, 30, true},
+                                   {60, 40, false}});
+        passed.clear();
+        CHECK_FALSE(a.scan_chunks(10, f)); // Starts over
+        CHECK(passed.size() == 4);
+    }
+
+    SUBCASE("in slices") {
+        CHECK(a.scan_chunks(2, f));
+        CHECK(passed.size() == 2);
+        CHECK(a.scan_chunks(1, f));
+        CHECK(passed.size() == 3);
+        CHECK_FALSE(a.scan_chunks(1, f));
+        CHECK(passed.size() == 4);
+    }
+
+    SUBCASE("next chunk coalesced into passed chunk") {
+        CHECK(a.scan_chunks(1, f));
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a1); }
+        CHECK(a.scan_chunks(10, f) == false);
+        CHECK(passed == chunk_list{{0, 10, true},
+                                   {10, 20, false},
+                                   {30, 30, true},
+                                   {60, 40, false}});
+    }
+
+    SUBCASE("passed chunk grown into next chunk") {
+        { auto discard = std::move(a2); }
+        CHECK(a.scan_chunks(2, f));
+        CHECK(a.resize(a1, 40));
+        CHECK_FALSE(a.scan_chunks(10, f));
+        CHECK(passed == chunk_list{{0, 10, true},
+                                   {10, 20, true},
+                                   {30, 20, true},
+                                   {50, 50, false}});
+    }
+
+    SUBCASE("chunks added during scan") {
+        CHECK(a.scan_chunks(3, f));
+        auto a3 = a.allocate(5);
+        REQUIRE(a3);
+        CHECK_FALSE(a.scan_chunks(10, f));
+        CHECK(passed == chunk_list{{0, 10, true},
+                                   {10, 20, true},
+                                   {30, 30, true},
+                                   {60, 5, true},
+                                   {65, 35, false}});
+    }
+
+    SUBCASE("empty arena") {
+        auto e = arena(0);
+        CHECK_FALSE(e.scan_chunks(10, f));
+        CHECK(passed.empty());
+    }
+
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("arena: scrub on free") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::arena;
+    auto a = arena(100, true);
+    a.set_scrub_on_free(true);
+    auto a0 = a.allocate(60);
+    REQUIRE(a0);
+    CHECK(a0.is_zeroed());
+    CHECK(a.take_chunks_to_scrub().empty());
+
+    { auto discard = std::move(a0); }
+    CHECK(a.free_count() == 40); // Held, not freed
+    CHECK_FALSE(a.allocate(50));
+
+    SUBCASE("scrubbed") {
+        auto held = a.take_chunks_to_scrub();
+        REQUIRE(held.size() == 1);
+        CHECK(held[0].start() == 0);
+        CHECK(held[0].count() == 60);
+        CHECK(a.take_chunks_to_scrub().empty());
+        a.free_scrubbed(std::move(held[0]));
+        CHECK_FALSE(held[0]);
+        CHECK(a.free_count() == 100);
+        auto a1 = a.allocate(100);
+        REQUIRE(a1);
+        CHECK(a1.is_zeroed());
+    }
+
+    SUBCASE("taken but dropped") {
+        { auto discard = a.take_chunks_to_scrub(); }
+        CHECK(a.free_count() == 40);
+        CHECK(a.take_chunks_to_scrub().size() == 1);
+    }
+
+    SUBCASE("shrunk tail is held") {
+        auto a1 = a.allocate(40);
+        REQUIRE(a1);
+        CHECK(a.resize(a1, 30));
+        auto held = a.take_chunks_to_scrub();
+        REQUIRE(held.size() == 2);
+        CHECK(held[1].start() == 90);
+        CHECK(held[1].count() == 10);
+    }
+
+    SUBCASE("disabled") {
+        a.set_scrub_on_free(false);
+        auto a1 = a.allocate(40);
+        { auto discard = std::move(a1); }
+        CHECK(a.free_count() == 40); // Only the earlier chunk is held
+        auto held = a.take_chunks_to_scrub();
+        REQUIRE(held.size() == 1);
+        held.clear(); // Now freed as written
+        CHECK(a.free_count() == 100);
+        CHECK_FALSE(a.allocate(100).is_zeroed());
+    }
+
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("arena: allocate_at") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::arena;
+    auto a = arena(100, true);
+    CHECK_FALSE(a.allocate_at(100, 1));
+    CHECK_FALSE(a.allocate_at(90, 11));
+
+    auto a0 = a.allocate_at(10, 20);
+    REQUIRE(a0);
+    CHECK(a0.start() == 10);
+    CHECK(a0.count() == 20);
+    CHECK(a0.is_zeroed());
+    auto a1 = a.allocate_at(50, 0); // Treated as 1
+    REQUIRE(a1);
+    CHECK(a1.count() == 1);
+    CHECK(a.free_count() == 79);
+    CHECK(a.free_chunk_count() == 3);
+
+    CHECK_FALSE(a.allocate_at(25, 10)); // Overlaps a0
+    CHECK_FALSE(a.allocate_at(45, 10)); // Overlaps a1
+    auto a2 = a.allocate_at(0, 10); // Earlier than others; fills the gap
+    REQUIRE(a2);
+    CHECK(a.free_chunk_count() == 2);
+
+    { auto discard = std::move(a0); }
+    CHECK(a.free_chunk_count() == 2); // Coalesced
+    CHECK(a.allocate_at(10, 40));
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("arena: resize") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::arena;
+    auto a = arena(100, true);
+    auto a0 = a.allocate_at(0, 10);
+    auto a1 = a.allocate_at(50, 10);
+    REQUIRE(a0);
+    REQUIRE(a1);
+
+    SUBCASE("grow into following free chunk") {
+        CHECK(a.resize(a0, 30));
+        CHECK(a0.start() == 0);
+        CHECK(a0.count() == 30);
+        CHECK(a0.is_zeroed());
+        CHECK(a.free_count() == 60);
+        CHECK(a.free_chunk_count() == 2);
+    }
+
+    SUBCASE("grow to fill following free chunk") {
+        CHECK(a.resize(a0, 50));
+        CHECK(a0.count() == 50);
+        CHECK(a.free_chunk_count() == 1);
+        CHECK_FALSE(a.resize(a0, 51)); // a1 is in the way
+    }
+
+    SUBCASE("grow fails if following chunk too small") {
+        CHECK_FALSE(a.resize(a1, 51));
+        CHECK(a1.count() == 10);
+        CHECK(a.free_count() == 80);
+    }
+
+    SUBCASE("shrink returns tail, coalesced with following chunk") {
+        CHECK(a.resize(a1, 4));
+        CHECK(a1.start() == 50);
+        CHECK(a1.count() == 4);
+        CHECK(a.free_count() == 86);
+        CHECK(a.free_chunk_count() == 2);
+        CHECK(a.resize(a1, 0)); // Treated as 1
+        CHECK(a1.count() == 1);
+    }
+
+    SUBCASE("shrink then grow back reuses dirty tail") {
+        CHECK(a.resize(a0, 5));
+        CHECK(a.resize(a0, 10));
+        CHECK_FALSE(a0.is_zeroed());
+    }
+
+    SUBCASE("same count") {
+        CHECK(a.resize(a0, 10));
+        CHECK(a.free_chunk_count() == 2);
+    }
+
+    { auto discard = std::move(a0); }
+    { auto discard = std::move(a1); }
+    CHECK(a.free_chunk_count() == 1);
+    CHECK(a.free_count() == 100);
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("arena: alignment") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::arena;
+
+    SUBCASE("skipped head remains free") {
+        auto a = arena(64);
+        auto a0 = a.allocate(1);
+        auto a1 = a.allocate(4, 16);
+        REQUIRE(a1);
+        CHECK(a1.start() == 16);
+        CHECK(a1.count() == 4);
+        CHECK(a.free_count() == 59);
+        auto a2 = a.allocate(15);
+        REQUIRE(a2);
+        CHECK(a2.start() == 1);
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a1); }
+        { auto discard = std::move(a2); }
+        CHECK(a.allocate(64));
+    }
+
+    SUBCASE("aligned chunk without room for padding") {
+        auto a = arena(32);
+        auto u0 = a.allocate(8);
+        auto f0 = a.allocate(8);
+        auto u1 = a.allocate(16);
+        REQUIRE(u1);
+        { auto discard = std::move(f0); }
+        auto a0 = a.allocate(8, 8);
+        REQUIRE(a0);
+        CHECK(a0.start() == 8);
+    }
+
+    SUBCASE("no aligned fit") {
+        auto a = arena(32);
+        auto u0 = a.allocate(1);
+        CHECK_FALSE(a.allocate(16, 32));
+        auto a0 = a.allocate(16, 16);
+        REQUIRE(a0);
+        CHECK(a0.start() == 16);
+    }
+
+    SUBCASE("alignment larger than arena") {
+        auto a = arena(8);
+        auto a0 = a.allocate(1, std::size_t(1) << 63);
+        REQUIRE(a0);
+        CHECK(a0.start() == 0);
+        CHECK_FALSE(a.allocate(1, 16));
+    }
+
+    // NOLINTEND(readability-magic-numbers)
+}
+
 struct fake_arena_allocation {
     std::size_t s;
     std::size_t c;
+    bool z;
     [[nodiscard]] auto start() const noexcept -> std::size_t { return s; }
     [[nodiscard]] auto count() const noexcept -> std::size_t { return c; }
+    [[nodiscard]] auto is_zeroed() const noexcept -> bool { return z; }
     operator bool() const noexcept { return c > 0; }
 };
 
@@ -70,8 +558,10 @@ class mock_arena {
 
   public:
     using allocation = fake_arena_allocation;
-    explicit mock_arena(std::size_t count) : cnt(count) {}
-    MAKE_MOCK1(allocate, allocation(std::size_t)); // NOLINT
+    explicit mock_arena(std::size_t count, bool /* zero_filled */ = false)
+        : cnt(count) {}
+    MAKE_MOCK2(allocate, allocation(std::size_t, std::size_t)); // NOLINT
+    MAKE_MOCK2(allocate_at, allocation(std::size_t, std::size_t)); // NOLINT
     auto size() const noexcept -> std::size_t { return cnt; }
 };
 
@@ -83,23 +573,60 @@ TEST_CASE("allocator") {
     CHECK(a.size() == 8);
 
     SUBCASE("typical allocation") {
-        REQUIRE_CALL(a.arena(), allocate(3))
-            .RETURN(fake_arena_allocation{42, 3});
+        REQUIRE_CALL(a.arena(), allocate(3, 1))
+            .RETURN(fake_arena_allocation{42, 3, false});
         auto alloc = a.allocate(5);
+        CHECK(alloc.segment_id() == 0);
         CHECK(alloc.offset() == 84);
         CHECK(alloc.size() == 6);
     }
 
+    SUBCASE("segment id is propagated") {
+        basic_allocator<mock_arena> b(9, 1, 3);
+        CHECK(b.segment_id() == 3);
+        REQUIRE_CALL(b.arena(), allocate(1, 1))
+            .RETURN(fake_arena_allocation{7, 1, false});
+        auto alloc = b.allocate(2);
+        CHECK(alloc.segment_id() == 3);
+        CHECK(alloc.offset() == 14);
+    }
+
     SUBCASE("zero-byte allocation passes through") {
-        REQUIRE_CALL(a.arena(), allocate(0))
-            .RETURN(fake_arena_allocation{0, 1});
+        REQUIRE_CALL(a.arena(), allocate(0, 1))
+            .RETURN(fake_arena_allocation{0, 1, false});
         auto alloc = a.allocate(0);
         CHECK(alloc.size() == 2);
     }
 
+    SUBCASE("zeroed flag is propagated") {
+        REQUIRE_CALL(a.arena(), allocate(1, 1))
+            .RETURN(fake_arena_allocation{0, 1, true});
+        auto alloc = a.allocate(2);
+        CHECK(alloc.is_zeroed());
+    }
+
+    SUBCASE("alignment is converted to blocks") {
+        REQUIRE_CALL(a.arena(), allocate(3, 4))
+            .RETURN(fake_arena_allocation{4, 3, false});
+        auto alloc = a.allocate(5, 8);
+        CHECK(alloc.offset() == 8);
+        REQUIRE_CALL(a.arena(), allocate(1, 1))
+            .RETURN(fake_arena_allocation{1, 1, false});
+        CHECK(a.allocate(1, 2));
+    }
+
+    SUBCASE("allocate_at converts to blocks") {
+        REQUIRE_CALL(a.arena(), allocate_at(2, 3))
+            .RETURN(fake_arena_allocation{2, 3, false});
+        auto alloc = a.allocate_at(4, 5);
+        CHECK(alloc.offset() == 4);
+        CHECK(alloc.size() == 6);
+        CHECK_FALSE(a.allocate_at(3, 2)); // Not block-aligned
+    }
+
     SUBCASE("failed allocation") {
-        REQUIRE_CALL(a.arena(), allocate(100))
-            .RETURN(fake_arena_allocation{0, 0});
+        REQUIRE_CALL(a.arena(), allocate(100, 1))
+            .RETURN(fake_arena_allocation{0, 0, false});
         auto alloc = a.allocate(200);
         CHECK_FALSE(alloc);
     }
@@ -10,10 +10,11 @@
 
 #include <boost/intrusive/list.hpp>
 #include <doctest.h>
-#include <gsl/span>
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
 #include <iterator>
 #include <type_traits>
 #include <utility>
@@ -81,11 +82,53 @@ TEST_CASE("countl_zero") {
     CHECK(countl_zero(std::size_t(1) << (size_bits - 1)) == 0);
 }
 
+template <typename T>
+constexpr inline auto countr_zero_software_nonzero(T x) noexcept -> int {
+    static_assert(std::is_unsigned_v<T>);
+    int ret = 0;
+    while ((x & T(1)) == 0) {
+        ++ret;
+        x >>= 1;
+    }
+    return ret;
+}
+
+TEST_CASE("countr_zero software implementation") {
+    CHECK(countr_zero_software_nonzero<std::uint16_t>(1u) == 0);
+    CHECK(countr_zero_software_nonzero<std::uint16_t>(6u) == 1);
+    CHECK(countr_zero_software_nonzero<std::uint16_t>(1u << 15) == 15);
+    CHECK(countr_zero_software_nonzero<std::uint64_t>(1uLL << 63) == 63);
+}
+
+// C++20 has std::countr_zero() that can replace this. We implement for
+// uint64_t only (used for bitmaps).
+inline auto countr_zero(std::uint64_t x) noexcept -> int {
+    if (x == 0)
+        return 64;
+#if defined(__GNUC__)
+    static_assert(sizeof(std::uint64_t) == sizeof(unsigned long long));
+    return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index = 0;
+    _BitScanForward64(&index, x);
+    return int(index);
+#else
+    return countr_zero_software_nonzero(x);
+#endif
+}
+
+TEST_CASE("countr_zero") {
+    CHECK(countr_zero(0) == 64);
+    CHECK(countr_zero(1) == 0);
+    CHECK(countr_zero(12) == 2);
+    CHECK(countr_zero(std::uint64_t(1) << 63) == 63);
+}
+
 inline auto free_list_index_for_size(std::size_t size) -> std::size_t {
     assert(size > 0);
-    // At least for now, we use a separate free list for each size range whose
-    // maximum is a power of 2: 1, 2, 4, ..., N, where N is the first power of
-    // 2 that is greater than or equal to size.
+    // Index of the size range whose maximum is a power of 2: 1, 2, 4, ..., N,
+    // where N is the first power of 2 that is greater than or equal to size.
+    // (That is, ceil(log2(size)).)
     return 8 * sizeof(size) - static_cast<std::size_t>(countl_zero(size - 1));
 }
 
@@ -100,6 +143,82 @@ TEST_CASE("free_list_index_for_size") {
     CHECK(free_list_index_for_size(257) == 9);
 }
 
+// Two-level segregated-fit (TLSF) index of free chunks by block count. The
+// first level bins by power of 2; each first-level bin is divided into
+// tlsf_sl_count second-level bins of equal width. Counts less than
+// tlsf_sl_count have exact bins (in first-level bin 0).
+inline constexpr std::size_t tlsf_log2_sl_count = 4;
+inline constexpr std::size_t tlsf_sl_count = std::size_t(1)
+                                             << tlsf_log2_sl_count;
+
+struct tlsf_index {
+    std::size_t fl;
+    std::size_t sl;
+};
+
+// Return the bin to which a free chunk of the given count belongs.
+inline auto tlsf_index_for_count(std::size_t count) noexcept -> tlsf_index {
+    assert(count > 0);
+    if (count < tlsf_sl_count)
+        return {0, count};
+    auto const msb =
+        8 * sizeof(count) - 1 - static_cast<std::size_t>(countl_zero(count));
+    return {msb - tlsf_log2_sl_count + 1,
+            (count >> (msb - tlsf_log2_sl_count)) - tlsf_sl_count};
+}
+
+// Return the first bin whose chunks all have at least the given count. The
+// returned fl is out of range for every arena if there is no such bin.
+inline auto tlsf_search_index_for_count(std::size_t count) noexcept
+    -> tlsf_index {
+    assert(count > 0);
+    if (count < tlsf_sl_count)
+        return {0, count};
+    auto const msb =
+        8 * sizeof(count) - 1 - static_cast<std::size_t>(countl_zero(count));
+    auto const round = (std::size_t(1) << (msb - tlsf_log2_sl_count)) - 1;
+    if (count > std::size_t(-1) - round)
+        return {8 * sizeof(count), 0};
+    return tlsf_index_for_count(count + round);
+}
+
+TEST_CASE("tlsf_index_for_count") {
+    auto const check = [](std::size_t count, std::size_t fl, std::size_t sl) {
+        CAPTURE(count);
+        auto const idx = tlsf_index_for_count(count);
+        CHECK(idx.fl == fl);
+        CHECK(idx.sl == sl);
+    };
+    check(1, 0, 1);
+    check(15, 0, 15);
+    check(16, 1, 0);
+    check(17, 1, 1);
+    check(31, 1, 15);
+    check(32, 2, 0);
+    check(33, 2, 0);
+    check(34, 2, 1);
+    check(63, 2, 15);
+    check(64, 3, 0);
+    check(std::size_t(-1), 8 * sizeof(std::size_t) - tlsf_log2_sl_count,
+          15);
+}
+
+TEST_CASE("tlsf_search_index_for_count") {
+    auto const check = [](std::size_t count, std::size_t fl, std::size_t sl) {
+        CAPTURE(count);
+        auto const idx = tlsf_search_index_for_count(count);
+        CHECK(idx.fl == fl);
+        CHECK(idx.sl == sl);
+    };
+    check(1, 0, 1);
+    check(17, 1, 1);
+    check(32, 2, 0);
+    check(33, 2, 1);
+    check(34, 2, 1);
+    check(63, 3, 0);
+    check(std::size_t(-1), 8 * sizeof(std::size_t), 0);
+}
+
 // The arena performs allocation of chunks of some contiguous resource (e.g.,
 // shared memory, of course). All bookkeeping happens externally (in regular
 // memory owned by the arena), so that the shared memory is not actually
@@ -112,32 +231,54 @@ TEST_CASE("free_list_index_for_size") {
 // integer number of contiguous blocks. Mapping the block size to some concrete
 // (usually power-of-2) number of bytes must be done by client code.
 //
-// For now we have a single strategy using power-of-2 free lists and next-fit
-// allocation, with eager coalescense of deallocated chunks.
+// Free chunks are indexed by a two-level segregated-fit scheme (TLSF), with a
+// bitmap of non-empty bins at each level, so that a fitting free chunk is
+// usually found with two bit scans and without scanning any free list. Freed
+// chunks are eagerly coalesced.
+//
+// Each free list is a contiguous array of (start, count, chunk) entries
+// rather than a linked list through the chunks, so that the scans that are
+// needed in some cases (see find_free_chunk()) read only the array and
+// dereference a chunk only upon a match. Chunks remain linked in address
+// order: an allocation holds its chunk, so finding the neighbors to coalesce
+// with is two pointer dereferences, which no ordered index keyed by start
+// (such as a B-tree) could beat.
 //
 // Because allocations track not just the start offset (as with the malloc()
 // API) but also chunk size, we are able to make deallocation efficient (O(1))
 // without storing metadata adjacent to (or inside) the chunk.
 //
+// The arena also tracks which blocks are known to be zero-filled, so that
+// clients can be told when they need not clear a new allocation. Blocks are
+// zero-filled initially if the arena is constructed with 'zero_filled' set.
+// Deallocated chunks are assumed to have been written. Each chunk records
+// the smallest range containing all of its possibly-written blocks; this is
+// exact except when written ranges are merged across a zero-filled gap.
+//
 // In the event that optimization becomes necessary (perhaps due to excessive
 // external fragmentation), it will probably make sense to use a layered
 // allocator with pluggable strategies (analogous to std::pmr), which might
-// include buddy and slab allocators. (Strategies based on multiple arenas (on
-// multiple shared memory segments) should also be considered.)
+// include buddy and slab allocators. (See slab_arena for a slab front end.
+// Multiple arenas on multiple shared memory segments are managed by
+// segment_pool.)
 class arena {
     struct adjacency_tag;
     using adjacency_base_hook =
         boost::intrusive::list_base_hook<boost::intrusive::tag<adjacency_tag>>;
 
-    struct free_list_tag;
-    using free_list_base_hook =
-        boost::intrusive::list_base_hook<boost::intrusive::tag<free_list_tag>>;
-
-    struct chunk : adjacency_base_hook, free_list_base_hook {
+    struct chunk : adjacency_base_hook {
         std::size_t strt;
         std::size_t cnt;
         bool in_use;
 
+        // Index of the entry for this chunk in its free list, if free.
+        std::size_t free_list_pos = 0;
+
+        // Blocks [dirty_begin, dirty_end) may be nonzero; the rest of the
+        // chunk is zero-filled. Both are zero if the whole chunk is zeroed.
+        std::size_t dirty_begin = 0;
+        std::size_t dirty_end = 0;
+
         // NOLINTNEXTLINE(bugprone-easily-swappable-parameters)
         explicit chunk(std::size_t start, std::size_t count, bool is_in_use)
             : strt(start), cnt(count), in_use(is_in_use) {}
@@ -157,10 +298,13 @@ class arena {
     // start offset.
     // Chunks in use are also referenced by an allocation, which automatically
     // returns the chunk to the arena upon destruction.
-    // Free chunks also participate in one of the free lists, which is a
-    // doubly-linked list of free chunks of a particular size class. Currently,
-    // the free lists are binned by power-of-2 thresholds: free_lists[N] holds
-    // free chunks whose block count is at least 2^N and no more than 2^(N+1).
+    // Free chunks also have an entry in one of the free lists, which is an
+    // array of the free chunks of a particular size class, most recently
+    // inserted last (with the exception that removal moves the last entry
+    // into the vacated position). The free list for TLSF bin {fl, sl} is
+    // free_lists[fl * tlsf_sl_count + sl]. Bit fl of 'fl_bitmap' is set iff
+    // any bin in first-level bin fl is non-empty; bit sl of sl_bitmaps[fl]
+    // is set iff bin {fl, sl} is non-empty.
 
     hive<chunk> chunk_storage;
 
@@ -168,12 +312,39 @@ class arena {
                            boost::intrusive::base_hook<adjacency_base_hook>>
         chunks;
 
-    using free_list = boost::intrusive::list<
-        chunk, boost::intrusive::base_hook<free_list_base_hook>>;
+    // The start and count are copies of those of the chunk, which are only
+    // modified while the chunk is not in a free list.
+    struct free_entry {
+        std::size_t strt;
+        std::size_t cnt;
+        chunk *chk;
+    };
+
+    using free_list = std::vector<free_entry>;
     std::vector<free_list> free_lists;
+    std::uint64_t fl_bitmap = 0;
+    std::vector<std::uint64_t> sl_bitmaps;
+    static_assert(8 * sizeof(std::size_t) <= 64);
+    static_assert(tlsf_sl_count <= 64);
+
+    // Totals over the free lists, for statistics.
+    std::size_t free_blocks = 0;
+    std::size_t free_chunks = 0;
+
+    // Position of the chunk scan (see scan_chunks()): the next chunk to
+    // visit (null if no scan is in progress) and the end of the blocks
+    // already passed. A chunk erased by coalescing is replaced by the chunk
+    // it is merged into.
+    chunk *scan_next = nullptr;
+    std::size_t scan_pos = 0;
+
+    // With scrub-on-free (see set_scrub_on_free()), deallocated chunks stay
+    // in use here until taken by take_chunks_to_scrub().
+    bool scrub_freed = false;
+    std::vector<chunk *> to_scrub;
 
   public:
-    explicit arena(std::size_t size) : siz(size) {
+    explicit arena(std::size_t size, bool zero_filled = false) : siz(size) {
         // Sentinels simplify coalescence of deallocated chunks. They are the
         // only 'chunk' instances with count == 0 and they never appear in free
         // lists.
@@ -185,11 +356,14 @@ class arena {
         if (size > 0) {
             // Set up an initial free chunk occupying the whole size
             auto free_chunk = chunk_storage.emplace(0, size, false);
+            if (not zero_filled)
+                free_chunk->dirty_end = size;
             chunks.push_back(*free_chunk);
 
-            auto n_free_lists = internal::free_list_index_for_size(size) + 1;
-            free_lists.resize(n_free_lists);
-            free_lists.back().push_back(*free_chunk);
+            auto const n_fl = tlsf_index_for_count(size).fl + 1;
+            free_lists.resize(n_fl * tlsf_sl_count);
+            sl_bitmaps.resize(n_fl);
+            insert_free_chunk(*free_chunk);
         }
 
         chunks.push_back(*right_sentinel);
@@ -204,6 +378,40 @@ class arena {
 
     [[nodiscard]] auto size() const noexcept -> std::size_t { return siz; }
 
+    // Number of free blocks.
+    [[nodiscard]] auto free_count() const noexcept -> std::size_t {
+        return free_blocks;
+    }
+
+    // Number of free chunks (the total length of the free lists).
+    [[nodiscard]] auto free_chunk_count() const noexcept -> std::size_t {
+        return free_chunks;
+    }
+
+    // Block count of the largest free chunk (the largest allocation that can
+    // currently succeed). Scans the highest non-empty bin.
+    [[nodiscard]] auto largest_free_count() const noexcept -> std::size_t {
+        if (fl_bitmap == 0)
+            return 0;
+        auto const fl = 8 * sizeof(std::size_t) - 1 -
+                        static_cast<std::size_t>(
+                            countl_zero(static_cast<std::size_t>(fl_bitmap)));
+        auto const sl = 8 * sizeof(std::size_t) - 1 -
+                        static_cast<std::size_t>(countl_zero(
+                            static_cast<std::size_t>(sl_bitmaps[fl])));
+        std::size_t largest = 0;
+        for (auto const &ent : free_lists[fl * tlsf_sl_count + sl])
+            largest = std::max(largest, ent.cnt);
+        return largest;
+    }
+
+    // Block counts to which allocations are rounded up, in increasing order
+    // (see basic_allocator::size_classes()). Empty, because every count is
+    // allocated exactly.
+    [[nodiscard]] auto size_classes() const -> std::vector<std::size_t> {
+        return {};
+    }
+
     // RAII class for chunk allocation
     class allocation {
         // Both arn and chk are nullptr if default-initialized or allocation
@@ -251,71 +459,373 @@ class arena {
         [[nodiscard]] auto count() const noexcept -> std::size_t {
             return chk != nullptr ? chk->cnt : 0;
         }
+
+        // True if the chunk was known to be zero-filled when allocated.
+        [[nodiscard]] auto is_zeroed() const noexcept -> bool {
+            return chk != nullptr && chk->dirty_begin == chk->dirty_end;
+        }
     };
 
-    [[nodiscard]] auto allocate(std::size_t count) -> allocation {
+    // The start of the chunk is a multiple of 'alignment' (a power of 2).
+    // Free blocks skipped to achieve alignment remain a free chunk.
+    [[nodiscard]] auto allocate(std::size_t count, std::size_t alignment = 1)
+        -> allocation {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
         // For the sake of regularity of behavior, we allow allocation of
         // zero-block chunks, but treat them as count 1 so that they have
         // distinct start offsets.
         if (count == 0)
             count = 1;
+        if (count > siz)
+            return {};
 
-        for (auto &flist : free_lists_for_count(count)) {
-            for (auto &chk : flist) {
-                if (chk.cnt < count)
-                    continue;
+        auto *chk = alignment > 1 ? find_free_chunk(count, alignment)
+                                  : find_free_chunk(count);
+        if (chk == nullptr)
+            return {}; // No large enough free chunk
+        return take_free_chunk(chk, padding(chk->strt, alignment), count);
+    }
 
-                // We will use chk. But before we go on, move the scanned
-                // chunks to the end of the list so that they will not be
-                // scanned first again next time. (If we don't do this, we
-                // will likely accumulate smaller chunks at the beginning
-                // of each free list, making allocations slower.)
-                // (Sometimes known as the "next-fit" algorithm.)
-                free_list wk;
-                wk.splice(wk.end(), flist, flist.begin(),
-                          flist.iterator_to(chk));
-                flist.splice(flist.end(), wk);
-
-                flist.erase(flist.iterator_to(chk));
-
-                if (chk.cnt > count) { // Split off excess capacity
-                    auto excess = chunk_storage.emplace(
-                        chk.strt + count, chk.cnt - count, false);
-                    chk.cnt = count;
-                    free_list_for_count(excess->cnt).push_front(*excess);
-                    chunks.insert(std::next(chunks.iterator_to(chk)), *excess);
-                }
+    // Allocate exactly the blocks [start, start + count), if they are free
+    // (for re-creating allocations known from elsewhere, such as a saved
+    // snapshot). Free chunks are scanned from the end, so this is fast when
+    // allocating in increasing order of start in an otherwise empty arena.
+    [[nodiscard]] auto allocate_at(std::size_t start, std::size_t count)
+        -> allocation {
+        if (count == 0)
+            count = 1;
+        if (start >= siz || count > siz - start)
+            return {};
+        for (auto it = chunks.rbegin(), e = chunks.rend(); it != e; ++it) {
+            if (it->strt > start)
+                continue;
+            if (it->in_use || it->strt + it->cnt < start + count)
+                return {};
+            return take_free_chunk(&*it, start - it->strt, count);
+        }
+        return {};
+    }
 
-                chk.in_use = true;
-                return allocation(this, &chk);
+    // Incremental scan of the chunk map, so that it can be exported without
+    // holding up allocation: pass up to 'max_count' chunks, in order of
+    // start, to 'f(start, count, in_use)'. Return true if more remain, in
+    // which case the next call continues where this one stopped (after any
+    // number of other operations); otherwise the next call starts over.
+    // Chunks that change during the scan are passed as they are when
+    // reached, clipped (or, for blocks coalesced into a chunk already
+    // passed, added) so that every block is passed exactly once.
+    template <typename F>
+    auto scan_chunks(std::size_t max_count, F &&f) -> bool {
+        auto it = scan_next == nullptr ? std::next(chunks.begin())
+                                       : chunks.iterator_to(*scan_next);
+        if (scan_next == nullptr)
+            scan_pos = 0;
+        // Only the sentinels have zero count.
+        for (std::size_t n = 0; n < max_count && it->cnt > 0; ++n, ++it) {
+            if (it->strt > scan_pos)
+                f(scan_pos, it->strt - scan_pos, std::prev(it)->in_use);
+            auto const end = it->strt + it->cnt;
+            if (end > scan_pos) {
+                auto const start = std::max(it->strt, scan_pos);
+                f(start, end - start, it->in_use);
+                scan_pos = end;
             }
         }
+        scan_next = it->cnt > 0 ? &*it : nullptr;
+        return scan_next != nullptr;
+    }
+
+    // If 'enable' is true, deallocated chunks are not reused until
+    // scrubbed, so that their data is never visible to their next owner:
+    // instead of being freed, they are held (still in use) until
+    // take_chunks_to_scrub() returns them as allocations, which the caller
+    // zero-fills and passes to free_scrubbed(). Chunks already held remain
+    // so if disabled.
+    void set_scrub_on_free(bool enable) noexcept { scrub_freed = enable; }
+
+    [[nodiscard]] auto take_chunks_to_scrub() -> std::vector<allocation> {
+        std::vector<allocation> ret;
+        ret.reserve(to_scrub.size());
+        for (auto *chk : to_scrub)
+            ret.push_back(allocation(this, chk));
+        to_scrub.clear();
+        return ret;
+    }
+
+    // Free 'alloc' (which must be from this arena), whose blocks the caller
+    // has zero-filled, marking its blocks as zero-filled. It is not held for
+    // scrubbing.
+    void free_scrubbed(allocation &&alloc) {
+        assert(alloc.arn == this);
+        alloc.arn = nullptr;
+        deallocate(std::exchange(alloc.chk, nullptr), true);
+    }
+
+    // Change the block count of 'alloc' (which must be from this arena) to
+    // 'count' without moving it. Shrinking returns the tail to the free
+    // lists; growing takes the blocks from the following chunk, so it
+    // succeeds only if that chunk is free and large enough. Return false,
+    // leaving 'alloc' unchanged, if growing is not possible.
+    [[nodiscard]] auto resize(allocation &alloc, std::size_t count) -> bool {
+        assert(alloc.arn == this);
+        auto *chk = alloc.chk;
+        if (count == 0)
+            count = 1;
+        if (count == chk->cnt)
+            return true;
+
+        if (count < chk->cnt) {
+            auto tail = chunk_storage.emplace(chk->strt + count,
+                                              chk->cnt - count, true);
+            chk->cnt = count;
+            clip_dirty_range(*chk);
+            chunks.insert(std::next(chunks.iterator_to(*chk)), *tail);
+            deallocate(&*tail); // Coalesces with the following chunk
+            return true;
+        }
 
-        return {}; // No large enough free chunk
+        // The right sentinel is in use, so need not be checked for.
+        auto next = std::next(chunks.iterator_to(*chk));
+        auto const extra = count - chk->cnt;
+        if (next->in_use || next->cnt < extra)
+            return false;
+        remove_free_chunk(*next);
+        chk->cnt = count;
+        merge_dirty_range(*chk, *next);
+        clip_dirty_range(*chk);
+        if (next->cnt == extra) {
+            note_merged(*next, *chk);
+            chunks.erase(next);
+            chunk_storage.erase(chunk_storage.get_iterator(&*next));
+        } else {
+            next->strt += extra;
+            next->cnt -= extra;
+            clip_dirty_range(*next);
+            insert_free_chunk(*next);
+        }
+        return true;
+    }
+
+    // Call 'release(start, count)' for the possibly-written blocks of each
+    // free chunk, if they number at least 'min_count'. 'release' should
+    // return true if the blocks are now zero-filled (e.g., because their
+    // pages were returned to the system); the blocks are then marked as such
+    // and are not passed again until reused. Return the total number of
+    // blocks so marked.
+    template <typename F>
+    auto release_free_chunks(std::size_t min_count, F &&release)
+        -> std::size_t {
+        if (min_count == 0)
+            min_count = 1;
+        std::size_t released = 0;
+        if (min_count > siz)
+            return released;
+        // Chunks in lower bins are all smaller than min_count.
+        auto const first = tlsf_index_for_count(min_count);
+        for (auto i = first.fl * tlsf_sl_count + first.sl;
+             i < free_lists.size(); ++i) {
+            for (auto const &ent : free_lists[i]) {
+                if (ent.cnt < min_count)
+                    continue;
+                auto &chk = *ent.chk;
+                auto const dirty = chk.dirty_end - chk.dirty_begin;
+                if (dirty >= min_count && release(chk.dirty_begin, dirty)) {
+                    chk.dirty_begin = chk.dirty_end = 0;
+                    released += dirty;
+                }
+            }
+        }
+        return released;
     }
 
   private:
-    [[nodiscard]] auto free_list_for_count(std::size_t count) -> free_list & {
-        assert(count > 0);
-        assert(count <= siz);
-        return free_lists[internal::free_list_index_for_size(count)];
+    // Allocate 'count' blocks from the free chunk 'chk', skipping the first
+    // 'pad' blocks; the skipped head and any excess remain free.
+    auto take_free_chunk(chunk *chk, std::size_t pad, std::size_t count)
+        -> allocation {
+        assert(not chk->in_use);
+        assert(pad <= chk->cnt && count <= chk->cnt - pad);
+        remove_free_chunk(*chk);
+
+        if (pad > 0) {
+            // Split off the head, which remains free. The preceding chunk is
+            // in use (free chunks are coalesced), so no merge is needed.
+            auto head = chunk_storage.emplace(chk->strt, pad, false);
+            chk->strt += pad;
+            chk->cnt -= pad;
+            head->dirty_begin = chk->dirty_begin;
+            head->dirty_end = chk->dirty_end;
+            clip_dirty_range(*head);
+            clip_dirty_range(*chk);
+            insert_free_chunk(*head);
+            chunks.insert(chunks.iterator_to(*chk), *head);
+        }
+
+        if (chk->cnt > count) { // Split off excess capacity
+            auto excess = chunk_storage.emplace(chk->strt + count,
+                                                chk->cnt - count, false);
+            chk->cnt = count;
+            excess->dirty_begin = chk->dirty_begin;
+            excess->dirty_end = chk->dirty_end;
+            clip_dirty_range(*excess);
+            clip_dirty_range(*chk);
+            insert_free_chunk(*excess);
+            chunks.insert(std::next(chunks.iterator_to(*chk)), *excess);
+        }
+
+        chk->in_use = true;
+        return allocation(this, chk);
     }
 
-    [[nodiscard]] auto free_lists_for_count(std::size_t count)
-        -> gsl::span<free_list> {
-        assert(count > 0);
-        auto index = internal::free_list_index_for_size(count);
-        index = std::min(index, free_lists.size());
-        return gsl::span<free_list>(free_lists).subspan(index);
+    // Restrict the dirty range of 'chk' to its blocks.
+    static void clip_dirty_range(chunk &chk) noexcept {
+        auto const begin = std::max(chk.dirty_begin, chk.strt);
+        auto const end = std::min(chk.dirty_end, chk.strt + chk.cnt);
+        if (begin < end) {
+            chk.dirty_begin = begin;
+            chk.dirty_end = end;
+        } else {
+            chk.dirty_begin = chk.dirty_end = 0;
+        }
+    }
+
+    // Extend the dirty range of 'chk' to cover that of 'other'.
+    static void merge_dirty_range(chunk &chk, chunk const &other) noexcept {
+        if (other.dirty_begin == other.dirty_end)
+            return;
+        if (chk.dirty_begin == chk.dirty_end) {
+            chk.dirty_begin = other.dirty_begin;
+            chk.dirty_end = other.dirty_end;
+        } else {
+            chk.dirty_begin = std::min(chk.dirty_begin, other.dirty_begin);
+            chk.dirty_end = std::max(chk.dirty_end, other.dirty_end);
+        }
     }
 
-    void deallocate(chunk *chk) {
+    [[nodiscard]] auto free_list_at(tlsf_index idx) -> free_list & {
+        return free_lists[idx.fl * tlsf_sl_count + idx.sl];
+    }
+
+    void insert_free_chunk(chunk &chk) {
+        assert(chk.cnt > 0);
+        assert(chk.cnt <= siz);
+        auto const idx = tlsf_index_for_count(chk.cnt);
+        auto &flist = free_list_at(idx);
+        chk.free_list_pos = flist.size();
+        flist.push_back({chk.strt, chk.cnt, &chk});
+        fl_bitmap |= std::uint64_t(1) << idx.fl;
+        sl_bitmaps[idx.fl] |= std::uint64_t(1) << idx.sl;
+        free_blocks += chk.cnt;
+        ++free_chunks;
+    }
+
+    void remove_free_chunk(chunk &chk) {
+        auto const idx = tlsf_index_for_count(chk.cnt);
+        auto &flist = free_list_at(idx);
+        assert(flist[chk.free_list_pos].chk == &chk);
+        if (chk.free_list_pos + 1 < flist.size()) {
+            flist[chk.free_list_pos] = flist.back();
+            flist[chk.free_list_pos].chk->free_list_pos = chk.free_list_pos;
+        }
+        flist.pop_back();
+        if (flist.empty()) {
+            sl_bitmaps[idx.fl] &= ~(std::uint64_t(1) << idx.sl);
+            if (sl_bitmaps[idx.fl] == 0)
+                fl_bitmap &= ~(std::uint64_t(1) << idx.fl);
+        }
+        free_blocks -= chk.cnt;
+        --free_chunks;
+    }
+
+    [[nodiscard]] auto find_free_chunk(std::size_t count) -> chunk * {
+        auto [fl, sl] = tlsf_search_index_for_count(count);
+        if (fl < sl_bitmaps.size()) {
+            auto sl_map = sl_bitmaps[fl] & (~std::uint64_t(0) << sl);
+            if (sl_map == 0) {
+                auto const fl_map =
+                    fl_bitmap & (~std::uint64_t(0) << (fl + 1));
+                if (fl_map != 0) {
+                    fl = static_cast<std::size_t>(countr_zero(fl_map));
+                    sl_map = sl_bitmaps[fl];
+                }
+            }
+            if (sl_map != 0) {
+                sl = static_cast<std::size_t>(countr_zero(sl_map));
+                return free_list_at({fl, sl}).back().chk;
+            }
+        }
+
+        // No bin is guaranteed to have a large enough chunk, but the
+        // (partially smaller) bin containing 'count' might. This is the only
+        // case that requires a linear scan, and it only happens when the
+        // arena is nearly full (or fragmented) for the requested count.
+        auto const &flist = free_list_at(tlsf_index_for_count(count));
+        for (auto it = flist.rbegin(), e = flist.rend(); it != e; ++it) {
+            if (it->cnt >= count)
+                return it->chk;
+        }
+        return nullptr;
+    }
+
+    // Number of blocks to skip at the start of a chunk for alignment.
+    static auto padding(std::size_t start, std::size_t alignment) noexcept
+        -> std::size_t {
+        return (alignment - start % alignment) % alignment;
+    }
+
+    [[nodiscard]] auto find_free_chunk(std::size_t count,
+                                       std::size_t alignment) -> chunk * {
+        // Any chunk of count + alignment - 1 blocks fits regardless of its
+        // start, so look for such a chunk first.
+        bool const can_pad = alignment - 1 <= siz - count;
+        auto const padded = can_pad ? count + (alignment - 1) : siz;
+        if (can_pad) {
+            if (auto *chk = find_free_chunk(padded); chk != nullptr)
+                return chk;
+        }
+
+        // Otherwise, a smaller chunk may still fit if its start happens to be
+        // suitably aligned; scan the bins from 'count' up to 'padded'.
+        auto const first = tlsf_index_for_count(count);
+        auto const last = tlsf_index_for_count(padded);
+        for (auto i = first.fl * tlsf_sl_count + first.sl;
+             i <= last.fl * tlsf_sl_count + last.sl && i < free_lists.size();
+             ++i) {
+            auto const &flist = free_lists[i];
+            for (auto it = flist.rbegin(), e = flist.rend(); it != e; ++it) {
+                auto const pad = padding(it->strt, alignment);
+                if (it->cnt >= pad && it->cnt - pad >= count)
+                    return it->chk;
+            }
+        }
+        return nullptr;
+    }
+
+    void note_merged(chunk const &erased, chunk &into) noexcept {
+        if (scan_next == &erased)
+            scan_next = &into;
+    }
+
+    // Unless 'zeroed', the chunk is assumed to have been written (and is
+    // held for scrubbing if enabled).
+    void deallocate(chunk *chk, bool zeroed = false) {
         if (chk == nullptr)
             return;
         assert(chk->in_use);
         assert(chk->cnt > 0);
 
+        if (scrub_freed && not zeroed) {
+            to_scrub.push_back(chk);
+            return;
+        }
+
         chk->in_use = false;
+        if (zeroed) {
+            chk->dirty_begin = chk->dirty_end = 0;
+        } else {
+            chk->dirty_begin = chk->strt;
+            chk->dirty_end = chk->strt + chk->cnt;
+        }
 
         auto chkit = chunks.iterator_to(*chk);
 
@@ -327,10 +837,11 @@ class arena {
         auto prev = chkit;
         --prev;
         if (not prev->in_use) {
-            auto &flist = free_list_for_count(prev->cnt);
-            flist.erase(flist.iterator_to(*prev));
+            remove_free_chunk(*prev);
             chk->strt = prev->strt;
             chk->cnt += prev->cnt;
+            merge_dirty_range(*chk, *prev);
+            note_merged(*prev, *chk);
             chunks.erase(prev);
             chunk_storage.erase(chunk_storage.get_iterator(&*prev));
         }
@@ -339,29 +850,55 @@ class arena {
         auto next = chkit;
         ++next;
         if (not next->in_use) {
-            auto &flist = free_list_for_count(next->cnt);
-            flist.erase(flist.iterator_to(*next));
+            remove_free_chunk(*next);
             chk->cnt += next->cnt;
+            merge_dirty_range(*chk, *next);
+            note_merged(*next, *chk);
             chunks.erase(next);
             chunk_storage.erase(chunk_storage.get_iterator(&*next));
         }
 
-        free_list_for_count(chk->cnt).push_front(*chk);
+        insert_free_chunk(*chk);
     }
 };
 
 } // namespace internal
 
+// Occupancy and fragmentation of an allocator (or several, in which case
+// 'largest_free' is the maximum and the rest are sums). Sizes are in bytes.
+struct allocator_stats {
+    std::size_t size = 0;
+    std::size_t free = 0;
+    std::size_t largest_free = 0; // Largest allocation that can succeed
+    std::size_t free_chunks = 0;
+
+    void add(allocator_stats const &other) noexcept {
+        size += other.size;
+        free += other.free;
+        largest_free = std::max(largest_free, other.largest_free);
+        free_chunks += other.free_chunks;
+    }
+};
+
 // Wrap arena to present an interface in terms of bytes instead of block
-// counts.
+// counts. The arena may manage a range of the segment starting at
+// 'base_offset' (a multiple of the block size), in which case offsets are
+// still relative to the segment.
 template <typename Arena> class basic_allocator {
     Arena arn;
     std::size_t shift; // Block size == 2^shift
+    std::uint32_t seg_id;
+    std::size_t base;
 
   public:
-    explicit basic_allocator(std::size_t size, std::size_t log2_block_size)
-        : arn(size >> log2_block_size), shift(log2_block_size) {
+    explicit basic_allocator(std::size_t size, std::size_t log2_block_size,
+                             std::uint32_t segment_id = 0,
+                             bool zero_filled = false,
+                             std::size_t base_offset = 0)
+        : arn(size >> log2_block_size, zero_filled), shift(log2_block_size),
+          seg_id(segment_id), base(base_offset) {
         assert(log2_block_size < 8 * sizeof(std::size_t));
+        assert((base_offset & ((std::size_t(1) << shift) - 1)) == 0);
     }
 
     [[nodiscard]] auto size() const noexcept -> std::size_t {
@@ -372,37 +909,169 @@ template <typename Arena> class basic_allocator {
         return shift;
     }
 
+    [[nodiscard]] auto segment_id() const noexcept -> std::uint32_t {
+        return seg_id;
+    }
+
+    [[nodiscard]] auto base_offset() const noexcept -> std::size_t {
+        return base;
+    }
+
+    // True if 'offset' (in the segment) is in the range managed.
+    [[nodiscard]] auto contains(std::size_t offset) const noexcept -> bool {
+        return offset >= base && offset - base < size();
+    }
+
+    [[nodiscard]] auto stats() const noexcept -> allocator_stats {
+        return {arn.size() << shift, arn.free_count() << shift,
+                arn.largest_free_count() << shift, arn.free_chunk_count()};
+    }
+
+    // Sizes (in bytes, increasing) to which the arena rounds up allocations:
+    // an allocation of a given size reserves the smallest listed size that
+    // is not less than it. Sizes beyond the last listed one (all sizes, if
+    // the list is empty) are only rounded up to the block size. The
+    // allocation's size() does not include this rounding, so clients may
+    // use the list to request the full size that would be reserved anyway.
+    [[nodiscard]] auto size_classes() const -> std::vector<std::size_t> {
+        auto ret = arn.size_classes();
+        for (auto &c : ret)
+            c <<= shift;
+        return ret;
+    }
+
     class allocation {
         typename Arena::allocation alloc;
         std::size_t shft;
+        std::uint32_t seg_id;
+        std::size_t base;
 
         friend class basic_allocator;
 
         explicit allocation(typename Arena::allocation &&arena_allocation,
-                            std::size_t shift)
-            : alloc(std::move(arena_allocation)), shft(shift) {}
+                            std::size_t shift, std::uint32_t segment_id,
+                            std::size_t base_offset)
+            : alloc(std::move(arena_allocation)), shft(shift),
+              seg_id(segment_id), base(base_offset) {}
 
       public:
-        allocation() noexcept : shft(0) {}
+        allocation() noexcept : shft(0), seg_id(0), base(0) {}
 
         operator bool() const noexcept { return bool(alloc); }
 
         [[nodiscard]] auto segment_id() const noexcept -> std::uint32_t {
-            return 0;
+            return seg_id;
         }
 
         [[nodiscard]] auto offset() const noexcept -> std::size_t {
-            return alloc.start() << shft;
+            return base + (alloc.start() << shft);
         }
 
         [[nodiscard]] auto size() const noexcept -> std::size_t {
             return alloc.count() << shft;
         }
+
+        [[nodiscard]] auto is_zeroed() const noexcept -> bool {
+            return alloc.is_zeroed();
+        }
     };
 
-    [[nodiscard]] auto allocate(std::size_t size) -> allocation {
+    // If 'alignment' (a power of 2, in bytes) is greater than the block
+    // size, the offset of the allocation is a multiple of it.
+    [[nodiscard]] auto allocate(std::size_t size, std::size_t alignment = 0)
+        -> allocation {
+        assert((alignment & (alignment - 1)) == 0);
         auto count = size == 0 ? 0 : ((size - 1) >> shift) + 1;
-        return allocation(arn.allocate(count), shift);
+        auto const align_blocks = std::max(alignment >> shift, std::size_t(1));
+        return allocation(arn.allocate(count, align_blocks), shift, seg_id,
+                          base);
+    }
+
+    // Allocate exactly the given byte range, which must start at a multiple
+    // of the block size (see arena::allocate_at()).
+    [[nodiscard]] auto allocate_at(std::size_t offset, std::size_t size)
+        -> allocation {
+        if ((offset & ((std::size_t(1) << shift) - 1)) != 0 || offset < base)
+            return {};
+        auto count = size == 0 ? 0 : ((size - 1) >> shift) + 1;
+        return allocation(arn.allocate_at((offset - base) >> shift, count),
+                          shift, seg_id, base);
+    }
+
+    // Change the size of 'alloc' (which must be from this allocator) to
+    // 'size' bytes without moving it (see arena::resize()). Return false,
+    // leaving 'alloc' unchanged, if this is not possible or if the arena
+    // does not support resizing (only the free-list arena does).
+    [[nodiscard]] auto resize(allocation &alloc, std::size_t size) -> bool {
+        assert(alloc);
+        if constexpr (std::is_same_v<Arena, internal::arena>) {
+            auto const count = size == 0 ? 0 : ((size - 1) >> shift) + 1;
+            return arn.resize(alloc.alloc, count);
+        } else {
+            return false;
+        }
+    }
+
+    // Call 'release(offset, size)' (in bytes) for free chunks of at least
+    // 'min_size' bytes that may have been written; see
+    // arena::release_free_chunks(). Return the number of bytes released.
+    template <typename F>
+    auto release_free_chunks(std::size_t min_size, F &&release)
+        -> std::size_t {
+        auto const min_count =
+            min_size == 0 ? 0 : ((min_size - 1) >> shift) + 1;
+        auto const released = arn.release_free_chunks(
+            min_count, [&](std::size_t start, std::size_t count) {
+                return release(base + (start << shift), count << shift);
+            });
+        return released << shift;
+    }
+
+    // Pass up to 'max_count' chunks to 'f(offset, size, in_use)' (in bytes)
+    // and return true if more remain; see arena::scan_chunks(). Only the
+    // free-list arena keeps a chunk map; with others, nothing is passed.
+    template <typename F>
+    auto scan_chunks(std::size_t max_count, F &&f) -> bool {
+        if constexpr (std::is_same_v<Arena, internal::arena>) {
+            return arn.scan_chunks(
+                max_count,
+                [&](std::size_t start, std::size_t count, bool in_use) {
+                    f(base + (start << shift), count << shift, in_use);
+                });
+        } else {
+            (void)max_count;
+            (void)f;
+            return false;
+        }
+    }
+
+    // See arena::set_scrub_on_free(). Only the free-list arena supports
+    // scrubbing; with others, this has no effect.
+    void set_scrub_on_free(bool enable) noexcept {
+        if constexpr (std::is_same_v<Arena, internal::arena>)
+            arn.set_scrub_on_free(enable);
+        else
+            (void)enable;
+    }
+
+    [[nodiscard]] auto take_chunks_to_scrub() -> std::vector<allocation> {
+        std::vector<allocation> ret;
+        if constexpr (std::is_same_v<Arena, internal::arena>) {
+            auto allocs = arn.take_chunks_to_scrub();
+            ret.reserve(allocs.size());
+            for (auto &a : allocs)
+                ret.push_back(allocation(std::move(a), shift, seg_id, base));
+        }
+        return ret;
+    }
+
+    // 'alloc' must be from this allocator and have been zero-filled.
+    void free_scrubbed(allocation &&alloc) {
+        assert(alloc);
+        if constexpr (std::is_same_v<Arena, internal::arena>)
+            arn.free_scrubbed(std::move(alloc.alloc));
+        else
+            alloc = {};
     }
 
     [[nodiscard]] auto arena() noexcept -> Arena & { return arn; }
@@ -0,0 +1,121 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "allocator.hpp"
+#include "buddy_arena.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+constexpr std::size_t arena_blocks = std::size_t(1) << 24;
+
+// Chunk sizes (in blocks) resembling a typical workload: mostly small
+// buffers, some medium, and a few large ones.
+auto size_mix(std::size_t n, std::uint32_t seed) -> std::vector<std::size_t> {
+    std::mt19937 gen(seed);
+    std::discrete_distribution<int> size_class({70.0, 25.0, 5.0});
+    std::uniform_int_distribution<std::size_t> small(1, 4);
+    std::uniform_int_distribution<std::size_t> medium(5, 64);
+    std::uniform_int_distribution<std::size_t> large(65, 1024);
+    std::vector<std::size_t> ret;
+    ret.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        switch (size_class(gen)) {
+        case 0:
+            ret.push_back(small(gen));
+            break;
+        case 1:
+            ret.push_back(medium(gen));
+            break;
+        default:
+            ret.push_back(large(gen));
+            break;
+        }
+    }
+    return ret;
+}
+
+auto random_indices(std::size_t n, std::size_t bound, std::uint32_t seed)
+    -> std::vector<std::size_t> {
+    std::mt19937 gen(seed);
+    std::uniform_int_distribution<std::size_t> dist(0, bound - 1);
+    std::vector<std::size_t> ret;
+    ret.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+        ret.push_back(dist(gen));
+    return ret;
+}
+
+// Steady state with range(0) live allocations: each iteration frees a
+// random allocation and allocates a chunk in its place.
+template <typename Arena> void bm_arena_churn(benchmark::State &state) {
+    auto const live = static_cast<std::size_t>(state.range(0));
+    auto const sizes = size_mix(4096, 42);
+    auto const victims = random_indices(4096, live, 43);
+    Arena a(arena_blocks);
+    std::vector<typename Arena::allocation> allocs(live);
+    for (std::size_t i = 0; i < live; ++i)
+        allocs[i] = a.allocate(sizes[i % sizes.size()]);
+
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto &victim = allocs[victims[i % victims.size()]];
+        victim = typename Arena::allocation();
+        victim = a.allocate(sizes[i % sizes.size()]);
+        benchmark::DoNotOptimize(victim.start());
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Allocate and free a 2-block chunk when the arena's free space is mostly
+// fragmented into range(0) 1-block holes.
+template <typename Arena> void bm_arena_fragmented(benchmark::State &state) {
+    auto const holes = static_cast<std::size_t>(state.range(0));
+    Arena a(arena_blocks);
+    std::vector<typename Arena::allocation> allocs;
+    allocs.reserve(2 * holes);
+    for (std::size_t i = 0; i < 2 * holes; ++i)
+        allocs.push_back(a.allocate(1));
+    for (std::size_t i = 0; i < 2 * holes; i += 2)
+        allocs[i] = typename Arena::allocation();
+
+    for (auto _ : state) {
+        auto alloc = a.allocate(2);
+        benchmark::DoNotOptimize(alloc.start());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(bm_arena_churn, internal::arena)
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000);
+BENCHMARK_TEMPLATE(bm_arena_churn, internal::buddy_arena)
+    ->RangeMultiplier(10)
+    ->Range(1000, 100000);
+
+BENCHMARK_TEMPLATE(bm_arena_fragmented, internal::arena)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+BENCHMARK_TEMPLATE(bm_arena_fragmented, internal::buddy_arena)
+    ->RangeMultiplier(10)
+    ->Range(1000, 1000000);
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace
+
+} // namespace partake::daemon
@@ -0,0 +1,9 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <benchmark/benchmark.h>
+
+BENCHMARK_MAIN();
@@ -0,0 +1,188 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "request_handler.hpp"
+
+#include <benchmark/benchmark.h>
+#include <flatbuffers/flatbuffers.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+struct fake_resource {
+    [[nodiscard]] auto segment_id() const -> std::uint32_t { return 0; }
+    [[nodiscard]] auto offset() const -> std::size_t { return 4096; }
+    [[nodiscard]] auto size() const -> std::size_t { return 1000; }
+    [[nodiscard]] auto is_zeroed() const -> bool { return false; }
+};
+
+// A session that completes Alloc and Close immediately and successfully, so
+// that what is measured is the request handler's own overhead (decoding,
+// dispatch, and response encoding). Other requests are not benchmarked and
+// are ignored. (The trompeloeil mocks used by the unit tests would dominate
+// the timings.)
+struct fake_session {
+    struct object_type {
+        using resource_type = fake_resource;
+    };
+
+    std::uint64_t next_key = 1;
+    fake_resource rsrc;
+
+    template <typename Success, typename Error>
+    void alloc(std::uint64_t /* size */, protocol::Policy /* policy */,
+               int /* numa_node */, std::uint64_t /* alignment */,
+               Success on_success, Error /* on_error */) {
+        on_success(common::token(next_key++), rsrc);
+    }
+
+    template <typename Success, typename Error, typename DeferredSuccess,
+              typename DeferredError>
+    void alloc_when_ready(std::uint64_t size, protocol::Policy policy,
+                          int numa_node, std::uint64_t alignment,
+                          Success on_success, Error on_error,
+                          DeferredSuccess /* on_deferred_success */,
+                          DeferredError /* on_deferred_error */) {
+        alloc(size, policy, numa_node, alignment, on_success, on_error);
+    }
+
+    template <typename Success, typename Error>
+    void close(common::token /* key */, Success on_success,
+               Error /* on_error */) {
+        on_success();
+    }
+
+    [[nodiscard]] auto
+    wake_word_offset(fake_resource const & /* rsrc */) const -> std::uint64_t {
+        return 0;
+    }
+
+    template <typename... Args> void hello(Args &&.../* args */) {}
+    template <typename... Args>
+    [[nodiscard]] auto bind_sub_pool(Args &&.../* args */) -> bool {
+        return true;
+    }
+    template <typename... Args> void get_segment(Args &&.../* args */) {}
+    template <typename... Args> void alloc_or_wait(Args &&.../* args */) {}
+    template <typename... Args> void alloc_extents(Args &&.../* args */) {}
+    template <typename... Args> void alloc_ring(Args &&.../* args */) {}
+    template <typename... Args>
+    void get_allocator_info(Args &&.../* args */) const {}
+    template <typename... Args> void clone(Args &&.../* args */) {}
+    template <typename... Args> void map_range(Args &&.../* args */) {}
+    template <typename... Args>
+    void map_for_prefetch(Args &&.../* args */) {}
+    template <typename... Args> void open(Args &&.../* args */) {}
+    template <typename... Args> void open_extents(Args &&.../* args */) {}
+    template <typename... Args> void share(Args &&.../* args */) {}
+    template <typename... Args> void share_dedup(Args &&.../* args */) {}
+    template <typename... Args> void unshare(Args &&.../* args */) {}
+    template <typename... Args> void resize(Args &&.../* args */) {}
+    template <typename... Args> void renew_leases(Args &&.../* args */) {}
+    template <typename... Args> void create_voucher(Args &&.../* args */) {}
+    template <typename... Args> void discard_voucher(Args &&.../* args */) {}
+    template <typename... Args>
+    void share_and_create_voucher(Args &&.../* args */) {}
+    template <typename... Args> void create_pool(Args &&.../* args */) {}
+    template <typename... Args> void alloc_from_pool(Args &&.../* args */) {}
+    template <typename... Args> void destroy_pool(Args &&.../* args */) {}
+    template <typename... Args> void subscribe(Args &&.../* args */) {}
+    template <typename... Args> void unsubscribe(Args &&.../* args */) {}
+    template <typename... Args> void publish(Args &&.../* args */) {}
+    template <typename... Args>
+    void subscribe_relocation(Args &&.../* args */) {}
+};
+
+template <typename MakeRequest>
+auto encode_batch(std::size_t n, MakeRequest make_request)
+    -> flatbuffers::DetachedBuffer {
+    flatbuffers::FlatBufferBuilder b;
+    std::vector<flatbuffers::Offset<protocol::Request>> reqs;
+    reqs.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+        reqs.push_back(make_request(b, i));
+    b.FinishSizePrefixed(
+        protocol::CreateRequestMessage(b, b.CreateVector(reqs)));
+    return b.Release();
+}
+
+void run_batch(benchmark::State &state, flatbuffers::DetachedBuffer &msg,
+               std::size_t batch_size, daemon_stats *stats = nullptr) {
+    fake_session sess;
+    std::size_t resp_bytes = 0;
+    auto write = [&](flatbuffers::DetachedBuffer &&resp) {
+        resp_bytes += resp.size();
+    };
+    auto housekeep = [] {};
+    auto on_error = [](std::error_code /* ec */) {};
+    auto rh = request_handler<fake_session, decltype(write),
+                              decltype(housekeep), decltype(on_error)>(
+        sess, write, housekeep, on_error, {}, nullptr, false, stats);
+    auto const bytes = gsl::span<std::uint8_t const>(msg.data(), msg.size());
+
+    for (auto _ : state) {
+        auto const done = rh.handle_message(bytes);
+        benchmark::DoNotOptimize(done);
+    }
+    benchmark::DoNotOptimize(resp_bytes);
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<std::int64_t>(batch_size));
+    state.SetBytesProcessed(state.iterations() *
+                            static_cast<std::int64_t>(msg.size()));
+}
+
+// A message containing range(0) Ping requests.
+void bm_request_handler_ping(benchmark::State &state) {
+    auto const n = static_cast<std::size_t>(state.range(0));
+    auto msg = encode_batch(n, [](auto &b, std::size_t i) {
+        return protocol::CreateRequest(b, i, protocol::AnyRequest::PingRequest,
+                                       protocol::CreatePingRequest(b).Union());
+    });
+    run_batch(state, msg, n);
+}
+
+// A message containing range(0) Alloc requests, with recording of
+// per-request statistics enabled if range(1) is nonzero.
+void bm_request_handler_alloc(benchmark::State &state) {
+    auto const n = static_cast<std::size_t>(state.range(0));
+    auto msg = encode_batch(n, [](auto &b, std::size_t i) {
+        return protocol::CreateRequest(
+            b, i, protocol::AnyRequest::AllocRequest,
+            protocol::CreateAllocRequest(b, 1000).Union());
+    });
+    daemon_stats stats;
+    run_batch(state, msg, n, state.range(1) != 0 ? &stats : nullptr);
+}
+
+// A message containing range(0) Close requests.
+void bm_request_handler_close(benchmark::State &state) {
+    auto const n = static_cast<std::size_t>(state.range(0));
+    auto msg = encode_batch(n, [](auto &b, std::size_t i) {
+        return protocol::CreateRequest(
+            b, i, protocol::AnyRequest::CloseRequest,
+            protocol::CreateCloseRequest(b, i + 1).Union());
+    });
+    run_batch(state, msg, n);
+}
+
+BENCHMARK(bm_request_handler_ping)->RangeMultiplier(8)->Range(1, 512);
+BENCHMARK(bm_request_handler_alloc)
+    ->ArgsProduct({benchmark::CreateRange(1, 512, 8), {0, 1}});
+BENCHMARK(bm_request_handler_close)->RangeMultiplier(8)->Range(1, 512);
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace
+
+} // namespace partake::daemon
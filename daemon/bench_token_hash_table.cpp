@@ -0,0 +1,174 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "key_sequence.hpp"
+#include "token_hash_table.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+struct elem {
+    common::token ky;
+    explicit elem(common::token key) : ky(key) {}
+    [[nodiscard]] auto key() const -> common::token { return ky; }
+};
+
+// Elements with keys as generated by the daemon.
+auto make_elems(std::size_t n) -> std::vector<elem> {
+    key_sequence seq;
+    std::vector<elem> ret;
+    ret.reserve(n);
+    for (std::size_t i = 0; i < n; ++i)
+        ret.emplace_back(seq.generate());
+    return ret;
+}
+
+void fill(token_hash_table<elem> &t, std::vector<elem> &elems) {
+    for (auto &e : elems)
+        t.insert(e);
+    t.finish_resize();
+}
+
+// Successful lookups, in random order, in a table of range(0) elements.
+void bm_token_hash_table_find(benchmark::State &state) {
+    auto const n = static_cast<std::size_t>(state.range(0));
+    auto elems = make_elems(n);
+    token_hash_table<elem> t;
+    fill(t, elems);
+    std::vector<common::token> keys;
+    keys.reserve(n);
+    for (auto const &e : elems)
+        keys.push_back(e.key());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+    std::size_t i = 0;
+    for (auto _ : state) {
+        auto it = t.find(keys[i]);
+        benchmark::DoNotOptimize(&*it);
+        if (++i == n)
+            i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Unsuccessful lookups in a table of range(0) elements.
+void bm_token_hash_table_find_missing(benchmark::State &state) {
+    auto const n = static_cast<std::size_t>(state.range(0));
+    auto elems = make_elems(2 * n);
+    token_hash_table<elem> t;
+    for (std::size_t i = 0; i < n; ++i)
+        t.insert(elems[i]);
+    t.finish_resize();
+
+    std::size_t i = n;
+    for (auto _ : state) {
+        auto it = t.find(elems[i].key());
+        benchmark::DoNotOptimize(it == t.end());
+        if (++i == 2 * n)
+            i = n;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Steady state with range(0) elements: each iteration inserts a new element
+// and erases the oldest, leaving tombstones that housekeeping must clear.
+void bm_token_hash_table_insert_erase(benchmark::State &state) {
+    auto const n = static_cast<std::size_t>(state.range(0));
+    auto elems = make_elems(2 * n);
+    token_hash_table<elem> t;
+    for (std::size_t i = 0; i < n; ++i)
+        t.insert(elems[i]);
+    t.finish_resize();
+
+    std::size_t oldest = 0;
+    std::size_t next = n;
+    for (auto _ : state) {
+        t.erase(t.iterator_to(elems[oldest]));
+        t.insert(elems[next]);
+        oldest = (oldest + 1) % (2 * n);
+        next = (next + 1) % (2 * n);
+        // Per request message in the daemon; here, per 64 requests.
+        if (next % 64 == 0)
+            t.rehash_if_appropriate(false);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Insert range(0) elements into an empty table, including incremental
+// resizes.
+void bm_token_hash_table_grow(benchmark::State &state) {
+    auto const n = static_cast<std::size_t>(state.range(0));
+    auto elems = make_elems(n);
+    for (auto _ : state) {
+        token_hash_table<elem> t;
+        for (auto &e : elems)
+            t.insert(e);
+        benchmark::DoNotOptimize(t.size());
+        state.PauseTiming(); // Exclude deallocation
+        t = token_hash_table<elem>();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Shrink a table of range(0) elements after all but 1/16 of them have been
+// erased, as done by housekeeping.
+void bm_token_hash_table_shrink(benchmark::State &state) {
+    auto const n = static_cast<std::size_t>(state.range(0));
+    auto const kept = n / 16;
+    auto elems = make_elems(n);
+    for (auto _ : state) {
+        state.PauseTiming();
+        token_hash_table<elem> t;
+        fill(t, elems);
+        for (std::size_t i = kept; i < n; ++i)
+            t.erase(t.iterator_to(elems[i]));
+        state.ResumeTiming();
+        t.rehash_if_appropriate();
+        t.finish_resize();
+        benchmark::DoNotOptimize(t.capacity());
+        state.PauseTiming(); // Exclude deallocation
+        t = token_hash_table<elem>();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() *
+                            static_cast<std::int64_t>(kept));
+}
+
+BENCHMARK(bm_token_hash_table_find)
+    ->RangeMultiplier(10)
+    ->Range(1000, 10'000'000);
+BENCHMARK(bm_token_hash_table_find_missing)
+    ->RangeMultiplier(10)
+    ->Range(1000, 10'000'000);
+BENCHMARK(bm_token_hash_table_insert_erase)
+    ->RangeMultiplier(10)
+    ->Range(1000, 10'000'000);
+BENCHMARK(bm_token_hash_table_grow)
+    ->RangeMultiplier(10)
+    ->Range(1000, 10'000'000)
+    ->Unit(benchmark::kMillisecond);
+BENCHMARK(bm_token_hash_table_shrink)
+    ->RangeMultiplier(10)
+    ->Range(1000, 10'000'000)
+    ->Unit(benchmark::kMillisecond);
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace
+
+} // namespace partake::daemon
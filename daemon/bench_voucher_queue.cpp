@@ -0,0 +1,147 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "voucher_queue.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+// Clock traits with a manually advanced clock, whose (single) pending timer
+// handler is run on demand, so that expiration can be benchmarked without
+// waiting.
+struct manual_clock_traits {
+    static inline time_point current{};
+    static inline time_point pending_deadline{};
+    static inline std::function<void(boost::system::error_code)> pending;
+
+    struct timer_type {
+        time_point deadline;
+
+        // NOLINTNEXTLINE(readability-convert-member-functions-to-static)
+        void cancel() { pending = {}; }
+
+        template <typename H> void async_wait(H h) {
+            pending_deadline = deadline;
+            pending = std::move(h);
+        }
+    };
+
+    static auto now() -> time_point { return current; }
+
+    // NOLINTBEGIN(readability-convert-member-functions-to-static)
+    auto make_timer() -> timer_type { return {}; }
+    auto make_timer(time_point tp) -> timer_type { return {tp}; }
+    // NOLINTEND(readability-convert-member-functions-to-static)
+
+    // Advance the clock to the pending timer's deadline and run its handler.
+    // Return false if no timer was pending.
+    static auto run_pending() -> bool {
+        auto h = std::exchange(pending, {});
+        if (not h)
+            return false;
+        current = std::max(current, pending_deadline);
+        h(boost::system::error_code());
+        return true;
+    }
+};
+
+struct bench_voucher : ref_counted<bench_voucher> {
+    time_point exp;
+    voucher_queue_node<bench_voucher> node;
+
+    explicit bench_voucher(time_point expiration) : exp(expiration) {}
+
+    auto as_voucher() -> bench_voucher & { return *this; }
+
+    [[nodiscard]] auto expiration() const -> time_point { return exp; }
+
+    auto queue_node() -> voucher_queue_node<bench_voucher> & { return node; }
+};
+
+using queue_type = voucher_queue<bench_voucher, manual_clock_traits>;
+
+// Enqueue range(0) vouchers with the same TTL (as the daemon does), staggered
+// over 10 seconds, then let them all expire. Voucher creation is excluded.
+void bm_voucher_queue_enqueue_expire(benchmark::State &state) {
+    using namespace std::chrono_literals;
+    auto const n = static_cast<std::size_t>(state.range(0));
+    manual_clock_traits traits;
+    queue_type q(traits);
+    std::vector<ref_ptr<bench_voucher>> vouchers;
+    vouchers.reserve(n);
+
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto const start = manual_clock_traits::now();
+        for (std::size_t i = 0; i < n; ++i) {
+            auto const stagger = std::chrono::milliseconds(
+                static_cast<std::int64_t>(10'000 * i / n));
+            vouchers.push_back(make_ref<bench_voucher>(start + 30s + stagger));
+        }
+        state.ResumeTiming();
+
+        for (auto const &v : vouchers)
+            q.enqueue(v);
+        state.PauseTiming();
+        vouchers.clear(); // Queue is now the only owner
+        state.ResumeTiming();
+
+        while (manual_clock_traits::run_pending())
+            continue;
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+// Enqueue and drop (as when a voucher is claimed) with range(0) vouchers
+// remaining in the queue.
+void bm_voucher_queue_enqueue_drop(benchmark::State &state) {
+    using namespace std::chrono_literals;
+    auto const n = static_cast<std::size_t>(state.range(0));
+    manual_clock_traits traits;
+    queue_type q(traits);
+    auto const exp = manual_clock_traits::now() + 30s;
+    std::vector<ref_ptr<bench_voucher>> resident;
+    resident.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+        resident.push_back(make_ref<bench_voucher>(exp));
+        q.enqueue(resident.back());
+    }
+    auto const v = make_ref<bench_voucher>(exp);
+
+    for (auto _ : state) {
+        q.enqueue(v);
+        q.drop(v);
+    }
+    state.SetItemsProcessed(state.iterations());
+    q.drop_all();
+}
+
+BENCHMARK(bm_voucher_queue_enqueue_expire)
+    ->RangeMultiplier(10)
+    ->Range(100, 1'000'000)
+    ->Unit(benchmark::kMicrosecond);
+BENCHMARK(bm_voucher_queue_enqueue_drop)
+    ->RangeMultiplier(100)
+    ->Range(1, 1'000'000);
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace
+
+} // namespace partake::daemon
@@ -0,0 +1,213 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "buddy_arena.hpp"
+
+#include <doctest.h>
+
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("buddy_arena") {
+    using internal::buddy_arena;
+    CHECK(buddy_arena(0).size() == 0);
+    CHECK(buddy_arena(1).size() == 1);
+    CHECK(buddy_arena(10).size() == 10);
+
+    CHECK_FALSE(buddy_arena(0).allocate(1));
+
+    SUBCASE("split and merge") {
+        auto a = buddy_arena(8);
+        auto a0 = a.allocate(1);
+        REQUIRE(a0);
+        CHECK(a0.start() == 0);
+        CHECK(a0.count() == 1);
+        auto a1 = a.allocate(2);
+        REQUIRE(a1);
+        CHECK(a1.start() == 2);
+        auto a2 = a.allocate(3); // Rounded up to 4
+        REQUIRE(a2);
+        CHECK(a2.start() == 4);
+        CHECK(a2.count() == 3);
+        auto a3 = a.allocate(0);
+        REQUIRE(a3);
+        CHECK(a3.start() == 1);
+        CHECK_FALSE(a.allocate(1));
+
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a3); }
+        CHECK_FALSE(a.allocate(4)); // a1 still in use
+        { auto discard = std::move(a1); }
+        auto a4 = a.allocate(4);
+        REQUIRE(a4);
+        CHECK(a4.start() == 0);
+    }
+
+    SUBCASE("full merge") {
+        auto a = buddy_arena(16);
+        {
+            auto a0 = a.allocate(1);
+            auto a1 = a.allocate(5);
+            auto a2 = a.allocate(2);
+            CHECK(a0);
+            CHECK(a1);
+            CHECK(a2);
+        }
+        auto all = a.allocate(16);
+        REQUIRE(all);
+        CHECK(all.start() == 0);
+    }
+
+    SUBCASE("non-power-of-2 size") {
+        auto a = buddy_arena(6);
+        CHECK_FALSE(a.allocate(5));
+        auto a0 = a.allocate(4);
+        REQUIRE(a0);
+        CHECK(a0.start() == 0);
+        auto a1 = a.allocate(2);
+        REQUIRE(a1);
+        CHECK(a1.start() == 4);
+        CHECK_FALSE(a.allocate(1));
+        { auto discard = std::move(a1); }
+        // Blocks at 4 must not merge with out-of-range buddy.
+        auto a2 = a.allocate(1);
+        auto a3 = a.allocate(1);
+        REQUIRE(a2);
+        REQUIRE(a3);
+        CHECK_FALSE(a.allocate(1));
+    }
+
+    SUBCASE("alignment") {
+        auto a = buddy_arena(16);
+        auto a0 = a.allocate(1);
+        auto a1 = a.allocate(1, 4);
+        REQUIRE(a1);
+        CHECK(a1.start() == 4);
+        CHECK(a1.count() == 1);
+        CHECK(a.free_count() == 11);
+        auto a2 = a.allocate(1, 32); // Only offset 0 can satisfy
+        CHECK_FALSE(a2);
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a1); }
+        a2 = a.allocate(1, 32);
+        REQUIRE(a2);
+        CHECK(a2.start() == 0);
+    }
+
+    SUBCASE("move assignment") {
+        auto a = buddy_arena(2);
+        auto a0 = a.allocate(1);
+        a0 = a.allocate(1);
+        CHECK(a0.start() == 1);
+        auto a1 = a.allocate(1);
+        REQUIRE(a1);
+        CHECK(a1.start() == 0);
+    }
+}
+
+TEST_CASE("buddy_arena: zero-fill tracking") {
+    using internal::buddy_arena;
+    CHECK_FALSE(buddy_arena(4).allocate(1).is_zeroed());
+
+    auto a = buddy_arena(4, true);
+    auto a0 = a.allocate(1);
+    REQUIRE(a0);
+    CHECK(a0.is_zeroed());
+    auto a1 = a.allocate(1);
+    REQUIRE(a1);
+    CHECK(a1.is_zeroed());
+    { auto discard = std::move(a0); }
+    auto a2 = a.allocate(1);
+    REQUIRE(a2);
+    CHECK(a2.start() == 0);
+    CHECK_FALSE(a2.is_zeroed());
+    auto a3 = a.allocate(2); // Split-off half, never used
+    REQUIRE(a3);
+    CHECK(a3.is_zeroed());
+    { auto discard = std::move(a1); }
+    { auto discard = std::move(a2); }
+    { auto discard = std::move(a3); }
+    // Merged block contains dirty buddies.
+    CHECK_FALSE(a.allocate(4).is_zeroed());
+}
+
+TEST_CASE("buddy_arena: release_free_chunks") {
+    using internal::buddy_arena;
+    std::vector<std::size_t> released; // Start offsets
+    auto const release = [&](std::size_t start, std::size_t count) {
+        (void)count;
+        released.push_back(start);
+        return true;
+    };
+
+    auto a = buddy_arena(8, true);
+    CHECK(a.release_free_chunks(1, release) == 0);
+    auto a0 = a.allocate(2);
+    auto a1 = a.allocate(2);
+    REQUIRE(a1);
+    { auto discard = std::move(a0); }
+    // Free blocks: [0, 2) (dirty), [4, 8).
+    CHECK(a.release_free_chunks(4, release) == 0);
+    CHECK(a.release_free_chunks(2, release) == 2);
+    CHECK(released == std::vector<std::size_t>{0});
+    CHECK(a.release_free_chunks(1, release) == 0);
+    CHECK(a.allocate(2).is_zeroed());
+}
+
+TEST_CASE("buddy_arena: statistics") {
+    using internal::buddy_arena;
+    auto a = buddy_arena(12);
+    CHECK(a.free_count() == 12);
+    CHECK(a.free_chunk_count() == 2); // 8 + 4
+    CHECK(a.largest_free_count() == 8);
+    auto a0 = a.allocate(3); // Rounded up to 4
+    REQUIRE(a0);
+    CHECK(a.free_count() == 8);
+    CHECK(a.largest_free_count() == 8);
+    auto a1 = a.allocate(8);
+    REQUIRE(a1);
+    CHECK(a.free_count() == 0);
+    CHECK(a.free_chunk_count() == 0);
+    CHECK(a.largest_free_count() == 0);
+    { auto discard = std::move(a0); }
+    CHECK(a.free_count() == 4);
+    CHECK(a.largest_free_count() == 4);
+}
+
+TEST_CASE("buddy_arena: large sizes") {
+    using internal::buddy_arena;
+    auto b = buddy_arena(std::size_t(-1));
+    auto const half = std::size_t(1) << (8 * sizeof(std::size_t) - 1);
+    auto const a0 = b.allocate(half);
+    CHECK(a0.count() == half);
+    CHECK_FALSE(b.allocate(half));
+    CHECK_FALSE(b.allocate(std::size_t(-1)));
+}
+
+TEST_CASE("buddy_arena: with basic_allocator") {
+    basic_allocator<internal::buddy_arena> a(1 << 20, 12);
+    auto a0 = a.allocate(4096);
+    auto a1 = a.allocate(3 * 4096);
+    REQUIRE(a0);
+    REQUIRE(a1);
+    CHECK(a0.offset() == 0);
+    CHECK(a1.offset() == 4 * 4096);
+    CHECK(a1.size() == 3 * 4096);
+}
+
+TEST_CASE("buddy_arena: size classes") {
+    using internal::buddy_arena;
+    CHECK(buddy_arena(6).size_classes() == std::vector<std::size_t>{1, 2, 4});
+    basic_allocator<buddy_arena> a(1 << 14, 12);
+    CHECK(a.size_classes() == std::vector<std::size_t>{4096, 8192, 16384});
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,289 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "allocator.hpp"
+
+#include <boost/intrusive/list.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace internal {
+
+// An arena (with the same interface as 'arena') using the binary buddy system.
+// Every chunk occupies a block of 2^k blocks ("order" k) aligned to 2^k, so
+// allocation and deallocation perform at most one split or merge per order,
+// without scanning free lists. The cost is internal fragmentation: requests
+// are rounded up to a power of 2 (but the allocation still reports the
+// requested count).
+//
+// The arena size need not be a power of 2; it is initially covered by the
+// maximal aligned power-of-2 blocks (in decreasing order of size), and merging
+// only happens with buddies that lie entirely within the arena.
+//
+// As with arena, blocks known to be zero-filled are tracked (per free block).
+// A merged block is zero-filled only if both buddies were.
+class buddy_arena {
+    struct free_block : boost::intrusive::list_base_hook<> {
+        std::size_t strt;
+        std::size_t order;
+        bool zeroed;
+
+        explicit free_block(std::size_t start, std::size_t block_order,
+                            bool is_zeroed)
+            : strt(start), order(block_order), zeroed(is_zeroed) {}
+
+        // No move or copy (used with intrusive data structures).
+        ~free_block() = default;
+        free_block(free_block const &) = delete;
+        auto operator=(free_block const &) = delete;
+        free_block(free_block &&) = delete;
+        auto operator=(free_block &&) = delete;
+    };
+
+    using free_list = boost::intrusive::list<free_block>;
+
+    std::size_t siz; // In units of blocks.
+
+    // Free blocks are owned by 'free_blocks' (keyed by start offset; node
+    // addresses are stable) and participate in the free list for their
+    // order. Bit k of 'nonempty_orders' is set iff free_lists[k] is not
+    // empty.
+    std::unordered_map<std::size_t, free_block> free_blocks;
+    std::vector<free_list> free_lists;
+    std::uint64_t nonempty_orders = 0;
+    std::size_t free_blks = 0; // Total over free blocks
+
+    static_assert(8 * sizeof(std::size_t) <= 64);
+
+  public:
+    explicit buddy_arena(std::size_t size, bool zero_filled = false)
+        : siz(size) {
+        if (size == 0)
+            return;
+        free_lists.resize(max_order_for_size(size) + 1);
+        std::size_t offset = 0;
+        for (std::size_t order = free_lists.size(); order-- > 0;) {
+            auto const block = std::size_t(1) << order;
+            if (size - offset >= block) {
+                insert_free_block(offset, order, zero_filled);
+                offset += block;
+            }
+        }
+        assert(offset == size);
+    }
+
+    // No move or copy (address taken by allocation instances)
+    ~buddy_arena() = default;
+    buddy_arena(buddy_arena const &) = delete;
+    auto operator=(buddy_arena const &) = delete;
+    buddy_arena(buddy_arena &&) = delete;
+    auto operator=(buddy_arena &&) = delete;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return siz; }
+
+    [[nodiscard]] auto free_count() const noexcept -> std::size_t {
+        return free_blks;
+    }
+
+    [[nodiscard]] auto free_chunk_count() const noexcept -> std::size_t {
+        return free_blocks.size();
+    }
+
+    [[nodiscard]] auto largest_free_count() const noexcept -> std::size_t {
+        if (nonempty_orders == 0)
+            return 0;
+        return std::size_t(1) << max_order_for_size(
+                   static_cast<std::size_t>(nonempty_orders));
+    }
+
+    // Every allocation is rounded up to a power-of-2 block count.
+    [[nodiscard]] auto size_classes() const -> std::vector<std::size_t> {
+        std::vector<std::size_t> ret;
+        ret.reserve(free_lists.size());
+        for (std::size_t order = 0; order < free_lists.size(); ++order)
+            ret.push_back(std::size_t(1) << order);
+        return ret;
+    }
+
+    // RAII class for chunk allocation
+    class allocation {
+        // arn is nullptr if default-initialized or allocation failed.
+        buddy_arena *arn = nullptr;
+        std::size_t strt = 0;
+        std::size_t cnt = 0;
+        std::size_t ord = 0;
+        bool zeroed = false;
+
+        friend class buddy_arena;
+
+        explicit allocation(buddy_arena *arena, std::size_t start,
+                            std::size_t count, std::size_t order,
+                            bool is_zeroed)
+            : arn(arena), strt(start), cnt(count), ord(order),
+              zeroed(is_zeroed) {}
+
+      public:
+        allocation() noexcept = default;
+
+        ~allocation() {
+            if (arn != nullptr)
+                arn->deallocate(strt, ord);
+        }
+
+        allocation(allocation const &) = delete;
+        auto operator=(allocation const &) = delete;
+
+        allocation(allocation &&other) noexcept
+            : arn(std::exchange(other.arn, nullptr)), strt(other.strt),
+              cnt(other.cnt), ord(other.ord), zeroed(other.zeroed) {}
+
+        auto operator=(allocation &&rhs) noexcept -> allocation & {
+            if (arn != nullptr)
+                arn->deallocate(strt, ord);
+            arn = std::exchange(rhs.arn, nullptr);
+            strt = rhs.strt;
+            cnt = rhs.cnt;
+            ord = rhs.ord;
+            zeroed = rhs.zeroed;
+            return *this;
+        }
+
+        // True if allocation succeeded (even if count is zero).
+        operator bool() const noexcept { return arn != nullptr; }
+
+        [[nodiscard]] auto start() const noexcept -> std::size_t {
+            return arn != nullptr ? strt : 0;
+        }
+
+        [[nodiscard]] auto count() const noexcept -> std::size_t {
+            return arn != nullptr ? cnt : 0;
+        }
+
+        // True if the block was known to be zero-filled when allocated.
+        [[nodiscard]] auto is_zeroed() const noexcept -> bool {
+            return arn != nullptr && zeroed;
+        }
+    };
+
+    // Blocks are naturally aligned to their size, so 'alignment' (a power of
+    // 2, in blocks) is honored by allocating a block of at least that size.
+    [[nodiscard]] auto allocate(std::size_t count, std::size_t alignment = 1)
+        -> allocation {
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+        // As with arena, zero-block chunks are treated as count 1.
+        if (count == 0)
+            count = 1;
+
+        // Smallest order whose block size is at least count. An alignment
+        // exceeding the arena can only be satisfied at offset 0, by the
+        // largest block.
+        auto const order = std::max(
+            free_list_index_for_size(count),
+            std::min(max_order_for_size(alignment), free_lists.size() - 1));
+        if (order >= free_lists.size())
+            return {};
+
+        auto const candidates = nonempty_orders >> order;
+        if (candidates == 0)
+            return {};
+        auto k = order + static_cast<std::size_t>(countr_zero(candidates));
+
+        auto const start = free_lists[k].front().strt;
+        auto const zeroed = erase_free_block(start, k);
+
+        // Split until the block is of the requested order, freeing the upper
+        // halves.
+        while (k > order) {
+            --k;
+            insert_free_block(start + (std::size_t(1) << k), k, zeroed);
+        }
+
+        return allocation(this, start, count, order, zeroed);
+    }
+
+    // Same as arena::release_free_chunks(), but whole free blocks are passed.
+    template <typename F>
+    auto release_free_chunks(std::size_t min_count, F &&release)
+        -> std::size_t {
+        std::size_t released = 0;
+        auto const first =
+            free_list_index_for_size(std::max(min_count, std::size_t(1)));
+        for (auto k = first; k < free_lists.size(); ++k) {
+            auto const block = std::size_t(1) << k;
+            for (auto &blk : free_lists[k]) {
+                if (not blk.zeroed && release(blk.strt, block)) {
+                    blk.zeroed = true;
+                    released += block;
+                }
+            }
+        }
+        return released;
+    }
+
+  private:
+    static auto max_order_for_size(std::size_t size) noexcept -> std::size_t {
+        assert(size > 0);
+        return 8 * sizeof(size) - 1 -
+               static_cast<std::size_t>(countl_zero(size));
+    }
+
+    void insert_free_block(std::size_t start, std::size_t order,
+                           bool zeroed) {
+        auto [it, inserted] =
+            free_blocks.try_emplace(start, start, order, zeroed);
+        assert(inserted);
+        free_lists[order].push_front(it->second);
+        nonempty_orders |= std::uint64_t(1) << order;
+        free_blks += std::size_t(1) << order;
+    }
+
+    // Return whether the erased block was zero-filled.
+    auto erase_free_block(std::size_t start, std::size_t order) -> bool {
+        auto it = free_blocks.find(start);
+        assert(it != free_blocks.end());
+        assert(it->second.order == order);
+        auto const zeroed = it->second.zeroed;
+        auto &flist = free_lists[order];
+        flist.erase(flist.iterator_to(it->second));
+        if (flist.empty())
+            nonempty_orders &= ~(std::uint64_t(1) << order);
+        free_blocks.erase(it);
+        free_blks -= std::size_t(1) << order;
+        return zeroed;
+    }
+
+    void deallocate(std::size_t start, std::size_t order) {
+        // Merge with free buddies as far as possible.
+        while (order + 1 < free_lists.size()) {
+            auto const block = std::size_t(1) << order;
+            auto const buddy = start ^ block;
+            if (buddy > siz - block) // Buddy not entirely within arena
+                break;
+            auto it = free_blocks.find(buddy);
+            if (it == free_blocks.end() || it->second.order != order)
+                break;
+            (void)erase_free_block(buddy, order);
+            start = std::min(start, buddy);
+            ++order;
+        }
+        // The deallocated block is assumed to have been written.
+        insert_free_block(start, order, false);
+    }
+};
+
+} // namespace internal
+
+} // namespace partake::daemon
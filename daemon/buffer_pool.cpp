@@ -0,0 +1,37 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "buffer_pool.hpp"
+
+#include <doctest.h>
+
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("buffer_pool") {
+    buffer_pool<int> pool({1, 2, 3}, protocol::Policy::PRIMITIVE, 64);
+    CHECK(pool.policy() == protocol::Policy::PRIMITIVE);
+    CHECK(pool.buffer_size() == 64);
+    CHECK(pool.buffer_count() == 3);
+    CHECK(pool.free_count() == 3);
+
+    CHECK(pool.acquire() == 1);
+    CHECK(pool.acquire() == 2);
+    CHECK(pool.free_count() == 1);
+    pool.give_back(1);
+    CHECK(pool.acquire() == 3);
+    CHECK(pool.acquire() == 1);
+    CHECK_FALSE(pool.acquire().has_value());
+    CHECK(pool.free_count() == 0);
+    CHECK(pool.buffer_count() == 3);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
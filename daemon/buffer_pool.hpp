@@ -0,0 +1,83 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "partake_protocol_generated.h"
+
+#include <cassert>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+// A fixed set of same-size buffers (resources) reserved by a producer. Free
+// buffers are kept in a ring (FIFO), so that acquiring a buffer is O(1) and
+// the buffer that has been free the longest is reused first (giving slow
+// readers of a recently recycled buffer the most time, in case they race
+// with the daemon). The owner of an object made from an acquired buffer is
+// responsible for giving the buffer back when the object ends its lifetime.
+template <typename Resource> class buffer_pool {
+  public:
+    using resource_type = Resource;
+
+  private:
+    protocol::Policy pol;
+    std::size_t buf_size; // For information; not used by the pool itself
+    std::size_t n_buffers;
+    std::deque<resource_type> free_buffers;
+
+  public:
+    explicit buffer_pool(std::vector<resource_type> &&buffers,
+                         protocol::Policy policy, std::size_t buffer_size = 0)
+        : pol(policy), buf_size(buffer_size), n_buffers(buffers.size()),
+          free_buffers(std::make_move_iterator(buffers.begin()),
+                       std::make_move_iterator(buffers.end())) {}
+
+    // No move or copy (referenced by objects made from its buffers)
+    ~buffer_pool() = default;
+    buffer_pool(buffer_pool const &) = delete;
+    auto operator=(buffer_pool const &) = delete;
+    buffer_pool(buffer_pool &&) = delete;
+    auto operator=(buffer_pool &&) = delete;
+
+    [[nodiscard]] auto policy() const noexcept -> protocol::Policy {
+        return pol;
+    }
+
+    [[nodiscard]] auto buffer_size() const noexcept -> std::size_t {
+        return buf_size;
+    }
+
+    [[nodiscard]] auto buffer_count() const noexcept -> std::size_t {
+        return n_buffers;
+    }
+
+    [[nodiscard]] auto free_count() const noexcept -> std::size_t {
+        return free_buffers.size();
+    }
+
+    // Return nullopt if all buffers are in use.
+    [[nodiscard]] auto acquire() -> std::optional<resource_type> {
+        if (free_buffers.empty())
+            return std::nullopt;
+        auto ret = std::optional<resource_type>(
+            std::move(free_buffers.front()));
+        free_buffers.pop_front();
+        return ret;
+    }
+
+    void give_back(resource_type &&buffer) {
+        assert(free_buffers.size() < n_buffers);
+        free_buffers.push_back(std::move(buffer));
+    }
+};
+
+} // namespace partake::daemon
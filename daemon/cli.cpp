@@ -6,12 +6,15 @@
 
 #include "cli.hpp"
 
+#include "compression.hpp"
 #include "config.hpp"
+#include "message.hpp"
 #include "sizes.hpp"
 
 #include <CLI/CLI.hpp>
 #include <fmt/core.h>
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cmath>
@@ -20,6 +23,8 @@
 #include <limits>
 #include <stdexcept>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace partake::daemon {
 
@@ -27,18 +32,55 @@ namespace {
 
 struct cli_args {
     std::size_t memory = 0;
+    std::size_t max_segments = 1;
+    std::vector<int> numa_nodes;
+    bool report_placement = false;
     std::string socket;
+    bool socket_activation = false;
     std::string name;
     std::string filename;
+    std::string overflow_file;
+    std::vector<std::string> sub_pools;
     bool posix = false;
     bool systemv = false;
     bool windows = false;
+    bool memfd = false;
     std::size_t granularity = 0;
+    std::string allocator = "free-list";
+    bool alloc_cache = false;
+    bool scrub_on_free = false;
     bool huge_pages = false;
+    bool transparent_huge_pages = false;
     std::size_t huge_page_size = 0;
     bool large_pages = false;
     bool force = false;
     double voucher_ttl = default_voucher_ttl_seconds;
+    double voucher_batching = default_voucher_expiry_batching_seconds;
+    std::string snapshot;
+    double snapshot_ttl = default_snapshot_ttl_seconds;
+    std::string state_export;
+    unsigned worker_threads = 2;
+    std::size_t normal_per_turn = 0;
+    std::size_t bulk_per_turn = 1;
+    std::size_t teardown_batch = default_teardown_batch_size;
+    std::size_t release_free = 0;
+    double compress_idle = 0.0;
+    std::size_t client_quota = 0;
+    std::size_t realtime_reserve = 0;
+    bool prefault = false;
+    bool lock = false;
+    bool background_populate = false;
+    bool wake_words = false;
+    bool pack_small_objects = false;
+    std::size_t profile_allocations = 0;
+    std::size_t log_queue = 0;
+    bool busy_poll = false;
+    int busy_poll_cpu = -1;
+    std::string log_overflow = "drop-oldest";
+    bool allow_trusted = false;
+    std::size_t read_buffer = 2 * common::max_message_frame_len;
+    std::size_t write_high_water = default_write_high_water_mark;
+    std::size_t max_message_size = default_max_frame_len;
 };
 
 constexpr auto partake_version =
@@ -53,7 +95,23 @@ constexpr auto partake_version =
 constexpr auto extra_help =
     R"(Memory size:
   A shared memory size that is a multiple of the platform page size
-  must be given via --memory.
+  must be given via --memory. This is the size of each segment; when
+  --max-segments is greater than 1, additional segments of the same
+  size are created when an allocation does not fit in any existing
+  segment. Names given by --name or --file are suffixed with the
+  segment number (.1, .2, ...) for additional segments.
+
+NUMA placement:
+  --numa-nodes=0,1 binds segments to the given NUMA nodes in turn
+  (on Linux with mbind(2); on Windows the file mapping and its views
+  prefer the node, which is also passed to clients for their views)
+  and creates one segment per node at startup; --max-segments must be
+  at least the number of nodes. Allocations are placed on the node
+  requested by the client, or else (Linux only) on the node where the
+  client process last ran, falling back to other nodes when full.
+  --report-placement tells each client (in the hello response) its
+  NUMA node and the CPUs sharing its L3 cache, found from the CPU
+  topology read at startup; this is implied by --numa-nodes.
 
 Client connection:
   You must pass --socket with a path name to use for the Unix domain
@@ -61,6 +119,14 @@ Client connection:
   path is recommeded because the same path must also be given to
   clients.
 
+  With --socket-activation (not on Windows), partaked instead uses the
+  listening socket passed by the service manager (systemd socket
+  activation; the .socket unit should have Accept=no). The socket then
+  stays in place, and connections to it queue, while partaked is
+  restarted (for example, to upgrade it). Clients must still
+  reconnect; together with --snapshot, shared objects survive the
+  restart.
+
 Unix shared memory:
   [--posix] [--name=/myshmem]: Create with shm_open(2) and map with
       mmap(2). If name is given it should start with a slash and
@@ -69,11 +135,18 @@ Unix shared memory:
       If name is given it must be an integer key.
   --file=myfile: Create with open(2) and map with mmap(2). The --name
       option is ignored.
+  --memfd: Create with memfd_create(2) and map with mmap(2) (Linux).
+      Clients receive the file descriptor over a Unix domain socket
+      (the --socket path with ".seg" appended, suffixed like names for
+      additional segments); with --socket-activation they instead open
+      /proc/<pid>/fd/<fd> of partaked. The --name option is ignored.
   Not all of the above may be available on a given Unix-like system.
   On Linux, huge pages can be allocated either by using --file with a
   location in a mounted hugetlbfs or by giving --huge-pages with
-  --systemv. In both cases, --memory must be a multiple of the huge
-  page size.
+  --systemv or --memfd. In all cases, --memory must be a multiple of
+  the huge page size. Alternatively, --thp requests transparent huge
+  pages with madvise(2); for shared memory this requires shmem THP to
+  be enabled in /sys/kernel/mm/transparent_hugepage/shmem_enabled.
 
 Windows shared memory:
   [--windows] [--name=Local\myshmem]: A named file mapping backed by
@@ -86,6 +159,193 @@ Windows shared memory:
   --file). This requires the user to have SeLockMemoryPrivilege. In
   this case, --memory must be a multiple of the large page size.
 
+Allocation strategy:
+  --allocator=free-list: Power-of-2 binned free lists with coalescing
+      of freed chunks (default). Works well for most workloads.
+  --allocator=slab: Serve allocations of up to 16 granules from
+      per-size slabs, falling back to free lists for larger sizes.
+      Reduces allocation cost for frequent small allocations.
+  --allocator=buddy: Binary buddy system. Allocation and deallocation
+      take bounded time, but sizes are rounded up to a power of 2
+      granules.
+  Any of the above can be combined with --alloc-cache, which retains
+  up to 16 recently freed chunks and reuses them for allocations of
+  exactly the same size, so that a producer that repeatedly allocates
+  and closes buffers of one size reuses the same memory without going
+  through the free lists.
+
+Scrubbing:
+  With --scrub-on-free, shared memory freed by one client is zeroed
+  before it can be allocated to another, so that no data is ever
+  visible to the next owner of the memory. Freed chunks are held back
+  while a worker thread (one even with --worker-threads=0) zeroes them
+  with streaming stores, which bypass the CPU caches where the build
+  targets SSE2, AVX, or AVX-512. They are then known to be zero-filled,
+  so allocations from them are reported to clients as such. Requires
+  the free-list allocator without --alloc-cache.
+
+Page residency:
+  --prefault touches every page of each segment when it is created,
+  so that clients do not incur page faults on first access. --lock
+  locks the segments in physical memory with mlock(2) (VirtualLock()
+  on Windows); partaked exits with an error if this fails (for
+  example, due to RLIMIT_MEMLOCK). --lock cannot be combined with
+  --release-free.
+
+  Both can take seconds for large segments. With
+  --populate-in-background, partaked instead starts accepting
+  connections immediately and performs them for the initial segments
+  in chunks, in parallel on the worker threads. AllocRequests are held
+  until the first chunk is done; with --lock, partaked exits with an
+  error if locking any chunk fails.
+
+Returning memory to the system:
+  With --release-free, the pages of free chunks of at least the
+  given size are periodically returned to the system, so that memory
+  use shrinks after a peak. On Linux this uses madvise(MADV_REMOVE);
+  on Windows, DiscardVirtualMemory(). Not supported on other systems.
+
+Socket reads:
+  Each client connection has a fixed read buffer (--read-buffer),
+  which must be at least 32 KiB (the default maximum message size). A
+  larger buffer lets partaked read more pipelined requests per system
+  call.
+  Clients sending large batches of requests may negotiate messages of
+  up to --max-message-size (at most 16 MiB); the read buffer of such a
+  client grows as needed to hold the largest message received.
+  When a client has more than --write-high-water bytes of responses
+  that it has not yet read, partaked stops reading its requests until
+  half of them have been sent, so that a client that pipelines
+  requests without reading the responses cannot make partaked's memory
+  use grow without bound.
+
+Busy polling:
+  With --busy-poll, the I/O thread checks for socket events in a loop
+  instead of sleeping until one arrives, so that requests are handled
+  without the latency of waking up a thread, at the cost of keeping one
+  CPU fully busy. With --busy-poll-cpu, the I/O thread is pinned to the
+  given CPU (Linux only); choose one isolated from other work.
+
+Worker threads:
+  Bulk memory operations requested by clients (FillRequest and
+  CopyRangeRequest) are run on a pool of --worker-threads threads, so
+  that they do not delay other requests. Large operations are further
+  divided among temporary threads. With --worker-threads=0, they are
+  performed while handling the request.
+
+Quality of service:
+  Clients declare a QoS class (NORMAL, REALTIME, or BULK) when they
+  connect. After handling --bulk-messages-per-turn request messages
+  (default 1) from a BULK client, partaked handles pending events for
+  other clients before continuing. --normal-messages-per-turn sets the
+  same limit for NORMAL clients (default 0, meaning no limit). Messages
+  from REALTIME clients are never deferred. When a client holding many
+  objects disconnects, its handles are closed --teardown-batch at a
+  time, handling other clients' requests in between.
+
+Memory quotas:
+  With --client-quota, each client connection may hold at most the
+  given number of bytes of shared memory (objects and pool buffers,
+  counted at their requested size); requests that would exceed it fail
+  with QUOTA_EXCEEDED without affecting other clients. With
+  --realtime-reserve, clients other than REALTIME ones are limited
+  together to the total shared memory (--memory times --max-segments)
+  less the given number of bytes, so that this space remains available
+  to REALTIME clients.
+
+Trusted clients:
+  By default, every request message is fully verified before it is
+  handled. With --allow-trusted-clients, a client may request trusted
+  mode in its HelloRequest, after which only the size prefix, the
+  location of the root table, and request types are checked. Use only
+  when all clients are known not to send malformed messages.
+
+Vouchers:
+  Each voucher expires --voucher-ttl seconds after it is created, or
+  sooner if the client requested a shorter TTL. Expired vouchers are
+  dropped (releasing their objects) by a timer that wakes up at most
+  once per --voucher-expiry-batching window, up to one window after
+  they expire. A shorter window frees memory sooner at the cost of more
+  frequent wakeups; it should not be much shorter than 1/64 of the TTL.
+
+Cold storage:
+  With --compress-idle, shared objects (of at least 64 KiB, other than
+  PRIMITIVE objects and pool buffers) that no client has had open for
+  the given number of seconds, being kept alive only by vouchers, are
+  compressed with LZ4 into partaked's private memory, and their shared
+  memory is freed. Such an object is decompressed into a new allocation
+  when it is next opened (which fails with OUT_OF_SHMEM if there is no
+  room), so that opening it takes longer but shared memory can retain
+  more data. Objects that do not compress are left alone. Requires
+  partaked to be built with LZ4 support (-Dlz4=enabled).
+
+Warm restart:
+  With --snapshot, the file given by --file is kept (not removed) when
+  partaked exits, and the keys and locations of all shared objects
+  (other than PRIMITIVE ones) are saved to the snapshot file upon
+  shutdown. When partaked is next started with the same --file,
+  --memory, --granularity, and --snapshot, these objects are restored
+  with their keys and data; each is destroyed after --snapshot-ttl
+  seconds unless a client has opened it by then. The snapshot file is
+  removed once read. Only objects that were shared at a clean shutdown
+  are saved. Requires --file (on a non-Windows system) and the
+  free-list allocator without --alloc-cache.
+
+Overflow segment:
+  With --overflow-file, allocations that do not fit in any of the
+  --max-segments segments (once all have been created) are placed in an
+  additional segment of the same size, backed by the given file
+  (typically on fast local storage), instead of failing. The segment is
+  created the first time it is needed. Objects in it are slower to
+  access under memory pressure, and are not saved by --snapshot.
+  Allocations return to the primary segments as soon as they have room.
+
+Sub-pools:
+  --sub-pool=NAME=BYTES (repeatable) reserves the given size at the end
+  of every segment (other than the overflow segment) for a sub-pool
+  with its own allocator, so that groups of clients with very different
+  allocation patterns do not fragment each other's space. A client
+  selects a sub-pool by name in its HelloRequest; other clients use
+  the rest of each segment. Allocations that do not fit in a
+  client's sub-pool fail rather than using another pool. With
+  --snapshot, the sub-pools must also be the same on restart.
+
+Small objects:
+  By default, the allocation granularity is the system page size, so
+  that every object occupies at least a page. With
+  --pack-small-objects (and no --granularity), the granularity is 64
+  bytes and objects smaller than a page are packed together into
+  shared pages, while larger objects remain page-aligned. This works
+  best with --allocator slab, which serves small sizes from slabs of
+  equal-sized slots.
+
+Allocation profiling:
+  With --profile-allocations, every Nth allocation is sampled, and the
+  sizes and lifetimes of the sampled objects are aggregated per client
+  (by the name and pid given at hello). The profiles are reported by
+  GetStatsRequest and are logged when partaked receives SIGUSR1 (not
+  on Windows).
+
+State export:
+  With --state-export, partaked writes a dump of its state to the
+  given file when it receives SIGUSR2 (not on Windows): for each
+  object, its key, location, size, policy, and numbers of open
+  sessions and vouchers; and, with the free-list allocator without
+  --alloc-cache, the map of used and free chunks of every segment. The
+  dump is taken a slice at a time between requests, so that it does not
+  pause the daemon; objects created or destroyed meanwhile may or may
+  not be included. The file appears (replacing any previous dump) once
+  complete.
+
+Logging:
+  By default, messages are written to the terminal by the thread that
+  logs them. With --log-queue, they are instead queued (up to the given
+  number) and written by a background thread, so that slow output does
+  not delay the handling of requests. When the queue is full, the
+  oldest queued message is discarded, or, with --log-overflow=block,
+  the logging thread waits. Repeated errors caused by client
+  connections are logged at most 10 times per second.
+
 In all cases, partaked will exit with an error if the filename given
 by --file or the name given by --name already exists, unless --force
 is also given.)";
@@ -208,11 +468,26 @@ auto parse_cli_args_unvalidated(int argc, char const *const *argv)
         ->check(parse_nonempty)
         ->transform(parse_size_suffix);
 
+    app.add_option("--max-segments", ret.max_segments,
+                   "Maximum number of shared memory segments (default: 1)")
+        ->type_name("COUNT");
+
+    app.add_option("--numa-nodes", ret.numa_nodes,
+                   "Bind segments to NUMA nodes (comma-separated)")
+        ->type_name("LIST")
+        ->delimiter(',');
+
+    app.add_flag("--report-placement", ret.report_placement,
+                 "Report each client's NUMA node and L3 cache at hello");
+
     app.add_option("-s,--socket", ret.socket,
                    "Filename of socket for client connection")
         ->type_name("NAME")
         ->check(parse_nonempty);
 
+    app.add_flag("--socket-activation", ret.socket_activation,
+                 "Use the listening socket passed by systemd");
+
     app.add_option("-n,--name", ret.name,
                    "Name of shared memory (integer if --systemv)")
         ->type_name("NAME");
@@ -223,6 +498,15 @@ auto parse_cli_args_unvalidated(int argc, char const *const *argv)
         ->type_name("FILENAME")
         ->check(parse_nonempty);
 
+    app.add_option("--overflow-file", ret.overflow_file,
+                   "Spill allocations to a segment in FILENAME when full")
+        ->type_name("FILENAME")
+        ->check(parse_nonempty);
+
+    app.add_option("--sub-pool", ret.sub_pools,
+                   "Reserve a named sub-pool in each segment (repeatable)")
+        ->type_name("NAME=BYTES");
+
     app.add_flag("-P,--posix", ret.posix,
                  "Use POSIX shm_open(2) shared memory (default)");
 
@@ -232,19 +516,35 @@ auto parse_cli_args_unvalidated(int argc, char const *const *argv)
     app.add_flag("-W,--windows", ret.windows,
                  "Use Win32 named shared memory (default on Windows)");
 
+    app.add_flag("--memfd", ret.memfd,
+                 "Use Linux memfd_create(2) shared memory");
+
     app.add_option("-g,--granularity", ret.granularity,
                    "Allocation granularity (suffixes K/M/G allowed)")
         ->type_name("BYTES")
         ->transform(parse_size_suffix);
 
+    app.add_option("--allocator", ret.allocator,
+                   "Allocation strategy (free-list, slab, buddy)")
+        ->type_name("NAME");
+
+    app.add_flag("--alloc-cache", ret.alloc_cache,
+                 "Reuse recently freed chunks of the same size");
+
+    app.add_flag("--scrub-on-free", ret.scrub_on_free,
+                 "Zero freed shared memory before it is reused");
+
     app.add_flag("-H,--huge-pages", ret.huge_pages,
-                 "Use Linux huge pages with --systemv");
+                 "Use Linux huge pages with --systemv or --memfd");
 
     app.add_option("--huge-page-size", ret.huge_page_size,
                    "Select Linux huge page size (implies --huge-pages)")
         ->type_name("BYTES")
         ->transform(parse_size_suffix);
 
+    app.add_flag("--thp", ret.transparent_huge_pages,
+                 "Request Linux transparent huge pages");
+
     app.add_flag("-L,--large-pages", ret.large_pages,
                  "Use Windows large pages");
 
@@ -253,6 +553,126 @@ auto parse_cli_args_unvalidated(int argc, char const *const *argv)
                                ret.voucher_ttl))
         ->type_name("SECONDS");
 
+    app.add_option(
+           "--voucher-expiry-batching", ret.voucher_batching,
+           fmt::format("Drop expired vouchers in batches of this window "
+                       "(default: {} s)",
+                       ret.voucher_batching))
+        ->type_name("SECONDS");
+
+    app.add_option("--snapshot", ret.snapshot,
+                   "Save shared objects to FILE at exit; restore at start")
+        ->type_name("FILE");
+
+    app.add_option(
+           "--snapshot-ttl", ret.snapshot_ttl,
+           fmt::format("Set time-to-live of restored objects (default: {} s)",
+                       ret.snapshot_ttl))
+        ->type_name("SECONDS");
+
+    app.add_option("--state-export", ret.state_export,
+                   "Dump objects and chunk maps to FILE upon SIGUSR2")
+        ->type_name("FILE");
+
+    app.add_flag("--prefault", ret.prefault,
+                 "Fault in all shared memory pages at startup");
+
+    app.add_flag("--lock", ret.lock,
+                 "Lock shared memory in physical memory (mlock)");
+
+    app.add_flag("--populate-in-background", ret.background_populate,
+                 "Perform --prefault and --lock after starting to listen");
+
+    app.add_option("--release-free", ret.release_free,
+                   "Return free chunks of at least BYTES to the system")
+        ->type_name("BYTES")
+        ->transform(parse_size_suffix);
+
+    app.add_option("--compress-idle", ret.compress_idle,
+                   "Compress shared objects not open for SECONDS")
+        ->type_name("SECONDS");
+
+    app.add_flag("--wake-words", ret.wake_words,
+                 "Give each PRIMITIVE object a futex word for signaling");
+
+    app.add_flag("--pack-small-objects", ret.pack_small_objects,
+                 "Pack objects smaller than a page into shared pages");
+
+    app.add_option("--profile-allocations", ret.profile_allocations,
+                   "Sample 1 in N allocations for the allocation profile")
+        ->type_name("N");
+
+    app.add_option("--log-queue", ret.log_queue,
+                   "Log asynchronously, queuing up to N messages")
+        ->type_name("N");
+
+    app.add_option("--log-overflow", ret.log_overflow,
+                   "When the log queue is full (drop-oldest, block)")
+        ->type_name("POLICY");
+
+    app.add_flag("--allow-trusted-clients", ret.allow_trusted,
+                 "Let clients opt out of message verification");
+
+    app.add_option("--read-buffer", ret.read_buffer,
+                   fmt::format("Per-client socket read buffer (default: {})",
+                               human_readable_size(ret.read_buffer)))
+        ->type_name("BYTES")
+        ->transform(parse_size_suffix);
+
+    app.add_option(
+           "--write-high-water", ret.write_high_water,
+           fmt::format(
+               "Pause reading from a client with this many bytes of unsent responses (default: {}; 0 for no limit)",
+               human_readable_size(ret.write_high_water)))
+        ->type_name("BYTES")
+        ->transform(parse_size_suffix);
+
+    app.add_option(
+           "--max-message-size", ret.max_message_size,
+           fmt::format(
+               "Largest message frame clients may negotiate (default: {})",
+               human_readable_size(ret.max_message_size)))
+        ->type_name("BYTES")
+        ->transform(parse_size_suffix);
+
+    app.add_flag("--busy-poll", ret.busy_poll,
+                 "Poll for socket events without blocking (uses a full CPU)");
+
+    app.add_option("--busy-poll-cpu", ret.busy_poll_cpu,
+                   "Pin the busy-polling I/O thread to CPU")
+        ->type_name("CPU");
+
+    app.add_option("--worker-threads", ret.worker_threads,
+                   "Number of threads for bulk memory operations (default: 2)")
+        ->type_name("COUNT");
+
+    app.add_option("--normal-messages-per-turn", ret.normal_per_turn,
+                   "Messages handled before yielding, for NORMAL clients "
+                   "(default: 0, no limit)")
+        ->type_name("COUNT");
+
+    app.add_option("--bulk-messages-per-turn", ret.bulk_per_turn,
+                   "Messages handled before yielding, for BULK clients "
+                   "(default: 1)")
+        ->type_name("COUNT");
+
+    app.add_option(
+           "--teardown-batch", ret.teardown_batch,
+           fmt::format("Handles of a disconnected client to close per turn "
+                       "(default: {}; 0 for all at once)",
+                       ret.teardown_batch))
+        ->type_name("COUNT");
+
+    app.add_option("--client-quota", ret.client_quota,
+                   "Limit shared memory held by each client (default: none)")
+        ->type_name("BYTES")
+        ->transform(parse_size_suffix);
+
+    app.add_option("--realtime-reserve", ret.realtime_reserve,
+                   "Shared memory available only to REALTIME clients")
+        ->type_name("BYTES")
+        ->transform(parse_size_suffix);
+
     app.add_flag("-f,--force", ret.force,
                  "Overwrite existing shared memory and/or file");
 
@@ -267,7 +687,14 @@ auto parse_cli_args_unvalidated(int argc, char const *const *argv)
     }
 }
 
-enum class shmem_type { posix, system_v, win32, posix_file, win32_file };
+enum class shmem_type {
+    posix,
+    system_v,
+    win32,
+    posix_file,
+    win32_file,
+    memfd
+};
 
 template <bool IsWindows =
 #ifdef _WIN32
@@ -279,18 +706,20 @@ template <bool IsWindows =
 auto validate_segment_type(cli_args const &args)
     -> tl::expected<shmem_type, std::string> {
     using namespace std::string_literals;
-    int const shmem_type_count = int(args.posix) + int(args.systemv) +
-                                 int(args.windows) +
-                                 int(not args.filename.empty());
+    int const shmem_type_count =
+        int(args.posix) + int(args.systemv) + int(args.windows) +
+        int(args.memfd) + int(not args.filename.empty());
     if (shmem_type_count > 1)
         return tl::unexpected(
-            "Only one of --posix, --systemv, --windows, --file may be given"s);
+            "Only one of --posix, --systemv, --windows, --memfd, --file may be given"s);
     if (args.posix)
         return shmem_type::posix;
     if (args.systemv)
         return shmem_type::system_v;
     if (args.windows)
         return shmem_type::win32;
+    if (args.memfd)
+        return shmem_type::memfd;
     if (not args.filename.empty()) {
         if constexpr (IsWindows)
             return shmem_type::win32_file;
@@ -323,6 +752,9 @@ TEST_CASE("validate_segment_type") {
     args = cli_args();
     args.windows = true;
     CHECK(validate_segment_type(args).value() == shmem_type::win32);
+    args = cli_args();
+    args.memfd = true;
+    CHECK(validate_segment_type(args).value() == shmem_type::memfd);
 
     args = cli_args();
     args.posix = true;
@@ -340,6 +772,10 @@ TEST_CASE("validate_segment_type") {
     args.windows = true;
     args.filename = "x";
     CHECK_FALSE(validate_segment_type(args).has_value());
+    args = cli_args();
+    args.memfd = true;
+    args.systemv = true;
+    CHECK_FALSE(validate_segment_type(args).has_value());
 }
 
 auto validate_posix_shmem_name(std::string const &name)
@@ -426,8 +862,13 @@ auto validate_segment_config(cli_args const &args)
     auto const type = *type_or_error;
 
     bool const use_huge_pages = args.huge_pages || args.huge_page_size > 0;
-    if (use_huge_pages && type != shmem_type::system_v)
-        return tl::unexpected("--huge-pages requires System V shared memory"s);
+    if (use_huge_pages && type != shmem_type::system_v &&
+        type != shmem_type::memfd)
+        return tl::unexpected("--huge-pages requires --systemv or --memfd"s);
+#ifndef __linux__
+    if (type == shmem_type::memfd)
+        return tl::unexpected("--memfd is only supported on Linux"s);
+#endif
     if (args.large_pages && type != shmem_type::win32)
         return tl::unexpected(
             "--large-pages requires Windows (non-file-backed) shared memory"s);
@@ -460,17 +901,98 @@ auto validate_segment_config(cli_args const &args)
     }
     case shmem_type::posix_file:
         return segment_config{
-            file_mmap_segment_config{args.filename, args.force}, args.memory};
+            file_mmap_segment_config{args.filename, args.force,
+                                     not args.snapshot.empty()},
+            args.memory};
     case shmem_type::win32_file:
         return segment_config{
             win32_segment_config{args.filename, args.name, args.force, false},
             args.memory};
+    case shmem_type::memfd: {
+        // Without a known socket path (socket activation), clients fall back
+        // to opening the memfd via /proc.
+        auto fd_socket = args.socket_activation || args.socket.empty()
+                             ? std::string()
+                             : args.socket + ".seg";
+        return segment_config{memfd_segment_config{use_huge_pages,
+                                                   args.huge_page_size,
+                                                   std::move(fd_socket)},
+                              args.memory};
+    }
     default:
         assert(false);
         std::terminate();
     }
 }
 
+auto validate_allocator_strategy(std::string const &name)
+    -> tl::expected<allocator_strategy, std::string> {
+    if (name == "free-list")
+        return allocator_strategy::free_list;
+    if (name == "slab")
+        return allocator_strategy::slab;
+    if (name == "buddy")
+        return allocator_strategy::buddy;
+    return tl::unexpected("Unknown allocator: " + name);
+}
+
+auto validate_log_overflow_policy(std::string const &name)
+    -> tl::expected<common::log_overflow_policy, std::string> {
+    if (name == "drop-oldest")
+        return common::log_overflow_policy::drop_oldest;
+    if (name == "block")
+        return common::log_overflow_policy::block;
+    return tl::unexpected("Unknown log overflow policy: " + name);
+}
+
+TEST_CASE("validate_log_overflow_policy") {
+    CHECK(validate_log_overflow_policy("drop-oldest").value() ==
+          common::log_overflow_policy::drop_oldest);
+    CHECK(validate_log_overflow_policy("block").value() ==
+          common::log_overflow_policy::block);
+    CHECK_FALSE(validate_log_overflow_policy("drop").has_value());
+}
+
+auto validate_sub_pool(std::string const &spec)
+    -> tl::expected<sub_pool_config, std::string> {
+    auto const eq = spec.find('=');
+    if (eq == std::string::npos || eq == 0)
+        return tl::unexpected("Invalid sub-pool (expected NAME=BYTES): " +
+                              spec);
+    std::size_t size = 0;
+    try {
+        size = std::stoull(parse_size_suffix(spec.substr(eq + 1)));
+    } catch (CLI::ValidationError const &) {
+        return tl::unexpected("Invalid sub-pool size: " + spec);
+    }
+    if (size == 0)
+        return tl::unexpected("Sub-pool size must be positive: " + spec);
+    return sub_pool_config{spec.substr(0, eq), size};
+}
+
+TEST_CASE("validate_sub_pool") {
+    auto const sp = validate_sub_pool("small=1M");
+    REQUIRE(sp.has_value());
+    CHECK(sp->name == "small");
+    CHECK(sp->size == 1048576);
+    CHECK_FALSE(validate_sub_pool("small").has_value());
+    CHECK_FALSE(validate_sub_pool("=1M").has_value());
+    CHECK_FALSE(validate_sub_pool("small=").has_value());
+    CHECK_FALSE(validate_sub_pool("small=0").has_value());
+    CHECK_FALSE(validate_sub_pool("small=1X").has_value());
+}
+
+TEST_CASE("validate_allocator_strategy") {
+    CHECK(validate_allocator_strategy("free-list").value() ==
+          allocator_strategy::free_list);
+    CHECK(validate_allocator_strategy("slab").value() ==
+          allocator_strategy::slab);
+    CHECK(validate_allocator_strategy("buddy").value() ==
+          allocator_strategy::buddy);
+    CHECK_FALSE(validate_allocator_strategy("").has_value());
+    CHECK_FALSE(validate_allocator_strategy("Buddy").has_value());
+}
+
 auto validate_cli_args(cli_args const &args)
     -> tl::expected<daemon_config, std::string> {
     using namespace std::string_literals;
@@ -483,10 +1005,37 @@ auto validate_cli_args(cli_args const &args)
     // Unix domain socket path names have a low length limit. Linux and Windows
     // limits are 107, (some?) BSDs have 103, and apparently some Unices have
     // limits as low as 91. However, we defer the length check to Asio.
-    if (args.socket.empty())
+    if (args.socket_activation) {
+#ifdef _WIN32
+        return tl::unexpected(
+            "--socket-activation is not supported on Windows"s);
+#endif
+        ret.socket_activation = true;
+    } else if (args.socket.empty()) {
         return tl::unexpected("--socket is required"s);
+    }
     ret.endpoint = args.socket;
 
+    if (args.max_segments == 0)
+        return tl::unexpected("--max-segments must be positive"s);
+    ret.max_segments = args.max_segments;
+
+    if (not args.numa_nodes.empty()) {
+#if not defined(__linux__) && not defined(_WIN32)
+        return tl::unexpected(
+            "--numa-nodes is only supported on Linux and Windows"s);
+#endif
+        for (auto node : args.numa_nodes) {
+            if (node < 0)
+                return tl::unexpected("NUMA nodes must not be negative"s);
+        }
+        if (args.max_segments < args.numa_nodes.size())
+            return tl::unexpected(
+                "--max-segments must not be less than the number of NUMA nodes"s);
+        ret.numa_nodes = args.numa_nodes;
+    }
+    ret.report_placement = args.report_placement;
+
     if (args.granularity > 0) {
         if (not is_size_power_of_2(args.granularity))
             return tl::unexpected(
@@ -499,15 +1048,158 @@ auto validate_cli_args(cli_args const &args)
         ret.log2_granularity = log2_size(args.granularity);
     }
 
+    auto const maybe_strategy = validate_allocator_strategy(args.allocator);
+    if (not maybe_strategy.has_value())
+        return tl::unexpected(maybe_strategy.error());
+    ret.allocator = *maybe_strategy;
+    ret.allocation_cache = args.alloc_cache;
+    if (args.scrub_on_free &&
+        (ret.allocator != allocator_strategy::free_list ||
+         ret.allocation_cache))
+        return tl::unexpected(
+            "--scrub-on-free requires the free-list allocator without --alloc-cache"s);
+    ret.scrub_on_free = args.scrub_on_free;
+
+    if (args.busy_poll_cpu >= 0 && not args.busy_poll)
+        return tl::unexpected("--busy-poll-cpu requires --busy-poll"s);
+    ret.busy_poll = args.busy_poll;
+    ret.busy_poll_cpu = args.busy_poll_cpu;
+    ret.worker_threads = args.worker_threads;
+    ret.normal_messages_per_turn = args.normal_per_turn;
+    if (args.bulk_per_turn == 0)
+        return tl::unexpected("--bulk-messages-per-turn must be positive"s);
+    ret.bulk_messages_per_turn = args.bulk_per_turn;
+    ret.teardown_batch_size = args.teardown_batch;
+    ret.allow_trusted_clients = args.allow_trusted;
+
+    ret.client_quota = args.client_quota;
+    if (args.realtime_reserve > 0 &&
+        args.realtime_reserve / args.max_segments >= args.memory)
+        return tl::unexpected(
+            "--realtime-reserve must be less than the total shared memory"s);
+    ret.realtime_reserve = args.realtime_reserve;
+
+    if (args.read_buffer < common::max_message_frame_len)
+        return tl::unexpected(
+            fmt::format("--read-buffer must be at least {}",
+                        common::max_message_frame_len));
+    ret.read_buffer_size = args.read_buffer;
+
+    if (args.write_high_water > 0 &&
+        args.write_high_water < common::max_message_frame_len)
+        return tl::unexpected(
+            fmt::format("--write-high-water must be 0 or at least {}",
+                        common::max_message_frame_len));
+    ret.write_high_water_mark = args.write_high_water;
+
+    if (args.max_message_size < common::max_message_frame_len ||
+        args.max_message_size > common::max_negotiable_frame_len)
+        return tl::unexpected(fmt::format(
+            "--max-message-size must be between {} and {}",
+            common::max_message_frame_len, common::max_negotiable_frame_len));
+    ret.max_frame_len = args.max_message_size;
+
+    if (args.lock && args.release_free > 0)
+        return tl::unexpected(
+            "--lock and --release-free cannot be used together"s);
+    ret.page_release_threshold = args.release_free;
+
+    if (args.compress_idle < 0.0)
+        return tl::unexpected("--compress-idle must not be negative"s);
+    if (args.compress_idle > 0.0 && not compression_supported)
+        return tl::unexpected(
+            "--compress-idle requires partaked built with -Dlz4=enabled"s);
+    ret.cold_storage_after =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::duration<double>(args.compress_idle));
+
+    if (args.background_populate && not args.prefault && not args.lock)
+        return tl::unexpected(
+            "--populate-in-background requires --prefault or --lock"s);
+    ret.background_population = args.background_populate;
+    ret.wake_words = args.wake_words;
+    ret.pack_small_objects = args.pack_small_objects;
+    ret.alloc_sample_interval = args.profile_allocations;
+
+    auto const maybe_overflow =
+        validate_log_overflow_policy(args.log_overflow);
+    if (not maybe_overflow.has_value())
+        return tl::unexpected(maybe_overflow.error());
+    ret.log_queue_size = args.log_queue;
+    ret.log_overflow = *maybe_overflow;
+
     if (args.voucher_ttl <= 0.0)
         return tl::unexpected("Voucher time-to-live must be positive"s);
     auto const fp_seconds = std::chrono::duration<double>(args.voucher_ttl);
     ret.voucher_ttl =
         std::chrono::duration_cast<std::chrono::milliseconds>(fp_seconds);
 
+    auto const fp_batching =
+        std::chrono::duration<double>(args.voucher_batching);
+    if (fp_batching < std::chrono::milliseconds(1))
+        return tl::unexpected(
+            "Voucher expiry batching window must be at least 1 ms"s);
+    ret.voucher_expiry_batching =
+        std::chrono::duration_cast<std::chrono::milliseconds>(fp_batching);
+
+    if (not args.snapshot.empty()) {
+        auto const type = validate_segment_type(args);
+        if (not type.has_value() || *type != shmem_type::posix_file)
+            return tl::unexpected(
+                "--snapshot requires --file (not on Windows)"s);
+        if (ret.allocator != allocator_strategy::free_list ||
+            ret.allocation_cache)
+            return tl::unexpected(
+                "--snapshot requires the free-list allocator without --alloc-cache"s);
+        if (args.snapshot_ttl <= 0.0)
+            return tl::unexpected("Snapshot time-to-live must be positive"s);
+        ret.snapshot_path = args.snapshot;
+        auto const fp_snapshot_ttl =
+            std::chrono::duration<double>(args.snapshot_ttl);
+        ret.snapshot_ttl =
+            std::chrono::duration_cast<std::chrono::milliseconds>(
+                fp_snapshot_ttl);
+    }
+
+    if (not args.state_export.empty()) {
+#ifdef _WIN32
+        return tl::unexpected("--state-export is not supported on Windows"s);
+#endif
+        ret.state_export_path = args.state_export;
+    }
+
+    std::size_t sub_pool_total = 0;
+    for (auto const &spec : args.sub_pools) {
+        auto const sp = validate_sub_pool(spec);
+        if (not sp.has_value())
+            return tl::unexpected(sp.error());
+        if (std::any_of(ret.sub_pools.begin(), ret.sub_pools.end(),
+                        [&](auto const &p) { return p.name == sp->name; }))
+            return tl::unexpected("Duplicate sub-pool name: " + sp->name);
+        sub_pool_total += sp->size;
+        ret.sub_pools.push_back(*sp);
+    }
+    if (sub_pool_total >= args.memory && not ret.sub_pools.empty())
+        return tl::unexpected(
+            "Total size of sub-pools must be less than --memory"s);
+
+    if (not args.overflow_file.empty()) {
+        ret.overflow_seg_config = segment_config{
+#ifdef _WIN32
+            win32_segment_config{args.overflow_file, {}, args.force, false},
+#else
+            file_mmap_segment_config{args.overflow_file, args.force, false},
+#endif
+            args.memory};
+    }
+
     return validate_segment_config(args).map(
-        [&ret](segment_config const &seg_cfg) {
+        [&ret, &args](segment_config const &seg_cfg) {
             ret.seg_config = seg_cfg;
+            ret.seg_config.prefault = args.prefault;
+            ret.seg_config.lock = args.lock;
+            ret.seg_config.transparent_huge_pages =
+                args.transparent_huge_pages;
             return ret;
         });
 }
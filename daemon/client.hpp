@@ -6,15 +6,23 @@
 
 #pragma once
 
-#include "allocator.hpp"
 #include "asio.hpp"
-#include "segment.hpp"
+#include "logging.hpp"
+#include "message.hpp"
+#include "partake_protocol_generated.h"
+#include "quota.hpp"
+#include "response_buffer_pool.hpp"
+#include "stats.hpp"
 
 #include <gsl/span>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
 #include <chrono>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string_view>
 #include <system_error>
 #include <utility>
@@ -35,6 +43,7 @@ class client {
   private:
     socket_type sock;
     session_type sess;
+    response_buffer_pool resp_buffers; // Must outlive buffers held by writer
     message_writer_type writer;
     request_handler_type handler;
     message_reader_type reader;
@@ -45,19 +54,48 @@ class client {
     // through the client object.
     std::size_t io_refcount = 0;
     std::function<void(self_type &)> close_self;
+    std::uint64_t hk_task = 0; // See housekeeping_task()
+
+    // Stop reading requests while more than this many bytes of responses
+    // are waiting to be written (0 for no limit), until half have been.
+    std::size_t write_high_water;
 
   public:
-    template <typename Repository, typename HousekeepFunc, typename CloseFunc>
-    explicit client(socket_type &&socket, std::uint32_t session_id,
-                    segment &seg, arena_allocator &allocator, Repository &repo,
-                    std::chrono::milliseconds voucher_time_to_live,
-                    HousekeepFunc per_req_housekeeping, CloseFunc close_client)
+    // If 'offload_work' is given, it is called (by the request handler) with
+    // functions 'work', to be run on another thread, and 'done', to be run
+    // on the socket's executor after 'work' returns. If 'messages_per_turn'
+    // is given, it returns the limit (0 for none) on messages handled per
+    // read for the client's QoS class. If 'account' is given, allocations
+    // are charged to it, and 'quota_parent', if given, returns its parent
+    // quota for the client's QoS class. Reading from a client that is not
+    // reading its responses pauses at 'write_high_water_mark' (see below).
+    // The client may negotiate message frames of up to 'max_frame_len'.
+    // 'per_msg_housekeeping' is called (with the client) after each request
+    // message, to schedule maintenance such as perform_housekeeping().
+    template <typename Allocator, typename Repository, typename HousekeepFunc,
+              typename CloseFunc>
+    explicit client(
+        socket_type &&socket, std::uint32_t session_id, Allocator &allocator,
+        Repository &repo, std::chrono::milliseconds voucher_time_to_live,
+        bool allow_trusted, std::size_t read_buffer_size,
+        std::size_t write_high_water_mark, std::size_t max_frame_len,
+        daemon_stats *stats,
+        HousekeepFunc per_msg_housekeeping, CloseFunc close_client,
+        std::function<void(std::function<void()>, std::function<void()>)>
+            offload_work = {},
+        std::function<std::size_t(protocol::QosClass)> messages_per_turn = {},
+        std::shared_ptr<quota> account = {},
+        std::function<std::shared_ptr<quota>(protocol::QosClass)>
+            quota_parent = {})
         : sock(std::forward<socket_type>(socket)),
-          sess(session_id, seg, allocator, repo, voucher_time_to_live),
+          sess(session_id, allocator, repo, voucher_time_to_live, account),
           writer(sock,
                  [this](std::error_code err) {
                      if (err)
                          handle_read_write_error(err);
+                     else if (reader.is_paused() &&
+                              writer.queued_bytes() <= write_high_water / 2)
+                         reader.resume();
                      decrement_io_refcount();
                  }),
           handler(
@@ -65,9 +103,46 @@ class client {
               [this](auto &&buf) {
                   increment_io_refcount();
                   writer.async_write_message(std::forward<decltype(buf)>(buf));
+                  if (write_high_water > 0 &&
+                      writer.queued_bytes() > write_high_water)
+                      reader.pause();
+              },
+              [this, hk = std::move(per_msg_housekeeping)] { hk(*this); },
+              [this](std::error_code err) { handle_read_write_error(err); },
+              [this](std::function<void()> flush) {
+                  // Keep the client alive until the flush has run.
+                  increment_io_refcount();
+                  asio::defer(sock.get_executor(),
+                              [this, flush = std::move(flush)] {
+                                  flush();
+                                  decrement_io_refcount();
+                              });
+              },
+              &resp_buffers, allow_trusted, stats,
+              offload_work ? [this, offload = std::move(offload_work)](
+                                 std::function<void()> work,
+                                 std::function<void()> done) {
+                  // Keep the client alive until 'done' has run.
+                  increment_io_refcount();
+                  offload(std::move(work), [this, done = std::move(done)] {
+                      done();
+                      decrement_io_refcount();
+                  });
+              } : decltype(offload_work)(),
+              [this, messages_per_turn, account,
+               quota_parent](protocol::QosClass qos) {
+                  if (messages_per_turn)
+                      reader.set_messages_per_turn(messages_per_turn(qos));
+                  if (account && quota_parent)
+                      account->set_parent(quota_parent(qos));
               },
-              std::move(per_req_housekeeping),
-              [this](std::error_code err) { handle_read_write_error(err); }),
+              [this, max_frame_len](std::size_t requested) {
+                  auto const len = std::clamp(
+                      requested, common::max_message_frame_len,
+                      std::max(max_frame_len, common::max_message_frame_len));
+                  reader.set_max_frame_len(len);
+                  return len;
+              }),
           reader(
               sock,
               [&handler = handler](gsl::span<std::uint8_t const> bytes) {
@@ -79,8 +154,15 @@ class client {
                   else
                       handle_end_of_read();
                   decrement_io_refcount();
-              }),
-          close_self(std::move(close_client)) {}
+              },
+              read_buffer_size),
+          close_self(std::move(close_client)),
+          write_high_water(write_high_water_mark) {
+        if (messages_per_turn) {
+            reader.set_messages_per_turn(
+                messages_per_turn(protocol::QosClass::NORMAL));
+        }
+    }
 
     // No move or copy (member references taken)
     ~client() = default;
@@ -96,6 +178,27 @@ class client {
 
     void prepare_for_shutdown() { sess.drop_pending_requests(); }
 
+    // Resize the session's tables if appropriate (not on the request path).
+    void perform_housekeeping() { sess.perform_housekeeping(); }
+
+    // Id of the task running perform_housekeeping(), for the daemon's use.
+    [[nodiscard]] auto housekeeping_task() const noexcept -> std::uint64_t {
+        return hk_task;
+    }
+
+    void set_housekeeping_task(std::uint64_t task) noexcept { hk_task = task; }
+
+    // After the client has been closed (close_client was called), close up
+    // to 'max_handles' of its session's handles; return true when none
+    // remain. See session::close_some_handles().
+    auto close_some_handles(std::size_t max_handles) -> bool {
+        return sess.close_some_handles(max_handles);
+    }
+
+    [[nodiscard]] auto queued_message_count() const noexcept -> std::size_t {
+        return writer.queued_message_count();
+    }
+
   private:
     void handle_end_of_read() {
         boost::system::error_code ignore;
@@ -110,15 +213,23 @@ class client {
         if (err == boost::system::error_code(asio::error::operation_aborted))
             return;
 
-        spdlog::error(
-            "client {} (pid {}, \"{}\"): failed to read from or write to socket: {} ({})",
-            sess.session_id(), sess.pid(), sess.name(), err.message(),
-            err.value());
+        // Shared by all clients (whose handlers run on the same strand), so
+        // that mass disconnection does not flood the log.
+        static common::log_rate_limiter limiter;
+        if (limiter.allow("client socket errors")) {
+            spdlog::error(
+                "client {} (pid {}, \"{}\"): failed to read from or write to socket: {} ({})",
+                sess.session_id(), sess.pid(), sess.name(), err.message(),
+                err.value());
+        }
 
         boost::system::error_code ignore;
         sock.shutdown(asio::socket_base::shutdown_type::shutdown_both, ignore);
         sess.drop_pending_requests();
         sock.close(); // Cancel all async read/writes.
+        // A paused reader has no read to cancel.
+        reader.abandon_if_paused(
+            boost::system::error_code(asio::error::operation_aborted));
     }
 
     void increment_io_refcount() noexcept { ++io_refcount; }
@@ -0,0 +1,92 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "cold_store.hpp"
+
+#include <doctest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("cold_store") {
+    using namespace std::chrono_literals;
+    cold_store<int> store;
+    int const a = 0;
+    int const b = 0;
+    auto const t0 = cold_store<int>::clock::time_point() + 1h;
+
+    SUBCASE("idle marks last while seen in every sweep") {
+        store.begin_sweep();
+        CHECK(store.mark_idle(&a, t0) == t0);
+        CHECK(store.mark_idle(&b, t0) == t0);
+        store.end_sweep();
+
+        store.begin_sweep();
+        CHECK(store.mark_idle(&a, t0 + 1s) == t0);
+        store.end_sweep(); // Forgets b
+
+        store.begin_sweep();
+        CHECK(store.mark_idle(&a, t0 + 2s) == t0);
+        CHECK(store.mark_idle(&b, t0 + 2s) == t0 + 2s);
+        store.mark_incompressible(&b);
+        store.end_sweep();
+
+        store.begin_sweep();
+        CHECK(store.mark_idle(&b, t0 + 3s) ==
+              cold_store<int>::clock::time_point::max());
+        store.end_sweep();
+
+        store.erase(&a);
+        store.begin_sweep();
+        CHECK(store.mark_idle(&a, t0 + 4s) == t0 + 4s);
+        store.end_sweep();
+    }
+
+    SUBCASE("cold objects") {
+        CHECK_FALSE(store.is_cold(&a));
+        store.insert(&a, std::vector<std::uint8_t>{1, 2, 3}, 100);
+        CHECK(store.is_cold(&a));
+        CHECK_FALSE(store.is_cold(&b));
+        CHECK(store.size() == 1);
+        CHECK(store.original_bytes() == 100);
+        CHECK(store.compressed_bytes() == 3);
+        CHECK(store.original_size(&a) == 100);
+        CHECK(store.compressed_data(&a).size() == 3);
+        CHECK(store.compressed_data(&a)[2] == 3);
+
+        store.erase(&b); // No-op
+        CHECK(store.size() == 1);
+        store.erase(&a);
+        CHECK_FALSE(store.is_cold(&a));
+        CHECK(store.size() == 0);
+        CHECK(store.original_bytes() == 0);
+        CHECK(store.compressed_bytes() == 0);
+    }
+
+    SUBCASE("compression in progress") {
+        store.begin_compression(&a);
+        store.begin_compression(&b);
+        CHECK(store.is_compressing(&a));
+        store.cancel_compression(&a);
+        CHECK_FALSE(store.is_compressing(&a));
+        CHECK_FALSE(store.end_compression(&a));
+        CHECK(store.end_compression(&b));
+        CHECK_FALSE(store.is_compressing(&b));
+
+        store.begin_compression(&a);
+        store.erase(&a);
+        CHECK_FALSE(store.end_compression(&a));
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
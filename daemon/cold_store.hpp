@@ -0,0 +1,171 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <gsl/span>
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+// Compressed copies of idle shared objects whose shared memory has been
+// freed, kept in daemon-private memory until the object is next opened
+// (when it is decompressed into a new allocation). Also tracks, between
+// periodic sweeps, since when each candidate object has been seen idle.
+// Objects are not owned; they must be removed (erase()) before they are
+// destroyed.
+template <typename Object> class cold_store {
+  public:
+    using object_type = Object;
+    using clock = std::chrono::steady_clock;
+
+  private:
+    struct idle_mark {
+        clock::time_point since;
+        std::uint64_t sweep; // Last sweep in which seen idle
+        bool incompressible; // Do not try again
+    };
+
+    struct cold_entry {
+        std::vector<std::uint8_t> data;
+        std::size_t original_size;
+    };
+
+    std::unordered_map<object_type const *, idle_mark> idle;
+    std::unordered_map<object_type const *, cold_entry> cold;
+    std::unordered_set<object_type const *> compressing; // Not cancelled
+    std::uint64_t sweep_count = 0;
+    std::size_t original_total = 0;
+    std::size_t compressed_total = 0;
+
+  public:
+    cold_store() = default;
+
+    // No move or copy (for consistency with other registries)
+    ~cold_store() = default;
+    cold_store(cold_store const &) = delete;
+    auto operator=(cold_store const &) = delete;
+    cold_store(cold_store &&) = delete;
+    auto operator=(cold_store &&) = delete;
+
+    // Number of objects in cold storage.
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return cold.size();
+    }
+
+    // Total size of the objects in cold storage, before compression.
+    [[nodiscard]] auto original_bytes() const noexcept -> std::size_t {
+        return original_total;
+    }
+
+    [[nodiscard]] auto compressed_bytes() const noexcept -> std::size_t {
+        return compressed_total;
+    }
+
+    // Candidates not marked idle between begin_sweep() and end_sweep() are
+    // forgotten, so that an object must stay idle to be compressed.
+    void begin_sweep() noexcept { ++sweep_count; }
+
+    void end_sweep() {
+        for (auto it = idle.begin(); it != idle.end();) {
+            if (it->second.sweep != sweep_count)
+                it = idle.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    // Record that 'obj' is idle at 'now', and return since when it has been
+    // continuously seen idle (time_point::max() if it was found
+    // incompressible, so that it is not tried again).
+    auto mark_idle(object_type const *obj, clock::time_point now)
+        -> clock::time_point {
+        auto [it, inserted] =
+            idle.try_emplace(obj, idle_mark{now, sweep_count, false});
+        it->second.sweep = sweep_count;
+        if (it->second.incompressible)
+            return clock::time_point::max();
+        return it->second.since;
+    }
+
+    void mark_incompressible(object_type const *obj) {
+        auto it = idle.find(obj);
+        if (it != idle.end())
+            it->second.incompressible = true;
+    }
+
+    // Record that 'obj' is being compressed (e.g., on another thread), to
+    // be inserted once done unless cancel_compression() is called first.
+    void begin_compression(object_type const *obj) {
+        compressing.insert(obj);
+    }
+
+    // Called before 'obj' is opened (or its data otherwise used), so that a
+    // compression in progress is abandoned.
+    void cancel_compression(object_type const *obj) {
+        if (not compressing.empty())
+            compressing.erase(obj);
+    }
+
+    // Return true unless the compression was cancelled.
+    [[nodiscard]] auto end_compression(object_type const *obj) -> bool {
+        return compressing.erase(obj) > 0;
+    }
+
+    [[nodiscard]] auto is_compressing(object_type const *obj) const -> bool {
+        return not compressing.empty() && compressing.count(obj) > 0;
+    }
+
+    [[nodiscard]] auto is_cold(object_type const *obj) const -> bool {
+        return not cold.empty() && cold.count(obj) > 0;
+    }
+
+    // 'obj' must not already be in cold storage.
+    void insert(object_type const *obj, std::vector<std::uint8_t> &&data,
+                std::size_t original_size) {
+        assert(not is_cold(obj));
+        idle.erase(obj);
+        original_total += original_size;
+        compressed_total += data.size();
+        cold.emplace(obj, cold_entry{std::move(data), original_size});
+    }
+
+    // 'obj' must be in cold storage.
+    [[nodiscard]] auto original_size(object_type const *obj) const
+        -> std::size_t {
+        return cold.at(obj).original_size;
+    }
+
+    // 'obj' must be in cold storage.
+    [[nodiscard]] auto compressed_data(object_type const *obj) const
+        -> gsl::span<std::uint8_t const> {
+        return cold.at(obj).data;
+    }
+
+    // No-op if 'obj' is neither idle, being compressed, nor in cold storage.
+    void erase(object_type const *obj) {
+        if (idle.empty() && cold.empty() && compressing.empty())
+            return; // Fast path when cold storage is not used
+        idle.erase(obj);
+        compressing.erase(obj);
+        auto it = cold.find(obj);
+        if (it == cold.end())
+            return;
+        original_total -= it->second.original_size;
+        compressed_total -= it->second.data.size();
+        cold.erase(it);
+    }
+};
+
+} // namespace partake::daemon
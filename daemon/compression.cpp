@@ -0,0 +1,101 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "compression.hpp"
+
+#include <doctest.h>
+
+#ifdef PARTAKE_LZ4
+#include <lz4.h>
+#endif
+
+#include <cstddef>
+#include <limits>
+
+namespace partake::daemon {
+
+auto compress(gsl::span<std::uint8_t const> data)
+    -> std::vector<std::uint8_t> {
+#ifdef PARTAKE_LZ4
+    // LZ4 block sizes are limited to int (and to LZ4_MAX_INPUT_SIZE).
+    if (data.size() < 2 || data.size() > LZ4_MAX_INPUT_SIZE)
+        return {};
+    auto const src_size = static_cast<int>(data.size());
+    // Only worth keeping if smaller, so no need for the worst-case bound.
+    std::vector<std::uint8_t> ret(data.size() - 1);
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto const n = LZ4_compress_default(
+        reinterpret_cast<char const *>(data.data()),
+        reinterpret_cast<char *>(ret.data()), src_size,
+        static_cast<int>(ret.size()));
+    // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+    if (n <= 0)
+        return {};
+    ret.resize(static_cast<std::size_t>(n));
+    ret.shrink_to_fit();
+    return ret;
+#else
+    (void)data;
+    return {};
+#endif
+}
+
+auto decompress(gsl::span<std::uint8_t const> compressed,
+                gsl::span<std::uint8_t> dest) -> bool {
+#ifdef PARTAKE_LZ4
+    if (compressed.size() > std::size_t(std::numeric_limits<int>::max()) ||
+        dest.size() > std::size_t(std::numeric_limits<int>::max()))
+        return false;
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto const n = LZ4_decompress_safe(
+        reinterpret_cast<char const *>(compressed.data()),
+        reinterpret_cast<char *>(dest.data()),
+        static_cast<int>(compressed.size()), static_cast<int>(dest.size()));
+    // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+    return n >= 0 && std::size_t(n) == dest.size();
+#else
+    (void)compressed;
+    (void)dest;
+    return false;
+#endif
+}
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("compress and decompress") {
+    std::vector<std::uint8_t> data(4096);
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<std::uint8_t>(i % 7);
+
+    auto const c = compress(data);
+    if (not compression_supported) {
+        CHECK(c.empty());
+        return;
+    }
+    REQUIRE_FALSE(c.empty());
+    CHECK(c.size() < data.size());
+
+    std::vector<std::uint8_t> out(data.size());
+    CHECK(decompress(c, out));
+    CHECK(out == data);
+
+    std::vector<std::uint8_t> wrong_size(data.size() - 1);
+    CHECK_FALSE(decompress(c, wrong_size));
+
+    SUBCASE("incompressible") {
+        std::vector<std::uint8_t> noise(256);
+        std::uint32_t x = 12345;
+        for (auto &b : noise) {
+            x = x * 1103515245 + 12345;
+            b = static_cast<std::uint8_t>(x >> 24);
+        }
+        CHECK(compress(noise).empty());
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,35 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <gsl/span>
+
+#include <cstdint>
+#include <vector>
+
+namespace partake::daemon {
+
+// Whether partaked was built with LZ4 (-Dlz4=enabled), without which
+// compress() always fails.
+#ifdef PARTAKE_LZ4
+constexpr bool compression_supported = true;
+#else
+constexpr bool compression_supported = false;
+#endif
+
+// Compress the data (with LZ4, favoring speed over ratio) for cold storage.
+// Return an empty vector if unsupported, or if the result would not be
+// smaller than the data.
+auto compress(gsl::span<std::uint8_t const> data) -> std::vector<std::uint8_t>;
+
+// Decompress data produced by compress() into 'dest', whose size must be
+// that of the original data. Return false if the data are corrupt (or
+// compression is unsupported).
+auto decompress(gsl::span<std::uint8_t const> compressed,
+                gsl::span<std::uint8_t> dest) -> bool;
+
+} // namespace partake::daemon
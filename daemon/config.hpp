@@ -10,6 +10,45 @@ namespace partake::daemon {
 
 constexpr auto default_voucher_ttl_seconds = 10;
 
+constexpr auto default_voucher_expiry_batching_seconds = 1;
+
+constexpr auto default_snapshot_ttl_seconds = 60;
+
+constexpr auto page_release_interval_seconds = 5;
+
+constexpr auto cold_storage_sweep_interval_seconds = 5;
+
+constexpr auto cold_storage_bytes_per_sweep = 256 * 1024 * 1024;
+
+constexpr auto min_cold_object_size = 64 * 1024; // Bytes
+
+// Objects (or chunks) written per housekeeping pass of a state export.
+constexpr auto state_export_slice_size = 1024;
+
+// Backstop for starting scrubs of freed memory that were not started after
+// a request message (see partake_daemon::start_scrubs()).
+constexpr auto scrub_interval_milliseconds = 100;
+
+constexpr auto population_chunk_size = 64 * 1024 * 1024; // Bytes
+
+constexpr auto packed_object_granularity = 64; // Bytes
+
 constexpr auto max_client_name_length = 1023;
 
+constexpr auto max_pool_buffer_count = 4096;
+
+constexpr auto max_object_extents = 64;
+
+constexpr auto max_topic_name_length = 255;
+
+constexpr auto max_profiled_clients = 1024;
+
+constexpr auto default_write_high_water_mark = 4 * 1024 * 1024; // Bytes
+
+constexpr auto default_max_frame_len = 1024 * 1024; // Bytes
+
+constexpr auto default_teardown_batch_size = 4096; // Handles
+
+constexpr auto housekeeping_tasks_per_pass = 64;
+
 } // namespace partake::daemon
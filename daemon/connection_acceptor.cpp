@@ -18,6 +18,8 @@
 
 #ifdef _WIN32
 #include <Windows.h>
+#else
+#include <unistd.h>
 #endif
 
 namespace partake::daemon {
@@ -98,4 +100,28 @@ TEST_CASE("connection_acceptor: connect") {
     cv.notify_one();
 }
 
+#ifndef _WIN32
+
+TEST_CASE("connection_acceptor: adopted socket") {
+    testing::tempdir const td;
+    auto path = testing::unique_path(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__));
+    asio::io_context ctx;
+    int fd = -1;
+    {
+        uds::acceptor listening(ctx, uds::endpoint(path.string()));
+        fd = ::dup(listening.native_handle());
+    }
+    REQUIRE(fd >= 0);
+    connection_acceptor<uds> a(ctx, uds::endpoint());
+    a.adopt(fd);
+    CHECK(a.start([](auto &&sock) { (void)sock; }, [] {}));
+    a.close();
+    // Not removed, because we didn't create it.
+    CHECK(std::filesystem::is_socket(path));
+    std::filesystem::remove(path);
+}
+
+#endif
+
 } // namespace partake::daemon
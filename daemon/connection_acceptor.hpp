@@ -15,6 +15,7 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 #include <utility>
 
 namespace partake::daemon {
@@ -25,6 +26,8 @@ class connection_acceptor {
     using io_context_type = AsioContext;
     using endpoint_type = typename StreamProtocol::endpoint;
     using socket_type = typename StreamProtocol::socket;
+    using native_handle_type =
+        typename StreamProtocol::acceptor::native_handle_type;
 
   private:
 #ifdef _WIN32
@@ -37,6 +40,7 @@ class connection_acceptor {
     endpoint_type endpt;
     typename StreamProtocol::acceptor acceptor;
     socket_type next_sock; // Unopened socket for next connection
+    std::optional<native_handle_type> adopted_sock;
     std::function<void(socket_type &&)> handle_new_conn;
     std::function<void()> handle_close_acceptor;
     unlinkable_type sock_unlinkable;
@@ -48,35 +52,19 @@ class connection_acceptor {
         : asio_context(&context), endpt(std::move(endpoint)),
           acceptor(context), next_sock(context) {}
 
+    // Use the given socket, which must already be bound and listening (such
+    // as one passed by socket activation), instead of creating one upon
+    // start(). Its socket file is not removed upon close(), because it
+    // belongs to whoever created the socket (and may be reused by a
+    // restarted daemon).
+    void adopt(native_handle_type listening_socket) {
+        adopted_sock = listening_socket;
+    }
+
     auto start(std::function<void(socket_type &&)> handle_connection,
                std::function<void()> handle_close) -> bool {
-        boost::system::error_code err;
-
-        acceptor.open(endpt.protocol(), err);
-        if (err) {
-            spdlog::error("failed to open listening socket: {} ({})",
-                          err.message(), err.value());
+        if (not(adopted_sock ? start_adopted() : start_listening()))
             return false;
-        }
-
-        acceptor.bind(endpt, err);
-        if (err) {
-            spdlog::error(
-                "failed to bind listening socket to endpoint: {}: {} ({})",
-                endpt.path(), err.message(), err.value());
-            return false;
-        }
-
-        sock_unlinkable =
-            unlinkable_type(endpt.path(), spdlog::default_logger());
-
-        acceptor.listen(socket_type::max_listen_connections, err);
-        if (err) {
-            spdlog::error("failed to listen on socket: {}: {} ({})",
-                          endpt.path(), err.message(), err.value());
-            return false;
-        }
-        spdlog::info("listening on socket: {}", endpt.path());
 
         handle_new_conn = std::move(handle_connection);
         handle_close_acceptor = std::move(handle_close);
@@ -113,6 +101,52 @@ class connection_acceptor {
     }
 
   private:
+    auto start_listening() -> bool {
+        boost::system::error_code err;
+
+        acceptor.open(endpt.protocol(), err);
+        if (err) {
+            spdlog::error("failed to open listening socket: {} ({})",
+                          err.message(), err.value());
+            return false;
+        }
+
+        acceptor.bind(endpt, err);
+        if (err) {
+            spdlog::error(
+                "failed to bind listening socket to endpoint: {}: {} ({})",
+                endpt.path(), err.message(), err.value());
+            return false;
+        }
+
+        sock_unlinkable =
+            unlinkable_type(endpt.path(), spdlog::default_logger());
+
+        acceptor.listen(socket_type::max_listen_connections, err);
+        if (err) {
+            spdlog::error("failed to listen on socket: {}: {} ({})",
+                          endpt.path(), err.message(), err.value());
+            return false;
+        }
+        spdlog::info("listening on socket: {}", endpt.path());
+        return true;
+    }
+
+    auto start_adopted() -> bool {
+        boost::system::error_code err;
+        acceptor.assign(endpt.protocol(), *adopted_sock, err);
+        if (err) {
+            spdlog::error("failed to use given listening socket: {} ({})",
+                          err.message(), err.value());
+            return false;
+        }
+        auto const local = acceptor.local_endpoint(err);
+        if (not err)
+            endpt = local;
+        spdlog::info("listening on given socket: {}", endpt.path());
+        return true;
+    }
+
     void schedule_accept() {
         acceptor.async_accept(
             next_sock, [this](boost::system::error_code const &err) {
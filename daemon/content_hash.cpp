@@ -0,0 +1,136 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "content_hash.hpp"
+
+#include <doctest.h>
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace partake::daemon {
+
+namespace {
+
+constexpr std::uint64_t prime1 = 0x9E37'79B1'85EB'CA87;
+constexpr std::uint64_t prime2 = 0xC2B2'AE3D'27D4'EB4F;
+constexpr std::uint64_t prime3 = 0x1656'67B1'9E37'79F9;
+constexpr std::uint64_t prime4 = 0x85EB'CA77'C2B2'AE63;
+constexpr std::uint64_t prime5 = 0x27D4'EB2F'1656'67C5;
+
+constexpr auto rotl(std::uint64_t x, int r) noexcept -> std::uint64_t {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Little-endian loads from unaligned data (which compilers reduce to a
+// single load on little-endian machines).
+inline auto read64(std::uint8_t const *p) noexcept -> std::uint64_t {
+    std::uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+inline auto read32(std::uint8_t const *p) noexcept -> std::uint64_t {
+    std::uint64_t v = 0;
+    for (int i = 3; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+constexpr auto round(std::uint64_t acc, std::uint64_t input) noexcept
+    -> std::uint64_t {
+    return rotl(acc + input * prime2, 31) * prime1;
+}
+
+constexpr auto merge_round(std::uint64_t acc, std::uint64_t val) noexcept
+    -> std::uint64_t {
+    return (acc ^ round(0, val)) * prime1 + prime4;
+}
+
+} // namespace
+
+auto content_hash(gsl::span<std::uint8_t const> data) noexcept
+    -> std::uint64_t {
+    auto const *p = data.data();
+    auto const len = data.size();
+    auto const *const end = p + len;
+    std::uint64_t h = 0;
+
+    if (len >= 32) {
+        std::uint64_t v1 = prime1 + prime2;
+        std::uint64_t v2 = prime2;
+        std::uint64_t v3 = 0;
+        std::uint64_t v4 = 0 - prime1;
+        auto const *const limit = end - 32;
+        do {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    } else {
+        h = prime5;
+    }
+
+    h += static_cast<std::uint64_t>(len);
+
+    for (; p + 8 <= end; p += 8)
+        h = rotl(h ^ round(0, read64(p)), 27) * prime1 + prime4;
+    if (p + 4 <= end) {
+        h = rotl(h ^ (read32(p) * prime1), 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = rotl(h ^ (*p * prime5), 11) * prime1;
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+namespace {
+
+auto hash_of(std::string_view s) -> std::uint64_t {
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    return content_hash({reinterpret_cast<std::uint8_t const *>(s.data()),
+                         s.size()});
+}
+
+} // namespace
+
+TEST_CASE("content_hash") {
+    // Reference values of XXH64 with seed 0.
+    CHECK(hash_of("") == 0xEF46'DB37'51D8'E999);
+    CHECK(hash_of("a") == 0xD24E'C4F1'A98C'6E5B);
+    CHECK(hash_of("abc") == 0x44BC'2CF5'AD77'0999);
+
+    // All code paths (lanes, 8-, 4-, and 1-byte tails) must be sensitive to
+    // every byte.
+    std::string const s(77, 'x');
+    auto const h = hash_of(s);
+    for (std::size_t i = 0; i < s.size(); ++i) {
+        auto t = s;
+        t[i] = 'y';
+        CHECK(hash_of(t) != h);
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,23 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <gsl/span>
+
+#include <cstdint>
+
+namespace partake::daemon {
+
+// 64-bit hash of the data (the XXH64 algorithm, with seed 0), for finding
+// candidate duplicates of shared objects. Four independent lanes are
+// accumulated, so that throughput is limited by memory rather than by
+// multiplication latency. Not cryptographic: equal hashes must be confirmed
+// by comparing the data.
+auto content_hash(gsl::span<std::uint8_t const> data) noexcept
+    -> std::uint64_t;
+
+} // namespace partake::daemon
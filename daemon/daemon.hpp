@@ -8,100 +8,391 @@
 
 #include "allocator.hpp"
 #include "asio.hpp"
+#include "buddy_arena.hpp"
 #include "client.hpp"
+#include "compression.hpp"
 #include "config.hpp"
 #include "connection_acceptor.hpp"
 #include "handle.hpp"
 #include "hive.hpp"
+#include "housekeeping_scheduler.hpp"
 #include "key_sequence.hpp"
+#include "logging.hpp"
+#include "magazine_arena.hpp"
 #include "message.hpp"
 #include "object.hpp"
 #include "overloaded.hpp"
+#include "page_residency.hpp"
 #include "page_size.hpp"
+#include "parallel_copy.hpp"
+#include "posix.hpp"
 #include "quitter.hpp"
+#include "quota.hpp"
+#include "random.hpp"
 #include "repository.hpp"
 #include "request_handler.hpp"
 #include "segment.hpp"
+#include "segment_pool.hpp"
 #include "session.hpp"
 #include "sizes.hpp"
+#include "slab_arena.hpp"
+#include "snapshot.hpp"
+#include "socket_activation.hpp"
+#include "state_export.hpp"
+#include "stats.hpp"
 
+#include <gsl/span>
 #include <tl/expected.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <chrono>
+#include <csignal>
 #include <cstddef>
 #include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <type_traits>
 #include <utility>
+#include <variant>
+#include <vector>
 
 namespace partake::daemon {
 
+enum class allocator_strategy {
+    free_list, // internal::arena
+    slab,      // internal::slab_arena<internal::arena>
+    buddy,     // internal::buddy_arena
+};
+
 struct daemon_config {
     asio::local::stream_protocol::endpoint endpoint;
+    // Use the listening socket passed by socket activation (not endpoint).
+    bool socket_activation = false;
     segment_config seg_config;
+    // If given, a segment (of the same size) created when all of the
+    // max_segments are full, to which allocations spill.
+    std::optional<segment_config> overflow_seg_config;
+    // Reserved at the end of each (primary) segment; clients may bind to
+    // one by name at hello (see basic_segment_pool).
+    std::vector<sub_pool_config> sub_pools;
     std::size_t log2_granularity = 0;
+    std::size_t max_segments = 1;
+    // If not empty, segment i is bound to numa_nodes[i % numa_nodes.size()],
+    // and one segment per node is created at startup.
+    std::vector<int> numa_nodes;
+    // Find (from sysfs, once) each client's NUMA node and L3 cache at hello
+    // and report them; always done if numa_nodes is not empty.
+    bool report_placement = false;
+    allocator_strategy allocator = allocator_strategy::free_list;
+    bool allocation_cache = false; // Use internal::magazine_arena front end
+    // Zero freed allocations on the worker threads before they are reused
+    // (see arena::set_scrub_on_free()). Requires the free_list allocator
+    // without allocation_cache.
+    bool scrub_on_free = false;
+    unsigned worker_threads = 2; // For bulk memory operations; 0 to disable
+    // Request messages handled per read, for clients of QoS class NORMAL
+    // and BULK (REALTIME clients are never limited); 0 for no limit.
+    std::size_t normal_messages_per_turn = 0;
+    std::size_t bulk_messages_per_turn = 1;
+    bool allow_trusted_clients = false; // Clients may skip verification
+    std::size_t client_quota = 0; // Bytes per client; 0 for no limit
+    // Bytes that only REALTIME clients can allocate; 0 for none. Must be
+    // less than the total size of max_segments segments.
+    std::size_t realtime_reserve = 0;
+    std::size_t read_buffer_size = 2 * common::max_message_frame_len;
+    // Pause reading from a client while it has more than this many bytes
+    // of responses waiting to be written; 0 for no limit.
+    std::size_t write_high_water_mark = default_write_high_water_mark;
+    // Largest message frame that clients may negotiate at hello (at least
+    // common::max_message_frame_len, the default).
+    std::size_t max_frame_len = default_max_frame_len;
+    // Handles of a disconnected client closed per event loop turn, so that
+    // tearing down a client with very many does not stall others; 0 to
+    // close all at once.
+    std::size_t teardown_batch_size = default_teardown_batch_size;
     std::chrono::milliseconds voucher_ttl =
         std::chrono::seconds(default_voucher_ttl_seconds);
+    // Expired vouchers are dropped at most once per window.
+    std::chrono::milliseconds voucher_expiry_batching =
+        std::chrono::seconds(default_voucher_expiry_batching_seconds);
+    std::size_t page_release_threshold = 0; // Disabled if zero
+    // Shared objects that have not been open (being held only by vouchers)
+    // for this long are compressed into daemon memory, freeing their shared
+    // memory, and decompressed when next opened (see cold_store); zero to
+    // disable. Requires compression_supported.
+    std::chrono::milliseconds cold_storage_after{0};
+    // Fault in and/or lock (seg_config.prefault, lock) the initial segments
+    // on the worker threads after starting to accept connections, holding
+    // allocations until the first part is done.
+    bool background_population = false;
+    // Reserve a wake word for each PRIMITIVE object (see
+    // basic_segment_pool); reported to clients in alloc/open responses.
+    bool wake_words = false;
+    // Use a 64-byte granularity (unless log2_granularity is set) and align
+    // only objects of at least a page to page boundaries, so that small
+    // objects share pages (see basic_segment_pool).
+    bool pack_small_objects = false;
+    // Sample 1 in this many allocations for the allocation profile, which is
+    // reported in GetStatsResponse and logged upon SIGUSR1; 0 to disable.
+    std::size_t alloc_sample_interval = 0;
+    // If nonzero, log asynchronously (see common::use_async_default_logger),
+    // queuing up to this many messages.
+    std::size_t log_queue_size = 0;
+    // Run the I/O thread in a loop of non-blocking polls instead of
+    // blocking for events (see main()), pinning it to busy_poll_cpu if
+    // that is non-negative.
+    bool busy_poll = false;
+    int busy_poll_cpu = -1;
+    common::log_overflow_policy log_overflow =
+        common::log_overflow_policy::drop_oldest;
+    // If not empty, shared objects are saved here upon shutdown and
+    // restored from here (if it exists) upon startup. Requires persistent
+    // segments and the free_list allocator without allocation_cache.
+    std::filesystem::path snapshot_path;
+    // Restored objects are destroyed after this long unless opened.
+    std::chrono::milliseconds snapshot_ttl =
+        std::chrono::seconds(default_snapshot_ttl_seconds);
+    // If not empty, a state export (see state_export_writer) is written
+    // here upon SIGUSR2 (not on Windows).
+    std::filesystem::path state_export_path;
+    std::chrono::milliseconds page_release_interval =
+        std::chrono::seconds(page_release_interval_seconds);
+    std::chrono::milliseconds cold_storage_sweep_interval =
+        std::chrono::seconds(cold_storage_sweep_interval_seconds);
 };
 
-template <typename AsioContext> class partake_daemon {
+// All of the daemon's handlers are run on a single strand, to which the
+// worker threads post the completions of offloaded work.
+template <typename AsioContext, typename Arena = internal::arena>
+class partake_daemon {
   private:
     using io_context_type = AsioContext;
+    using strand_type = asio::strand<typename io_context_type::executor_type>;
     using socket_type = asio::local::stream_protocol::socket;
     using message_reader_type = common::async_message_reader<socket_type>;
     using message_writer_type =
         common::async_message_writer<socket_type, flatbuffers::DetachedBuffer>;
-    using object_type = object<arena_allocator::allocation>;
+    using segment_pool_type = basic_segment_pool<segment, Arena>;
+    using object_type = object<typename segment_pool_type::allocation>;
     using voucher_queue_type = voucher_queue<object_type>;
     using repository_type =
         repository<object_type, key_sequence, voucher_queue_type>;
     using handle_type = handle<object_type>;
     using session_type =
-        session<arena_allocator, repository_type, handle_type, segment>;
+        session<segment_pool_type, repository_type, handle_type>;
     using request_handler_type = request_handler<session_type>;
     using client_type =
         client<socket_type, message_reader_type, message_writer_type,
                session_type, request_handler_type>;
+    using acceptor_type =
+        connection_acceptor<asio::local::stream_protocol, strand_type>;
 
     daemon_config cfg;
 
-    quitter<io_context_type> quitr;
-    connection_acceptor<asio::local::stream_protocol, io_context_type>
-        acceptor;
+    // Sockets, timers, and signals are created on this strand, so their
+    // completion handlers (and hence all access to the state below) are
+    // serialized with each other and with completions from the workers.
+    strand_type strnd;
+
+    quitter<strand_type> quitr;
+#ifndef _WIN32
+    asio::signal_set profile_signal; // SIGUSR1
+    asio::signal_set export_signal;  // SIGUSR2
+#endif
+    acceptor_type acceptor;
+
+    // Two (read-write and read-only) per segment whose descriptor is passed
+    // to clients (memfd with fd_socket), sent to each connecting client.
+    std::vector<std::unique_ptr<acceptor_type>> segment_fd_acceptors;
 
-    segment seg;
-    arena_allocator allocr;
+    segment_pool_type pool;
 
     steady_clock_traits clk_traits;
     voucher_queue_type vq;
     repository_type repo;
 
+    // Table resizing and waiting-allocation retries (scheduled after each
+    // request message), page release, and cold storage sweeps are run here,
+    // outside of request handling.
+    housekeeping_scheduler<strand_type> housekeeper;
+    housekeeping_scheduler<strand_type>::task_id repo_housekeeping = 0;
+
+    // Set for the earliest deadline of waiting Open and Unshare requests
+    // with a timeout; armed by the repository housekeeping task, which runs
+    // after each request message.
+    steady_clock_traits::timer_type wait_deadline_timer;
+    time_point wait_deadline_scheduled_time = time_point::max();
+
     hive<client_type> clients;
     std::uint32_t session_counter = 0;
 
+    daemon_stats stats;
+
+    // Shared by all non-REALTIME clients if realtime_reserve is set.
+    std::shared_ptr<quota> non_realtime_quota;
+
+    // The state export in progress, if any, written by the export task a
+    // slice at a time: objects, then chunks.
+    std::unique_ptr<state_export_writer> exporter;
+    bool exporting_chunks = false;
+    housekeeping_scheduler<strand_type>::task_id export_task = 0;
+
+    // Number of chunks of background population not yet done (on the strand),
+    // and whether to skip the rest (accessed by worker threads).
+    std::size_t population_chunks_left = 0;
+    std::atomic<bool> population_canceled{false};
+
+    // Runs bulk memory operations (Fill, CopyRange) and background population
+    // off the strand. Declared after the state above so that it is joined
+    // before that is destroyed.
+    asio::thread_pool workers;
+    std::size_t bulk_ops_in_flight = 0;
+    std::size_t scrubs_in_flight = 0; // Included in bulk_ops_in_flight
+    bool quitting = false;
+
     int exitcode = 0;
 
   public:
     explicit partake_daemon(io_context_type &asio_context,
                             daemon_config config)
-        : cfg(std::move(config)),
-          quitr(asio_context, [this]() { acceptor.close(); }),
-          acceptor(asio_context, config.endpoint), seg(config.seg_config),
-          allocr(seg.size(), config.log2_granularity != 0u
-                                 ? config.log2_granularity
-                                 : log2_size(page_size())),
-          clk_traits(asio_context), vq(clk_traits), repo(key_sequence(), vq) {
-        if (not seg.is_valid()) {
-            spdlog::error("failed to create shared memory segment");
+        : cfg(std::move(config)), strnd(asio::make_strand(asio_context)),
+          quitr(strnd, [this]() { acceptor.close(); }),
+#ifndef _WIN32
+          profile_signal(strnd, SIGUSR1), export_signal(strnd),
+#endif
+          acceptor(strnd, cfg.endpoint),
+          pool(
+              [this](std::uint32_t segment_id) {
+                  auto seg_cfg =
+                      segment_id == 0
+                          ? cfg.seg_config
+                          : additional_segment_config(cfg.seg_config,
+                                                      segment_id);
+                  if (not cfg.numa_nodes.empty())
+                      seg_cfg.numa_node =
+                          cfg.numa_nodes[segment_id % cfg.numa_nodes.size()];
+                  if (cfg.background_population &&
+                      segment_id < initial_segment_count())
+                      seg_cfg.prefault = seg_cfg.lock = false;
+                  auto seg = segment(seg_cfg);
+                  if (seg.is_valid() && not serve_descriptor(seg, seg_cfg))
+                      return segment();
+                  return seg;
+              },
+              initial_log2_granularity(),
+              cfg.max_segments, is_initially_zero_filled(cfg.seg_config),
+              initial_segment_count(), cfg.wake_words,
+              cfg.pack_small_objects ? page_size() : 0,
+              cfg.overflow_seg_config
+                  ? [this](std::uint32_t) {
+                        return segment(*cfg.overflow_seg_config);
+                    }
+                  : std::function<segment(std::uint32_t)>(),
+              cfg.sub_pools),
+          clk_traits(strnd),
+          vq(clk_traits, cfg.voucher_expiry_batching),
+          repo(key_sequence::with_epoch(
+                   static_cast<std::uint8_t>(common::random_uint64())),
+               vq),
+          housekeeper(strnd, housekeeping_tasks_per_pass),
+          repo_housekeeping(housekeeper.add_task([this] {
+              if (cfg.scrub_on_free)
+                  start_scrubs();
+              repo.perform_housekeeping();
+              schedule_wait_deadlines();
+              return false;
+          })),
+          wait_deadline_timer(clk_traits.make_timer()),
+          stats([this] { return gather_gauges(); }),
+          workers(std::max(cfg.worker_threads, 1u)) {
+        if (not pool.is_valid()) {
             exitcode = 1;
             return;
         }
-        std::size_t const gran = std::size_t(1) << allocr.log2_granularity();
+        std::size_t const gran = std::size_t(1) << pool.log2_granularity();
         spdlog::info("allocation granularity set to {}",
                      human_readable_size(gran));
-        if (seg.size() % gran != 0) {
+        auto const seg_size = pool.find_segment(0)->size();
+        if (seg_size % gran != 0) {
             spdlog::warn(
                 "segment size is not a multiple of the allocation granularity; wasting {} bytes",
-                seg.size() % gran);
+                seg_size % gran);
+        }
+        if (cfg.pack_small_objects) {
+            spdlog::info("objects smaller than {} are packed into shared pages",
+                         human_readable_size(page_size()));
+        }
+        if (pool.max_segment_count() > 1) {
+            spdlog::info(
+                "additional segments will be created on demand, up to {} in total",
+                pool.max_segment_count());
+        }
+        if (cfg.overflow_seg_config) {
+            spdlog::info(
+                "allocations will spill to an overflow segment when shared memory is full");
+        }
+        for (auto const &sp : cfg.sub_pools) {
+            spdlog::info("sub-pool '{}' has {} in each segment", sp.name,
+                         human_readable_size(sp.size));
         }
+        if (not cfg.numa_nodes.empty()) {
+            spdlog::info("segments are bound to {} NUMA nodes in turn",
+                         cfg.numa_nodes.size());
+        }
+        if (not cfg.numa_nodes.empty() || cfg.report_placement) {
+            repo.topology() = cpu_topology::probe();
+            if (repo.topology().empty())
+                spdlog::warn("CPU topology unknown; clients are not placed");
+        }
+        if (cfg.busy_poll)
+            spdlog::info("the I/O thread will busy-poll for socket events");
+#ifdef BOOST_ASIO_HAS_IO_URING
+        spdlog::info("socket I/O uses io_uring");
+#endif
+        if (cfg.worker_threads == 0)
+            spdlog::info("bulk memory operations will not use worker threads");
+        if (cfg.page_release_threshold > 0) {
+            spdlog::info(
+                "pages of free chunks of at least {} will be returned to the system",
+                human_readable_size(cfg.page_release_threshold));
+        }
+        if (cfg.scrub_on_free) {
+            pool.set_scrub_on_free(true);
+            spdlog::info("freed shared memory will be zeroed before reuse");
+        }
+        if (cfg.cold_storage_after.count() > 0) {
+            spdlog::info(
+                "shared objects not open for {} s will be compressed into daemon memory",
+                std::chrono::duration<double>(cfg.cold_storage_after).count());
+        }
+        if (cfg.client_quota > 0) {
+            spdlog::info("each client may hold up to {} of shared memory",
+                         human_readable_size(cfg.client_quota));
+        }
+        if (cfg.realtime_reserve > 0) {
+            auto const total = seg_size * pool.max_segment_count();
+            assert(cfg.realtime_reserve < total);
+            non_realtime_quota =
+                std::make_shared<quota>(total - cfg.realtime_reserve);
+            spdlog::info("{} of shared memory is reserved for REALTIME clients",
+                         human_readable_size(cfg.realtime_reserve));
+        }
+        if (cfg.alloc_sample_interval > 0) {
+            repo.alloc_profiler().set_sample_interval(
+                cfg.alloc_sample_interval);
+            spdlog::info("1 in {} allocations will be sampled for profiling",
+                         cfg.alloc_sample_interval);
+        }
+        if (not cfg.snapshot_path.empty())
+            restore_snapshot();
+        if (cfg.background_population)
+            repo.alloc_waiters().hold();
     }
 
     // No move or copy (references to members are taken)
@@ -114,37 +405,626 @@ template <typename AsioContext> class partake_daemon {
     void start() {
         if (exitcode != 0)
             return;
+#ifndef _WIN32 // Rejected by CLI on Windows
+        if (cfg.socket_activation) {
+            auto const fd = socket_activation_fd();
+            if (fd < 0) {
+                exitcode = 1;
+                return;
+            }
+            acceptor.adopt(fd);
+        }
+#endif
         if (not acceptor.start(
                 [this](socket_type &&sock) { start_client(std::move(sock)); },
-                [this]() { quit(); }))
+                [this]() { quit(); })) {
             exitcode = 1;
-        else
-            quitr.start();
+            return;
+        }
+        quitr.start();
+#ifndef _WIN32
+        wait_for_profile_signal();
+        if (not cfg.state_export_path.empty()) {
+            export_signal.add(SIGUSR2);
+            export_task =
+                housekeeper.add_task([this] { return export_state_slice(); });
+            wait_for_export_signal();
+        }
+#endif
+        if (cfg.page_release_threshold > 0) {
+            (void)housekeeper.add_periodic_task(
+                cfg.page_release_interval, [this] {
+                    release_free_pages();
+                    return false;
+                });
+        }
+        if (cfg.cold_storage_after.count() > 0) {
+            (void)housekeeper.add_periodic_task(
+                cfg.cold_storage_sweep_interval, [this] {
+                    sweep_cold_storage();
+                    return false;
+                });
+        }
+        if (cfg.scrub_on_free) {
+            (void)housekeeper.add_periodic_task(
+                std::chrono::milliseconds(scrub_interval_milliseconds),
+                [this] {
+                    start_scrubs();
+                    return false;
+                });
+        }
+        if (cfg.background_population)
+            start_population();
     }
 
     auto exit_code() const noexcept -> int { return exitcode; }
 
   private:
+    // Start listening on the sockets from which clients receive the
+    // descriptors of the segment, if they are to be passed (see
+    // fd_passing_segment_spec). The read-write descriptor is sent to anyone
+    // who connects, whether or not their connection was declared read-only
+    // (which is advisory; see HelloRequest).
+    auto serve_descriptor(segment const &seg, segment_config const &seg_cfg)
+        -> bool {
+        auto const *memfd_cfg =
+            std::get_if<memfd_segment_config>(&seg_cfg.method);
+        if (memfd_cfg == nullptr || seg.descriptor() < 0)
+            return true;
+        if (not serve_fd(memfd_cfg->fd_socket, seg.descriptor()))
+            return false;
+        if (not serve_fd(memfd_cfg->fd_socket + ".ro",
+                         seg.read_only_descriptor())) {
+            // Kept (closed) because its accept handler may still be pending.
+            segment_fd_acceptors.back()->close();
+            return false;
+        }
+        return true;
+    }
+
+    auto serve_fd(std::string const &socket_path, int fd) -> bool {
+#ifdef _WIN32
+        (void)socket_path;
+        (void)fd;
+        return false; // Not reached (memfd is Linux-only)
+#else
+        auto &fd_acceptor =
+            segment_fd_acceptors.emplace_back(std::make_unique<acceptor_type>(
+                strnd, asio::local::stream_protocol::endpoint(socket_path)));
+        if (not fd_acceptor->start(
+                [fd](socket_type &&sock) {
+                    (void)common::posix::send_fd(sock.native_handle(), fd,
+                                                 spdlog::default_logger());
+                    boost::system::error_code ignore;
+                    sock.close(ignore);
+                },
+                [] {})) {
+            segment_fd_acceptors.pop_back(); // Nothing pending
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    [[nodiscard]] auto initial_log2_granularity() const -> std::size_t {
+        if (cfg.log2_granularity != 0u)
+            return cfg.log2_granularity;
+        if (cfg.pack_small_objects)
+            return log2_size(packed_object_granularity);
+        return log2_size(page_size());
+    }
+
+    [[nodiscard]] auto initial_segment_count() const noexcept
+        -> std::size_t {
+        return std::max<std::size_t>(cfg.numa_nodes.size(), 1);
+    }
+
+    // Chunks are queued in order of address, so the start of segment 0
+    // (where a fresh arena allocates first) is done first; allocations are
+    // released as soon as that chunk is done.
+    void start_population() {
+        std::size_t const chunk_size = population_chunk_size;
+        auto const seg_count =
+            std::min(pool.segment_count(), initial_segment_count());
+        std::size_t total = 0;
+        for (std::uint32_t id = 0; id < seg_count; ++id) {
+            auto const *seg = pool.find_segment(id);
+            auto *base = static_cast<std::uint8_t *>(seg->address());
+            for (std::size_t off = 0; off < seg->size(); off += chunk_size) {
+                auto const size = std::min(chunk_size, seg->size() - off);
+                bool const first = population_chunks_left == 0;
+                ++population_chunks_left;
+                total += size;
+                asio::post(workers, [this, addr = base + off, size, first] {
+                    bool ok = true;
+                    if (not population_canceled.load()) {
+                        if (cfg.seg_config.prefault)
+                            (void)prefault_pages(addr, size);
+                        if (cfg.seg_config.lock)
+                            ok = lock_pages(addr, size);
+                    }
+                    asio::post(strnd, [this, ok, first] {
+                        population_chunk_done(ok, first);
+                    });
+                });
+            }
+        }
+        spdlog::info("populating {} of shared memory in the background",
+                     human_readable_size(total));
+    }
+
+    void population_chunk_done(bool ok, bool first) {
+        --population_chunks_left;
+        if (quitting)
+            return;
+        if (not ok) {
+            // As when locking fails at startup without background population.
+            spdlog::error("cannot lock shared memory; exiting");
+            exitcode = 1;
+            quit();
+            return;
+        }
+        if (first) {
+            repo.alloc_waiters().release();
+            housekeeper.schedule(repo_housekeeping);
+        }
+        if (population_chunks_left == 0)
+            spdlog::info("finished populating shared memory");
+    }
+
+    // Close the handles of a closed client, in batches on successive turns
+    // of the event loop, then destroy it. Clients remaining at quit are
+    // destroyed at once by close_all_clients().
+    void tear_down_client(client_type &c) {
+        bool const done = cfg.teardown_batch_size == 0 ||
+                          c.close_some_handles(cfg.teardown_batch_size);
+        if (done) {
+            housekeeper.remove_task(c.housekeeping_task());
+            clients.erase(clients.get_iterator(&c));
+        }
+        // Memory freed by the closed session may satisfy waiting
+        // allocations.
+        housekeeper.schedule(repo_housekeeping);
+        if (not done) {
+            asio::post(strnd, [this, &c] {
+                if (not quitting)
+                    tear_down_client(c);
+            });
+        }
+    }
+
     void start_client(socket_type &&socket) {
-        clients
-            .emplace(
-                std::move(socket), session_counter++, seg, allocr, repo,
-                cfg.voucher_ttl, [this]() { repo.perform_housekeeping(); },
-                [this](client_type &c) {
-                    clients.erase(clients.get_iterator(&c));
-                })
-            ->start();
+        auto &new_client = *clients.emplace(
+            std::move(socket), session_counter++, pool, repo, cfg.voucher_ttl,
+            cfg.allow_trusted_clients, cfg.read_buffer_size,
+            cfg.write_high_water_mark, cfg.max_frame_len, &stats,
+            [this](client_type &c) {
+                housekeeper.schedule(c.housekeeping_task());
+                housekeeper.schedule(repo_housekeeping);
+            },
+            [this](client_type &c) { tear_down_client(c); },
+            cfg.worker_threads > 0 ? offloader() : offloader_type(),
+            [this](protocol::QosClass qos) -> std::size_t {
+                switch (qos) {
+                case protocol::QosClass::REALTIME:
+                    return 0;
+                case protocol::QosClass::BULK:
+                    return cfg.bulk_messages_per_turn;
+                default:
+                    return cfg.normal_messages_per_turn;
+                }
+            },
+            cfg.client_quota > 0 || non_realtime_quota
+                ? std::make_shared<quota>(cfg.client_quota, non_realtime_quota)
+                : nullptr,
+            [this](protocol::QosClass qos) {
+                return qos == protocol::QosClass::REALTIME
+                           ? nullptr
+                           : non_realtime_quota;
+            });
+        new_client.set_housekeeping_task(
+            housekeeper.add_task([&new_client] {
+                new_client.perform_housekeeping();
+                return false;
+            }));
+        new_client.start();
+    }
+
+    using offloader_type =
+        std::function<void(std::function<void()>, std::function<void()>)>;
+
+    // Run 'work' on a worker thread, then 'done' on the strand.
+    auto offloader() -> offloader_type {
+        return [this](std::function<void()> work, std::function<void()> done) {
+            ++bulk_ops_in_flight;
+            asio::post(workers, [this, work = std::move(work),
+                                 done = std::move(done)]() mutable {
+                work();
+                asio::post(strnd, [this, done = std::move(done)] {
+                    done();
+                    --bulk_ops_in_flight;
+                    if (quitting && bulk_ops_in_flight == 0)
+                        close_all_clients();
+                });
+            });
+        };
+    }
+
+    // Zero the freed allocations held by the pool (see
+    // basic_segment_pool::take_chunks_to_scrub()) on a worker thread, then
+    // free them, as zero-filled, on the strand. The data spans are obtained
+    // here because the pool may only be accessed on the strand.
+    void start_scrubs() {
+        if (quitting)
+            return;
+        auto held = std::make_shared<
+            std::vector<typename segment_pool_type::allocation>>(
+            pool.take_chunks_to_scrub());
+        if (held->empty())
+            return;
+        std::vector<gsl::span<std::uint8_t>> data;
+        data.reserve(held->size());
+        for (auto const &a : *held)
+            data.push_back(pool.bytes(a));
+        ++scrubs_in_flight;
+        offloader()(
+            [data = std::move(data)] {
+                for (auto const &d : data)
+                    parallel_scrub(d.data(), d.size());
+            },
+            [this, held] {
+                --scrubs_in_flight;
+                for (auto &a : *held)
+                    pool.free_scrubbed(std::move(a));
+                repo.alloc_waiters().notify_freed();
+                housekeeper.schedule(repo_housekeeping);
+            });
+    }
+
+#ifndef _WIN32
+    void wait_for_profile_signal() {
+        profile_signal.async_wait(
+            [this](boost::system::error_code const &err, int /* sig */) {
+                if (err)
+                    return;
+                log_allocation_profiles(repo.alloc_profiler());
+                wait_for_profile_signal();
+            });
+    }
+
+    void wait_for_export_signal() {
+        export_signal.async_wait(
+            [this](boost::system::error_code const &err, int /* sig */) {
+                if (err)
+                    return;
+                start_state_export();
+                wait_for_export_signal();
+            });
+    }
+#endif
+
+    void start_state_export() {
+        if (exporter) {
+            spdlog::warn("state export already in progress; signal ignored");
+            return;
+        }
+        auto w = std::make_unique<state_export_writer>(
+            cfg.state_export_path,
+            static_cast<std::uint32_t>(pool.log2_granularity()));
+        if (not w->is_valid())
+            return;
+        exporter = std::move(w);
+        exporting_chunks = false;
+        housekeeper.schedule(export_task);
+    }
+
+    // Return true if there is more to export.
+    auto export_state_slice() -> bool {
+        if (not exporter)
+            return false;
+        if (not exporting_chunks) {
+            exporting_chunks = not repo.scan_objects(
+                state_export_slice_size, [this](object_type &obj) {
+                    exporter->add(exported_object_of(obj));
+                });
+        } else if (not pool.scan_chunks(
+                       state_export_slice_size,
+                       [this](std::uint32_t segment_id, std::size_t offset,
+                              std::size_t size, bool in_use) {
+                           exporter->add(exported_chunk{segment_id, offset,
+                                                        size, in_use});
+                       })) {
+            if (exporter->finish()) {
+                spdlog::info("exported {} objects and {} chunks to {}",
+                             exporter->object_count(),
+                             exporter->chunk_count(),
+                             cfg.state_export_path.string());
+            }
+            exporter.reset();
+            return false;
+        }
+        (void)exporter->flush();
+        return true;
+    }
+
+    auto exported_object_of(object_type &obj) -> exported_object {
+        auto &po = obj.as_proper_object();
+        auto const &a = po.resource();
+        std::uint8_t flags = 0;
+        if (obj.policy() == protocol::Policy::PRIMITIVE)
+            flags |= exported_object_flags::primitive;
+        if (po.is_shared())
+            flags |= exported_object_flags::shared;
+        if (repo.cold_objects().is_cold(&obj))
+            flags |= exported_object_flags::cold;
+        if (repo.is_multi_extent(&obj))
+            flags |= exported_object_flags::multi_extent;
+        if (po.is_pooled())
+            flags |= exported_object_flags::pooled;
+        return {obj.key().as_u64(),
+                a.segment_id(),
+                a.offset(),
+                a.size(),
+                po.open_handle_count(),
+                static_cast<std::uint32_t>(po.vouchers().size()),
+                flags};
+    }
+
+    auto gather_gauges() -> daemon_gauges {
+        daemon_gauges g;
+        g.object_count = repo.object_count();
+        g.voucher_count = repo.voucher_count();
+        g.segment_count = pool.segment_count();
+        g.shmem = pool.stats();
+        g.alloc_profiler = &repo.alloc_profiler();
+        g.client_count = clients.size();
+        for (auto const &c : clients) {
+            auto const q = c.queued_message_count();
+            g.queued_messages += q;
+            g.max_client_queued_messages =
+                std::max(g.max_client_queued_messages, q);
+        }
+        return g;
+    }
+
+    void schedule_wait_deadlines() {
+        auto const deadline = repo.wait_deadlines().next_deadline();
+        if (deadline >= wait_deadline_scheduled_time)
+            return; // Already scheduled before given deadline.
+
+        wait_deadline_timer.cancel();
+        wait_deadline_scheduled_time = deadline;
+        wait_deadline_timer = clk_traits.make_timer(deadline);
+        wait_deadline_timer.async_wait([this](boost::system::error_code err) {
+            if (not err && not quitting) {
+                wait_deadline_scheduled_time = time_point::max();
+                repo.wait_deadlines().expire(steady_clock_traits::now());
+                schedule_wait_deadlines();
+            }
+        });
+    }
+
+    void release_free_pages() {
+        auto const released =
+            pool.release_free_pages(cfg.page_release_threshold);
+        if (released > 0) {
+            spdlog::debug("returned {} of free shared memory to system",
+                          human_readable_size(released));
+        }
+    }
+
+    struct cold_sweep_tally {
+        std::size_t pending = 0; // Compressions not yet done
+        std::size_t stored = 0;
+        std::size_t freed = 0;
+    };
+
+    // Compress the shared objects that have not been open for
+    // cfg.cold_storage_after (up to a limit per sweep) and free their
+    // shared memory. Compression runs on the worker threads, if any; an
+    // object opened in the meantime is left as it is (see
+    // cold_store::cancel_compression()). Objects that are not open are not
+    // mapped by any client, but may be read by bulk operations on the worker
+    // threads, so the sweep is skipped while any (other than scrubs, which
+    // only write freed memory, but including the previous sweep's
+    // compressions) are in flight.
+    void sweep_cold_storage() {
+        if (quitting || bulk_ops_in_flight > scrubs_in_flight)
+            return;
+        auto &cold = repo.cold_objects();
+        auto const now = std::chrono::steady_clock::now();
+        std::size_t budget = cold_storage_bytes_per_sweep;
+        auto tally = std::make_shared<cold_sweep_tally>();
+        cold.begin_sweep();
+        repo.for_each_proper_object([&](object_type &obj) {
+            auto &po = obj.as_proper_object();
+            if (obj.policy() != protocol::Policy::DEFAULT ||
+                not po.is_shared() || po.is_open() || po.is_pooled() ||
+                cold.is_cold(&obj) || cold.is_compressing(&obj) ||
+                repo.is_multi_extent(&obj))
+                return;
+            auto const size = po.resource().size();
+            if (size < min_cold_object_size)
+                return;
+            if (cold.mark_idle(&obj, now) > now - cfg.cold_storage_after ||
+                size > budget)
+                return;
+            budget -= size;
+            cold.begin_compression(&obj);
+            ++tally->pending;
+            // The object is kept alive (so its data is not freed) until done.
+            auto data = std::make_shared<std::vector<std::uint8_t>>();
+            auto work = [data, in = pool.bytes(po.resource())] {
+                *data = compress(in);
+            };
+            auto done = [this, keep = ref_ptr<object_type>(&obj), data, size,
+                         tally] {
+                finish_cold_storage(*keep, std::move(*data), size, *tally);
+            };
+            if (cfg.worker_threads > 0) {
+                offloader()(std::move(work), std::move(done));
+            } else {
+                work();
+                done();
+            }
+        });
+        cold.end_sweep();
+    }
+
+    void finish_cold_storage(object_type &obj,
+                             std::vector<std::uint8_t> &&data,
+                             std::size_t size, cold_sweep_tally &tally) {
+        auto &cold = repo.cold_objects();
+        auto &po = obj.as_proper_object();
+        if (cold.end_compression(&obj) && not po.is_open()) {
+            if (data.empty()) {
+                cold.mark_incompressible(&obj);
+            } else {
+                repo.dedup().erase(&obj); // Its data can no longer be compared
+                cold.insert(&obj, std::move(data), size);
+                (void)po.replace_resource({}); // Frees the shared memory
+                tally.freed += size;
+                ++tally.stored;
+            }
+        }
+        if (--tally.pending > 0 || tally.stored == 0)
+            return;
+        repo.alloc_waiters().notify_freed();
+        spdlog::debug(
+            "compressed {} idle objects ({}); {} objects ({} compressed to {}) in cold storage",
+            tally.stored, human_readable_size(tally.freed), cold.size(),
+            human_readable_size(cold.original_bytes()),
+            human_readable_size(cold.compressed_bytes()));
+    }
+
+    // The snapshot is removed once read, so that it is not applied again
+    // if we do not exit cleanly (by which time the data may have changed).
+    void restore_snapshot() {
+        std::error_code ec;
+        if (not std::filesystem::exists(cfg.snapshot_path, ec))
+            return;
+        auto const snap = read_snapshot(cfg.snapshot_path);
+        std::filesystem::remove(cfg.snapshot_path, ec);
+        if (not snap)
+            return;
+        if (snap->segment_size != pool.find_segment(0)->size() ||
+            snap->log2_granularity != pool.log2_granularity()) {
+            spdlog::warn(
+                "snapshot does not match segment size or allocation granularity; ignored");
+            return;
+        }
+        // A state of 0 (epoch 0, no keys issued) cannot have objects.
+        if (snap->key_sequence_state == 0 && not snap->objects.empty()) {
+            spdlog::warn("snapshot has objects but no issued keys; ignored");
+            return;
+        }
+        if constexpr (not std::is_same_v<Arena, internal::arena>) {
+            spdlog::error("snapshots require the free-list allocator");
+        } else {
+            repo.key_seq() = key_sequence(snap->key_sequence_state);
+            auto const expiration = clock::now() + cfg.snapshot_ttl;
+            std::size_t restored = 0;
+            for (auto const &o : snap->objects) {
+                auto alloc = pool.allocate_at(
+                    o.segment_id, static_cast<std::size_t>(o.offset),
+                    static_cast<std::size_t>(o.size));
+                if (not alloc)
+                    continue;
+                auto obj =
+                    repo.restore_object(common::token(o.key),
+                                        protocol::Policy::DEFAULT,
+                                        std::move(alloc));
+                if (not obj)
+                    continue;
+                obj->as_proper_object().share_unopened();
+                // The voucher (whose key is not given to anyone) keeps the
+                // object alive until clients open it by its key.
+                repo.create_voucher(std::move(obj), expiration, 1);
+                ++restored;
+            }
+            spdlog::info("restored {} of {} shared objects from snapshot",
+                         restored, snap->objects.size());
+        }
+    }
+
+    // Save the shared DEFAULT objects, whose contents cannot change, in
+    // order of location (so that they are quickly restored).
+    void save_snapshot() {
+        repository_snapshot snap;
+        snap.key_sequence_state = repo.key_seq().state();
+        snap.segment_size = pool.find_segment(0)->size();
+        snap.log2_granularity =
+            static_cast<std::uint32_t>(pool.log2_granularity());
+        std::size_t unsaved = 0;
+        repo.for_each_proper_object([this, &snap, &unsaved](object_type &obj) {
+            if (obj.policy() != protocol::Policy::DEFAULT ||
+                not obj.as_proper_object().is_shared())
+                return;
+            // Objects in cold storage have no shared memory to restore, and
+            // only single-extent objects can be restored.
+            if (repo.cold_objects().is_cold(&obj) ||
+                repo.is_multi_extent(&obj)) {
+                ++unsaved;
+                return;
+            }
+            auto const &a = obj.as_proper_object().resource();
+            // The overflow segment is not persistent.
+            if (pool.is_overflow_segment(a.segment_id())) {
+                ++unsaved;
+                return;
+            }
+            snap.objects.push_back(
+                {obj.key().as_u64(), a.segment_id(), a.offset(), a.size()});
+        });
+        std::sort(snap.objects.begin(), snap.objects.end(),
+                  [](snapshot_object const &l, snapshot_object const &r) {
+                      return std::pair(l.segment_id, l.offset) <
+                             std::pair(r.segment_id, r.offset);
+                  });
+        if (unsaved > 0) {
+            spdlog::warn(
+                "{} shared objects (in cold storage, multi-extent, or in the overflow segment) are not saved",
+                unsaved);
+        }
+        if (write_snapshot(cfg.snapshot_path, snap)) {
+            spdlog::info("saved {} shared objects to snapshot {}",
+                         snap.objects.size(), cfg.snapshot_path.string());
+        }
     }
 
     void quit() {
         quitr.stop();
+#ifndef _WIN32
+        {
+            boost::system::error_code err;
+            profile_signal.cancel(err);
+            export_signal.cancel(err);
+        }
+#endif
+        exporter.reset(); // An incomplete export is discarded
+        housekeeper.stop();
+        wait_deadline_timer.cancel();
+        population_canceled = true;
+        for (auto &fd_acceptor : segment_fd_acceptors)
+            fd_acceptor->close();
+
+        // Objects are destroyed when their clients are closed below.
+        if (not cfg.snapshot_path.empty())
+            save_snapshot();
 
         // Drop pending requests before closing sessions (and hence
         // handles, objects), so that none of them resume.
         for (auto &c : clients)
             c.prepare_for_shutdown();
-        clients.clear();
 
+        // Bulk operations in progress refer to their clients until done.
+        quitting = true;
+        if (bulk_ops_in_flight == 0)
+            close_all_clients();
+    }
+
+    void close_all_clients() {
+        clients.clear();
         repo.drop_all_vouchers();
     }
 };
@@ -0,0 +1,47 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "dedup_index.hpp"
+
+#include <doctest.h>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("dedup_index") {
+    dedup_index<int> idx;
+    CHECK(idx.empty());
+    int a = 1;
+    int b = 2;
+    int c = 1;
+    auto const equal_to = [](int v) {
+        return [v](int const &o) { return o == v; };
+    };
+
+    idx.insert(42, &a);
+    idx.insert(42, &b); // Hash collision
+    idx.insert(43, &c);
+    CHECK(idx.size() == 3);
+    CHECK(idx.find(42, equal_to(1)) == &a);
+    CHECK(idx.find(42, equal_to(2)) == &b);
+    CHECK(idx.find(43, equal_to(2)) == nullptr);
+    CHECK(idx.find(44, equal_to(1)) == nullptr);
+
+    idx.erase(&a);
+    CHECK(idx.find(42, equal_to(1)) == nullptr);
+    CHECK(idx.find(42, equal_to(2)) == &b);
+    idx.erase(&a); // No-op
+    CHECK(idx.size() == 2);
+
+    idx.erase(&b);
+    idx.erase(&c);
+    CHECK(idx.empty());
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,82 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+namespace partake::daemon {
+
+// Shared objects indexed by the hash of their contents, so that an object
+// being shared with deduplication can be replaced by an existing identical
+// one. Objects are not owned; they must be removed (erase()) before they are
+// destroyed or their contents may change (upon unshare).
+template <typename Object> class dedup_index {
+  public:
+    using object_type = Object;
+
+  private:
+    std::unordered_multimap<std::uint64_t, object_type *> by_hash;
+    std::unordered_map<object_type const *, std::uint64_t> hash_of;
+
+  public:
+    dedup_index() = default;
+
+    // No move or copy (for consistency with other registries)
+    ~dedup_index() = default;
+    dedup_index(dedup_index const &) = delete;
+    auto operator=(dedup_index const &) = delete;
+    dedup_index(dedup_index &&) = delete;
+    auto operator=(dedup_index &&) = delete;
+
+    [[nodiscard]] auto empty() const noexcept -> bool {
+        return hash_of.empty();
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return hash_of.size();
+    }
+
+    // 'obj' must not already be in the index.
+    void insert(std::uint64_t hash, object_type *obj) {
+        auto const [it, inserted] = hash_of.try_emplace(obj, hash);
+        if (inserted)
+            by_hash.emplace(hash, obj);
+    }
+
+    // No-op if 'obj' is not in the index.
+    void erase(object_type const *obj) {
+        if (hash_of.empty())
+            return; // Fast path when deduplication is not used
+        auto const it = hash_of.find(obj);
+        if (it == hash_of.end())
+            return;
+        auto [first, last] = by_hash.equal_range(it->second);
+        for (; first != last; ++first) {
+            if (first->second == obj) {
+                by_hash.erase(first);
+                break;
+            }
+        }
+        hash_of.erase(it);
+    }
+
+    // Return the first object with the given hash for which 'equal(obj)'
+    // returns true, or nullptr.
+    template <typename Equal>
+    auto find(std::uint64_t hash, Equal equal) const -> object_type * {
+        auto [first, last] = by_hash.equal_range(hash);
+        for (; first != last; ++first) {
+            if (equal(*first->second))
+                return first->second;
+        }
+        return nullptr;
+    }
+};
+
+} // namespace partake::daemon
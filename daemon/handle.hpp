@@ -7,81 +7,119 @@
 #pragma once
 
 #include "handle_list.hpp"
-#include "hive.hpp"
+#include "ref_counted.hpp"
+#include "small_function.hpp"
 #include "token.hpp"
-#include "token_hash_table.hpp"
+#include "tracing.hpp"
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
-#include <functional>
-#include <memory>
 #include <optional>
+#include <utility>
+#include <vector>
 
 namespace partake::daemon {
 
 // A handle is owned by a session and contains per-session data about an
 // object. The object is either open via the handle or awaiting to be opened.
 template <typename Object>
-class handle : public token_hash_table<handle<Object>>::hook,
-               public handle_list<handle<Object>>::hook,
-               public std::enable_shared_from_this<handle<Object>> {
+class handle : public handle_list<handle<Object>>::hook,
+               public ref_counted<handle<Object>> {
   public:
     using object_type = Object; // Can be incomplete type.
 
   private:
-    std::shared_ptr<object_type> obj;
+    ref_ptr<object_type> obj;
+
+    // Key in the session's handle table. Normally equal to the object's key,
+    // but kept separately so that the handle can still be removed from the
+    // table after another session has rekeyed the object (by unsharing it)
+    // while this handle is closing.
+    common::token ky;
 
     // Number of times opened by the session owning this handle
     unsigned open_count = 0;
 
+    // How many of the opens are leased (closed when the session's lease
+    // expires); never more than open_count.
+    unsigned leased_count = 0;
+
     // Hold strong reference to self while open_count > 0
-    std::shared_ptr<handle> shared_self;
+    ref_ptr<handle> shared_self;
 
+    // Whether the client has been asked to relocate the object
+    bool relocation_req = false;
+
+  public:
+    // The handler is typically a lambda capturing the completion callbacks
+    // of a deferred request, each of which captures only the seqno and the
+    // request handler; this fits in place, so that storing a pending
+    // request does not allocate.
+    using pending_handler = small_function<void(ref_ptr<handle>)>;
+
+  private:
     struct pending_request {
-        std::shared_ptr<handle> self; // Retain reference
-        std::function<void(std::shared_ptr<handle>)> handler;
+        ref_ptr<handle> self; // Retain reference
+        pending_handler handler;
+        std::uint64_t id; // For cancellation; 0 if not cancelable
     };
-    hive<pending_request> requests_pending_on_share;
+
+    // A session rarely has more than one request pending on the share of a
+    // given object, so the first is stored in the handle itself (which is
+    // pool-allocated by the session); any more go to the vector.
+    std::optional<pending_request> request_pending_on_share;
+    std::vector<pending_request> more_requests_pending_on_share;
     std::optional<pending_request> request_pending_on_unique_ownership;
 
   public:
-    explicit handle(std::shared_ptr<object_type> object)
-        : obj(std::move(object)) {
+    explicit handle(ref_ptr<object_type> object)
+        : obj(std::move(object)), ky(obj->key()) {
         assert(obj->is_proper_object());
     }
 
     ~handle() {
-        // We must only arrive here due to all shared_ptrs being destroyed,
+        // We must only arrive here due to all ref_ptrs being destroyed,
         // thus triggering removal from the session. So the following must be
         // true.
-        assert(requests_pending_on_share.empty());
+        assert(not has_requests_pending_on_share());
         assert(not request_pending_on_unique_ownership.has_value());
         assert(open_count == 0);
     }
 
-    // No move or copy (used with intrusive data structures and shared_ptr)
+    // No move or copy (used with intrusive data structures and ref_ptr)
     handle(handle const &) = delete;
     auto operator=(handle const &) = delete;
     handle(handle &&) = delete;
     auto operator=(handle &&) = delete;
 
-    [[nodiscard]] auto key() const noexcept -> common::token {
-        return obj->key();
-    }
+    [[nodiscard]] auto key() const noexcept -> common::token { return ky; }
+
+    // Must not be called when the handle is in a session's handle table.
+    void rekey(common::token key) noexcept { ky = key; }
 
-    auto object() noexcept -> std::shared_ptr<object_type> { return obj; }
+    auto object() noexcept -> ref_ptr<object_type> { return obj; }
 
     void open() {
         if (open_count == 0) {
             assert(not shared_self);
-            shared_self = this->shared_from_this();
+            shared_self = ref_ptr<handle>(this);
             obj->as_proper_object().open();
         }
         ++open_count;
     }
 
+    // Mark one of the opens as leased.
+    void add_lease() noexcept {
+        assert(leased_count < open_count);
+        ++leased_count;
+    }
+
+    // Close an unleased open if there is one; otherwise a leased one.
     void close() {
         assert(open_count > 0);
+        if (leased_count == open_count)
+            --leased_count;
         --open_count;
         if (open_count == 0) {
             obj->as_proper_object().close(this);
@@ -100,31 +138,108 @@ class handle : public token_hash_table<handle<Object>>::hook,
         return open_count > 0;
     }
 
+    [[nodiscard]] auto lease_count() const noexcept -> unsigned {
+        return leased_count;
+    }
+
+    // Close all leased opens, leaving unleased ones open.
+    void close_leased() {
+        auto keep_me = ref_ptr<handle>(this); // Last close() releases self
+        while (leased_count > 0) {
+            --leased_count;
+            close();
+        }
+    }
+
     [[nodiscard]] auto is_open_uniquely() const -> bool {
         return open_count == 1 &&
                obj->as_proper_object().is_opened_by_unique_handle();
     }
 
-    void add_request_pending_on_share(
-        std::function<void(std::shared_ptr<handle>)> handler) {
-        obj->as_proper_object().add_handle_awaiting_share(this);
-        requests_pending_on_share.insert(
-            {this->shared_from_this(), std::move(handler)});
+    [[nodiscard]] auto is_relocation_requested() const noexcept -> bool {
+        return relocation_req;
+    }
+
+    void set_relocation_requested() noexcept { relocation_req = true; }
+
+    [[nodiscard]] auto has_requests_pending_on_share() const noexcept
+        -> bool {
+        return request_pending_on_share.has_value();
+    }
+
+    // A nonzero 'id' allows the request to be canceled (when it times out).
+    void add_request_pending_on_share(pending_handler handler,
+                                      std::uint64_t id = 0) {
+        pending_request pending{ref_ptr<handle>(this), std::move(handler),
+                                id};
+        if (not request_pending_on_share) {
+            // The handle is in the object's list once, however many
+            // requests are pending.
+            obj->as_proper_object().add_handle_awaiting_share(this);
+            request_pending_on_share = std::move(pending);
+        } else {
+            more_requests_pending_on_share.push_back(std::move(pending));
+        }
     }
 
-    void set_request_pending_on_unique_ownership(
-        std::function<void(std::shared_ptr<handle>)> handler) {
+    void set_request_pending_on_unique_ownership(pending_handler handler) {
         assert(not request_pending_on_unique_ownership.has_value());
         obj->as_proper_object().set_handle_awaiting_unique_ownership(this);
-        request_pending_on_unique_ownership = {this->shared_from_this(),
-                                               std::move(handler)};
+        request_pending_on_unique_ownership = {ref_ptr<handle>(this),
+                                               std::move(handler), 0};
+    }
+
+    // Remove the request pending on share with the given (nonzero) id,
+    // without calling it. Return false if there is no such request.
+    auto cancel_request_pending_on_share(std::uint64_t id) -> bool {
+        assert(id != 0);
+        auto keep_me = ref_ptr<handle>(this);
+        if (not request_pending_on_share)
+            return false;
+        if (request_pending_on_share->id == id) {
+            if (more_requests_pending_on_share.empty()) {
+                obj->as_proper_object().remove_handle_awaiting_share(this);
+                request_pending_on_share.reset();
+            } else {
+                request_pending_on_share =
+                    std::move(more_requests_pending_on_share.front());
+                more_requests_pending_on_share.erase(
+                    more_requests_pending_on_share.begin());
+            }
+            return true;
+        }
+        auto &more = more_requests_pending_on_share;
+        auto const it = std::find_if(
+            more.begin(), more.end(),
+            [id](pending_request const &p) { return p.id == id; });
+        if (it == more.end())
+            return false;
+        more.erase(it);
+        return true;
+    }
+
+    // Remove the request pending on unique ownership without calling it.
+    // Return false if there is none.
+    auto cancel_request_pending_on_unique_ownership() -> bool {
+        auto keep_me = ref_ptr<handle>(this);
+        if (not request_pending_on_unique_ownership)
+            return false;
+        obj->as_proper_object().clear_handle_awaiting_unique_ownership(this);
+        request_pending_on_unique_ownership.reset();
+        return true;
     }
 
     void resume_requests_pending_on_share() {
-        auto keep_me = this->shared_from_this();
-        for (auto &pending : requests_pending_on_share)
+        if (not request_pending_on_share)
+            return;
+        auto keep_me = ref_ptr<handle>(this);
+        auto first = std::exchange(request_pending_on_share, std::nullopt);
+        auto more = std::move(more_requests_pending_on_share);
+        more_requests_pending_on_share.clear();
+        PARTAKE_TRACE1(share_resume, 1 + more.size());
+        first->handler(std::move(first->self));
+        for (auto &pending : more)
             pending.handler(std::move(pending.self));
-        requests_pending_on_share.clear();
     }
 
     void resume_request_pending_on_unique_ownership() {
@@ -136,10 +251,11 @@ class handle : public token_hash_table<handle<Object>>::hook,
     }
 
     void drop_pending_requests() {
-        auto keep_me = this->shared_from_this();
-        if (not requests_pending_on_share.empty()) {
+        auto keep_me = ref_ptr<handle>(this);
+        if (request_pending_on_share) {
             obj->as_proper_object().remove_handle_awaiting_share(this);
-            requests_pending_on_share.clear();
+            request_pending_on_share.reset();
+            more_requests_pending_on_share.clear();
         }
         if (request_pending_on_unique_ownership) {
             obj->as_proper_object().clear_handle_awaiting_unique_ownership(
@@ -149,6 +265,7 @@ class handle : public token_hash_table<handle<Object>>::hook,
     }
 
     void close_all() {
+        auto keep_me = ref_ptr<handle>(this); // Last close() releases self
         drop_pending_requests();
         while (open_count > 0)
             close();
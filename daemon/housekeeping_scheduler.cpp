@@ -0,0 +1,121 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "housekeeping_scheduler.hpp"
+
+#include "asio.hpp"
+
+#include <doctest.h>
+
+#include <chrono>
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("housekeeping_scheduler") {
+    asio::io_context ctx;
+    housekeeping_scheduler<asio::io_context::executor_type> hk(
+        ctx.get_executor(), 2);
+    std::vector<int> runs;
+
+    SUBCASE("on-demand task runs once per pass") {
+        auto const t = hk.add_task([&] {
+            runs.push_back(1);
+            return false;
+        });
+        hk.schedule(t);
+        hk.schedule(t);
+        CHECK(runs.empty()); // Not run synchronously
+        CHECK(hk.due_count() == 1);
+        ctx.run();
+        CHECK(runs == std::vector{1});
+        CHECK(hk.due_count() == 0);
+    }
+
+    SUBCASE("task with more work runs again") {
+        int remaining = 3;
+        auto const t = hk.add_task([&] {
+            runs.push_back(remaining);
+            return --remaining > 0;
+        });
+        hk.schedule(t);
+        ctx.run();
+        CHECK(runs == std::vector{3, 2, 1});
+    }
+
+    SUBCASE("tasks per pass are limited") {
+        auto const t1 = hk.add_task([&] {
+            runs.push_back(1);
+            return false;
+        });
+        auto const t2 = hk.add_task([&] {
+            runs.push_back(2);
+            return false;
+        });
+        auto const t3 = hk.add_task([&] {
+            runs.push_back(3);
+            return false;
+        });
+        hk.schedule(t1);
+        hk.schedule(t2);
+        hk.schedule(t3);
+        CHECK(ctx.run_one() == 1);
+        CHECK(runs == std::vector{1, 2});
+        ctx.run();
+        CHECK(runs == std::vector{1, 2, 3});
+    }
+
+    SUBCASE("removed task is not run") {
+        auto const t = hk.add_task([&] {
+            runs.push_back(1);
+            return false;
+        });
+        hk.schedule(t);
+        hk.remove_task(t);
+        ctx.run();
+        CHECK(runs.empty());
+    }
+
+    SUBCASE("task may remove itself") {
+        housekeeping_scheduler<asio::io_context::executor_type>::task_id t{};
+        t = hk.add_task([&] {
+            hk.remove_task(t);
+            runs.push_back(1);
+            return true;
+        });
+        hk.schedule(t);
+        ctx.run();
+        CHECK(runs == std::vector{1});
+    }
+
+    SUBCASE("periodic task") {
+        (void)hk.add_periodic_task(std::chrono::milliseconds(1), [&] {
+            runs.push_back(1);
+            if (runs.size() == 2)
+                hk.stop();
+            return false;
+        });
+        ctx.run();
+        CHECK(runs == std::vector{1, 1});
+    }
+
+    SUBCASE("stopped") {
+        auto const t = hk.add_task([&] {
+            runs.push_back(1);
+            return false;
+        });
+        hk.schedule(t);
+        hk.stop();
+        ctx.run();
+        CHECK(runs.empty());
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,158 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "asio.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+namespace partake::daemon {
+
+// Runs maintenance work (hash table resizing, page release, cold storage
+// sweeps, ...) on the daemon's executor, in passes of its own rather than
+// as part of handling client requests.
+//
+// A task is a function returning true if it has more work to do (having
+// stopped at its own budget). On-demand tasks run once after being marked
+// due with schedule(), however many times that is called in the meantime;
+// periodic tasks are marked due by a timer. Each pass runs at most
+// 'tasks_per_pass' due tasks and is posted to the executor, so that other
+// ready handlers (such as socket reads) run between passes. Tasks that have
+// more work to do are marked due again.
+template <typename Executor> class housekeeping_scheduler {
+  public:
+    using executor_type = Executor;
+    using task_id = std::uint64_t;
+
+  private:
+    struct task {
+        std::function<bool()> fn;
+        bool due = false;
+        std::chrono::milliseconds interval{0};    // Periodic tasks only
+        std::unique_ptr<asio::steady_timer> timer; // Periodic tasks only
+    };
+
+    executor_type exec;
+    std::size_t per_pass;
+    std::unordered_map<task_id, task> tasks;
+    std::deque<task_id> due_ids; // May contain removed tasks
+    task_id next_id = 1;
+    bool pass_posted = false;
+    bool stopped = false;
+
+  public:
+    explicit housekeeping_scheduler(executor_type executor,
+                                    std::size_t tasks_per_pass)
+        : exec(std::move(executor)), per_pass(tasks_per_pass) {
+        assert(per_pass > 0);
+    }
+
+    // No move or copy (referenced by posted handlers)
+    ~housekeeping_scheduler() = default;
+    housekeeping_scheduler(housekeeping_scheduler const &) = delete;
+    auto operator=(housekeeping_scheduler const &) = delete;
+    housekeeping_scheduler(housekeeping_scheduler &&) = delete;
+    auto operator=(housekeeping_scheduler &&) = delete;
+
+    auto add_task(std::function<bool()> fn) -> task_id {
+        auto const id = next_id++;
+        tasks[id].fn = std::move(fn);
+        return id;
+    }
+
+    // The first run is after 'interval'.
+    auto add_periodic_task(std::chrono::milliseconds interval,
+                           std::function<bool()> fn) -> task_id {
+        auto const id = add_task(std::move(fn));
+        auto &t = tasks[id];
+        t.interval = interval;
+        t.timer = std::make_unique<asio::steady_timer>(exec);
+        arm_timer(id, t);
+        return id;
+    }
+
+    // The task will not be called after this returns.
+    void remove_task(task_id id) { tasks.erase(id); }
+
+    void schedule(task_id id) {
+        auto it = tasks.find(id);
+        if (it == tasks.end() || it->second.due)
+            return;
+        it->second.due = true;
+        due_ids.push_back(id);
+        post_pass();
+    }
+
+    [[nodiscard]] auto due_count() const noexcept -> std::size_t {
+        std::size_t ret = 0;
+        for (auto const &[id, t] : tasks)
+            ret += std::size_t(t.due);
+        return ret;
+    }
+
+    // Cancel timers and stop running tasks (upon shutdown).
+    void stop() {
+        stopped = true;
+        for (auto &[id, t] : tasks) {
+            if (t.timer)
+                t.timer->cancel();
+        }
+    }
+
+  private:
+    void arm_timer(task_id id, task &t) {
+        t.timer->expires_after(t.interval);
+        t.timer->async_wait([this, id](boost::system::error_code err) {
+            if (err || stopped)
+                return;
+            auto it = tasks.find(id);
+            if (it == tasks.end())
+                return;
+            arm_timer(id, it->second);
+            schedule(id);
+        });
+    }
+
+    void post_pass() {
+        if (pass_posted || stopped)
+            return;
+        pass_posted = true;
+        asio::post(exec, [this] {
+            pass_posted = false;
+            if (not stopped)
+                run_pass();
+        });
+    }
+
+    void run_pass() {
+        for (std::size_t n = 0; n < per_pass && not due_ids.empty();) {
+            auto const id = due_ids.front();
+            due_ids.pop_front();
+            auto it = tasks.find(id);
+            if (it == tasks.end() || not it->second.due)
+                continue; // Removed (and id not reused)
+            it->second.due = false;
+            ++n;
+            // Copy, so that the task may remove itself.
+            auto fn = it->second.fn;
+            if (fn())
+                schedule(id);
+        }
+        if (not due_ids.empty())
+            post_pass();
+    }
+};
+
+} // namespace partake::daemon
@@ -10,30 +10,68 @@
 
 #include <doctest.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <utility>
+#include <vector>
 
 namespace partake::daemon {
 
+namespace internal {
+
+// Inverse of an odd number modulo 2^64 (Newton's method; each step doubles
+// the number of correct low bits, starting with 3).
+constexpr auto inverse_mod_2_64(std::uint64_t odd) noexcept -> std::uint64_t {
+    std::uint64_t inv = odd;
+    for (int i = 0; i < 5; ++i)
+        inv *= 2 - odd * inv;
+    return inv;
+}
+
+} // namespace internal
+
 // Within the lifetime of a partaked instance, keys are unique and never
 // reused; for DEFAULT policy objects, a key uniquely identifies shared object
-// content. (There are enough unique 64-bit numbers that we will never loop
-// around.) The null (zero) token is not used as a key.
+// content. The null (zero) token is not used as a key.
 //
-// Keys are generated using a pseudorandom sequence that will emit 2^64 - 1
-// _distinct_ non-zero tokens before looping around. Sequential numbers would
-// also work, but we don't want to tempt users to make assumptions about token
-// values (unless they are determined to). The pseudorandom tokens also serve
-// as good hash table keys.
+// Each key encodes a 56-bit sequence number, scrambled by a bijection so that
+// users are not tempted to make assumptions about key values (and so that
+// keys serve as good hash table keys), in its low 56 bits. (There are enough
+// 56-bit numbers that we will never run out.) The high 8 bits are a check
+// byte computed from the low bits and the sequence's epoch, which is chosen
+// at random when partaked starts (and kept across snapshot restores). This
+// allows may_have_issued() to reject, without looking anything up, nearly all
+// keys that were never issued: garbage, and keys from other epochs (such as
+// from before a restart), all but 1/256 of which fail the check, as well as
+// keys that will only be issued in the future.
 class key_sequence {
-    // The initial value could be any non-zero value; use the simplest one.
-    // NOLINTNEXTLINE(readability-magic-numbers)
-    std::uint64_t prev = 0xffff'ffff'ffff'ffffuLL;
+    static constexpr unsigned seqno_bits = 56;
+    static constexpr std::uint64_t seqno_mask =
+        (std::uint64_t(1) << seqno_bits) - 1;
+
+    std::uint64_t seqno = 0; // Of the last generated key
+    std::uint8_t ep = 0;
 
   public:
     key_sequence() noexcept = default;
 
+    // Continue the sequence from a previous instance's state(), so that keys
+    // from before a restart are not reused (and remain valid). A state of 0
+    // is that of a sequence with epoch 0 that has issued no keys.
+    explicit key_sequence(std::uint64_t state) noexcept
+        : seqno(state & seqno_mask),
+          ep(static_cast<std::uint8_t>(state >> seqno_bits)) {}
+
+    // Start a new sequence, whose keys are distinguished from those of
+    // sequences with other epochs.
+    [[nodiscard]] static auto with_epoch(std::uint8_t epoch) noexcept
+        -> key_sequence {
+        key_sequence ret;
+        ret.ep = epoch;
+        return ret;
+    }
+
     ~key_sequence() = default;
 
     // Copying suggests a bug, so allow move only.
@@ -41,35 +79,148 @@ class key_sequence {
     auto operator=(key_sequence const &) = delete;
 
     key_sequence(key_sequence &&other) noexcept
-        : prev(std::exchange(other.prev, 0uLL)) {}
+        : seqno(std::exchange(other.seqno, 0)),
+          ep(std::exchange(other.ep, 0)) {}
 
     auto operator=(key_sequence &&rhs) noexcept -> key_sequence & {
-        prev = std::exchange(rhs.prev, 0uLL);
+        seqno = std::exchange(rhs.seqno, 0);
+        ep = std::exchange(rhs.ep, 0);
         return *this;
     }
 
+    // The epoch and the sequence number of the last generated key.
+    [[nodiscard]] auto state() const noexcept -> std::uint64_t {
+        return (std::uint64_t(ep) << seqno_bits) | seqno;
+    }
+
+    [[nodiscard]] auto epoch() const noexcept -> std::uint8_t { return ep; }
+
     [[nodiscard]] auto generate() noexcept -> common::token {
-        auto t = prev;
-        assert(t != 0);
-
-        // NOLINTBEGIN(readability-magic-numbers)
-        // See https://en.wikipedia.org/wiki/Xorshift
-        t ^= t << 13;
-        t ^= t >> 7;
-        t ^= t << 17;
-        // NOLINTEND(readability-magic-numbers)
-
-        prev = t;
-        return common::token(t);
+        assert(seqno < seqno_mask);
+        ++seqno;
+        auto const x = scramble(seqno);
+        return common::token((std::uint64_t(check_byte(x)) << seqno_bits) |
+                             x);
+    }
+
+    // Return false if 'key' has certainly not been generated by this
+    // sequence (or its predecessors in the same epoch). Costs a few
+    // multiplications, and touches no memory other than the sequence.
+    [[nodiscard]] auto may_have_issued(common::token key) const noexcept
+        -> bool {
+        auto const k = key.as_u64();
+        auto const x = k & seqno_mask;
+        if (x == 0 || (k >> seqno_bits) != check_byte(x))
+            return false;
+        return unscramble(x) <= seqno;
+    }
+
+  private:
+    // NOLINTBEGIN(readability-magic-numbers)
+    static constexpr std::uint64_t mul1 = 0x9e37'79b9'7f4a'7c15uLL;
+    static constexpr std::uint64_t mul2 = 0xbf58'476d'1ce4'e5b9uLL;
+    static constexpr std::uint64_t mul_check = 0x94d0'49bb'1331'11ebuLL;
+    static constexpr unsigned shift1 = 28;
+    static constexpr unsigned shift2 = 29;
+    // NOLINTEND(readability-magic-numbers)
+
+    static constexpr std::uint64_t inv1 = internal::inverse_mod_2_64(mul1);
+    static constexpr std::uint64_t inv2 = internal::inverse_mod_2_64(mul2);
+    static_assert(mul1 * inv1 == 1 && mul2 * inv2 == 1);
+
+    // Bijection on [0, 2^56) mapping only 0 to 0: multiplication by an odd
+    // number and xor with a right shift (by at least half the width, so
+    // that it is its own inverse) are each invertible modulo 2^56.
+    static constexpr auto scramble(std::uint64_t n) noexcept
+        -> std::uint64_t {
+        n = (n * mul1) & seqno_mask;
+        n ^= n >> shift1;
+        n = (n * mul2) & seqno_mask;
+        n ^= n >> shift2;
+        return n;
+    }
+
+    static constexpr auto unscramble(std::uint64_t x) noexcept
+        -> std::uint64_t {
+        x ^= x >> shift2;
+        x = (x * inv2) & seqno_mask;
+        x ^= x >> shift1;
+        x = (x * inv1) & seqno_mask;
+        return x;
+    }
+
+    [[nodiscard]] constexpr auto check_byte(std::uint64_t x) const noexcept
+        -> std::uint64_t {
+        return ((x * mul_check) >> seqno_bits) ^ ep;
     }
 };
 
 TEST_CASE("key_sequence") {
-    // Smoke test only.
+    // NOLINTBEGIN(readability-magic-numbers)
     key_sequence seq;
-    CHECK(~seq.generate().as_u64() != 0);
-    CHECK(seq.generate().is_valid());
+    auto const k0 = seq.generate();
+    CHECK(k0.is_valid());
     CHECK(seq.generate() != seq.generate());
+
+    SUBCASE("resume") {
+        auto const k = seq.generate();
+        key_sequence resumed(seq.state());
+        CHECK(resumed.generate() == seq.generate());
+        CHECK(resumed.state() != k.as_u64());
+        CHECK(resumed.may_have_issued(k));
+    }
+
+    SUBCASE("resume with nothing issued") {
+        auto fresh = key_sequence::with_epoch(0);
+        CHECK(fresh.state() == 0);
+        key_sequence resumed(fresh.state());
+        CHECK(resumed.epoch() == 0);
+        CHECK_FALSE(resumed.may_have_issued(k0));
+        CHECK(resumed.generate() == fresh.generate());
+    }
+
+    SUBCASE("keys are distinct") {
+        std::vector<std::uint64_t> keys;
+        for (int i = 0; i < 100000; ++i)
+            keys.push_back(seq.generate().as_u64());
+        std::sort(keys.begin(), keys.end());
+        CHECK(std::adjacent_find(keys.begin(), keys.end()) == keys.end());
+    }
+
+    SUBCASE("issued keys are accepted") {
+        CHECK(seq.may_have_issued(k0));
+        for (int i = 0; i < 1000; ++i)
+            CHECK(seq.may_have_issued(seq.generate()));
+    }
+
+    SUBCASE("future keys are rejected") {
+        key_sequence ahead(seq.state());
+        auto const future = ahead.generate();
+        CHECK_FALSE(seq.may_have_issued(future));
+        CHECK(seq.generate() == future);
+        CHECK(seq.may_have_issued(future));
+    }
+
+    SUBCASE("null and garbage keys are rejected") {
+        CHECK_FALSE(seq.may_have_issued(common::token()));
+        int accepted = 0;
+        std::uint64_t g = 12345;
+        for (int i = 0; i < 10000; ++i) {
+            g = g * 6364136223846793005uLL + 1442695040888963407uLL;
+            accepted += int(seq.may_have_issued(common::token(g)));
+        }
+        CHECK(accepted == 0);
+    }
+
+    SUBCASE("keys of other epochs are mostly rejected") {
+        auto other = key_sequence::with_epoch(1);
+        CHECK(other.epoch() == 1);
+        int accepted = 0;
+        for (int i = 0; i < 10000; ++i)
+            accepted += int(seq.may_have_issued(other.generate()));
+        CHECK(accepted < 100); // About 1/256 expected
+    }
+    // NOLINTEND(readability-magic-numbers)
 }
 
 } // namespace partake::daemon
@@ -0,0 +1,148 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "magazine_arena.hpp"
+
+#include "slab_arena.hpp"
+
+#include <doctest.h>
+
+#include <utility>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("magazine_arena") {
+    using internal::magazine_arena;
+
+    CHECK(magazine_arena<>(0).size() == 0);
+    CHECK(magazine_arena<>(100).size() == 100);
+    CHECK_FALSE(magazine_arena<>(0).allocate(1));
+
+    SUBCASE("freed chunk of same count is reused") {
+        magazine_arena<> a(100);
+        auto a0 = a.allocate(10);
+        auto a1 = a.allocate(20);
+        REQUIRE(a1);
+        auto const start1 = a1.start();
+        { auto discard = std::move(a1); }
+        CHECK(a.cached_count() == 1);
+        auto a2 = a.allocate(10);
+        CHECK(a2.start() != start1); // Different count
+        auto a3 = a.allocate(20);
+        CHECK(a3.start() == start1);
+        CHECK(a.cached_count() == 0);
+    }
+
+    SUBCASE("most recently freed chunk is reused") {
+        magazine_arena<> a(100);
+        auto a0 = a.allocate(10);
+        auto a1 = a.allocate(10);
+        REQUIRE(a1);
+        auto const start1 = a1.start();
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a1); }
+        CHECK(a.allocate(10).start() == start1);
+    }
+
+    SUBCASE("zero-block chunks") {
+        magazine_arena<> a(10);
+        auto a0 = a.allocate(0);
+        REQUIRE(a0);
+        CHECK(a0.count() == 1);
+        auto const start0 = a0.start();
+        { auto discard = std::move(a0); }
+        CHECK(a.allocate(0).start() == start0);
+    }
+
+    SUBCASE("least recently freed chunk is evicted") {
+        magazine_arena<internal::arena, 2> a(100);
+        auto a0 = a.allocate(1);
+        auto a1 = a.allocate(2);
+        auto a2 = a.allocate(3);
+        REQUIRE(a2);
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a1); }
+        { auto discard = std::move(a2); }
+        CHECK(a.cached_count() == 2);
+        // The 1-block chunk was returned to the backing arena.
+        auto a3 = a.allocate(1);
+        CHECK(a.cached_count() == 2);
+        CHECK(a3.start() == 0);
+    }
+
+    SUBCASE("retained chunks are flushed when backing arena is full") {
+        magazine_arena<> a(100);
+        auto a0 = a.allocate(50);
+        auto a1 = a.allocate(50);
+        REQUIRE(a1);
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a1); }
+        CHECK(a.cached_count() == 2);
+        auto a2 = a.allocate(100);
+        REQUIRE(a2);
+        CHECK(a.cached_count() == 0);
+    }
+
+    SUBCASE("reused chunks are not zero-filled") {
+        magazine_arena<> a(100, true);
+        auto a0 = a.allocate(10);
+        REQUIRE(a0);
+        CHECK(a0.is_zeroed());
+        { auto discard = std::move(a0); }
+        CHECK_FALSE(a.allocate(10).is_zeroed());
+    }
+
+    SUBCASE("release_free_chunks flushes magazine") {
+        magazine_arena<> a(100);
+        { auto discard = a.allocate(10); }
+        CHECK(a.cached_count() == 1);
+        CHECK(a.release_free_chunks(
+                  1, [](std::size_t, std::size_t) { return true; }) == 100);
+        CHECK(a.cached_count() == 0);
+        CHECK(a.allocate(100).is_zeroed());
+    }
+
+    SUBCASE("misaligned chunk is not reused") {
+        magazine_arena<> a(100);
+        auto a0 = a.allocate(1);
+        auto a1 = a.allocate(4);
+        REQUIRE(a1);
+        CHECK(a1.start() == 1);
+        { auto discard = std::move(a1); }
+        auto a2 = a.allocate(4, 4);
+        REQUIRE(a2);
+        CHECK(a2.start() == 8);
+        CHECK(a.cached_count() == 1);
+        CHECK(a.allocate(4, 1).start() == 1);
+    }
+
+    SUBCASE("move assignment") {
+        magazine_arena<> a(2);
+        auto a0 = a.allocate(1);
+        a0 = a.allocate(1);
+        CHECK(a0.start() == 1);
+        CHECK(a.cached_count() == 1);
+    }
+}
+
+TEST_CASE("magazine_arena: with slab_arena and basic_allocator") {
+    using internal::magazine_arena;
+    using internal::slab_arena;
+    basic_allocator<magazine_arena<slab_arena<>>> a(1 << 20, 12);
+    auto a0 = a.allocate(3 * 4096);
+    REQUIRE(a0);
+    auto const offset0 = a0.offset();
+    { auto discard = std::move(a0); }
+    auto a1 = a.allocate(3 * 4096);
+    REQUIRE(a1);
+    CHECK(a1.offset() == offset0);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,196 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "allocator.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace internal {
+
+// A front end to an arena (the backing arena) that retains up to Capacity
+// recently freed chunks (the magazine) instead of returning them to the
+// backing arena. An allocation whose count exactly matches a retained chunk
+// reuses the most recently freed such chunk, without touching the backing
+// arena's free lists. This favors the common streaming pattern in which a
+// producer repeatedly allocates and closes buffers of the same size, and
+// improves cache and TLB locality because the same memory is reused.
+//
+// When the magazine is full, the least recently freed chunk is returned to
+// the backing arena. If the backing arena cannot satisfy an allocation, all
+// retained chunks are returned to it (so that they can coalesce) before
+// retrying, so that retention never causes an allocation to fail.
+//
+// Reused chunks are never reported as zero-filled.
+template <typename Arena = arena, std::size_t Capacity = 16>
+class magazine_arena {
+    static_assert(Capacity > 0);
+
+    Arena backing;
+
+    // Ordered from least to most recently freed.
+    std::vector<typename Arena::allocation> magazine;
+
+  public:
+    explicit magazine_arena(std::size_t size, bool zero_filled = false)
+        : backing(size, zero_filled) {
+        magazine.reserve(Capacity);
+    }
+
+    // No move or copy (address taken by allocation instances)
+    ~magazine_arena() = default;
+    magazine_arena(magazine_arena const &) = delete;
+    auto operator=(magazine_arena const &) = delete;
+    magazine_arena(magazine_arena &&) = delete;
+    auto operator=(magazine_arena &&) = delete;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return backing.size();
+    }
+
+    // Statistics are those of the backing arena, so retained chunks count as
+    // in use.
+    [[nodiscard]] auto free_count() const noexcept -> std::size_t {
+        return backing.free_count();
+    }
+
+    [[nodiscard]] auto free_chunk_count() const noexcept -> std::size_t {
+        return backing.free_chunk_count();
+    }
+
+    [[nodiscard]] auto largest_free_count() const noexcept -> std::size_t {
+        return backing.largest_free_count();
+    }
+
+    [[nodiscard]] auto size_classes() const -> std::vector<std::size_t> {
+        return backing.size_classes();
+    }
+
+    // Number of chunks currently retained.
+    [[nodiscard]] auto cached_count() const noexcept -> std::size_t {
+        return magazine.size();
+    }
+
+    // RAII class for chunk allocation
+    class allocation {
+        // arn is nullptr if default-initialized or allocation failed.
+        magazine_arena *arn = nullptr;
+        typename Arena::allocation chunk;
+        bool zeroed = false;
+
+        friend class magazine_arena;
+
+        explicit allocation(magazine_arena *arena,
+                            typename Arena::allocation &&chunk_allocation,
+                            bool is_zeroed)
+            : arn(arena), chunk(std::move(chunk_allocation)),
+              zeroed(is_zeroed) {}
+
+      public:
+        allocation() noexcept = default;
+
+        ~allocation() { release(); }
+
+        allocation(allocation const &) = delete;
+        auto operator=(allocation const &) = delete;
+
+        allocation(allocation &&other) noexcept
+            : arn(std::exchange(other.arn, nullptr)),
+              chunk(std::move(other.chunk)), zeroed(other.zeroed) {}
+
+        auto operator=(allocation &&rhs) noexcept -> allocation & {
+            release();
+            arn = std::exchange(rhs.arn, nullptr);
+            chunk = std::move(rhs.chunk);
+            zeroed = rhs.zeroed;
+            return *this;
+        }
+
+        // True if allocation succeeded (even if count is zero).
+        operator bool() const noexcept { return arn != nullptr; }
+
+        [[nodiscard]] auto start() const noexcept -> std::size_t {
+            return arn != nullptr ? chunk.start() : 0;
+        }
+
+        [[nodiscard]] auto count() const noexcept -> std::size_t {
+            return arn != nullptr ? chunk.count() : 0;
+        }
+
+        // True if the chunk was known to be zero-filled when allocated.
+        [[nodiscard]] auto is_zeroed() const noexcept -> bool {
+            return arn != nullptr && zeroed;
+        }
+
+      private:
+        void release() noexcept {
+            if (arn != nullptr)
+                arn->recycle(std::move(chunk));
+            arn = nullptr;
+        }
+    };
+
+    // Retained chunks are reused only if they satisfy 'alignment' (a power
+    // of 2, in blocks).
+    [[nodiscard]] auto allocate(std::size_t count, std::size_t alignment = 1)
+        -> allocation {
+        // Zero-block chunks are treated as count 1, as with arena.
+        if (count == 0)
+            count = 1;
+
+        for (auto it = magazine.rbegin(); it != magazine.rend(); ++it) {
+            if (it->count() == count &&
+                (it->start() & (alignment - 1)) == 0) {
+                auto chunk = std::move(*it);
+                magazine.erase(std::next(it).base());
+                return allocation(this, std::move(chunk), false);
+            }
+        }
+
+        auto chunk = backing.allocate(count, alignment);
+        if (not chunk && not magazine.empty()) {
+            flush();
+            chunk = backing.allocate(count, alignment);
+        }
+        if (not chunk)
+            return {};
+        auto const zeroed = chunk.is_zeroed();
+        return allocation(this, std::move(chunk), zeroed);
+    }
+
+    // Return all retained chunks to the backing arena.
+    void flush() noexcept { magazine.clear(); }
+
+    // Release free chunks of the backing arena (see
+    // arena::release_free_chunks()), after returning all retained chunks to
+    // it.
+    template <typename F>
+    auto release_free_chunks(std::size_t min_count, F &&release)
+        -> std::size_t {
+        flush();
+        return backing.release_free_chunks(min_count,
+                                           std::forward<F>(release));
+    }
+
+  private:
+    void recycle(typename Arena::allocation &&chunk) noexcept {
+        assert(chunk);
+        if (magazine.size() == Capacity)
+            magazine.erase(magazine.begin()); // Return to backing arena
+        magazine.push_back(std::move(chunk));
+    }
+};
+
+} // namespace internal
+
+} // namespace partake::daemon
@@ -7,20 +7,70 @@
 #include "asio.hpp"
 #include "cli.hpp"
 #include "daemon.hpp"
+#include "logging.hpp"
+#include "numa.hpp"
+
+#include <spdlog/spdlog.h>
+
+namespace {
+
+using namespace partake::daemon;
+
+// With busy polling, the thread never sleeps waiting for socket events, so
+// that, at the cost of a fully occupied CPU, there is no wakeup latency.
+void run_io_thread(partake::asio::io_context &ioctx,
+                   daemon_config const &cfg) {
+    if (not cfg.busy_poll) {
+        ioctx.run();
+        return;
+    }
+    if (cfg.busy_poll_cpu >= 0)
+        (void)pin_current_thread_to_cpu(cfg.busy_poll_cpu);
+    // The context stops when it runs out of work, as with run().
+    while (not ioctx.stopped())
+        ioctx.poll();
+}
+
+template <typename Arena>
+auto run_daemon(daemon_config const &cfg) -> tl::expected<void, int> {
+    partake::asio::io_context ioctx(1);
+    auto daemon = partake_daemon<partake::asio::io_context, Arena>(ioctx, cfg);
+    daemon.start();
+    run_io_thread(ioctx, cfg);
+    auto status = daemon.exit_code();
+    if (status != 0)
+        return tl::unexpected(status);
+    return {};
+}
+
+template <typename Arena>
+auto run_daemon_with_arena(daemon_config const &cfg)
+    -> tl::expected<void, int> {
+    if (cfg.allocation_cache)
+        return run_daemon<internal::magazine_arena<Arena>>(cfg);
+    return run_daemon<Arena>(cfg);
+}
+
+} // namespace
 
 auto main(int argc, char const *const argv[]) -> int {
-    using namespace partake::daemon;
     auto const result =
         parse_cli_args(argc, argv)
             .and_then([](daemon_config const &cfg) -> tl::expected<void, int> {
-                partake::asio::io_context ioctx(1);
-                auto daemon = partake_daemon(ioctx, cfg);
-                daemon.start();
-                ioctx.run();
-                auto status = daemon.exit_code();
-                if (status != 0)
-                    return tl::unexpected(status);
-                return {};
+                if (cfg.log_queue_size > 0) {
+                    partake::common::use_async_default_logger(
+                        cfg.log_queue_size, cfg.log_overflow);
+                }
+                switch (cfg.allocator) {
+                case allocator_strategy::slab:
+                    return run_daemon_with_arena<internal::slab_arena<>>(cfg);
+                case allocator_strategy::buddy:
+                    return run_daemon_with_arena<internal::buddy_arena>(cfg);
+                case allocator_strategy::free_list:
+                default:
+                    return run_daemon_with_arena<internal::arena>(cfg);
+                }
             });
+    spdlog::shutdown(); // Write any queued messages
     return result.has_value() ? 0 : result.error();
 }
@@ -0,0 +1,331 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "numa.hpp"
+
+#include "posix.hpp"
+
+#include <doctest.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace partake::daemon {
+
+namespace internal {
+
+auto parse_proc_stat_processor(std::string_view stat) -> int {
+    // The command name (field 2) is parenthesized and may contain spaces and
+    // parentheses, so we count fields from the last ')'. The 'processor'
+    // field is field 39, or the 37th after the command name.
+    auto const rparen = stat.rfind(')');
+    if (rparen == std::string_view::npos)
+        return -1;
+    auto rest = stat.substr(rparen + 1);
+    static constexpr int processor_field_index = 36;
+    for (int i = 0;; ++i) {
+        auto const begin = rest.find_first_not_of(' ');
+        if (begin == std::string_view::npos)
+            return -1;
+        rest.remove_prefix(begin);
+        auto const end = std::min(rest.find(' '), rest.size());
+        if (i == processor_field_index) {
+            int cpu = -1;
+            auto const field = rest.substr(0, end);
+            auto const [ptr, ec] = std::from_chars(
+                field.data(), field.data() + field.size(), cpu);
+            if (ec != std::errc() || ptr != field.data() + field.size() ||
+                cpu < 0)
+                return -1;
+            return cpu;
+        }
+        rest.remove_prefix(end);
+    }
+}
+
+auto parse_cpu_list(std::string_view list) -> std::vector<int> {
+    auto const parse_int = [](std::string_view s, int &value) {
+        auto const [ptr, ec] =
+            std::from_chars(s.data(), s.data() + s.size(), value);
+        return ec == std::errc() && ptr == s.data() + s.size() && value >= 0;
+    };
+    auto const last = list.find_last_not_of(" \n");
+    if (last == std::string_view::npos)
+        return {};
+    list = list.substr(0, last + 1);
+    std::vector<int> ret;
+    for (;;) {
+        auto const comma = std::min(list.find(','), list.size());
+        auto const item = list.substr(0, comma);
+        auto const dash = item.find('-');
+        int first = -1;
+        int final = -1;
+        if (dash == std::string_view::npos) {
+            if (not parse_int(item, first))
+                return {};
+            final = first;
+        } else if (not parse_int(item.substr(0, dash), first) ||
+                   not parse_int(item.substr(dash + 1), final) ||
+                   final < first) {
+            return {};
+        }
+        for (int cpu = first; cpu <= final; ++cpu)
+            ret.push_back(cpu);
+        if (comma == list.size())
+            return ret;
+        list.remove_prefix(comma + 1);
+    }
+}
+
+} // namespace internal
+
+auto bind_to_numa_node(void *addr, std::size_t size, int node) -> bool {
+#ifdef __linux__
+    static constexpr std::size_t bits_per_long = CHAR_BIT * sizeof(long);
+    if (node < 0)
+        return false;
+    auto const n = static_cast<std::size_t>(node);
+    std::vector<unsigned long> mask(n / bits_per_long + 1);
+    mask[n / bits_per_long] = 1UL << (n % bits_per_long);
+    // The kernel ignores the last bit of maxnode.
+    auto const maxnode = mask.size() * bits_per_long + 1;
+    errno = 0;
+    if (::syscall(SYS_mbind, addr, size, MPOL_PREFERRED, mask.data(),
+                  maxnode, 0) != 0) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::warn("mbind: {}: node {}: {} ({})", addr, node, msg, err);
+        return false;
+    }
+    spdlog::info("mbind: {}: node {}: success", addr, node);
+    return true;
+#else
+    (void)addr;
+    (void)size;
+    (void)node;
+    spdlog::warn("NUMA node binding not supported on this platform");
+    return false;
+#endif
+}
+
+auto cpu_of_process(std::uint32_t pid) -> int {
+#ifdef __linux__
+    std::ifstream stat_file("/proc/" + std::to_string(pid) + "/stat");
+    std::string const stat{std::istreambuf_iterator<char>(stat_file),
+                           std::istreambuf_iterator<char>()};
+    return internal::parse_proc_stat_processor(stat);
+#else
+    (void)pid;
+    return -1;
+#endif
+}
+
+auto placement_of_cpu(int cpu) -> cpu_placement {
+    cpu_placement ret;
+    ret.cpu = cpu;
+#ifdef __linux__
+    if (cpu < 0)
+        return ret;
+    namespace fs = std::filesystem;
+    auto const read_file = [](fs::path const &path) {
+        std::ifstream f(path);
+        return std::string{std::istreambuf_iterator<char>(f),
+                           std::istreambuf_iterator<char>()};
+    };
+    auto const read_int = [&](fs::path const &path) {
+        auto const s = read_file(path);
+        int value = -1;
+        auto const [ptr, err] =
+            std::from_chars(s.data(), s.data() + s.size(), value);
+        if (err != std::errc() || value < 0 ||
+            (ptr != s.data() + s.size() && *ptr != '\n'))
+            return -1;
+        return value;
+    };
+    std::error_code ec;
+    auto const cpu_dir =
+        fs::path("/sys/devices/system/cpu") / ("cpu" + std::to_string(cpu));
+
+    // The CPU's directory contains a link named node<N> for its node.
+    for (auto it = fs::directory_iterator(cpu_dir, ec);
+         not ec && it != fs::directory_iterator(); it.increment(ec)) {
+        auto const name = it->path().filename().string();
+        std::string_view const prefix = "node";
+        if (name.size() <= prefix.size() ||
+            name.compare(0, prefix.size(), prefix) != 0)
+            continue;
+        int node = -1;
+        auto const *first = name.data() + prefix.size();
+        auto const *last = name.data() + name.size();
+        auto const [ptr, err] = std::from_chars(first, last, node);
+        if (err == std::errc() && ptr == last) {
+            ret.numa_node = node;
+            break;
+        }
+    }
+
+    // Caches are listed as cache/index<K>, each with its level.
+    for (auto it = fs::directory_iterator(cpu_dir / "cache", ec);
+         not ec && it != fs::directory_iterator(); it.increment(ec)) {
+        if (it->path().filename().string().rfind("index", 0) != 0)
+            continue;
+        if (read_int(it->path() / "level") != 3)
+            continue;
+        ret.l3_cache_id = read_int(it->path() / "id");
+        ret.l3_cpus =
+            internal::parse_cpu_list(read_file(it->path() / "shared_cpu_list"));
+        break;
+    }
+#endif
+    return ret;
+}
+
+auto cpu_topology::probe() -> cpu_topology {
+    std::vector<cpu_placement> placements;
+#ifdef __linux__
+    std::ifstream f("/sys/devices/system/cpu/online");
+    std::string const online{std::istreambuf_iterator<char>(f),
+                             std::istreambuf_iterator<char>()};
+    for (int const cpu : internal::parse_cpu_list(online)) {
+        auto const i = static_cast<std::size_t>(cpu);
+        if (i >= placements.size())
+            placements.resize(i + 1);
+        placements[i] = placement_of_cpu(cpu);
+    }
+    // Offline CPUs in between are known only by number.
+    for (std::size_t i = 0; i < placements.size(); ++i)
+        placements[i].cpu = static_cast<int>(i);
+#endif
+    return cpu_topology(std::move(placements));
+}
+
+auto numa_node_of_process(std::uint32_t pid) -> int {
+    auto const cpu = cpu_of_process(pid);
+    if (cpu < 0)
+        return -1;
+    return placement_of_cpu(cpu).numa_node;
+}
+
+auto pin_current_thread_to_cpu(int cpu) -> bool {
+#ifdef __linux__
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        spdlog::warn("cannot pin thread to CPU {}: no such CPU", cpu);
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(static_cast<std::size_t>(cpu), &set);
+    if (::sched_setaffinity(0, sizeof(set), &set) != 0) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::warn("sched_setaffinity: CPU {}: {} ({})", cpu, msg, err);
+        return false;
+    }
+    spdlog::info("pinned thread to CPU {}", cpu);
+    return true;
+#else
+    (void)cpu;
+    spdlog::warn("CPU pinning not supported on this platform");
+    return false;
+#endif
+}
+
+TEST_CASE("parse_cpu_list") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::parse_cpu_list;
+    CHECK(parse_cpu_list("3") == std::vector<int>{3});
+    CHECK(parse_cpu_list("0-3,8,10-11\n") ==
+          std::vector<int>{0, 1, 2, 3, 8, 10, 11});
+    CHECK(parse_cpu_list("").empty());
+    CHECK(parse_cpu_list("\n").empty());
+    CHECK(parse_cpu_list("1,").empty());
+    CHECK(parse_cpu_list("3-1").empty());
+    CHECK(parse_cpu_list("a").empty());
+    CHECK(parse_cpu_list("-1").empty());
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("cpu_topology") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    CHECK(cpu_topology().empty());
+    CHECK(cpu_topology().placement_of(3).cpu == 3);
+    CHECK(cpu_topology().placement_of(3).numa_node == -1);
+
+    cpu_placement p;
+    p.cpu = 1;
+    p.numa_node = 1;
+    p.l3_cache_id = 7;
+    p.l3_cpus = {0, 1};
+    auto const topo = cpu_topology({cpu_placement{0}, p});
+    CHECK_FALSE(topo.empty());
+    CHECK(topo.placement_of(1).numa_node == 1);
+    CHECK(topo.placement_of(1).l3_cpus == std::vector<int>{0, 1});
+    CHECK(topo.placement_of(0).numa_node == -1);
+    CHECK(topo.placement_of(2).cpu == 2);
+    CHECK(topo.placement_of(-1).cpu == -1);
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("parse_proc_stat_processor") {
+    // NOLINTBEGIN(readability-magic-numbers)
+    using internal::parse_proc_stat_processor;
+    std::string fields;
+    for (int i = 3; i < 39; ++i)
+        fields += " " + std::to_string(i);
+    CHECK(parse_proc_stat_processor("123 (cmd)" + fields + " 5 40 41") ==
+          5);
+    CHECK(parse_proc_stat_processor("123 (a (b) c)" + fields + " 7") == 7);
+    CHECK(parse_proc_stat_processor("123 (cmd)" + fields) == -1);
+    CHECK(parse_proc_stat_processor("123 (cmd)" + fields + " x") == -1);
+    CHECK(parse_proc_stat_processor("123 cmd") == -1);
+    CHECK(parse_proc_stat_processor("") == -1);
+    // NOLINTEND(readability-magic-numbers)
+}
+
+#ifdef __linux__
+
+TEST_CASE("numa_node_of_process") {
+    CHECK(numa_node_of_process(0) == -1); // No /proc/0
+    CHECK(numa_node_of_process(static_cast<std::uint32_t>(::getpid())) >= -1);
+}
+
+TEST_CASE("placement_of_cpu") {
+    CHECK(placement_of_cpu(-1).numa_node == -1);
+    auto const cpu = cpu_of_process(static_cast<std::uint32_t>(::getpid()));
+    CHECK(cpu >= 0);
+    auto const placement = placement_of_cpu(cpu);
+    CHECK(placement.cpu == cpu);
+    if (not placement.l3_cpus.empty()) {
+        auto const &c = placement.l3_cpus;
+        CHECK(std::find(c.begin(), c.end(), cpu) != c.end());
+    }
+
+    auto const cached = cpu_topology::probe().placement_of(cpu);
+    CHECK(cached.cpu == cpu);
+    CHECK(cached.numa_node == placement.numa_node);
+    CHECK(cached.l3_cache_id == placement.l3_cache_id);
+    CHECK(cached.l3_cpus == placement.l3_cpus);
+}
+
+#endif
+
+} // namespace partake::daemon
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+// Set the memory policy of the given page-aligned range so that its pages are
+// preferably allocated on the given NUMA node (Linux mbind(2) with
+// MPOL_PREFERRED). Must be called before the pages are first touched. Return
+// false (and log a warning) if not supported or the node does not exist.
+auto bind_to_numa_node(void *addr, std::size_t size, int node) -> bool;
+
+// Where a CPU sits in the cache and memory hierarchy. Members are -1 (or
+// empty) where unknown.
+struct cpu_placement {
+    int cpu = -1;
+    int numa_node = -1;
+    int l3_cache_id = -1;     // Distinguishes L3 caches (Linux cache id)
+    std::vector<int> l3_cpus; // CPUs sharing the L3 cache, including 'cpu'
+};
+
+// Return the CPU on which the given process last ran, or -1 if unknown
+// (process not found, or not Linux).
+auto cpu_of_process(std::uint32_t pid) -> int;
+
+// Return the NUMA node and L3 cache of the given CPU, as reported by Linux
+// sysfs. Only 'cpu' is set if nothing is known (negative or nonexistent
+// CPU, not Linux, or kernel without NUMA support or cache information).
+auto placement_of_cpu(int cpu) -> cpu_placement;
+
+// The placements of all online CPUs, read once (placement_of_cpu() reads
+// sysfs on every call).
+class cpu_topology {
+    std::vector<cpu_placement> placements; // Indexed by CPU
+
+  public:
+    // Nothing known; placement_of() sets only 'cpu'.
+    cpu_topology() = default;
+
+    explicit cpu_topology(std::vector<cpu_placement> &&cpu_placements)
+        : placements(std::move(cpu_placements)) {}
+
+    // Read the placement of each online CPU (none if not Linux).
+    static auto probe() -> cpu_topology;
+
+    [[nodiscard]] auto empty() const noexcept -> bool {
+        return placements.empty();
+    }
+
+    [[nodiscard]] auto placement_of(int cpu) const -> cpu_placement {
+        if (cpu < 0 || std::size_t(cpu) >= placements.size())
+            return {cpu};
+        return placements[std::size_t(cpu)];
+    }
+};
+
+// Return the NUMA node of the CPU on which the given process last ran, or -1
+// if unknown (process not found, not Linux, or kernel without NUMA support).
+auto numa_node_of_process(std::uint32_t pid) -> int;
+
+// Restrict the calling thread to run only on the given CPU (Linux
+// sched_setaffinity(2)). Return false (and log a warning) if not supported
+// or the CPU does not exist.
+auto pin_current_thread_to_cpu(int cpu) -> bool;
+
+namespace internal {
+
+// Return the 'processor' field of the contents of /proc/<pid>/stat, or -1 if
+// malformed.
+auto parse_proc_stat_processor(std::string_view stat) -> int;
+
+// Return the CPUs in a Linux CPU list such as "0-3,8,10-11" (trailing
+// whitespace allowed), in the given order, or an empty vector if malformed.
+auto parse_cpu_list(std::string_view list) -> std::vector<int>;
+
+} // namespace internal
+
+} // namespace partake::daemon
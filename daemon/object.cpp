@@ -5,3 +5,14 @@
  */
 
 #include "object.hpp"
+
+#include <doctest.h>
+
+namespace partake::daemon {
+
+TEST_CASE("object: vouchers are stored more compactly") {
+    CHECK(sizeof(internal::voucher_node<int>) <
+          sizeof(internal::proper_object_node<int>));
+}
+
+} // namespace partake::daemon
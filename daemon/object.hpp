@@ -9,50 +9,60 @@
 #include "handle.hpp"
 #include "partake_protocol_generated.h"
 #include "proper_object.hpp"
+#include "ref_counted.hpp"
 #include "time_point.hpp"
 #include "token.hpp"
-#include "token_hash_table.hpp"
 #include "voucher.hpp"
 
+#include <cassert>
 #include <cstddef>
-#include <functional>
-#include <memory>
-#include <optional>
 #include <utility>
-#include <variant>
 
 namespace partake::daemon {
 
 using object_policy = protocol::Policy;
 
+template <typename Resource> class object;
+
+namespace internal {
+
+template <typename Resource> class proper_object_node;
+template <typename Resource> class voucher_node;
+
+} // namespace internal
+
+// An object is either a proper object or a voucher. Both are looked up by key
+// in the same table, but they are allocated as the distinct derived types
+// internal::proper_object_node and internal::voucher_node (in separate hives
+// in the repository), so that vouchers, of which there may be very many, do
+// not occupy the space of a proper object.
 template <typename Resource>
-class object : public token_hash_table<object<Resource>>::hook,
-               public std::enable_shared_from_this<object<Resource>> {
+class object : public ref_counted<object<Resource>> {
   public:
     using resource_type = Resource;
     using handle_type = handle<object<resource_type>>;
-    using proper_object_type = proper_object<resource_type, handle_type>;
     using voucher_type = voucher<object<resource_type>>;
+    using proper_object_type =
+        proper_object<resource_type, handle_type, voucher_type>;
+    using proper_object_node_type =
+        internal::proper_object_node<resource_type>;
+    using voucher_node_type = internal::voucher_node<resource_type>;
 
   private:
     common::token ky;
     object_policy pol;
-    std::variant<proper_object_type, voucher_type> body;
+    bool vchr;
 
-  public:
+  protected:
     explicit object(common::token key, object_policy policy,
-                    resource_type &&mem)
-        : ky(key), pol(policy), body(std::in_place_type<proper_object_type>,
-                                     std::forward<resource_type>(mem)) {}
-
-    explicit object(common::token key, std::shared_ptr<object> target,
-                    unsigned count, time_point expiration)
-        : ky(key), pol(target->policy()),
-          body(std::in_place_type<voucher_type>, std::move(target), count,
-               expiration) {}
+                    bool is_voucher) noexcept
+        : ky(key), pol(policy), vchr(is_voucher) {}
 
-    // No move or copy (used with intrusive data structures and shared_ptr)
+    // Only destroyed as the derived type (by the repository's disposer).
     ~object() = default;
+
+  public:
+    // No move or copy (used with intrusive data structures and ref_ptr)
     object(object const &) = delete;
     auto operator=(object const &) = delete;
     object(object &&) = delete;
@@ -67,20 +77,64 @@ class object : public token_hash_table<object<Resource>>::hook,
     [[nodiscard]] auto policy() const noexcept -> object_policy { return pol; }
 
     [[nodiscard]] auto is_proper_object() const noexcept -> bool {
-        return std::holds_alternative<proper_object_type>(body);
+        return not vchr;
     }
 
-    [[nodiscard]] auto is_voucher() const noexcept -> bool {
-        return std::holds_alternative<voucher_type>(body);
-    }
+    [[nodiscard]] auto is_voucher() const noexcept -> bool { return vchr; }
 
     [[nodiscard]] auto as_proper_object() -> proper_object_type & {
-        return std::get<proper_object_type>(body);
+        assert(not vchr);
+        return static_cast<proper_object_node_type *>(this)->body;
     }
 
     [[nodiscard]] auto as_voucher() -> voucher_type & {
-        return std::get<voucher_type>(body);
+        assert(vchr);
+        return static_cast<voucher_node_type *>(this)->body;
     }
 };
 
+namespace internal {
+
+template <typename Resource>
+class proper_object_node final : public object<Resource> {
+    using object_type = object<Resource>;
+    typename object_type::proper_object_type body;
+
+    friend object_type;
+
+  public:
+    explicit proper_object_node(common::token key, object_policy policy,
+                                Resource &&resource)
+        : object_type(key, policy, false),
+          body(std::forward<Resource>(resource)) {}
+
+    ~proper_object_node() = default;
+    proper_object_node(proper_object_node const &) = delete;
+    auto operator=(proper_object_node const &) = delete;
+    proper_object_node(proper_object_node &&) = delete;
+    auto operator=(proper_object_node &&) = delete;
+};
+
+template <typename Resource>
+class voucher_node final : public object<Resource> {
+    using object_type = object<Resource>;
+    typename object_type::voucher_type body;
+
+    friend object_type;
+
+  public:
+    explicit voucher_node(common::token key, ref_ptr<object_type> target,
+                          unsigned count, time_point expiration)
+        : object_type(key, target->policy(), true),
+          body(std::move(target), count, expiration) {}
+
+    ~voucher_node() = default;
+    voucher_node(voucher_node const &) = delete;
+    auto operator=(voucher_node const &) = delete;
+    voucher_node(voucher_node &&) = delete;
+    auto operator=(voucher_node &&) = delete;
+};
+
+} // namespace internal
+
 } // namespace partake::daemon
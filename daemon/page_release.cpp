@@ -0,0 +1,79 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "page_release.hpp"
+
+#include "page_size.hpp"
+#include "posix.hpp"
+#include "shmem_mmap.hpp"
+#include "win32.hpp"
+
+#include <doctest.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+
+#ifdef _WIN32
+// clang-format off
+#include <Windows.h>
+#include <Memoryapi.h>
+// clang-format on
+#else
+#include <sys/mman.h>
+#endif
+
+namespace partake::daemon {
+
+auto release_shared_pages(void *addr, std::size_t size) -> bool {
+    if (size == 0)
+        return true;
+#if defined(__linux__)
+    errno = 0;
+    if (::madvise(addr, size, MADV_REMOVE) != 0) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::debug("madvise: {}: MADV_REMOVE: {} ({})", addr, msg, err);
+        return false;
+    }
+    return true;
+#elif defined(_WIN32)
+    auto const err = ::DiscardVirtualMemory(addr, size);
+    if (err != ERROR_SUCCESS) {
+        auto msg = common::win32::strerror(err);
+        spdlog::debug("DiscardVirtualMemory: {}: {} ({})", addr, msg, err);
+    }
+    return false; // Contents are undefined after discarding.
+#else
+    (void)addr;
+    return false;
+#endif
+}
+
+#ifdef __linux__
+
+TEST_CASE("release_shared_pages") {
+    auto const psize = page_size();
+    auto shm = create_posix_mmap_shmem(2 * psize);
+    REQUIRE(shm.is_valid());
+    auto *data = static_cast<std::uint8_t *>(shm.address());
+    std::fill_n(data, 2 * psize, std::uint8_t(1));
+
+    CHECK(release_shared_pages(data + psize, psize));
+    CHECK(data[0] == 1);
+    CHECK(data[psize - 1] == 1);
+    CHECK(std::all_of(data + psize, data + 2 * psize,
+                      [](std::uint8_t b) { return b == 0; }));
+
+    CHECK(release_shared_pages(data, 0));
+    CHECK_FALSE(release_shared_pages(data + 1, psize)); // Unaligned
+    CHECK(data[0] == 1);
+}
+
+#endif
+
+} // namespace partake::daemon
@@ -0,0 +1,25 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace partake::daemon {
+
+// Return the physical pages backing the given page-aligned range of a shared
+// memory mapping to the system, so that they no longer count toward resident
+// memory. Return true if the pages were released and will read as zero when
+// next accessed. Return false if not supported for the mapping (nothing is
+// done) or if the contents are left undefined (Windows).
+//
+// On Linux this uses madvise(MADV_REMOVE), which punches a hole in the
+// backing tmpfs, hugetlbfs, or regular file (including System V shared
+// memory). On Windows, DiscardVirtualMemory() is used. Not supported on other
+// systems.
+auto release_shared_pages(void *addr, std::size_t size) -> bool;
+
+} // namespace partake::daemon
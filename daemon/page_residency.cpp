@@ -0,0 +1,204 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "page_residency.hpp"
+
+#include "page_size.hpp"
+#include "posix.hpp"
+#include "shmem_mmap.hpp"
+#include "win32.hpp"
+
+#include <doctest.h>
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+
+#ifdef _WIN32
+// clang-format off
+#include <Windows.h>
+#include <Memoryapi.h>
+// clang-format on
+#else
+#include <sys/mman.h>
+#endif
+
+namespace partake::daemon {
+
+#ifdef _WIN32
+
+namespace {
+
+// PrefetchVirtualMemory(), the equivalent of madvise(MADV_WILLNEED).
+auto prefetch_virtual_memory(void const *addr, std::size_t size) -> bool {
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = const_cast<void *>(addr); // NOLINT
+    range.NumberOfBytes = size;
+    if (::PrefetchVirtualMemory(::GetCurrentProcess(), 1, &range, 0) == 0) {
+        auto err = ::GetLastError();
+        auto msg = common::win32::strerror(err);
+        spdlog::debug("PrefetchVirtualMemory: {}, size {}: {} ({})", addr,
+                      size, msg, err);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+#endif
+
+auto prefault_pages(void *addr, std::size_t size) -> bool {
+    if (size == 0)
+        return true;
+#if defined(__linux__) && defined(MADV_POPULATE_WRITE)
+    errno = 0;
+    if (::madvise(addr, size, MADV_POPULATE_WRITE) == 0) {
+        spdlog::debug("madvise: {}: MADV_POPULATE_WRITE: success", addr);
+        return true;
+    }
+    int err = errno;
+    if (err != EINVAL) { // EINVAL if not supported by kernel
+        auto msg = common::posix::strerror(err);
+        spdlog::error("madvise: {}: MADV_POPULATE_WRITE: {} ({})", addr, msg,
+                      err);
+        return false;
+    }
+#endif
+#ifdef _WIN32
+    // Read in the pages with large I/Os where they have backing store; the
+    // writes below still fault each page into the working set.
+    (void)prefetch_virtual_memory(addr, size);
+#endif
+    auto const psize = page_size();
+    // A read-modify-write that cannot lose concurrent writes to the byte.
+    static_assert(sizeof(std::atomic<std::uint8_t>) == 1);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto *bytes = reinterpret_cast<std::atomic<std::uint8_t> *>(addr);
+    for (std::size_t off = 0; off < size; off += psize)
+        bytes[off].fetch_or(0, std::memory_order_relaxed);
+    spdlog::debug("prefaulted {} bytes at {}", size, addr);
+    return true;
+}
+
+auto prefetch_pages(void const *addr, std::size_t size, bool touch) -> bool {
+    if (size == 0)
+        return true;
+    auto const psize = page_size();
+    auto const start = reinterpret_cast<std::uintptr_t>(addr) & ~(psize - 1);
+    auto const end = reinterpret_cast<std::uintptr_t>(addr) + size;
+    auto const len = static_cast<std::size_t>(end - start);
+    // NOLINTNEXTLINE(performance-no-int-to-ptr)
+    auto *base = reinterpret_cast<void *>(start);
+    bool ok = true;
+#ifndef _WIN32
+    errno = 0;
+    if (::madvise(base, len, MADV_WILLNEED) != 0) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::debug("madvise: {}: MADV_WILLNEED: {} ({})", base, msg, err);
+        ok = false;
+    }
+#else
+    ok = prefetch_virtual_memory(base, len);
+#endif
+    if (not touch)
+        return ok;
+#if defined(__linux__) && defined(MADV_POPULATE_READ)
+    errno = 0;
+    if (::madvise(base, len, MADV_POPULATE_READ) == 0)
+        return ok;
+    if (errno != EINVAL) { // EINVAL if not supported by kernel
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::debug("madvise: {}: MADV_POPULATE_READ: {} ({})", base, msg,
+                      err);
+        return false;
+    }
+#endif
+    // Reading through an atomic, as the pages may be written concurrently.
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto const *bytes = reinterpret_cast<std::atomic<std::uint8_t> *>(base);
+    for (std::size_t off = 0; off < len; off += psize)
+        (void)bytes[off].load(std::memory_order_relaxed);
+    return ok;
+}
+
+auto advise_huge_pages(void *addr, std::size_t size) -> bool {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    errno = 0;
+    if (::madvise(addr, size, MADV_HUGEPAGE) != 0) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::warn("madvise: {}: MADV_HUGEPAGE: {} ({})", addr, msg, err);
+        return false;
+    }
+    spdlog::info("madvise: {}: MADV_HUGEPAGE: success", addr);
+    return true;
+#else
+    (void)addr;
+    (void)size;
+    spdlog::warn("transparent huge pages not supported on this platform");
+    return false;
+#endif
+}
+
+auto lock_pages(void *addr, std::size_t size) -> bool {
+    if (size == 0)
+        return true;
+#ifdef _WIN32
+    if (::VirtualLock(addr, size) == 0) {
+        auto err = ::GetLastError();
+        auto msg = common::win32::strerror(err);
+        spdlog::error("VirtualLock: {}, size {}: {} ({})", addr, size, msg,
+                      err);
+        return false;
+    }
+    spdlog::info("VirtualLock: {}, size {}: success", addr, size);
+#else
+    errno = 0;
+    if (::mlock(addr, size) != 0) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::error("mlock: {}, size {}: {} ({})", addr, size, msg, err);
+        return false;
+    }
+    spdlog::info("mlock: {}, size {}: success", addr, size);
+#endif
+    return true;
+}
+
+#ifndef _WIN32
+
+TEST_CASE("prefault_pages") {
+    auto const psize = page_size();
+    auto shm = create_posix_mmap_shmem(4 * psize);
+    REQUIRE(shm.is_valid());
+    auto *data = static_cast<std::uint8_t *>(shm.address());
+    data[psize] = 42;
+    CHECK(prefault_pages(data, 4 * psize));
+    CHECK(data[0] == 0);
+    CHECK(data[psize] == 42);
+    CHECK(prefault_pages(data, 0));
+}
+
+TEST_CASE("prefetch_pages") {
+    auto const psize = page_size();
+    auto shm = create_posix_mmap_shmem(4 * psize);
+    REQUIRE(shm.is_valid());
+    auto *data = static_cast<std::uint8_t *>(shm.address());
+    data[psize] = 42;
+    CHECK(prefetch_pages(data + 1, 2 * psize, false));
+    CHECK(prefetch_pages(data + 1, 2 * psize, true));
+    CHECK(data[0] == 0);
+    CHECK(data[psize] == 42);
+    CHECK(prefetch_pages(data, 0, true));
+}
+
+#endif
+
+} // namespace partake::daemon
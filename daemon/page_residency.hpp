@@ -0,0 +1,42 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace partake::daemon {
+
+// Fault in every page of the given page-aligned range of a writable mapping,
+// so that later accesses do not incur page faults. Contents are preserved.
+// On Linux (5.14 and later) this uses madvise(MADV_POPULATE_WRITE); otherwise
+// a byte of each page is atomically or-ed with zero (on Windows, after
+// PrefetchVirtualMemory()). Either way, the range may be in use (including
+// by other processes) at the same time.
+auto prefault_pages(void *addr, std::size_t size) -> bool;
+
+// Bring the pages overlapping the given range (which need not be
+// page-aligned) into memory ahead of use, without modifying them: advise the
+// system that they will be needed (madvise(MADV_WILLNEED), or
+// PrefetchVirtualMemory() on Windows) and, if 'touch', read a byte of each
+// page (with madvise(MADV_POPULATE_READ) where supported). Return false (and
+// log at debug level) if the advice failed; prefetching is only an
+// optimization.
+auto prefetch_pages(void const *addr, std::size_t size, bool touch) -> bool;
+
+// Advise the system to back the given page-aligned range with transparent
+// huge pages (Linux madvise(MADV_HUGEPAGE)). For shared memory this only has
+// an effect if enabled for shmem/tmpfs (see
+// /sys/kernel/mm/transparent_hugepage/shmem_enabled). Return false (and log a
+// warning) if not supported.
+auto advise_huge_pages(void *addr, std::size_t size) -> bool;
+
+// Lock the given page-aligned range into physical memory, with mlock() or
+// VirtualLock(). Return false (and log an error) on failure, which is
+// typically due to exceeding RLIMIT_MEMLOCK or the working set size.
+auto lock_pages(void *addr, std::size_t size) -> bool;
+
+} // namespace partake::daemon
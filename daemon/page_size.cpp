@@ -237,6 +237,28 @@ auto file_page_size(int fd) -> std::size_t {
     return static_cast<std::size_t>(st.f_bsize);
 }
 
+auto selected_page_size(bool use_huge_pages, std::size_t huge_page_size)
+    -> std::size_t {
+    if (use_huge_pages) {
+        if (huge_page_size == 0)
+            return default_huge_page_size();
+        auto const sizes = huge_page_sizes();
+        if (std::find(sizes.begin(), sizes.end(), huge_page_size) ==
+            sizes.end())
+            return 0;
+        return huge_page_size;
+    }
+    return page_size();
+}
+
+TEST_CASE("selected_page_size") {
+    CHECK(selected_page_size(false, 0) == page_size());
+    CHECK(selected_page_size(true, 0) == default_huge_page_size());
+    CHECK(selected_page_size(true, 12345) == 0);
+    for (auto s : huge_page_sizes())
+        CHECK(selected_page_size(true, s) == s);
+}
+
 #endif
 
 } // namespace partake::daemon
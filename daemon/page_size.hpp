@@ -42,6 +42,13 @@ auto huge_page_sizes() -> std::vector<std::size_t>;
 // Return the page size for the given fd, taking hugetlbfs into account.
 auto file_page_size(int fd) -> std::size_t;
 
+// Return the page size for a mapping with the given options: the given or
+// default huge page size if use_huge_pages is true, otherwise the regular page
+// size. Return 0 if the given huge page size is not supported (or huge pages
+// are not supported at all).
+auto selected_page_size(bool use_huge_pages, std::size_t huge_page_size)
+    -> std::size_t;
+
 #endif
 
 } // namespace partake::daemon
@@ -0,0 +1,225 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "parallel_copy.hpp"
+
+#include <doctest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+#include <thread>
+#include <vector>
+
+// The widest streaming store enabled for the build (e.g., with
+// -march=native); SSE2 is always available on x86-64.
+#if defined(__AVX512F__)
+#define PARTAKE_STREAM_STORE_BYTES 64
+#include <immintrin.h>
+#elif defined(__AVX__)
+#define PARTAKE_STREAM_STORE_BYTES 32
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) ||                                 \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTAKE_STREAM_STORE_BYTES 16
+#include <emmintrin.h>
+#endif
+
+namespace partake::daemon {
+
+namespace {
+
+// Each thread copies at least this much, so that thread startup does not
+// dominate.
+constexpr std::size_t min_chunk_size = 4 << 20;
+
+// Beyond a handful of threads, memory bandwidth is saturated.
+constexpr unsigned default_max_threads = 8;
+
+// Call 'func(offset, count)' for consecutive chunks covering [0, size),
+// dividing large sizes among up to 'max_threads' threads. Chunk boundaries
+// (other than 'size') are multiples of 'align'.
+template <typename F>
+void for_each_chunk(std::size_t size, std::size_t align, unsigned max_threads,
+                    F func) {
+    if (size == 0)
+        return;
+    if (max_threads == 0) {
+        max_threads = std::clamp(std::thread::hardware_concurrency(), 1u,
+                                 default_max_threads);
+    }
+    auto const nthreads = size < parallel_copy_threshold
+                              ? std::size_t(1)
+                              : std::clamp(size / min_chunk_size,
+                                           std::size_t(1),
+                                           std::size_t(max_threads));
+    if (nthreads == 1) {
+        func(std::size_t(0), size);
+        return;
+    }
+
+    auto const chunk = ((size / nthreads) + align - 1) / align * align;
+    std::vector<std::thread> threads;
+    threads.reserve(nthreads - 1);
+    std::size_t offset = chunk; // This thread takes the first chunk
+    while (offset < size) {
+        auto const n = std::min(chunk, size - offset);
+        threads.emplace_back([=] { func(offset, n); });
+        offset += n;
+    }
+    func(std::size_t(0), std::min(chunk, size));
+    for (auto &t : threads)
+        t.join();
+}
+
+// Chunks are rounded to cache lines.
+constexpr std::size_t line_size = 64;
+
+// Zero with streaming stores, bypassing the caches, except for a head and
+// tail that are not whole cache lines.
+void stream_zero(std::uint8_t *dest, std::size_t size) {
+#ifdef PARTAKE_STREAM_STORE_BYTES
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    auto const addr = reinterpret_cast<std::uintptr_t>(dest);
+    auto const head =
+        std::min(size, (line_size - addr % line_size) % line_size);
+    std::memset(dest, 0, head);
+    dest += head;
+    size -= head;
+    auto const body = size / line_size * line_size;
+    constexpr std::size_t width = PARTAKE_STREAM_STORE_BYTES;
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-reinterpret-cast)
+    for (std::size_t i = 0; i < body; i += width) {
+#if PARTAKE_STREAM_STORE_BYTES == 64
+        _mm512_stream_si512(reinterpret_cast<__m512i *>(dest + i),
+                            _mm512_setzero_si512());
+#elif PARTAKE_STREAM_STORE_BYTES == 32
+        _mm256_stream_si256(reinterpret_cast<__m256i *>(dest + i),
+                            _mm256_setzero_si256());
+#else
+        _mm_stream_si128(reinterpret_cast<__m128i *>(dest + i),
+                         _mm_setzero_si128());
+#endif
+    }
+    // NOLINTEND(cppcoreguidelines-pro-type-reinterpret-cast)
+    _mm_sfence(); // Order the streaming stores before later stores
+    std::memset(dest + body, 0, size - body);
+#else
+    std::memset(dest, 0, size);
+#endif
+}
+
+} // namespace
+
+void parallel_copy(void *dest, void const *src, std::size_t size,
+                   unsigned max_threads) {
+    auto *d = static_cast<std::uint8_t *>(dest);
+    auto const *s = static_cast<std::uint8_t const *>(src);
+    for_each_chunk(size, line_size, max_threads,
+                   [=](std::size_t offset, std::size_t n) {
+                       std::memcpy(d + offset, s + offset, n);
+                   });
+}
+
+void parallel_fill(void *dest, std::size_t size,
+                   gsl::span<std::uint8_t const> pattern,
+                   unsigned max_threads) {
+    auto *d = static_cast<std::uint8_t *>(dest);
+    if (pattern.size() <= 1) {
+        int const value = pattern.empty() ? 0 : pattern[0];
+        for_each_chunk(size, line_size, max_threads,
+                       [=](std::size_t offset, std::size_t n) {
+                           std::memset(d + offset, value, n);
+                       });
+        return;
+    }
+
+    // Each chunk starts with a whole repetition, then doubles the filled
+    // part by copying it.
+    auto const *p = pattern.data();
+    auto const plen = pattern.size();
+    for_each_chunk(size, line_size * plen, max_threads,
+                   [=](std::size_t offset, std::size_t n) {
+                       auto *c = d + offset;
+                       auto filled = std::min(plen, n);
+                       std::memcpy(c, p, filled);
+                       while (filled < n) {
+                           auto const m = std::min(filled, n - filled);
+                           std::memcpy(c + filled, c, m);
+                           filled += m;
+                       }
+                   });
+}
+
+void parallel_scrub(void *dest, std::size_t size, unsigned max_threads) {
+    auto *d = static_cast<std::uint8_t *>(dest);
+    for_each_chunk(size, line_size, max_threads,
+                   [=](std::size_t offset, std::size_t n) {
+                       stream_zero(d + offset, n);
+                   });
+}
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("parallel_copy") {
+    auto const check_copy = [](std::size_t size, unsigned max_threads) {
+        std::vector<std::uint8_t> src(size);
+        std::iota(src.begin(), src.end(), std::uint8_t(1));
+        std::vector<std::uint8_t> dest(size);
+        parallel_copy(dest.data(), src.data(), size, max_threads);
+        return dest == src;
+    };
+    CHECK(check_copy(0, 0));
+    CHECK(check_copy(100, 0));
+    CHECK(check_copy(parallel_copy_threshold, 3));
+    CHECK(check_copy(parallel_copy_threshold * 2 + 7, 0));
+    CHECK(check_copy(parallel_copy_threshold + 1, 1));
+}
+
+TEST_CASE("parallel_fill") {
+    auto const check_fill = [](std::size_t size,
+                               std::vector<std::uint8_t> const &pattern,
+                               unsigned max_threads) {
+        std::vector<std::uint8_t> dest(size, 0xff);
+        parallel_fill(dest.data(), size, pattern, max_threads);
+        for (std::size_t i = 0; i < size; ++i) {
+            auto const expected =
+                pattern.empty() ? 0 : pattern[i % pattern.size()];
+            if (dest[i] != expected)
+                return false;
+        }
+        return true;
+    };
+    CHECK(check_fill(0, {}, 0));
+    CHECK(check_fill(100, {}, 0));
+    CHECK(check_fill(100, {42}, 0));
+    CHECK(check_fill(100, {1, 2, 3}, 0));
+    CHECK(check_fill(2, {1, 2, 3}, 0));
+    CHECK(check_fill(parallel_copy_threshold * 2 + 7, {}, 0));
+    CHECK(check_fill(parallel_copy_threshold * 2 + 7, {1, 2, 3}, 3));
+}
+
+TEST_CASE("parallel_scrub") {
+    // Unaligned start and end, to exercise the non-streaming head and tail.
+    auto const check_scrub = [](std::size_t offset, std::size_t size,
+                                unsigned max_threads) {
+        std::vector<std::uint8_t> buf(offset + size + 1, 0xff);
+        parallel_scrub(buf.data() + offset, size, max_threads);
+        return std::all_of(buf.begin() + offset, buf.end() - 1,
+                           [](std::uint8_t b) { return b == 0; }) &&
+               buf[offset - 1] == 0xff && buf.back() == 0xff;
+    };
+    CHECK(check_scrub(1, 0, 0));
+    CHECK(check_scrub(1, 10, 0));
+    CHECK(check_scrub(3, 1000, 0));
+    CHECK(check_scrub(64, 4096, 0));
+    CHECK(check_scrub(5, parallel_copy_threshold * 2 + 7, 3));
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,37 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <gsl/span>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace partake::daemon {
+
+// Copies and fills of at least this size are split across threads.
+inline constexpr std::size_t parallel_copy_threshold = 8 << 20;
+
+// Copy 'size' bytes from 'src' to 'dest' (which must not overlap). Large
+// copies are divided among up to 'max_threads' threads (0 for a default based
+// on the hardware), because a single thread cannot saturate memory bandwidth.
+// All threads have finished when this function returns.
+void parallel_copy(void *dest, void const *src, std::size_t size,
+                   unsigned max_threads = 0);
+
+// Fill 'size' bytes at 'dest' with repetitions of 'pattern' (zeros if empty),
+// using threads as with parallel_copy(). The last repetition may be partial.
+void parallel_fill(void *dest, std::size_t size,
+                   gsl::span<std::uint8_t const> pattern = {},
+                   unsigned max_threads = 0);
+
+// Zero 'size' bytes at 'dest' as with parallel_fill(), but with
+// non-temporal (streaming) stores where the target supports them, so that
+// scrubbing memory that nobody is about to read does not evict the caches.
+void parallel_scrub(void *dest, std::size_t size, unsigned max_threads = 0);
+
+} // namespace partake::daemon
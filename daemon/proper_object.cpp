@@ -20,11 +20,13 @@ struct mock_handle : handle_list<mock_handle>::hook {
     MAKE_MOCK0(resume_request_pending_on_unique_ownership, void());
 };
 
+struct mock_voucher : voucher_list<mock_voucher>::hook {};
+
 } // namespace
 
 TEST_CASE("proper_object") {
     // NOLINTBEGIN(readability-magic-numbers)
-    proper_object<int, mock_handle> po(42);
+    proper_object<int, mock_handle, mock_voucher> po(42);
     CHECK(po.resource() == 42);
     // NOLINTEND(readability-magic-numbers)
     CHECK_FALSE(po.is_opened_by_unique_handle());
@@ -113,6 +115,24 @@ TEST_CASE("proper_object") {
             CHECK(po.exclusive_writer() == &g);
             po.close(&g);
         }
+
+        SUBCASE("drop_vouchers") {
+            mock_voucher v1;
+            mock_voucher v2;
+            po.add_voucher(&v1);
+            po.add_voucher(&v2);
+            CHECK(po.vouchers().size() == 2);
+            ALLOW_CALL(g, is_open_uniquely()).RETURN(true);
+            po.close(&h);
+            po.drop_voucher(&v2);
+            CHECK(&*po.vouchers().begin() == &v1);
+            REQUIRE_CALL(g, resume_request_pending_on_unique_ownership())
+                .TIMES(1);
+            po.drop_voucher(&v1);
+            CHECK(po.vouchers().empty());
+            po.unshare(&g);
+            po.close(&g);
+        }
     }
 }
 
@@ -7,6 +7,8 @@
 #pragma once
 
 #include "handle_list.hpp"
+#include "small_function.hpp"
+#include "voucher_list.hpp"
 
 #include <cassert>
 #include <cstddef>
@@ -14,16 +16,26 @@
 
 namespace partake::daemon {
 
-template <typename Resource, typename Handle> class proper_object {
+class quota;
+
+template <typename Resource, typename Handle, typename Voucher>
+class proper_object {
   public:
     using resource_type = Resource;
     using handle_type = Handle;
+    using voucher_type = Voucher;
 
   private:
     bool shared = false;         // Always false for PRIMITIVE policy
+    bool pooled = false;         // Resource is a buffer pool's
     unsigned n_open_handles = 0; // Not including handles waiting to open
-    unsigned n_vouchers = 0;
+    voucher_list<voucher_type> vchrs; // Targeting this object
     resource_type rsrc;
+    small_function<void(resource_type &&)> recycler; // Empty if none
+
+    // The quota, if any, charged for this object, and the bytes charged.
+    quota *charged_quota = nullptr;
+    std::size_t charged = 0;
 
     // The following are null/empty for PRIMITIVE policy. For DEFAULT policy,
     // non-null pointers are guaranteed to be valid because sessions and
@@ -38,10 +50,12 @@ template <typename Resource, typename Handle> class proper_object {
 
     ~proper_object() {
         assert(n_open_handles == 0);
-        assert(n_vouchers == 0);
+        assert(vchrs.empty());
         assert(exc_writer == nullptr);
         assert(handles_awaiting_share.empty());
         assert(handle_awaiting_unique_ownership == nullptr);
+        if (recycler)
+            recycler(std::move(rsrc));
     }
 
     proper_object(proper_object const &) = delete;
@@ -53,12 +67,63 @@ template <typename Resource, typename Handle> class proper_object {
         return rsrc;
     }
 
+    // Instead of being destroyed with the object, the resource will be
+    // passed to 'recycle' (by rvalue) so that it can be reused. The recycler
+    // is called before the members of the object are destroyed, so it may
+    // refer to them (e.g., to charged_bytes()).
+    void set_recycler(small_function<void(resource_type &&)> recycle) {
+        recycler = std::move(recycle);
+    }
+
+    // Record the quota charged for this object and the amount, which may
+    // later be adjusted (e.g., when the object is resized). Crediting the
+    // quota is left to the recycler.
+    void set_charge(quota *account, std::size_t bytes) noexcept {
+        charged_quota = account;
+        charged = bytes;
+    }
+
+    [[nodiscard]] auto charged_account() const noexcept -> quota * {
+        return charged_quota;
+    }
+
+    [[nodiscard]] auto charged_bytes() const noexcept -> std::size_t {
+        return charged;
+    }
+
+    // For modifying the resource in place (e.g., resizing it). Clients that
+    // have it open must be informed.
+    [[nodiscard]] auto mutable_resource() noexcept -> resource_type & {
+        assert(not pooled);
+        return rsrc;
+    }
+
+    // Mark the resource as a pool buffer, which must be given back to its
+    // pool and hence cannot be replaced.
+    void set_pooled() noexcept { pooled = true; }
+
+    [[nodiscard]] auto is_pooled() const noexcept -> bool { return pooled; }
+
+    // Replace the resource (e.g., with an empty one while the data are in
+    // cold storage) and return the old one. The object must not be open,
+    // because clients may have the old resource mapped.
+    auto replace_resource(resource_type &&resource) -> resource_type {
+        assert(n_open_handles == 0);
+        assert(not pooled);
+        return std::exchange(rsrc, std::forward<resource_type>(resource));
+    }
+
     [[nodiscard]] auto is_open() const noexcept -> bool {
         return n_open_handles > 0;
     }
 
+    // Number of sessions that have the object open.
+    [[nodiscard]] auto open_handle_count() const noexcept -> unsigned {
+        return n_open_handles;
+    }
+
     [[nodiscard]] auto is_opened_by_unique_handle() const noexcept -> bool {
-        return n_open_handles == 1 && n_vouchers == 0;
+        return n_open_handles == 1 && vchrs.empty();
     }
 
     [[nodiscard]] auto is_shared() const noexcept -> bool { return shared; }
@@ -84,7 +149,7 @@ template <typename Resource, typename Handle> class proper_object {
         // (so that it can fail) if closed by the handle that was awaiting
         // unique ownership.
         auto &h_awaiting = handle_awaiting_unique_ownership;
-        if ((h_awaiting != nullptr && n_open_handles == 1 && n_vouchers == 0 &&
+        if ((h_awaiting != nullptr && n_open_handles == 1 && vchrs.empty() &&
              h_awaiting->is_open_uniquely()) ||
             h_awaiting == hnd) {
             h_awaiting->resume_request_pending_on_unique_ownership();
@@ -118,6 +183,15 @@ template <typename Resource, typename Handle> class proper_object {
         handles_awaiting_share.clear();
     }
 
+    // Mark a newly created object, which has no writer, as shared (for
+    // objects restored from a snapshot).
+    void share_unopened() {
+        assert(not shared);
+        assert(n_open_handles == 0);
+        assert(exc_writer == nullptr);
+        shared = true;
+    }
+
     void unshare(handle_type *new_exclusive_writer) {
         assert(new_exclusive_writer != nullptr);
         assert(shared);
@@ -132,6 +206,10 @@ template <typename Resource, typename Handle> class proper_object {
         handles_awaiting_share.push_back(*hnd);
     }
 
+    [[nodiscard]] auto has_handles_awaiting_share() const noexcept -> bool {
+        return not handles_awaiting_share.empty();
+    }
+
     void remove_handle_awaiting_share(handle_type *hnd) {
         handles_awaiting_share.erase(handles_awaiting_share.iterator_to(*hnd));
     }
@@ -146,20 +224,29 @@ template <typename Resource, typename Handle> class proper_object {
         return handle_awaiting_unique_ownership != nullptr;
     }
 
+    // Dropping a voucher (by the repository) removes it from the list, so
+    // iterate in a manner that allows erasure.
+    [[nodiscard]] auto vouchers() noexcept -> voucher_list<voucher_type> & {
+        return vchrs;
+    }
+
     void clear_handle_awaiting_unique_ownership(handle_type *hnd) {
         assert(handle_awaiting_unique_ownership == hnd);
         handle_awaiting_unique_ownership = nullptr;
     }
 
-    void add_voucher() { ++n_vouchers; }
+    void add_voucher(voucher_type *vchr) {
+        assert(vchr != nullptr);
+        vchrs.push_back(*vchr);
+    }
 
-    void drop_voucher() {
-        assert(n_vouchers > 0);
-        --n_vouchers;
+    void drop_voucher(voucher_type *vchr) {
+        assert(vchr != nullptr);
+        vchrs.erase(*vchr);
 
         // Resume pending Unshare requests if now uniquely opened.
         auto &h_awaiting = handle_awaiting_unique_ownership;
-        if ((h_awaiting != nullptr && n_open_handles == 1 && n_vouchers == 0 &&
+        if ((h_awaiting != nullptr && n_open_handles == 1 && vchrs.empty() &&
              h_awaiting->is_open_uniquely())) {
             h_awaiting->resume_request_pending_on_unique_ownership();
             h_awaiting = nullptr;
@@ -0,0 +1,71 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "quota.hpp"
+
+#include <doctest.h>
+
+#include <memory>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("quota") {
+    quota q(100);
+    CHECK(q.limit() == 100);
+    CHECK(q.used() == 0);
+    CHECK(q.try_charge(60));
+    CHECK_FALSE(q.try_charge(41));
+    CHECK(q.used() == 60);
+    CHECK(q.try_charge(40));
+    CHECK(q.used() == 100);
+    CHECK_FALSE(q.try_charge(1));
+    q.credit(60);
+    CHECK(q.used() == 40);
+    CHECK(q.try_charge(0));
+}
+
+TEST_CASE("quota: unlimited") {
+    quota q(0);
+    CHECK(q.try_charge(std::size_t(-1)));
+    q.credit(std::size_t(-1));
+    CHECK(q.used() == 0);
+}
+
+TEST_CASE("quota: parent") {
+    auto shared = std::make_shared<quota>(100);
+    quota q1(80, shared);
+    quota q2(0, shared);
+    CHECK(q1.try_charge(70));
+    CHECK(shared->used() == 70);
+    CHECK_FALSE(q1.try_charge(20)); // Own limit
+    CHECK_FALSE(q2.try_charge(40)); // Parent's limit
+    CHECK(q2.used() == 0);
+    CHECK(q2.try_charge(30));
+    CHECK(shared->used() == 100);
+    q1.credit(70);
+    CHECK(q1.used() == 0);
+    CHECK(shared->used() == 30);
+}
+
+TEST_CASE("quota: set_parent") {
+    auto shared = std::make_shared<quota>(100);
+    quota q(0, shared);
+    CHECK(q.try_charge(50));
+    q.set_parent(nullptr);
+    CHECK(shared->used() == 0);
+    CHECK(q.try_charge(200));
+    q.set_parent(shared); // Limit not enforced
+    CHECK(shared->used() == 250);
+    CHECK(q.parent() == shared);
+    q.credit(250);
+    CHECK(shared->used() == 0);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,86 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+namespace partake::daemon {
+
+// Accounting of the shared memory bytes allocated on behalf of a client (or
+// a group of clients). A quota may have a parent quota, to which everything
+// charged to it is also charged; this is used to limit the total for all
+// clients except those (of QoS class REALTIME) for which headroom is
+// reserved.
+//
+// Quotas are shared (via std::shared_ptr) between the session and the
+// objects allocated by it, which credit the quota when they are destroyed
+// and may outlive the session. Like objects, quotas are only accessed from
+// the daemon's thread.
+class quota {
+    std::size_t lim; // 0 for no limit
+    std::size_t used_bytes = 0;
+    std::shared_ptr<quota> parent_quota;
+
+  public:
+    explicit quota(std::size_t limit, std::shared_ptr<quota> parent = {})
+        : lim(limit), parent_quota(std::move(parent)) {}
+
+    // No move or copy (shared by reference)
+    ~quota() = default;
+    quota(quota const &) = delete;
+    auto operator=(quota const &) = delete;
+    quota(quota &&) = delete;
+    auto operator=(quota &&) = delete;
+
+    [[nodiscard]] auto limit() const noexcept -> std::size_t { return lim; }
+
+    [[nodiscard]] auto used() const noexcept -> std::size_t {
+        return used_bytes;
+    }
+
+    [[nodiscard]] auto parent() const noexcept
+        -> std::shared_ptr<quota> const & {
+        return parent_quota;
+    }
+
+    // Charge 'bytes' to this quota and its ancestors, unless that would
+    // exceed the limit of any of them, in which case nothing is charged and
+    // false is returned.
+    [[nodiscard]] auto try_charge(std::size_t bytes) noexcept -> bool {
+        for (quota const *q = this; q != nullptr; q = q->parent_quota.get()) {
+            if (q->lim > 0 && bytes > q->lim - q->used_bytes)
+                return false;
+        }
+        for (quota *q = this; q != nullptr; q = q->parent_quota.get())
+            q->used_bytes += bytes;
+        return true;
+    }
+
+    // Undo try_charge(bytes).
+    void credit(std::size_t bytes) noexcept {
+        for (quota *q = this; q != nullptr; q = q->parent_quota.get()) {
+            assert(q->used_bytes >= bytes);
+            q->used_bytes -= bytes;
+        }
+    }
+
+    // Move the bytes currently charged to this quota from the current parent
+    // (if any) to 'new_parent' (if any), regardless of the latter's limit.
+    void set_parent(std::shared_ptr<quota> new_parent) noexcept {
+        if (parent_quota)
+            parent_quota->credit(used_bytes);
+        parent_quota = std::move(new_parent);
+        for (quota *q = parent_quota.get(); q != nullptr;
+             q = q->parent_quota.get())
+            q->used_bytes += used_bytes;
+    }
+};
+
+} // namespace partake::daemon
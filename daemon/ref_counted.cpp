@@ -0,0 +1,67 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "ref_counted.hpp"
+
+#include <doctest.h>
+
+#include <vector>
+
+namespace partake::daemon {
+
+namespace {
+
+struct counted : ref_counted<counted> {
+    int value;
+    bool *destroyed;
+
+    explicit counted(int v, bool *destroyed_flag)
+        : value(v), destroyed(destroyed_flag) {}
+
+    ~counted() { *destroyed = true; }
+
+    counted(counted const &) = delete;
+    auto operator=(counted const &) = delete;
+    counted(counted &&) = delete;
+    auto operator=(counted &&) = delete;
+};
+
+} // namespace
+
+TEST_CASE("ref_counted: deleted by default") {
+    bool destroyed = false;
+    auto p = make_ref<counted>(42, &destroyed);
+    CHECK(p->value == 42);
+    CHECK(p->use_count() == 1);
+    auto q = p;
+    CHECK(p->use_count() == 2);
+    p.reset();
+    CHECK_FALSE(destroyed);
+    CHECK(q->use_count() == 1);
+    q.reset();
+    CHECK(destroyed);
+}
+
+TEST_CASE("ref_counted: disposer") {
+    std::vector<counted *> disposed;
+    bool destroyed = false;
+    counted c(1, &destroyed);
+    c.set_disposer(
+        [](void *ctx, counted *obj) {
+            static_cast<std::vector<counted *> *>(ctx)->push_back(obj);
+        },
+        &disposed);
+    {
+        auto p = ref_ptr<counted>(&c);
+        auto q = p;
+        CHECK(c.use_count() == 2);
+    }
+    CHECK(c.use_count() == 0);
+    CHECK(disposed == std::vector<counted *>{&c});
+    CHECK_FALSE(destroyed);
+}
+
+} // namespace partake::daemon
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+
+#include <cassert>
+#include <type_traits>
+#include <utility>
+
+namespace partake::daemon {
+
+// Base class embedding a reference count, for use with ref_ptr. The count is
+// not atomic: objects and handles are only ever referenced from the daemon's
+// single thread, so we avoid the atomic operations (and the separate control
+// block) of std::shared_ptr.
+//
+// When the count drops to zero, the disposer, if set, is called instead of
+// deleting the object. This allows objects stored in a container (such as a
+// hive) to be removed from it. A disposer must always be set if Derived does
+// not have a public destructor.
+template <typename Derived> class ref_counted {
+  public:
+    using disposer_type = void (*)(void *context, Derived *obj);
+
+  private:
+    unsigned refs = 0;
+    disposer_type dispose = nullptr;
+    void *dispose_ctx = nullptr;
+
+  protected:
+    ref_counted() noexcept = default;
+    ~ref_counted() = default;
+
+  public:
+    // No move or copy (the count belongs to the object's address)
+    ref_counted(ref_counted const &) = delete;
+    auto operator=(ref_counted const &) = delete;
+    ref_counted(ref_counted &&) = delete;
+    auto operator=(ref_counted &&) = delete;
+
+    void set_disposer(disposer_type disposer, void *context) noexcept {
+        dispose = disposer;
+        dispose_ctx = context;
+    }
+
+    [[nodiscard]] auto use_count() const noexcept -> unsigned { return refs; }
+
+  private:
+    friend void intrusive_ptr_add_ref(ref_counted *p) noexcept { ++p->refs; }
+
+    friend void intrusive_ptr_release(ref_counted *p) noexcept {
+        assert(p->refs > 0);
+        if (--p->refs > 0)
+            return;
+        auto *obj = static_cast<Derived *>(p);
+        if (p->dispose != nullptr)
+            p->dispose(p->dispose_ctx, obj);
+        else if constexpr (std::is_destructible_v<Derived>)
+            delete obj;
+        else
+            assert(false);
+    }
+};
+
+template <typename T> using ref_ptr = boost::intrusive_ptr<T>;
+
+template <typename T, typename... Args>
+auto make_ref(Args &&...args) -> ref_ptr<T> {
+    return ref_ptr<T>(new T(std::forward<Args>(args)...));
+}
+
+} // namespace partake::daemon
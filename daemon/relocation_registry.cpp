@@ -0,0 +1,61 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "relocation_registry.hpp"
+
+#include <doctest.h>
+
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("relocation_registry") {
+    relocation_registry reg;
+    CHECK(reg.request(100, 1000) == 0);
+
+    std::vector<std::pair<int, std::size_t>> asked; // Subscriber, bytes
+    auto const subscriber = [&](int i, std::size_t relocatable) {
+        return [&asked, i, relocatable](std::size_t bytes) {
+            asked.emplace_back(i, bytes);
+            return relocatable;
+        };
+    };
+    auto const id1 = reg.subscribe(subscriber(1, 60));
+    auto const id2 = reg.subscribe(subscriber(2, 0));
+    auto const id3 = reg.subscribe(subscriber(3, 60));
+    CHECK(id1 != id2);
+    CHECK(reg.size() == 3);
+
+    CHECK(reg.request(100, 1000) == 120);
+    using asked_type = std::vector<std::pair<int, std::size_t>>;
+    CHECK(asked == asked_type{{1, 100}, {2, 40}, {3, 40}});
+
+    asked.clear();
+    CHECK(reg.request(50, 1000) == 0); // Free space unchanged
+    CHECK(asked.empty());
+    CHECK(reg.request(50, 1100) == 60); // Continues with the next subscriber
+    CHECK(asked == asked_type{{1, 50}});
+
+    asked.clear();
+    reg.unsubscribe(id2);
+    reg.unsubscribe(id3);
+    reg.unsubscribe(id3); // No effect
+    CHECK(reg.size() == 1);
+    CHECK(reg.request(200, 1200) == 60);
+    CHECK(asked == asked_type{{1, 200}});
+
+    asked.clear();
+    reg.subscribe(subscriber(4, 10));
+    CHECK(reg.request(200, 1200) == 70); // Asked again for the new one
+    CHECK(asked == asked_type{{1, 200}, {4, 140}});
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,98 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+// Sessions whose clients have agreed to relocate (replace with a copy) the
+// objects they hold when asked, so that the holes left behind can coalesce
+// when shared memory is fragmented. request() asks subscribers in turn,
+// starting after the one last asked so that the burden is spread, until the
+// objects they have been asked to relocate add up to the wanted size.
+// Subscribers are asked again only once the amount of free space has
+// changed (or a new one has subscribed): until then, every failed
+// allocation would find the same candidates (already asked) and the same
+// fragmentation, so repeated requests (e.g., from retried allocations)
+// return 0 at no cost.
+//
+// Request functions must not subscribe or unsubscribe.
+class relocation_registry {
+  public:
+    // Given the number of bytes wanted, ask the client to relocate some
+    // objects and return their total size (0 if none).
+    using request_func = std::function<std::size_t(std::size_t)>;
+
+  private:
+    struct subscription {
+        std::uint64_t id;
+        request_func request;
+    };
+
+    std::vector<subscription> subs;
+    std::size_t next_sub = 0; // Index of subscription to ask first
+    std::uint64_t last_id = 0;
+    std::optional<std::size_t> free_when_asked; // At the last request
+
+  public:
+    relocation_registry() = default;
+
+    // No move or copy (sessions keep subscription ids)
+    ~relocation_registry() = default;
+    relocation_registry(relocation_registry const &) = delete;
+    auto operator=(relocation_registry const &) = delete;
+    relocation_registry(relocation_registry &&) = delete;
+    auto operator=(relocation_registry &&) = delete;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return subs.size();
+    }
+
+    // Return the (nonzero) subscription id.
+    auto subscribe(request_func request) -> std::uint64_t {
+        auto const id = ++last_id;
+        subs.push_back({id, std::move(request)});
+        free_when_asked.reset();
+        return id;
+    }
+
+    void unsubscribe(std::uint64_t subscription_id) {
+        auto it = std::find_if(subs.begin(), subs.end(),
+                               [subscription_id](subscription const &s) {
+                                   return s.id == subscription_id;
+                               });
+        if (it == subs.end())
+            return;
+        subs.erase(it);
+        if (next_sub >= subs.size())
+            next_sub = 0;
+    }
+
+    // Return the total size of the objects whose relocation was requested,
+    // given the allocator's current free space, 'free_bytes'.
+    auto request(std::size_t bytes, std::size_t free_bytes) -> std::size_t {
+        if (free_when_asked == free_bytes)
+            return 0;
+        free_when_asked = free_bytes;
+        std::size_t total = 0;
+        for (std::size_t i = 0; i < subs.size() && total < bytes; ++i) {
+            auto &sub = subs[next_sub];
+            next_sub = (next_sub + 1) % subs.size();
+            total += sub.request(bytes - total);
+        }
+        return total;
+    }
+};
+
+} // namespace partake::daemon
@@ -9,18 +9,27 @@
 #include <doctest.h>
 #include <trompeloeil.hpp>
 
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
 namespace partake::daemon {
 
 namespace {
 
-struct mock_object : token_hash_table<mock_object>::hook,
-                     std::enable_shared_from_this<mock_object> {
+struct mock_object : ref_counted<mock_object> {
+    // Both kinds are stored as the same type in this mock.
+    using proper_object_node_type = mock_object;
+    using voucher_node_type = mock_object;
+
     bool v;
     common::token k;
     protocol::Policy p = protocol::Policy::DEFAULT;
     int r = 0;
     std::size_t nv = 0;
-    std::shared_ptr<mock_object> tgt;
+    std::function<void(int &&)> recycler;
+    ref_ptr<mock_object> tgt;
     unsigned c = 0;
     time_point exp;
 
@@ -29,11 +38,15 @@ struct mock_object : token_hash_table<mock_object>::hook,
         : v(false), k(key), p(policy), r(resource) {}
 
     explicit mock_object(common::token key,
-                         std::shared_ptr<mock_object> target, unsigned count,
+                         ref_ptr<mock_object> target, unsigned count,
                          time_point expiration)
         : v(true), k(key), tgt(std::move(target)), c(count), exp(expiration) {}
 
-    ~mock_object() { CHECK(nv == 0); }
+    ~mock_object() {
+        CHECK(nv == 0);
+        if (recycler)
+            recycler(std::move(r));
+    }
 
     mock_object(mock_object const &) = delete;
     auto operator=(mock_object const &) = delete;
@@ -48,9 +61,13 @@ struct mock_object : token_hash_table<mock_object>::hook,
 
     auto as_proper_object() -> mock_object & { return *this; }
 
-    void add_voucher() { ++nv; }
+    template <typename F> void set_recycler(F recycle) {
+        recycler = std::move(recycle);
+    }
+
+    void add_voucher(mock_object * /* vchr */) { ++nv; }
 
-    void drop_voucher() {
+    void drop_voucher(mock_object * /* vchr */) {
         CHECK(nv > 0);
         --nv;
     }
@@ -69,22 +86,26 @@ struct mock_object : token_hash_table<mock_object>::hook,
 
     auto is_valid(time_point now) const -> bool { return c > 0 && now <= exp; }
 
-    auto target() const noexcept -> std::shared_ptr<mock_object> {
-        return tgt;
-    }
+    auto target() const noexcept -> ref_ptr<mock_object> { return tgt; }
 };
 
 struct mock_key_sequence { // Generate sequential starting at 1.
     std::uint64_t prev;
 
     auto generate() -> common::token { return common::token(++prev); }
+
+    // Pretend that keys above 1000 can be told apart as never issued.
+    // NOLINTNEXTLINE(readability-magic-numbers)
+    static auto may_have_issued(common::token key) -> bool {
+        return key.is_valid() && key.as_u64() <= 1000;
+    }
 };
 
 struct mock_voucher_queue {
     using object_type = mock_object;
 
-    MAKE_MOCK1(enqueue, void(std::shared_ptr<mock_object>));
-    MAKE_MOCK1(drop, void(std::shared_ptr<mock_object>));
+    MAKE_MOCK1(enqueue, void(ref_ptr<mock_object>));
+    MAKE_MOCK1(drop, void(ref_ptr<mock_object>));
 };
 
 } // namespace
@@ -108,10 +129,115 @@ TEST_CASE("repository") {
     using trompeloeil::_;
     REQUIRE_CALL(vq, enqueue(_)).WITH(_1->key().as_u64() == 3).TIMES(1);
     auto v = r.create_voucher(obj, time_point(std::chrono::seconds(100)), 1);
+    CHECK(r.object_count() == 2);
+    CHECK(r.voucher_count() == 1);
 
     REQUIRE_CALL(vq, drop(_)).WITH(_1 == v).TIMES(1);
     CHECK(r.claim_voucher(v, time_point(std::chrono::seconds(50))));
     CHECK_FALSE(r.claim_voucher(v, time_point(std::chrono::seconds(50))));
+    v.reset();
+    CHECK(r.object_count() == 1);
+    CHECK(r.voucher_count() == 0);
+
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("repository: recycled resource") {
+    // NOLINTBEGIN(readability-magic-numbers)
+
+    mock_voucher_queue vq;
+    repository<mock_object, mock_key_sequence, mock_voucher_queue> r(
+        mock_key_sequence(), vq);
+
+    int recycled = 0;
+    auto obj = r.create_object(protocol::Policy::DEFAULT, 42,
+                               [&](int &&rsrc) { recycled = rsrc; });
+    CHECK(r.find_object(obj->key()) == obj);
+    auto const key = obj->key();
+    obj.reset();
+    CHECK(recycled == 42);
+    CHECK_FALSE(r.find_object(key));
+
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("repository: restore_object") {
+    // NOLINTBEGIN(readability-magic-numbers)
+
+    mock_voucher_queue vq;
+    repository<mock_object, mock_key_sequence, mock_voucher_queue> r(
+        mock_key_sequence(), vq);
+
+    auto obj = r.restore_object(common::token(100),
+                                protocol::Policy::DEFAULT, 42);
+    REQUIRE(obj);
+    CHECK(obj->key().as_u64() == 100);
+    CHECK(r.find_object(common::token(100)) == obj);
+    CHECK_FALSE(r.restore_object(common::token(100),
+                                 protocol::Policy::DEFAULT, 43));
+    CHECK_FALSE(r.restore_object(common::token(), protocol::Policy::DEFAULT,
+                                 43));
+
+    // Not found, because the key sequence cannot have issued it.
+    auto never_issued = r.restore_object(common::token(1001),
+                                         protocol::Policy::DEFAULT, 45);
+    REQUIRE(never_issued);
+    CHECK_FALSE(r.find_object(common::token(1001)));
+    never_issued.reset();
+
+    auto obj2 = r.create_object(protocol::Policy::PRIMITIVE, 44);
+    std::vector<int> resources;
+    r.for_each_proper_object(
+        [&](mock_object &o) { resources.push_back(o.r); });
+    std::sort(resources.begin(), resources.end());
+    CHECK(resources == std::vector<int>{42, 44});
+
+    // NOLINTEND(readability-magic-numbers)
+}
+
+TEST_CASE("repository: scan_objects") {
+    // NOLINTBEGIN(readability-magic-numbers)
+
+    mock_voucher_queue vq;
+    repository<mock_object, mock_key_sequence, mock_voucher_queue> r(
+        mock_key_sequence(), vq);
+
+    std::vector<ref_ptr<mock_object>> objs;
+    for (int i = 0; i < 5; ++i)
+        objs.push_back(r.create_object(protocol::Policy::DEFAULT, i));
+    std::vector<int> visited;
+    auto const f = [&](mock_object &o) { visited.push_back(o.r); };
+
+    SUBCASE("in slices") {
+        CHECK(r.scan_objects(2, f));
+        CHECK(r.scan_objects(2, f));
+        CHECK_FALSE(r.scan_objects(2, f));
+        std::sort(visited.begin(), visited.end());
+        CHECK(visited == std::vector<int>{0, 1, 2, 3, 4});
+        visited.clear();
+        CHECK_FALSE(r.scan_objects(10, f)); // Starts over
+        CHECK(visited.size() == 5);
+    }
+
+    SUBCASE("objects destroyed during scan") {
+        CHECK(r.scan_objects(2, f));
+        // Destroy those not yet visited, including the next.
+        std::vector<int> remaining;
+        for (auto &o : objs) {
+            if (std::find(visited.begin(), visited.end(), o->r) ==
+                visited.end()) {
+                remaining.push_back(o->r);
+                o.reset();
+            }
+        }
+        REQUIRE(remaining.size() == 3);
+        objs.push_back(r.create_object(protocol::Policy::DEFAULT, 5));
+        while (r.scan_objects(1, f)) {
+        }
+        for (int const gone : remaining)
+            CHECK(std::count(visited.begin(), visited.end(), gone) == 0);
+        CHECK(visited.size() <= 3);
+    }
 
     // NOLINTEND(readability-magic-numbers)
 }
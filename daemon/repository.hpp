@@ -6,19 +6,29 @@
 
 #pragma once
 
+#include "alloc_wait_queue.hpp"
+#include "allocation_profiler.hpp"
+#include "cold_store.hpp"
+#include "dedup_index.hpp"
 #include "hive.hpp"
+#include "numa.hpp"
 #include "partake_protocol_generated.h"
+#include "ref_counted.hpp"
+#include "relocation_registry.hpp"
 #include "time_point.hpp"
 #include "token.hpp"
 #include "token_hash_table.hpp"
+#include "topic_registry.hpp"
+#include "wait_deadline_queue.hpp"
 
 #include <gsl/pointers>
+#include <gsl/span>
 
 #include <cassert>
 #include <chrono>
 #include <cstddef>
-#include <memory>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -30,21 +40,45 @@ class repository {
     using object_type = Object;
     using key_sequence_type = KeySequence;
     using voucher_queue_type = VoucherQueue;
+    using proper_object_node_type =
+        typename object_type::proper_object_node_type;
+    using voucher_node_type = typename object_type::voucher_node_type;
+    using resource_type = typename object_type::resource_type;
     static_assert(
         std::is_same_v<object_type, typename voucher_queue_type::object_type>);
 
   private:
-    // Objects are owned by 'object_storage' but also participate in the
-    // hash table 'objects'. These ownerships do not keep the object alive;
-    // instead, objects are held elsewhere by shared_ptr with a custom
-    // deleter that removes the object from the hash table and storage.
-    // User is responsible for releasing all objects before destroying the
-    // repository.
-
-    hive<object_type> object_storage;
+    // Proper objects are owned by 'object_storage' and vouchers by
+    // 'voucher_storage', but both participate in the hash table 'objects'.
+    // These ownerships do not keep the object alive; instead, objects are
+    // held elsewhere by ref_ptr, and a disposer set on each object removes it
+    // from the hash table and storage. User is responsible for releasing all
+    // objects before destroying the repository.
+
+    hive<proper_object_node_type> object_storage;
+    hive<voucher_node_type> voucher_storage;
     token_hash_table<object_type> objects;
     key_sequence_type tokseq;
     gsl::not_null<voucher_queue_type *> vqueue;
+    topic_registry<object_type> topic_reg;
+    alloc_wait_queue alloc_waits; // Notified when objects are destroyed
+    wait_deadline_queue wait_dls;  // Of Open and Unshare with a timeout
+    relocation_registry relocation_reg;
+    allocation_profiler alloc_prof;
+    dedup_index<object_type> dedup_idx; // Shared with deduplication
+    cold_store<object_type> cold;       // Idle objects compressed
+    cpu_topology topo; // Empty unless client placement is needed
+
+    // Extents of multi-extent objects other than the first (which is the
+    // object's resource); freed when the object is destroyed.
+    std::unordered_map<object_type const *, std::vector<resource_type>>
+        more_extents;
+
+    // Position of the object scan (see scan_objects()): the next object to
+    // visit, or null if the scan has reached the end. Advanced when that
+    // object is destroyed.
+    bool scanning = false;
+    proper_object_node_type *scan_next = nullptr;
 
   public:
     explicit repository(key_sequence_type &&key_sequence,
@@ -61,53 +95,77 @@ class repository {
 
     template <typename R>
     auto create_object(protocol::Policy policy, R &&resource)
-        -> std::shared_ptr<object_type> {
+        -> ref_ptr<object_type> {
         auto obj = object_storage.emplace(tokseq.generate(), policy,
                                           std::forward<R>(resource));
         objects.insert(*obj);
+        obj->set_disposer(&repository::dispose_object, this);
+        return ref_ptr<object_type>(&*obj);
+    }
 
-        return {&*obj, [this](object_type *o) {
-                    objects.erase(objects.iterator_to(*o));
-                    object_storage.erase(object_storage.get_iterator(o));
-                }};
+    // Same as above, but instead of being destroyed with the object, the
+    // resource is passed to 'recycle' (by rvalue) when the object is
+    // destroyed.
+    template <typename R, typename Recycle>
+    auto create_object(protocol::Policy policy, R &&resource, Recycle recycle)
+        -> ref_ptr<object_type> {
+        auto obj = create_object(policy, std::forward<R>(resource));
+        obj->as_proper_object().set_recycler(std::move(recycle));
+        return obj;
     }
 
-    // May return a voucher!
-    auto find_object(common::token key) -> std::shared_ptr<object_type> {
+    // Create an object with the given key, which must not be in use (for
+    // objects restored from a snapshot). Return null if the key is in use.
+    // The key sequence must have been restored first, as find_object() only
+    // finds keys that it may have issued.
+    template <typename R>
+    auto restore_object(common::token key, protocol::Policy policy,
+                        R &&resource) -> ref_ptr<object_type> {
+        if (not key.is_valid() || objects.find(key) != objects.end())
+            return {};
+        auto obj =
+            object_storage.emplace(key, policy, std::forward<R>(resource));
+        objects.insert(*obj);
+        obj->set_disposer(&repository::dispose_object, this);
+        return ref_ptr<object_type>(&*obj);
+    }
+
+    // May return a voucher! Keys that the key sequence has certainly not
+    // issued (such as stale keys from before a restart) are rejected
+    // without probing the hash table.
+    auto find_object(common::token key) -> ref_ptr<object_type> {
+        if (not tokseq.may_have_issued(key))
+            return {};
         auto objit = objects.find(key);
         if (objit == objects.end())
             return {};
-        return objit->shared_from_this();
+        return ref_ptr<object_type>(&*objit);
     }
 
-    void rekey_object(std::shared_ptr<object_type> const &obj) {
+    void rekey_object(ref_ptr<object_type> const &obj) {
         assert(obj->is_proper_object());
         objects.erase(objects.iterator_to(*obj));
         obj->rekey(tokseq.generate());
         objects.insert(*obj);
     }
 
-    auto create_voucher(std::shared_ptr<object_type> target,
-                        time_point expiration, unsigned count)
-        -> std::shared_ptr<object_type> {
+    auto create_voucher(ref_ptr<object_type> target, time_point expiration,
+                        unsigned count) -> ref_ptr<object_type> {
         assert(target);
         assert(target->is_proper_object());
         assert(count > 0);
-        target->as_proper_object().add_voucher();
-        auto voucher = object_storage.emplace(
+        auto &target_po = target->as_proper_object();
+        auto voucher = voucher_storage.emplace(
             tokseq.generate(), std::move(target), count, expiration);
+        target_po.add_voucher(&voucher->as_voucher());
         objects.insert(*voucher);
-        auto ptr =
-            std::shared_ptr<object_type>(&*voucher, [this](object_type *vchr) {
-                vchr->as_voucher().target()->as_proper_object().drop_voucher();
-                objects.erase(objects.iterator_to(*vchr));
-                object_storage.erase(object_storage.get_iterator(vchr));
-            });
+        voucher->set_disposer(&repository::dispose_voucher, this);
+        auto ptr = ref_ptr<object_type>(&*voucher);
         vqueue->enqueue(ptr);
         return ptr;
     }
 
-    auto claim_voucher(std::shared_ptr<object_type> const &voucher,
+    auto claim_voucher(ref_ptr<object_type> const &voucher,
                        time_point now) -> bool {
         assert(voucher);
         assert(voucher->is_voucher());
@@ -119,9 +177,152 @@ class repository {
         return true;
     }
 
+    // Drop from the queue the vouchers targeting 'target' that can no
+    // longer be claimed (because they have expired but have not yet been
+    // visited by the queue), so that they do not keep it from being
+    // uniquely owned. Costs time proportional to the vouchers of 'target',
+    // not of the whole queue.
+    void drop_stale_vouchers(ref_ptr<object_type> const &target,
+                             time_point now) {
+        assert(target->is_proper_object());
+        auto &vchrs = target->as_proper_object().vouchers();
+        for (auto it = vchrs.begin(); it != vchrs.end();) {
+            auto &v = *it++;
+            // Releasing 'vobj' may destroy the voucher (unlinking it from
+            // 'vchrs'), but no other voucher.
+            auto const vobj = v.queue_node().owner; // Null if not queued
+            if (vobj && not v.is_valid(now))
+                vqueue->drop(vobj);
+        }
+    }
+
+    // Live objects, including vouchers.
+    [[nodiscard]] auto object_count() const noexcept -> std::size_t {
+        return object_storage.size() + voucher_storage.size();
+    }
+
+    [[nodiscard]] auto voucher_count() const noexcept -> std::size_t {
+        return voucher_storage.size();
+    }
+
+    // Call 'f' with each proper object (not vouchers), as 'object_type &'.
+    // 'f' must not create or destroy objects.
+    template <typename F> void for_each_proper_object(F &&f) {
+        for (auto &obj : object_storage)
+            f(static_cast<object_type &>(obj));
+    }
+
+    // Incremental version of the above, so that very many objects can be
+    // visited without holding up other work: call 'f' with up to
+    // 'max_count' proper objects and return true if more remain, in which
+    // case the next call continues where this one stopped (objects may be
+    // created and destroyed in between); otherwise the next call starts
+    // over. Objects created during the scan may or may not be visited.
+    // 'f' must not create or destroy objects.
+    template <typename F>
+    auto scan_objects(std::size_t max_count, F &&f) -> bool {
+        auto it = object_storage.begin();
+        if (scanning)
+            it = scan_next == nullptr ? object_storage.end()
+                                      : object_storage.get_iterator(scan_next);
+        for (std::size_t n = 0; n < max_count && it != object_storage.end();
+             ++n, ++it)
+            f(static_cast<object_type &>(*it));
+        scanning = it != object_storage.end();
+        scan_next = scanning ? &*it : nullptr;
+        return scanning;
+    }
+
+    auto key_seq() noexcept -> key_sequence_type & { return tokseq; }
+
+    auto topics() noexcept -> topic_registry<object_type> & {
+        return topic_reg;
+    }
+
+    auto alloc_waiters() noexcept -> alloc_wait_queue & {
+        return alloc_waits;
+    }
+
+    auto wait_deadlines() noexcept -> wait_deadline_queue & {
+        return wait_dls;
+    }
+
+    auto relocations() noexcept -> relocation_registry & {
+        return relocation_reg;
+    }
+
+    auto alloc_profiler() noexcept -> allocation_profiler & {
+        return alloc_prof;
+    }
+
+    auto dedup() noexcept -> dedup_index<object_type> & { return dedup_idx; }
+
+    auto cold_objects() noexcept -> cold_store<object_type> & {
+        return cold;
+    }
+
+    auto topology() noexcept -> cpu_topology & { return topo; }
+
+    // Make 'obj' a multi-extent object, whose data continue (after its
+    // resource) in 'extents'.
+    void set_more_extents(object_type const *obj,
+                          std::vector<resource_type> &&extents) {
+        if (extents.empty())
+            return;
+        more_extents[obj] = std::move(extents);
+    }
+
+    [[nodiscard]] auto is_multi_extent(object_type const *obj) const
+        -> bool {
+        return not more_extents.empty() && more_extents.count(obj) > 0;
+    }
+
+    // The extents of 'obj' after the first; empty if it is contiguous.
+    [[nodiscard]] auto more_extents_of(object_type const *obj) const
+        -> gsl::span<resource_type const> {
+        if (more_extents.empty())
+            return {};
+        auto it = more_extents.find(obj);
+        if (it == more_extents.end())
+            return {};
+        return it->second;
+    }
+
     void drop_all_vouchers() { vqueue->drop_all(); }
 
-    void perform_housekeeping() { objects.rehash_if_appropriate(true); }
+    // Also retries waiting allocations if objects have been destroyed.
+    void perform_housekeeping() {
+        objects.rehash_if_appropriate(true);
+        alloc_waits.retry();
+    }
+
+  private:
+    static void dispose_object(void *self, object_type *obj) {
+        auto *repo = static_cast<repository *>(self);
+        repo->dedup_idx.erase(obj);
+        repo->cold.erase(obj);
+        if (not repo->more_extents.empty())
+            repo->more_extents.erase(obj);
+        repo->objects.erase(repo->objects.iterator_to(*obj));
+        auto *node = static_cast<proper_object_node_type *>(obj);
+        auto const it = repo->object_storage.get_iterator(node);
+        if (repo->scan_next == node) {
+            auto const next = std::next(it);
+            repo->scan_next =
+                next == repo->object_storage.end() ? nullptr : &*next;
+        }
+        repo->object_storage.erase(it);
+        repo->alloc_waits.notify_freed();
+    }
+
+    static void dispose_voucher(void *self, object_type *vchr) {
+        auto *repo = static_cast<repository *>(self);
+        auto &v = vchr->as_voucher();
+        v.target()->as_proper_object().drop_voucher(&v);
+        repo->objects.erase(repo->objects.iterator_to(*vchr));
+        repo->voucher_storage.erase(repo->voucher_storage.get_iterator(
+            static_cast<voucher_node_type *>(vchr)));
+    }
 };
 
 } // namespace partake::daemon
@@ -7,10 +7,13 @@
 #include "request_handler.hpp"
 
 #include <doctest.h>
+#include <gsl/span>
 #include <trompeloeil.hpp>
 
+#include <array>
 #include <cstdint>
 #include <functional>
+#include <vector>
 
 namespace partake::daemon {
 
@@ -20,9 +23,11 @@ struct mock_resource {
     std::uint32_t seg;
     std::size_t off;
     std::size_t siz;
+    bool zero;
     [[nodiscard]] auto segment_id() const -> std::uint32_t { return seg; }
     [[nodiscard]] auto offset() const -> std::size_t { return off; }
     [[nodiscard]] auto size() const -> std::size_t { return siz; }
+    [[nodiscard]] auto is_zeroed() const -> bool { return zero; }
 };
 
 struct mock_session {
@@ -30,39 +35,136 @@ struct mock_session {
         using resource_type = mock_resource;
     };
 
-    MAKE_MOCK4(hello, void(std::string_view, std::uint32_t,
-                           std::function<void(std::uint32_t)>,
-                           std::function<void(protocol::Status)>));
+    MAKE_MOCK5(hello,
+               void(std::string_view, std::uint32_t,
+                    std::function<void(std::uint32_t, cpu_placement const &)>,
+                    std::function<void(protocol::Status)>, int));
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_MOCK1(bind_sub_pool, auto(std::string_view)->bool);
     MAKE_MOCK3(get_segment,
                void(std::uint32_t, std::function<void(segment_spec)>,
                     std::function<void(protocol::Status)>));
-    MAKE_MOCK4(alloc,
-               void(std::uint64_t, protocol::Policy,
+    MAKE_MOCK6(alloc,
+               void(std::uint64_t, protocol::Policy, int, std::uint64_t,
+                    std::function<void(common::token, mock_resource const &)>,
+                    std::function<void(protocol::Status)>));
+    MAKE_MOCK8(alloc_when_ready,
+               void(std::uint64_t, protocol::Policy, int, std::uint64_t,
+                    std::function<void(common::token, mock_resource const &)>,
+                    std::function<void(protocol::Status)>,
                     std::function<void(common::token, mock_resource const &)>,
                     std::function<void(protocol::Status)>));
-    MAKE_MOCK8(open,
-               void(common::token, protocol::Policy, bool, time_point,
+    MAKE_MOCK8(alloc_or_wait,
+               void(std::uint64_t, protocol::Policy, int, std::uint64_t,
                     std::function<void(common::token, mock_resource const &)>,
                     std::function<void(protocol::Status)>,
                     std::function<void(common::token, mock_resource const &)>,
                     std::function<void(protocol::Status)>));
+    MAKE_MOCK6(alloc_extents,
+               void(std::uint64_t, std::uint32_t, protocol::Policy, int,
+                    std::function<void(common::token, mock_resource const &,
+                                       gsl::span<mock_resource const>)>,
+                    std::function<void(protocol::Status)>));
+    MAKE_MOCK10(open,
+                void(common::token, protocol::Policy, bool, time_point,
+                     std::function<void(common::token, mock_resource const &)>,
+                     std::function<void(protocol::Status)>,
+                     std::function<void(common::token, mock_resource const &)>,
+                     std::function<void(protocol::Status)>,
+                     std::chrono::milliseconds, std::chrono::milliseconds));
+    MAKE_MOCK10(open_extents,
+                void(common::token, protocol::Policy, bool, time_point,
+                     std::function<void(common::token, mock_resource const &,
+                                        gsl::span<mock_resource const>)>,
+                     std::function<void(protocol::Status)>,
+                     std::function<void(common::token, mock_resource const &,
+                                        gsl::span<mock_resource const>)>,
+                     std::function<void(protocol::Status)>,
+                     std::chrono::milliseconds, std::chrono::milliseconds));
     MAKE_MOCK3(close, void(common::token, std::function<void()>,
                            std::function<void(protocol::Status)>));
+    MAKE_MOCK4(renew_leases,
+               void(std::chrono::milliseconds, time_point,
+                    std::function<void(bool)>,
+                    std::function<void(protocol::Status)>));
     MAKE_MOCK3(share, void(common::token, std::function<void()>,
                            std::function<void(protocol::Status)>));
-    MAKE_MOCK6(unshare,
+    MAKE_MOCK3(share_dedup,
+               void(common::token,
+                    std::function<void(common::token, mock_resource const &)>,
+                    std::function<void(protocol::Status)>));
+    MAKE_MOCK4(resize,
+               void(common::token, std::uint64_t,
+                    std::function<void(common::token, mock_resource const &)>,
+                    std::function<void(protocol::Status)>));
+    MAKE_MOCK7(unshare,
                void(common::token, bool, std::function<void(common::token)>,
                     std::function<void(protocol::Status)>,
                     std::function<void(common::token)>,
+                    std::function<void(protocol::Status)>,
+                    std::chrono::milliseconds));
+    MAKE_MOCK6(create_voucher,
+               void(common::token, unsigned, time_point,
+                    std::chrono::milliseconds,
+                    std::function<void(common::token)>,
+                    std::function<void(protocol::Status)>));
+    MAKE_MOCK6(share_and_create_voucher,
+               void(common::token, unsigned, time_point,
+                    std::chrono::milliseconds,
+                    std::function<void(common::token)>,
                     std::function<void(protocol::Status)>));
-    MAKE_MOCK5(create_voucher, void(common::token, unsigned, time_point,
-                                    std::function<void(common::token)>,
-                                    std::function<void(protocol::Status)>));
     MAKE_MOCK4(discard_voucher, void(common::token, time_point,
                                      std::function<void(common::token)>,
                                      std::function<void(protocol::Status)>));
+    MAKE_MOCK5(create_pool, void(std::uint32_t, std::uint64_t,
+                                 protocol::Policy,
+                                 std::function<void(std::uint32_t)>,
+                                 std::function<void(protocol::Status)>));
+    MAKE_MOCK3(alloc_from_pool,
+               void(std::uint32_t,
+                    std::function<void(common::token, mock_resource const &)>,
+                    std::function<void(protocol::Status)>));
+    MAKE_MOCK3(destroy_pool, void(std::uint32_t, std::function<void()>,
+                                  std::function<void(protocol::Status)>));
+    MAKE_MOCK5(subscribe,
+               void(std::string_view, bool,
+                    std::function<void(common::token, mock_resource const *)>,
+                    std::function<void()>,
+                    std::function<void(protocol::Status)>));
+    MAKE_MOCK3(unsubscribe, void(std::string_view, std::function<void()>,
+                                 std::function<void(protocol::Status)>));
+    MAKE_MOCK4(publish, void(std::string_view, common::token,
+                             std::function<void(std::uint32_t)>,
+                             std::function<void(protocol::Status)>));
+    MAKE_MOCK3(subscribe_relocation,
+               void(std::function<void(common::token)>, std::function<void()>,
+                    std::function<void(protocol::Status)>));
+
+    MAKE_MOCK4(clone,
+               void(common::token, protocol::Policy,
+                    std::function<void(common::token, mock_resource const &)>,
+                    std::function<void(protocol::Status)>));
+    // Use 'int' as the type of the reference keeping the object alive.
+    MAKE_MOCK6(map_range,
+               void(common::token, std::uint64_t, std::uint64_t, bool,
+                    std::function<void(gsl::span<std::uint8_t>, int)>,
+                    std::function<void(protocol::Status)>));
+    MAKE_MOCK4(map_for_prefetch,
+               void(common::token, time_point,
+                    std::function<void(gsl::span<std::uint8_t>, int)>,
+                    std::function<void(protocol::Status)>));
 
-    MAKE_MOCK0(perform_housekeeping, void());
+    MAKE_MOCK7(alloc_ring,
+               void(std::uint32_t, std::uint32_t, int,
+                    std::function<void(common::token, mock_resource const &)>,
+                    std::function<void(protocol::Status)>,
+                    std::function<void(common::token, mock_resource const &)>,
+                    std::function<void(protocol::Status)>));
+    using allocator_info_callback = std::function<void(
+        std::size_t, std::size_t, std::vector<std::size_t> const &)>;
+    MAKE_CONST_MOCK1(get_allocator_info, void(allocator_info_callback));
+    MAKE_CONST_MOCK1(wake_word_offset,
+                     std::uint64_t(mock_resource const &));
 };
 
 struct mock_writer {
@@ -91,7 +193,6 @@ TEST_CASE("request_handler: invalid request message") {
     REQUIRE_CALL(handle_error,
                  call(std::error_code(common::errc::invalid_message)))
         .TIMES(1);
-    REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
     CHECK(rh.handle_message(std::vector<std::uint8_t>{}));
 }
@@ -111,12 +212,44 @@ TEST_CASE("request_handler: empty request message") {
     auto req_span = b.GetBufferSpan();
 
     using trompeloeil::_;
-    REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
     // No calls to 'write'.
 
     CHECK_FALSE(rh.handle_message(req_span));
 }
 
+TEST_CASE("request_handler: request of type NONE") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({CreateRequest(b, 42, AnyRequest::NONE)})));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+    REQUIRE_CALL(handle_error,
+                 call(std::error_code(common::errc::invalid_request_type)))
+        .TIMES(1);
+
+    CHECK(rh.handle_message(req_span));
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    REQUIRE(resp_msg->responses()->size() == 1);
+    CHECK(resp_msg->responses()->Get(0)->seqno() == 42);
+    CHECK(resp_msg->responses()->Get(0)->status() ==
+          Status::INVALID_REQUEST);
+}
+
 TEST_CASE("request_handler: ping") {
     mock_session sess;
     mock_writer write;
@@ -141,7 +274,6 @@ TEST_CASE("request_handler: ping") {
     REQUIRE_CALL(write, call(_))
         .LR_SIDE_EFFECT(resp_buf = std::move(_1))
         .TIMES(1);
-    REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
     CHECK_FALSE(rh.handle_message(req_span));
 
@@ -185,14 +317,18 @@ TEST_CASE("request_handler: hello") {
     using trompeloeil::_;
 
     SUBCASE("success") {
-        REQUIRE_CALL(sess, hello("some_client", 123u, _, _))
-            .SIDE_EFFECT(_3(7))
+        REQUIRE_CALL(sess, hello("some_client", 123u, _, _, -1))
+            .SIDE_EFFECT(_3(7, cpu_placement()))
             .TIMES(1);
+        auto const spec =
+            segment_spec{posix_mmap_segment_spec{"/myshmem"}, 16384};
+        REQUIRE_CALL(sess, get_segment(_, _, _))
+            .LR_SIDE_EFFECT(_1 < 2 ? _2(spec) : _3(Status::NO_SUCH_SEGMENT))
+            .TIMES(3);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -208,17 +344,54 @@ TEST_CASE("request_handler: hello") {
         CHECK(resp->response_type() == AnyResponse::HelloResponse);
         auto const *hello_resp = resp->response_as_HelloResponse();
         CHECK(hello_resp->conn_no() == 7);
+        CHECK_FALSE(hello_resp->trusted());
+        auto const *segs = hello_resp->segments();
+        REQUIRE(segs->size() == 2);
+        CHECK(segs->Get(0)->segment() == 0);
+        CHECK(segs->Get(1)->segment() == 1);
+        CHECK(segs->Get(1)->spec()->size() == 16384);
+        CHECK(hello_resp->max_frame_len() == 0); // Default
+        CHECK(hello_resp->cpu() == -1);
+        CHECK(hello_resp->l3_cpus() == nullptr);
+    }
+
+    SUBCASE("placement") {
+        cpu_placement placement;
+        placement.cpu = 5;
+        placement.numa_node = 1;
+        placement.l3_cache_id = 2;
+        placement.l3_cpus = {4, 5, 6, 7};
+        REQUIRE_CALL(sess, hello("some_client", 123u, _, _, -1))
+            .LR_SIDE_EFFECT(_3(7, placement))
+            .TIMES(1);
+        ALLOW_CALL(sess, get_segment(_, _, _))
+            .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *hello_resp =
+            resp_msg->responses()->Get(0)->response_as_HelloResponse();
+        CHECK(hello_resp->cpu() == 5);
+        CHECK(hello_resp->numa_node() == 1);
+        CHECK(hello_resp->l3_cache() == 2);
+        REQUIRE(hello_resp->l3_cpus()->size() == 4);
+        CHECK(hello_resp->l3_cpus()->Get(0) == 4);
     }
 
     SUBCASE("failure") {
-        REQUIRE_CALL(sess, hello("some_client", 123u, _, _))
+        REQUIRE_CALL(sess, hello("some_client", 123u, _, _, -1))
             .SIDE_EFFECT(_4(Status::INVALID_REQUEST))
             .TIMES(1);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         rh.handle_message(req_span);
 
@@ -235,6 +408,283 @@ TEST_CASE("request_handler: hello") {
     }
 }
 
+TEST_CASE("request_handler: hello with qos class") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    std::vector<protocol::QosClass> qos_set;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error), {}, nullptr, false, nullptr,
+        {}, [&](protocol::QosClass qos) { qos_set.push_back(qos); });
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::HelloRequest,
+                             CreateHelloRequest(b, 123,
+                                                b.CreateString("archiver"),
+                                                false, QosClass::BULK)
+                                 .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+    REQUIRE_CALL(write, call(_)).TIMES(1);
+
+    SUBCASE("success") {
+        REQUIRE_CALL(sess, hello("archiver", 123u, _, _, -1))
+            .SIDE_EFFECT(_3(7, cpu_placement()))
+            .TIMES(1);
+        CHECK_FALSE(rh.handle_message(req_span));
+        CHECK(qos_set == std::vector{QosClass::BULK});
+    }
+
+    SUBCASE("failure") {
+        REQUIRE_CALL(sess, hello("archiver", 123u, _, _, -1))
+            .SIDE_EFFECT(_4(Status::INVALID_REQUEST))
+            .TIMES(1);
+        rh.handle_message(req_span);
+        CHECK(qos_set.empty());
+    }
+}
+
+TEST_CASE("request_handler: hello with sub-pool") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::HelloRequest,
+                             CreateHelloRequest(b, 123,
+                                                b.CreateString("worker"),
+                                                false, QosClass::NORMAL,
+                                                false, 0,
+                                                b.CreateString("small"))
+                                 .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+    auto const status = [&] {
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        return resp_msg->responses()->Get(0)->status();
+    };
+
+    SUBCASE("success") {
+        REQUIRE_CALL(sess, bind_sub_pool("small")).RETURN(true);
+        REQUIRE_CALL(sess, hello("worker", 123u, _, _, -1))
+            .SIDE_EFFECT(_3(7, cpu_placement()))
+            .TIMES(1);
+        CHECK_FALSE(rh.handle_message(req_span));
+        CHECK(status() == Status::OK);
+    }
+
+    SUBCASE("no such sub-pool") {
+        REQUIRE_CALL(sess, bind_sub_pool("small")).RETURN(false);
+        FORBID_CALL(sess, hello(_, _, _, _, _));
+        rh.handle_message(req_span);
+        CHECK(status() == Status::INVALID_REQUEST);
+    }
+}
+
+TEST_CASE("request_handler: hello with max frame length") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    std::vector<std::size_t> requested;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error), {}, nullptr, false, nullptr,
+        {}, {}, [&](std::size_t len) -> std::size_t {
+            requested.push_back(len);
+            return 65536;
+        });
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::HelloRequest,
+                             CreateHelloRequest(b, 123,
+                                                b.CreateString("batcher"),
+                                                false, QosClass::NORMAL,
+                                                false, 1 << 20)
+                                 .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+    REQUIRE_CALL(sess, hello("batcher", 123u, _, _, -1))
+        .SIDE_EFFECT(_3(7, cpu_placement()))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+    CHECK(requested == std::vector<std::size_t>{1 << 20});
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *hello_resp =
+        resp_msg->responses()->Get(0)->response_as_HelloResponse();
+    REQUIRE(hello_resp != nullptr);
+    CHECK(hello_resp->max_frame_len() == 65536);
+}
+
+TEST_CASE("request_handler: hello in trusted mode") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b,
+        b.CreateVector({
+            CreateRequest(b, 42, AnyRequest::HelloRequest,
+                          CreateHelloRequest(
+                              b, 123, b.CreateString("some_client"), true)
+                              .Union()),
+        })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    auto const hello_is_trusted = [&](bool allow) {
+        auto rh = request_handler<mock_session>(
+            sess, std::reference_wrapper(write), [] {},
+            std::reference_wrapper(handle_error), {}, nullptr, allow);
+        REQUIRE_CALL(sess, hello("some_client", 123u, _, _, -1))
+            .SIDE_EFFECT(_3(7, cpu_placement()))
+            .TIMES(1);
+        ALLOW_CALL(sess, get_segment(_, _, _))
+            .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        return resp_msg->responses()
+            ->Get(0)
+            ->response_as_HelloResponse()
+            ->trusted();
+    };
+
+    CHECK(hello_is_trusted(true));
+    CHECK_FALSE(hello_is_trusted(false));
+}
+
+TEST_CASE("request_handler: read-only connection") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::HelloRequest,
+                             CreateHelloRequest(b, 123,
+                                                b.CreateString("consumer"),
+                                                false, QosClass::NORMAL, true)
+                                 .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    REQUIRE_CALL(sess, hello("consumer", 123u, _, _, -1))
+        .SIDE_EFFECT(_3(7, cpu_placement()))
+        .TIMES(1);
+    auto const spec = segment_spec{
+        fd_passing_segment_spec{"/tmp/sock.seg", "/tmp/sock.seg.ro"}, 16384};
+    REQUIRE_CALL(sess, get_segment(_, _, _))
+        .LR_SIDE_EFFECT(_1 < 1 ? _2(spec) : _3(Status::NO_SUCH_SEGMENT))
+        .TIMES(2);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(2);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+    auto const *hello_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *segs = hello_msg->responses()
+                           ->Get(0)
+                           ->response_as_HelloResponse()
+                           ->segments();
+    REQUIRE(segs->size() == 1);
+    auto const *seg = segs->Get(0)->spec();
+    CHECK(seg->read_only());
+    REQUIRE(seg->spec_type() == SegmentMappingSpec::FdPassingSpec);
+    CHECK(seg->spec_as_FdPassingSpec()->socket()->str() ==
+          "/tmp/sock.seg.ro");
+
+    // Alloc is rejected without reaching the session.
+    flatbuffers::FlatBufferBuilder b2;
+    b2.FinishSizePrefixed(CreateRequestMessage(
+        b2, b2.CreateVector({
+                CreateRequest(b2, 43, AnyRequest::AllocRequest,
+                              CreateAllocRequest(b2, 1000).Union()),
+            })));
+    CHECK_FALSE(rh.handle_message(b2.GetBufferSpan()));
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp = flatbuffers::GetSizePrefixedRoot<ResponseMessage>(
+                           resp_buf.data())
+                           ->responses()
+                           ->Get(0);
+    CHECK(resp->seqno() == 43);
+    CHECK(resp->status() == Status::READ_ONLY_CONNECTION);
+}
+
+TEST_CASE("check_request_message_bounds") {
+    using internal::check_request_message_bounds;
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector(std::vector<flatbuffers::Offset<Request>>{})));
+    auto const span = b.GetBufferSpan();
+    std::vector<std::uint8_t> bytes(span.begin(), span.end());
+    CHECK(check_request_message_bounds(bytes));
+
+    CHECK_FALSE(check_request_message_bounds(std::vector<std::uint8_t>{}));
+    CHECK_FALSE(check_request_message_bounds(
+        gsl::span<std::uint8_t const>(bytes).first(bytes.size() - 1)));
+
+    auto bad_root = bytes;
+    bad_root[4] = 0xff; // Root offset (little endian)
+    bad_root[5] = 0xff;
+    CHECK_FALSE(check_request_message_bounds(bad_root));
+}
+
 TEST_CASE("request_handler: quit") {
     mock_session sess;
     mock_writer write;
@@ -257,7 +707,6 @@ TEST_CASE("request_handler: quit") {
     REQUIRE_CALL(write, call(_))
         .LR_SIDE_EFFECT(resp_buf = std::move(_1))
         .TIMES(1);
-    REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
     CHECK(rh.handle_message(req_span));
     auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
@@ -292,7 +741,8 @@ TEST_CASE("request_handler: get_segment") {
     using trompeloeil::_;
 
     SUBCASE("posix_mmap") {
-        auto spec = segment_spec{posix_mmap_segment_spec{"/myshmem"}, 16384};
+        auto spec =
+            segment_spec{posix_mmap_segment_spec{"/myshmem"}, 16384, 555, 3};
         REQUIRE_CALL(sess, get_segment(7u, _, _))
             .LR_SIDE_EFFECT(_2(spec))
             .TIMES(1);
@@ -300,7 +750,6 @@ TEST_CASE("request_handler: get_segment") {
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -314,8 +763,11 @@ TEST_CASE("request_handler: get_segment") {
         CHECK(resp->seqno() == 42);
         CHECK(resp->status() == Status::OK);
         CHECK(resp->response_type() == AnyResponse::GetSegmentResponse);
-        auto const *seg = resp->response_as_GetSegmentResponse()->segment();
+        auto const *gsr = resp->response_as_GetSegmentResponse();
+        CHECK(gsr->generation() == 3);
+        auto const *seg = gsr->segment();
         CHECK(seg->size() == 16384);
+        CHECK(seg->identity() == 555);
         CHECK(seg->spec_type() == SegmentMappingSpec::PosixMmapSpec);
         auto const *mapping = seg->spec_as_PosixMmapSpec();
         CHECK(mapping->name()->str() == "/myshmem");
@@ -331,7 +783,6 @@ TEST_CASE("request_handler: get_segment") {
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -362,7 +813,6 @@ TEST_CASE("request_handler: get_segment") {
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -384,8 +834,8 @@ TEST_CASE("request_handler: get_segment") {
     }
 
     SUBCASE("win32") {
-        auto spec =
-            segment_spec{win32_segment_spec{"Local\\MyMapping", true}, 16384};
+        auto spec = segment_spec{
+            win32_segment_spec{"Local\\MyMapping", true, 1}, 16384};
         REQUIRE_CALL(sess, get_segment(7u, _, _))
             .LR_SIDE_EFFECT(_2(spec))
             .TIMES(1);
@@ -393,7 +843,6 @@ TEST_CASE("request_handler: get_segment") {
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -413,6 +862,35 @@ TEST_CASE("request_handler: get_segment") {
         auto const *mapping = seg->spec_as_Win32FileMappingSpec();
         CHECK(mapping->name()->str() == "Local\\MyMapping");
         CHECK(mapping->use_large_pages());
+        CHECK(mapping->numa_node() == 1);
+    }
+
+    SUBCASE("fd passing") {
+        auto spec = segment_spec{fd_passing_segment_spec{"/tmp/sock.seg"},
+                                 16384};
+        REQUIRE_CALL(sess, get_segment(7u, _, _))
+            .LR_SIDE_EFFECT(_2(spec))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resps = resp_msg->responses();
+        CHECK(resps->size() == 1);
+        auto const *resp = resps->Get(0);
+        CHECK(resp->status() == Status::OK);
+        auto const *seg = resp->response_as_GetSegmentResponse()->segment();
+        CHECK(seg->size() == 16384);
+        CHECK(seg->spec_type() == SegmentMappingSpec::FdPassingSpec);
+        auto const *mapping = seg->spec_as_FdPassingSpec();
+        CHECK(mapping->socket()->str() == "/tmp/sock.seg");
     }
 
     SUBCASE("failure") {
@@ -423,7 +901,6 @@ TEST_CASE("request_handler: get_segment") {
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -458,17 +935,19 @@ TEST_CASE("request_handler: alloc") {
     auto req_span = b.GetBufferSpan();
 
     using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
 
     SUBCASE("success") {
-        auto const rsrc = mock_resource{7, 4096, 1024};
-        REQUIRE_CALL(sess, alloc(1000, Policy::DEFAULT, _, _))
-            .SIDE_EFFECT(_3(common::token(12345), rsrc))
+        auto const rsrc = mock_resource{7, 4096, 1024, false};
+        REQUIRE_CALL(
+            sess, alloc_when_ready(1000, Policy::DEFAULT, -1, 0, _, _, _, _))
+            .SIDE_EFFECT(_5(common::token(12345), rsrc))
             .TIMES(1);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -487,18 +966,39 @@ TEST_CASE("request_handler: alloc") {
         CHECK(alloc_resp->object()->segment() == 7);
         CHECK(alloc_resp->object()->offset() == 4096);
         CHECK(alloc_resp->object()->size() == 1024);
-        CHECK_FALSE(alloc_resp->zeroed()); // Currently fixed
+        CHECK_FALSE(alloc_resp->zeroed());
+    }
+
+    SUBCASE("zero-filled object") {
+        auto const rsrc = mock_resource{7, 4096, 1024, true};
+        REQUIRE_CALL(
+            sess, alloc_when_ready(1000, Policy::DEFAULT, -1, 0, _, _, _, _))
+            .SIDE_EFFECT(_5(common::token(12345), rsrc))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *alloc_resp =
+            resp_msg->responses()->Get(0)->response_as_AllocResponse();
+        REQUIRE(alloc_resp != nullptr);
+        CHECK(alloc_resp->zeroed());
     }
 
     SUBCASE("failure") {
-        REQUIRE_CALL(sess, alloc(1000, Policy::DEFAULT, _, _))
-            .SIDE_EFFECT(_4(Status::OUT_OF_SHMEM))
+        REQUIRE_CALL(
+            sess, alloc_when_ready(1000, Policy::DEFAULT, -1, 0, _, _, _, _))
+            .SIDE_EFFECT(_6(Status::OUT_OF_SHMEM))
             .TIMES(1);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -513,17 +1013,202 @@ TEST_CASE("request_handler: alloc") {
         CHECK(resp->status() == Status::OUT_OF_SHMEM);
         CHECK(resp->response_type() == AnyResponse::NONE);
     }
-}
-
-TEST_CASE("request_handler: open") {
-    mock_session sess;
-    mock_writer write;
-    mock_error_handler handle_error;
-    auto rh = request_handler<mock_session>(
-        sess, std::reference_wrapper(write), [] {},
-        std::reference_wrapper(handle_error));
 
-    flatbuffers::FlatBufferBuilder b;
+    SUBCASE("deferred while allocations are held") {
+        std::function<void(common::token, mock_resource const &)>
+            deferred_success_cb;
+        REQUIRE_CALL(
+            sess, alloc_when_ready(1000, Policy::DEFAULT, -1, 0, _, _, _, _))
+            .LR_SIDE_EFFECT(deferred_success_cb = _7)
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+        deferred_success_cb(common::token(12345),
+                            mock_resource{7, 4096, 1024, false});
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        auto const *alloc_resp = resp->response_as_AllocResponse();
+        REQUIRE(alloc_resp != nullptr);
+        CHECK(alloc_resp->object()->key() == 12345);
+    }
+}
+
+TEST_CASE("request_handler: alloc primitive object") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(
+                   b, 42, AnyRequest::AllocRequest,
+                   CreateAllocRequest(b, 1000, Policy::PRIMITIVE).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+
+    auto const rsrc = mock_resource{7, 4096, 1024, false};
+    REQUIRE_CALL(
+        sess, alloc_when_ready(1000, Policy::PRIMITIVE, -1, 0, _, _, _, _))
+        .SIDE_EFFECT(_5(common::token(12345), rsrc))
+        .TIMES(1);
+    REQUIRE_CALL(sess, wake_word_offset(_)).RETURN(65540u).TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *alloc_resp =
+        resp_msg->responses()->Get(0)->response_as_AllocResponse();
+    REQUIRE(alloc_resp != nullptr);
+    CHECK(alloc_resp->object()->offset() == 4096);
+    CHECK(alloc_resp->wake_word() == 65540);
+}
+
+TEST_CASE("request_handler: alloc with wait") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(
+                   b, 42, AnyRequest::AllocRequest,
+                   CreateAllocRequest(b, 1000, Policy::DEFAULT, -1, 0, true)
+                       .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+
+    std::function<void(common::token, mock_resource const &)>
+        deferred_success_cb;
+    REQUIRE_CALL(sess,
+                 alloc_or_wait(1000, Policy::DEFAULT, -1, 0, _, _, _, _))
+        .LR_SIDE_EFFECT(deferred_success_cb = _7)
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    auto const rsrc = mock_resource{7, 4096, 1024, true};
+    deferred_success_cb(common::token(12345), rsrc);
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    auto const *alloc_resp = resp->response_as_AllocResponse();
+    REQUIRE(alloc_resp != nullptr);
+    CHECK(alloc_resp->object()->key() == 12345);
+    CHECK(alloc_resp->zeroed());
+}
+
+TEST_CASE("request_handler: alloc with extents") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::AllocRequest,
+                             CreateAllocRequest(b, 1000, Policy::DEFAULT, -1,
+                                                0, false, 4)
+                                 .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+
+    auto const rsrc = mock_resource{7, 4096, 512, true};
+    auto const more = std::array<mock_resource, 2>{
+        mock_resource{7, 8192, 256, true},
+        mock_resource{8, 0, 232, false},
+    };
+    REQUIRE_CALL(sess, alloc_extents(1000, 4, Policy::DEFAULT, -1, _, _))
+        .LR_SIDE_EFFECT(_5(common::token(12345), rsrc,
+                           gsl::span<mock_resource const>(more)))
+        .TIMES(1);
+
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    auto const *alloc_resp = resp->response_as_AllocResponse();
+    REQUIRE(alloc_resp != nullptr);
+    CHECK(alloc_resp->object()->key() == 12345);
+    CHECK_FALSE(alloc_resp->zeroed());
+    auto const *extents = alloc_resp->extents();
+    REQUIRE(extents != nullptr);
+    REQUIRE(extents->size() == 3);
+    CHECK(extents->Get(0)->offset() == 4096);
+    CHECK(extents->Get(1)->segment() == 7);
+    CHECK(extents->Get(1)->offset() == 8192);
+    CHECK(extents->Get(2)->segment() == 8);
+    CHECK(extents->Get(2)->size() == 232);
+}
+
+TEST_CASE("request_handler: open") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
     using namespace protocol;
     b.FinishSizePrefixed(CreateRequestMessage(
         b, b.CreateVector({
@@ -533,18 +1218,19 @@ TEST_CASE("request_handler: open") {
     auto req_span = b.GetBufferSpan();
 
     using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
 
     SUBCASE("immediate_success") {
-        auto const rsrc = mock_resource{7, 4096, 1024};
+        auto const rsrc = mock_resource{7, 4096, 1024, false};
         REQUIRE_CALL(sess, open(common::token(12345), Policy::DEFAULT, true, _,
-                                _, _, _, _))
+                                _, _, _, _, _, _))
             .SIDE_EFFECT(_5(common::token(23456), rsrc))
             .TIMES(1);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -567,14 +1253,13 @@ TEST_CASE("request_handler: open") {
 
     SUBCASE("immediate_failure") {
         REQUIRE_CALL(sess, open(common::token(12345), Policy::DEFAULT, true, _,
-                                _, _, _, _))
+                                _, _, _, _, _, _))
             .SIDE_EFFECT(_6(Status::NO_SUCH_OBJECT))
             .TIMES(1);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -594,10 +1279,9 @@ TEST_CASE("request_handler: open") {
         std::function<void(common::token, mock_resource const &)>
             deferred_success_cb;
         REQUIRE_CALL(sess, open(common::token(12345), Policy::DEFAULT, true, _,
-                                _, _, _, _))
+                                _, _, _, _, _, _))
             .LR_SIDE_EFFECT(deferred_success_cb = _7)
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -606,7 +1290,7 @@ TEST_CASE("request_handler: open") {
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
 
-        auto const rsrc = mock_resource{7, 4096, 1024};
+        auto const rsrc = mock_resource{7, 4096, 1024, false};
         deferred_success_cb(common::token(23456), rsrc);
 
         auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
@@ -629,10 +1313,9 @@ TEST_CASE("request_handler: open") {
     SUBCASE("deferred_failure") {
         std::function<void(Status)> deferred_error_cb;
         REQUIRE_CALL(sess, open(common::token(12345), Policy::DEFAULT, true, _,
-                                _, _, _, _))
+                                _, _, _, _, _, _))
             .LR_SIDE_EFFECT(deferred_error_cb = _8)
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -656,7 +1339,7 @@ TEST_CASE("request_handler: open") {
     }
 }
 
-TEST_CASE("request_handler: close") {
+TEST_CASE("request_handler: open with timeout") {
     mock_session sess;
     mock_writer write;
     mock_error_handler handle_error;
@@ -668,63 +1351,79 @@ TEST_CASE("request_handler: close") {
     using namespace protocol;
     b.FinishSizePrefixed(CreateRequestMessage(
         b, b.CreateVector({
-               CreateRequest(b, 42, AnyRequest::CloseRequest,
-                             CreateCloseRequest(b, 12345).Union()),
+               CreateRequest(b, 42, AnyRequest::OpenRequest,
+                             CreateOpenRequest(b, 12345, Policy::DEFAULT,
+                                               true, false, 250)
+                                 .Union()),
            })));
     auto req_span = b.GetBufferSpan();
 
     using trompeloeil::_;
+    std::function<void(Status)> deferred_error_cb;
+    REQUIRE_CALL(sess, open(common::token(12345), Policy::DEFAULT, true, _,
+                            _, _, _, _, std::chrono::milliseconds(250), _))
+        .LR_SIDE_EFFECT(deferred_error_cb = _8)
+        .TIMES(1);
 
-    SUBCASE("success") {
-        REQUIRE_CALL(sess, close(common::token(12345), _, _))
-            .SIDE_EFFECT(_2())
-            .TIMES(1);
-        flatbuffers::DetachedBuffer resp_buf;
-        REQUIRE_CALL(write, call(_))
-            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
-            .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
+    CHECK_FALSE(rh.handle_message(req_span));
 
-        CHECK_FALSE(rh.handle_message(req_span));
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
 
-        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
-        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
-        auto const *resp_msg =
-            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
-        auto const *resps = resp_msg->responses();
-        CHECK(resps->size() == 1);
-        auto const *resp = resps->Get(0);
-        CHECK(resp->seqno() == 42);
-        CHECK(resp->status() == Status::OK);
-        CHECK(resp->response_type() == AnyResponse::CloseResponse);
-    }
+    deferred_error_cb(Status::TIMED_OUT);
 
-    SUBCASE("immediate_failure") {
-        REQUIRE_CALL(sess, close(common::token(12345), _, _))
-            .SIDE_EFFECT(_3(Status::NO_SUCH_OBJECT))
-            .TIMES(1);
-        flatbuffers::DetachedBuffer resp_buf;
-        REQUIRE_CALL(write, call(_))
-            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
-            .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::TIMED_OUT);
+}
 
-        CHECK_FALSE(rh.handle_message(req_span));
+TEST_CASE("request_handler: open with lease") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
 
-        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
-        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
-        auto const *resp_msg =
-            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
-        auto const *resps = resp_msg->responses();
-        CHECK(resps->size() == 1);
-        auto const *resp = resps->Get(0);
-        CHECK(resp->seqno() == 42);
-        CHECK(resp->status() == Status::NO_SUCH_OBJECT);
-        CHECK(resp->response_type() == AnyResponse::NONE);
-    }
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::OpenRequest,
+                             CreateOpenRequest(b, 12345, Policy::DEFAULT,
+                                               true, false, 0, 5000)
+                                 .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+    auto const rsrc = mock_resource{7, 4096, 1024, false};
+    REQUIRE_CALL(sess, open(common::token(12345), Policy::DEFAULT, true, _,
+                            _, _, _, _, std::chrono::milliseconds(0),
+                            std::chrono::milliseconds(5000)))
+        .SIDE_EFFECT(_5(common::token(12345), rsrc))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
 }
 
-TEST_CASE("request_handler: share") {
+TEST_CASE("request_handler: renew leases") {
     mock_session sess;
     mock_writer write;
     mock_error_handler handle_error;
@@ -736,63 +1435,51 @@ TEST_CASE("request_handler: share") {
     using namespace protocol;
     b.FinishSizePrefixed(CreateRequestMessage(
         b, b.CreateVector({
-               CreateRequest(b, 42, AnyRequest::ShareRequest,
-                             CreateShareRequest(b, 12345).Union()),
+               CreateRequest(b, 42, AnyRequest::RenewLeasesRequest,
+                             CreateRenewLeasesRequest(b, 5000).Union()),
            })));
     auto req_span = b.GetBufferSpan();
 
     using trompeloeil::_;
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
 
     SUBCASE("success") {
-        REQUIRE_CALL(sess, share(common::token(12345), _, _))
-            .SIDE_EFFECT(_2())
-            .TIMES(1);
-        flatbuffers::DetachedBuffer resp_buf;
-        REQUIRE_CALL(write, call(_))
-            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        REQUIRE_CALL(sess,
+                     renew_leases(std::chrono::milliseconds(5000), _, _, _))
+            .SIDE_EFFECT(_3(true))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
-        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
-        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
         auto const *resp_msg =
             flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
-        auto const *resps = resp_msg->responses();
-        CHECK(resps->size() == 1);
-        auto const *resp = resps->Get(0);
+        auto const *resp = resp_msg->responses()->Get(0);
         CHECK(resp->seqno() == 42);
         CHECK(resp->status() == Status::OK);
-        CHECK(resp->response_type() == AnyResponse::ShareResponse);
+        auto const *renew_resp = resp->response_as_RenewLeasesResponse();
+        REQUIRE(renew_resp != nullptr);
+        CHECK(renew_resp->renewed());
     }
 
     SUBCASE("failure") {
-        REQUIRE_CALL(sess, share(common::token(12345), _, _))
-            .SIDE_EFFECT(_3(Status::NO_SUCH_OBJECT))
-            .TIMES(1);
-        flatbuffers::DetachedBuffer resp_buf;
-        REQUIRE_CALL(write, call(_))
-            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        REQUIRE_CALL(sess,
+                     renew_leases(std::chrono::milliseconds(5000), _, _, _))
+            .SIDE_EFFECT(_4(Status::INVALID_REQUEST))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
-        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
-        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
         auto const *resp_msg =
             flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
-        auto const *resps = resp_msg->responses();
-        CHECK(resps->size() == 1);
-        auto const *resp = resps->Get(0);
-        CHECK(resp->seqno() == 42);
-        CHECK(resp->status() == Status::NO_SUCH_OBJECT);
-        CHECK(resp->response_type() == AnyResponse::NONE);
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->status() == Status::INVALID_REQUEST);
     }
 }
 
-TEST_CASE("request_handler: unshare") {
+TEST_CASE("request_handler: new segment specs are sent once") {
     mock_session sess;
     mock_writer write;
     mock_error_handler handle_error;
@@ -804,22 +1491,209 @@ TEST_CASE("request_handler: unshare") {
     using namespace protocol;
     b.FinishSizePrefixed(CreateRequestMessage(
         b, b.CreateVector({
-               CreateRequest(b, 42, AnyRequest::UnshareRequest,
-                             CreateUnshareRequest(b, 12345).Union()),
+               CreateRequest(b, 42, AnyRequest::AllocRequest,
+                             CreateAllocRequest(b, 1000).Union()),
+               CreateRequest(b, 43, AnyRequest::OpenRequest,
+                             CreateOpenRequest(b, 12345).Union()),
            })));
     auto req_span = b.GetBufferSpan();
 
     using trompeloeil::_;
-
-    SUBCASE("immediate_success") {
-        REQUIRE_CALL(sess, unshare(common::token(12345), true, _, _, _, _))
-            .SIDE_EFFECT(_3(common::token(23456)))
-            .TIMES(1);
-        flatbuffers::DetachedBuffer resp_buf;
+    auto const spec = segment_spec{posix_mmap_segment_spec{"/myshmem"}, 16384};
+    auto const rsrc = mock_resource{7, 4096, 1024, false};
+    REQUIRE_CALL(sess, get_segment(7u, _, _))
+        .LR_SIDE_EFFECT(_2(spec))
+        .TIMES(1);
+    REQUIRE_CALL(sess,
+                 alloc_when_ready(1000, Policy::DEFAULT, -1, 0, _, _, _, _))
+        .SIDE_EFFECT(_5(common::token(12345), rsrc))
+        .TIMES(1);
+    REQUIRE_CALL(sess,
+                 open(common::token(12345), Policy::DEFAULT, true, _, _, _,
+                      _, _, _))
+        .SIDE_EFFECT(_5(common::token(23456), rsrc))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resps =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data())
+            ->responses();
+    REQUIRE(resps->size() == 2);
+    auto const *alloc_resp = resps->Get(0)->response_as_AllocResponse();
+    REQUIRE(alloc_resp->segment() != nullptr);
+    CHECK(alloc_resp->segment()->size() == 16384);
+    CHECK(alloc_resp->segment()->spec_type() ==
+          SegmentMappingSpec::PosixMmapSpec);
+    auto const *open_resp = resps->Get(1)->response_as_OpenResponse();
+    CHECK(open_resp->segment() == nullptr);
+}
+
+TEST_CASE("request_handler: close") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::CloseRequest,
+                             CreateCloseRequest(b, 12345).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    SUBCASE("success") {
+        REQUIRE_CALL(sess, close(common::token(12345), _, _))
+            .SIDE_EFFECT(_2())
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resps = resp_msg->responses();
+        CHECK(resps->size() == 1);
+        auto const *resp = resps->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        CHECK(resp->response_type() == AnyResponse::CloseResponse);
+    }
+
+    SUBCASE("immediate_failure") {
+        REQUIRE_CALL(sess, close(common::token(12345), _, _))
+            .SIDE_EFFECT(_3(Status::NO_SUCH_OBJECT))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resps = resp_msg->responses();
+        CHECK(resps->size() == 1);
+        auto const *resp = resps->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::NO_SUCH_OBJECT);
+        CHECK(resp->response_type() == AnyResponse::NONE);
+    }
+}
+
+TEST_CASE("request_handler: share") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::ShareRequest,
+                             CreateShareRequest(b, 12345).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    SUBCASE("success") {
+        REQUIRE_CALL(sess, share(common::token(12345), _, _))
+            .SIDE_EFFECT(_2())
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resps = resp_msg->responses();
+        CHECK(resps->size() == 1);
+        auto const *resp = resps->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        CHECK(resp->response_type() == AnyResponse::ShareResponse);
+    }
+
+    SUBCASE("failure") {
+        REQUIRE_CALL(sess, share(common::token(12345), _, _))
+            .SIDE_EFFECT(_3(Status::NO_SUCH_OBJECT))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resps = resp_msg->responses();
+        CHECK(resps->size() == 1);
+        auto const *resp = resps->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::NO_SUCH_OBJECT);
+        CHECK(resp->response_type() == AnyResponse::NONE);
+    }
+}
+
+TEST_CASE("request_handler: unshare") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::UnshareRequest,
+                             CreateUnshareRequest(b, 12345).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    SUBCASE("immediate_success") {
+        REQUIRE_CALL(sess, unshare(common::token(12345), true, _, _, _, _, _))
+            .SIDE_EFFECT(_3(common::token(23456)))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -839,14 +1713,13 @@ TEST_CASE("request_handler: unshare") {
     }
 
     SUBCASE("immediate_failure") {
-        REQUIRE_CALL(sess, unshare(common::token(12345), true, _, _, _, _))
+        REQUIRE_CALL(sess, unshare(common::token(12345), true, _, _, _, _, _))
             .SIDE_EFFECT(_4(Status::NO_SUCH_OBJECT))
             .TIMES(1);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -864,10 +1737,9 @@ TEST_CASE("request_handler: unshare") {
 
     SUBCASE("deferred_success") {
         std::function<void(common::token)> deferred_success_cb;
-        REQUIRE_CALL(sess, unshare(common::token(12345), true, _, _, _, _))
+        REQUIRE_CALL(sess, unshare(common::token(12345), true, _, _, _, _, _))
             .LR_SIDE_EFFECT(deferred_success_cb = _5)
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -895,10 +1767,9 @@ TEST_CASE("request_handler: unshare") {
 
     SUBCASE("deferred_failure") {
         std::function<void(Status)> deferred_error_cb;
-        REQUIRE_CALL(sess, unshare(common::token(12345), true, _, _, _, _))
+        REQUIRE_CALL(sess, unshare(common::token(12345), true, _, _, _, _, _))
             .LR_SIDE_EFFECT(deferred_error_cb = _6)
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -934,22 +1805,24 @@ TEST_CASE("request_handler: create_voucher") {
     using namespace protocol;
     b.FinishSizePrefixed(CreateRequestMessage(
         b, b.CreateVector({
-               CreateRequest(b, 42, AnyRequest::CreateVoucherRequest,
-                             CreateCreateVoucherRequest(b, 12345, 3).Union()),
+               CreateRequest(
+                   b, 42, AnyRequest::CreateVoucherRequest,
+                   CreateCreateVoucherRequest(b, 12345, 3, 250).Union()),
            })));
     auto req_span = b.GetBufferSpan();
 
     using trompeloeil::_;
 
     SUBCASE("success") {
-        REQUIRE_CALL(sess, create_voucher(common::token(12345), 3u, _, _, _))
-            .SIDE_EFFECT(_4(common::token(23456)))
+        REQUIRE_CALL(sess, create_voucher(common::token(12345), 3u, _,
+                                          std::chrono::milliseconds(250), _,
+                                          _))
+            .SIDE_EFFECT(_5(common::token(23456)))
             .TIMES(1);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -967,14 +1840,14 @@ TEST_CASE("request_handler: create_voucher") {
     }
 
     SUBCASE("failure") {
-        REQUIRE_CALL(sess, create_voucher(common::token(12345), 3u, _, _, _))
-            .SIDE_EFFECT(_5(Status::NO_SUCH_OBJECT))
+        REQUIRE_CALL(sess,
+                     create_voucher(common::token(12345), 3u, _, _, _, _))
+            .SIDE_EFFECT(_6(Status::NO_SUCH_OBJECT))
             .TIMES(1);
         flatbuffers::DetachedBuffer resp_buf;
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -1018,7 +1891,6 @@ TEST_CASE("request_handler: discard_voucher") {
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -1043,7 +1915,6 @@ TEST_CASE("request_handler: discard_voucher") {
         REQUIRE_CALL(write, call(_))
             .LR_SIDE_EFFECT(resp_buf = std::move(_1))
             .TIMES(1);
-        REQUIRE_CALL(sess, perform_housekeeping()).TIMES(AT_MOST(1));
 
         CHECK_FALSE(rh.handle_message(req_span));
 
@@ -1060,6 +1931,1550 @@ TEST_CASE("request_handler: discard_voucher") {
     }
 }
 
+TEST_CASE("request_handler: share with dedup") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::ShareRequest,
+                             CreateShareRequest(b, 12345, true).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+
+    auto const rsrc = mock_resource{7, 4096, 1024, false};
+    REQUIRE_CALL(sess, share_dedup(common::token(12345), _, _))
+        .SIDE_EFFECT(_2(common::token(23456), rsrc))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    REQUIRE(resp->response_type() == AnyResponse::ShareResponse);
+    auto const *share_resp = resp->response_as_ShareResponse();
+    REQUIRE(share_resp->object() != nullptr);
+    CHECK(share_resp->object()->key() == 23456);
+    CHECK(share_resp->object()->segment() == 7);
+    CHECK(share_resp->object()->size() == 1024);
+}
+
+TEST_CASE("request_handler: share_and_create_voucher") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(
+                   b, 42, AnyRequest::ShareAndCreateVoucherRequest,
+                   CreateShareAndCreateVoucherRequest(b, 12345, 3).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    SUBCASE("success") {
+        REQUIRE_CALL(sess, share_and_create_voucher(common::token(12345), 3u,
+                                                    _, _, _, _))
+            .SIDE_EFFECT(_5(common::token(23456)))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resps = resp_msg->responses();
+        CHECK(resps->size() == 1);
+        auto const *resp = resps->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        CHECK(resp->response_type() ==
+              AnyResponse::ShareAndCreateVoucherResponse);
+        CHECK(resp->response_as_ShareAndCreateVoucherResponse()->key() ==
+              23456);
+    }
+
+    SUBCASE("failure") {
+        REQUIRE_CALL(sess, share_and_create_voucher(common::token(12345), 3u,
+                                                    _, _, _, _))
+            .SIDE_EFFECT(_6(Status::NO_SUCH_OBJECT))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resps = resp_msg->responses();
+        CHECK(resps->size() == 1);
+        auto const *resp = resps->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::NO_SUCH_OBJECT);
+        CHECK(resp->response_type() == AnyResponse::NONE);
+    }
+}
+
+TEST_CASE("request_handler: create_pool") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(
+                   b, 42, AnyRequest::CreatePoolRequest,
+                   CreateCreatePoolRequest(b, 8, 4096, Policy::PRIMITIVE)
+                       .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    SUBCASE("success") {
+        REQUIRE_CALL(sess, create_pool(8u, 4096u, Policy::PRIMITIVE, _, _))
+            .SIDE_EFFECT(_4(3))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        CHECK(resp->response_type() == AnyResponse::CreatePoolResponse);
+        CHECK(resp->response_as_CreatePoolResponse()->pool() == 3);
+    }
+
+    SUBCASE("failure") {
+        REQUIRE_CALL(sess, create_pool(8u, 4096u, Policy::PRIMITIVE, _, _))
+            .SIDE_EFFECT(_5(Status::OUT_OF_SHMEM))
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->status() == Status::OUT_OF_SHMEM);
+        CHECK(resp->response_type() == AnyResponse::NONE);
+    }
+}
+
+TEST_CASE("request_handler: alloc_from_pool") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::AllocFromPoolRequest,
+                             CreateAllocFromPoolRequest(b, 3).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    auto const rsrc = mock_resource{7, 4096, 1024, false};
+    REQUIRE_CALL(sess, alloc_from_pool(3u, _, _))
+        .SIDE_EFFECT(_2(common::token(12345), rsrc))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::AllocFromPoolResponse);
+    auto const *obj = resp->response_as_AllocFromPoolResponse()->object();
+    CHECK(obj->key() == 12345);
+    CHECK(obj->segment() == 7);
+    CHECK(obj->offset() == 4096);
+    CHECK(obj->size() == 1024);
+}
+
+TEST_CASE("request_handler: destroy_pool") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::DestroyPoolRequest,
+                             CreateDestroyPoolRequest(b, 3).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    REQUIRE_CALL(sess, destroy_pool(3u, _, _)).SIDE_EFFECT(_2()).TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::DestroyPoolResponse);
+}
+
+TEST_CASE("request_handler: subscribe") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    auto topic = b.CreateString("news");
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::SubscribeRequest,
+                             CreateSubscribeRequest(b, topic, true).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    std::function<void(common::token, mock_resource const *)> notify_cb;
+    REQUIRE_CALL(sess, subscribe(_, true, _, _, _))
+        .WITH(_1 == "news")
+        .LR_SIDE_EFFECT(notify_cb = _3)
+        .SIDE_EFFECT(_4())
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(3);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::SubscribeResponse);
+
+    auto const rsrc = mock_resource{7, 4096, 1024, false};
+    notify_cb(common::token(23456), &rsrc);
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::NotificationResponse);
+    auto const *notif = resp->response_as_NotificationResponse();
+    CHECK(notif->key() == 23456);
+    REQUIRE(notif->object() != nullptr);
+    CHECK(notif->object()->key() == 23456);
+    CHECK(notif->object()->segment() == 7);
+    CHECK(notif->object()->offset() == 4096);
+    CHECK(notif->object()->size() == 1024);
+
+    notify_cb(common::token(34567), nullptr);
+    resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    notif = resp_msg->responses()->Get(0)->response_as_NotificationResponse();
+    CHECK(notif->key() == 34567);
+    CHECK(notif->object() == nullptr);
+}
+
+TEST_CASE("request_handler: ring") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::RingRequest,
+                             CreateRingRequest(b, 64, 256).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    SUBCASE("success") {
+        auto const rsrc = mock_resource{7, 4096, 16768, false};
+        REQUIRE_CALL(sess, alloc_ring(64, 256, -1, _, _, _, _))
+            .SIDE_EFFECT(_4(common::token(12345), rsrc))
+            .TIMES(1);
+        REQUIRE_CALL(sess, wake_word_offset(_)).RETURN(0u).TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        auto const *ring_resp = resp->response_as_RingResponse();
+        REQUIRE(ring_resp != nullptr);
+        CHECK(ring_resp->object()->key() == 12345);
+        CHECK(ring_resp->object()->size() == 16768);
+        CHECK(ring_resp->wake_word() == 0);
+    }
+
+    SUBCASE("failure") {
+        REQUIRE_CALL(sess, alloc_ring(64, 256, -1, _, _, _, _))
+            .SIDE_EFFECT(_5(Status::INVALID_REQUEST))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->status() == Status::INVALID_REQUEST);
+        CHECK(resp->response_type() == AnyResponse::NONE);
+    }
+}
+
+TEST_CASE("request_handler: subscribe relocation") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::SubscribeRelocationRequest,
+                             CreateSubscribeRelocationRequest(b).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    std::function<void(common::token)> notify_cb;
+    REQUIRE_CALL(sess, subscribe_relocation(_, _, _))
+        .LR_SIDE_EFFECT(notify_cb = _1)
+        .SIDE_EFFECT(_2())
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(2);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::SubscribeRelocationResponse);
+
+    notify_cb(common::token(23456));
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() ==
+          AnyResponse::RelocateNotificationResponse);
+    CHECK(resp->response_as_RelocateNotificationResponse()->key() == 23456);
+}
+
+TEST_CASE("request_handler: deferred responses are coalesced") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    std::vector<std::function<void()>> scheduled;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error),
+        [&](std::function<void()> f) { scheduled.push_back(std::move(f)); });
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    auto topic = b.CreateString("news");
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::SubscribeRequest,
+                             CreateSubscribeRequest(b, topic).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    std::function<void(common::token, mock_resource const *)> notify_cb;
+    REQUIRE_CALL(sess, subscribe(_, false, _, _, _))
+        .LR_SIDE_EFFECT(notify_cb = _3)
+        .SIDE_EFFECT(_4())
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    SUBCASE("flushed when scheduled") {
+        notify_cb(common::token(1), nullptr);
+        notify_cb(common::token(2), nullptr);
+        notify_cb(common::token(3), nullptr);
+        REQUIRE(scheduled.size() == 1);
+
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+        scheduled.front()();
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resps =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data())
+                ->responses();
+        REQUIRE(resps->size() == 3);
+        for (std::uint64_t i = 0; i < 3; ++i) {
+            auto const *resp = resps->Get(static_cast<unsigned>(i));
+            CHECK(resp->seqno() == 42);
+            CHECK(resp->response_as_NotificationResponse()->key() == i + 1);
+        }
+
+        // Nothing more to flush
+        scheduled.front()();
+    }
+
+    SUBCASE("flushed early when large") {
+        std::size_t count = 0;
+        resp_buf = flatbuffers::DetachedBuffer();
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+        for (;;) {
+            notify_cb(common::token(++count), nullptr);
+            if (resp_buf.size() > 0)
+                break;
+            REQUIRE(count < 10000);
+        }
+        CHECK(scheduled.size() == 1);
+        CHECK(resp_buf.size() <= 32768);
+    }
+
+    SUBCASE("flushed before immediate responses") {
+        notify_cb(common::token(1), nullptr);
+        REQUIRE_CALL(sess, subscribe(_, false, _, _, _))
+            .SIDE_EFFECT(_5(Status::INVALID_REQUEST))
+            .TIMES(1);
+        std::vector<AnyResponse> types;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(types.push_back(
+                flatbuffers::GetSizePrefixedRoot<ResponseMessage>(_1.data())
+                    ->responses()
+                    ->Get(0)
+                    ->response_type()))
+            .TIMES(2);
+        CHECK_FALSE(rh.handle_message(req_span));
+        CHECK(types == std::vector<AnyResponse>{
+                           AnyResponse::NotificationResponse,
+                           AnyResponse::NONE});
+    }
+}
+
+TEST_CASE("request_handler: unsubscribe") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    auto topic = b.CreateString("news");
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::UnsubscribeRequest,
+                             CreateUnsubscribeRequest(b, topic).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    REQUIRE_CALL(sess, unsubscribe(_, _, _))
+        .WITH(_1 == "news")
+        .SIDE_EFFECT(_3(Status::INVALID_REQUEST))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::INVALID_REQUEST);
+    CHECK(resp->response_type() == AnyResponse::NONE);
+}
+
+TEST_CASE("request_handler: publish") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    auto topic = b.CreateString("news");
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::PublishRequest,
+                             CreatePublishRequest(b, topic, 12345).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    REQUIRE_CALL(sess, publish(_, common::token(12345), _, _))
+        .WITH(_1 == "news")
+        .SIDE_EFFECT(_3(2))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::PublishResponse);
+    CHECK(resp->response_as_PublishResponse()->count() == 2);
+}
+
+TEST_CASE("request_handler: get_stats") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    allocation_profiler prof;
+    prof.set_sample_interval(4);
+    (void)prof.record_allocation("cl", 7, 100);
+    auto stats = daemon_stats([&prof] {
+        daemon_gauges g;
+        g.object_count = 5;
+        g.shmem.size = 4096;
+        g.client_count = 2;
+        g.alloc_profiler = &prof;
+        return g;
+    });
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error), {}, nullptr, false, &stats);
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 41, AnyRequest::PingRequest,
+                             CreatePingRequest(b).Union()),
+               CreateRequest(b, 42, AnyRequest::GetStatsRequest,
+                             CreateGetStatsRequest(b).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    // The ping was recorded before the stats were taken.
+    CHECK(stats.requests().latency(AnyRequest::PingRequest).count() == 1);
+    CHECK(stats.requests().latency(AnyRequest::GetStatsRequest).count() ==
+          1);
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(1);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    REQUIRE(resp->response_type() == AnyResponse::GetStatsResponse);
+    auto const *gs = resp->response_as_GetStatsResponse();
+    CHECK(gs->object_count() == 5);
+    CHECK(gs->shmem_size() == 4096);
+    CHECK(gs->client_count() == 2);
+    REQUIRE(gs->requests()->size() == 1);
+    auto const *ping = gs->requests()->Get(0);
+    CHECK(ping->request_type() ==
+          static_cast<std::uint8_t>(AnyRequest::PingRequest));
+    CHECK(ping->count() == 1);
+    CHECK(ping->latency_p50_ns() <= ping->latency_max_ns());
+    CHECK(gs->allocation_sample_interval() == 4);
+    REQUIRE(gs->allocation_profiles()->size() == 1);
+    auto const *ap = gs->allocation_profiles()->Get(0);
+    CHECK(ap->client_name()->str() == "cl");
+    CHECK(ap->client_pid() == 7);
+    CHECK(ap->sampled_allocations() == 1);
+    CHECK(ap->sampled_bytes() == 100);
+    CHECK(ap->live_samples() == 1);
+    REQUIRE(ap->size_log2_counts()->size() == 8); // (64, 128]
+    CHECK(ap->size_log2_counts()->Get(7) == 1);
+}
+
+TEST_CASE("request_handler: get_allocator_info") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::GetAllocatorInfoRequest,
+                             CreateGetAllocatorInfoRequest(b).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    REQUIRE_CALL(sess, get_allocator_info(_))
+        .SIDE_EFFECT(_1(4096, 1 << 20, std::vector<std::size_t>{4096, 8192}))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    auto const *info = resp->response_as_GetAllocatorInfoResponse();
+    REQUIRE(info != nullptr);
+    CHECK(info->granularity() == 4096);
+    CHECK(info->max_allocation_size() == 1 << 20);
+    REQUIRE(info->size_classes()->size() == 2);
+    CHECK(info->size_classes()->Get(1) == 8192);
+}
+
+TEST_CASE("request_handler: clone") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::CloneRequest,
+                             CreateCloneRequest(b, 12345).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    ALLOW_CALL(sess, get_segment(_, _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_SEGMENT));
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    SUBCASE("success") {
+        auto const rsrc = mock_resource{7, 8192, 1024, false};
+        REQUIRE_CALL(sess,
+                     clone(common::token(12345), Policy::DEFAULT, _, _))
+            .SIDE_EFFECT(_3(common::token(23456), rsrc))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        REQUIRE(resp->response_type() == AnyResponse::CloneResponse);
+        auto const *clone_resp = resp->response_as_CloneResponse();
+        CHECK(clone_resp->object()->key() == 23456);
+        CHECK(clone_resp->object()->segment() == 7);
+        CHECK(clone_resp->object()->offset() == 8192);
+        CHECK(clone_resp->object()->size() == 1024);
+    }
+
+    SUBCASE("failure") {
+        REQUIRE_CALL(sess,
+                     clone(common::token(12345), Policy::DEFAULT, _, _))
+            .SIDE_EFFECT(_4(Status::NO_SUCH_OBJECT))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::NO_SUCH_OBJECT);
+        CHECK(resp->response_type() == AnyResponse::NONE);
+    }
+}
+
+TEST_CASE("request_handler: fill") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    std::function<void()> work;
+    std::function<void()> done;
+    std::function<void(std::function<void()>, std::function<void()>)> offload;
+    bool offloading = false;
+    SUBCASE("immediate") {}
+    SUBCASE("offloaded") {
+        offloading = true;
+        offload = [&](std::function<void()> w, std::function<void()> d) {
+            work = std::move(w);
+            done = std::move(d);
+        };
+    }
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error), {}, nullptr, false, nullptr,
+        offload);
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(
+                   b, 42, AnyRequest::FillRequest,
+                   CreateFillRequest(
+                       b, 12345, 8, 100,
+                       b.CreateVector(std::vector<std::uint8_t>{1, 2, 3}))
+                       .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    std::array<std::uint8_t, 128> data{};
+    REQUIRE_CALL(sess, map_range(common::token(12345), 8, 100, true, _, _))
+        .LR_SIDE_EFFECT(_5(gsl::span<std::uint8_t>(data).subspan(8, 100), 0))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+    if (offloading) {
+        CHECK(resp_buf.size() == 0);
+        CHECK(data[8] == 0);
+        REQUIRE(work);
+        REQUIRE(done);
+        work();
+        done();
+    }
+
+    CHECK(data[7] == 0);
+    CHECK(data[8] == 1);
+    CHECK(data[9] == 2);
+    CHECK(data[10] == 3);
+    CHECK(data[107] == 2);
+    CHECK(data[108] == 0);
+
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::FillResponse);
+}
+
+TEST_CASE("request_handler: prefetch") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    std::function<void()> work;
+    std::function<void()> done;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error), {}, nullptr, false, nullptr,
+        [&](std::function<void()> w, std::function<void()> d) {
+            work = std::move(w);
+            done = std::move(d);
+        });
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::PrefetchRequest,
+                             CreatePrefetchRequest(b, 12345, true).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    SUBCASE("success") {
+        std::array<std::uint8_t, 128> data{};
+        REQUIRE_CALL(sess, map_for_prefetch(common::token(12345), _, _, _))
+            .LR_SIDE_EFFECT(_3(gsl::span<std::uint8_t>(data), 0))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+        CHECK(resp_buf.size() == 0);
+        REQUIRE(work);
+        REQUIRE(done);
+        work();
+        done();
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        CHECK(resp->response_type() == AnyResponse::PrefetchResponse);
+    }
+
+    SUBCASE("failure") {
+        REQUIRE_CALL(sess, map_for_prefetch(common::token(12345), _, _, _))
+            .SIDE_EFFECT(_4(Status::NO_SUCH_OBJECT))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+        CHECK_FALSE(work);
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::NO_SUCH_OBJECT);
+    }
+}
+
+TEST_CASE("request_handler: resize") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::ResizeRequest,
+                             CreateResizeRequest(b, 12345, 3000).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    SUBCASE("success") {
+        auto const rsrc = mock_resource{7, 4096, 3072, false};
+        REQUIRE_CALL(sess, resize(common::token(12345), 3000, _, _))
+            .LR_SIDE_EFFECT(_3(common::token(12345), rsrc))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        auto const *resize_resp = resp->response_as_ResizeResponse();
+        REQUIRE(resize_resp != nullptr);
+        CHECK(resize_resp->object()->key() == 12345);
+        CHECK(resize_resp->object()->offset() == 4096);
+        CHECK(resize_resp->object()->size() == 3072);
+    }
+
+    SUBCASE("failure") {
+        REQUIRE_CALL(sess, resize(common::token(12345), 3000, _, _))
+            .SIDE_EFFECT(_4(Status::OUT_OF_SHMEM))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OUT_OF_SHMEM);
+    }
+}
+
+TEST_CASE("request_handler: copy_range") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::CopyRangeRequest,
+                             CreateCopyRangeRequest(b, 12345, 0, 23456, 16, 32)
+                                 .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    std::array<std::uint8_t, 64> data{};
+    for (std::size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<std::uint8_t>(i);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    SUBCASE("success") {
+        std::array<std::uint8_t, 32> dest{};
+        REQUIRE_CALL(sess,
+                     map_range(common::token(12345), 0, 32, true, _, _))
+            .LR_SIDE_EFFECT(_5(gsl::span<std::uint8_t>(dest), 0))
+            .TIMES(1);
+        REQUIRE_CALL(sess,
+                     map_range(common::token(23456), 16, 32, false, _, _))
+            .LR_SIDE_EFFECT(
+                _5(gsl::span<std::uint8_t>(data).subspan(16, 32), 0))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        CHECK(dest[0] == 16);
+        CHECK(dest[31] == 47);
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        CHECK(resp->response_type() == AnyResponse::CopyRangeResponse);
+    }
+
+    SUBCASE("overlapping") {
+        REQUIRE_CALL(sess,
+                     map_range(common::token(12345), 0, 32, true, _, _))
+            .LR_SIDE_EFFECT(
+                _5(gsl::span<std::uint8_t>(data).subspan(0, 32), 0))
+            .TIMES(1);
+        REQUIRE_CALL(sess,
+                     map_range(common::token(23456), 16, 32, false, _, _))
+            .LR_SIDE_EFFECT(
+                _5(gsl::span<std::uint8_t>(data).subspan(16, 32), 0))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        CHECK(data[0] == 0);
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->status() == Status::INVALID_REQUEST);
+    }
+
+    SUBCASE("no such source") {
+        std::array<std::uint8_t, 32> dest{};
+        REQUIRE_CALL(sess,
+                     map_range(common::token(12345), 0, 32, true, _, _))
+            .LR_SIDE_EFFECT(_5(gsl::span<std::uint8_t>(dest), 0))
+            .TIMES(1);
+        REQUIRE_CALL(sess,
+                     map_range(common::token(23456), 16, 32, false, _, _))
+            .SIDE_EFFECT(_6(Status::NO_SUCH_OBJECT))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->status() == Status::NO_SUCH_OBJECT);
+    }
+}
+
+TEST_CASE("request_handler: alloc_many") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    auto sizes = b.CreateVector<std::uint64_t>({1000, 2000});
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(
+                   b, 42, AnyRequest::AllocManyRequest,
+                   CreateAllocManyRequest(b, sizes, Policy::DEFAULT, 1)
+                       .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    auto const rsrc = mock_resource{7, 4096, 1024, true};
+    REQUIRE_CALL(sess, alloc(1000, Policy::DEFAULT, 1, 0, _, _))
+        .SIDE_EFFECT(_5(common::token(12345), rsrc))
+        .TIMES(1);
+    REQUIRE_CALL(sess, alloc(2000, Policy::DEFAULT, 1, 0, _, _))
+        .SIDE_EFFECT(_6(Status::OUT_OF_SHMEM))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resps = resp_msg->responses();
+    CHECK(resps->size() == 1);
+    auto const *resp = resps->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::AllocManyResponse);
+    auto const *alloc_resp = resp->response_as_AllocManyResponse();
+    REQUIRE(alloc_resp->objects()->size() == 2);
+    REQUIRE(alloc_resp->statuses()->size() == 2);
+    CHECK(alloc_resp->objects()->Get(0)->key() == 12345);
+    CHECK(alloc_resp->objects()->Get(0)->segment() == 7);
+    CHECK(alloc_resp->objects()->Get(0)->offset() == 4096);
+    CHECK(alloc_resp->objects()->Get(0)->size() == 1024);
+    CHECK(alloc_resp->objects()->Get(1)->key() == 0);
+    CHECK(Status(alloc_resp->statuses()->Get(0)) == Status::OK);
+    CHECK(Status(alloc_resp->statuses()->Get(1)) == Status::OUT_OF_SHMEM);
+    REQUIRE(alloc_resp->zeroed()->size() == 2);
+    CHECK(alloc_resp->zeroed()->Get(0));
+    CHECK_FALSE(alloc_resp->zeroed()->Get(1));
+}
+
+TEST_CASE("request_handler: open_many") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    auto keys = b.CreateVector<std::uint64_t>({12345, 23456, 34567});
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(
+                   b, 42, AnyRequest::OpenManyRequest,
+                   CreateOpenManyRequest(b, keys, Policy::DEFAULT, true)
+                       .Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+    std::function<void(common::token, mock_resource const &)>
+        deferred_success_cb;
+    std::function<void(Status)> deferred_error_cb;
+    REQUIRE_CALL(sess, open(common::token(12345), Policy::DEFAULT, true, _, _,
+                            _, _, _, _, _))
+        .SIDE_EFFECT(
+            _5(common::token(45678), mock_resource{7, 4096, 1024, false}))
+        .TIMES(1);
+    REQUIRE_CALL(sess, open(common::token(23456), Policy::DEFAULT, true, _, _,
+                            _, _, _, _, _))
+        .LR_SIDE_EFFECT(deferred_success_cb = _7)
+        .TIMES(1);
+    REQUIRE_CALL(sess, open(common::token(34567), Policy::DEFAULT, true, _, _,
+                            _, _, _, _, _))
+        .LR_SIDE_EFFECT(deferred_error_cb = _8)
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    // No response until all keys are done.
+    deferred_success_cb(common::token(56789),
+                        mock_resource{8, 8192, 2048, false});
+
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+    deferred_error_cb(Status::NO_SUCH_OBJECT);
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    auto const *open_resp = resp->response_as_OpenManyResponse();
+    REQUIRE(open_resp != nullptr);
+    REQUIRE(open_resp->objects()->size() == 3);
+    REQUIRE(open_resp->statuses()->size() == 3);
+    CHECK(open_resp->objects()->Get(0)->key() == 45678);
+    CHECK(open_resp->objects()->Get(1)->key() == 56789);
+    CHECK(open_resp->objects()->Get(1)->segment() == 8);
+    CHECK(open_resp->objects()->Get(2)->key() == 0);
+    CHECK(Status(open_resp->statuses()->Get(0)) == Status::OK);
+    CHECK(Status(open_resp->statuses()->Get(1)) == Status::OK);
+    CHECK(Status(open_resp->statuses()->Get(2)) == Status::NO_SUCH_OBJECT);
+}
+
+TEST_CASE("request_handler: deferred open_many after deferred responses") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    std::vector<std::function<void()>> scheduled;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error),
+        [&](std::function<void()> f) { scheduled.push_back(std::move(f)); });
+
+    using namespace protocol;
+    using trompeloeil::_;
+
+    std::vector<flatbuffers::DetachedBuffer> resp_bufs;
+    ALLOW_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_bufs.push_back(std::move(_1)));
+
+    flatbuffers::FlatBufferBuilder b;
+    auto topic = b.CreateString("news");
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::SubscribeRequest,
+                             CreateSubscribeRequest(b, topic).Union()),
+           })));
+    std::function<void(common::token, mock_resource const *)> notify_cb;
+    REQUIRE_CALL(sess, subscribe(_, false, _, _, _))
+        .LR_SIDE_EFFECT(notify_cb = _3)
+        .SIDE_EFFECT(_4())
+        .TIMES(1);
+    CHECK_FALSE(rh.handle_message(b.GetBufferSpan()));
+    REQUIRE(resp_bufs.size() == 1);
+
+    flatbuffers::FlatBufferBuilder b2;
+    auto keys = b2.CreateVector(
+        std::vector<std::uint64_t>(internal::max_batch_size, 12345));
+    b2.FinishSizePrefixed(CreateRequestMessage(
+        b2, b2.CreateVector({
+                CreateRequest(
+                    b2, 43, AnyRequest::OpenManyRequest,
+                    CreateOpenManyRequest(b2, keys, Policy::DEFAULT, true)
+                        .Union()),
+            })));
+    std::vector<std::function<void(common::token, mock_resource const &)>>
+        open_cbs;
+    REQUIRE_CALL(sess, open(common::token(12345), Policy::DEFAULT, true, _, _,
+                            _, _, _, _, _))
+        .LR_SIDE_EFFECT(open_cbs.push_back(_7))
+        .TIMES(internal::max_batch_size);
+    CHECK_FALSE(rh.handle_message(b2.GetBufferSpan()));
+    REQUIRE(resp_bufs.size() == 1);
+
+    // Find how many notifications fill the deferred responses, then leave
+    // one fewer pending.
+    std::size_t count = 0;
+    while (resp_bufs.size() == 1) {
+        notify_cb(common::token(++count), nullptr);
+        REQUIRE(count < 10000);
+    }
+    for (std::size_t i = 1; i < count; ++i)
+        notify_cb(common::token(i), nullptr);
+    REQUIRE(resp_bufs.size() == 2);
+
+    for (auto &cb : open_cbs)
+        cb(common::token(56789), mock_resource{8, 8192, 2048, false});
+    for (auto &f : scheduled)
+        f();
+
+    REQUIRE(resp_bufs.size() > 3);
+    bool found = false;
+    for (auto const &buf : resp_bufs) {
+        CHECK(buf.size() <= common::max_message_frame_len);
+        auto verif = flatbuffers::Verifier(buf.data(), buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        for (auto const *resp :
+             *flatbuffers::GetSizePrefixedRoot<ResponseMessage>(buf.data())
+                  ->responses()) {
+            if (auto const *open_resp = resp->response_as_OpenManyResponse()) {
+                CHECK(resp->seqno() == 43);
+                CHECK(open_resp->objects()->size() ==
+                      internal::max_batch_size);
+                found = true;
+            }
+        }
+    }
+    CHECK(found);
+}
+
+TEST_CASE("request_handler: close_many") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    using namespace protocol;
+    using trompeloeil::_;
+
+    SUBCASE("mixed results") {
+        flatbuffers::FlatBufferBuilder b;
+        auto keys = b.CreateVector<std::uint64_t>({12345, 23456, 34567});
+        b.FinishSizePrefixed(CreateRequestMessage(
+            b, b.CreateVector({
+                   CreateRequest(b, 42, AnyRequest::CloseManyRequest,
+                                 CreateCloseManyRequest(b, keys).Union()),
+               })));
+        auto req_span = b.GetBufferSpan();
+
+        REQUIRE_CALL(sess, close(common::token(12345), _, _))
+            .SIDE_EFFECT(_2())
+            .TIMES(1);
+        REQUIRE_CALL(sess, close(common::token(23456), _, _))
+            .SIDE_EFFECT(_3(Status::NO_SUCH_OBJECT))
+            .TIMES(1);
+        REQUIRE_CALL(sess, close(common::token(34567), _, _))
+            .SIDE_EFFECT(_2())
+            .TIMES(1);
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resps = resp_msg->responses();
+        CHECK(resps->size() == 1);
+        auto const *resp = resps->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::OK);
+        CHECK(resp->response_type() == AnyResponse::CloseManyResponse);
+        auto const *statuses =
+            resp->response_as_CloseManyResponse()->statuses();
+        REQUIRE(statuses->size() == 3);
+        CHECK(Status(statuses->Get(0)) == Status::OK);
+        CHECK(Status(statuses->Get(1)) == Status::NO_SUCH_OBJECT);
+        CHECK(Status(statuses->Get(2)) == Status::OK);
+    }
+
+    SUBCASE("missing keys") {
+        flatbuffers::FlatBufferBuilder b;
+        b.FinishSizePrefixed(CreateRequestMessage(
+            b, b.CreateVector({
+                   CreateRequest(b, 42, AnyRequest::CloseManyRequest,
+                                 CreateCloseManyRequest(b).Union()),
+               })));
+        auto req_span = b.GetBufferSpan();
+
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->status() == Status::OK);
+        CHECK(resp->response_as_CloseManyResponse()->statuses()->size() ==
+              0);
+    }
+
+    SUBCASE("too many keys") {
+        flatbuffers::FlatBufferBuilder b;
+        auto keys = b.CreateVector(
+            std::vector<std::uint64_t>(internal::max_batch_size + 1, 12345));
+        b.FinishSizePrefixed(CreateRequestMessage(
+            b, b.CreateVector({
+                   CreateRequest(b, 42, AnyRequest::CloseManyRequest,
+                                 CreateCloseManyRequest(b, keys).Union()),
+               })));
+        auto req_span = b.GetBufferSpan();
+
+        // No calls to sess.close().
+        flatbuffers::DetachedBuffer resp_buf;
+        REQUIRE_CALL(write, call(_))
+            .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+            .TIMES(1);
+
+        CHECK_FALSE(rh.handle_message(req_span));
+
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+        auto const *resp = resp_msg->responses()->Get(0);
+        CHECK(resp->seqno() == 42);
+        CHECK(resp->status() == Status::INVALID_REQUEST);
+        CHECK(resp->response_type() == AnyResponse::NONE);
+    }
+}
+
+TEST_CASE("request_handler: large responses are split into messages") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    using namespace protocol;
+    using trompeloeil::_;
+
+    // Each response is over 2 KiB; together they exceed the default frame.
+    constexpr std::uint64_t n_requests = 16;
+    flatbuffers::FlatBufferBuilder b;
+    auto keys = b.CreateVector(
+        std::vector<std::uint64_t>(internal::max_batch_size, 12345));
+    std::vector<flatbuffers::Offset<Request>> reqs;
+    for (std::uint64_t i = 0; i < n_requests; ++i)
+        reqs.push_back(CreateRequest(b, 42 + i, AnyRequest::CloseManyRequest,
+                                     CreateCloseManyRequest(b, keys).Union()));
+    b.FinishSizePrefixed(CreateRequestMessage(b, b.CreateVector(reqs)));
+    auto req_span = b.GetBufferSpan();
+
+    ALLOW_CALL(sess, close(common::token(12345), _, _)).SIDE_EFFECT(_2());
+    std::vector<flatbuffers::DetachedBuffer> resp_bufs;
+    ALLOW_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_bufs.push_back(std::move(_1)));
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    CHECK(resp_bufs.size() > 1);
+    std::uint64_t next_seqno = 42;
+    for (auto const &buf : resp_bufs) {
+        CHECK(buf.size() <= common::max_message_frame_len);
+        auto verif = flatbuffers::Verifier(buf.data(), buf.size());
+        REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+        auto const *resp_msg =
+            flatbuffers::GetSizePrefixedRoot<ResponseMessage>(buf.data());
+        for (auto const *resp : *resp_msg->responses())
+            CHECK(resp->seqno() == next_seqno++);
+    }
+    CHECK(next_seqno == 42 + n_requests);
+}
+
+TEST_CASE("request_handler: share_many") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    auto keys = b.CreateVector<std::uint64_t>({12345, 23456});
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(b, 42, AnyRequest::ShareManyRequest,
+                             CreateShareManyRequest(b, keys).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    REQUIRE_CALL(sess, share(common::token(12345), _, _))
+        .SIDE_EFFECT(_3(Status::NO_SUCH_OBJECT))
+        .TIMES(1);
+    REQUIRE_CALL(sess, share(common::token(23456), _, _))
+        .SIDE_EFFECT(_2())
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::ShareManyResponse);
+    auto const *statuses = resp->response_as_ShareManyResponse()->statuses();
+    REQUIRE(statuses->size() == 2);
+    CHECK(Status(statuses->Get(0)) == Status::NO_SUCH_OBJECT);
+    CHECK(Status(statuses->Get(1)) == Status::OK);
+}
+
+TEST_CASE("request_handler: create_voucher_many") {
+    mock_session sess;
+    mock_writer write;
+    mock_error_handler handle_error;
+    auto rh = request_handler<mock_session>(
+        sess, std::reference_wrapper(write), [] {},
+        std::reference_wrapper(handle_error));
+
+    flatbuffers::FlatBufferBuilder b;
+    using namespace protocol;
+    auto keys = b.CreateVector<std::uint64_t>({12345, 23456});
+    b.FinishSizePrefixed(CreateRequestMessage(
+        b, b.CreateVector({
+               CreateRequest(
+                   b, 42, AnyRequest::CreateVoucherManyRequest,
+                   CreateCreateVoucherManyRequest(b, keys, 3).Union()),
+           })));
+    auto req_span = b.GetBufferSpan();
+
+    using trompeloeil::_;
+
+    REQUIRE_CALL(sess, create_voucher(common::token(12345), 3u, _, _, _, _))
+        .SIDE_EFFECT(_5(common::token(34567)))
+        .TIMES(1);
+    REQUIRE_CALL(sess, create_voucher(common::token(23456), 3u, _, _, _, _))
+        .SIDE_EFFECT(_6(Status::NO_SUCH_OBJECT))
+        .TIMES(1);
+    flatbuffers::DetachedBuffer resp_buf;
+    REQUIRE_CALL(write, call(_))
+        .LR_SIDE_EFFECT(resp_buf = std::move(_1))
+        .TIMES(1);
+
+    CHECK_FALSE(rh.handle_message(req_span));
+
+    auto verif = flatbuffers::Verifier(resp_buf.data(), resp_buf.size());
+    REQUIRE(verif.VerifySizePrefixedBuffer<ResponseMessage>(nullptr));
+    auto const *resp_msg =
+        flatbuffers::GetSizePrefixedRoot<ResponseMessage>(resp_buf.data());
+    auto const *resp = resp_msg->responses()->Get(0);
+    CHECK(resp->seqno() == 42);
+    CHECK(resp->status() == Status::OK);
+    CHECK(resp->response_type() == AnyResponse::CreateVoucherManyResponse);
+    auto const *cv_resp = resp->response_as_CreateVoucherManyResponse();
+    REQUIRE(cv_resp->keys()->size() == 2);
+    REQUIRE(cv_resp->statuses()->size() == 2);
+    CHECK(cv_resp->keys()->Get(0) == 34567);
+    CHECK(cv_resp->keys()->Get(1) == 0);
+    CHECK(Status(cv_resp->statuses()->Get(0)) == Status::OK);
+    CHECK(Status(cv_resp->statuses()->Get(1)) == Status::NO_SUCH_OBJECT);
+}
+
 // NOLINTEND(readability-magic-numbers)
 
 } // namespace partake::daemon
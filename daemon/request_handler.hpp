@@ -6,27 +6,46 @@
 
 #pragma once
 
+#include "allocation_profiler.hpp"
 #include "errors.hpp"
+#include "message.hpp"
+#include "numa.hpp"
 #include "overloaded.hpp"
+#include "page_residency.hpp"
+#include "parallel_copy.hpp"
 #include "partake_protocol_generated.h"
 #include "response_builder.hpp"
 #include "segment.hpp"
+#include "stats.hpp"
 #include "time_point.hpp"
 #include "token.hpp"
+#include "tracing.hpp"
 
 #include <gsl/pointers>
 #include <gsl/span>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 namespace partake::daemon {
 
 namespace internal {
 
+// For a read_only client, the spec is marked read-only and refers to the
+// read-only descriptor, if any.
 inline auto segment_spec_to_fb(flatbuffers::FlatBufferBuilder &fbb,
-                               segment_spec const &spec) {
+                               segment_spec const &spec,
+                               bool read_only = false) {
     auto [seg_type, seg_mapping_spec] = std::visit(
         common::overloaded{
             [&fbb](posix_mmap_segment_spec const &s) {
@@ -53,14 +72,45 @@ inline auto segment_spec_to_fb(flatbuffers::FlatBufferBuilder &fbb,
                 return std::make_pair(
                     protocol::SegmentMappingSpec::Win32FileMappingSpec,
                     protocol::CreateWin32FileMappingSpec(
-                        fbb, fbb.CreateString(s.name), s.use_large_pages)
+                        fbb, fbb.CreateString(s.name), s.use_large_pages,
+                        s.numa_node)
+                        .Union());
+            },
+            [&fbb, read_only](fd_passing_segment_spec const &s) {
+                return std::make_pair(
+                    protocol::SegmentMappingSpec::FdPassingSpec,
+                    protocol::CreateFdPassingSpec(
+                        fbb, fbb.CreateString(read_only ? s.read_only_socket
+                                                        : s.socket))
                         .Union());
             },
         },
         spec.spec);
 
     return protocol::CreateSegmentSpec(fbb, spec.size, seg_type,
-                                       seg_mapping_spec);
+                                       seg_mapping_spec, spec.identity,
+                                       read_only);
+}
+
+// Requests that write to shared memory (or give the client an object it may
+// write), which read-only clients may not make.
+constexpr auto is_write_request(protocol::AnyRequest type) noexcept -> bool {
+    using r = protocol::AnyRequest;
+    switch (type) {
+    case r::AllocRequest:
+    case r::AllocManyRequest:
+    case r::CreatePoolRequest:
+    case r::AllocFromPoolRequest:
+    case r::UnshareRequest:
+    case r::CloneRequest:
+    case r::FillRequest:
+    case r::CopyRangeRequest:
+    case r::RingRequest:
+    case r::ResizeRequest:
+        return true;
+    default:
+        return false;
+    }
 }
 
 template <typename Resource>
@@ -70,6 +120,61 @@ inline auto make_mapping(common::token key, Resource const &rsrc)
                              rsrc.size());
 }
 
+// All extents of a multi-extent object, starting with its resource; null if
+// 'more' is empty (the object is contiguous).
+template <typename Resource>
+inline auto make_extent_mappings(flatbuffers::FlatBufferBuilder &fbb,
+                                 common::token key, Resource const &first,
+                                 gsl::span<Resource const> more)
+    -> flatbuffers::Offset<flatbuffers::Vector<protocol::Mapping const *>> {
+    if (more.empty())
+        return {};
+    std::vector<protocol::Mapping> mappings;
+    mappings.reserve(more.size() + 1);
+    mappings.push_back(make_mapping(key, first));
+    for (auto const &rsrc : more)
+        mappings.push_back(make_mapping(key, rsrc));
+    return fbb.CreateVectorOfStructs(mappings);
+}
+
+// Maximum number of elements in a batched (*Many) request. The response to a
+// full AllocMany or OpenMany is about 19 KiB (mostly the 32-byte mappings),
+// within max_response_size, not counting the specs of any segments sent with
+// it.
+constexpr std::size_t max_batch_size = 512;
+
+// Room left in the response message frame before handling each request;
+// if less remains, the responses so far are written as a message of their
+// own. Only a Hello response (listing all segments) or one carrying many
+// segment specs can exceed this.
+constexpr std::size_t max_response_size = 24576;
+static_assert(max_response_size < common::max_message_frame_len);
+
+constexpr std::size_t max_fill_pattern_size = 256;
+
+inline auto ranges_overlap(gsl::span<std::uint8_t const> a,
+                           gsl::span<std::uint8_t const> b) -> bool {
+    return a.data() < b.data() + b.size() && b.data() < a.data() + a.size();
+}
+
+template <typename T>
+inline auto batch_size(flatbuffers::Vector<T> const *v) -> std::size_t {
+    return v == nullptr ? 0 : v->size();
+}
+
+// A missing string is treated as empty.
+inline auto string_view_of(flatbuffers::String const *str)
+    -> std::string_view {
+    if (str == nullptr)
+        return {};
+    return {str->c_str(), str->size()};
+}
+
+// Vectors of enums are stored as the underlying type.
+inline auto status_code(protocol::Status status) -> std::int32_t {
+    return static_cast<std::int32_t>(status);
+}
+
 inline auto verify_request_message(gsl::span<std::uint8_t const> bytes)
     -> bool {
     auto verifier = flatbuffers::Verifier(bytes.data(), bytes.size());
@@ -77,25 +182,100 @@ inline auto verify_request_message(gsl::span<std::uint8_t const> bytes)
         nullptr);
 }
 
+// Cheap check for trusted clients: the size prefix must match the frame and
+// the root table offset must point within it. Other offsets are not checked.
+inline auto check_request_message_bounds(gsl::span<std::uint8_t const> bytes)
+    -> bool {
+    using flatbuffers::uoffset_t;
+    if (bytes.size() < 2 * sizeof(uoffset_t))
+        return false;
+    auto const size = std::size_t(flatbuffers::GetPrefixedSize(bytes.data()));
+    if (size > bytes.size() - sizeof(uoffset_t))
+        return false;
+    auto const root = std::size_t(
+        flatbuffers::ReadScalar<uoffset_t>(bytes.data() + sizeof(uoffset_t)));
+    return root >= sizeof(uoffset_t) && root <= size - sizeof(uoffset_t);
+}
+
 } // namespace internal
 
-template <typename Session> class request_handler {
+// The per-message callbacks (WriteResponse, Housekeeping, ErrorHandler) may
+// be given as concrete function object types, so that calls to them can be
+// inlined; by default they are type-erased.
+template <typename Session,
+          typename WriteResponse =
+              std::function<void(flatbuffers::DetachedBuffer &&)>,
+          typename Housekeeping = std::function<void()>,
+          typename ErrorHandler = std::function<void(std::error_code)>>
+class request_handler {
     gsl::not_null<Session *> sess;
-    std::function<void(flatbuffers::DetachedBuffer &&)> write_resp;
-    std::function<void()> housekeep;
-    std::function<void(std::error_code)> handle_err; // Fatal message errors
+    WriteResponse write_resp;
+    Housekeeping housekeep;
+    ErrorHandler handle_err; // Fatal message errors
+    std::function<void(std::function<void()>)> schedule;
+    std::function<void(std::function<void()>, std::function<void()>)> offload;
+    std::function<void(protocol::QosClass)> set_qos;
+    std::function<auto(std::size_t)->std::size_t> negotiate_frame_len;
+    flatbuffers::Allocator *buf_alloc; // Null for default allocation
+    daemon_stats *stats;               // Null to disable
+    bool trusted_allowed;
+    bool trusted = false; // Skip full verification (granted at hello)
+    bool read_only = false; // Declared at hello
+    std::size_t max_frame_len = common::max_message_frame_len; // Granted
+
+    // Indexed by segment id: whether the client has been sent the segment's
+    // spec (with Hello, GetSegment, Alloc, or Open). Alloc and Open responses
+    // carry the spec of segments not yet sent, saving the client a
+    // GetSegment round trip.
+    std::vector<bool> segments_sent;
+
+    // Responses to deferred requests (which may complete in large numbers at
+    // once, e.g., when an object with many waiters is shared) are accumulated
+    // and written together when the function passed to 'schedule' is called.
+    // The message is written early if it gets large, or if the next
+    // response might not fit in the granted frame length.
+    std::optional<response_builder> deferred_rb;
+    static constexpr std::size_t max_deferred_bytes = 16384;
 
     using resource_type = typename Session::object_type::resource_type;
 
   public:
+    // If 'schedule_flush' is empty, deferred responses are written
+    // immediately. Otherwise it is called with a function that must be
+    // called later (typically after the current event loop handler returns).
+    // If 'buffer_allocator' is given, it is used for all response buffers
+    // and must outlive them. If 'allow_trusted' is true, the client may
+    // request (at hello) that its messages not be fully verified. If
+    // 'daemon_statistics' is given, request latencies are recorded in it and
+    // it is used to respond to stats requests. If 'offload_work' is given,
+    // bulk memory operations (Fill, CopyRange, Prefetch) are passed to it as
+    // 'work', to be run on another thread, and 'done', to be called on the
+    // daemon's thread once 'work' has returned; otherwise they are performed
+    // immediately. If 'set_qos_class' is given, it is called with the QoS
+    // class requested by the client at hello. If 'negotiate_max_frame_len'
+    // is given, it is called at hello with the maximum message frame length
+    // requested by the client (0 for the default) and returns the one
+    // granted; otherwise the default is granted.
     explicit request_handler(
-        Session &session,
-        std::function<void(flatbuffers::DetachedBuffer &&)> write_response,
-        std::function<void()> per_request_housekeeping,
-        std::function<void(std::error_code)> handle_error)
+        Session &session, WriteResponse write_response,
+        Housekeeping per_request_housekeeping, ErrorHandler handle_error,
+        std::function<void(std::function<void()>)> schedule_flush = {},
+        flatbuffers::Allocator *buffer_allocator = nullptr,
+        bool allow_trusted = false, daemon_stats *daemon_statistics = nullptr,
+        std::function<void(std::function<void()>, std::function<void()>)>
+            offload_work = {},
+        std::function<void(protocol::QosClass)> set_qos_class = {},
+        std::function<auto(std::size_t)->std::size_t>
+            negotiate_max_frame_len = {})
         : sess(&session), write_resp(std::move(write_response)),
           housekeep(std::move(per_request_housekeeping)),
-          handle_err(std::move(handle_error)) {}
+          handle_err(std::move(handle_error)),
+          schedule(std::move(schedule_flush)),
+          offload(std::move(offload_work)),
+          set_qos(std::move(set_qos_class)),
+          negotiate_frame_len(std::move(negotiate_max_frame_len)),
+          buf_alloc(buffer_allocator),
+          stats(daemon_statistics), trusted_allowed(allow_trusted) {}
 
     // No move or copy (reference taken by handlers)
     ~request_handler() = default;
@@ -106,7 +286,10 @@ template <typename Session> class request_handler {
 
     // Deserialize and handle one FlatBuffers message.
     auto handle_message(gsl::span<std::uint8_t const> bytes) -> bool {
-        if (not internal::verify_request_message(bytes)) {
+        bool const valid =
+            trusted ? internal::check_request_message_bounds(bytes)
+                    : internal::verify_request_message(bytes);
+        if (not valid) {
             handle_err(std::error_code(common::errc::invalid_message));
             return true;
         }
@@ -114,15 +297,29 @@ template <typename Session> class request_handler {
             flatbuffers::GetSizePrefixedRoot<protocol::RequestMessage>(
                 bytes.data());
         auto const *requests = req_msg->requests();
-        auto rb = response_builder(requests->size());
+        auto rb = response_builder(requests->size(), buf_alloc);
         auto now = clock::now();
+        auto start = now; // Of each request, if recording stats
 
         bool done = false;
         for (auto const *req : *requests) {
+            // Start a new message if this response might not fit.
+            auto const limit = max_frame_len - internal::max_response_size;
+            if (not rb.empty() && rb.frame_size() > limit) {
+                flush_deferred_responses();
+                write_resp(rb.release_buffer());
+                rb = response_builder(requests->size(), buf_alloc);
+            }
             auto type = req->request_type();
-            if (type >= protocol::AnyRequest::MIN &&
+            // NONE (the union's MIN) has no handler.
+            if (type > protocol::AnyRequest::NONE &&
                 type <= protocol::AnyRequest::MAX) {
                 done = handle_request(req, now, rb);
+                if (stats != nullptr) {
+                    auto const end = clock::now();
+                    stats->requests().record(type, end - start);
+                    start = end;
+                }
             } else {
                 // From here on, we can meaningfully report errors to the
                 // client. However, unexpected request type is a client bug, so
@@ -133,59 +330,218 @@ template <typename Session> class request_handler {
                     std::error_code(common::errc::invalid_request_type));
                 done = true;
             }
+            if (rb.frame_size() > max_frame_len) {
+                // The client could not read the message; drop it.
+                rb = response_builder(0, buf_alloc);
+                handle_err(std::error_code(common::errc::message_too_long));
+                done = true;
+            }
             if (done)
                 break;
         }
 
+        // Responses deferred during this message (e.g., notifications to
+        // ourselves) precede the immediate ones.
+        flush_deferred_responses();
         if (not rb.empty()) {
             write_resp(rb.release_buffer());
         }
 
-        // Rehash tables at most once per request message, after having
-        // kicked off responses (to increase the chance that it is done
-        // when the daemon is otherwise idle).
-        sess->perform_housekeeping();
+        // Maintenance such as rehashing tables is scheduled from here (once
+        // per request message, after having kicked off responses), not
+        // performed while handling requests.
         housekeep();
 
         return done;
     }
 
+    void flush_deferred_responses() {
+        if (not deferred_rb)
+            return;
+        auto buf = deferred_rb->release_buffer();
+        deferred_rb.reset();
+        write_resp(std::move(buf));
+    }
+
   private:
+    void mark_segment_sent(std::uint32_t segment_id) {
+        if (segment_id >= segments_sent.size())
+            segments_sent.resize(std::size_t(segment_id) + 1);
+        segments_sent[segment_id] = true;
+    }
+
+    auto wake_word_offset(protocol::Policy policy, resource_type const &rsrc)
+        -> std::uint64_t {
+        if (policy != protocol::Policy::PRIMITIVE)
+            return 0;
+        return sess->wake_word_offset(rsrc);
+    }
+
+    // Build the spec of the segment if it exists and has not yet been sent
+    // to the client (marking it sent); otherwise return null.
+    auto unsent_segment_spec(flatbuffers::FlatBufferBuilder &fbb,
+                             std::uint32_t segment_id)
+        -> flatbuffers::Offset<protocol::SegmentSpec> {
+        if (segment_id < segments_sent.size() && segments_sent[segment_id])
+            return {};
+        flatbuffers::Offset<protocol::SegmentSpec> ret;
+        sess->get_segment(
+            segment_id,
+            [&](segment_spec const &spec) {
+                ret = internal::segment_spec_to_fb(fbb, spec, read_only);
+                mark_segment_sent(segment_id);
+            },
+            [](protocol::Status status) { (void)status; });
+        return ret;
+    }
+
+    template <typename AddResponse>
+    void add_deferred_response(AddResponse add_response) {
+        // Keep the coalesced message within the frame, as in
+        // handle_message().
+        if (deferred_rb && deferred_rb->frame_size() +
+                                   internal::max_response_size >
+                               max_frame_len)
+            flush_deferred_responses();
+        bool const is_first = not deferred_rb;
+        if (is_first)
+            deferred_rb.emplace(1, buf_alloc);
+        add_response(*deferred_rb);
+        if (not schedule || deferred_rb->byte_size() >= max_deferred_bytes)
+            flush_deferred_responses();
+        else if (is_first)
+            schedule([this] { flush_deferred_responses(); });
+    }
+
+    // Perform 'work', on another thread if offloading, keeping 'keep_alive'
+    // (the objects whose data is accessed) until it is done; then add the
+    // response built by 'create_response'.
+    template <typename Work, typename KeepAlive, typename CreateResponse>
+    void perform_bulk_work(std::uint64_t seqno, response_builder &rb,
+                           Work work, KeepAlive keep_alive,
+                           CreateResponse create_response) {
+        auto const add_response = [seqno,
+                                   create_response](response_builder &rb2) {
+            rb2.add_successful_response(seqno,
+                                        create_response(rb2.fbbuilder()));
+        };
+        if (not offload) {
+            work();
+            add_response(rb);
+            return;
+        }
+        offload(std::move(work),
+                [this, add_response, keep = std::move(keep_alive)] {
+                    (void)keep;
+                    add_deferred_response(add_response);
+                });
+    }
+
     auto handle_request(protocol::Request const *req, time_point now,
                         response_builder &rb) -> bool {
         auto seqno = req->seqno();
         auto type = req->request_type();
-        switch (type) {
-            using r = protocol::AnyRequest;
-        case r::PingRequest:
-            return handle_ping(seqno, req->request_as_PingRequest(), rb);
-        case r::HelloRequest:
-            return handle_hello(seqno, req->request_as_HelloRequest(), rb);
-        case r::QuitRequest:
-            return handle_quit(seqno, req->request_as_QuitRequest(), rb);
-        case r::GetSegmentRequest:
-            return handle_get_segment(seqno,
-                                      req->request_as_GetSegmentRequest(), rb);
-        case r::AllocRequest:
-            return handle_alloc(seqno, req->request_as_AllocRequest(), rb);
-        case r::OpenRequest:
-            return handle_open(seqno, req->request_as_OpenRequest(), now, rb);
-        case r::CloseRequest:
-            return handle_close(seqno, req->request_as_CloseRequest(), rb);
-        case r::ShareRequest:
-            return handle_share(seqno, req->request_as_ShareRequest(), rb);
-        case r::UnshareRequest:
-            return handle_unshare(seqno, req->request_as_UnshareRequest(), rb);
-        case r::CreateVoucherRequest:
-            return handle_create_voucher(
-                seqno, req->request_as_CreateVoucherRequest(), now, rb);
-        case r::DiscardVoucherRequest:
-            return handle_discard_voucher(
-                seqno, req->request_as_DiscardVoucherRequest(), now, rb);
-        default:
-            assert(false); // Forgot to implement
-            std::terminate();
+        PARTAKE_TRACE2(request_dispatch, type, seqno);
+        if (read_only && internal::is_write_request(type)) {
+            rb.add_error_response(seqno,
+                                  protocol::Status::READ_ONLY_CONNECTION);
+            return false;
+        }
+        auto const handle = dispatch_table()[static_cast<std::size_t>(type)];
+        return (this->*handle)(req, now, rb);
+    }
+
+    // Handlers are looked up by request type in a table built at compile
+    // time from the schema's union traits; each entry casts the request to
+    // its type and calls the handler (with 'now' if it takes it).
+    using dispatch_fn = auto (request_handler::*)(protocol::Request const *,
+                                                  time_point,
+                                                  response_builder &) -> bool;
+    using dispatch_table_type =
+        std::array<dispatch_fn,
+                   static_cast<std::size_t>(protocol::AnyRequest::MAX) + 1>;
+
+    template <typename Req, auto Handle>
+    auto dispatch(protocol::Request const *req, time_point now,
+                  response_builder &rb) -> bool {
+        auto const *r = req->template request_as<Req>();
+        if constexpr (std::is_invocable_v<decltype(Handle), request_handler &,
+                                          std::uint64_t, Req const *,
+                                          time_point, response_builder &>)
+            return (this->*Handle)(req->seqno(), r, now, rb);
+        else
+            return (this->*Handle)(req->seqno(), r, rb);
+    }
+
+    template <typename Req, auto Handle>
+    static constexpr void add_dispatch(dispatch_table_type &t) {
+        t[static_cast<std::size_t>(
+            protocol::AnyRequestTraits<Req>::enum_value)] =
+            &request_handler::dispatch<Req, Handle>;
+    }
+
+    static constexpr auto make_dispatch_table() -> dispatch_table_type {
+        namespace p = protocol;
+        using self = request_handler;
+        dispatch_table_type t{};
+        add_dispatch<p::PingRequest, &self::handle_ping>(t);
+        add_dispatch<p::HelloRequest, &self::handle_hello>(t);
+        add_dispatch<p::QuitRequest, &self::handle_quit>(t);
+        add_dispatch<p::GetSegmentRequest, &self::handle_get_segment>(t);
+        add_dispatch<p::AllocRequest, &self::handle_alloc>(t);
+        add_dispatch<p::OpenRequest, &self::handle_open>(t);
+        add_dispatch<p::CloseRequest, &self::handle_close>(t);
+        add_dispatch<p::ShareRequest, &self::handle_share>(t);
+        add_dispatch<p::UnshareRequest, &self::handle_unshare>(t);
+        add_dispatch<p::CreateVoucherRequest, &self::handle_create_voucher>(t);
+        add_dispatch<p::DiscardVoucherRequest,
+                     &self::handle_discard_voucher>(t);
+        add_dispatch<p::AllocManyRequest, &self::handle_alloc_many>(t);
+        add_dispatch<p::CloseManyRequest, &self::handle_close_many>(t);
+        add_dispatch<p::ShareManyRequest, &self::handle_share_many>(t);
+        add_dispatch<p::CreateVoucherManyRequest,
+                     &self::handle_create_voucher_many>(t);
+        add_dispatch<p::ShareAndCreateVoucherRequest,
+                     &self::handle_share_and_create_voucher>(t);
+        add_dispatch<p::CreatePoolRequest, &self::handle_create_pool>(t);
+        add_dispatch<p::AllocFromPoolRequest,
+                     &self::handle_alloc_from_pool>(t);
+        add_dispatch<p::DestroyPoolRequest, &self::handle_destroy_pool>(t);
+        add_dispatch<p::SubscribeRequest, &self::handle_subscribe>(t);
+        add_dispatch<p::UnsubscribeRequest, &self::handle_unsubscribe>(t);
+        add_dispatch<p::PublishRequest, &self::handle_publish>(t);
+        add_dispatch<p::GetStatsRequest, &self::handle_get_stats>(t);
+        add_dispatch<p::CloneRequest, &self::handle_clone>(t);
+        add_dispatch<p::FillRequest, &self::handle_fill>(t);
+        add_dispatch<p::CopyRangeRequest, &self::handle_copy_range>(t);
+        add_dispatch<p::SubscribeRelocationRequest,
+                     &self::handle_subscribe_relocation>(t);
+        add_dispatch<p::RingRequest, &self::handle_ring>(t);
+        add_dispatch<p::OpenManyRequest, &self::handle_open_many>(t);
+        add_dispatch<p::GetAllocatorInfoRequest,
+                     &self::handle_get_allocator_info>(t);
+        add_dispatch<p::PrefetchRequest, &self::handle_prefetch>(t);
+        add_dispatch<p::ResizeRequest, &self::handle_resize>(t);
+        add_dispatch<p::RenewLeasesRequest, &self::handle_renew_leases>(t);
+        return t;
+    }
+
+    // Every type but NONE (which handle_message() rejects) has a handler.
+    static constexpr auto
+    is_complete_dispatch_table(dispatch_table_type const &t) -> bool {
+        for (auto i = static_cast<std::size_t>(protocol::AnyRequest::NONE) + 1;
+             i < t.size(); ++i) {
+            if (t[i] == nullptr)
+                return false;
         }
+        return true;
+    }
+
+    static auto dispatch_table() -> dispatch_table_type const & {
+        static constexpr auto table = make_dispatch_table();
+        static_assert(is_complete_dispatch_table(table),
+                      "Handler missing for request type");
+        return table;
     }
 
     auto handle_ping(std::uint64_t seqno, protocol::PingRequest const *req,
@@ -200,16 +556,52 @@ template <typename Session> class request_handler {
     auto handle_hello(std::uint64_t seqno, protocol::HelloRequest const *req,
                       response_builder &rb) -> bool {
         auto const *name = req->name();
+        auto const *pool = req->pool();
+        if (pool != nullptr && pool->size() > 0 &&
+            not sess->bind_sub_pool({pool->c_str(), pool->size()})) {
+            rb.add_error_response(seqno, protocol::Status::INVALID_REQUEST);
+            return false;
+        }
         sess->hello(
             {name->c_str(), name->size()}, req->pid(),
-            [seqno, &rb](std::uint32_t session_id) {
+            [seqno, &rb, this, want_trusted = req->trusted(),
+             qos = req->qos(), want_read_only = req->read_only(),
+             want_frame_len = req->max_frame_len()](
+                std::uint32_t session_id, cpu_placement const &placement) {
+                // Takes effect from the next request message.
+                trusted = want_trusted && trusted_allowed;
+                read_only = want_read_only;
+                if (set_qos)
+                    set_qos(qos);
+                auto const frame_len = static_cast<std::uint32_t>(
+                    negotiate_frame_len ? negotiate_frame_len(want_frame_len)
+                                        : 0);
+                if (frame_len != 0) // The client accepts it from now on
+                    max_frame_len = frame_len;
                 auto &fbb = rb.fbbuilder();
-                auto resp = protocol::CreateHelloResponse(fbb, session_id);
+                std::vector<flatbuffers::Offset<protocol::NumberedSegmentSpec>>
+                    segs;
+                for (std::uint32_t i = 0;; ++i) { // Segment ids are dense
+                    auto const seg_spec = unsent_segment_spec(fbb, i);
+                    if (seg_spec.IsNull())
+                        break;
+                    segs.push_back(
+                        protocol::CreateNumberedSegmentSpec(fbb, i, seg_spec));
+                }
+                auto const l3_cpus =
+                    placement.l3_cpus.empty()
+                        ? flatbuffers::Offset<flatbuffers::Vector<int>>()
+                        : fbb.CreateVector(placement.l3_cpus);
+                auto resp = protocol::CreateHelloResponse(
+                    fbb, session_id, trusted, fbb.CreateVector(segs),
+                    frame_len, placement.cpu, placement.numa_node,
+                    placement.l3_cache_id, l3_cpus);
                 rb.add_successful_response(seqno, resp);
             },
             [seqno, &rb](protocol::Status status) {
                 rb.add_error_response(seqno, status);
-            });
+            },
+            req->cpu());
         return false;
     }
 
@@ -227,10 +619,14 @@ template <typename Session> class request_handler {
                             response_builder &rb) -> bool {
         sess->get_segment(
             req->segment(),
-            [seqno, &rb](segment_spec const &spec) {
+            [seqno, &rb, this, seg_id = req->segment()](
+                segment_spec const &spec) {
+                mark_segment_sent(seg_id);
                 auto &fbb = rb.fbbuilder();
-                auto seg_spec = internal::segment_spec_to_fb(fbb, spec);
-                auto resp = protocol::CreateGetSegmentResponse(fbb, seg_spec);
+                auto seg_spec =
+                    internal::segment_spec_to_fb(fbb, spec, read_only);
+                auto resp = protocol::CreateGetSegmentResponse(
+                    fbb, seg_spec, spec.generation);
                 rb.add_successful_response(seqno, resp);
             },
             [seqno, &rb](protocol::Status status) {
@@ -241,46 +637,157 @@ template <typename Session> class request_handler {
 
     auto handle_alloc(std::uint64_t seqno, protocol::AllocRequest const *req,
                       response_builder &rb) -> bool {
-        sess->alloc(
-            req->size(), req->policy(),
-            [seqno, &rb](common::token k, resource_type const &rsrc) {
-                auto &fbb = rb.fbbuilder();
-                auto mapping = internal::make_mapping(k, rsrc);
-                auto resp = protocol::CreateAllocResponse(fbb, &mapping);
-                rb.add_successful_response(seqno, resp);
-            },
-            [seqno, &rb](protocol::Status status) {
-                rb.add_error_response(seqno, status);
+        auto const add_response = [seqno, this, policy = req->policy()](
+                                      response_builder &rb2, common::token k,
+                                      resource_type const &rsrc) {
+            auto &fbb = rb2.fbbuilder();
+            auto mapping = internal::make_mapping(k, rsrc);
+            auto seg_spec = unsent_segment_spec(fbb, rsrc.segment_id());
+            auto resp = protocol::CreateAllocResponse(
+                fbb, &mapping, rsrc.is_zeroed(), seg_spec,
+                wake_word_offset(policy, rsrc));
+            rb2.add_successful_response(seqno, resp);
+        };
+        auto const success = [&rb, add_response](common::token k,
+                                                 resource_type const &rsrc) {
+            add_response(rb, k, rsrc);
+        };
+        auto const error = [seqno, &rb](protocol::Status status) {
+            rb.add_error_response(seqno, status);
+        };
+        auto const deferred_success = [this, add_response](
+                                          common::token k,
+                                          resource_type const &rsrc) {
+            add_deferred_response(
+                [&](response_builder &rb2) { add_response(rb2, k, rsrc); });
+        };
+        auto const deferred_error = [seqno, this](protocol::Status status) {
+            add_deferred_response([&](response_builder &rb2) {
+                rb2.add_error_response(seqno, status);
             });
+        };
+        if (req->max_extents() != 1) {
+            if (req->wait()) {
+                error(protocol::Status::INVALID_REQUEST);
+                return false;
+            }
+            sess->alloc_extents(
+                req->size(), req->max_extents(), req->policy(),
+                req->numa_node(),
+                [seqno, &rb, this, policy = req->policy()](
+                    common::token k, resource_type const &rsrc,
+                    gsl::span<resource_type const> more) {
+                    auto &fbb = rb.fbbuilder();
+                    auto mapping = internal::make_mapping(k, rsrc);
+                    auto seg_spec =
+                        unsent_segment_spec(fbb, rsrc.segment_id());
+                    auto extents =
+                        internal::make_extent_mappings(fbb, k, rsrc, more);
+                    bool const zeroed =
+                        rsrc.is_zeroed() &&
+                        std::all_of(more.begin(), more.end(),
+                                    [](resource_type const &r) {
+                                        return r.is_zeroed();
+                                    });
+                    auto resp = protocol::CreateAllocResponse(
+                        fbb, &mapping, zeroed, seg_spec,
+                        wake_word_offset(policy, rsrc), extents);
+                    rb.add_successful_response(seqno, resp);
+                },
+                error);
+            return false;
+        }
+        if (req->wait()) {
+            sess->alloc_or_wait(req->size(), req->policy(), req->numa_node(),
+                                req->alignment(), success, error,
+                                deferred_success, deferred_error);
+        } else {
+            sess->alloc_when_ready(req->size(), req->policy(),
+                                   req->numa_node(), req->alignment(), success,
+                                   error, deferred_success, deferred_error);
+        }
         return false;
     }
 
     auto handle_open(std::uint64_t seqno, protocol::OpenRequest const *req,
                      time_point now, response_builder &rb) -> bool {
+        auto const policy = req->policy();
+        if (req->accept_extents()) {
+            auto const add_response =
+                [seqno, this, policy](response_builder &rb2, common::token k,
+                                      resource_type const &rsrc,
+                                      gsl::span<resource_type const> more) {
+                    auto &fbb = rb2.fbbuilder();
+                    auto mapping = internal::make_mapping(k, rsrc);
+                    auto seg_spec =
+                        unsent_segment_spec(fbb, rsrc.segment_id());
+                    auto extents =
+                        internal::make_extent_mappings(fbb, k, rsrc, more);
+                    auto resp = protocol::CreateOpenResponse(
+                        fbb, &mapping, seg_spec,
+                        wake_word_offset(policy, rsrc), extents);
+                    rb2.add_successful_response(seqno, resp);
+                };
+            sess->open_extents(
+                common::token(req->key()), policy, req->wait(), now,
+                [&rb, add_response](common::token k,
+                                    resource_type const &rsrc,
+                                    gsl::span<resource_type const> more) {
+                    add_response(rb, k, rsrc, more);
+                },
+                [seqno, &rb](protocol::Status status) {
+                    rb.add_error_response(seqno, status);
+                },
+                [this, add_response](common::token k,
+                                     resource_type const &rsrc,
+                                     gsl::span<resource_type const> more) {
+                    add_deferred_response([&](response_builder &rb2) {
+                        add_response(rb2, k, rsrc, more);
+                    });
+                },
+                [seqno, this](protocol::Status status) {
+                    add_deferred_response([&](response_builder &rb2) {
+                        rb2.add_error_response(seqno, status);
+                    });
+                },
+                std::chrono::milliseconds(req->timeout_ms()),
+                std::chrono::milliseconds(req->lease_ms()));
+            return false;
+        }
         sess->open(
-            common::token(req->key()), req->policy(), req->wait(), now,
-            [seqno, &rb](common::token k, resource_type const &rsrc) {
+            common::token(req->key()), policy, req->wait(), now,
+            [seqno, &rb, this, policy](common::token k,
+                                       resource_type const &rsrc) {
                 auto &fbb = rb.fbbuilder();
                 auto mapping = internal::make_mapping(k, rsrc);
-                auto resp = protocol::CreateOpenResponse(fbb, &mapping);
+                auto seg_spec = unsent_segment_spec(fbb, rsrc.segment_id());
+                auto resp = protocol::CreateOpenResponse(
+                    fbb, &mapping, seg_spec, wake_word_offset(policy, rsrc));
                 rb.add_successful_response(seqno, resp);
             },
             [seqno, &rb](protocol::Status status) {
                 rb.add_error_response(seqno, status);
             },
-            [seqno, this](common::token k, resource_type const &rsrc) {
-                auto rb2 = response_builder(1);
-                auto &fbb = rb2.fbbuilder();
-                auto mapping = internal::make_mapping(k, rsrc);
-                auto resp = protocol::CreateOpenResponse(fbb, &mapping);
-                rb2.add_successful_response(seqno, resp);
-                write_resp(rb2.release_buffer());
+            [seqno, this, policy](common::token k,
+                                  resource_type const &rsrc) {
+                add_deferred_response([&](response_builder &rb2) {
+                    auto &fbb = rb2.fbbuilder();
+                    auto mapping = internal::make_mapping(k, rsrc);
+                    auto seg_spec =
+                        unsent_segment_spec(fbb, rsrc.segment_id());
+                    auto resp = protocol::CreateOpenResponse(
+                        fbb, &mapping, seg_spec,
+                        wake_word_offset(policy, rsrc));
+                    rb2.add_successful_response(seqno, resp);
+                });
             },
             [seqno, this](protocol::Status status) {
-                auto rb2 = response_builder(1);
-                rb2.add_error_response(seqno, status);
-                write_resp(rb2.release_buffer());
-            });
+                add_deferred_response([&](response_builder &rb2) {
+                    rb2.add_error_response(seqno, status);
+                });
+            },
+            std::chrono::milliseconds(req->timeout_ms()),
+            std::chrono::milliseconds(req->lease_ms()));
         return false;
     }
 
@@ -299,8 +806,42 @@ template <typename Session> class request_handler {
         return false;
     }
 
+    auto handle_renew_leases(std::uint64_t seqno,
+                             protocol::RenewLeasesRequest const *req,
+                             time_point now, response_builder &rb) -> bool {
+        sess->renew_leases(
+            std::chrono::milliseconds(req->lease_ms()), now,
+            [seqno, &rb](bool renewed) {
+                auto &fbb = rb.fbbuilder();
+                auto resp = protocol::CreateRenewLeasesResponse(fbb, renewed);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
     auto handle_share(std::uint64_t seqno, protocol::ShareRequest const *req,
                       response_builder &rb) -> bool {
+        if (req->dedup()) {
+            sess->share_dedup(
+                common::token(req->key()),
+                [seqno, &rb, this](common::token k,
+                                   resource_type const &rsrc) {
+                    auto &fbb = rb.fbbuilder();
+                    auto mapping = internal::make_mapping(k, rsrc);
+                    auto seg_spec =
+                        unsent_segment_spec(fbb, rsrc.segment_id());
+                    auto resp =
+                        protocol::CreateShareResponse(fbb, &mapping, seg_spec);
+                    rb.add_successful_response(seqno, resp);
+                },
+                [seqno, &rb](protocol::Status status) {
+                    rb.add_error_response(seqno, status);
+                });
+            return false;
+        }
         sess->share(
             common::token(req->key()),
             [seqno, &rb]() {
@@ -329,17 +870,34 @@ template <typename Session> class request_handler {
                 rb.add_error_response(seqno, status);
             },
             [seqno, this](common::token new_key) {
-                auto rb2 = response_builder(1);
-                auto &fbb = rb2.fbbuilder();
-                auto resp =
-                    protocol::CreateUnshareResponse(fbb, new_key.as_u64());
-                rb2.add_successful_response(seqno, resp);
-                write_resp(rb2.release_buffer());
+                add_deferred_response([&](response_builder &rb2) {
+                    auto &fbb = rb2.fbbuilder();
+                    auto resp = protocol::CreateUnshareResponse(
+                        fbb, new_key.as_u64());
+                    rb2.add_successful_response(seqno, resp);
+                });
             },
             [seqno, this](protocol::Status status) {
-                auto rb2 = response_builder(1);
-                rb2.add_error_response(seqno, status);
-                write_resp(rb2.release_buffer());
+                add_deferred_response([&](response_builder &rb2) {
+                    rb2.add_error_response(seqno, status);
+                });
+            },
+            std::chrono::milliseconds(req->timeout_ms()));
+        return false;
+    }
+
+    auto handle_resize(std::uint64_t seqno, protocol::ResizeRequest const *req,
+                       response_builder &rb) -> bool {
+        sess->resize(
+            common::token(req->key()), req->size(),
+            [seqno, &rb](common::token k, resource_type const &rsrc) {
+                auto &fbb = rb.fbbuilder();
+                auto mapping = internal::make_mapping(k, rsrc);
+                auto resp = protocol::CreateResizeResponse(fbb, &mapping);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
             });
         return false;
     }
@@ -349,6 +907,7 @@ template <typename Session> class request_handler {
                                time_point now, response_builder &rb) -> bool {
         sess->create_voucher(
             common::token(req->key()), req->count(), now,
+            std::chrono::milliseconds(req->ttl_ms()),
             [seqno, &rb](common::token voucher_key) {
                 auto &fbb = rb.fbbuilder();
                 auto resp = protocol::CreateCreateVoucherResponse(
@@ -377,6 +936,602 @@ template <typename Session> class request_handler {
             });
         return false;
     }
+
+    auto handle_share_and_create_voucher(
+        std::uint64_t seqno, protocol::ShareAndCreateVoucherRequest const *req,
+        time_point now, response_builder &rb) -> bool {
+        sess->share_and_create_voucher(
+            common::token(req->key()), req->count(), now,
+            std::chrono::milliseconds(req->ttl_ms()),
+            [seqno, &rb](common::token voucher_key) {
+                auto &fbb = rb.fbbuilder();
+                auto resp = protocol::CreateShareAndCreateVoucherResponse(
+                    fbb, voucher_key.as_u64());
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    auto handle_create_pool(std::uint64_t seqno,
+                            protocol::CreatePoolRequest const *req,
+                            response_builder &rb) -> bool {
+        sess->create_pool(
+            req->count(), req->size(), req->policy(),
+            [seqno, &rb](std::uint32_t pool_id) {
+                auto &fbb = rb.fbbuilder();
+                auto resp = protocol::CreateCreatePoolResponse(fbb, pool_id);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    auto handle_alloc_from_pool(std::uint64_t seqno,
+                                protocol::AllocFromPoolRequest const *req,
+                                response_builder &rb) -> bool {
+        sess->alloc_from_pool(
+            req->pool(),
+            [seqno, &rb](common::token k, resource_type const &rsrc) {
+                auto &fbb = rb.fbbuilder();
+                auto mapping = internal::make_mapping(k, rsrc);
+                auto resp =
+                    protocol::CreateAllocFromPoolResponse(fbb, &mapping);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    auto handle_destroy_pool(std::uint64_t seqno,
+                             protocol::DestroyPoolRequest const *req,
+                             response_builder &rb) -> bool {
+        sess->destroy_pool(
+            req->pool(),
+            [seqno, &rb]() {
+                auto &fbb = rb.fbbuilder();
+                auto resp = protocol::CreateDestroyPoolResponse(fbb);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    // Notifications are deferred responses with the seqno of the subscribe
+    // request.
+    auto handle_subscribe(std::uint64_t seqno,
+                          protocol::SubscribeRequest const *req,
+                          response_builder &rb) -> bool {
+        sess->subscribe(
+            internal::string_view_of(req->topic()), req->auto_open(),
+            [seqno, this](common::token k, resource_type const *rsrc) {
+                add_deferred_response([&](response_builder &rb2) {
+                    auto &fbb = rb2.fbbuilder();
+                    auto resp = [&] {
+                        if (rsrc == nullptr)
+                            return protocol::CreateNotificationResponse(
+                                fbb, k.as_u64());
+                        auto mapping = internal::make_mapping(k, *rsrc);
+                        return protocol::CreateNotificationResponse(
+                            fbb, k.as_u64(), &mapping);
+                    }();
+                    rb2.add_successful_response(seqno, resp);
+                });
+            },
+            [seqno, &rb]() {
+                auto &fbb = rb.fbbuilder();
+                auto resp = protocol::CreateSubscribeResponse(fbb);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    auto handle_unsubscribe(std::uint64_t seqno,
+                            protocol::UnsubscribeRequest const *req,
+                            response_builder &rb) -> bool {
+        sess->unsubscribe(
+            internal::string_view_of(req->topic()),
+            [seqno, &rb]() {
+                auto &fbb = rb.fbbuilder();
+                auto resp = protocol::CreateUnsubscribeResponse(fbb);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    auto handle_publish(std::uint64_t seqno,
+                        protocol::PublishRequest const *req,
+                        response_builder &rb) -> bool {
+        sess->publish(
+            internal::string_view_of(req->topic()), common::token(req->key()),
+            [seqno, &rb](std::uint32_t count) {
+                auto &fbb = rb.fbbuilder();
+                auto resp = protocol::CreatePublishResponse(fbb, count);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    // Stats are reported as zero if not enabled.
+    auto handle_get_stats(std::uint64_t seqno,
+                          protocol::GetStatsRequest const *req,
+                          response_builder &rb) -> bool {
+        (void)req;
+        auto &fbb = rb.fbbuilder();
+        std::vector<flatbuffers::Offset<protocol::RequestTypeStats>> reqs;
+        daemon_gauges gauges;
+        if (stats != nullptr) {
+            gauges = stats->gauges();
+            auto const ns = [](std::chrono::nanoseconds d) {
+                return static_cast<std::uint64_t>(d.count());
+            };
+            for (std::size_t i = 0; i < request_stats::type_count; ++i) {
+                auto const &lat = stats->requests().latency(
+                    static_cast<protocol::AnyRequest>(i));
+                if (lat.count() == 0)
+                    continue;
+                reqs.push_back(protocol::CreateRequestTypeStats(
+                    fbb, static_cast<std::uint8_t>(i), lat.count(),
+                    ns(lat.quantile(0.5)), ns(lat.quantile(0.99)),
+                    ns(lat.quantile(0.999)), ns(lat.max())));
+            }
+        }
+        auto resp = protocol::CreateGetStatsResponse(
+            fbb, fbb.CreateVector(reqs), gauges.object_count,
+            gauges.voucher_count,
+            static_cast<std::uint32_t>(gauges.segment_count),
+            gauges.shmem.size, gauges.shmem.free, gauges.shmem.largest_free,
+            gauges.shmem.free_chunks,
+            static_cast<std::uint32_t>(gauges.client_count),
+            gauges.queued_messages, gauges.max_client_queued_messages,
+            gauges.alloc_profiler != nullptr
+                ? gauges.alloc_profiler->sample_interval()
+                : 0,
+            create_allocation_profiles(fbb, gauges.alloc_profiler));
+        rb.add_successful_response(seqno, resp);
+        return false;
+    }
+
+    static auto
+    create_allocation_profiles(flatbuffers::FlatBufferBuilder &fbb,
+                               allocation_profiler const *profiler)
+        -> flatbuffers::Offset<flatbuffers::Vector<
+            flatbuffers::Offset<protocol::ClientAllocationProfile>>> {
+        std::vector<flatbuffers::Offset<protocol::ClientAllocationProfile>>
+            profs;
+        if (profiler != nullptr) {
+            auto const ns = [](std::chrono::nanoseconds d) {
+                return static_cast<std::uint64_t>(d.count());
+            };
+            for (auto const &p : profiler->profiles()) {
+                auto const &counts = p.size_log2_counts;
+                auto const nonzero_end =
+                    std::find_if(counts.rbegin(), counts.rend(),
+                                 [](std::uint64_t c) { return c != 0; })
+                        .base();
+                std::vector<std::uint64_t> const sizes(counts.begin(),
+                                                       nonzero_end);
+                profs.push_back(protocol::CreateClientAllocationProfile(
+                    fbb, fbb.CreateString(p.client_name), p.client_pid,
+                    p.sampled_allocations, p.sampled_bytes, p.live_samples,
+                    fbb.CreateVector(sizes), ns(p.lifetimes.quantile(0.5)),
+                    ns(p.lifetimes.quantile(0.99)), ns(p.lifetimes.max())));
+            }
+        }
+        return fbb.CreateVector(profs);
+    }
+
+    auto handle_get_allocator_info(
+        std::uint64_t seqno, protocol::GetAllocatorInfoRequest const *req,
+        response_builder &rb) -> bool {
+        (void)req;
+        sess->get_allocator_info(
+            [seqno, &rb](std::size_t granularity,
+                         std::size_t max_allocation_size,
+                         std::vector<std::size_t> const &size_classes) {
+                auto &fbb = rb.fbbuilder();
+                std::vector<std::uint64_t> const classes(size_classes.begin(),
+                                                         size_classes.end());
+                auto resp = protocol::CreateGetAllocatorInfoResponse(
+                    fbb, granularity, max_allocation_size,
+                    fbb.CreateVector(classes));
+                rb.add_successful_response(seqno, resp);
+            });
+        return false;
+    }
+
+    auto handle_clone(std::uint64_t seqno, protocol::CloneRequest const *req,
+                      response_builder &rb) -> bool {
+        sess->clone(
+            common::token(req->key()), req->policy(),
+            [seqno, &rb, this](common::token k, resource_type const &rsrc) {
+                auto &fbb = rb.fbbuilder();
+                auto mapping = internal::make_mapping(k, rsrc);
+                auto seg_spec = unsent_segment_spec(fbb, rsrc.segment_id());
+                auto resp =
+                    protocol::CreateCloneResponse(fbb, &mapping, seg_spec);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    auto handle_fill(std::uint64_t seqno, protocol::FillRequest const *req,
+                     response_builder &rb) -> bool {
+        std::vector<std::uint8_t> pattern;
+        if (auto const *pat = req->pattern()) {
+            if (pat->size() > internal::max_fill_pattern_size) {
+                rb.add_error_response(seqno,
+                                      protocol::Status::INVALID_REQUEST);
+                return false;
+            }
+            pattern.assign(pat->begin(), pat->end());
+        }
+        sess->map_range(
+            common::token(req->key()), req->offset(), req->size(), true,
+            [&](gsl::span<std::uint8_t> dest, auto keep_alive) {
+                perform_bulk_work(
+                    seqno, rb,
+                    [dest, pat = std::move(pattern)] {
+                        parallel_fill(dest.data(), dest.size(), pat);
+                    },
+                    std::move(keep_alive), [](auto &fbb) {
+                        return protocol::CreateFillResponse(fbb);
+                    });
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    auto handle_copy_range(std::uint64_t seqno,
+                           protocol::CopyRangeRequest const *req,
+                           response_builder &rb) -> bool {
+        auto const add_error = [seqno, &rb](protocol::Status status) {
+            rb.add_error_response(seqno, status);
+        };
+        sess->map_range(
+            common::token(req->dest_key()), req->dest_offset(), req->size(),
+            true,
+            [&](gsl::span<std::uint8_t> dest, auto dest_keep_alive) {
+                sess->map_range(
+                    common::token(req->source_key()), req->source_offset(),
+                    req->size(), false,
+                    [&](gsl::span<std::uint8_t> src, auto src_keep_alive) {
+                        if (internal::ranges_overlap(dest, src))
+                            return add_error(
+                                protocol::Status::INVALID_REQUEST);
+                        perform_bulk_work(
+                            seqno, rb,
+                            [dest, src] {
+                                parallel_copy(dest.data(), src.data(),
+                                              dest.size());
+                            },
+                            std::make_pair(std::move(dest_keep_alive),
+                                           std::move(src_keep_alive)),
+                            [](auto &fbb) {
+                                return protocol::CreateCopyRangeResponse(fbb);
+                            });
+                    },
+                    add_error);
+            },
+            add_error);
+        return false;
+    }
+
+    auto handle_prefetch(std::uint64_t seqno,
+                         protocol::PrefetchRequest const *req, time_point now,
+                         response_builder &rb) -> bool {
+        sess->map_for_prefetch(
+            common::token(req->key()), now,
+            [&](gsl::span<std::uint8_t> bytes, auto keep_alive) {
+                perform_bulk_work(
+                    seqno, rb,
+                    [bytes, touch = req->touch()] {
+                        (void)prefetch_pages(bytes.data(), bytes.size(),
+                                             touch);
+                    },
+                    std::move(keep_alive), [](auto &fbb) {
+                        return protocol::CreatePrefetchResponse(fbb);
+                    });
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    // As with handle_subscribe(), notifications are deferred responses with
+    // the seqno of the subscribe request.
+    auto handle_subscribe_relocation(
+        std::uint64_t seqno, protocol::SubscribeRelocationRequest const *req,
+        response_builder &rb) -> bool {
+        (void)req;
+        sess->subscribe_relocation(
+            [seqno, this](common::token k) {
+                add_deferred_response([&](response_builder &rb2) {
+                    auto &fbb = rb2.fbbuilder();
+                    auto resp = protocol::CreateRelocateNotificationResponse(
+                        fbb, k.as_u64());
+                    rb2.add_successful_response(seqno, resp);
+                });
+            },
+            [seqno, &rb]() {
+                auto &fbb = rb.fbbuilder();
+                auto resp = protocol::CreateSubscribeRelocationResponse(fbb);
+                rb.add_successful_response(seqno, resp);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            });
+        return false;
+    }
+
+    auto handle_ring(std::uint64_t seqno, protocol::RingRequest const *req,
+                     response_builder &rb) -> bool {
+        auto const add_response = [seqno, this](response_builder &rb2,
+                                                common::token k,
+                                                resource_type const &rsrc) {
+            auto &fbb = rb2.fbbuilder();
+            auto mapping = internal::make_mapping(k, rsrc);
+            auto seg_spec = unsent_segment_spec(fbb, rsrc.segment_id());
+            auto resp = protocol::CreateRingResponse(
+                fbb, &mapping, seg_spec,
+                wake_word_offset(protocol::Policy::PRIMITIVE, rsrc));
+            rb2.add_successful_response(seqno, resp);
+        };
+        sess->alloc_ring(
+            req->slot_size(), req->slot_count(), req->numa_node(),
+            [&rb, add_response](common::token k, resource_type const &rsrc) {
+                add_response(rb, k, rsrc);
+            },
+            [seqno, &rb](protocol::Status status) {
+                rb.add_error_response(seqno, status);
+            },
+            [this, add_response](common::token k, resource_type const &rsrc) {
+                add_deferred_response([&](response_builder &rb2) {
+                    add_response(rb2, k, rsrc);
+                });
+            },
+            [seqno, this](protocol::Status status) {
+                add_deferred_response([&](response_builder &rb2) {
+                    rb2.add_error_response(seqno, status);
+                });
+            });
+        return false;
+    }
+
+    // The batched requests below only use session operations that complete
+    // immediately, so each produces exactly one response.
+
+    auto handle_alloc_many(std::uint64_t seqno,
+                           protocol::AllocManyRequest const *req,
+                           response_builder &rb) -> bool {
+        auto const *sizes = req->sizes();
+        auto const n = internal::batch_size(sizes);
+        if (n > internal::max_batch_size) {
+            rb.add_error_response(seqno, protocol::Status::INVALID_REQUEST);
+            return false;
+        }
+        std::vector<protocol::Mapping> mappings;
+        std::vector<std::int32_t> statuses;
+        std::vector<bool> zeroed;
+        mappings.reserve(n);
+        statuses.reserve(n);
+        zeroed.reserve(n);
+        for (flatbuffers::uoffset_t i = 0; i < n; ++i) {
+            sess->alloc(
+                sizes->Get(i), req->policy(), req->numa_node(), 0,
+                [&](common::token k, resource_type const &rsrc) {
+                    mappings.push_back(internal::make_mapping(k, rsrc));
+                    statuses.push_back(
+                        internal::status_code(protocol::Status::OK));
+                    zeroed.push_back(rsrc.is_zeroed());
+                },
+                [&](protocol::Status status) {
+                    mappings.emplace_back();
+                    statuses.push_back(internal::status_code(status));
+                    zeroed.push_back(false);
+                });
+        }
+        auto &fbb = rb.fbbuilder();
+        auto resp = protocol::CreateAllocManyResponse(
+            fbb, fbb.CreateVectorOfStructs(mappings),
+            fbb.CreateVector(statuses), fbb.CreateVector(zeroed));
+        rb.add_successful_response(seqno, resp);
+        return false;
+    }
+
+    auto handle_close_many(std::uint64_t seqno,
+                           protocol::CloseManyRequest const *req,
+                           response_builder &rb) -> bool {
+        if (internal::batch_size(req->keys()) > internal::max_batch_size) {
+            rb.add_error_response(seqno, protocol::Status::INVALID_REQUEST);
+            return false;
+        }
+        auto statuses = statuses_for_keys(
+            req->keys(), [this](common::token key, auto on_success,
+                                auto on_error) {
+                sess->close(key, on_success, on_error);
+            });
+        auto &fbb = rb.fbbuilder();
+        auto resp =
+            protocol::CreateCloseManyResponse(fbb, fbb.CreateVector(statuses));
+        rb.add_successful_response(seqno, resp);
+        return false;
+    }
+
+    auto handle_share_many(std::uint64_t seqno,
+                           protocol::ShareManyRequest const *req,
+                           response_builder &rb) -> bool {
+        if (internal::batch_size(req->keys()) > internal::max_batch_size) {
+            rb.add_error_response(seqno, protocol::Status::INVALID_REQUEST);
+            return false;
+        }
+        auto statuses = statuses_for_keys(
+            req->keys(), [this](common::token key, auto on_success,
+                                auto on_error) {
+                sess->share(key, on_success, on_error);
+            });
+        auto &fbb = rb.fbbuilder();
+        auto resp =
+            protocol::CreateShareManyResponse(fbb, fbb.CreateVector(statuses));
+        rb.add_successful_response(seqno, resp);
+        return false;
+    }
+
+    auto handle_create_voucher_many(
+        std::uint64_t seqno, protocol::CreateVoucherManyRequest const *req,
+        time_point now, response_builder &rb) -> bool {
+        auto const *keys = req->keys();
+        auto const n = internal::batch_size(keys);
+        if (n > internal::max_batch_size) {
+            rb.add_error_response(seqno, protocol::Status::INVALID_REQUEST);
+            return false;
+        }
+        std::vector<std::uint64_t> voucher_keys;
+        std::vector<std::int32_t> statuses;
+        voucher_keys.reserve(n);
+        statuses.reserve(n);
+        for (flatbuffers::uoffset_t i = 0; i < n; ++i) {
+            sess->create_voucher(
+                common::token(keys->Get(i)), req->count(), now,
+                std::chrono::milliseconds(req->ttl_ms()),
+                [&](common::token voucher_key) {
+                    voucher_keys.push_back(voucher_key.as_u64());
+                    statuses.push_back(
+                        internal::status_code(protocol::Status::OK));
+                },
+                [&](protocol::Status status) {
+                    voucher_keys.push_back(0);
+                    statuses.push_back(internal::status_code(status));
+                });
+        }
+        auto &fbb = rb.fbbuilder();
+        auto resp = protocol::CreateCreateVoucherManyResponse(
+            fbb, fbb.CreateVector(voucher_keys), fbb.CreateVector(statuses));
+        rb.add_successful_response(seqno, resp);
+        return false;
+    }
+
+    // Unlike the above, opening with 'wait' may complete later, so the
+    // outcomes are gathered in shared state and the response is sent
+    // (deferred if necessary) when the last key completes.
+    auto handle_open_many(std::uint64_t seqno,
+                          protocol::OpenManyRequest const *req,
+                          time_point now, response_builder &rb) -> bool {
+        auto const *keys = req->keys();
+        auto const n = internal::batch_size(keys);
+        if (n > internal::max_batch_size) {
+            rb.add_error_response(seqno, protocol::Status::INVALID_REQUEST);
+            return false;
+        }
+
+        struct gather_state {
+            std::vector<protocol::Mapping> mappings;
+            std::vector<std::int32_t> statuses;
+            std::size_t pending = 0;
+            bool deferred = false; // Response to be sent by last deferred
+        };
+        auto const st = std::make_shared<gather_state>();
+        st->mappings.resize(n);
+        st->statuses.resize(n);
+        st->pending = n;
+
+        auto const add_response = [seqno](response_builder &rb2,
+                                          gather_state const &s) {
+            auto &fbb = rb2.fbbuilder();
+            auto resp = protocol::CreateOpenManyResponse(
+                fbb, fbb.CreateVectorOfStructs(s.mappings),
+                fbb.CreateVector(s.statuses));
+            rb2.add_successful_response(seqno, resp);
+        };
+        auto const complete_deferred = [this, st, add_response] {
+            st->deferred = true;
+            if (--st->pending == 0)
+                add_deferred_response(
+                    [&](response_builder &rb2) { add_response(rb2, *st); });
+        };
+
+        for (flatbuffers::uoffset_t i = 0; i < n; ++i) {
+            auto const set_success = [st, i](common::token k,
+                                             resource_type const &rsrc) {
+                st->mappings[i] = internal::make_mapping(k, rsrc);
+                st->statuses[i] = internal::status_code(protocol::Status::OK);
+            };
+            auto const set_error = [st, i](protocol::Status status) {
+                st->statuses[i] = internal::status_code(status);
+            };
+            sess->open(
+                common::token(keys->Get(i)), req->policy(), req->wait(), now,
+                [&](common::token k, resource_type const &rsrc) {
+                    set_success(k, rsrc);
+                    --st->pending;
+                },
+                [&](protocol::Status status) {
+                    set_error(status);
+                    --st->pending;
+                },
+                [set_success, complete_deferred](common::token k,
+                                                 resource_type const &rsrc) {
+                    set_success(k, rsrc);
+                    complete_deferred();
+                },
+                [set_error, complete_deferred](protocol::Status status) {
+                    set_error(status);
+                    complete_deferred();
+                },
+                std::chrono::milliseconds(req->timeout_ms()),
+                std::chrono::milliseconds(req->lease_ms()));
+        }
+        if (st->pending == 0 && not st->deferred)
+            add_response(rb, *st);
+        return false;
+    }
+
+    // Apply 'op' (which calls a session operation taking a key and
+    // immediately-invoked success and error callbacks) to each of 'keys'.
+    template <typename Op>
+    static auto
+    statuses_for_keys(flatbuffers::Vector<std::uint64_t> const *keys, Op op)
+        -> std::vector<std::int32_t> {
+        std::vector<std::int32_t> statuses;
+        if (keys == nullptr)
+            return statuses;
+        statuses.reserve(keys->size());
+        for (auto const key : *keys) {
+            op(
+                common::token(key),
+                [&statuses] {
+                    statuses.push_back(
+                        internal::status_code(protocol::Status::OK));
+                },
+                [&statuses](protocol::Status status) {
+                    statuses.push_back(internal::status_code(status));
+                });
+        }
+        return statuses;
+    }
 };
 
 } // namespace partake::daemon
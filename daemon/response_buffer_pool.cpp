@@ -0,0 +1,83 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "response_buffer_pool.hpp"
+
+#include "partake_protocol_generated.h"
+#include "response_builder.hpp"
+
+#include <doctest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("response_buffer_pool") {
+    response_buffer_pool pool;
+    CHECK(pool.pooled_count() == 0);
+
+    auto *p0 = pool.allocate(100);
+    auto *p1 = pool.allocate(256);
+    CHECK(p0 != p1);
+    pool.deallocate(p0, 100);
+    CHECK(pool.pooled_count() == 1);
+    CHECK(pool.allocate(200) == p0); // Same size class
+    CHECK(pool.pooled_count() == 0);
+    pool.deallocate(p0, 200);
+    pool.deallocate(p1, 256);
+    CHECK(pool.pooled_count() == 2);
+
+    SUBCASE("different size class") {
+        auto *p2 = pool.allocate(257);
+        CHECK(p2 != p0);
+        CHECK(p2 != p1);
+        pool.deallocate(p2, 257);
+        CHECK(pool.pooled_count() == 3);
+    }
+
+    SUBCASE("large buffers are not pooled") {
+        auto *p2 = pool.allocate(1 << 20);
+        pool.deallocate(p2, 1 << 20);
+        CHECK(pool.pooled_count() == 2);
+    }
+
+    SUBCASE("limited number pooled per size class") {
+        std::vector<std::uint8_t *> ps;
+        for (int i = 0; i < 10; ++i)
+            ps.push_back(pool.allocate(1000));
+        for (auto *p : ps)
+            pool.deallocate(p, 1000);
+        CHECK(pool.pooled_count() == 6);
+    }
+}
+
+TEST_CASE("response_buffer_pool: with response_builder") {
+    response_buffer_pool pool;
+    std::size_t steady_count = 0;
+    for (int i = 0; i < 3; ++i) {
+        {
+            response_builder rb(1, &pool);
+            auto resp = protocol::CreatePingResponse(rb.fbbuilder());
+            rb.add_successful_response(i, resp);
+            auto buf = rb.release_buffer();
+            CHECK(buf.size() > 0);
+        }
+        // Buffers are returned to the pool and reused.
+        if (i == 0)
+            steady_count = pool.pooled_count();
+        else
+            CHECK(pool.pooled_count() == steady_count);
+    }
+    CHECK(steady_count > 0);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
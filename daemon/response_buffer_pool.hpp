@@ -0,0 +1,86 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <flatbuffers/flatbuffers.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace partake::daemon {
+
+// A FlatBuffers allocator that keeps a few freed buffers of each
+// (power-of-2) size class for reuse, so that building responses does not
+// need heap allocations in the steady state. Buffers detached from a builder
+// using this allocator return here when destroyed, so the pool must outlive
+// them.
+//
+// Not thread-safe; intended to be owned by a single client connection.
+class response_buffer_pool final : public flatbuffers::Allocator {
+    static constexpr std::size_t min_block_size = 256;
+    static constexpr std::size_t num_size_classes = 9; // Up to 64 KiB
+    static constexpr std::size_t max_blocks_per_class = 4;
+
+    // free_blocks[k] holds blocks of size (min_block_size << k).
+    std::array<std::vector<std::unique_ptr<std::uint8_t[]>>, num_size_classes>
+        free_blocks;
+
+  public:
+    response_buffer_pool() {
+        for (auto &blocks : free_blocks)
+            blocks.reserve(max_blocks_per_class);
+    }
+
+    // No move or copy (address taken by builders and buffers)
+    ~response_buffer_pool() override = default;
+    response_buffer_pool(response_buffer_pool const &) = delete;
+    auto operator=(response_buffer_pool const &) = delete;
+    response_buffer_pool(response_buffer_pool &&) = delete;
+    auto operator=(response_buffer_pool &&) = delete;
+
+    auto allocate(std::size_t size) -> std::uint8_t * override {
+        auto const k = size_class(size);
+        if (k >= num_size_classes)
+            return new std::uint8_t[size];
+        auto &blocks = free_blocks[k];
+        if (blocks.empty())
+            return new std::uint8_t[min_block_size << k];
+        auto *p = blocks.back().release();
+        blocks.pop_back();
+        return p;
+    }
+
+    void deallocate(std::uint8_t *p, std::size_t size) override {
+        auto const k = size_class(size);
+        if (k < num_size_classes &&
+            free_blocks[k].size() < max_blocks_per_class) {
+            free_blocks[k].emplace_back(p); // Does not allocate
+            return;
+        }
+        delete[] p;
+    }
+
+    [[nodiscard]] auto pooled_count() const noexcept -> std::size_t {
+        std::size_t n = 0;
+        for (auto const &blocks : free_blocks)
+            n += blocks.size();
+        return n;
+    }
+
+  private:
+    static auto size_class(std::size_t size) noexcept -> std::size_t {
+        std::size_t k = 0;
+        while (k < num_size_classes && (min_block_size << k) < size)
+            ++k;
+        return k;
+    }
+};
+
+} // namespace partake::daemon
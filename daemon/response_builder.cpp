@@ -43,6 +43,8 @@ TEST_CASE("response_builder: successful response") {
     auto resp = protocol::CreatePingResponse(fbb);
     rb.add_successful_response(123, resp);
     CHECK_FALSE(rb.empty());
+    CHECK(rb.size() == 1);
+    CHECK(rb.byte_size() > 0);
     auto buf = rb.release_buffer();
     gsl::span<std::uint8_t const> const bytes(buf.data(), buf.size());
 
@@ -75,6 +77,20 @@ TEST_CASE("response_builder: error response") {
     CHECK(resp0->response_type() == protocol::AnyResponse::NONE);
 }
 
+TEST_CASE("response_builder: frame size") {
+    response_builder rb;
+    CHECK(rb.frame_size() >= rb.byte_size());
+    for (int i = 0; i < 100; ++i) {
+        auto &fbb = rb.fbbuilder();
+        rb.add_successful_response(i, protocol::CreatePingResponse(fbb));
+        rb.add_error_response(i, protocol::Status::INVALID_REQUEST);
+    }
+    auto const estimate = rb.frame_size();
+    auto buf = rb.release_buffer();
+    CHECK(buf.size() <= estimate);
+    CHECK(buf.size() + 128 > estimate);
+}
+
 // NOLINTEND(readability-magic-numbers)
 
 } // namespace partake::daemon
@@ -23,9 +23,15 @@ class response_builder {
 
     static constexpr std::size_t approx_bytes_per_response = 64;
 
+    // Root table, vector length, size prefix, and alignment padding.
+    static constexpr std::size_t frame_overhead = 64;
+
   public:
-    explicit response_builder(std::size_t count_hint = 0)
-        : bldr(approx_bytes_per_response * count_hint),
+    // If given, 'allocator' (not owned) is used for the buffer, which must be
+    // destroyed before the allocator.
+    explicit response_builder(std::size_t count_hint = 0,
+                              flatbuffers::Allocator *allocator = nullptr)
+        : bldr(approx_bytes_per_response * count_hint, allocator),
           alloc_hint(count_hint) {}
 
     [[nodiscard]] auto fbbuilder() noexcept
@@ -54,6 +60,23 @@ class response_builder {
         return resp_offsets.empty();
     }
 
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return resp_offsets.size();
+    }
+
+    // Bytes used so far (excluding the response vector and root table).
+    [[nodiscard]] auto byte_size() const noexcept -> std::size_t {
+        return bldr.GetSize();
+    }
+
+    // Upper bound on the length of the message frame that release_buffer()
+    // would return now.
+    [[nodiscard]] auto frame_size() const noexcept -> std::size_t {
+        return bldr.GetSize() +
+               sizeof(flatbuffers::uoffset_t) * resp_offsets.size() +
+               frame_overhead;
+    }
+
     // After call to this function, the instance may not be used.
     [[nodiscard]] auto release_buffer() -> flatbuffers::DetachedBuffer {
         auto resp_vec = bldr.CreateVector(resp_offsets);
@@ -6,7 +6,12 @@
 
 #include "segment.hpp"
 
+#include "numa.hpp"
 #include "overloaded.hpp"
+#include "page_release.hpp"
+#include "page_residency.hpp"
+#include "page_size.hpp"
+#include "random.hpp"
 #include "shmem_mmap.hpp"
 #include "shmem_sysv.hpp"
 #include "shmem_win32.hpp"
@@ -14,8 +19,10 @@
 
 #include <doctest.h>
 
+#include <algorithm>
 #include <cassert>
 #include <exception>
+#include <string>
 
 namespace partake::daemon {
 
@@ -44,8 +51,22 @@ class unsupported_segment final : public internal::segment_impl {
         assert(false);
         std::terminate();
     }
+
+    [[nodiscard]] auto address() const noexcept -> void * override {
+        return nullptr;
+    }
+
+    auto release_pages([[maybe_unused]] std::size_t offset,
+                       [[maybe_unused]] std::size_t size) -> bool override {
+        return false;
+    }
 };
 
+auto release_in_mapping(void *base, std::size_t offset, std::size_t size)
+    -> bool {
+    return release_shared_pages(static_cast<char *>(base) + offset, size);
+}
+
 #ifndef _WIN32
 
 class posix_mmap_segment final : public internal::segment_impl {
@@ -69,6 +90,14 @@ class posix_mmap_segment final : public internal::segment_impl {
     [[nodiscard]] auto spec() const -> segment_spec override {
         return {posix_mmap_segment_spec{shm.name()}, size()};
     }
+
+    [[nodiscard]] auto address() const noexcept -> void * override {
+        return shm.address();
+    }
+
+    auto release_pages(std::size_t offset, std::size_t size) -> bool override {
+        return release_in_mapping(shm.address(), offset, size);
+    }
 };
 
 class file_mmap_segment final : public internal::segment_impl {
@@ -78,6 +107,7 @@ class file_mmap_segment final : public internal::segment_impl {
     explicit file_mmap_segment(file_mmap_segment_config const &cfg,
                                std::size_t size)
         : shm([&]() {
+              assert(not cfg.persistent || not cfg.filename.empty());
               if (cfg.filename.empty())
                   return create_file_mmap_shmem(size);
               std::error_code ec;
@@ -87,7 +117,11 @@ class file_mmap_segment final : public internal::segment_impl {
                                 cfg.filename, ec.message(), ec.value());
                   return mmap_shmem();
               }
-              return create_file_mmap_shmem(canon, size, cfg.force);
+              if (not cfg.persistent)
+                  return create_file_mmap_shmem(canon, size, cfg.force);
+              auto shm = create_file_mmap_shmem(canon, size, true);
+              shm.keep();
+              return shm;
           }()) {}
 
     [[nodiscard]] auto is_valid() const noexcept -> bool override {
@@ -101,6 +135,14 @@ class file_mmap_segment final : public internal::segment_impl {
     [[nodiscard]] auto spec() const -> segment_spec override {
         return {file_mmap_segment_spec{shm.name()}, size()};
     }
+
+    [[nodiscard]] auto address() const noexcept -> void * override {
+        return shm.address();
+    }
+
+    auto release_pages(std::size_t offset, std::size_t size) -> bool override {
+        return release_in_mapping(shm.address(), offset, size);
+    }
 };
 
 class sysv_segment final : public internal::segment_impl {
@@ -125,29 +167,94 @@ class sysv_segment final : public internal::segment_impl {
     [[nodiscard]] auto spec() const -> segment_spec override {
         return {sysv_segment_spec{shm.id()}, size()};
     }
+
+    [[nodiscard]] auto address() const noexcept -> void * override {
+        return shm.address();
+    }
+
+    auto release_pages(std::size_t offset, std::size_t size) -> bool override {
+        return release_in_mapping(shm.address(), offset, size);
+    }
 };
 
 using win32_segment = unsupported_segment;
 
+#ifdef __linux__
+
+class memfd_segment final : public internal::segment_impl {
+    memfd_shmem shm;
+    std::string fd_socket;
+    common::posix::file_descriptor ro_fd; // Only if fd_socket given
+
+  public:
+    explicit memfd_segment(memfd_segment_config const &cfg, std::size_t size)
+        : shm(create_memfd_shmem(size, cfg.use_huge_pages,
+                                 cfg.huge_page_size)),
+          fd_socket(cfg.fd_socket) {
+        if (shm.is_valid() && not fd_socket.empty())
+            ro_fd = shm.open_read_only();
+    }
+
+    [[nodiscard]] auto is_valid() const noexcept -> bool override {
+        return shm.is_valid() && (fd_socket.empty() || ro_fd.is_valid());
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t override {
+        return shm.size();
+    }
+
+    [[nodiscard]] auto spec() const -> segment_spec override {
+        if (not fd_socket.empty())
+            return {fd_passing_segment_spec{fd_socket, fd_socket + ".ro"},
+                    size()};
+        return {file_mmap_segment_spec{shm.path()}, size()};
+    }
+
+    [[nodiscard]] auto address() const noexcept -> void * override {
+        return shm.address();
+    }
+
+    auto release_pages(std::size_t offset, std::size_t size) -> bool override {
+        return release_in_mapping(shm.address(), offset, size);
+    }
+
+    [[nodiscard]] auto descriptor() const noexcept -> int override {
+        return fd_socket.empty() ? -1 : shm.descriptor();
+    }
+
+    [[nodiscard]] auto read_only_descriptor() const noexcept -> int override {
+        return fd_socket.empty() ? -1 : ro_fd.get();
+    }
+};
+
+#else
+
+using memfd_segment = unsupported_segment;
+
+#endif
+
 #else // _WIN32
 
 using posix_mmap_segment = unsupported_segment;
 using file_mmap_segment = unsupported_segment;
 using sysv_segment = unsupported_segment;
+using memfd_segment = unsupported_segment;
 
 class win32_segment final : public internal::segment_impl {
     std::string mapping_name;
     win32_shmem shm;
     bool large_pages;
+    int node;
 
   public:
-    explicit win32_segment(win32_segment_config const &cfg, std::size_t size)
+    explicit win32_segment(win32_segment_config const &cfg, std::size_t size,
+                           int numa_node)
         : mapping_name(cfg.name.empty() ? generate_win32_file_mapping_name()
                                         : cfg.name),
           shm([&]() {
               if (cfg.filename.empty()) {
                   return create_win32_shmem(mapping_name, size,
-                                            cfg.use_large_pages);
+                                            cfg.use_large_pages, numa_node);
               }
               std::error_code ec;
               auto canon = std::filesystem::weakly_canonical(cfg.filename, ec);
@@ -157,9 +264,10 @@ class win32_segment final : public internal::segment_impl {
                   return win32_shmem();
               }
               return create_win32_file_shmem(canon, mapping_name, size,
-                                             cfg.force, cfg.use_large_pages);
+                                             cfg.force, cfg.use_large_pages,
+                                             numa_node);
           }()),
-          large_pages(cfg.use_large_pages) {}
+          large_pages(cfg.use_large_pages), node(numa_node) {}
 
     [[nodiscard]] auto is_valid() const noexcept -> bool override {
         return shm.is_valid();
@@ -170,7 +278,17 @@ class win32_segment final : public internal::segment_impl {
     }
 
     [[nodiscard]] auto spec() const -> segment_spec override {
-        return {win32_segment_spec{mapping_name, large_pages}, size()};
+        return {win32_segment_spec{mapping_name, large_pages, node}, size()};
+    }
+
+    [[nodiscard]] auto address() const noexcept -> void * override {
+        return shm.address();
+    }
+
+    auto release_pages(std::size_t offset, std::size_t size) -> bool override {
+        if (large_pages) // Large pages cannot be discarded.
+            return false;
+        return release_in_mapping(shm.address(), offset, size);
     }
 };
 
@@ -194,10 +312,243 @@ segment::segment(segment_config const &config)
                   return std::make_unique<sysv_segment>(cfg, config.size);
               },
               [&config](win32_segment_config const &cfg) -> impl_ptr {
+#ifdef _WIN32
+                  return std::make_unique<win32_segment>(cfg, config.size,
+                                                         config.numa_node);
+#else
                   return std::make_unique<win32_segment>(cfg, config.size);
+#endif
+              },
+              [&config](memfd_segment_config const &cfg) -> impl_ptr {
+                  return std::make_unique<memfd_segment>(cfg, config.size);
               },
           },
-          config.method)) {}
+          config.method)) {
+    if (not impl->is_valid())
+        return;
+    // The memory policy must be set before any page is touched.
+#ifdef _WIN32
+    // Already preferred by the file mapping and its view.
+    node = config.numa_node;
+#else
+    if (config.numa_node >= 0 &&
+        bind_to_numa_node(impl->address(), impl->size(), config.numa_node))
+        node = config.numa_node;
+#endif
+    if (config.transparent_huge_pages)
+        (void)advise_huge_pages(impl->address(), impl->size());
+    if (config.prefault)
+        (void)prefault_pages(impl->address(), impl->size());
+    if (config.lock && not lock_pages(impl->address(), impl->size())) {
+        // Destroy the segment, which cannot be used as requested.
+        impl = std::make_unique<unsupported_segment>(config.size);
+        return;
+    }
+    while (ident == 0)
+        ident = common::random_uint64();
+}
+
+auto segment::release_pages(std::size_t offset, std::size_t size) -> bool {
+    assert(offset <= impl->size() && size <= impl->size() - offset);
+    auto const psize = page_size();
+    auto const begin = (offset + psize - 1) & ~(psize - 1);
+    auto const end = (offset + size) & ~(psize - 1);
+    if (begin >= end)
+        return false;
+    if (not impl->release_pages(begin, end - begin))
+        return false;
+    ++gen;
+    auto *const base = static_cast<char *>(impl->address());
+    std::fill(base + offset, base + begin, char(0));
+    std::fill(base + end, base + offset + size, char(0));
+    return true;
+}
+
+#ifdef __linux__
+
+TEST_CASE("segment: numa_node") {
+    auto const psize = page_size();
+    segment seg(segment_config{posix_mmap_segment_config{}, psize});
+    REQUIRE(seg.is_valid());
+    CHECK(seg.numa_node() == -1);
+}
+
+TEST_CASE("segment: release_pages") {
+    auto const psize = page_size();
+    segment seg(segment_config{posix_mmap_segment_config{}, 4 * psize});
+    REQUIRE(seg.is_valid());
+    CHECK(seg.generation() == 0);
+    CHECK(seg.release_pages(0, 4 * psize));
+    CHECK(seg.generation() == 1);
+    CHECK(seg.release_pages(psize, psize));
+    CHECK(seg.generation() == 2);
+    // Partial pages are not released, but zeroed if whole pages are.
+    auto *data = static_cast<std::uint8_t *>(seg.address());
+    std::fill_n(data, 4 * psize, std::uint8_t(1));
+    CHECK(seg.release_pages(1, 3 * psize));
+    CHECK(data[0] == 1);
+    CHECK(std::all_of(data + 1, data + 3 * psize + 1,
+                      [](std::uint8_t b) { return b == 0; }));
+    CHECK(data[3 * psize + 1] == 1);
+    CHECK_FALSE(seg.release_pages(psize, psize - 1));
+    CHECK(seg.generation() == 3); // Pages within the first range released
+    CHECK(seg.spec().generation == 3);
+}
+
+TEST_CASE("segment: identity") {
+    auto const psize = page_size();
+    segment const seg0(segment_config{posix_mmap_segment_config{}, psize});
+    segment const seg1(segment_config{posix_mmap_segment_config{}, psize});
+    REQUIRE(seg0.is_valid());
+    REQUIRE(seg1.is_valid());
+    CHECK(seg0.identity() != 0);
+    CHECK(seg0.identity() != seg1.identity());
+    CHECK(seg0.spec().identity == seg0.identity());
+    CHECK(segment().identity() == 0);
+}
+
+#endif
+
+#ifndef _WIN32
+
+TEST_CASE("segment: prefault") {
+    auto const psize = page_size();
+    segment const seg(
+        segment_config{posix_mmap_segment_config{}, 4 * psize, true, false});
+    REQUIRE(seg.is_valid());
+    CHECK(seg.size() == 4 * psize);
+}
+
+#endif
+
+auto additional_segment_config(segment_config const &config,
+                               std::uint32_t segment_id) -> segment_config {
+    assert(segment_id > 0);
+    auto const suffixed = [segment_id](std::string const &name) {
+        if (name.empty())
+            return name;
+        return name + '.' + std::to_string(segment_id);
+    };
+    using method_type = decltype(segment_config::method);
+    return {std::visit(
+                common::overloaded{
+                    [&](posix_mmap_segment_config const &cfg) -> method_type {
+                        return posix_mmap_segment_config{suffixed(cfg.name),
+                                                         cfg.force};
+                    },
+                    [&](file_mmap_segment_config const &cfg) -> method_type {
+                        return file_mmap_segment_config{
+                            suffixed(cfg.filename), cfg.force,
+                            cfg.persistent};
+                    },
+                    [&](sysv_segment_config const &cfg) -> method_type {
+                        auto c = cfg;
+                        if (c.key != 0)
+                            c.key += static_cast<std::int32_t>(segment_id);
+                        return c;
+                    },
+                    [&](win32_segment_config const &cfg) -> method_type {
+                        return win32_segment_config{
+                            suffixed(cfg.filename), suffixed(cfg.name),
+                            cfg.force, cfg.use_large_pages};
+                    },
+                    [&](memfd_segment_config const &cfg) -> method_type {
+                        return memfd_segment_config{cfg.use_huge_pages,
+                                                    cfg.huge_page_size,
+                                                    suffixed(cfg.fd_socket)};
+                    },
+                },
+                config.method),
+            config.size, config.prefault, config.lock,
+            config.transparent_huge_pages, config.numa_node};
+}
+
+auto is_initially_zero_filled(segment_config const &config) -> bool {
+    return std::visit(
+        common::overloaded{
+            [](memfd_segment_config const &) { return true; },
+            [](file_mmap_segment_config const &cfg) {
+                return not cfg.force && not cfg.persistent;
+            },
+            [](auto const &cfg) { return not cfg.force; },
+        },
+        config.method);
+}
+
+TEST_CASE("is_initially_zero_filled") {
+    CHECK(is_initially_zero_filled(
+        segment_config{posix_mmap_segment_config{"/myshm"}, 8192}));
+    CHECK_FALSE(is_initially_zero_filled(
+        segment_config{posix_mmap_segment_config{"/myshm", true}, 8192}));
+    CHECK(is_initially_zero_filled(
+        segment_config{file_mmap_segment_config{"myfile"}, 8192}));
+    CHECK_FALSE(is_initially_zero_filled(
+        segment_config{file_mmap_segment_config{"myfile", true}, 8192}));
+    CHECK_FALSE(is_initially_zero_filled(segment_config{
+        file_mmap_segment_config{"myfile", false, true}, 8192}));
+    auto sysv_force = sysv_segment_config{100};
+    sysv_force.force = true;
+    CHECK(is_initially_zero_filled(
+        segment_config{sysv_segment_config{100}, 8192}));
+    CHECK_FALSE(is_initially_zero_filled(segment_config{sysv_force, 8192}));
+    CHECK(is_initially_zero_filled(
+        segment_config{win32_segment_config{}, 8192}));
+    CHECK(is_initially_zero_filled(
+        segment_config{memfd_segment_config{}, 8192}));
+}
+
+TEST_CASE("additional_segment_config") {
+    auto const posix = additional_segment_config(
+        segment_config{posix_mmap_segment_config{"/myshm", true}, 8192, true,
+                       true, false, 1},
+        2);
+    CHECK(std::get<posix_mmap_segment_config>(posix.method).name ==
+          "/myshm.2");
+    CHECK(std::get<posix_mmap_segment_config>(posix.method).force);
+    CHECK(posix.size == 8192);
+    CHECK(posix.prefault);
+    CHECK(posix.lock);
+    CHECK(posix.numa_node == 1);
+
+    auto const posix_gen = additional_segment_config(
+        segment_config{posix_mmap_segment_config{}, 8192}, 1);
+    CHECK(std::get<posix_mmap_segment_config>(posix_gen.method).name.empty());
+
+    auto const file = additional_segment_config(
+        segment_config{file_mmap_segment_config{"myfile"}, 8192}, 1);
+    CHECK(std::get<file_mmap_segment_config>(file.method).filename ==
+          "myfile.1");
+
+    auto const persistent = additional_segment_config(
+        segment_config{file_mmap_segment_config{"myfile", false, true}, 8192},
+        1);
+    CHECK(std::get<file_mmap_segment_config>(persistent.method).persistent);
+
+    auto const sysv = additional_segment_config(
+        segment_config{sysv_segment_config{100}, 8192}, 3);
+    CHECK(std::get<sysv_segment_config>(sysv.method).key == 103);
+    auto const sysv_auto = additional_segment_config(
+        segment_config{sysv_segment_config{}, 8192}, 3);
+    CHECK(std::get<sysv_segment_config>(sysv_auto.method).key == 0);
+
+    auto const win32 = additional_segment_config(
+        segment_config{win32_segment_config{{}, R"(Local\x)"}, 8192}, 1);
+    CHECK(std::get<win32_segment_config>(win32.method).filename.empty());
+    CHECK(std::get<win32_segment_config>(win32.method).name ==
+          R"(Local\x.1)");
+
+    auto const memfd = additional_segment_config(
+        segment_config{memfd_segment_config{true, 2 << 20}, 8192}, 1);
+    CHECK(std::get<memfd_segment_config>(memfd.method).use_huge_pages);
+    CHECK(std::get<memfd_segment_config>(memfd.method).huge_page_size ==
+          2 << 20);
+    CHECK(std::get<memfd_segment_config>(memfd.method).fd_socket.empty());
+
+    auto const memfd_passing = additional_segment_config(
+        segment_config{memfd_segment_config{false, 0, "/tmp/s.seg"}, 8192}, 2);
+    CHECK(std::get<memfd_segment_config>(memfd_passing.method).fd_socket ==
+          "/tmp/s.seg.2");
+}
 
 #ifdef _WIN32
 
@@ -261,6 +612,17 @@ TEST_CASE("segment: win32 system paging file") {
               "Local\\");
         CHECK_FALSE(win32_spec.use_large_pages);
     }
+
+    SUBCASE("create with numa node") {
+        auto conf = segment_config{win32_segment_config{}, 8192};
+        conf.numa_node = 0;
+        segment const seg(conf);
+        CHECK(seg.is_valid());
+        CHECK(seg.numa_node() == 0);
+        auto const spec = seg.spec();
+        REQUIRE(std::holds_alternative<win32_segment_spec>(spec.spec));
+        CHECK(std::get<win32_segment_spec>(spec.spec).numa_node == 0);
+    }
 }
 
 TEST_CASE("segment: win32 file") {
@@ -407,6 +769,23 @@ TEST_CASE("segment: file mmap") {
                 CHECK(seg.size() >= 8192);
             }
         }
+
+        SUBCASE("persistent") {
+            auto const conf = segment_config{
+                file_mmap_segment_config{path.string(), false, true}, 8192};
+            {
+                segment const seg(conf);
+                REQUIRE(seg.is_valid());
+                static_cast<char *>(seg.address())[100] = 42;
+            }
+            CHECK(std::filesystem::exists(path));
+            {
+                segment const seg(conf);
+                REQUIRE(seg.is_valid());
+                CHECK(static_cast<char *>(seg.address())[100] == 42);
+            }
+            std::filesystem::remove(path);
+        }
     }
 
     SUBCASE("create with generated name") {
@@ -474,6 +853,52 @@ TEST_CASE("segment: sysv") {
     }
 }
 
+#ifdef __linux__
+
+TEST_CASE("segment: memfd") {
+    auto const conf = segment_config{memfd_segment_config{}, 8192};
+    segment const seg(conf);
+    REQUIRE(seg.is_valid());
+    CHECK(seg.size() >= 8192);
+    auto const spec = seg.spec();
+    REQUIRE(std::holds_alternative<file_mmap_segment_spec>(spec.spec));
+    auto file_spec = std::get<file_mmap_segment_spec>(spec.spec);
+    CHECK(file_spec.filename.rfind("/proc/", 0) == 0);
+    CHECK(seg.descriptor() == -1);
+}
+
+TEST_CASE("segment: memfd with fd passing") {
+    auto const conf = segment_config{
+        memfd_segment_config{false, 0, "/tmp/partake.sock.seg"}, 8192};
+    segment const seg(conf);
+    REQUIRE(seg.is_valid());
+    auto const spec = seg.spec();
+    REQUIRE(std::holds_alternative<fd_passing_segment_spec>(spec.spec));
+    CHECK(std::get<fd_passing_segment_spec>(spec.spec).socket ==
+          "/tmp/partake.sock.seg");
+    CHECK(std::get<fd_passing_segment_spec>(spec.spec).read_only_socket ==
+          "/tmp/partake.sock.seg.ro");
+    CHECK(seg.descriptor() >= 0);
+    CHECK(seg.read_only_descriptor() >= 0);
+    CHECK(seg.read_only_descriptor() != seg.descriptor());
+}
+
+TEST_CASE("segment: transparent huge pages") {
+    auto conf = segment_config{posix_mmap_segment_config{}, 8192};
+    conf.transparent_huge_pages = true;
+    segment const seg(conf); // Succeeds even if THP not available
+    CHECK(seg.is_valid());
+}
+
+#else
+
+TEST_CASE("segment: memfd invalid on non-Linux") {
+    CHECK_FALSE(segment(segment_config{memfd_segment_config{}, 8192})
+                    .is_valid());
+}
+
+#endif
+
 #endif // _WIN32
 
 } // namespace partake::daemon
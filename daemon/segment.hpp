@@ -34,13 +34,25 @@ struct sysv_segment_spec {
 struct win32_segment_spec {
     std::string name; // Named file mapping name; non-empty
     bool use_large_pages = false;
+    int numa_node = -1; // Preferred NUMA node for views, or -1 for none
+};
+
+// The client connects to the Unix domain socket and receives the file
+// descriptor of the shared memory (SCM_RIGHTS), which it maps with mmap().
+struct fd_passing_segment_spec {
+    std::string socket; // Socket path; non-empty
+    // Socket from which a read-only descriptor is received; non-empty
+    std::string read_only_socket;
 };
 
 struct segment_spec {
     std::variant<posix_mmap_segment_spec, file_mmap_segment_spec,
-                 sysv_segment_spec, win32_segment_spec>
+                 sysv_segment_spec, win32_segment_spec,
+                 fd_passing_segment_spec>
         spec;
     std::size_t size = 0;
+    std::uint64_t identity = 0;   // See segment::identity()
+    std::uint64_t generation = 0; // See segment::generation()
 };
 
 struct posix_mmap_segment_config {
@@ -51,6 +63,9 @@ struct posix_mmap_segment_config {
 struct file_mmap_segment_config {
     std::string filename; // Generate tempfile if empty
     bool force = false;   // Replace existing file
+    // Reuse existing file, keeping its contents, and do not delete it on
+    // exit; requires filename.
+    bool persistent = false;
 };
 
 struct sysv_segment_config {
@@ -67,13 +82,44 @@ struct win32_segment_config {
     bool use_large_pages = false; // Requires empty filename
 };
 
+// Linux only. If fd_socket is given, clients see this as an
+// fd_passing_segment_spec (and the daemon must serve the descriptor() on
+// that socket, and the read_only_descriptor() on the same path with ".ro"
+// appended; both are available to any process that can connect to the
+// sockets); otherwise as a file_mmap_segment_spec whose filename is the
+// /proc/<pid>/fd entry for the memfd.
+struct memfd_segment_config {
+    bool use_huge_pages = false;
+    std::size_t huge_page_size = 0; // Default huge page size if zero
+    std::string fd_socket;
+};
+
 struct segment_config {
     std::variant<posix_mmap_segment_config, file_mmap_segment_config,
-                 sysv_segment_config, win32_segment_config>
+                 sysv_segment_config, win32_segment_config,
+                 memfd_segment_config>
         method;
     std::size_t size = 0;
+    bool prefault = false; // Fault in all pages upon creation
+    bool lock = false;     // Lock pages in memory; failure is an error
+    bool transparent_huge_pages = false; // Linux; madvise(MADV_HUGEPAGE)
+    // Preferred NUMA node, or -1 for none (Linux: mbind(); Windows: given
+    // when creating the file mapping and its view)
+    int numa_node = -1;
 };
 
+// Return the configuration to use for creating the additional segment with the
+// given id (> 0), derived from the configuration for segment 0. User-given
+// names are suffixed with the segment id; generated names remain generated.
+auto additional_segment_config(segment_config const &config,
+                               std::uint32_t segment_id) -> segment_config;
+
+// Return true if a segment created with the given configuration is known to
+// be zero-filled. A force-created or persistent segment may reuse an existing
+// one (and its contents), so is conservatively assumed not to be. A memfd
+// segment is always new.
+auto is_initially_zero_filled(segment_config const &config) -> bool;
+
 namespace internal {
 
 struct segment_impl {
@@ -89,6 +135,19 @@ struct segment_impl {
     [[nodiscard]] virtual auto is_valid() const noexcept -> bool = 0;
     [[nodiscard]] virtual auto size() const noexcept -> std::size_t = 0;
     [[nodiscard]] virtual auto spec() const -> segment_spec = 0;
+    [[nodiscard]] virtual auto address() const noexcept -> void * = 0;
+
+    // See segment::release_pages(); the range is page-aligned.
+    virtual auto release_pages(std::size_t offset, std::size_t size)
+        -> bool = 0;
+
+    // See segment::descriptor() and read_only_descriptor().
+    [[nodiscard]] virtual auto descriptor() const noexcept -> int {
+        return -1;
+    }
+    [[nodiscard]] virtual auto read_only_descriptor() const noexcept -> int {
+        return -1;
+    }
 };
 
 } // namespace internal
@@ -96,6 +155,9 @@ struct segment_impl {
 class segment {
     using impl_ptr = std::unique_ptr<internal::segment_impl>;
     impl_ptr impl;
+    int node = -1;
+    std::uint64_t ident = 0;
+    std::uint64_t gen = 0;
 
   public:
     segment();
@@ -110,7 +172,49 @@ class segment {
         return impl->size();
     }
 
-    [[nodiscard]] auto spec() const -> segment_spec { return impl->spec(); }
+    [[nodiscard]] auto spec() const -> segment_spec {
+        auto ret = impl->spec();
+        ret.identity = ident;
+        ret.generation = gen;
+        return ret;
+    }
+
+    // Random, nonzero value chosen upon creation; zero if invalid.
+    [[nodiscard]] auto identity() const noexcept -> std::uint64_t {
+        return ident;
+    }
+
+    // Number of times pages have been released (so that any registrations
+    // pinning the previous pages have become stale).
+    [[nodiscard]] auto generation() const noexcept -> std::uint64_t {
+        return gen;
+    }
+
+    // Address at which the segment is mapped in the daemon.
+    [[nodiscard]] auto address() const noexcept -> void * {
+        return impl->address();
+    }
+
+    // The NUMA node to which the segment was bound, or -1 if none.
+    [[nodiscard]] auto numa_node() const noexcept -> int { return node; }
+
+    // The file descriptor to pass to clients for an fd_passing_segment_spec,
+    // or -1 if the segment is not of that kind.
+    [[nodiscard]] auto descriptor() const noexcept -> int {
+        return impl->descriptor();
+    }
+
+    // Like descriptor(), but opened read-only, for read-only clients.
+    [[nodiscard]] auto read_only_descriptor() const noexcept -> int {
+        return impl->read_only_descriptor();
+    }
+
+    // Return the pages lying entirely within the given byte range to the
+    // system (see release_shared_pages()). If that succeeds, the partial
+    // pages at either end of the range are zeroed, and true is returned: the
+    // whole range is then known to be zero-filled (so that it need not be
+    // released again). Return false if the range contains no whole page.
+    auto release_pages(std::size_t offset, std::size_t size) -> bool;
 };
 
 } // namespace partake::daemon
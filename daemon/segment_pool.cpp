@@ -0,0 +1,438 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "segment_pool.hpp"
+
+#include <doctest.h>
+
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace {
+
+struct fake_segment {
+    std::size_t siz = 0;
+    bool valid = true;
+    std::vector<std::pair<std::size_t, std::size_t>> released;
+    int node = -1;
+    mutable std::vector<std::uint8_t> data = std::vector<std::uint8_t>(siz);
+
+    [[nodiscard]] auto is_valid() const noexcept -> bool { return valid; }
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return siz; }
+    [[nodiscard]] auto numa_node() const noexcept -> int { return node; }
+    [[nodiscard]] auto address() const noexcept -> void * {
+        return data.data();
+    }
+
+    auto release_pages(std::size_t offset, std::size_t size) -> bool {
+        released.emplace_back(offset, size);
+        return true;
+    }
+};
+
+} // namespace
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("segment_pool") {
+    std::vector<std::uint32_t> created;
+    bool fail_creation = false;
+    auto create = [&](std::uint32_t id) {
+        created.push_back(id);
+        return fake_segment{1024, not fail_creation, {}};
+    };
+
+    SUBCASE("single segment") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8);
+        REQUIRE(pool.is_valid());
+        CHECK(pool.segment_count() == 1);
+        CHECK(created == std::vector<std::uint32_t>{0});
+        CHECK(pool.find_segment(0) != nullptr);
+        CHECK(pool.find_segment(1) == nullptr);
+
+        auto a0 = pool.allocate(1024);
+        CHECK(a0);
+        CHECK(a0.segment_id() == 0);
+        auto a1 = pool.allocate(256);
+        CHECK_FALSE(a1);
+        CHECK(pool.segment_count() == 1);
+    }
+
+    SUBCASE("additional segments on demand") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 2);
+        REQUIRE(pool.is_valid());
+        CHECK(pool.segment_count() == 1);
+
+        auto a0 = pool.allocate(768);
+        CHECK(a0.segment_id() == 0);
+        CHECK(pool.segment_count() == 1);
+
+        auto a1 = pool.allocate(512);
+        CHECK(a1);
+        CHECK(a1.segment_id() == 1);
+        CHECK(a1.offset() == 0);
+        CHECK(pool.segment_count() == 2);
+        CHECK(created == std::vector<std::uint32_t>{0, 1});
+        CHECK(pool.find_segment(1) != nullptr);
+
+        // Earlier segments are preferred.
+        auto a2 = pool.allocate(256);
+        CHECK(a2.segment_id() == 0);
+        CHECK(a2.offset() == 768);
+
+        auto a3 = pool.allocate(1024);
+        CHECK_FALSE(a3); // Reached max segment count
+        CHECK(pool.segment_count() == 2);
+    }
+
+    SUBCASE("request larger than segment does not add segment") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 2);
+        CHECK(pool.max_allocation_size() == 1024);
+        auto a = pool.allocate(2048);
+        CHECK_FALSE(a);
+        CHECK(pool.segment_count() == 1);
+    }
+
+    SUBCASE("failure to create additional segment") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 2);
+        auto a0 = pool.allocate(1024);
+        CHECK(a0);
+        fail_creation = true;
+        auto a1 = pool.allocate(1024);
+        CHECK_FALSE(a1);
+        CHECK(pool.segment_count() == 1);
+    }
+
+    SUBCASE("overflow segment") {
+        std::vector<std::uint32_t> created_overflow;
+        bool fail_overflow = false;
+        auto create_overflow = [&](std::uint32_t id) {
+            created_overflow.push_back(id);
+            return fake_segment{1024, not fail_overflow, {}};
+        };
+        basic_segment_pool<fake_segment, internal::arena> pool(
+            create, 8, 2, true, 1, false, 0, create_overflow);
+        CHECK(pool.max_segment_count() == 3);
+        auto a0 = pool.allocate(1024);
+        CHECK(a0.segment_id() == 0);
+        auto a1 = pool.allocate(768);
+        CHECK(a1.segment_id() == 1); // Primary segments first
+        CHECK(created_overflow.empty());
+
+        SUBCASE("spill") {
+            auto a2 = pool.allocate(512);
+            CHECK(a2.segment_id() == 2);
+            CHECK(pool.is_overflow_segment(2));
+            CHECK_FALSE(pool.is_overflow_segment(1));
+            CHECK_FALSE(a2.is_zeroed());
+            CHECK(created_overflow == std::vector<std::uint32_t>{2});
+            CHECK(pool.segment_count() == 3);
+
+            // Primary segments are preferred again once they have room.
+            { auto discard = std::move(a0); }
+            auto a3 = pool.allocate(256);
+            CHECK(a3.segment_id() == 0);
+        }
+
+        SUBCASE("failure to create overflow segment is not retried") {
+            fail_overflow = true;
+            CHECK_FALSE(pool.allocate(512));
+            CHECK_FALSE(pool.allocate(512));
+            CHECK(created_overflow == std::vector<std::uint32_t>{2});
+            CHECK(pool.segment_count() == 2);
+        }
+    }
+
+    SUBCASE("extents") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8);
+        std::vector<decltype(pool.allocate(0))> held;
+        for (int i = 0; i < 4; ++i)
+            held.push_back(pool.allocate(256));
+        { auto discard = std::move(held[0]); }
+        { auto discard = std::move(held[2]); }
+        CHECK_FALSE(pool.allocate(512));
+
+        CHECK(pool.allocate_extents(512, 1).empty());
+        CHECK(pool.allocate_extents(768, 2).empty());
+
+        SUBCASE("fragmented") {
+            auto const exts = pool.allocate_extents(512, 2);
+            REQUIRE(exts.size() == 2);
+            CHECK(exts[0].size() == 256);
+            CHECK(exts[1].size() == 256);
+            CHECK(exts[0].offset() != exts[1].offset());
+        }
+
+        SUBCASE("last extent partial") {
+            auto const exts = pool.allocate_extents(300, 2);
+            REQUIRE(exts.size() == 2);
+            CHECK(exts[0].size() == 256);
+            CHECK(exts[1].size() == 256); // 44 bytes, rounded up
+        }
+
+        SUBCASE("contiguous if possible") {
+            auto const exts = pool.allocate_extents(200, 4);
+            CHECK(exts.size() == 1);
+        }
+    }
+
+    SUBCASE("resize") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8);
+        auto a0 = pool.allocate(256);
+        auto a1 = pool.allocate(256);
+        { auto discard = std::move(a1); }
+        auto const off = a0.offset();
+        CHECK(pool.resize(a0, 600));
+        CHECK(a0.offset() == off);
+        CHECK(a0.size() == 768);
+        CHECK(pool.resize(a0, 10));
+        CHECK(a0.size() == 256);
+        CHECK_FALSE(pool.resize(a0, 1 << 20)); // Larger than segment
+        CHECK(a0.size() == 256);
+    }
+
+    SUBCASE("sub-pools") {
+        basic_segment_pool<fake_segment, internal::arena> pool(
+            create, 8, 2, false, 1, false, 0, {},
+            {{"small", 256}, {"big", 300}});
+        CHECK(pool.sub_pool_count() == 3);
+        CHECK(pool.find_sub_pool("small") == 1);
+        CHECK(pool.find_sub_pool("big") == 2);
+        CHECK_FALSE(pool.find_sub_pool("other"));
+        CHECK(pool.max_allocation_size() == 512); // 300 rounded to 256
+
+        auto s0 = pool.allocate(256, -1, 0, 1);
+        CHECK(s0.segment_id() == 0);
+        CHECK(s0.offset() == 512);
+        auto s1 = pool.allocate(256, -1, 0, 1);
+        CHECK(s1.segment_id() == 1); // Sub-pool full; new segment
+        CHECK(s1.offset() == 512);
+        CHECK_FALSE(pool.allocate(256, -1, 0, 1)); // No fallback
+        CHECK_FALSE(pool.allocate(512, -1, 0, 2)); // Larger than sub-pool
+
+        auto b = pool.allocate(256, -1, 0, 2);
+        CHECK(b.offset() == 768);
+        auto d = pool.allocate(512);
+        CHECK(d.segment_id() == 0);
+        CHECK(d.offset() == 0);
+        CHECK_FALSE(pool.resize(s0, 512)); // Cannot grow into other pools
+        { auto discard = std::move(s0); }
+        CHECK(pool.allocate_at(0, 512, 256)); // Freed to its own sub-pool
+    }
+
+    SUBCASE("zero-filled segments") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 2,
+                                                               true);
+        auto a0 = pool.allocate(1024);
+        CHECK(a0.is_zeroed());
+        auto a1 = pool.allocate(1024);
+        CHECK(a1.segment_id() == 1);
+        CHECK(a1.is_zeroed());
+    }
+
+    SUBCASE("segments not known to be zero-filled") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8);
+        CHECK_FALSE(pool.allocate(1024).is_zeroed());
+    }
+
+    SUBCASE("release free pages") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 2);
+        auto a0 = pool.allocate(1024);
+        auto a1 = pool.allocate(512);
+        REQUIRE(a1.segment_id() == 1);
+        auto a2 = pool.allocate(256);
+        REQUIRE(a2.segment_id() == 1);
+        { auto discard = std::move(a0); }
+        { auto discard = std::move(a2); }
+        CHECK(pool.release_free_pages(1024) == 1024);
+        using released_type = std::vector<std::pair<std::size_t, std::size_t>>;
+        CHECK(pool.find_segment(0)->released == released_type{{0, 1024}});
+        CHECK(pool.find_segment(1)->released.empty());
+        CHECK(pool.release_free_pages(256) == 512);
+        CHECK(pool.find_segment(1)->released == released_type{{512, 512}});
+        CHECK(pool.allocate(1024).is_zeroed());
+    }
+
+    SUBCASE("scrub on free") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 2);
+        pool.set_scrub_on_free(true);
+        auto a0 = pool.allocate(1024);
+        CHECK_FALSE(a0.is_zeroed());
+        auto a1 = pool.allocate(256); // In segment 1, added after enabling
+        REQUIRE(a1.segment_id() == 1);
+        a0 = {};
+        a1 = {};
+        auto held = pool.take_chunks_to_scrub();
+        REQUIRE(held.size() == 2);
+        CHECK(held[0].segment_id() == 0);
+        CHECK(held[0].size() == 1024);
+        CHECK(held[1].segment_id() == 1);
+        CHECK(pool.take_chunks_to_scrub().empty());
+        for (auto &a : held)
+            pool.free_scrubbed(std::move(a));
+        auto a2 = pool.allocate(1024);
+        REQUIRE(a2.segment_id() == 0);
+        CHECK(a2.is_zeroed());
+    }
+
+    SUBCASE("scan chunks") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 2);
+        auto a0 = pool.allocate(1024);
+        auto a1 = pool.allocate(256);
+        REQUIRE(a1.segment_id() == 1);
+        using chunk =
+            std::tuple<std::uint32_t, std::size_t, std::size_t, bool>;
+        std::vector<chunk> chunks;
+        auto const f = [&](std::uint32_t seg, std::size_t offset,
+                           std::size_t size, bool in_use) {
+            chunks.emplace_back(seg, offset, size, in_use);
+        };
+        CHECK(pool.scan_chunks(2, f));
+        CHECK(chunks.size() == 2);
+        CHECK_FALSE(pool.scan_chunks(2, f));
+        CHECK(chunks == std::vector<chunk>{{0, 0, 1024, true},
+                                           {1, 0, 256, true},
+                                           {1, 256, 768, false}});
+        chunks.clear();
+        CHECK_FALSE(pool.scan_chunks(10, f)); // Starts over
+        CHECK(chunks.size() == 3);
+    }
+
+    SUBCASE("initial segments") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 3,
+                                                               false, 2);
+        CHECK(pool.segment_count() == 2);
+        CHECK(created == std::vector<std::uint32_t>{0, 1});
+    }
+
+    SUBCASE("failure to create initial segments") {
+        auto create_one = [&](std::uint32_t id) {
+            created.push_back(id);
+            return fake_segment{1024, id == 0, {}};
+        };
+        basic_segment_pool<fake_segment, internal::arena> pool(create_one, 8,
+                                                               3, false, 3);
+        CHECK(pool.is_valid());
+        CHECK(pool.segment_count() == 1);
+        CHECK(created == std::vector<std::uint32_t>{0, 1});
+    }
+
+    SUBCASE("preferred NUMA node") {
+        auto create_numa = [&](std::uint32_t id) {
+            return fake_segment{1024, true, {}, static_cast<int>(id % 2)};
+        };
+        basic_segment_pool<fake_segment, internal::arena> pool(create_numa, 8,
+                                                               3, false, 2);
+        REQUIRE(pool.segment_count() == 2);
+
+        auto a0 = pool.allocate(256, 1);
+        CHECK(a0.segment_id() == 1);
+        auto a1 = pool.allocate(256, 0);
+        CHECK(a1.segment_id() == 0);
+        auto a2 = pool.allocate(256);
+        CHECK(a2.segment_id() == 0);
+        auto a3 = pool.allocate(256, 5); // No such node
+        CHECK(a3.segment_id() == 0);
+        auto a4 = pool.allocate(768, 1);
+        CHECK(a4.segment_id() == 1);
+
+        // Falls back to other nodes before adding a segment.
+        auto a5 = pool.allocate(256, 1);
+        CHECK(a5.segment_id() == 0);
+        CHECK(pool.segment_count() == 2);
+        auto a6 = pool.allocate(1024, 1);
+        CHECK(a6.segment_id() == 2);
+    }
+
+    SUBCASE("clone") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 2);
+        auto a0 = pool.allocate(300);
+        auto a1 = pool.allocate(512);
+        REQUIRE(a1.segment_id() == 0);
+        auto const b0 = pool.bytes(a0);
+        CHECK(b0.size() == a0.size());
+        CHECK(b0.data() == static_cast<std::uint8_t *>(
+                               pool.find_segment(0)->address()) +
+                               a0.offset());
+        for (std::size_t i = 0; i < 300; ++i)
+            b0[i] = static_cast<std::uint8_t>(i);
+        auto a2 = pool.clone(a0);
+        REQUIRE(a2);
+        CHECK(a2.segment_id() == 1); // Copied between segments
+        CHECK(a2.size() == a0.size());
+        CHECK(pool.bytes(a2)[0] == 0);
+        CHECK(pool.bytes(a2)[299] == 299 % 256);
+        auto a3 = pool.clone(a1);
+        CHECK_FALSE(pool.clone(a1));
+    }
+
+    SUBCASE("allocate_at") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8, 3);
+        auto a0 = pool.allocate_at(2, 256, 512);
+        REQUIRE(a0);
+        CHECK(a0.segment_id() == 2);
+        CHECK(a0.offset() == 256);
+        CHECK(pool.segment_count() == 3); // Earlier segments created too
+        CHECK_FALSE(pool.allocate_at(2, 512, 256)); // In use
+        CHECK_FALSE(pool.allocate_at(3, 0, 256)); // Beyond max segments
+        CHECK(pool.allocate_at(0, 0, 1024));
+    }
+
+    SUBCASE("wake words") {
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 6, 2,
+                                                               false, 1, true);
+        // 1024 / (64 + 4) = 15 granules, followed by the words.
+        CHECK(pool.max_allocation_size() == 15 * 64);
+        CHECK_FALSE(pool.allocate(1024));
+        auto *seg_data =
+            static_cast<std::uint8_t *>(pool.find_segment(0)->address());
+        seg_data[960 + 4] = 0xff;
+        auto a0 = pool.allocate(64);
+        auto a1 = pool.allocate(128);
+        REQUIRE(a1);
+        CHECK(pool.wake_word_offset(a0) == 960);
+        CHECK(pool.wake_word_offset(a1) == 960 + 4);
+        CHECK(seg_data[960 + 4] == 0); // Zeroed upon allocation
+        auto a2 = pool.allocate_at(1, 128, 64);
+        REQUIRE(a2);
+        CHECK(pool.wake_word_offset(a2) == 960 + 2 * 4);
+
+        basic_segment_pool<fake_segment, internal::arena> pool2(create, 6);
+        CHECK(pool2.wake_word_offset(pool2.allocate(64)) == 0);
+    }
+
+    SUBCASE("large object alignment") {
+        basic_segment_pool<fake_segment, internal::arena> pool(
+            create, 6, 1, false, 1, false, 256);
+        auto a0 = pool.allocate(64);
+        auto a1 = pool.allocate(256);
+        auto a2 = pool.allocate(128);
+        auto a3 = pool.allocate(300);
+        REQUIRE(a3);
+        CHECK(a0.offset() == 0);
+        CHECK(a1.offset() == 256);
+        CHECK(a2.offset() == 64); // Packed before the large object
+        CHECK(a3.offset() == 512);
+        auto a4 = pool.allocate(64, -1, 128); // Explicit alignment honored
+        REQUIRE(a4);
+        CHECK(a4.offset() == 896);
+    }
+
+    SUBCASE("failure to create first segment") {
+        fail_creation = true;
+        basic_segment_pool<fake_segment, internal::arena> pool(create, 8);
+        CHECK_FALSE(pool.is_valid());
+        CHECK(pool.find_segment(0) == nullptr);
+        CHECK_FALSE(pool.allocate(1));
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
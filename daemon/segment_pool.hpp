@@ -0,0 +1,609 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "allocator.hpp"
+#include "parallel_copy.hpp"
+#include "segment.hpp"
+#include "sizes.hpp"
+
+#include <gsl/span>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+// A named sub-pool of basic_segment_pool (see below).
+struct sub_pool_config {
+    std::string name;
+    std::size_t size; // Per segment; rounded down to the granularity
+};
+
+// A list of shared memory segments, each with its own arena. The first
+// segment(s) are created upon construction; further segments are created on
+// demand (up to a maximum count) when an allocation cannot be satisfied by
+// any existing segment.
+//
+// Segments may be bound to NUMA nodes (by the segment creation function), in
+// which case allocations can be directed to a preferred node.
+//
+// Segment ids are indices into the list and are never reused. Segments are
+// never destroyed before the pool itself (clients may have mapped them).
+//
+// If wake words are enabled, the end of each segment is reserved for an
+// array of 32-bit words, one per granule of the rest of the segment, which
+// the arena manages. The word for the granule at which an allocation starts
+// belongs to that allocation (it is zeroed when allocated), so that clients
+// can use it as a futex to coordinate access to the allocation's data.
+//
+// An overflow segment (typically file-backed on fast local storage) may be
+// configured, to which allocations spill only when they cannot be satisfied
+// by the primary segments and no more primary segments can be created. It is
+// created the first time this happens and has the next segment id; clients
+// see it as just another segment. This turns a burst of allocations beyond
+// the primary (DRAM) capacity into slower access rather than failure.
+//
+// With a sub-page granularity, small objects are packed together in shared
+// pages. A large-object alignment (normally the page size) can then be set,
+// so that allocations of at least that size still start on a page boundary
+// (and are therefore eligible for page release and huge pages) while the
+// smaller ones fill the gaps.
+//
+// Named sub-pools may be configured, each an independent arena over a fixed
+// range at the end of the arena part of every primary segment, so that
+// clients with very different allocation patterns (bound to different
+// sub-pools) do not fragment each other's space or lengthen each other's
+// free lists. Sub-pool 0 is the default pool: the rest of each segment, and
+// the overflow segment. Allocations from a sub-pool never fall back to
+// another sub-pool.
+template <typename Segment, typename Arena> class basic_segment_pool {
+  public:
+    using segment_type = Segment;
+    using allocator_type = basic_allocator<Arena>;
+    using allocation = typename allocator_type::allocation;
+
+    static constexpr std::size_t wake_word_size = 4;
+
+  private:
+    struct member {
+        segment_type seg;
+        std::size_t wake_base; // Offset of wake words; segment size if none
+        allocator_type allocr; // The default pool
+        std::deque<allocator_type> sub_allocrs; // Sub-pools 1, 2, ...
+        bool overflow;
+
+        // 'sub_pool_sizes' are carved from the end of the arena part.
+        explicit member(segment_type &&segment, std::size_t log2_granularity,
+                        std::uint32_t segment_id, bool zero_filled,
+                        bool wake_words, bool is_overflow,
+                        std::vector<std::size_t> const &sub_pool_sizes = {})
+            : seg(std::move(segment)),
+              wake_base(wake_words ? wake_word_base(seg.size(),
+                                                    log2_granularity)
+                                   : seg.size()),
+              allocr(wake_base - total_size(sub_pool_sizes), log2_granularity,
+                     segment_id, zero_filled),
+              overflow(is_overflow) {
+            assert(total_size(sub_pool_sizes) < wake_base);
+            auto base = allocr.size();
+            for (auto const size : sub_pool_sizes) {
+                sub_allocrs.emplace_back(size, log2_granularity, segment_id,
+                                         zero_filled, base);
+                base += size;
+            }
+        }
+
+        // No move or copy (allocator is not movable)
+        ~member() = default;
+        member(member const &) = delete;
+        auto operator=(member const &) = delete;
+        member(member &&) = delete;
+        auto operator=(member &&) = delete;
+    };
+
+    std::function<segment_type(std::uint32_t)> create_seg;
+    std::size_t log2_gran;
+    std::size_t max_segs;
+    bool zero_filled;
+    bool wake_words;
+    std::size_t large_align;
+    std::function<segment_type(std::uint32_t)> create_overflow_seg;
+    std::vector<std::string> sub_names; // Of sub-pools 1, 2, ...
+    std::vector<std::size_t> sub_sizes;
+    std::size_t primary_segs = 0;
+    bool overflow_tried = false; // Created, or creation failed
+    member *overflow_member = nullptr;
+
+    // Deque so that members are not relocated when segments are added.
+    std::deque<member> members;
+
+    // Position of the chunk scan (see scan_chunks()): member index and
+    // allocator within the member (0 for the default pool).
+    std::size_t scan_member = 0;
+    std::size_t scan_allocr = 0;
+
+    bool scrub_freed = false; // See set_scrub_on_free()
+
+  public:
+    // If 'segments_zero_filled' is true, newly created segments are assumed
+    // to be zero-filled (see is_initially_zero_filled()). The first
+    // 'initial_segments' segments are created upon construction (typically
+    // one per NUMA node); creation stops at the first failure. If
+    // 'enable_wake_words' is true, each segment has wake words (see above).
+    // If 'large_object_alignment' (a power of 2) is nonzero, allocations of
+    // at least that size are aligned to it (see above). If
+    // 'create_overflow_segment' is given, it is called (with the segment id)
+    // to create the overflow segment (see above), which must be the same size
+    // as the others and is assumed not to be zero-filled. 'sub_pools' are
+    // numbered from 1 in the given order (see above); their total size must
+    // be less than the segment size.
+    explicit basic_segment_pool(
+        std::function<segment_type(std::uint32_t)> create_segment,
+        std::size_t log2_granularity, std::size_t max_segments = 1,
+        bool segments_zero_filled = false, std::size_t initial_segments = 1,
+        bool enable_wake_words = false, std::size_t large_object_alignment = 0,
+        std::function<segment_type(std::uint32_t)> create_overflow_segment =
+            {},
+        std::vector<sub_pool_config> const &sub_pools = {})
+        : create_seg(std::move(create_segment)), log2_gran(log2_granularity),
+          max_segs(max_segments), zero_filled(segments_zero_filled),
+          wake_words(enable_wake_words), large_align(large_object_alignment),
+          create_overflow_seg(std::move(create_overflow_segment)) {
+        assert(max_segs > 0);
+        assert((large_align & (large_align - 1)) == 0);
+        assert(initial_segments > 0 && initial_segments <= max_segs);
+        for (auto const &sp : sub_pools) {
+            sub_names.push_back(sp.name);
+            sub_sizes.push_back((sp.size >> log2_gran) << log2_gran);
+        }
+        for (std::size_t i = 0; i < initial_segments; ++i) {
+            if (not add_segment())
+                break;
+        }
+    }
+
+    // No move or copy (references to segments and allocators are taken)
+    ~basic_segment_pool() = default;
+    basic_segment_pool(basic_segment_pool const &) = delete;
+    auto operator=(basic_segment_pool const &) = delete;
+    basic_segment_pool(basic_segment_pool &&) = delete;
+    auto operator=(basic_segment_pool &&) = delete;
+
+    // True if (at least) the first segment was created successfully.
+    [[nodiscard]] auto is_valid() const noexcept -> bool {
+        return not members.empty();
+    }
+
+    [[nodiscard]] auto log2_granularity() const noexcept -> std::size_t {
+        return log2_gran;
+    }
+
+    [[nodiscard]] auto segment_count() const noexcept -> std::size_t {
+        return members.size();
+    }
+
+    // Including the overflow segment, if configured.
+    [[nodiscard]] auto max_segment_count() const noexcept -> std::size_t {
+        return max_segs + (create_overflow_seg ? 1 : 0);
+    }
+
+    [[nodiscard]] auto is_overflow_segment(std::uint32_t segment_id) const
+        noexcept -> bool {
+        return segment_id < members.size() && members[segment_id].overflow;
+    }
+
+    // Combined over all segments (and sub-pools).
+    [[nodiscard]] auto stats() const noexcept -> allocator_stats {
+        allocator_stats ret;
+        for (auto const &m : members) {
+            ret.add(m.allocr.stats());
+            for (auto const &a : m.sub_allocrs)
+                ret.add(a.stats());
+        }
+        return ret;
+    }
+
+    // Including the default pool (number 0).
+    [[nodiscard]] auto sub_pool_count() const noexcept -> std::size_t {
+        return sub_names.size() + 1;
+    }
+
+    // Return the number of the sub-pool with the given name, or nullopt if
+    // there is none.
+    [[nodiscard]] auto find_sub_pool(std::string_view name) const
+        -> std::optional<std::size_t> {
+        auto const it = std::find(sub_names.begin(), sub_names.end(), name);
+        if (it == sub_names.end())
+            return std::nullopt;
+        return std::size_t(it - sub_names.begin()) + 1;
+    }
+
+    // Allocations (from the default pool) larger than this can never
+    // succeed (all segments have the same size).
+    [[nodiscard]] auto max_allocation_size() const noexcept -> std::size_t {
+        return members.empty() ? 0 : members.front().allocr.size();
+    }
+
+    // See basic_allocator::size_classes() (all segments have the same
+    // arena type and size).
+    [[nodiscard]] auto size_classes() const -> std::vector<std::size_t> {
+        if (members.empty())
+            return {};
+        return members.front().allocr.size_classes();
+    }
+
+    // Return nullptr if no such segment.
+    [[nodiscard]] auto find_segment(std::uint32_t segment_id) const noexcept
+        -> segment_type const * {
+        if (segment_id >= members.size())
+            return nullptr;
+        return &members[segment_id].seg;
+    }
+
+    // Segment offset of the wake word of the allocation, or 0 if wake words
+    // are not enabled (a wake word is never at offset 0).
+    [[nodiscard]] auto wake_word_offset(allocation const &a) const noexcept
+        -> std::size_t {
+        assert(a);
+        if (not wake_words)
+            return 0;
+        return members[a.segment_id()].wake_base +
+               wake_word_size * (a.offset() >> log2_gran);
+    }
+
+    // If 'numa_node' is non-negative, segments bound to that node are tried
+    // first, and then all others (in order). 'alignment' is as with
+    // basic_allocator::allocate(). 'sub_pool' must be less than
+    // sub_pool_count().
+    [[nodiscard]] auto allocate(std::size_t size, int numa_node = -1,
+                                std::size_t alignment = 0,
+                                std::size_t sub_pool = 0) -> allocation {
+        assert(sub_pool < sub_pool_count());
+        if (large_align != 0 && size >= large_align)
+            alignment = std::max(alignment, large_align);
+        return reset_wake_word(
+            allocate_any(size, numa_node, alignment, sub_pool));
+    }
+
+    // Allocate 'size' bytes as at most 'max_extents' allocations (in the
+    // order in which they make up the object), each time taking as much as
+    // fits in the largest free chunk, for when the size cannot be allocated
+    // contiguously because free space is fragmented. Extents other than the
+    // last are whole multiples of the granularity. No segments are added
+    // (the caller is expected to have tried allocate() first). Return an
+    // empty vector, having allocated nothing, if this is not possible.
+    [[nodiscard]] auto allocate_extents(std::size_t size,
+                                        std::size_t max_extents,
+                                        int numa_node = -1,
+                                        std::size_t sub_pool = 0)
+        -> std::vector<allocation> {
+        assert(sub_pool < sub_pool_count());
+        auto const gran_mask = ~((std::size_t(1) << log2_gran) - 1);
+        std::vector<allocation> ret;
+        auto remaining = size;
+        while (remaining > 0) {
+            if (ret.size() >= max_extents)
+                return {};
+            std::size_t largest = 0;
+            for (auto &m : members) {
+                if (auto const *al = find_allocator(m, sub_pool);
+                    al != nullptr && not m.overflow)
+                    largest = std::max(largest, al->stats().largest_free);
+            }
+            auto piece = std::min(remaining, largest);
+            if (piece < remaining)
+                piece &= gran_mask;
+            // The largest free chunk may not fit 'piece' once aligned (see
+            // large_object_alignment), so try smaller pieces.
+            allocation a;
+            while (piece > 0) {
+                auto const alignment =
+                    large_align != 0 && piece >= large_align ? large_align : 0;
+                a = reset_wake_word(allocate_in_existing(piece, numa_node,
+                                                         alignment, sub_pool));
+                if (a)
+                    break;
+                piece = (piece / 2) & gran_mask;
+            }
+            if (not a)
+                return {};
+            remaining -= piece;
+            ret.push_back(std::move(a));
+        }
+        return ret;
+    }
+
+    // Allocate exactly the given range of the given segment (see
+    // basic_allocator::allocate_at()), creating (primary) segments up to and
+    // including 'segment_id' if they do not exist yet.
+    [[nodiscard]] auto allocate_at(std::uint32_t segment_id,
+                                   std::size_t offset, std::size_t size)
+        -> allocation {
+        while (segment_id >= members.size()) {
+            if (not add_segment())
+                return {};
+        }
+        return reset_wake_word(
+            owner(members[segment_id], offset).allocate_at(offset, size));
+    }
+
+    // Change the size of 'a' in place (see basic_allocator::resize()). The
+    // offset, and hence the wake word, is unchanged. Return false, leaving
+    // 'a' unchanged, if the space after it is not free.
+    [[nodiscard]] auto resize(allocation &a, std::size_t size) -> bool {
+        assert(a);
+        return owner(members[a.segment_id()], a.offset()).resize(a, size);
+    }
+
+    // Allocate as with allocate() the size of 'src', and fill the new
+    // allocation with a copy of the data of 'src'.
+    [[nodiscard]] auto clone(allocation const &src, int numa_node = -1,
+                             std::size_t sub_pool = 0) -> allocation {
+        assert(src);
+        auto ret = allocate(src.size(), numa_node, 0, sub_pool);
+        if (ret)
+            parallel_copy(bytes(ret).data(), bytes(src).data(), src.size());
+        return ret;
+    }
+
+    // The data of an allocation, as mapped in the daemon. The address is
+    // valid until the allocation is destroyed.
+    [[nodiscard]] auto bytes(allocation const &a) -> gsl::span<std::uint8_t> {
+        assert(a);
+        auto *seg_data =
+            static_cast<std::uint8_t *>(members[a.segment_id()].seg.address());
+        return {seg_data + a.offset(), a.size()};
+    }
+
+    // Pass up to 'max_count' chunks of all segments and sub-pools, in order,
+    // to 'f(segment_id, offset, size, in_use)' and return true if more
+    // remain; see basic_allocator::scan_chunks(). Segments added during the
+    // scan are included.
+    template <typename F>
+    auto scan_chunks(std::size_t max_count, F &&f) -> bool {
+        std::size_t n = 0;
+        while (scan_member < members.size() && n < max_count) {
+            auto &m = members[scan_member];
+            auto &a = scan_allocr == 0 ? m.allocr
+                                       : m.sub_allocrs[scan_allocr - 1];
+            auto const seg_id = static_cast<std::uint32_t>(scan_member);
+            bool const more = a.scan_chunks(
+                max_count - n,
+                [&](std::size_t offset, std::size_t size, bool in_use) {
+                    ++n;
+                    f(seg_id, offset, size, in_use);
+                });
+            if (more)
+                return true;
+            if (++scan_allocr > m.sub_allocrs.size()) {
+                scan_allocr = 0;
+                ++scan_member;
+            }
+        }
+        if (scan_member < members.size())
+            return true;
+        scan_member = 0;
+        return false;
+    }
+
+    // Hold freed allocations for scrubbing (see arena::set_scrub_on_free()),
+    // in all segments, including those added later.
+    void set_scrub_on_free(bool enable) {
+        scrub_freed = enable;
+        for (auto &m : members)
+            apply_scrub_on_free(m);
+    }
+
+    // Freed allocations (of all segments and sub-pools) to be zero-filled
+    // (for example, with parallel_scrub() on bytes()) and then passed to
+    // free_scrubbed().
+    [[nodiscard]] auto take_chunks_to_scrub() -> std::vector<allocation> {
+        std::vector<allocation> ret;
+        auto const take = [&ret](allocator_type &a) {
+            auto allocs = a.take_chunks_to_scrub();
+            ret.insert(ret.end(), std::make_move_iterator(allocs.begin()),
+                       std::make_move_iterator(allocs.end()));
+        };
+        for (auto &m : members) {
+            take(m.allocr);
+            for (auto &a : m.sub_allocrs)
+                take(a);
+        }
+        return ret;
+    }
+
+    void free_scrubbed(allocation &&a) {
+        assert(a);
+        owner(members[a.segment_id()], a.offset())
+            .free_scrubbed(std::move(a));
+    }
+
+    // Return the pages of free chunks of at least 'min_size' bytes to the
+    // system. Chunks whose pages are released are subsequently known to be
+    // zero-filled. Return the number of bytes released (and zeroed).
+    auto release_free_pages(std::size_t min_size) -> std::size_t {
+        std::size_t released = 0;
+        for (auto &m : members) {
+            auto const release = [&m](std::size_t offset, std::size_t size) {
+                return m.seg.release_pages(offset, size);
+            };
+            released += m.allocr.release_free_chunks(min_size, release);
+            for (auto &a : m.sub_allocrs)
+                released += a.release_free_chunks(min_size, release);
+        }
+        return released;
+    }
+
+  private:
+    auto allocate_any(std::size_t size, int numa_node, std::size_t alignment,
+                      std::size_t sub_pool) -> allocation {
+        if (auto alloc =
+                allocate_in_existing(size, numa_node, alignment, sub_pool))
+            return alloc;
+
+        // A request that cannot fit in an empty segment cannot be satisfied
+        // by adding a segment.
+        if (members.empty() ||
+            size > find_allocator(members.front(), sub_pool)->size())
+            return {};
+
+        if (add_segment())
+            return find_allocator(members.back(), sub_pool)
+                ->allocate(size, alignment);
+
+        // Only the default pool spills to the overflow segment.
+        if (sub_pool != 0 ||
+            (overflow_member == nullptr && not add_overflow_segment()))
+            return {};
+        return overflow_member->allocr.allocate(size, alignment);
+    }
+
+    // Try the primary segments (those on 'numa_node', if non-negative, first).
+    auto allocate_in_existing(std::size_t size, int numa_node,
+                              std::size_t alignment, std::size_t sub_pool)
+        -> allocation {
+        if (numa_node >= 0) {
+            for (auto &m : members) {
+                auto *al = find_allocator(m, sub_pool);
+                if (al == nullptr || m.seg.numa_node() != numa_node)
+                    continue;
+                auto alloc = al->allocate(size, alignment);
+                if (alloc)
+                    return alloc;
+            }
+        }
+        for (auto &m : members) {
+            auto *al = find_allocator(m, sub_pool);
+            if (al == nullptr || m.overflow ||
+                (numa_node >= 0 && m.seg.numa_node() == numa_node))
+                continue; // Overflow is last resort, or already tried
+            auto alloc = al->allocate(size, alignment);
+            if (alloc)
+                return alloc;
+        }
+        return {};
+    }
+
+    // The allocator of the given sub-pool in the segment; nullptr for
+    // sub-pools other than the default in the overflow segment.
+    static auto find_allocator(member &m, std::size_t sub_pool)
+        -> allocator_type * {
+        if (sub_pool == 0)
+            return &m.allocr;
+        if (sub_pool > m.sub_allocrs.size())
+            return nullptr;
+        return &m.sub_allocrs[sub_pool - 1];
+    }
+
+    // The allocator managing 'offset' in the segment.
+    static auto owner(member &m, std::size_t offset) -> allocator_type & {
+        for (auto &a : m.sub_allocrs) {
+            if (a.contains(offset))
+                return a;
+        }
+        return m.allocr;
+    }
+
+    static auto total_size(std::vector<std::size_t> const &sizes)
+        -> std::size_t {
+        return std::accumulate(sizes.begin(), sizes.end(), std::size_t(0));
+    }
+
+    void apply_scrub_on_free(member &m) {
+        m.allocr.set_scrub_on_free(scrub_freed);
+        for (auto &a : m.sub_allocrs)
+            a.set_scrub_on_free(scrub_freed);
+    }
+
+    auto reset_wake_word(allocation &&a) -> allocation {
+        if (wake_words && a) {
+            auto *seg_data = static_cast<std::uint8_t *>(
+                members[a.segment_id()].seg.address());
+            std::memset(seg_data + wake_word_offset(a), 0, wake_word_size);
+        }
+        return std::move(a);
+    }
+
+    // Offset at which to place the wake words of a segment of the given
+    // size: the arena before it must have at most one granule per word after
+    // it, so it covers segment_size * g / (g + 4) bytes, in whole granules.
+    static auto wake_word_base(std::size_t segment_size,
+                               std::size_t log2_granularity) -> std::size_t {
+        auto const gran = std::size_t(1) << log2_granularity;
+        return (segment_size / (gran + wake_word_size)) << log2_granularity;
+    }
+
+    auto add_segment() -> bool {
+        if (primary_segs >= max_segs)
+            return false;
+        auto const id = static_cast<std::uint32_t>(members.size());
+        auto seg = create_seg(id);
+        if (not seg.is_valid()) {
+            spdlog::error("failed to create shared memory segment {}", id);
+            return false;
+        }
+        auto const arena_size = wake_words
+                                    ? wake_word_base(seg.size(), log2_gran)
+                                    : seg.size();
+        if (total_size(sub_sizes) >= arena_size) {
+            spdlog::error("sub-pools do not fit in shared memory segment {}",
+                          id);
+            return false;
+        }
+        auto &m = members.emplace_back(std::move(seg), log2_gran, id,
+                                        zero_filled, wake_words, false,
+                                        sub_sizes);
+        apply_scrub_on_free(m);
+        ++primary_segs;
+        spdlog::info("created shared memory segment {} ({})", id,
+                     human_readable_size(m.seg.size()));
+        return true;
+    }
+
+    // Attempted at most once, so that every allocation failure does not
+    // retry (and log).
+    auto add_overflow_segment() -> bool {
+        if (not create_overflow_seg || overflow_tried)
+            return false;
+        overflow_tried = true;
+        auto const id = static_cast<std::uint32_t>(members.size());
+        auto seg = create_overflow_seg(id);
+        if (not seg.is_valid()) {
+            spdlog::error("failed to create overflow segment {}", id);
+            return false;
+        }
+        if (seg.size() != members.front().seg.size()) {
+            spdlog::error("overflow segment size does not match; not used");
+            return false;
+        }
+        overflow_member = &members.emplace_back(std::move(seg), log2_gran, id,
+                                                false, wake_words, true);
+        apply_scrub_on_free(*overflow_member);
+        spdlog::warn("primary shared memory is full; spilling to overflow "
+                     "segment {} ({})",
+                     id, human_readable_size(overflow_member->seg.size()));
+        return true;
+    }
+};
+
+using segment_pool = basic_segment_pool<segment, internal::arena>;
+
+} // namespace partake::daemon
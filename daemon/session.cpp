@@ -6,16 +6,27 @@
 
 #include "session.hpp"
 
+#include "allocator.hpp"
+#include "compression.hpp"
 #include "handle.hpp"
 #include "key_sequence.hpp"
 #include "object.hpp"
+#include "quota.hpp"
 #include "repository.hpp"
 #include "token.hpp"
 
 #include <doctest.h>
+#include <gsl/span>
 #include <trompeloeil.hpp>
 
+#include <array>
 #include <chrono>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
 namespace partake::daemon {
 
@@ -24,22 +35,43 @@ namespace partake::daemon {
 
 namespace {
 
-struct mock_allocator {
-    // Use 'int' as resource type.
-    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
-    MAKE_MOCK1(allocate, auto(std::size_t)->int);
-};
-
 struct mock_segment {
     // Use 'int' as segment spec type.
     // NOLINTNEXTLINE(modernize-use-trailing-return-type)
     MAKE_CONST_MOCK0(spec, auto()->int);
 };
 
+struct mock_allocator {
+    // Use 'int' as resource type.
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_MOCK3(allocate, auto(std::size_t, int, std::size_t)->int);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_MOCK4(allocate,
+               auto(std::size_t, int, std::size_t, std::size_t)->int);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_MOCK2(clone, auto(int const &, int)->int);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_MOCK3(clone, auto(int const &, int, std::size_t)->int);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_MOCK1(bytes, auto(int const &)->gsl::span<std::uint8_t>);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_MOCK2(resize, auto(int &, std::size_t)->bool);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_CONST_MOCK0(max_allocation_size, auto()->std::size_t);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_CONST_MOCK0(stats, auto()->allocator_stats);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_CONST_MOCK1(find_segment,
+                     auto(std::uint32_t)->mock_segment const *);
+    // NOLINTNEXTLINE(modernize-use-trailing-return-type)
+    MAKE_CONST_MOCK1(find_sub_pool,
+                     auto(std::string_view)->std::optional<std::size_t>);
+};
+
 struct mock_voucher_queue {
     using object_type = object<int>;
-    MAKE_MOCK1(enqueue, void(std::shared_ptr<object_type>));
-    MAKE_MOCK1(drop, void(std::shared_ptr<object_type>));
+    MAKE_MOCK1(enqueue, void(ref_ptr<object_type>));
+    MAKE_MOCK1(drop, void(ref_ptr<object_type>));
 };
 
 } // namespace
@@ -50,9 +82,8 @@ TEST_CASE("session: global ops") {
     using session_type =
         session<mock_allocator,
                 repository<object<int>, key_sequence, mock_voucher_queue>,
-                handle<object<int>>, mock_segment>;
+                handle<object<int>>>;
     mock_allocator alloc;
-    mock_segment const seg;
     mock_voucher_queue vq;
     repository<object<int>, key_sequence, mock_voucher_queue> repo(
         key_sequence(), vq);
@@ -60,7 +91,7 @@ TEST_CASE("session: global ops") {
     using protocol::Status;
     using namespace std::chrono_literals;
 
-    session_type sess(42, seg, alloc, repo, 10s);
+    session_type sess(42, alloc, repo, 10s);
     CHECK(sess.is_valid());
     CHECK(sess.session_id() == 42);
     CHECK(sess.name().empty());
@@ -69,7 +100,10 @@ TEST_CASE("session: global ops") {
     SUBCASE("hello") {
         std::uint32_t session_id = 0;
         sess.hello(
-            "myclient", 1234, [&](std::uint32_t id) { session_id = id; },
+            "myclient", 1234,
+            [&](std::uint32_t id, [[maybe_unused]] cpu_placement const &p) {
+                session_id = id;
+            },
             []([[maybe_unused]] Status err) { CHECK(false); });
         CHECK(session_id == 42);
         CHECK(sess.name() == "myclient");
@@ -78,19 +112,137 @@ TEST_CASE("session: global ops") {
         // Second call is error
         auto err = Status::OK;
         sess.hello(
-            "", 0, [](std::uint32_t) { CHECK(false); },
+            "", 0, [](std::uint32_t, cpu_placement const &) { CHECK(false); },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::INVALID_REQUEST);
+    }
+
+    SUBCASE("hello with CPU") {
+        int cpu = -1;
+        sess.hello(
+            "pinned", 1234,
+            [&]([[maybe_unused]] std::uint32_t id, cpu_placement const &p) {
+                cpu = p.cpu;
+            },
+            []([[maybe_unused]] Status err) { CHECK(false); }, 0);
+        CHECK(cpu == 0);
+    }
+
+    SUBCASE("hello with known topology") {
+        cpu_placement p;
+        p.cpu = 1;
+        p.numa_node = 1;
+        repo.topology() = cpu_topology({cpu_placement{0}, p});
+        int node = -1;
+        sess.hello(
+            "pinned", 1234,
+            [&]([[maybe_unused]] std::uint32_t id, cpu_placement const &pl) {
+                node = pl.numa_node;
+            },
+            []([[maybe_unused]] Status err) { CHECK(false); }, 1);
+        CHECK(node == 1);
+    }
+
+    SUBCASE("sub-pool") {
+        REQUIRE_CALL(alloc, find_sub_pool("nosuch")).RETURN(std::nullopt);
+        CHECK_FALSE(sess.bind_sub_pool("nosuch"));
+        REQUIRE_CALL(alloc, find_sub_pool("mypool")).RETURN(2);
+        CHECK(sess.bind_sub_pool("mypool"));
+
+        int rsrc = 0;
+        REQUIRE_CALL(alloc, allocate(64, -1, 0, 2)).RETURN(7);
+        sess.alloc(
+            64, protocol::Policy::PRIMITIVE, -1, 0,
+            [&]([[maybe_unused]] common::token k, int r) { rsrc = r; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(rsrc == 7);
+
+        // Cannot rebind after hello
+        sess.hello(
+            "myclient", 1234, [](std::uint32_t, cpu_placement const &) {},
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK_FALSE(sess.bind_sub_pool("mypool"));
+    }
+
+    SUBCASE("alloc with NUMA node") {
+        int rsrc = 0;
+        REQUIRE_CALL(alloc, allocate(64, 1, 0)).RETURN(7);
+        sess.alloc(
+            64, protocol::Policy::PRIMITIVE, 1, 0,
+            [&]([[maybe_unused]] common::token k, int r) { rsrc = r; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(rsrc == 7);
+    }
+
+    SUBCASE("alloc with alignment") {
+        int rsrc = 0;
+        REQUIRE_CALL(alloc, allocate(64, -1, 4096)).RETURN(7);
+        sess.alloc(
+            64, protocol::Policy::PRIMITIVE, -1, 4096,
+            [&]([[maybe_unused]] common::token k, int r) { rsrc = r; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(rsrc == 7);
+    }
+
+    SUBCASE("alloc sampled by allocation profiler") {
+        repo.alloc_profiler().set_sample_interval(2);
+        sess.hello(
+            "prof", 99, [](std::uint32_t, cpu_placement const &) {},
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        std::vector<common::token> keys;
+        REQUIRE_CALL(alloc, allocate(64, -1, 0)).RETURN(7).TIMES(2);
+        for (int i = 0; i < 2; ++i) {
+            sess.alloc(
+                64, protocol::Policy::PRIMITIVE, -1, 0,
+                [&](common::token k, [[maybe_unused]] int r) {
+                    keys.push_back(k);
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+        }
+        auto const &profs = repo.alloc_profiler().profiles();
+        REQUIRE(profs.size() == 1);
+        CHECK(profs[0].client_name == "prof");
+        CHECK(profs[0].client_pid == 99);
+        CHECK(profs[0].sampled_allocations == 1);
+        CHECK(profs[0].live_samples == 1);
+        for (auto k : keys) {
+            sess.close(
+                k, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        }
+        CHECK(profs[0].live_samples == 0);
+        CHECK(profs[0].lifetimes.count() == 1);
+    }
+
+    SUBCASE("alloc with non-power-of-2 alignment") {
+        auto err = Status::OK;
+        sess.alloc(
+            64, protocol::Policy::PRIMITIVE, -1, 3000,
+            []([[maybe_unused]] common::token k, [[maybe_unused]] int r) {
+                CHECK(false);
+            },
             [&](Status e) { err = e; });
         CHECK(err == Status::INVALID_REQUEST);
     }
 
     SUBCASE("get_segment") {
+        mock_segment const seg;
         int spec = 0;
         ALLOW_CALL(seg, spec()).RETURN(5678);
+        REQUIRE_CALL(alloc, find_segment(1)).RETURN(&seg);
         sess.get_segment(
-            0, [&](int s) { spec = s; },
+            1, [&](int s) { spec = s; },
             []([[maybe_unused]] Status err) { CHECK(false); });
         CHECK(spec == 5678);
     }
+
+    SUBCASE("get_segment -> no such segment") {
+        REQUIRE_CALL(alloc, find_segment(2)).RETURN(nullptr);
+        auto err = Status::OK;
+        sess.get_segment(
+            2, []([[maybe_unused]] int s) { CHECK(false); },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::NO_SUCH_SEGMENT);
+    }
 }
 
 TEST_CASE("session: object ops") {
@@ -100,9 +252,8 @@ TEST_CASE("session: object ops") {
     using session_type =
         session<mock_allocator,
                 repository<object<int>, key_sequence, mock_voucher_queue>,
-                handle<object<int>>, mock_segment>;
+                handle<object<int>>>;
     mock_allocator alloc;
-    mock_segment const seg;
     mock_voucher_queue vq;
     repository<object<int>, key_sequence, mock_voucher_queue> repo(
         key_sequence(), vq);
@@ -113,8 +264,8 @@ TEST_CASE("session: object ops") {
     using trompeloeil::_;
     using namespace std::chrono_literals;
 
-    session_type sess1(42, seg, alloc, repo, 10s);
-    session_type sess2(43, seg, alloc, repo, 10s);
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
 
     GIVEN("nonexistent key") {
         std::vector const keys{token(0), token(12345)};
@@ -157,6 +308,15 @@ TEST_CASE("session: object ops") {
                 CHECK(err == Status::NO_SUCH_OBJECT);
             }
 
+            SUBCASE("share_and_create_voucher -> no such object") {
+                auto err = Status::OK;
+                sess1.share_and_create_voucher(
+                    key, 1, clock::now(),
+                    []([[maybe_unused]] token k) { CHECK(false); },
+                    [&](Status e) { err = e; });
+                CHECK(err == Status::NO_SUCH_OBJECT);
+            }
+
             SUBCASE("unshare -> no such object") {
                 std::vector const waits{false, true};
                 for (bool wait : waits) {
@@ -195,9 +355,9 @@ TEST_CASE("session: object ops") {
 
     GIVEN("default policy, unshared, opened by sess1") {
         token key;
-        REQUIRE_CALL(alloc, allocate(1024)).RETURN(532);
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(532);
         sess1.alloc(
-            1024, Policy::DEFAULT,
+            1024, Policy::DEFAULT, -1, 0,
             [&](token k, int r) {
                 CHECK(r == 532);
                 key = k;
@@ -222,6 +382,141 @@ TEST_CASE("session: object ops") {
             }
         }
 
+        SUBCASE("clone by sess1 -> succeeds, unshared") {
+            REQUIRE_CALL(alloc, clone(532, -1)).RETURN(533);
+            token key2;
+            sess1.clone(
+                key, Policy::DEFAULT,
+                [&](token k, int r) {
+                    CHECK(r == 533);
+                    key2 = k;
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(key2.is_valid());
+            CHECK(key2 != key);
+
+            auto err = Status::OK;
+            sess1.share(
+                key2, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+            sess2.share(
+                key2, [] { CHECK(false); }, [&](Status e) { err = e; });
+            CHECK(err == Status::NO_SUCH_OBJECT);
+        }
+
+        SUBCASE("clone by sess1 -> out of shmem") {
+            REQUIRE_CALL(alloc, clone(532, -1)).RETURN(0);
+            auto err = Status::OK;
+            sess1.clone(
+                key, Policy::DEFAULT,
+                []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                    CHECK(false);
+                },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::OUT_OF_SHMEM);
+        }
+
+        SUBCASE("clone by sess2 -> no such object") {
+            auto err = Status::OK;
+            sess2.clone(
+                key, Policy::DEFAULT,
+                []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                    CHECK(false);
+                },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::NO_SUCH_OBJECT);
+        }
+
+        std::array<std::uint8_t, 1024> data{};
+        ALLOW_CALL(alloc, bytes(532)).RETURN(gsl::span<std::uint8_t>(data));
+
+        SUBCASE("map_range by sess1 -> succeeds") {
+            gsl::span<std::uint8_t> bytes;
+            sess1.map_range(
+                key, 24, 1000, true,
+                [&](gsl::span<std::uint8_t> b, auto obj) {
+                    bytes = b;
+                    CHECK(obj->key() == key);
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(bytes.data() == data.data() + 24);
+            CHECK(bytes.size() == 1000);
+        }
+
+        SUBCASE("map_range beyond end -> invalid request") {
+            auto err = Status::OK;
+            sess1.map_range(
+                key, 24, 1001, false,
+                []([[maybe_unused]] gsl::span<std::uint8_t> b,
+                   [[maybe_unused]] auto obj) { CHECK(false); },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::INVALID_REQUEST);
+        }
+
+        SUBCASE("map_range by sess2 -> no such object") {
+            auto err = Status::OK;
+            sess2.map_range(
+                key, 0, 0, false,
+                []([[maybe_unused]] gsl::span<std::uint8_t> b,
+                   [[maybe_unused]] auto obj) { CHECK(false); },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::NO_SUCH_OBJECT);
+        }
+
+        SUBCASE("map_for_prefetch by sess1 -> succeeds") {
+            std::size_t size = 0;
+            sess1.map_for_prefetch(
+                key, clock::now(),
+                [&](gsl::span<std::uint8_t> b, [[maybe_unused]] auto obj) {
+                    size = b.size();
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(size == 1024);
+        }
+
+        SUBCASE("map_for_prefetch by sess2 -> no such object") {
+            auto err = Status::OK;
+            sess2.map_for_prefetch(
+                key, clock::now(),
+                []([[maybe_unused]] gsl::span<std::uint8_t> b,
+                   [[maybe_unused]] auto obj) { CHECK(false); },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::NO_SUCH_OBJECT);
+        }
+
+        SUBCASE("share by sess1 -> prefetchable by sess2") {
+            sess1.share(
+                key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+            std::size_t size = 0;
+            sess2.map_for_prefetch(
+                key, clock::now(),
+                [&](gsl::span<std::uint8_t> b, auto obj) {
+                    size = b.size();
+                    CHECK(obj->key() == key);
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(size == 1024);
+        }
+
+        SUBCASE("share by sess1 -> only readable") {
+            sess1.share(
+                key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+            auto err = Status::OK;
+            sess1.map_range(
+                key, 0, 1024, true,
+                []([[maybe_unused]] gsl::span<std::uint8_t> b,
+                   [[maybe_unused]] auto obj) { CHECK(false); },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::NO_SUCH_OBJECT);
+            std::size_t size = 0;
+            sess1.map_range(
+                key, 0, 1024, false,
+                [&](gsl::span<std::uint8_t> b, [[maybe_unused]] auto obj) {
+                    size = b.size();
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(size == 1024);
+        }
+
         SUBCASE("close by sess2 -> no such object") {
             auto err = Status::OK;
             sess2.close(
@@ -323,6 +618,57 @@ TEST_CASE("session: object ops") {
                 CHECK(ok);
                 CHECK(opened_key == key);
             }
+
+            SUBCASE("open-wait again by sess2 -> both succeed on share") {
+                token opened_key2;
+                sess2.open(
+                    key, Policy::DEFAULT, true, clock::now(),
+                    []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                        CHECK(false);
+                    },
+                    []([[maybe_unused]] Status e) { CHECK(false); },
+                    [&](token k, [[maybe_unused]] int r) { opened_key2 = k; },
+                    []([[maybe_unused]] Status e) { CHECK(false); });
+                CHECK_FALSE(opened_key2.is_valid());
+                sess1.share(
+                    key, [] {},
+                    []([[maybe_unused]] Status e) { CHECK(false); });
+                CHECK(opened_key == key);
+                CHECK(opened_key2 == key);
+            }
+        }
+
+        SUBCASE("open-wait with timeout by sess2 -> times out") {
+            token opened_key;
+            auto err = Status::OK;
+            auto const now = clock::now();
+            sess2.open(
+                key, Policy::DEFAULT, true, now,
+                []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                    CHECK(false);
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); },
+                [&](token k, [[maybe_unused]] int r) { opened_key = k; },
+                [&](Status e) { err = e; }, 100ms);
+            CHECK(repo.wait_deadlines().next_deadline() == now + 100ms);
+
+            SUBCASE("share by sess1 before timeout -> open-wait succeeds") {
+                sess1.share(
+                    key, [] {},
+                    []([[maybe_unused]] Status e) { CHECK(false); });
+                CHECK(opened_key == key);
+                CHECK(repo.wait_deadlines().size() == 0);
+            }
+
+            SUBCASE("timeout -> open-wait fails, timed out") {
+                CHECK(repo.wait_deadlines().expire(now + 99ms) == 0);
+                CHECK(repo.wait_deadlines().expire(now + 100ms) == 1);
+                CHECK(err == Status::TIMED_OUT);
+                sess1.share(
+                    key, [] {},
+                    []([[maybe_unused]] Status e) { CHECK(false); });
+                CHECK_FALSE(opened_key.is_valid());
+            }
         }
 
         SUBCASE("share by sess1 -> succeeds") {
@@ -340,6 +686,99 @@ TEST_CASE("session: object ops") {
             CHECK(err == Status::NO_SUCH_OBJECT);
         }
 
+        SUBCASE("share_and_create_voucher by sess1 -> succeeds") {
+            token vkey;
+            REQUIRE_CALL(vq, enqueue(_)).TIMES(1);
+            sess1.share_and_create_voucher(
+                key, 3, clock::now(), [&](token k) { vkey = k; },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(vkey.is_valid());
+            CHECK(vkey != key);
+
+            SUBCASE("share by sess1 -> no such object") {
+                auto err = Status::OK;
+                sess1.share(
+                    key, [] { CHECK(false); }, [&](Status e) { err = e; });
+                CHECK(err == Status::NO_SUCH_OBJECT);
+            }
+
+            SUBCASE("open-nowait by sess2 via voucher -> succeeds") {
+                token opened_key;
+                sess2.open(
+                    vkey, Policy::DEFAULT, false, clock::now(),
+                    [&](token k, [[maybe_unused]] int r) { opened_key = k; },
+                    []([[maybe_unused]] Status e) { CHECK(false); },
+                    []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                        CHECK(false);
+                    },
+                    []([[maybe_unused]] Status e) { CHECK(false); });
+                CHECK(opened_key == key);
+            }
+
+            SUBCASE("open-nowait by sess1 via voucher -> reuses handle") {
+                token opened_key;
+                sess1.open(
+                    vkey, Policy::DEFAULT, false, clock::now(),
+                    [&](token k, [[maybe_unused]] int r) { opened_key = k; },
+                    []([[maybe_unused]] Status e) { CHECK(false); },
+                    []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                        CHECK(false);
+                    },
+                    []([[maybe_unused]] Status e) { CHECK(false); });
+                CHECK(opened_key == key);
+                CHECK(sess1.handle_count() == 1);
+            }
+        }
+
+        SUBCASE("share_and_create_voucher with short TTL -> expires early") {
+            token vkey;
+            auto const now = clock::now();
+            REQUIRE_CALL(vq, enqueue(_)).TIMES(1);
+            sess1.share_and_create_voucher(
+                key, 3, now, 100ms, [&](token k) { vkey = k; },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(vkey.is_valid());
+
+            auto err = Status::OK;
+            sess2.open(
+                vkey, Policy::DEFAULT, false, now + 200ms,
+                []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                    CHECK(false);
+                },
+                [&](Status e) { err = e; },
+                []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                    CHECK(false);
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(err == Status::NO_SUCH_OBJECT);
+        }
+
+        SUBCASE("share_and_create_voucher with zero count -> invalid") {
+            auto err = Status::OK;
+            sess1.share_and_create_voucher(
+                key, 0, clock::now(),
+                []([[maybe_unused]] token k) { CHECK(false); },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::INVALID_REQUEST);
+
+            SUBCASE("share by sess1 -> succeeds") {
+                bool ok = false;
+                sess1.share(
+                    key, [&] { ok = true; },
+                    []([[maybe_unused]] Status e) { CHECK(false); });
+                CHECK(ok);
+            }
+        }
+
+        SUBCASE("share_and_create_voucher by sess2 -> no such object") {
+            auto err = Status::OK;
+            sess2.share_and_create_voucher(
+                key, 1, clock::now(),
+                []([[maybe_unused]] token k) { CHECK(false); },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::NO_SUCH_OBJECT);
+        }
+
         SUBCASE("unshare by sess1 -> no such object") {
             auto err = Status::OK;
             sess1.unshare(
@@ -407,9 +846,9 @@ TEST_CASE("session: object ops") {
 
     GIVEN("default policy, shared, opened by sess1") {
         token key;
-        REQUIRE_CALL(alloc, allocate(1024)).RETURN(532);
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(532);
         sess1.alloc(
-            1024, Policy::DEFAULT,
+            1024, Policy::DEFAULT, -1, 0,
             [&](token k, int r) {
                 CHECK(r == 532);
                 sess1.share(
@@ -578,9 +1017,9 @@ TEST_CASE("session: object ops") {
 
     GIVEN("default policy, shared, opened by sess1 and sess2") {
         token key;
-        REQUIRE_CALL(alloc, allocate(1024)).RETURN(532);
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(532);
         sess1.alloc(
-            1024, Policy::DEFAULT,
+            1024, Policy::DEFAULT, -1, 0,
             [&](token k, int r) {
                 CHECK(r == 532);
                 sess1.share(
@@ -642,6 +1081,30 @@ TEST_CASE("session: object ops") {
             CHECK(err == Status::OBJECT_BUSY);
         }
 
+        SUBCASE("unshare-wait with timeout by sess1 -> times out") {
+            token newkey;
+            auto err = Status::OK;
+            sess1.unshare(
+                key, true, []([[maybe_unused]] token k) { CHECK(false); },
+                []([[maybe_unused]] Status e) { CHECK(false); },
+                [&](token k) { newkey = k; }, [&](Status e) { err = e; },
+                100ms);
+            CHECK(repo.wait_deadlines().size() == 1);
+            CHECK(repo.wait_deadlines().expire(
+                      repo.wait_deadlines().next_deadline()) == 1);
+            CHECK(err == Status::TIMED_OUT);
+
+            // No longer reserved
+            auto err2 = Status::OK;
+            sess2.unshare(
+                key, false, []([[maybe_unused]] token k) { CHECK(false); },
+                [&](Status e) { err2 = e; },
+                []([[maybe_unused]] token k) { CHECK(false); },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(err2 == Status::OBJECT_BUSY);
+            CHECK_FALSE(newkey.is_valid());
+        }
+
         SUBCASE("unshare-wait by sess1 -> waits") {
             token newkey;
             auto err = Status::OK;
@@ -725,9 +1188,9 @@ TEST_CASE("session: object ops") {
 
     GIVEN("default policy, shared, opened by sess1 twice") {
         token key;
-        REQUIRE_CALL(alloc, allocate(1024)).RETURN(532);
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(532);
         sess1.alloc(
-            1024, Policy::DEFAULT,
+            1024, Policy::DEFAULT, -1, 0,
             [&](token k, int r) {
                 CHECK(r == 532);
                 sess1.share(
@@ -833,11 +1296,11 @@ TEST_CASE("session: object ops") {
         token key;
         token vkey;
         // Keep voucher alive despite voucher queue being mocked:
-        std::shared_ptr<object<int>> vptr;
-        REQUIRE_CALL(alloc, allocate(1024)).RETURN(532);
+        ref_ptr<object<int>> vptr;
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(532);
         REQUIRE_CALL(vq, enqueue(_)).LR_SIDE_EFFECT(vptr = _1).TIMES(1);
         sess1.alloc(
-            1024, Policy::DEFAULT,
+            1024, Policy::DEFAULT, -1, 0,
             [&](token k, int r) {
                 key = k;
                 CHECK(r == 532);
@@ -978,11 +1441,11 @@ TEST_CASE("session: object ops") {
         token key;
         token vkey;
         // Keep voucher alive despite voucher queue being mocked:
-        std::shared_ptr<object<int>> vptr;
-        REQUIRE_CALL(alloc, allocate(1024)).RETURN(532);
+        ref_ptr<object<int>> vptr;
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(532);
         REQUIRE_CALL(vq, enqueue(_)).LR_SIDE_EFFECT(vptr = _1).TIMES(1);
         sess1.alloc(
-            1024, Policy::DEFAULT,
+            1024, Policy::DEFAULT, -1, 0,
             [&](token k, int r) {
                 key = k;
                 CHECK(r == 532);
@@ -1085,9 +1548,9 @@ TEST_CASE("session: object ops") {
 
     GIVEN("primitive policy, opened by sess1") {
         token key;
-        REQUIRE_CALL(alloc, allocate(1024)).RETURN(532);
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(532);
         sess1.alloc(
-            1024, Policy::PRIMITIVE,
+            1024, Policy::PRIMITIVE, -1, 0,
             [&](token k, int r) {
                 CHECK(r == 532);
                 key = k;
@@ -1095,6 +1558,20 @@ TEST_CASE("session: object ops") {
             []([[maybe_unused]] Status e) { CHECK(false); });
         CHECK(key.is_valid());
 
+        SUBCASE("map_range writable by sess1 -> succeeds") {
+            std::array<std::uint8_t, 1024> data{};
+            REQUIRE_CALL(alloc, bytes(532))
+                .RETURN(gsl::span<std::uint8_t>(data));
+            std::size_t size = 0;
+            sess1.map_range(
+                key, 0, 1024, true,
+                [&](gsl::span<std::uint8_t> b, [[maybe_unused]] auto obj) {
+                    size = b.size();
+                },
+                []([[maybe_unused]] Status e) { CHECK(false); });
+            CHECK(size == 1024);
+        }
+
         SUBCASE("close by sess1 -> succeeds") {
             bool ok = false;
             sess1.close(
@@ -1267,6 +1744,1267 @@ TEST_CASE("session: object ops") {
     sess2.drop_pending_requests();
 }
 
+TEST_CASE("session: buffer pools") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using trompeloeil::_;
+    using namespace std::chrono_literals;
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+
+    int next_rsrc = 100;
+    ALLOW_CALL(alloc, allocate(1024, -1, 0)).LR_RETURN(++next_rsrc);
+
+    auto const create_pool = [&](std::uint32_t count) {
+        std::uint32_t pool_id = 0;
+        sess1.create_pool(
+            count, 1024, Policy::DEFAULT,
+            [&](std::uint32_t id) { pool_id = id; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        return pool_id;
+    };
+
+    // Return the resource, or 0 with 'err' set.
+    auto const alloc_from_pool = [&](std::uint32_t pool_id, token &key,
+                                     Status &err) {
+        int rsrc = 0;
+        err = Status::OK;
+        sess1.alloc_from_pool(
+            pool_id,
+            [&](token k, int r) {
+                key = k;
+                rsrc = r;
+            },
+            [&](Status e) { err = e; });
+        return rsrc;
+    };
+
+    SUBCASE("invalid count") {
+        std::vector<std::uint32_t> const counts{0, max_pool_buffer_count + 1};
+        for (auto count : counts) {
+            auto err = Status::OK;
+            sess1.create_pool(
+                count, 1024, Policy::DEFAULT,
+                []([[maybe_unused]] std::uint32_t id) { CHECK(false); },
+                [&](Status e) { err = e; });
+            CHECK(err == Status::INVALID_REQUEST);
+        }
+    }
+
+    SUBCASE("out of shmem") {
+        REQUIRE_CALL(alloc, allocate(2048, -1, 0)).RETURN(0);
+        auto err = Status::OK;
+        sess1.create_pool(
+            2, 2048, Policy::DEFAULT,
+            []([[maybe_unused]] std::uint32_t id) { CHECK(false); },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::OUT_OF_SHMEM);
+    }
+
+    SUBCASE("closed buffer is reused") {
+        auto const pool_id = create_pool(2);
+        CHECK(pool_id == 1);
+        CHECK(create_pool(1) == 2);
+
+        token k0;
+        token k1;
+        auto err = Status::OK;
+        CHECK(alloc_from_pool(pool_id, k0, err) == 101);
+        CHECK(alloc_from_pool(pool_id, k1, err) == 102);
+        CHECK(k0 != k1);
+        token k2;
+        CHECK(alloc_from_pool(pool_id, k2, err) == 0);
+        CHECK(err == Status::OUT_OF_SHMEM);
+
+        sess1.close(
+            k0, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        token k3;
+        CHECK(alloc_from_pool(pool_id, k3, err) == 101);
+        CHECK(k3 != k0);
+    }
+
+    SUBCASE("buffer is returned when last reader closes") {
+        auto const pool_id = create_pool(1);
+        token key;
+        auto err = Status::OK;
+        REQUIRE(alloc_from_pool(pool_id, key, err) == 101);
+        sess1.share(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        int opened = 0;
+        sess2.open(
+            key, Policy::DEFAULT, false, clock::now(),
+            [&]([[maybe_unused]] token k, int r) { opened = r; },
+            []([[maybe_unused]] Status e) { CHECK(false); },
+            []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                CHECK(false);
+            },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(opened == 101);
+
+        sess1.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        token k1;
+        CHECK(alloc_from_pool(pool_id, k1, err) == 0);
+        CHECK(err == Status::OUT_OF_SHMEM);
+
+        sess2.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(alloc_from_pool(pool_id, k1, err) == 101);
+    }
+
+    SUBCASE("no such pool") {
+        token key;
+        auto err = Status::OK;
+        CHECK(alloc_from_pool(5, key, err) == 0);
+        CHECK(err == Status::INVALID_REQUEST);
+        sess1.destroy_pool(
+            5, [] { CHECK(false); }, [&](Status e) { err = e; });
+        CHECK(err == Status::INVALID_REQUEST);
+    }
+
+    SUBCASE("destroy pool with buffer in use") {
+        auto const pool_id = create_pool(1);
+        token key;
+        auto err = Status::OK;
+        REQUIRE(alloc_from_pool(pool_id, key, err) == 101);
+        bool destroyed = false;
+        sess1.destroy_pool(
+            pool_id, [&] { destroyed = true; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(destroyed);
+        token k1;
+        CHECK(alloc_from_pool(pool_id, k1, err) == 0);
+        CHECK(err == Status::INVALID_REQUEST);
+        bool closed = false;
+        sess1.close(
+            key, [&] { closed = true; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(closed);
+    }
+}
+
+TEST_CASE("session: alloc with wait") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using namespace std::chrono_literals;
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+    ALLOW_CALL(alloc, max_allocation_size()).RETURN(4096);
+    ALLOW_CALL(alloc, stats()).RETURN(allocator_stats{});
+
+    token key;
+    REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(7);
+    sess1.alloc(
+        1024, Policy::PRIMITIVE, -1, 0, [&](token k, int) { key = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    REQUIRE(key.is_valid());
+
+    int next_rsrc = 0; // Out of shmem
+    ALLOW_CALL(alloc, allocate(2048, -1, 0)).LR_RETURN(next_rsrc);
+    int rsrc = 0;
+    sess2.alloc_or_wait(
+        2048, Policy::PRIMITIVE, -1, 0,
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) { CHECK(false); },
+        []([[maybe_unused]] Status e) { CHECK(false); },
+        [&]([[maybe_unused]] token k, int r) { rsrc = r; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    CHECK(repo.alloc_waiters().size() == 1);
+
+    SUBCASE("completed when memory is freed") {
+        repo.perform_housekeeping(); // Nothing freed yet
+        CHECK(rsrc == 0);
+
+        sess1.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        next_rsrc = 8;
+        repo.perform_housekeeping();
+        CHECK(rsrc == 8);
+        CHECK(repo.alloc_waiters().size() == 0);
+    }
+
+    SUBCASE("still waiting if not enough freed") {
+        sess1.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        repo.perform_housekeeping();
+        CHECK(rsrc == 0);
+        CHECK(repo.alloc_waiters().size() == 1);
+    }
+
+    SUBCASE("canceled by drop_pending_requests") {
+        sess2.drop_pending_requests();
+        CHECK(repo.alloc_waiters().size() == 0);
+    }
+
+    SUBCASE("request larger than max allocation size") {
+        REQUIRE_CALL(alloc, allocate(8192, -1, 0)).RETURN(0);
+        auto err = Status::OK;
+        sess2.alloc_or_wait(
+            8192, Policy::PRIMITIVE, -1, 0,
+            []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                CHECK(false);
+            },
+            [&](Status e) { err = e; },
+            []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                CHECK(false);
+            },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(err == Status::OUT_OF_SHMEM);
+        CHECK(repo.alloc_waiters().size() == 1);
+    }
+}
+
+TEST_CASE("session: allocations on hold") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using namespace std::chrono_literals;
+
+    session_type sess(42, alloc, repo, 10s);
+    ALLOW_CALL(alloc, max_allocation_size()).RETURN(4096);
+    ALLOW_CALL(alloc, stats()).RETURN(allocator_stats{});
+
+    repo.alloc_waiters().hold();
+    int rsrc1 = 0;
+    int rsrc2 = 0;
+    auto err1 = Status::OK;
+    auto err2 = Status::OK;
+    sess.alloc_when_ready(
+        1024, Policy::PRIMITIVE, -1, 0,
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) { CHECK(false); },
+        []([[maybe_unused]] Status e) { CHECK(false); },
+        [&]([[maybe_unused]] token k, int r) { rsrc1 = r; },
+        [&](Status e) { err1 = e; });
+    sess.alloc_or_wait(
+        2048, Policy::PRIMITIVE, -1, 0,
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) { CHECK(false); },
+        []([[maybe_unused]] Status e) { CHECK(false); },
+        [&]([[maybe_unused]] token k, int r) { rsrc2 = r; },
+        [&](Status e) { err2 = e; });
+    CHECK(repo.alloc_waiters().size() == 2);
+    repo.perform_housekeeping();
+    CHECK(repo.alloc_waiters().size() == 2);
+
+    SUBCASE("completed when released") {
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(7);
+        REQUIRE_CALL(alloc, allocate(2048, -1, 0)).RETURN(8);
+        repo.alloc_waiters().release();
+        repo.perform_housekeeping();
+        CHECK(rsrc1 == 7);
+        CHECK(rsrc2 == 8);
+        CHECK(repo.alloc_waiters().size() == 0);
+    }
+
+    SUBCASE("only the waiting request keeps waiting for memory") {
+        REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(0);
+        REQUIRE_CALL(alloc, allocate(2048, -1, 0)).RETURN(0);
+        repo.alloc_waiters().release();
+        repo.perform_housekeeping();
+        CHECK(err1 == Status::OUT_OF_SHMEM);
+        CHECK(rsrc2 == 0);
+        CHECK(err2 == Status::OK);
+        CHECK(repo.alloc_waiters().size() == 1);
+    }
+
+    SUBCASE("canceled by drop_pending_requests") {
+        sess.drop_pending_requests();
+        CHECK(repo.alloc_waiters().size() == 0);
+    }
+}
+
+TEST_CASE("session: alloc_ring") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::basic_ring_buffer;
+    using common::token;
+    using protocol::Status;
+    using trompeloeil::_;
+    using namespace std::chrono_literals;
+
+    session_type sess(42, alloc, repo, 10s);
+    ALLOW_CALL(alloc, stats()).RETURN(allocator_stats{});
+
+    struct alignas(64) {
+        std::array<std::uint8_t, basic_ring_buffer::required_size(8, 4)>
+            bytes{};
+    } data;
+
+    token key;
+    int rsrc = 0;
+    auto err = Status::OK;
+    auto const deferred_success = []([[maybe_unused]] token k,
+                                     [[maybe_unused]] int r) {
+        CHECK(false);
+    };
+    auto const deferred_error = []([[maybe_unused]] Status e) {
+        CHECK(false);
+    };
+
+    SUBCASE("success") {
+        REQUIRE_CALL(alloc, allocate(data.bytes.size(), -1,
+                                     basic_ring_buffer::alignment))
+            .RETURN(7);
+        REQUIRE_CALL(alloc, bytes(7))
+            .RETURN(gsl::span<std::uint8_t>(data.bytes));
+        sess.alloc_ring(
+            8, 4, -1,
+            [&](token k, int r) {
+                key = k;
+                rsrc = r;
+            },
+            [&](Status e) { err = e; }, deferred_success, deferred_error);
+        CHECK(key.is_valid());
+        CHECK(rsrc == 7);
+        auto const ring = basic_ring_buffer::attach(data.bytes);
+        REQUIRE(ring.is_valid());
+        CHECK(ring.slot_size() == 8);
+        CHECK(ring.slot_count() == 4);
+        CHECK(repo.find_object(key)->policy() == protocol::Policy::PRIMITIVE);
+    }
+
+    SUBCASE("invalid geometry") {
+        FORBID_CALL(alloc, allocate(_, _, _));
+        sess.alloc_ring(
+            8, 3, -1, [&]([[maybe_unused]] token k, int r) { rsrc = r; },
+            [&](Status e) { err = e; }, deferred_success, deferred_error);
+        CHECK(err == Status::INVALID_REQUEST);
+        CHECK(rsrc == 0);
+    }
+}
+
+TEST_CASE("session: quota") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using trompeloeil::_;
+    using namespace std::chrono_literals;
+
+    auto shared = std::make_shared<quota>(3000);
+    auto acct = std::make_shared<quota>(2048, shared);
+    session_type sess(42, alloc, repo, 10s, acct);
+
+    int next_rsrc = 100;
+    ALLOW_CALL(alloc, allocate(_, -1, 0)).LR_RETURN(++next_rsrc);
+
+    // Return the key, or an invalid key with 'err' set.
+    auto const do_alloc = [&](std::uint64_t size, Status &err) {
+        token key;
+        err = Status::OK;
+        sess.alloc(
+            size, Policy::PRIMITIVE, -1, 0,
+            [&](token k, [[maybe_unused]] int r) { key = k; },
+            [&](Status e) { err = e; });
+        return key;
+    };
+
+    SUBCASE("alloc is charged until object destroyed") {
+        auto err = Status::OK;
+        auto const k0 = do_alloc(1024, err);
+        REQUIRE(k0.is_valid());
+        CHECK(acct->used() == 1024);
+        CHECK(shared->used() == 1024);
+        CHECK(do_alloc(1024, err).is_valid());
+        CHECK_FALSE(do_alloc(1, err).is_valid());
+        CHECK(err == Status::QUOTA_EXCEEDED);
+
+        sess.close(
+            k0, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(acct->used() == 1024);
+        CHECK(do_alloc(1024, err).is_valid());
+    }
+
+    SUBCASE("shared quota exceeded") {
+        auto err = Status::OK;
+        REQUIRE(shared->try_charge(2000));
+        CHECK_FALSE(do_alloc(1024, err).is_valid());
+        CHECK(err == Status::QUOTA_EXCEEDED);
+        CHECK(acct->used() == 0);
+        CHECK(do_alloc(1000, err).is_valid());
+    }
+
+    SUBCASE("out of shmem -> not charged") {
+        REQUIRE_CALL(alloc, allocate(512, 1, 0)).RETURN(0);
+        ALLOW_CALL(alloc, stats()).RETURN(allocator_stats{});
+        auto err = Status::OK;
+        sess.alloc(
+            512, Policy::PRIMITIVE, 1, 0,
+            []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                CHECK(false);
+            },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::OUT_OF_SHMEM);
+        CHECK(acct->used() == 0);
+    }
+
+    SUBCASE("clone is charged") {
+        auto err = Status::OK;
+        auto const key = do_alloc(1024, err);
+        REQUIRE(key.is_valid());
+        std::array<std::uint8_t, 1024> data{};
+        ALLOW_CALL(alloc, bytes(101)).RETURN(gsl::span<std::uint8_t>(data));
+        REQUIRE_CALL(alloc, clone(101, -1)).RETURN(201);
+        token key2;
+        sess.clone(
+            key, Policy::PRIMITIVE,
+            [&](token k, [[maybe_unused]] int r) { key2 = k; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(key2.is_valid());
+        CHECK(acct->used() == 2048);
+        sess.clone(
+            key, Policy::PRIMITIVE,
+            []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                CHECK(false);
+            },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::QUOTA_EXCEEDED);
+    }
+
+    SUBCASE("pool buffers are charged until freed") {
+        std::uint32_t pool_id = 0;
+        auto err = Status::OK;
+        sess.create_pool(
+            3, 1024, Policy::PRIMITIVE,
+            []([[maybe_unused]] std::uint32_t id) { CHECK(false); },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::QUOTA_EXCEEDED);
+        CHECK(acct->used() == 0);
+
+        sess.create_pool(
+            2, 1024, Policy::PRIMITIVE,
+            [&](std::uint32_t id) { pool_id = id; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(acct->used() == 2048);
+
+        token key;
+        sess.alloc_from_pool(
+            pool_id, [&](token k, [[maybe_unused]] int r) { key = k; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        REQUIRE(key.is_valid());
+        sess.destroy_pool(
+            pool_id, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(acct->used() == 1024); // Buffer in use
+        sess.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(acct->used() == 0);
+        CHECK(shared->used() == 0);
+    }
+}
+
+TEST_CASE("session: relocation") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using trompeloeil::_;
+    using namespace std::chrono_literals;
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+
+    std::vector<token> notified;
+    sess1.subscribe_relocation(
+        [&](token k) { notified.push_back(k); }, [] {},
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    CHECK(repo.relocations().size() == 1);
+
+    auto err = Status::OK;
+    sess1.subscribe_relocation(
+        []([[maybe_unused]] token k) { CHECK(false); }, [] { CHECK(false); },
+        [&](Status e) { err = e; });
+    CHECK(err == Status::INVALID_REQUEST);
+
+    int next_rsrc = 100;
+    ALLOW_CALL(alloc, allocate(_, -1, 0)).LR_RETURN(++next_rsrc);
+    std::array<std::uint8_t, 1024> data{};
+    ALLOW_CALL(alloc, bytes(_)).RETURN(gsl::span<std::uint8_t>(data));
+
+    auto const do_alloc = [&](session_type &sess, Policy policy) {
+        token key;
+        sess.alloc(
+            1024, policy, -1, 0,
+            [&](token k, [[maybe_unused]] int r) { key = k; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        return key;
+    };
+    auto const k_unshared = do_alloc(sess1, Policy::DEFAULT);
+    auto const k_primitive = do_alloc(sess1, Policy::PRIMITIVE);
+    auto const k_shared = do_alloc(sess1, Policy::DEFAULT);
+    sess1.share(
+        k_shared, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+    sess2.open(
+        k_shared, Policy::DEFAULT, false, clock::now(),
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) {},
+        []([[maybe_unused]] Status e) { CHECK(false); },
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+            CHECK(false);
+        },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    REQUIRE(k_primitive.is_valid());
+
+    allocator_stats stats;
+    ALLOW_CALL(alloc, stats()).LR_RETURN(stats);
+    auto const failing_alloc = [&](std::size_t size) {
+        REQUIRE_CALL(alloc, allocate(size, -1, 0)).RETURN(0);
+        err = Status::OK;
+        sess2.alloc(
+            size, Policy::DEFAULT, -1, 0,
+            []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                CHECK(false);
+            },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::OUT_OF_SHMEM);
+    };
+
+    SUBCASE("not fragmented -> no request") {
+        stats.free = 2000;
+        failing_alloc(4096);
+        CHECK(notified.empty());
+    }
+
+    SUBCASE("fragmented -> request once per object") {
+        stats.free = 8192;
+        failing_alloc(4096);
+        CHECK(notified == std::vector<token>{k_unshared});
+        failing_alloc(4096);
+        CHECK(notified.size() == 1);
+    }
+
+    SUBCASE("unsubscribed by drop_pending_requests") {
+        sess1.drop_pending_requests();
+        CHECK(repo.relocations().size() == 0);
+        stats.free = 8192;
+        failing_alloc(4096);
+        CHECK(notified.empty());
+    }
+}
+
+TEST_CASE("session: topics") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using namespace std::chrono_literals;
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+
+    ALLOW_CALL(alloc, allocate(1024, -1, 0)).RETURN(7);
+
+    auto const alloc_obj = [&](Policy policy) {
+        token key;
+        sess1.alloc(
+            1024, policy, -1, 0,
+            [&](token k, [[maybe_unused]] int r) { key = k; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        return key;
+    };
+
+    // Return the count, or -1 with 'err' set.
+    auto const publish = [&](std::string_view topic, token key,
+                             Status &err) {
+        long count = -1;
+        err = Status::OK;
+        sess1.publish(
+            topic, key, [&](std::uint32_t c) { count = c; },
+            [&](Status e) { err = e; });
+        return count;
+    };
+
+    std::vector<std::pair<token, int>> notified;
+    auto const subscribe = [&](std::string_view topic, bool auto_open) {
+        auto err = Status::OK;
+        sess2.subscribe(
+            topic, auto_open,
+            [&](token k, int const *r) {
+                notified.emplace_back(k, r != nullptr ? *r : 0);
+            },
+            [] {}, [&](Status e) { err = e; });
+        return err;
+    };
+
+    SUBCASE("publish without subscribers") {
+        auto const key = alloc_obj(Policy::PRIMITIVE);
+        auto err = Status::OK;
+        CHECK(publish("t", key, err) == 0);
+    }
+
+    SUBCASE("invalid topic") {
+        auto const key = alloc_obj(Policy::PRIMITIVE);
+        auto err = Status::OK;
+        CHECK(publish("", key, err) == -1);
+        CHECK(err == Status::INVALID_REQUEST);
+        std::string const long_name(max_topic_name_length + 1, 'x');
+        CHECK(publish(long_name, key, err) == -1);
+        CHECK(err == Status::INVALID_REQUEST);
+        CHECK(subscribe("", false) == Status::INVALID_REQUEST);
+        CHECK(subscribe(long_name, false) == Status::INVALID_REQUEST);
+    }
+
+    SUBCASE("publish unshared object -> no such object") {
+        auto const key = alloc_obj(Policy::DEFAULT);
+        REQUIRE(subscribe("t", false) == Status::OK);
+        auto err = Status::OK;
+        CHECK(publish("t", key, err) == -1);
+        CHECK(err == Status::NO_SUCH_OBJECT);
+        CHECK(publish("t", token(12345), err) == -1);
+        CHECK(err == Status::NO_SUCH_OBJECT);
+        CHECK(notified.empty());
+    }
+
+    SUBCASE("notification without auto-open") {
+        auto const key = alloc_obj(Policy::DEFAULT);
+        sess1.share(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        REQUIRE(subscribe("t", false) == Status::OK);
+        CHECK(subscribe("t", true) == Status::INVALID_REQUEST);
+        auto err = Status::OK;
+        CHECK(publish("t", key, err) == 1);
+        CHECK(notified == std::vector<std::pair<token, int>>{{key, 0}});
+
+        // Not opened by sess2
+        err = Status::OK;
+        sess2.close(
+            key, [] { CHECK(false); }, [&](Status e) { err = e; });
+        CHECK(err == Status::NO_SUCH_OBJECT);
+    }
+
+    SUBCASE("notification with auto-open") {
+        auto const key = alloc_obj(Policy::PRIMITIVE);
+        REQUIRE(subscribe("t", true) == Status::OK);
+        auto err = Status::OK;
+        CHECK(publish("t", key, err) == 1);
+        CHECK(notified == std::vector<std::pair<token, int>>{{key, 7}});
+
+        // Remains alive while opened by sess2
+        bool closed = false;
+        sess1.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        sess2.close(
+            key, [&] { closed = true; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(closed);
+    }
+
+    SUBCASE("unsubscribe") {
+        auto const key = alloc_obj(Policy::PRIMITIVE);
+        REQUIRE(subscribe("t", false) == Status::OK);
+        bool unsubscribed = false;
+        sess2.unsubscribe(
+            "t", [&] { unsubscribed = true; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(unsubscribed);
+        auto err = Status::OK;
+        sess2.unsubscribe(
+            "t", [] { CHECK(false); }, [&](Status e) { err = e; });
+        CHECK(err == Status::INVALID_REQUEST);
+        CHECK(publish("t", key, err) == 0);
+        CHECK(notified.empty());
+    }
+
+    SUBCASE("subscriptions are dropped with pending requests") {
+        REQUIRE(subscribe("t", false) == Status::OK);
+        CHECK(repo.topics().subscriber_count("t") == 1);
+        sess2.drop_pending_requests();
+        CHECK(repo.topics().subscriber_count("t") == 0);
+    }
+}
+
+TEST_CASE("session: unshare drops expired vouchers") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using trompeloeil::_;
+    using namespace std::chrono_literals;
+
+    session_type sess1(42, alloc, repo, 10s);
+
+    // The mock queue holds the voucher as the real one would (via the
+    // node's owner), until dropped.
+    REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(532);
+    REQUIRE_CALL(vq, enqueue(_))
+        .SIDE_EFFECT(_1->as_voucher().queue_node().owner = _1)
+        .TIMES(2);
+    token key;
+    sess1.alloc(
+        1024, Policy::DEFAULT, -1, 0, [&](token k, int /* r */) { key = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    sess1.share(
+        key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+    token expired_vkey;
+    token valid_vkey;
+    sess1.create_voucher(
+        key, 1, clock::now() - 20s, [&](token k) { expired_vkey = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    sess1.create_voucher(
+        key, 1, clock::now(), [&](token k) { valid_vkey = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    CHECK(repo.voucher_count() == 2);
+
+    REQUIRE_CALL(vq, drop(_))
+        .WITH(_1->key() == expired_vkey)
+        .SIDE_EFFECT(_1->as_voucher().queue_node().owner.reset())
+        .TIMES(1);
+    auto err = Status::OK;
+    sess1.unshare(
+        key, false, []([[maybe_unused]] token k) { CHECK(false); },
+        [&](Status e) { err = e; },
+        []([[maybe_unused]] token k) { CHECK(false); },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    CHECK(err == Status::OBJECT_BUSY); // The valid voucher remains
+    CHECK(repo.voucher_count() == 1);
+    CHECK_FALSE(repo.find_object(expired_vkey));
+
+    // Release the remaining voucher before the repository is destroyed.
+    auto vptr = repo.find_object(valid_vkey);
+    REQUIRE(vptr);
+    vptr->as_voucher().queue_node().owner.reset();
+}
+
+TEST_CASE("session: share_dedup") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using trompeloeil::_;
+    using namespace std::chrono_literals;
+
+    std::array<std::uint8_t, 4> data1{1, 2, 3, 4};
+    std::array<std::uint8_t, 4> data2{1, 2, 3, 4};
+    std::array<std::uint8_t, 4> data3{1, 2, 3, 5};
+    ALLOW_CALL(alloc, bytes(532)).RETURN(gsl::span<std::uint8_t>(data1));
+    ALLOW_CALL(alloc, bytes(533)).RETURN(gsl::span<std::uint8_t>(data2));
+    ALLOW_CALL(alloc, bytes(534)).RETURN(gsl::span<std::uint8_t>(data3));
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+
+    auto alloc_in = [&](session_type &sess, int rsrc) {
+        REQUIRE_CALL(alloc, allocate(4, -1, 0)).RETURN(rsrc);
+        token key;
+        sess.alloc(
+            4, Policy::DEFAULT, -1, 0, [&](token k, int /* r */) { key = k; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        return key;
+    };
+    auto share_dedup = [](session_type &sess, token key) {
+        token result;
+        int result_rsrc = 0;
+        sess.share_dedup(
+            key,
+            [&](token k, int r) {
+                result = k;
+                result_rsrc = r;
+            },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        return std::make_pair(result, result_rsrc);
+    };
+
+    auto const key1 = alloc_in(sess1, 532);
+    CHECK(share_dedup(sess1, key1) == std::make_pair(key1, 532));
+    CHECK(repo.dedup().size() == 1);
+
+    SUBCASE("identical object is replaced") {
+        auto const key2 = alloc_in(sess2, 533);
+        CHECK(share_dedup(sess2, key2) == std::make_pair(key1, 532));
+        CHECK_FALSE(repo.find_object(key2));
+        CHECK(repo.dedup().size() == 1);
+
+        // Now held by sess2 too.
+        bool closed = false;
+        sess2.close(
+            key1, [&] { closed = true; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(closed);
+    }
+
+    SUBCASE("different contents are not replaced") {
+        auto const key3 = alloc_in(sess2, 534);
+        CHECK(share_dedup(sess2, key3) == std::make_pair(key3, 534));
+        CHECK(repo.dedup().size() == 2);
+    }
+
+    SUBCASE("unshared object is no longer a candidate") {
+        bool unshared = false;
+        sess1.unshare(
+            key1, false, [&](token /* k */) { unshared = true; },
+            []([[maybe_unused]] Status e) { CHECK(false); },
+            []([[maybe_unused]] token k) { CHECK(false); },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(unshared);
+        CHECK(repo.dedup().empty());
+        auto const key2 = alloc_in(sess2, 533);
+        CHECK(share_dedup(sess2, key2) == std::make_pair(key2, 533));
+    }
+
+    SUBCASE("non-owner cannot share") {
+        auto err = Status::OK;
+        sess2.share_dedup(
+            key1, [](token /* k */, int /* r */) { CHECK(false); },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::NO_SUCH_OBJECT);
+    }
+}
+
+TEST_CASE("session: resize") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using trompeloeil::_;
+    using namespace std::chrono_literals;
+
+    // The size of the (single) resource is that of 'data'.
+    std::vector<std::uint8_t> data(1024);
+    ALLOW_CALL(alloc, bytes(_)).LR_RETURN(gsl::span<std::uint8_t>(data));
+    bool resizable = true;
+    ALLOW_CALL(alloc, resize(_, _))
+        .LR_SIDE_EFFECT(resizable ? data.resize(_2) : void())
+        .LR_RETURN(resizable);
+
+    auto acct = std::make_shared<quota>(2048);
+    session_type sess1(42, alloc, repo, 10s, acct);
+    session_type sess2(43, alloc, repo, 10s);
+
+    REQUIRE_CALL(alloc, allocate(1024, -1, 0)).RETURN(101);
+    token key;
+    sess1.alloc(
+        1024, Policy::DEFAULT, -1, 0, [&](token k, int /* r */) { key = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    REQUIRE(key.is_valid());
+    CHECK(acct->used() == 1024);
+
+    auto const do_resize = [&](session_type &sess, std::uint64_t size) {
+        auto err = Status::OK;
+        sess.resize(
+            key, size,
+            [&](token k, int r) {
+                CHECK(k == key);
+                CHECK(r == 101);
+            },
+            [&](Status e) { err = e; });
+        return err;
+    };
+
+    SUBCASE("grow is charged until object destroyed") {
+        CHECK(do_resize(sess1, 1536) == Status::OK);
+        CHECK(data.size() == 1536);
+        CHECK(acct->used() == 1536);
+        sess1.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(acct->used() == 0);
+    }
+
+    SUBCASE("grow beyond quota is undone") {
+        CHECK(do_resize(sess1, 4096) == Status::QUOTA_EXCEEDED);
+        CHECK(data.size() == 1024);
+        CHECK(acct->used() == 1024);
+    }
+
+    SUBCASE("shrink is credited") {
+        CHECK(do_resize(sess1, 100) == Status::OK);
+        CHECK(data.size() == 100);
+        CHECK(acct->used() == 100);
+        sess1.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(acct->used() == 0);
+    }
+
+    SUBCASE("repeated shrink and grow is charged once") {
+        for (int i = 0; i < 4; ++i) {
+            CHECK(do_resize(sess1, 100) == Status::OK);
+            CHECK(do_resize(sess1, 2048) == Status::OK);
+        }
+        CHECK(acct->used() == 2048);
+        sess1.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(acct->used() == 0);
+    }
+
+    SUBCASE("no room to grow") {
+        resizable = false;
+        CHECK(do_resize(sess1, 1536) == Status::OUT_OF_SHMEM);
+        CHECK(acct->used() == 1024);
+    }
+
+    SUBCASE("only the exclusive writer can resize") {
+        CHECK(do_resize(sess2, 100) == Status::NO_SUCH_OBJECT);
+        sess1.share(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(do_resize(sess1, 100) == Status::NO_SUCH_OBJECT);
+        CHECK(data.size() == 1024);
+    }
+}
+
+#ifdef PARTAKE_LZ4
+TEST_CASE("session: open decompresses object in cold storage") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using trompeloeil::_;
+    using namespace std::chrono_literals;
+
+    std::vector<std::uint8_t> data(4096, 42);
+    std::vector<std::uint8_t> warmed(4096);
+    ALLOW_CALL(alloc, bytes(532)).RETURN(gsl::span<std::uint8_t>(data));
+    ALLOW_CALL(alloc, bytes(533)).RETURN(gsl::span<std::uint8_t>(warmed));
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+
+    // Leave the object held only by a voucher.
+    REQUIRE_CALL(alloc, allocate(4096, -1, 0)).RETURN(532);
+    REQUIRE_CALL(vq, enqueue(_))
+        .SIDE_EFFECT(_1->as_voucher().queue_node().owner = _1);
+    token key;
+    sess1.alloc(
+        4096, Policy::DEFAULT, -1, 0, [&](token k, int /* r */) { key = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    token vkey;
+    sess1.share_and_create_voucher(
+        key, 1, clock::now(), [&](token k) { vkey = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    sess1.close(
+        key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+
+    // Move it to cold storage as the daemon's sweep does.
+    auto obj = repo.find_object(key);
+    REQUIRE(obj);
+    auto &cold = repo.cold_objects();
+    cold.insert(obj.get(), compress(data), data.size());
+    CHECK(obj->as_proper_object().replace_resource(0) == 532);
+
+    REQUIRE_CALL(alloc, allocate(4096, -1, 0)).RETURN(533);
+    int rsrc = 0;
+    sess2.open(
+        key, Policy::DEFAULT, false, clock::now(),
+        [&](token /* k */, int r) { rsrc = r; },
+        []([[maybe_unused]] Status e) { CHECK(false); },
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+            CHECK(false);
+        },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+    CHECK(rsrc == 533);
+    CHECK(warmed == data);
+    CHECK_FALSE(cold.is_cold(obj.get()));
+
+    // Release the voucher before the repository is destroyed.
+    obj.reset();
+    auto vptr = repo.find_object(vkey);
+    REQUIRE(vptr);
+    vptr->as_voucher().queue_node().owner.reset();
+}
+#endif // PARTAKE_LZ4
+
+TEST_CASE("session: close_some_handles") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using namespace std::chrono_literals;
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+
+    REQUIRE_CALL(alloc, allocate(64, -1, 0)).RETURN(7).TIMES(5);
+    token shared_key;
+    for (int i = 0; i < 5; ++i) {
+        sess1.alloc(
+            64, Policy::DEFAULT, -1, 0,
+            [&](token k, [[maybe_unused]] int r) { shared_key = k; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+    }
+    CHECK(sess1.handle_count() == 5);
+
+    // A request by another session waiting for the object to be shared
+    // fails once the object is gone.
+    auto err = Status::OK;
+    sess2.open(
+        shared_key, Policy::DEFAULT, true, clock::now(),
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+            CHECK(false);
+        },
+        []([[maybe_unused]] Status e) { CHECK(false); },
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+            CHECK(false);
+        },
+        [&](Status e) { err = e; });
+    CHECK(err == Status::OK); // Waiting
+
+    CHECK_FALSE(sess1.close_some_handles(2));
+    CHECK(sess1.handle_count() == 3);
+    CHECK_FALSE(sess1.close_some_handles(2));
+    CHECK(sess1.handle_count() == 1);
+    CHECK(sess1.close_some_handles(2));
+    CHECK(sess1.handle_count() == 0);
+    CHECK(err == Status::NO_SUCH_OBJECT);
+    CHECK(sess1.is_valid()); // Destruction remains
+}
+
+TEST_CASE("session: leases") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using namespace std::chrono_literals;
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+
+    REQUIRE_CALL(alloc, allocate(64, -1, 0)).RETURN(7);
+    token key;
+    sess1.alloc(
+        64, Policy::DEFAULT, -1, 0,
+        [&](token k, [[maybe_unused]] int r) { key = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+
+    auto const open_leased = [&](time_point now,
+                                 std::chrono::milliseconds lease) {
+        bool ok = false;
+        sess2.open(
+            key, Policy::DEFAULT, true, now,
+            [&]([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                ok = true;
+            },
+            []([[maybe_unused]] Status e) { CHECK(false); },
+            [&]([[maybe_unused]] token k, [[maybe_unused]] int r) {
+                ok = true;
+            },
+            []([[maybe_unused]] Status e) { CHECK(false); }, {}, lease);
+        return ok;
+    };
+    auto const renew = [&](time_point now, std::chrono::milliseconds lease) {
+        std::optional<bool> renewed;
+        sess2.renew_leases(
+            lease, now, [&](bool r) { renewed = r; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        return renewed.value();
+    };
+
+    auto const now = clock::now();
+
+    SUBCASE("renew without lease -> not renewed") {
+        CHECK_FALSE(renew(now, 100ms));
+        CHECK(repo.wait_deadlines().size() == 0);
+    }
+
+    SUBCASE("renew with zero lease -> invalid request") {
+        auto err = Status::OK;
+        sess2.renew_leases(
+            0ms, now, []([[maybe_unused]] bool r) { CHECK(false); },
+            [&](Status e) { err = e; });
+        CHECK(err == Status::INVALID_REQUEST);
+    }
+
+    sess1.share(
+        key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+
+    SUBCASE("leased opens are closed on expiry") {
+        CHECK(open_leased(now, 100ms));
+        CHECK(open_leased(now + 50ms, 100ms));
+        CHECK(repo.wait_deadlines().next_deadline() == now + 150ms);
+        CHECK(repo.wait_deadlines().expire(now + 149ms) == 0);
+        CHECK(sess2.handle_count() == 1);
+        CHECK(repo.wait_deadlines().expire(now + 150ms) == 1);
+        CHECK(sess2.handle_count() == 0);
+        CHECK_FALSE(renew(now + 200ms, 100ms));
+    }
+
+    SUBCASE("renewal postpones expiry") {
+        CHECK(open_leased(now, 100ms));
+        CHECK(renew(now + 90ms, 100ms));
+        CHECK(repo.wait_deadlines().size() == 1);
+        CHECK(repo.wait_deadlines().expire(now + 100ms) == 0);
+        CHECK(repo.wait_deadlines().expire(now + 190ms) == 1);
+        CHECK(sess2.handle_count() == 0);
+    }
+
+    SUBCASE("unleased opens survive expiry, and are closed first") {
+        CHECK(open_leased(now, 100ms));
+        CHECK(open_leased(now, {}));
+        CHECK(open_leased(now, {}));
+        bool ok = false;
+        sess2.close(
+            key, [&] { ok = true; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(ok);
+        CHECK(repo.wait_deadlines().expire(now + 100ms) == 1);
+        CHECK(sess2.handle_count() == 1);
+        ok = false;
+        sess2.close(
+            key, [&] { ok = true; },
+            []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(ok);
+        CHECK(sess2.handle_count() == 0);
+    }
+
+    SUBCASE("explicit close of leased open -> nothing left to expire") {
+        CHECK(open_leased(now, 100ms));
+        sess2.close(
+            key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+        CHECK(sess2.handle_count() == 0);
+        CHECK(repo.wait_deadlines().expire(now + 100ms) == 1);
+    }
+}
+
+TEST_CASE("session: leased open-wait starts lease when opened") {
+    using session_type =
+        session<mock_allocator,
+                repository<object<int>, key_sequence, mock_voucher_queue>,
+                handle<object<int>>>;
+    mock_allocator alloc;
+    mock_voucher_queue vq;
+    repository<object<int>, key_sequence, mock_voucher_queue> repo(
+        key_sequence(), vq);
+
+    using common::token;
+    using protocol::Policy;
+    using protocol::Status;
+    using namespace std::chrono_literals;
+
+    session_type sess1(42, alloc, repo, 10s);
+    session_type sess2(43, alloc, repo, 10s);
+
+    REQUIRE_CALL(alloc, allocate(64, -1, 0)).RETURN(7);
+    token key;
+    sess1.alloc(
+        64, Policy::DEFAULT, -1, 0,
+        [&](token k, [[maybe_unused]] int r) { key = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); });
+
+    token opened_key;
+    sess2.open(
+        key, Policy::DEFAULT, true, clock::now(),
+        []([[maybe_unused]] token k, [[maybe_unused]] int r) {
+            CHECK(false);
+        },
+        []([[maybe_unused]] Status e) { CHECK(false); },
+        [&](token k, [[maybe_unused]] int r) { opened_key = k; },
+        []([[maybe_unused]] Status e) { CHECK(false); }, {}, 100ms);
+    CHECK(repo.wait_deadlines().size() == 0);
+
+    auto const before_share = clock::now();
+    sess1.share(
+        key, [] {}, []([[maybe_unused]] Status e) { CHECK(false); });
+    CHECK(opened_key == key);
+    CHECK(repo.wait_deadlines().size() == 1);
+    CHECK(repo.wait_deadlines().next_deadline() >= before_share + 100ms);
+    CHECK(repo.wait_deadlines().expire(
+              repo.wait_deadlines().next_deadline()) == 1);
+    CHECK(sess2.handle_count() == 0);
+}
+
 // NOLINTEND(readability-magic-numbers)
 
 } // namespace partake::daemon
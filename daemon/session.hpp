@@ -6,13 +6,24 @@
 
 #pragma once
 
+#include "buffer_pool.hpp"
+#include "compression.hpp"
 #include "config.hpp"
+#include "content_hash.hpp"
 #include "hive.hpp"
+#include "numa.hpp"
 #include "partake_protocol_generated.h"
+#include "quota.hpp"
+#include "ref_counted.hpp"
+#include "ring_buffer.hpp"
 #include "time_point.hpp"
 #include "token.hpp"
 #include "token_hash_table.hpp"
+#include "wait_deadline_queue.hpp"
 
+#include <gsl/span>
+
+#include <algorithm>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
@@ -21,27 +32,37 @@
 #include <string>
 #include <string_view>
 #include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace partake::daemon {
 
-template <typename Allocator, typename Repository, typename Handle,
-          typename Segment>
+// The Allocator must also provide access to the segments it allocates from
+// (find_segment()), copying of allocations (clone()), access to their data
+// (bytes()), in-place resizing (resize()), the largest size that can ever
+// be allocated (max_allocation_size()), and statistics including the free
+// space (stats()). Allocation functions must also accept a trailing sub-pool
+// number; find_sub_pool() is needed for bind_sub_pool(). For
+// get_allocator_info(), it must also provide log2_granularity() and
+// size_classes().
+template <typename Allocator, typename Repository, typename Handle>
 class session {
   public:
     using allocator_type = Allocator;
     using repository_type = Repository;
     using object_type = typename repository_type::object_type;
     using handle_type = Handle;
-    using segment_type = Segment;
+    using resource_type = typename object_type::resource_type;
+    using buffer_pool_type = buffer_pool<resource_type>;
     static_assert(
         std::is_same_v<typename object_type::resource_type,
-                       decltype(std::declval<allocator_type>().allocate(0))>);
+                       decltype(std::declval<allocator_type>().allocate(
+                           0, -1, 0))>);
     static_assert(
         std::is_same_v<typename handle_type::object_type, object_type>);
 
   private:
-    segment_type const *seg = nullptr;
     allocator_type *allocr = nullptr;
     repository_type *repo = nullptr;
 
@@ -50,25 +71,52 @@ class session {
 
     bool valid = false;
     bool has_said_hello = false;
+    bool closing = false; // Being torn down by close_some_handles()
     std::string client_name;
     std::uint32_t client_pid = 0;
+    int client_numa_node = -1; // Detected at hello; -1 if unknown
+    cpu_placement client_placement; // Detected at hello
+    std::size_t sub_pool = 0;  // Of allocr; bound at hello
     std::uint32_t id = 0;
 
     std::chrono::milliseconds voucher_ttl =
         std::chrono::seconds(default_voucher_ttl_seconds);
 
+    // Shared memory allocated by this session (objects, pool buffers) is
+    // charged to this quota, if any, until freed.
+    std::shared_ptr<quota> acct;
+
+    // Objects made from pool buffers hold weak references to their pool, so
+    // that buffers in use when a pool is destroyed are simply deallocated.
+    std::unordered_map<std::uint32_t, std::shared_ptr<buffer_pool_type>>
+        pools;
+    std::uint32_t pool_counter = 0;
+
+    // Topic name -> subscription id in the repository's topic registry.
+    // Notification functions capture 'this', so subscriptions are dropped
+    // together with pending requests.
+    std::unordered_map<std::string, std::uint64_t> subscriptions;
+
+    // Id in the repository's relocation registry; 0 if not subscribed.
+    std::uint64_t relocation_sub = 0;
+
+    // Deadline (in the repository's wait deadline queue) at which all leased
+    // opens are closed; 0 if no lease is in force.
+    wait_deadline_queue::id_type lease_deadline = 0;
+    time_point lease_expiration;
+
   public:
     // Construct in empty state, on which the only valid operations are
     // destruction, move-assignment, and swap.
     session() noexcept = default;
 
-    explicit session(std::uint32_t session_id, segment_type const &segment,
-                     allocator_type &allocator, repository_type &repository,
-                     std::chrono::milliseconds voucher_time_to_live)
-        : seg(&segment), allocr(&allocator), repo(&repository),
-          handles(1 << 3), valid(true), id(session_id),
-          voucher_ttl(voucher_time_to_live) {
-        assert(seg != nullptr);
+    explicit session(std::uint32_t session_id, allocator_type &allocator,
+                     repository_type &repository,
+                     std::chrono::milliseconds voucher_time_to_live,
+                     std::shared_ptr<quota> account = {})
+        : allocr(&allocator), repo(&repository), handles(1 << 3), valid(true),
+          id(session_id), voucher_ttl(voucher_time_to_live),
+          acct(std::move(account)) {
         assert(allocr != nullptr);
         assert(repo != nullptr);
     }
@@ -79,16 +127,24 @@ class session {
     auto operator=(session const &) = delete;
 
     session(session &&other) noexcept
-        : seg(std::exchange(other.seg, nullptr)),
-          allocr(std::exchange(other.allocr, nullptr)),
+        : allocr(std::exchange(other.allocr, nullptr)),
           repo(std::exchange(other.repo, nullptr)),
           handle_storage(std::move(other.handle_storage)),
           handles(std::move(other.handles)),
           valid(std::exchange(other.valid, false)),
-          has_said_hello(other.has_said_hello),
+          has_said_hello(other.has_said_hello), closing(other.closing),
           client_name(std::move(other.client_name)),
-          client_pid(other.client_pid), id(other.id),
-          voucher_ttl(other.voucher_ttl) {}
+          client_pid(other.client_pid),
+          client_numa_node(other.client_numa_node),
+          client_placement(std::move(other.client_placement)),
+          sub_pool(other.sub_pool), id(other.id),
+          voucher_ttl(other.voucher_ttl), acct(std::move(other.acct)),
+          pools(std::move(other.pools)),
+          pool_counter(other.pool_counter),
+          subscriptions(std::move(other.subscriptions)),
+          relocation_sub(std::exchange(other.relocation_sub, 0)),
+          lease_deadline(std::exchange(other.lease_deadline, 0)),
+          lease_expiration(other.lease_expiration) {}
 
     auto operator=(session &&rhs) noexcept -> session & {
         close_session();
@@ -98,17 +154,27 @@ class session {
 
     void swap(session &other) noexcept {
         using std::swap;
-        swap(seg, other.seg);
         swap(allocr, other.allocr);
         swap(repo, other.repo);
         swap(handle_storage, other.handle_storage);
         swap(handles, other.handles);
         swap(valid, other.valid);
         swap(has_said_hello, other.has_said_hello);
+        swap(closing, other.closing);
         swap(client_name, other.client_name);
         swap(client_pid, other.client_pid);
+        swap(client_numa_node, other.client_numa_node);
+        swap(client_placement, other.client_placement);
+        swap(sub_pool, other.sub_pool);
         swap(id, other.id);
         swap(voucher_ttl, other.voucher_ttl);
+        swap(acct, other.acct);
+        swap(pools, other.pools);
+        swap(pool_counter, other.pool_counter);
+        swap(subscriptions, other.subscriptions);
+        swap(relocation_sub, other.relocation_sub);
+        swap(lease_deadline, other.lease_deadline);
+        swap(lease_expiration, other.lease_expiration);
     }
 
     friend void swap(session &lhs, session &rhs) noexcept { lhs.swap(rhs); }
@@ -130,9 +196,13 @@ class session {
         return client_pid;
     }
 
+    // The client's placement is found from 'cpu', or if it is negative,
+    // from the CPU on which 'pid' last ran; it is passed to 'success_cb',
+    // together with the session id. If the repository's topology is empty
+    // (placement not needed), only the given 'cpu' is known.
     template <typename Success, typename Error>
     void hello(std::string_view name, std::uint32_t pid, Success success_cb,
-               Error error_cb) {
+               Error error_cb, int cpu = -1) {
         assert(valid);
         if (has_said_hello) {
             error_cb(protocol::Status::INVALID_REQUEST);
@@ -140,56 +210,534 @@ class session {
             // TODO Make error if name too long?
             client_name = name.substr(0, max_client_name_length);
             client_pid = pid;
+            auto const &topo = repo->topology();
+            if (topo.empty())
+                client_placement = cpu_placement{cpu};
+            else
+                client_placement = topo.placement_of(
+                    cpu >= 0 ? cpu : cpu_of_process(pid));
+            client_numa_node = client_placement.numa_node;
             has_said_hello = true;
-            success_cb(id);
+            success_cb(id, client_placement);
         }
     }
 
+    // Bind the session to the named sub-pool of the allocator (see
+    // basic_segment_pool), from which its objects and pool buffers are then
+    // allocated. Must be called before hello() (of which it is part); return
+    // false if there is no such sub-pool or hello() has already been called.
+    [[nodiscard]] auto bind_sub_pool(std::string_view pool_name) -> bool {
+        assert(valid);
+        if (has_said_hello)
+            return false;
+        auto const sp = allocr->find_sub_pool(pool_name);
+        if (not sp)
+            return false;
+        sub_pool = *sp;
+        return true;
+    }
+
     template <typename Success, typename Error>
     void get_segment(std::uint32_t segment_id, Success success_cb,
                      Error error_cb) {
         assert(valid);
 
-        // For now there is only one segment, id 0.
-        if (segment_id == 0) {
+        auto const *seg = allocr->find_segment(segment_id);
+        if (seg != nullptr) {
             success_cb(seg->spec());
         } else {
             error_cb(protocol::Status::NO_SUCH_SEGMENT);
         }
     }
 
+    // Call 'success_cb' with the allocation granularity, the largest
+    // allocation size, and the size classes (see
+    // basic_allocator::size_classes()), all in bytes.
+    template <typename Success>
+    void get_allocator_info(Success success_cb) const {
+        assert(valid);
+        success_cb(std::size_t(1) << allocr->log2_granularity(),
+                   allocr->max_allocation_size(), allocr->size_classes());
+    }
+
+    // Segment offset of the object's wake word (see basic_segment_pool), or
+    // 0 if wake words are not enabled.
+    [[nodiscard]] auto wake_word_offset(resource_type const &rsrc) const
+        -> std::uint64_t {
+        return allocr->wake_word_offset(rsrc);
+    }
+
+    // If 'numa_node' is negative, the client's node (if known) is preferred.
+    // 'alignment' (in bytes) must be zero or a power of 2.
+    template <typename Success, typename Error>
+    void alloc(std::uint64_t size, protocol::Policy policy, int numa_node,
+               std::uint64_t alignment, Success success_cb, Error error_cb) {
+        assert(valid);
+
+        if ((alignment & (alignment - 1)) != 0)
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        if (size > std::numeric_limits<std::size_t>::max() ||
+            alignment > std::numeric_limits<std::size_t>::max()) // 32-bit
+            return error_cb(protocol::Status::OUT_OF_SHMEM);
+        auto s = static_cast<std::size_t>(size);
+        auto const node = numa_node >= 0 ? numa_node : client_numa_node;
+        if (acct && not acct->try_charge(s))
+            return error_cb(protocol::Status::QUOTA_EXCEEDED);
+        auto rsrc = allocate_in_sub_pool(
+            s, node, static_cast<std::size_t>(alignment));
+        if (not rsrc) {
+            if (acct)
+                acct->credit(s);
+            request_relocation_if_fragmented(s);
+            return error_cb(protocol::Status::OUT_OF_SHMEM);
+        }
+        auto obj = create_allocated_object(policy, std::move(rsrc), s);
+
+        auto hnd = create_handle(obj);
+        hnd->open();
+        auto &po = obj->as_proper_object();
+        if (policy == protocol::Policy::DEFAULT)
+            po.exclusive_writer(hnd.get());
+        success_cb(obj->key(), po.resource());
+    }
+
+    // Like alloc() (with default alignment), but if the size cannot be
+    // allocated contiguously, allocate it as up to 'max_extents' extents
+    // (see basic_segment_pool::allocate_extents()), making a multi-extent
+    // object. The success callback is passed the key, the first extent (the
+    // object's resource), and the extents after the first (empty if the
+    // object is contiguous). Multi-extent objects can only be opened with
+    // open_extents(); clone(), map_range(), map_for_prefetch(), and
+    // publish() reject them, as these operate on a single extent.
+    template <typename Success, typename Error>
+    void alloc_extents(std::uint64_t size, std::uint32_t max_extents,
+                       protocol::Policy policy, int numa_node,
+                       Success success_cb, Error error_cb) {
+        assert(valid);
+
+        if (max_extents == 0 || max_extents > max_object_extents)
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        auto status = protocol::Status::OK;
+        alloc(
+            size, policy, numa_node, 0,
+            [&](common::token k, resource_type const &rsrc) {
+                success_cb(k, rsrc, gsl::span<resource_type const>());
+            },
+            [&](protocol::Status st) { status = st; });
+        if (status == protocol::Status::OK)
+            return;
+        if (status != protocol::Status::OUT_OF_SHMEM || max_extents == 1 ||
+            size > std::numeric_limits<std::size_t>::max())
+            return error_cb(status);
+
+        auto s = static_cast<std::size_t>(size);
+        auto const node = numa_node >= 0 ? numa_node : client_numa_node;
+        if (acct && not acct->try_charge(s))
+            return error_cb(protocol::Status::QUOTA_EXCEEDED);
+        auto extents =
+            sub_pool == 0
+                ? allocr->allocate_extents(s, max_extents, node)
+                : allocr->allocate_extents(s, max_extents, node, sub_pool);
+        if (extents.empty()) {
+            if (acct)
+                acct->credit(s);
+            return error_cb(protocol::Status::OUT_OF_SHMEM);
+        }
+        auto first = std::move(extents.front());
+        extents.erase(extents.begin());
+        auto obj = create_allocated_object(policy, std::move(first), s);
+        repo->set_more_extents(obj.get(), std::move(extents));
+
+        auto hnd = create_handle(obj);
+        hnd->open();
+        auto &po = obj->as_proper_object();
+        if (policy == protocol::Policy::DEFAULT)
+            po.exclusive_writer(hnd.get());
+        success_cb(obj->key(), po.resource(),
+                   repo->more_extents_of(obj.get()));
+    }
+
+    // Same as alloc(), but if allocations are on hold (while shared memory is
+    // being prepared at startup; see alloc_wait_queue::hold()), wait until
+    // they are released and call the deferred callbacks. The wait is canceled
+    // by drop_pending_requests().
+    template <typename ImmediateSuccess, typename ImmediateError,
+              typename DeferredSuccess, typename DeferredError>
+    void alloc_when_ready(std::uint64_t size, protocol::Policy policy,
+                          int numa_node, std::uint64_t alignment,
+                          ImmediateSuccess success_cb, ImmediateError error_cb,
+                          DeferredSuccess deferred_success_cb,
+                          DeferredError deferred_error_cb) {
+        assert(valid);
+        if (not repo->alloc_waiters().is_held())
+            return alloc(size, policy, numa_node, alignment, success_cb,
+                         error_cb);
+        repo->alloc_waiters().enqueue(
+            this, [this, size, policy, numa_node, alignment,
+                   deferred_success_cb, deferred_error_cb] {
+                alloc(size, policy, numa_node, alignment, deferred_success_cb,
+                      deferred_error_cb);
+                return true;
+            });
+    }
+
+    // Same as alloc(), but if there is not enough free shared memory (and the
+    // request could be satisfied if there were), wait for memory to be freed
+    // and call the deferred callbacks. Waiting allocations from all sessions
+    // are completed in order. The wait is canceled by
+    // drop_pending_requests().
+    template <typename ImmediateSuccess, typename ImmediateError,
+              typename DeferredSuccess, typename DeferredError>
+    void alloc_or_wait(std::uint64_t size, protocol::Policy policy,
+                       int numa_node, std::uint64_t alignment,
+                       ImmediateSuccess success_cb, ImmediateError error_cb,
+                       DeferredSuccess deferred_success_cb,
+                       DeferredError deferred_error_cb) {
+        assert(valid);
+
+        // While allocations are on hold, all of them wait.
+        if (not repo->alloc_waiters().is_held()) {
+            bool out_of_shmem = false;
+            alloc(size, policy, numa_node, alignment, success_cb,
+                  [&](protocol::Status status) {
+                      if (status == protocol::Status::OUT_OF_SHMEM)
+                          out_of_shmem = true;
+                      else
+                          error_cb(status);
+                  });
+            if (not out_of_shmem)
+                return;
+        }
+        if (size > allocr->max_allocation_size())
+            return error_cb(protocol::Status::OUT_OF_SHMEM);
+
+        repo->alloc_waiters().enqueue(
+            this, [this, size, policy, numa_node, alignment,
+                   deferred_success_cb, deferred_error_cb] {
+                bool done = true;
+                alloc(size, policy, numa_node, alignment, deferred_success_cb,
+                      [&](protocol::Status status) {
+                          if (status == protocol::Status::OUT_OF_SHMEM)
+                              done = false;
+                          else
+                              deferred_error_cb(status);
+                      });
+                return done;
+            });
+    }
+
+    // Allocate, as if by alloc_when_ready(), a PRIMITIVE object holding an
+    // empty common::basic_ring_buffer of the given geometry.
+    template <typename ImmediateSuccess, typename ImmediateError,
+              typename DeferredSuccess, typename DeferredError>
+    void alloc_ring(std::uint32_t slot_size, std::uint32_t slot_count,
+                    int numa_node, ImmediateSuccess success_cb,
+                    ImmediateError error_cb,
+                    DeferredSuccess deferred_success_cb,
+                    DeferredError deferred_error_cb) {
+        assert(valid);
+        using common::basic_ring_buffer;
+
+        if (not basic_ring_buffer::is_valid_geometry(slot_size, slot_count))
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        auto const init = [this, slot_size,
+                           slot_count](resource_type const &rsrc) {
+            (void)basic_ring_buffer::create(allocr->bytes(rsrc), slot_size,
+                                            slot_count);
+        };
+        alloc_when_ready(
+            basic_ring_buffer::required_size(slot_size, slot_count),
+            protocol::Policy::PRIMITIVE, numa_node,
+            basic_ring_buffer::alignment,
+            [init, success_cb](common::token key, resource_type const &rsrc) {
+                init(rsrc);
+                success_cb(key, rsrc);
+            },
+            error_cb,
+            [init, deferred_success_cb](common::token key,
+                                        resource_type const &rsrc) {
+                init(rsrc);
+                deferred_success_cb(key, rsrc);
+            },
+            deferred_error_cb);
+    }
+
+    // The source object must be open by this session. The new object (a
+    // copy made by the Allocator's clone()) is returned as if by alloc(),
+    // preferring the client's NUMA node.
+    template <typename Success, typename Error>
+    void clone(common::token source_key, protocol::Policy policy,
+               Success success_cb, Error error_cb) {
+        assert(valid);
+
+        auto src = find_handle(source_key);
+        if (not src || not src->is_open())
+            return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        if (repo->is_multi_extent(src->object().get()))
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        auto const &src_rsrc = src->object()->as_proper_object().resource();
+        auto const s = acct ? allocr->bytes(src_rsrc).size() : 0;
+        if (acct && not acct->try_charge(s))
+            return error_cb(protocol::Status::QUOTA_EXCEEDED);
+        auto rsrc = sub_pool == 0
+                        ? allocr->clone(src_rsrc, client_numa_node)
+                        : allocr->clone(src_rsrc, client_numa_node, sub_pool);
+        if (not rsrc) {
+            if (acct)
+                acct->credit(s);
+            return error_cb(protocol::Status::OUT_OF_SHMEM);
+        }
+        auto obj = repo->create_object(policy, std::move(rsrc));
+        if (acct)
+            charge_object(*obj, s);
+
+        auto hnd = create_handle(obj);
+        hnd->open();
+        auto &po = obj->as_proper_object();
+        if (policy == protocol::Policy::DEFAULT)
+            po.exclusive_writer(hnd.get());
+        success_cb(obj->key(), po.resource());
+    }
+
+    // Find the bytes [offset, offset + size) of an object open by this
+    // session. If 'writable', the object must be PRIMITIVE or unshared
+    // (written by this session). The success callback is passed the bytes
+    // and a reference keeping the object, and hence its data, alive; the
+    // bytes may be accessed from another thread while the reference is held,
+    // but the reference must be released on the daemon's thread.
+    template <typename Success, typename Error>
+    void map_range(common::token key, std::uint64_t offset, std::uint64_t size,
+                   bool writable, Success success_cb, Error error_cb) {
+        assert(valid);
+
+        auto hnd = find_handle(key);
+        if (not hnd || not hnd->is_open())
+            return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        auto obj = hnd->object();
+        if (repo->is_multi_extent(obj.get()))
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        auto const &po = obj->as_proper_object();
+        if (writable && obj->policy() == protocol::Policy::DEFAULT &&
+            po.exclusive_writer() != hnd.get())
+            return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        auto const bytes = allocr->bytes(po.resource());
+        if (offset > bytes.size() || size > bytes.size() - offset)
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        success_cb(bytes.subspan(static_cast<std::size_t>(offset),
+                                 static_cast<std::size_t>(size)),
+                   std::move(obj));
+    }
+
+    // Find the bytes of an object open by this session, a shared object, or
+    // the target of a valid voucher (which is not claimed), without opening
+    // it; for prefetching. The callbacks are as with map_range().
+    template <typename Success, typename Error>
+    void map_for_prefetch(common::token key, time_point now,
+                          Success success_cb, Error error_cb) {
+        assert(valid);
+
+        ref_ptr<object_type> obj;
+        if (auto hnd = find_handle(key); hnd && hnd->is_open()) {
+            obj = hnd->object();
+        } else {
+            ref_ptr<object_type> vchr;
+            std::tie(obj, vchr) = find_target(key, now);
+            if (not obj ||
+                (not vchr && not obj->as_proper_object().is_shared()))
+                return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        }
+        if (repo->is_multi_extent(obj.get()))
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        if (auto const status = warm(*obj); status != protocol::Status::OK)
+            return error_cb(status);
+        auto const bytes = allocr->bytes(obj->as_proper_object().resource());
+        success_cb(bytes, std::move(obj));
+    }
+
     template <typename Success, typename Error>
-    void alloc(std::uint64_t size, protocol::Policy policy, Success success_cb,
-               Error error_cb) {
+    void create_pool(std::uint32_t count, std::uint64_t size,
+                     protocol::Policy policy, Success success_cb,
+                     Error error_cb) {
         assert(valid);
 
+        if (count == 0 || count > max_pool_buffer_count)
+            return error_cb(protocol::Status::INVALID_REQUEST);
         if (size > std::numeric_limits<std::size_t>::max()) // 32-bit Systems
             return error_cb(protocol::Status::OUT_OF_SHMEM);
         auto s = static_cast<std::size_t>(size);
-        auto obj = repo->create_object(policy, allocr->allocate(s));
-        if (not obj)
+        if (acct && (s > std::numeric_limits<std::size_t>::max() / count ||
+                     not acct->try_charge(s * count)))
+            return error_cb(protocol::Status::QUOTA_EXCEEDED);
+
+        std::vector<resource_type> buffers;
+        buffers.reserve(count);
+        for (std::uint32_t i = 0; i < count; ++i) {
+            buffers.push_back(allocate_in_sub_pool(s, client_numa_node, 0));
+            if (not buffers.back()) {
+                if (acct)
+                    acct->credit(s * count);
+                return error_cb(protocol::Status::OUT_OF_SHMEM);
+            }
+        }
+
+        // Buffers are credited to the quota when freed: those still free
+        // when the pool is destroyed here, others when their object is.
+        auto const pool_id = ++pool_counter;
+        pools.emplace(pool_id,
+                      std::shared_ptr<buffer_pool_type>(
+                          new buffer_pool_type(std::move(buffers), policy, s),
+                          [a = acct](buffer_pool_type *p) {
+                              if (a)
+                                  a->credit(p->free_count() *
+                                            p->buffer_size());
+                              delete p;
+                          }));
+        success_cb(pool_id);
+    }
+
+    template <typename Success, typename Error>
+    void alloc_from_pool(std::uint32_t pool_id, Success success_cb,
+                         Error error_cb) {
+        assert(valid);
+
+        auto it = pools.find(pool_id);
+        if (it == pools.end())
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        auto &pool = it->second;
+        auto buffer = pool->acquire();
+        if (not buffer)
             return error_cb(protocol::Status::OUT_OF_SHMEM);
 
+        auto const policy = pool->policy();
+        auto obj = repo->create_object(
+            policy, std::move(*buffer),
+            [weak_pool = std::weak_ptr(pool), a = acct,
+             s = pool->buffer_size()](resource_type &&rsrc) {
+                if (auto p = weak_pool.lock())
+                    p->give_back(std::move(rsrc));
+                else if (a)
+                    a->credit(s);
+            });
+
         auto hnd = create_handle(obj);
         hnd->open();
         auto &po = obj->as_proper_object();
+        po.set_pooled();
         if (policy == protocol::Policy::DEFAULT)
             po.exclusive_writer(hnd.get());
-        // Segment currently hard-coded to 0.
-        auto const &rsrc = po.resource();
-        success_cb(obj->key(), rsrc);
+        success_cb(obj->key(), po.resource());
+    }
+
+    template <typename Success, typename Error>
+    void destroy_pool(std::uint32_t pool_id, Success success_cb,
+                      Error error_cb) {
+        assert(valid);
+        if (pools.erase(pool_id) == 0)
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        repo->alloc_waiters().notify_freed();
+        success_cb();
+    }
+
+    // Until unsubscribed, 'notify_cb' is called with the key of each object
+    // published to the topic and a pointer to its resource. The pointer is
+    // null unless 'auto_open' is true, in which case the object has been
+    // opened on behalf of this session (and must be closed by the client).
+    template <typename Notify, typename Success, typename Error>
+    void subscribe(std::string_view topic, bool auto_open, Notify notify_cb,
+                   Success success_cb, Error error_cb) {
+        assert(valid);
+        if (topic.empty() || topic.size() > max_topic_name_length ||
+            subscriptions.count(std::string(topic)) > 0)
+            return error_cb(protocol::Status::INVALID_REQUEST);
+
+        auto const sub_id = repo->topics().subscribe(
+            topic,
+            [this, auto_open, notify_cb](ref_ptr<object_type> const &obj) {
+                if (not auto_open)
+                    return notify_cb(obj->key(), nullptr);
+                auto hnd = find_handle(obj->key());
+                if (not hnd)
+                    hnd = create_handle(obj);
+                hnd->open();
+                notify_cb(obj->key(), &obj->as_proper_object().resource());
+            });
+        subscriptions.emplace(topic, sub_id);
+        success_cb();
+    }
+
+    template <typename Success, typename Error>
+    void unsubscribe(std::string_view topic, Success success_cb,
+                     Error error_cb) {
+        assert(valid);
+        auto it = subscriptions.find(std::string(topic));
+        if (it == subscriptions.end())
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        repo->topics().unsubscribe(it->second);
+        subscriptions.erase(it);
+        success_cb();
+    }
+
+    // Until the session ends, 'notify_cb' may be called with the key of an
+    // object held only by this session (not PRIMITIVE; unshared, or shared
+    // and open only via this session, without vouchers), when an allocation
+    // has failed although there is enough free space in total. The client is
+    // expected to replace the object with a copy, so that the freed space
+    // can coalesce with neighboring free space. Each object is notified at
+    // most once.
+    template <typename Notify, typename Success, typename Error>
+    void subscribe_relocation(Notify notify_cb, Success success_cb,
+                              Error error_cb) {
+        assert(valid);
+        if (relocation_sub != 0)
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        relocation_sub = repo->relocations().subscribe(
+            [this, notify_cb](std::size_t bytes) {
+                return request_relocation(bytes, notify_cb);
+            });
+        success_cb();
     }
 
+    // The object must be open by this session and can be opened by others
+    // (i.e., shared or PRIMITIVE). Subscribers are notified before
+    // 'success_cb' is called with their number.
+    template <typename Success, typename Error>
+    void publish(std::string_view topic, common::token key,
+                 Success success_cb, Error error_cb) {
+        assert(valid);
+        if (topic.empty() || topic.size() > max_topic_name_length)
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        auto hnd = find_handle(key);
+        if (not hnd || not hnd->is_open())
+            return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        auto obj = hnd->object();
+        if (obj->policy() == protocol::Policy::DEFAULT &&
+            not obj->as_proper_object().is_shared())
+            return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        if (repo->is_multi_extent(obj.get()))
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        auto const count = repo->topics().publish(topic, obj);
+        success_cb(static_cast<std::uint32_t>(count));
+    }
+
+    // Opening a multi-extent object fails with INVALID_REQUEST unless
+    // 'accept_extents' is true (see open_extents()). If 'timeout' is
+    // positive, waiting for the object to be shared fails with TIMED_OUT
+    // after that long (see wait_deadline_queue). If 'lease' is positive, the
+    // open is leased (see renew_leases()), extending the session's lease to
+    // at least 'lease' after the object is opened.
     template <typename ImmediateSuccess, typename ImmediateError,
               typename DeferredSuccess, typename DeferredError>
     void open(common::token key, protocol::Policy policy, bool wait,
               time_point now, ImmediateSuccess success_cb,
               ImmediateError error_cb, DeferredSuccess deferred_success_cb,
-              DeferredError deferred_error_cb) {
+              DeferredError deferred_error_cb,
+              std::chrono::milliseconds timeout = {},
+              std::chrono::milliseconds lease = {},
+              bool accept_extents = false) {
         assert(valid);
 
-        std::shared_ptr<object_type> obj;
-        std::shared_ptr<object_type> vchr;
+        ref_ptr<object_type> obj;
+        ref_ptr<object_type> vchr;
         auto hnd = find_handle(key);
         if (hnd)
             obj = hnd->object();
@@ -197,6 +745,8 @@ class session {
             std::tie(obj, vchr) = find_target(key, now);
         if (not obj || obj->policy() != policy)
             return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        if (not accept_extents && repo->is_multi_extent(obj.get()))
+            return error_cb(protocol::Status::INVALID_REQUEST);
 
         bool const can_open_immediately =
             obj->policy() == protocol::Policy::PRIMITIVE ||
@@ -213,6 +763,9 @@ class session {
 
             if (not wait)
                 return error_cb(protocol::Status::OBJECT_BUSY);
+        } else if (auto const status = warm(*obj);
+                   status != protocol::Status::OK) {
+            return error_cb(status);
         }
 
         if (vchr) {
@@ -220,28 +773,72 @@ class session {
                 return error_cb(protocol::Status::NO_SUCH_OBJECT);
         }
 
+        // Opening through a voucher reuses this session's handle, if any.
+        if (not hnd)
+            hnd = find_handle(obj->key());
         if (not hnd)
             hnd = create_handle(obj);
 
         if (can_open_immediately) {
             hnd->open();
+            if (lease > lease.zero())
+                add_lease(*hnd, now + lease);
             auto const &rsrc = obj->as_proper_object().resource();
             return success_cb(obj->key(), rsrc);
         }
 
-        hnd->add_request_pending_on_share(
-            [deferred_success_cb,
-             deferred_error_cb](std::shared_ptr<handle_type> const &handle) {
-                auto o = handle->object();
-                auto const &po = o->as_proper_object();
-                if (po.is_shared()) {
-                    handle->open();
-                    auto const &rsrc = po.resource();
-                    deferred_success_cb(o->key(), rsrc);
-                } else {
-                    deferred_error_cb(protocol::Status::NO_SUCH_OBJECT);
-                }
-            });
+        auto resume = [deferred_success_cb,
+                       deferred_error_cb](ref_ptr<handle_type> const &handle) {
+            auto o = handle->object();
+            auto const &po = o->as_proper_object();
+            if (po.is_shared()) {
+                handle->open();
+                auto const &rsrc = po.resource();
+                deferred_success_cb(o->key(), rsrc);
+            } else {
+                deferred_error_cb(protocol::Status::NO_SUCH_OBJECT);
+            }
+        };
+        // Only leased requests pay for the larger capture.
+        if (lease > lease.zero()) {
+            return add_pending_open(
+                hnd,
+                [this, lease, resume](ref_ptr<handle_type> const &handle) {
+                    bool const opening =
+                        handle->object()->as_proper_object().is_shared();
+                    resume(handle);
+                    if (opening)
+                        add_lease(*handle, clock::now() + lease);
+                },
+                now, timeout, deferred_error_cb);
+        }
+        add_pending_open(hnd, std::move(resume), now, timeout,
+                         deferred_error_cb);
+    }
+
+    // Same as open(), but multi-extent objects (see alloc_extents()) can be
+    // opened, and the success callbacks are also passed the extents after
+    // the first (empty if the object is contiguous).
+    template <typename ImmediateSuccess, typename ImmediateError,
+              typename DeferredSuccess, typename DeferredError>
+    void open_extents(common::token key, protocol::Policy policy, bool wait,
+                      time_point now, ImmediateSuccess success_cb,
+                      ImmediateError error_cb,
+                      DeferredSuccess deferred_success_cb,
+                      DeferredError deferred_error_cb,
+                      std::chrono::milliseconds timeout = {},
+                      std::chrono::milliseconds lease = {}) {
+        open(
+            key, policy, wait, now,
+            [this, success_cb](common::token k, resource_type const &rsrc) {
+                success_cb(k, rsrc, more_extents_of(k));
+            },
+            error_cb,
+            [this, deferred_success_cb](common::token k,
+                                        resource_type const &rsrc) {
+                deferred_success_cb(k, rsrc, more_extents_of(k));
+            },
+            deferred_error_cb, timeout, lease, true);
     }
 
     template <typename Success, typename Error>
@@ -254,6 +851,71 @@ class session {
         success_cb();
     }
 
+    // Leased opens (see open()) are closed automatically, without close(),
+    // when the session's lease expires. The lease is extended by each
+    // leased open as necessary, but this is the only way to shorten it.
+    // Renewal extends (or shortens) the lease to 'lease' from 'now'; the
+    // success callback is passed false, and nothing is done, if there is no
+    // lease in force.
+    template <typename Success, typename Error>
+    void renew_leases(std::chrono::milliseconds lease, time_point now,
+                      Success success_cb, Error error_cb) {
+        assert(valid);
+        if (lease <= lease.zero())
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        if (lease_deadline == 0)
+            return success_cb(false);
+        set_lease_expiration(now + lease);
+        success_cb(true);
+    }
+
+    // Change the size of an unshared object, opened by this session as its
+    // exclusive writer, without moving it (see basic_segment_pool::resize()).
+    // Shrinking always succeeds; growing fails with OUT_OF_SHMEM unless the
+    // space after the object is free, so that the client can promptly fall
+    // back to allocating and copying. The object's charge to the quota, if
+    // any, follows the requested size, as for alloc(); objects charged to
+    // another session's quota (e.g., obtained by unsharing) are resized
+    // without adjusting any quota. The success callback is passed the key
+    // and the resource.
+    template <typename Success, typename Error>
+    void resize(common::token key, std::uint64_t size, Success success_cb,
+                Error error_cb) {
+        assert(valid);
+        auto hnd = find_handle(key);
+        if (not hnd ||
+            hnd->object()->as_proper_object().exclusive_writer() != hnd.get())
+            return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        auto obj = hnd->object();
+        auto &po = obj->as_proper_object();
+        if (po.is_pooled() || repo->is_multi_extent(obj.get()))
+            return error_cb(protocol::Status::INVALID_REQUEST);
+        if (size > std::numeric_limits<std::size_t>::max()) // 32-bit
+            return error_cb(protocol::Status::OUT_OF_SHMEM);
+
+        auto const s = static_cast<std::size_t>(size);
+        bool const ours = acct && po.charged_account() == acct.get();
+        auto const old_charge = ours ? po.charged_bytes() : s;
+        if (s > old_charge && not acct->try_charge(s - old_charge))
+            return error_cb(protocol::Status::QUOTA_EXCEEDED);
+
+        auto &rsrc = po.mutable_resource();
+        auto const old_size = allocr->bytes(rsrc).size();
+        if (not allocr->resize(rsrc, s)) {
+            if (s > old_charge)
+                acct->credit(s - old_charge);
+            return error_cb(protocol::Status::OUT_OF_SHMEM);
+        }
+        if (ours) {
+            if (s < old_charge)
+                acct->credit(old_charge - s);
+            po.set_charge(acct.get(), s);
+        }
+        if (allocr->bytes(rsrc).size() < old_size)
+            repo->alloc_waiters().notify_freed();
+        success_cb(obj->key(), po.resource());
+    }
+
     template <typename Success, typename Error>
     void share(common::token key, Success success_cb, Error error_cb) {
         assert(valid);
@@ -265,11 +927,96 @@ class session {
         success_cb();
     }
 
+    // Like share(), but if an identical (same size and contents) object has
+    // been shared with deduplication, that object is opened in place of the
+    // given one, which is closed (and hence destroyed). Otherwise the object
+    // is shared and indexed for later deduplication. The success callback is
+    // passed the key and resource of the object now held. Replacement is
+    // only done if nothing else refers to the given object (no vouchers or
+    // waiting opens), as those would otherwise fail. The contents are hashed
+    // on the calling thread.
+    template <typename Success, typename Error>
+    void share_dedup(common::token key, Success success_cb, Error error_cb) {
+        assert(valid);
+        auto hnd = find_handle(key);
+        if (not hnd ||
+            hnd->object()->as_proper_object().exclusive_writer() != hnd.get())
+            return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        auto obj = hnd->object();
+        auto &po = obj->as_proper_object();
+        if (repo->is_multi_extent(obj.get())) {
+            po.share(); // Only single-extent objects are deduplicated
+            return success_cb(obj->key(), po.resource());
+        }
+        auto const bytes = allocr->bytes(po.resource());
+        auto const hash = content_hash(bytes);
+
+        if (hnd->is_open_uniquely() && po.vouchers().empty() &&
+            not po.has_handles_awaiting_share()) {
+            auto *const dup =
+                repo->dedup().find(hash, [&](object_type &other) {
+                    auto const b = allocr->bytes(
+                        other.as_proper_object().resource());
+                    return std::equal(b.begin(), b.end(), bytes.begin(),
+                                      bytes.end());
+                });
+            if (dup != nullptr) {
+                auto dup_hnd = find_handle(dup->key());
+                if (not dup_hnd)
+                    dup_hnd = create_handle(ref_ptr<object_type>(dup));
+                dup_hnd->open();
+                hnd->close();
+                return success_cb(dup->key(),
+                                  dup->as_proper_object().resource());
+            }
+        }
+
+        po.share();
+        repo->dedup().insert(hash, obj.get());
+        success_cb(obj->key(), po.resource());
+    }
+
+    // Equivalent to share() followed by create_voucher() on the same key, but
+    // with a single lookup. Nothing is done if either step would fail.
+    template <typename Success, typename Error>
+    void share_and_create_voucher(common::token key, unsigned count,
+                                  time_point now, Success success_cb,
+                                  Error error_cb) {
+        share_and_create_voucher(key, count, now, std::chrono::milliseconds(0),
+                                 success_cb, error_cb);
+    }
+
+    template <typename Success, typename Error>
+    void share_and_create_voucher(common::token key, unsigned count,
+                                  time_point now,
+                                  std::chrono::milliseconds ttl,
+                                  Success success_cb, Error error_cb) {
+        assert(valid);
+
+        if (count == 0)
+            return error_cb(protocol::Status::INVALID_REQUEST);
+
+        auto hnd = find_handle(key);
+        if (not hnd ||
+            hnd->object()->as_proper_object().exclusive_writer() != hnd.get())
+            return error_cb(protocol::Status::NO_SUCH_OBJECT);
+        auto obj = hnd->object();
+        obj->as_proper_object().share();
+
+        auto voucher =
+            repo->create_voucher(obj, voucher_expiration(now, ttl), count);
+
+        success_cb(voucher->key());
+    }
+
+    // If 'timeout' is positive, waiting for unique ownership fails with
+    // TIMED_OUT after that long.
     template <typename ImmediateSuccess, typename ImmediateError,
               typename DeferredSuccess, typename DeferredError>
     void unshare(common::token key, bool wait, ImmediateSuccess success_cb,
                  ImmediateError error_cb, DeferredSuccess deferred_success_cb,
-                 DeferredError deferred_error_cb) {
+                 DeferredError deferred_error_cb,
+                 std::chrono::milliseconds timeout = {}) {
         assert(valid);
 
         auto hnd = find_handle(key);
@@ -282,42 +1029,69 @@ class session {
         if (obj->as_proper_object().has_handle_awaiting_unique_ownership())
             return error_cb(protocol::Status::OBJECT_RESERVED);
 
+        // Expired vouchers would otherwise delay unique ownership until the
+        // voucher queue gets to them.
+        auto const now = clock::now();
+        repo->drop_stale_vouchers(obj, now);
+
         bool const can_unshare_immediately = hnd->is_open_uniquely();
         if (not can_unshare_immediately && not wait)
             return error_cb(protocol::Status::OBJECT_BUSY);
         if (can_unshare_immediately)
             return success_cb(do_unshare(hnd));
 
+        auto const dl = timeout > timeout.zero()
+                            ? repo->wait_deadlines().new_id()
+                            : wait_deadline_queue::id_type(0);
         hnd->set_request_pending_on_unique_ownership(
-            [deferred_success_cb, deferred_error_cb,
-             this](std::shared_ptr<handle_type> const &handle) {
+            [deferred_success_cb, deferred_error_cb, this,
+             dl](ref_ptr<handle_type> const &handle) {
+                if (dl != 0)
+                    repo->wait_deadlines().cancel(dl);
                 if (handle->is_open_uniquely())
                     return deferred_success_cb(do_unshare(handle));
                 return deferred_error_cb(protocol::Status::NO_SUCH_OBJECT);
             });
+        if (dl != 0) {
+            repo->wait_deadlines().add(
+                this, dl, now + timeout, [hnd, deferred_error_cb] {
+                    if (hnd->cancel_request_pending_on_unique_ownership())
+                        deferred_error_cb(protocol::Status::TIMED_OUT);
+                });
+        }
     }
 
     template <typename Success, typename Error>
     void create_voucher(common::token target, unsigned count, time_point now,
                         Success success_cb, Error error_cb) {
+        create_voucher(target, count, now, std::chrono::milliseconds(0),
+                       success_cb, error_cb);
+    }
+
+    // A positive 'ttl' shortens (but does not lengthen) the voucher's time to
+    // live; zero uses the session's configured TTL.
+    template <typename Success, typename Error>
+    void create_voucher(common::token target, unsigned count, time_point now,
+                        std::chrono::milliseconds ttl, Success success_cb,
+                        Error error_cb) {
         assert(valid);
 
         if (count == 0)
             return error_cb(protocol::Status::INVALID_REQUEST);
 
         auto const hnd = find_handle(target);
-        std::shared_ptr<object_type> real_target;
+        ref_ptr<object_type> real_target;
         if (hnd) {
             real_target = hnd->object();
         } else {
-            std::shared_ptr<object_type> vchr;
+            ref_ptr<object_type> vchr;
             std::tie(real_target, vchr) = find_target(target, now);
             if (not real_target)
                 return error_cb(protocol::Status::NO_SUCH_OBJECT);
         }
 
-        auto expiration = now + voucher_ttl;
-        auto voucher = repo->create_voucher(real_target, expiration, count);
+        auto voucher = repo->create_voucher(
+            real_target, voucher_expiration(now, ttl), count);
 
         success_cb(voucher->key());
     }
@@ -341,12 +1115,21 @@ class session {
 
     void drop_pending_requests() {
         assert(valid);
+        repo->wait_deadlines().drop(this); // Including the lease
+        lease_deadline = 0;
         // Iterate in a manner that allows item erasure.
         for (auto i = handles.begin(), e = handles.end(); i != e;) {
             auto n = std::next(i);
             i->drop_pending_requests();
             i = n;
         }
+        for (auto const &sub : subscriptions)
+            repo->topics().unsubscribe(sub.second);
+        subscriptions.clear();
+        if (relocation_sub != 0)
+            repo->relocations().unsubscribe(
+                std::exchange(relocation_sub, 0));
+        repo->alloc_waiters().drop(this);
     }
 
     void perform_housekeeping() {
@@ -354,14 +1137,211 @@ class session {
         handles.rehash_if_appropriate(true);
     }
 
+    [[nodiscard]] auto handle_count() const noexcept -> std::size_t {
+        return handles.size();
+    }
+
+    // Tear down the session (whose client has gone away) in steps, so that
+    // closing very many handles does not hold up other clients: drop all
+    // pending requests (on the first call; this frees nothing and is quick
+    // per handle), then close up to 'max_count' handles. Return true when
+    // no handles remain, after which destruction is quick. No other
+    // requests may be made once this has been called.
+    auto close_some_handles(std::size_t max_count) -> bool {
+        assert(valid);
+        if (not closing) {
+            drop_pending_requests();
+            closing = true;
+        }
+        // Iterate in a manner that allows item erasure.
+        std::size_t closed = 0;
+        for (auto i = handles.begin(), e = handles.end();
+             i != e && closed < max_count; ++closed) {
+            auto n = std::next(i);
+            i->close_all();
+            i = n;
+        }
+        return handles.empty();
+    }
+
   private:
+    // Shared by the unleased and leased paths of open(). If 'timeout' is
+    // positive, the pending request is canceled with TIMED_OUT at the
+    // deadline.
+    template <typename Resume, typename DeferredError>
+    void add_pending_open(ref_ptr<handle_type> const &hnd, Resume resume,
+                          time_point now, std::chrono::milliseconds timeout,
+                          DeferredError deferred_error_cb) {
+        if (timeout <= timeout.zero())
+            return hnd->add_request_pending_on_share(std::move(resume));
+
+        // Only requests with a timeout pay for the larger capture.
+        auto &deadlines = repo->wait_deadlines();
+        auto const dl = deadlines.new_id();
+        hnd->add_request_pending_on_share(
+            [this, dl, resume](ref_ptr<handle_type> const &handle) {
+                repo->wait_deadlines().cancel(dl);
+                resume(handle);
+            },
+            dl);
+        deadlines.add(this, dl, now + timeout, [hnd, dl, deferred_error_cb] {
+            if (hnd->cancel_request_pending_on_share(dl))
+                deferred_error_cb(protocol::Status::TIMED_OUT);
+        });
+    }
+
+    void add_lease(handle_type &hnd, time_point expiration) {
+        hnd.add_lease();
+        if (lease_deadline == 0 || expiration > lease_expiration)
+            set_lease_expiration(expiration);
+    }
+
+    void set_lease_expiration(time_point expiration) {
+        auto &deadlines = repo->wait_deadlines();
+        if (lease_deadline != 0)
+            deadlines.cancel(lease_deadline);
+        lease_deadline = deadlines.new_id();
+        lease_expiration = expiration;
+        deadlines.add(this, lease_deadline, expiration, [this] {
+            lease_deadline = 0;
+            expire_leases();
+        });
+    }
+
+    // Closing may resume requests pending on unique ownership, which rekey
+    // handles in our table, so collect the leased handles before closing.
+    void expire_leases() {
+        std::vector<ref_ptr<handle_type>> leased;
+        for (auto &hnd : handles) {
+            if (hnd.lease_count() > 0)
+                leased.emplace_back(&hnd);
+        }
+        for (auto const &hnd : leased)
+            hnd->close_leased();
+    }
+
+    // Allocate from the session's sub-pool (see bind_sub_pool()).
+    auto allocate_in_sub_pool(std::size_t size, int numa_node,
+                              std::size_t alignment) -> resource_type {
+        if (sub_pool == 0)
+            return allocr->allocate(size, numa_node, alignment);
+        return allocr->allocate(size, numa_node, alignment, sub_pool);
+    }
+
+    void request_relocation_if_fragmented(std::size_t size) {
+        auto const free = allocr->stats().free;
+        if (free >= size)
+            repo->relocations().request(size, free);
+    }
+
+    // Notify the client of objects to relocate (see subscribe_relocation())
+    // until their total size reaches 'bytes'; return the total size.
+    template <typename Notify>
+    auto request_relocation(std::size_t bytes, Notify const &notify_cb)
+        -> std::size_t {
+        std::size_t total = 0;
+        for (auto &hnd : handles) {
+            if (total >= bytes)
+                break;
+            if (hnd.is_relocation_requested() || not hnd.is_open())
+                continue;
+            auto obj = hnd.object();
+            if (obj->policy() != protocol::Policy::DEFAULT ||
+                repo->is_multi_extent(obj.get()))
+                continue; // Relocated by Clone, which needs one extent
+            auto const &po = obj->as_proper_object();
+            if (not po.is_opened_by_unique_handle() ||
+                po.has_handles_awaiting_share() ||
+                po.has_handle_awaiting_unique_ownership() ||
+                (not po.is_shared() && po.exclusive_writer() != &hnd))
+                continue;
+            hnd.set_relocation_requested();
+            total += allocr->bytes(po.resource()).size();
+            notify_cb(obj->key());
+        }
+        return total;
+    }
+
+    // The extents after the first of the (proper) object with the given key.
+    auto more_extents_of(common::token key) -> gsl::span<resource_type const> {
+        auto obj = repo->find_object(key);
+        assert(obj);
+        return repo->more_extents_of(obj.get());
+    }
+
+    // Create an object for a new allocation of 'bytes' (charged to the
+    // quota, if any), sampled for profiling if chosen.
+    auto create_allocated_object(protocol::Policy policy, resource_type &&rsrc,
+                                 std::size_t bytes) -> ref_ptr<object_type> {
+        if (repo->alloc_profiler().should_sample())
+            return create_sampled_object(policy, std::move(rsrc), bytes);
+        auto obj = repo->create_object(policy, std::move(rsrc));
+        if (acct)
+            charge_object(*obj, bytes);
+        return obj;
+    }
+
+    // If the object is in cold storage (see cold_store), decompress it into
+    // a new allocation (which is not charged to the quota, as the object
+    // already was). If it is being compressed, it stays as it is.
+    auto warm(object_type &obj) -> protocol::Status {
+        auto &cold = repo->cold_objects();
+        cold.cancel_compression(&obj);
+        if (not cold.is_cold(&obj))
+            return protocol::Status::OK;
+        auto rsrc =
+            allocr->allocate(cold.original_size(&obj), client_numa_node, 0);
+        if (not rsrc)
+            return protocol::Status::OUT_OF_SHMEM;
+        [[maybe_unused]] bool const ok =
+            decompress(cold.compressed_data(&obj), allocr->bytes(rsrc));
+        assert(ok);
+        (void)obj.as_proper_object().replace_resource(std::move(rsrc));
+        cold.erase(&obj);
+        return protocol::Status::OK;
+    }
+
+    // Record that 'bytes' have been charged to the quota for 'obj' (which
+    // is not otherwise recycled), and set a recycler that credits the quota
+    // with the bytes charged (as adjusted by resize()) when it is destroyed.
+    void charge_object(object_type &obj, std::size_t bytes) {
+        assert(acct);
+        auto &po = obj.as_proper_object();
+        po.set_charge(acct.get(), bytes);
+        po.set_recycler([a = acct, p = &po](resource_type && /* rsrc */) {
+            a->credit(p->charged_bytes());
+        });
+    }
+
+    // Create an object for an allocation of 'bytes' that has been chosen
+    // for sampling by the repository's allocation profiler, with a recycler
+    // that records its lifetime (and credits the quota, if any).
+    auto create_sampled_object(protocol::Policy policy, resource_type &&rsrc,
+                               std::size_t bytes) -> ref_ptr<object_type> {
+        auto &prof = repo->alloc_profiler();
+        auto const i = prof.record_allocation(client_name, client_pid, bytes);
+        auto obj = repo->create_object(policy, std::move(rsrc));
+        auto &po = obj->as_proper_object();
+        if (acct)
+            po.set_charge(acct.get(), bytes);
+        po.set_recycler(
+            [p = &prof, i, start = std::chrono::steady_clock::now(), a = acct,
+             o = &po](resource_type && /* rsrc */) {
+                p->record_free(i, std::chrono::steady_clock::now() - start);
+                if (a)
+                    a->credit(o->charged_bytes());
+            });
+        return obj;
+    }
+
     void close_session() {
         if (not valid)
             return;
 
         // Before starting closing handles, drop all of _our_ pending
         // requests so that they do not get resumed.
-        drop_pending_requests();
+        if (not closing)
+            drop_pending_requests();
 
         // Iterate in a manner that allows item erasure.
         for (auto i = handles.begin(), e = handles.end(); i != e;) {
@@ -373,30 +1353,40 @@ class session {
         assert(handles.empty());
         assert(handle_storage.empty());
 
+        if (not pools.empty()) {
+            pools.clear();
+            repo->alloc_waiters().notify_freed();
+        }
+
         valid = false;
     }
 
-    auto create_handle(std::shared_ptr<object_type> object)
-        -> std::shared_ptr<handle_type> {
+    auto create_handle(ref_ptr<object_type> object) -> ref_ptr<handle_type> {
         auto hnd = handle_storage.emplace(std::move(object));
         handles.insert(*hnd);
-        return {&*hnd, [this](handle_type *h) {
-                    handles.erase(handles.iterator_to(*h));
-                    handle_storage.erase(handle_storage.get_iterator(h));
-                }};
+        hnd->set_disposer(&session::dispose_handle, this);
+        return ref_ptr<handle_type>(&*hnd);
+    }
+
+    static void dispose_handle(void *self, handle_type *hnd) {
+        auto *sess = static_cast<session *>(self);
+        sess->handles.erase(sess->handles.iterator_to(*hnd));
+        sess->handle_storage.erase(sess->handle_storage.get_iterator(hnd));
     }
 
-    auto find_handle(common::token key) -> std::shared_ptr<handle_type> {
+    auto find_handle(common::token key) -> ref_ptr<handle_type> {
+        if (not repo->key_seq().may_have_issued(key))
+            return {};
         auto hnd = handles.find(key);
         if (hnd == handles.end())
             return {};
-        return hnd->shared_from_this();
+        return ref_ptr<handle_type>(&*hnd);
     }
 
-    // Returns pair of shared_ptr<object>s: {target, voucher}.
+    // Returns pair of ref_ptr<object>s: {target, voucher}.
     auto find_target(common::token key, time_point now) {
         auto obj = repo->find_object(key);
-        std::shared_ptr<object_type> vchr;
+        ref_ptr<object_type> vchr;
         if (obj && obj->is_voucher()) {
             auto &v = obj->as_voucher();
             if (v.is_valid(now))
@@ -407,13 +1397,25 @@ class session {
         return std::pair{obj, vchr};
     }
 
-    auto do_unshare(std::shared_ptr<handle_type> const &hnd) -> common::token {
+    [[nodiscard]] auto voucher_expiration(time_point now,
+                                          std::chrono::milliseconds ttl) const
+        -> time_point {
+        if (ttl.count() > 0 && ttl < voucher_ttl)
+            return now + ttl;
+        return now + voucher_ttl;
+    }
+
+    auto do_unshare(ref_ptr<handle_type> const &hnd) -> common::token {
         auto obj = hnd->object();
 
+        // The contents may now change.
+        repo->dedup().erase(obj.get());
+
         // Temporarily remove from handle table while key changes.
         handles.erase(handles.iterator_to(*hnd));
         obj->as_proper_object().unshare(hnd.get());
         repo->rekey_object(obj);
+        hnd->rekey(obj->key());
         handles.insert(*hnd);
 
         return obj->key();
@@ -32,6 +32,13 @@
 #include <linux/limits.h>
 #endif
 
+// MFD_HUGE_SHIFT is defined in linux/memfd.h, which may conflict with
+// sys/mman.h. Like SHM_HUGE_SHIFT, it is HUGETLB_FLAG_ENCODE_SHIFT from the
+// stable kernel ABI.
+#if defined(__linux__) && not defined(MFD_HUGE_SHIFT)
+#define MFD_HUGE_SHIFT 26 // NOLINT(cppcoreguidelines-macro-usage)
+#endif
+
 namespace partake::daemon {
 
 namespace internal {
@@ -400,6 +407,124 @@ TEST_CASE("create_posix_file_shmem") {
     CHECK(shm.unmap());
 }
 
+#ifdef __linux__
+
+auto memfd_shmem::path() const -> std::string {
+    if (not fd.is_valid())
+        return {};
+    return "/proc/" + std::to_string(::getpid()) + "/fd/" +
+           std::to_string(fd.get());
+}
+
+auto memfd_shmem::open_read_only() const -> common::posix::file_descriptor {
+    auto const p = path();
+    if (p.empty())
+        return {};
+    errno = 0;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    auto ret = common::posix::file_descriptor(
+        ::open(p.c_str(), O_RDONLY | O_CLOEXEC), spdlog::default_logger());
+    if (not ret.is_valid()) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::error("open: {}: {} ({})", p, msg, err);
+    }
+    return ret;
+}
+
+auto create_memfd_shmem(std::size_t size, bool use_huge_pages,
+                        std::size_t huge_page_size) -> memfd_shmem {
+    auto const psize = selected_page_size(use_huge_pages, huge_page_size);
+    if (psize == 0) {
+        spdlog::error("{} is not a supported huge page size",
+                      human_readable_size(huge_page_size));
+        return {};
+    }
+    if (not round_up_or_check_size(size, psize))
+        return {};
+
+    unsigned flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+    if (use_huge_pages) {
+        flags |= MFD_HUGETLB;
+        if (huge_page_size > 0)
+            flags |= static_cast<unsigned>(log2_size(huge_page_size))
+                     << MFD_HUGE_SHIFT;
+    }
+
+    errno = 0;
+    auto fd = common::posix::file_descriptor(::memfd_create("partake", flags),
+                                             spdlog::default_logger());
+    if (not fd.is_valid()) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::error("memfd_create: {} ({})", msg, err);
+        return {};
+    }
+    spdlog::info("memfd_create: success; fd {}", fd.get());
+    auto const raw_fd = fd.get();
+    auto ret = memfd_shmem(std::move(fd), size); // Sets the size
+    if (not ret.is_valid())
+        return {};
+
+    // Failure to seal is not fatal; clients are then merely trusted not to
+    // resize the file.
+    errno = 0;
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    if (::fcntl(raw_fd, F_ADD_SEALS,
+                F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+        int err = errno;
+        auto msg = common::posix::strerror(err);
+        spdlog::warn("fcntl: F_ADD_SEALS: fd {}: {} ({})", raw_fd, msg, err);
+    }
+    return ret;
+}
+
+TEST_CASE("create_memfd_shmem") {
+    // NOLINTNEXTLINE(readability-magic-numbers)
+    auto shm = create_memfd_shmem(100);
+    REQUIRE(shm.is_valid());
+    CHECK(shm.address() != nullptr);
+    CHECK(shm.size() == page_size());
+    auto const path = shm.path();
+    CHECK(path.rfind("/proc/", 0) == 0);
+
+    // The memory can be mapped via the path.
+    // NOLINTBEGIN(cppcoreguidelines-pro-type-vararg)
+    auto const fd2 =
+        common::posix::file_descriptor(::open(path.c_str(), O_RDWR));
+    // NOLINTEND(cppcoreguidelines-pro-type-vararg)
+    REQUIRE(fd2.is_valid());
+    void *addr2 = ::mmap(nullptr, shm.size(), PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd2.get(), 0);
+    REQUIRE(addr2 != MAP_FAILED);
+    static_cast<char *>(shm.address())[0] = 42;
+    CHECK(static_cast<char *>(addr2)[0] == 42);
+    CHECK(::munmap(addr2, shm.size()) == 0);
+
+    // The size cannot be changed by a client.
+    CHECK(shm.descriptor() >= 0);
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-vararg)
+    auto const seals = ::fcntl(shm.descriptor(), F_GET_SEALS);
+    CHECK((seals & F_SEAL_SHRINK) != 0);
+    CHECK((seals & F_SEAL_GROW) != 0);
+    CHECK(::ftruncate(fd2.get(), 0) != 0);
+
+    auto const ro = shm.open_read_only();
+    REQUIRE(ro.is_valid());
+    CHECK(::mmap(nullptr, shm.size(), PROT_READ | PROT_WRITE, MAP_SHARED,
+                 ro.get(), 0) == MAP_FAILED);
+    void *addr3 =
+        ::mmap(nullptr, shm.size(), PROT_READ, MAP_SHARED, ro.get(), 0);
+    REQUIRE(addr3 != MAP_FAILED);
+    CHECK(static_cast<char *>(addr3)[0] == 42);
+    CHECK(::munmap(addr3, shm.size()) == 0);
+    CHECK(shm.unmap());
+
+    CHECK_FALSE(create_memfd_shmem(100, true, 12345).is_valid());
+}
+
+#endif // __linux__
+
 } // namespace partake::daemon
 
 #endif // _WIN32
@@ -37,9 +37,8 @@ class mmap_mapping {
     auto operator=(mmap_mapping const &) = delete;
 
     mmap_mapping(mmap_mapping &&other) noexcept
-        : siz(other.siz), addr(other.addr) {
-        other = {};
-    }
+        : siz(std::exchange(other.siz, 0)),
+          addr(std::exchange(other.addr, nullptr)) {}
 
     auto operator=(mmap_mapping &&rhs) noexcept -> mmap_mapping & {
         unmap();
@@ -87,6 +86,9 @@ class mmap_shmem {
 
     auto unlink() -> bool { return ent.unlink(); }
 
+    // Do not unlink upon destruction.
+    void keep() noexcept { ent.keep(); }
+
     auto unmap() -> bool { return mapping.unmap(); }
 };
 
@@ -100,6 +102,55 @@ auto create_file_mmap_shmem(std::string const &filename, std::size_t size,
 
 auto create_file_mmap_shmem(std::size_t size) -> mmap_shmem;
 
+#ifdef __linux__
+
+// Anonymous shared memory created with memfd_create(2), optionally backed by
+// huge pages. The descriptor is kept open so that other processes can map the
+// memory by opening path() (the /proc/<pid>/fd entry for the descriptor),
+// subject to the usual access checks for /proc/<pid>/fd, or by receiving a
+// duplicate of descriptor() over a Unix domain socket. The size is sealed
+// (F_SEAL_SHRINK | F_SEAL_GROW) so that clients can map it without fear of
+// the file being truncated under them.
+class memfd_shmem {
+    common::posix::file_descriptor fd;
+    internal::mmap_mapping mapping;
+
+  public:
+    memfd_shmem() noexcept = default;
+
+    explicit memfd_shmem(common::posix::file_descriptor &&filedes,
+                         std::size_t size)
+        : fd(std::move(filedes)), mapping(size, fd) {}
+
+    [[nodiscard]] auto is_valid() const noexcept -> bool {
+        return mapping.is_valid();
+    }
+
+    [[nodiscard]] auto path() const -> std::string;
+
+    [[nodiscard]] auto descriptor() const noexcept -> int { return fd.get(); }
+
+    // Return a new descriptor for the memory, opened read-only (so that it
+    // cannot be mapped writable); invalid on failure.
+    [[nodiscard]] auto open_read_only() const
+        -> common::posix::file_descriptor;
+
+    [[nodiscard]] auto address() const noexcept -> void * {
+        return mapping.address();
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return mapping.size();
+    }
+
+    auto unmap() -> bool { return mapping.unmap(); }
+};
+
+auto create_memfd_shmem(std::size_t size, bool use_huge_pages = false,
+                        std::size_t huge_page_size = 0) -> memfd_shmem;
+
+#endif // __linux__
+
 } // namespace partake::daemon
 
 #endif // _WIN32
@@ -16,7 +16,6 @@
 #include <doctest.h>
 #include <spdlog/spdlog.h>
 
-#include <algorithm>
 #include <cerrno>
 #include <type_traits>
 
@@ -51,23 +50,6 @@ namespace {
     return ret;
 }();
 
-#ifdef __linux__
-// Returns 0 if invalid size requested.
-auto linux_page_size(bool use_huge_pages, std::size_t huge_page_size)
-    -> std::size_t {
-    if (use_huge_pages) {
-        if (huge_page_size == 0)
-            return default_huge_page_size();
-        auto const sizes = huge_page_sizes();
-        if (std::find(sizes.begin(), sizes.end(), huge_page_size) ==
-            sizes.end())
-            return 0;
-        return huge_page_size;
-    }
-    return page_size();
-}
-#endif
-
 } // namespace
 
 auto create_sysv_shmem_id(int key, std::size_t size, bool force = false,
@@ -101,7 +83,7 @@ auto create_sysv_shmem_id(int key, std::size_t size, bool force = false,
     }
 
 #ifdef __linux__
-    auto const psize = linux_page_size(use_huge_pages, huge_page_size);
+    auto const psize = selected_page_size(use_huge_pages, huge_page_size);
     if (psize == 0) {
         spdlog::error("{} is not a supported huge page size",
                       human_readable_size(huge_page_size));
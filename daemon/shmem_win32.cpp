@@ -133,18 +133,26 @@ TEST_CASE("create_autodeleted_file") {
     }
 }
 
+auto preferred_node(int numa_node) -> DWORD {
+    return numa_node >= 0 ? static_cast<DWORD>(numa_node)
+                          : NUMA_NO_PREFERRED_NODE;
+}
+
 auto create_file_mapping(win32::win32_handle const &file_handle,
                          std::string const &name, std::size_t size,
-                         bool use_large_pages = false) -> win32::win32_handle {
+                         bool use_large_pages = false, int numa_node = -1)
+    -> win32::win32_handle {
     if (name.empty() || size == 0)
         return {};
     if (use_large_pages)
         add_lock_memory_privilege(); // Ignore errors; let next step fail.
-    HANDLE raw_handle = CreateFileMappingA(
+    // The preferred node applies to the physical pages of the section
+    // (committed with SEC_COMMIT), wherever they are first faulted.
+    HANDLE raw_handle = CreateFileMappingNumaA(
         file_handle.get(), nullptr,
         PAGE_READWRITE | SEC_COMMIT | (use_large_pages ? SEC_LARGE_PAGES : 0),
         sizeof(std::size_t) > 4 ? size >> 32 : 0, size & UINT_MAX,
-        name.c_str());
+        name.c_str(), preferred_node(numa_node));
     // Docs say return value is NULL (not INVALID_HANDLE_VALUE) on failure.
     auto h_mapping =
         raw_handle == nullptr
@@ -155,11 +163,11 @@ auto create_file_mapping(win32::win32_handle const &file_handle,
     auto err = GetLastError();
     if (not h_mapping.is_valid() || err == ERROR_ALREADY_EXISTS) {
         auto msg = win32::strerror(err);
-        spdlog::error("CreateFileMapping: {}: {} ({})", name, msg, err);
+        spdlog::error("CreateFileMappingNuma: {}: {} ({})", name, msg, err);
         return {};
     }
-    spdlog::info("CreateFileMapping: {}: success, handle {}", name,
-                 h_mapping.get());
+    spdlog::info("CreateFileMappingNuma: {}: node {}: success, handle {}",
+                 name, numa_node, h_mapping.get());
     return h_mapping;
 }
 
@@ -206,22 +214,24 @@ TEST_CASE("create_file_mapping") {
 namespace internal {
 
 win32_map_view::win32_map_view(win32::win32_handle const &h_mapping,
-                               std::size_t size, bool use_large_pages)
-    : addr(
-          h_mapping.is_valid()
-              ? MapViewOfFile(h_mapping.get(),
-                              FILE_MAP_READ | FILE_MAP_WRITE |
-                                  (use_large_pages ? FILE_MAP_LARGE_PAGES : 0),
-                              0, 0, size)
-              : nullptr),
+                               std::size_t size, bool use_large_pages,
+                               int numa_node)
+    : addr(h_mapping.is_valid()
+               ? MapViewOfFileExNuma(
+                     h_mapping.get(),
+                     FILE_MAP_READ | FILE_MAP_WRITE |
+                         (use_large_pages ? FILE_MAP_LARGE_PAGES : 0),
+                     0, 0, size, nullptr, preferred_node(numa_node))
+               : nullptr),
       siz(size) {
     if (h_mapping.is_valid() && addr == nullptr) {
         auto err = GetLastError();
         auto msg = win32::strerror(err);
-        spdlog::error("MapViewOfFile: {}: {} ({})", h_mapping.get(), msg, err);
+        spdlog::error("MapViewOfFileExNuma: {}: {} ({})", h_mapping.get(),
+                      msg, err);
     } else {
-        spdlog::info("MapViewOfFile: {}: success; addr {}", h_mapping.get(),
-                     addr);
+        spdlog::info("MapViewOfFileExNuma: {}: node {}: success; addr {}",
+                     h_mapping.get(), numa_node, addr);
     }
 }
 
@@ -279,15 +289,16 @@ TEST_CASE("win32_map_view") {
 } // namespace internal
 
 auto create_win32_shmem(std::string const &mapping_name, std::size_t size,
-                        bool use_large_pages) -> win32_shmem {
+                        bool use_large_pages, int numa_node) -> win32_shmem {
     auto const granularity = use_large_pages ? large_page_minimum()
                                              : system_allocation_granularity();
     if (not round_up_or_check_size(size, granularity))
         return {};
 
-    return win32_shmem(
-        {}, create_file_mapping({}, mapping_name, size, use_large_pages), size,
-        use_large_pages);
+    return win32_shmem({},
+                       create_file_mapping({}, mapping_name, size,
+                                           use_large_pages, numa_node),
+                       size, use_large_pages, numa_node);
 }
 
 TEST_CASE("create_win32_shmem") {
@@ -299,7 +310,8 @@ TEST_CASE("create_win32_shmem") {
 
 auto create_win32_file_shmem(std::filesystem::path const &path,
                              std::string const &mapping_name, std::size_t size,
-                             bool force, bool use_large_pages) -> win32_shmem {
+                             bool force, bool use_large_pages,
+                             int numa_node) -> win32_shmem {
     auto const granularity = use_large_pages ? large_page_minimum()
                                              : system_allocation_granularity();
     if (not round_up_or_check_size(size, granularity))
@@ -308,10 +320,17 @@ auto create_win32_file_shmem(std::filesystem::path const &path,
     auto h_file = create_autodeleted_file(path, force);
     if (not h_file.is_valid())
         return {};
-    auto h_mapping =
-        create_file_mapping(h_file, mapping_name, size, use_large_pages);
+    auto h_mapping = create_file_mapping(h_file, mapping_name, size,
+                                         use_large_pages, numa_node);
     return win32_shmem(std::move(h_file), std::move(h_mapping), size,
-                       use_large_pages);
+                       use_large_pages, numa_node);
+}
+
+TEST_CASE("create_win32_shmem: numa node") {
+    auto shm =
+        create_win32_shmem(generate_win32_file_mapping_name(), 100, false, 0);
+    CHECK(shm.is_valid());
+    CHECK(shm.address() != nullptr);
 }
 
 TEST_CASE("create_win32_file_shmem") {
@@ -21,7 +21,7 @@ namespace partake::daemon {
 
 namespace internal {
 
-// RAII for MapViewOfFile() - UnmapViewOfFile()
+// RAII for MapViewOfFileExNuma() - UnmapViewOfFile()
 class win32_map_view {
     void *addr = nullptr;
     std::size_t siz = 0;
@@ -29,8 +29,11 @@ class win32_map_view {
   public:
     win32_map_view() noexcept = default;
 
+    // Pages faulted through the view are preferably placed on 'numa_node'
+    // (-1 for no preference).
     explicit win32_map_view(win32::win32_handle const &h_mapping,
-                            std::size_t size, bool use_large_pages = false);
+                            std::size_t size, bool use_large_pages = false,
+                            int numa_node = -1);
 
     ~win32_map_view() { unmap(); }
 
@@ -71,9 +74,10 @@ class win32_shmem {
 
     explicit win32_shmem(win32::win32_handle &&file_handle,
                          win32::win32_handle &&mapping_handle,
-                         std::size_t size, bool use_large_pages)
+                         std::size_t size, bool use_large_pages,
+                         int numa_node = -1)
         : h_file(std::move(file_handle)), h_mapping(std::move(mapping_handle)),
-          view(h_mapping, size, use_large_pages) {}
+          view(h_mapping, size, use_large_pages, numa_node) {}
 
     [[nodiscard]] auto is_valid() const noexcept -> bool {
         return h_mapping.is_valid() && view.is_valid();
@@ -92,13 +96,16 @@ inline auto generate_win32_file_mapping_name() -> std::string {
     return "Local\\partake-" + random_string(24);
 }
 
+// If 'numa_node' is not negative, the memory is preferably allocated on that
+// NUMA node (CreateFileMappingNuma(), MapViewOfFileExNuma()).
 auto create_win32_shmem(std::string const &mapping_name, std::size_t size,
-                        bool use_large_pages = false) -> win32_shmem;
+                        bool use_large_pages = false, int numa_node = -1)
+    -> win32_shmem;
 
 auto create_win32_file_shmem(std::filesystem::path const &path,
                              std::string const &mapping_name, std::size_t size,
-                             bool force = false, bool use_large_pages = false)
-    -> win32_shmem;
+                             bool force = false, bool use_large_pages = false,
+                             int numa_node = -1) -> win32_shmem;
 
 } // namespace partake::daemon
 
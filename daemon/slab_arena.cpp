@@ -0,0 +1,181 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "slab_arena.hpp"
+
+#include "buddy_arena.hpp"
+
+#include <doctest.h>
+
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("slab_arena") {
+    using internal::slab_arena;
+    static constexpr auto spp = slab_arena<>::slots_per_slab;
+
+    CHECK(slab_arena<>(0).size() == 0);
+    CHECK(slab_arena<>(100).size() == 100);
+    CHECK_FALSE(slab_arena<>(0).allocate(1));
+
+    SUBCASE("small allocations are packed in a slab") {
+        slab_arena<internal::arena, 4> a(4 * spp);
+        auto a0 = a.allocate(2);
+        REQUIRE(a0);
+        CHECK(a0.count() == 2);
+        auto a1 = a.allocate(2);
+        REQUIRE(a1);
+        CHECK(a1.count() == 2);
+        CHECK(a1.start() == a0.start() + 2);
+        auto a2 = a.allocate(0);
+        REQUIRE(a2);
+        CHECK(a2.count() == 1);
+    }
+
+    SUBCASE("freed slot is reused") {
+        slab_arena<internal::arena, 4> a(4 * spp);
+        auto a0 = a.allocate(3);
+        auto a1 = a.allocate(3);
+        auto const start0 = a0.start();
+        { auto discard = std::move(a0); }
+        auto a2 = a.allocate(3);
+        CHECK(a2.start() == start0);
+    }
+
+    SUBCASE("full slab leads to new slab") {
+        slab_arena<internal::arena, 4> a(2 * spp);
+        std::vector<slab_arena<internal::arena, 4>::allocation> allocs;
+        for (std::size_t i = 0; i < spp + 1; ++i) {
+            allocs.push_back(a.allocate(1));
+            REQUIRE(allocs.back());
+        }
+        CHECK(allocs.back().start() == spp);
+    }
+
+    SUBCASE("aligned allocations pass through") {
+        slab_arena<internal::arena, 4> a(4 * spp + 16);
+        auto a0 = a.allocate(1);
+        REQUIRE(a0);
+        auto a1 = a.allocate(1, 16);
+        REQUIRE(a1);
+        CHECK(a1.start() % 16 == 0);
+        CHECK(a1.start() != a0.start() + 1);
+    }
+
+    SUBCASE("large allocations pass through") {
+        slab_arena<internal::arena, 4> a(100);
+        auto a0 = a.allocate(5);
+        REQUIRE(a0);
+        CHECK(a0.count() == 5);
+        CHECK(a0.start() == 0);
+    }
+
+    SUBCASE("small allocation falls back when slab does not fit") {
+        slab_arena<internal::arena, 4> a(10);
+        auto a0 = a.allocate(4);
+        REQUIRE(a0);
+        auto a1 = a.allocate(4);
+        REQUIRE(a1);
+        auto a2 = a.allocate(2);
+        REQUIRE(a2);
+        CHECK_FALSE(a.allocate(1));
+    }
+
+    SUBCASE("empty slab is released if another exists") {
+        slab_arena<internal::arena, 4> a(2 * spp);
+        std::vector<slab_arena<internal::arena, 4>::allocation> allocs;
+        for (std::size_t i = 0; i < spp + 1; ++i)
+            allocs.push_back(a.allocate(1));
+        // Free the whole first slab; it should be returned to the backing
+        // arena because the second slab still has free slots.
+        allocs.erase(allocs.begin(), std::next(allocs.begin(), spp));
+        auto big = a.allocate(spp);
+        REQUIRE(big);
+        CHECK(big.start() == 0);
+    }
+
+    SUBCASE("move assignment releases slot") {
+        slab_arena<internal::arena, 4> a(spp);
+        auto a0 = a.allocate(1);
+        auto const start0 = a0.start();
+        a0 = a.allocate(1);
+        CHECK(a0.start() != start0);
+        auto a1 = a.allocate(1);
+        CHECK(a1.start() == start0);
+    }
+}
+
+TEST_CASE("slab_arena: zero-fill tracking") {
+    using internal::slab_arena;
+    static constexpr auto spp = slab_arena<>::slots_per_slab;
+
+    SUBCASE("not initially zero-filled") {
+        slab_arena<internal::arena, 4> a(4 * spp);
+        CHECK_FALSE(a.allocate(1).is_zeroed());
+        CHECK_FALSE(a.allocate(100).is_zeroed());
+    }
+
+    SUBCASE("freed slot is dirty") {
+        slab_arena<internal::arena, 4> a(4 * spp, true);
+        auto a0 = a.allocate(1);
+        auto a1 = a.allocate(1);
+        REQUIRE(a1);
+        CHECK(a0.is_zeroed());
+        CHECK(a1.is_zeroed());
+        auto const start0 = a0.start();
+        { auto discard = std::move(a0); }
+        auto a2 = a.allocate(1);
+        CHECK(a2.start() == start0);
+        CHECK_FALSE(a2.is_zeroed());
+        CHECK(a.allocate(1).is_zeroed());
+    }
+
+    SUBCASE("large allocations pass through") {
+        slab_arena<internal::arena, 4> a(100, true);
+        CHECK(a.allocate(50).is_zeroed());
+    }
+}
+
+TEST_CASE("slab_arena: release_free_chunks") {
+    using internal::slab_arena;
+    slab_arena<internal::arena, 4> a(1000);
+    auto a0 = a.allocate(100);
+    REQUIRE(a0);
+    { auto discard = std::move(a0); }
+    std::size_t count = 0;
+    CHECK(a.release_free_chunks(1, [&](std::size_t start, std::size_t cnt) {
+        CHECK(start == 0);
+        count = cnt;
+        return true;
+    }) == 1000);
+    CHECK(count == 1000);
+}
+
+TEST_CASE("slab_arena: with basic_allocator") {
+    basic_allocator<internal::slab_arena<>> a(1 << 20, 12);
+    auto a0 = a.allocate(4096);
+    auto a1 = a.allocate(5000);
+    REQUIRE(a0);
+    REQUIRE(a1);
+    CHECK(a0.size() == 4096);
+    CHECK(a1.size() == 8192);
+    CHECK(a0.offset() != a1.offset());
+}
+
+TEST_CASE("slab_arena: size classes") {
+    using internal::slab_arena;
+    CHECK(slab_arena<>(1 << 10).size_classes().empty());
+    auto const classes =
+        slab_arena<internal::buddy_arena, 4>(64).size_classes();
+    CHECK(classes == std::vector<std::size_t>{1, 2, 3, 4, 8, 16, 32, 64});
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
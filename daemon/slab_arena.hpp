@@ -0,0 +1,264 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "allocator.hpp"
+#include "hive.hpp"
+
+#include <boost/intrusive/list.hpp>
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace internal {
+
+// A front end to an arena (the backing arena) that serves small allocations
+// from slabs. Each allocation whose block count is at most MaxSlabCount is
+// placed in a slot of a slab dedicated to that exact count (size class). A
+// slab is a single chunk allocated from the backing arena, holding
+// slots_per_slab slots; its free slots are tracked in a bitmap, so that
+// allocation and deallocation of small chunks is O(1) and does not touch the
+// backing arena's chunk lists (except when a slab is created or released).
+//
+// Larger allocations are passed through to the backing arena, as are small
+// allocations when a new slab cannot be allocated (so that a nearly full or
+// small arena can still be used to capacity).
+//
+// At most one completely free slab is retained per size class; others are
+// returned to the backing arena as soon as they become free.
+//
+// A slot is known to be zero-filled if its slab was zero-filled when
+// allocated and the slot has never been used.
+template <typename Arena = arena, std::size_t MaxSlabCount = 16>
+class slab_arena {
+    static_assert(MaxSlabCount > 0);
+
+  public:
+    static constexpr std::size_t slots_per_slab = 64;
+
+  private:
+    using bitmap_type = std::uint64_t;
+    static_assert(8 * sizeof(bitmap_type) == slots_per_slab);
+    static constexpr bitmap_type all_free = ~bitmap_type(0);
+
+    struct slab : boost::intrusive::list_base_hook<> {
+        typename Arena::allocation chunk;
+        std::size_t slot_count; // Blocks per slot
+        bitmap_type free_slots = all_free;
+        bitmap_type dirty_slots;
+
+        explicit slab(typename Arena::allocation &&chunk_allocation,
+                      std::size_t count)
+            : chunk(std::move(chunk_allocation)), slot_count(count),
+              dirty_slots(chunk.is_zeroed() ? 0 : all_free) {}
+
+        // No move or copy (used with intrusive data structures).
+        ~slab() = default;
+        slab(slab const &) = delete;
+        auto operator=(slab const &) = delete;
+        slab(slab &&) = delete;
+        auto operator=(slab &&) = delete;
+    };
+
+    using slab_list = boost::intrusive::list<slab>;
+
+    Arena backing;
+
+    // Slabs are owned by 'slab_storage'. Slabs with at least one free slot
+    // also participate in the list for their size class: partial_slabs[N - 1]
+    // holds slabs with slot count N.
+    hive<slab> slab_storage;
+    std::array<slab_list, MaxSlabCount> partial_slabs;
+
+  public:
+    explicit slab_arena(std::size_t size, bool zero_filled = false)
+        : backing(size, zero_filled) {}
+
+    // No move or copy (address taken by allocation instances)
+    ~slab_arena() = default;
+    slab_arena(slab_arena const &) = delete;
+    auto operator=(slab_arena const &) = delete;
+    slab_arena(slab_arena &&) = delete;
+    auto operator=(slab_arena &&) = delete;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return backing.size();
+    }
+
+    // Statistics are those of the backing arena, so free slots within slabs
+    // count as in use.
+    [[nodiscard]] auto free_count() const noexcept -> std::size_t {
+        return backing.free_count();
+    }
+
+    [[nodiscard]] auto free_chunk_count() const noexcept -> std::size_t {
+        return backing.free_chunk_count();
+    }
+
+    [[nodiscard]] auto largest_free_count() const noexcept -> std::size_t {
+        return backing.largest_free_count();
+    }
+
+    // Counts up to MaxSlabCount are exact (each has its own slabs); larger
+    // ones are rounded as by the backing arena. Empty if the backing arena
+    // does not round.
+    [[nodiscard]] auto size_classes() const -> std::vector<std::size_t> {
+        auto const backing_classes = backing.size_classes();
+        if (backing_classes.empty())
+            return {};
+        std::vector<std::size_t> ret;
+        for (std::size_t c = 1; c <= MaxSlabCount; ++c)
+            ret.push_back(c);
+        for (auto const c : backing_classes) {
+            if (c > MaxSlabCount)
+                ret.push_back(c);
+        }
+        return ret;
+    }
+
+    // RAII class for chunk allocation
+    class allocation {
+        // If slb is non-null, this is a slab slot allocation; otherwise
+        // 'direct' holds the (possibly empty) allocation from the backing
+        // arena.
+        slab_arena *arn = nullptr;
+        slab *slb = nullptr;
+        std::size_t slot = 0;
+        typename Arena::allocation direct;
+
+        friend class slab_arena;
+
+        explicit allocation(slab_arena *arena, slab *slab_ptr,
+                            std::size_t slot_index)
+            : arn(arena), slb(slab_ptr), slot(slot_index) {}
+
+        explicit allocation(typename Arena::allocation &&direct_allocation)
+            : direct(std::move(direct_allocation)) {}
+
+      public:
+        allocation() noexcept = default;
+
+        ~allocation() { release(); }
+
+        allocation(allocation const &) = delete;
+        auto operator=(allocation const &) = delete;
+
+        allocation(allocation &&other) noexcept
+            : arn(std::exchange(other.arn, nullptr)),
+              slb(std::exchange(other.slb, nullptr)),
+              slot(std::exchange(other.slot, 0)),
+              direct(std::move(other.direct)) {}
+
+        auto operator=(allocation &&rhs) noexcept -> allocation & {
+            release();
+            arn = std::exchange(rhs.arn, nullptr);
+            slb = std::exchange(rhs.slb, nullptr);
+            slot = std::exchange(rhs.slot, 0);
+            direct = std::move(rhs.direct);
+            return *this;
+        }
+
+        // True if allocation succeeded (even if count is zero).
+        operator bool() const noexcept {
+            return slb != nullptr || bool(direct);
+        }
+
+        [[nodiscard]] auto start() const noexcept -> std::size_t {
+            if (slb != nullptr)
+                return slb->chunk.start() + slot * slb->slot_count;
+            return direct.start();
+        }
+
+        [[nodiscard]] auto count() const noexcept -> std::size_t {
+            if (slb != nullptr)
+                return slb->slot_count;
+            return direct.count();
+        }
+
+        // True if the chunk was known to be zero-filled when allocated.
+        [[nodiscard]] auto is_zeroed() const noexcept -> bool {
+            if (slb != nullptr)
+                return (slb->dirty_slots & (bitmap_type(1) << slot)) == 0;
+            return direct.is_zeroed();
+        }
+
+      private:
+        void release() noexcept {
+            if (slb != nullptr)
+                arn->deallocate(slb, slot);
+            arn = nullptr;
+            slb = nullptr;
+        }
+    };
+
+    // Slots are not aligned beyond their size, so allocations with
+    // 'alignment' (a power of 2, in blocks) greater than 1 bypass the slabs.
+    [[nodiscard]] auto allocate(std::size_t count, std::size_t alignment = 1)
+        -> allocation {
+        // Zero-block chunks are treated as count 1, as with arena.
+        if (count == 0)
+            count = 1;
+        if (alignment > 1)
+            return allocation(backing.allocate(count, alignment));
+        if (count > MaxSlabCount)
+            return allocation(backing.allocate(count));
+
+        auto &partial = partial_slabs[count - 1];
+        if (partial.empty()) {
+            auto chunk = backing.allocate(count * slots_per_slab);
+            if (not chunk)
+                return allocation(backing.allocate(count));
+            auto slb = slab_storage.emplace(std::move(chunk), count);
+            partial.push_back(*slb);
+        }
+
+        auto &slb = partial.front();
+        auto const slot =
+            static_cast<std::size_t>(countr_zero(slb.free_slots));
+        slb.free_slots &= ~(bitmap_type(1) << slot);
+        if (slb.free_slots == 0)
+            partial.erase(partial.iterator_to(slb));
+        return allocation(this, &slb, slot);
+    }
+
+    // Release free chunks of the backing arena (see
+    // arena::release_free_chunks()). Free slots within slabs, and slabs
+    // retained while empty, are not released.
+    template <typename F>
+    auto release_free_chunks(std::size_t min_count, F &&release)
+        -> std::size_t {
+        return backing.release_free_chunks(min_count,
+                                           std::forward<F>(release));
+    }
+
+  private:
+    void deallocate(slab *slb, std::size_t slot) noexcept {
+        auto const bit = bitmap_type(1) << slot;
+        assert((slb->free_slots & bit) == 0);
+        auto &partial = partial_slabs[slb->slot_count - 1];
+
+        if (slb->free_slots == 0) // Was full
+            partial.push_front(*slb);
+        slb->free_slots |= bit;
+        slb->dirty_slots |= bit;
+
+        if (slb->free_slots == all_free && partial.size() > 1) {
+            partial.erase(partial.iterator_to(*slb));
+            slab_storage.erase(slab_storage.get_iterator(slb));
+        }
+    }
+};
+
+} // namespace internal
+
+} // namespace partake::daemon
@@ -0,0 +1,80 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "small_function.hpp"
+
+#include <doctest.h>
+
+#include <array>
+#include <memory>
+#include <utility>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("small_function") {
+    SUBCASE("empty") {
+        small_function<void()> f;
+        CHECK_FALSE(f);
+        auto g = std::move(f);
+        CHECK_FALSE(g);
+    }
+
+    SUBCASE("stored in place") {
+        int x = 0;
+        auto const add = [&x](int i) { x += i; };
+        static_assert(
+            small_function<void(int)>::is_stored_in_place<decltype(add)>);
+        small_function<void(int)> f(add);
+        REQUIRE(f);
+        f(3);
+        CHECK(x == 3);
+        auto g = std::move(f);
+        CHECK_FALSE(f); // NOLINT(bugprone-use-after-move)
+        g(4);
+        CHECK(x == 7);
+    }
+
+    SUBCASE("stored on heap") {
+        std::array<int, 32> big{};
+        big[31] = 5;
+        auto const get = [big](int i) { return big[31] + i; };
+        static_assert(
+            not small_function<int(int)>::is_stored_in_place<decltype(get)>);
+        small_function<int(int)> f(get);
+        CHECK(f(1) == 6);
+        small_function<int(int)> g;
+        g = std::move(f);
+        CHECK(g(2) == 7);
+    }
+
+    SUBCASE("captures are destroyed") {
+        auto p = std::make_shared<int>(42);
+        {
+            small_function<int()> f([p] { return *p; });
+            CHECK(p.use_count() == 2);
+            auto g = std::move(f);
+            CHECK(p.use_count() == 2);
+            CHECK(g() == 42);
+            g.reset();
+            CHECK(p.use_count() == 1);
+            g = [p] { return *p + 1; };
+            CHECK(p.use_count() == 2);
+        }
+        CHECK(p.use_count() == 1);
+    }
+
+    SUBCASE("move-only arguments") {
+        small_function<int(std::unique_ptr<int>)> f(
+            [](std::unique_ptr<int> p) { return *p; });
+        CHECK(f(std::make_unique<int>(8)) == 8);
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,124 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace partake::daemon {
+
+template <typename Signature, std::size_t Capacity = 48>
+class small_function;
+
+// A move-only alternative to std::function that stores callables of up to
+// 'Capacity' bytes in place, so that wrapping a lambda with a few captures
+// does not allocate. Larger callables (or ones that are not nothrow-movable)
+// are allocated on the heap, as with std::function.
+template <typename R, typename... Args, std::size_t Capacity>
+class small_function<R(Args...), Capacity> {
+    struct operations {
+        R (*invoke)(void *, Args &&...);
+        void (*move)(void *dest, void *src) noexcept; // Destroys src
+        void (*destroy)(void *) noexcept;
+    };
+
+    template <typename F> struct in_place {
+        static auto get(void *s) noexcept -> F * {
+            return std::launder(static_cast<F *>(s));
+        }
+        static auto invoke(void *s, Args &&...args) -> R {
+            return (*get(s))(std::forward<Args>(args)...);
+        }
+        static void move(void *dest, void *src) noexcept {
+            ::new (dest) F(std::move(*get(src)));
+            get(src)->~F();
+        }
+        static void destroy(void *s) noexcept { get(s)->~F(); }
+        static constexpr operations ops{&invoke, &move, &destroy};
+    };
+
+    template <typename F> struct on_heap {
+        static auto get(void *s) noexcept -> F *& {
+            return *std::launder(static_cast<F **>(s));
+        }
+        static auto invoke(void *s, Args &&...args) -> R {
+            return (*get(s))(std::forward<Args>(args)...);
+        }
+        static void move(void *dest, void *src) noexcept {
+            ::new (dest) F *(std::exchange(get(src), nullptr));
+        }
+        static void destroy(void *s) noexcept { delete get(s); }
+        static constexpr operations ops{&invoke, &move, &destroy};
+    };
+
+    std::aligned_storage_t<Capacity, alignof(std::max_align_t)> storage;
+    operations const *ops = nullptr;
+
+  public:
+    template <typename F>
+    static constexpr bool is_stored_in_place =
+        sizeof(F) <= Capacity && alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible_v<F>;
+
+    small_function() noexcept = default;
+
+    template <typename F,
+              typename = std::enable_if_t<
+                  not std::is_same_v<std::decay_t<F>, small_function> &&
+                  std::is_invocable_r_v<R, std::decay_t<F> &, Args...>>>
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    small_function(F &&f) {
+        using fn = std::decay_t<F>;
+        static_assert(sizeof(fn *) <= Capacity);
+        if constexpr (is_stored_in_place<fn>) {
+            ::new (static_cast<void *>(&storage)) fn(std::forward<F>(f));
+            ops = &in_place<fn>::ops;
+        } else {
+            ::new (static_cast<void *>(&storage))
+                fn *(new fn(std::forward<F>(f)));
+            ops = &on_heap<fn>::ops;
+        }
+    }
+
+    ~small_function() { reset(); }
+
+    small_function(small_function const &) = delete;
+    auto operator=(small_function const &) = delete;
+
+    small_function(small_function &&other) noexcept
+        : ops(std::exchange(other.ops, nullptr)) {
+        if (ops != nullptr)
+            ops->move(&storage, &other.storage);
+    }
+
+    auto operator=(small_function &&rhs) noexcept -> small_function & {
+        if (&rhs != this) {
+            reset();
+            ops = std::exchange(rhs.ops, nullptr);
+            if (ops != nullptr)
+                ops->move(&storage, &rhs.storage);
+        }
+        return *this;
+    }
+
+    void reset() noexcept {
+        if (ops != nullptr)
+            std::exchange(ops, nullptr)->destroy(&storage);
+    }
+
+    explicit operator bool() const noexcept { return ops != nullptr; }
+
+    auto operator()(Args... args) -> R {
+        assert(ops != nullptr);
+        return ops->invoke(&storage, std::forward<Args>(args)...);
+    }
+};
+
+} // namespace partake::daemon
@@ -0,0 +1,183 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "snapshot.hpp"
+
+#include "testing.hpp"
+
+#include <doctest.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <type_traits>
+
+namespace partake::daemon {
+
+namespace {
+
+// The file consists of the magic, the header fields, the object count, and
+// the objects, all little-endian and unpadded. (Version 2: the key sequence
+// state includes the epoch; see key_sequence.)
+constexpr std::array<std::uint8_t, 8> snapshot_magic{'P', 'T', 'K', 'S',
+                                                     'N', 'A', 'P', '2'};
+constexpr std::size_t header_size = snapshot_magic.size() + 8 + 8 + 4 + 8;
+constexpr std::size_t object_size = 8 + 4 + 8 + 8;
+
+template <typename T> void put(std::vector<std::uint8_t> &buf, T value) {
+    static_assert(std::is_unsigned_v<T>);
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        buf.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+}
+
+// The caller must ensure that the buffer is long enough.
+template <typename T>
+auto get(std::vector<std::uint8_t> const &buf, std::size_t &pos) -> T {
+    static_assert(std::is_unsigned_v<T>);
+    T value = 0;
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        value |= static_cast<T>(T(buf[pos + i]) << (8 * i));
+    pos += sizeof(T);
+    return value;
+}
+
+} // namespace
+
+auto write_snapshot(std::filesystem::path const &path,
+                    repository_snapshot const &snapshot) -> bool {
+    std::vector<std::uint8_t> buf;
+    buf.reserve(header_size + object_size * snapshot.objects.size());
+    buf.insert(buf.end(), snapshot_magic.begin(), snapshot_magic.end());
+    put(buf, snapshot.key_sequence_state);
+    put(buf, snapshot.segment_size);
+    put(buf, snapshot.log2_granularity);
+    put(buf, std::uint64_t(snapshot.objects.size()));
+    for (auto const &obj : snapshot.objects) {
+        put(buf, obj.key);
+        put(buf, obj.segment_id);
+        put(buf, obj.offset);
+        put(buf, obj.size);
+    }
+
+    auto tmp_path = path;
+    tmp_path += ".tmp";
+    std::error_code ec;
+    {
+        std::ofstream s(tmp_path, std::ios::binary | std::ios::trunc);
+        // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+        s.write(reinterpret_cast<char const *>(buf.data()),
+                static_cast<std::streamsize>(buf.size()));
+        s.close();
+        if (not s) {
+            spdlog::error("{}: cannot write snapshot", tmp_path.string());
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+    }
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        spdlog::error("{}: cannot rename snapshot: {} ({})", path.string(),
+                      ec.message(), ec.value());
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+auto read_snapshot(std::filesystem::path const &path)
+    -> std::optional<repository_snapshot> {
+    std::ifstream s(path, std::ios::binary);
+    if (not s) {
+        spdlog::error("{}: cannot open snapshot", path.string());
+        return std::nullopt;
+    }
+    std::vector<std::uint8_t> const buf((std::istreambuf_iterator<char>(s)),
+                                        std::istreambuf_iterator<char>());
+    if (buf.size() < header_size ||
+        not std::equal(snapshot_magic.begin(), snapshot_magic.end(),
+                       buf.begin())) {
+        spdlog::error("{}: not a snapshot", path.string());
+        return std::nullopt;
+    }
+
+    repository_snapshot ret;
+    std::size_t pos = snapshot_magic.size();
+    ret.key_sequence_state = get<std::uint64_t>(buf, pos);
+    ret.segment_size = get<std::uint64_t>(buf, pos);
+    ret.log2_granularity = get<std::uint32_t>(buf, pos);
+    auto const count = get<std::uint64_t>(buf, pos);
+    auto const body_size = buf.size() - header_size;
+    if (body_size % object_size != 0 || body_size / object_size != count) {
+        spdlog::error("{}: snapshot is truncated or corrupt", path.string());
+        return std::nullopt;
+    }
+    ret.objects.reserve(static_cast<std::size_t>(count));
+    for (std::uint64_t i = 0; i < count; ++i) {
+        snapshot_object obj;
+        obj.key = get<std::uint64_t>(buf, pos);
+        obj.segment_id = get<std::uint32_t>(buf, pos);
+        obj.offset = get<std::uint64_t>(buf, pos);
+        obj.size = get<std::uint64_t>(buf, pos);
+        ret.objects.push_back(obj);
+    }
+    return ret;
+}
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("snapshot") {
+    testing::tempdir const td;
+    auto const path = testing::unique_path(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__));
+
+    CHECK_FALSE(read_snapshot(path).has_value());
+
+    repository_snapshot snap;
+    snap.key_sequence_state = 0x1234'5678'9abc'def0uLL;
+    snap.segment_size = 1 << 20;
+    snap.log2_granularity = 12;
+    snap.objects.push_back({1, 0, 0, 4096});
+    snap.objects.push_back({0xffff'ffff'ffff'fffeuLL, 3, 8192, 12288});
+    REQUIRE(write_snapshot(path, snap));
+    CHECK_FALSE(std::filesystem::exists(path.string() + ".tmp"));
+
+    SUBCASE("round trip") {
+        auto const read = read_snapshot(path);
+        REQUIRE(read.has_value());
+        CHECK(read->key_sequence_state == snap.key_sequence_state);
+        CHECK(read->segment_size == snap.segment_size);
+        CHECK(read->log2_granularity == 12);
+        REQUIRE(read->objects.size() == 2);
+        CHECK(read->objects[1].key == snap.objects[1].key);
+        CHECK(read->objects[1].segment_id == 3);
+        CHECK(read->objects[1].offset == 8192);
+        CHECK(read->objects[1].size == 12288);
+    }
+
+    SUBCASE("truncated") {
+        std::filesystem::resize_file(path,
+                                     std::filesystem::file_size(path) - 1);
+        CHECK_FALSE(read_snapshot(path).has_value());
+    }
+
+    SUBCASE("overwritten") {
+        snap.objects.clear();
+        REQUIRE(write_snapshot(path, snap));
+        auto const read = read_snapshot(path);
+        REQUIRE(read.has_value());
+        CHECK(read->objects.empty());
+    }
+
+    std::filesystem::remove(path);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
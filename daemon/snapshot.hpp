@@ -0,0 +1,45 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+namespace partake::daemon {
+
+// The shared objects of a repository, saved upon shutdown so that a daemon
+// restarted on the same (persistent) segments can re-adopt them with their
+// keys and data instead of starting empty.
+
+struct snapshot_object {
+    std::uint64_t key = 0;
+    std::uint32_t segment_id = 0;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+};
+
+struct repository_snapshot {
+    std::uint64_t key_sequence_state = 0; // See key_sequence::state()
+    std::uint64_t segment_size = 0;
+    std::uint32_t log2_granularity = 0;
+    std::vector<snapshot_object> objects;
+};
+
+// Write the snapshot to 'path' (via a temporary file that is then renamed,
+// so that an incomplete snapshot is never left at 'path'). Log and return
+// false on failure.
+auto write_snapshot(std::filesystem::path const &path,
+                    repository_snapshot const &snapshot) -> bool;
+
+// Log and return nullopt if the file cannot be read or is not a valid
+// snapshot.
+auto read_snapshot(std::filesystem::path const &path)
+    -> std::optional<repository_snapshot>;
+
+} // namespace partake::daemon
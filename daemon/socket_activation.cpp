@@ -0,0 +1,109 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "socket_activation.hpp"
+
+#include <doctest.h>
+#include <spdlog/spdlog.h>
+
+#include <cstdlib>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace partake::daemon {
+
+#ifdef _WIN32
+
+auto socket_activation_fd() -> int {
+    spdlog::error("socket activation is not supported on Windows");
+    return -1;
+}
+
+#else
+
+namespace {
+
+constexpr int listen_fds_start = 3; // SD_LISTEN_FDS_START
+
+// Return the value of the environment variable as a non-negative integer, or
+// -1 if it is not set or not such an integer.
+auto getenv_int(char const *name) -> long {
+    char const *value = std::getenv(name); // NOLINT(concurrency-mt-unsafe)
+    if (value == nullptr || *value == '\0')
+        return -1;
+    char *end = nullptr;
+    // NOLINTNEXTLINE(readability-magic-numbers)
+    long const n = std::strtol(value, &end, 10);
+    if (*end != '\0' || n < 0)
+        return -1;
+    return n;
+}
+
+} // namespace
+
+auto socket_activation_fd() -> int {
+    auto const pid = getenv_int("LISTEN_PID");
+    auto const count = getenv_int("LISTEN_FDS");
+
+    // NOLINTBEGIN(concurrency-mt-unsafe)
+    ::unsetenv("LISTEN_PID");
+    ::unsetenv("LISTEN_FDS");
+    ::unsetenv("LISTEN_FDNAMES");
+    // NOLINTEND(concurrency-mt-unsafe)
+
+    if (pid != static_cast<long>(::getpid()) || count <= 0) {
+        spdlog::error("no socket was passed by socket activation");
+        return -1;
+    }
+    if (count > 1) {
+        spdlog::error("{} sockets were passed by socket activation; only one "
+                      "is supported",
+                      count);
+        return -1;
+    }
+    int const fd = listen_fds_start;
+    // Not inherited by processes we might start.
+    int const flags = ::fcntl(fd, F_GETFD);
+    if (flags < 0 || ::fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0) {
+        spdlog::error("socket passed by socket activation is not valid");
+        return -1;
+    }
+    spdlog::info("using socket passed by socket activation");
+    return fd;
+}
+
+// NOLINTBEGIN(concurrency-mt-unsafe)
+
+TEST_CASE("socket_activation_fd: not activated") {
+    ::unsetenv("LISTEN_PID");
+    ::unsetenv("LISTEN_FDS");
+    CHECK(socket_activation_fd() == -1);
+
+    ::setenv("LISTEN_PID", "1", 1); // Another process
+    ::setenv("LISTEN_FDS", "1", 1);
+    CHECK(socket_activation_fd() == -1);
+    CHECK(std::getenv("LISTEN_PID") == nullptr);
+    CHECK(std::getenv("LISTEN_FDS") == nullptr);
+
+    auto const self = std::to_string(::getpid());
+    ::setenv("LISTEN_PID", self.c_str(), 1);
+    ::setenv("LISTEN_FDS", "2", 1);
+    CHECK(socket_activation_fd() == -1);
+
+    ::setenv("LISTEN_PID", self.c_str(), 1);
+    ::setenv("LISTEN_FDS", "x", 1);
+    CHECK(socket_activation_fd() == -1);
+}
+
+// NOLINTEND(concurrency-mt-unsafe)
+
+#endif
+
+} // namespace partake::daemon
@@ -0,0 +1,18 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+namespace partake::daemon {
+
+// Return the listening socket passed by the service manager (systemd socket
+// activation; see sd_listen_fds(3)), or -1 (and log an error) if none was
+// passed to this process. Exactly one socket is expected. The environment
+// variables describing the passed sockets are unset, so that they are not
+// inherited by child processes. Always returns -1 on Windows.
+auto socket_activation_fd() -> int;
+
+} // namespace partake::daemon
@@ -0,0 +1,272 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "state_export.hpp"
+
+#include "testing.hpp"
+
+#include <doctest.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
+#include <system_error>
+#include <type_traits>
+
+namespace partake::daemon {
+
+namespace {
+
+// The file consists of the magic, the header, and tagged records: objects
+// and chunks in any order, followed by a trailer giving their counts (so
+// that a truncated file is detected). All little-endian and unpadded.
+constexpr std::array<std::uint8_t, 8> export_magic{'P', 'T', 'K', 'X',
+                                                   'P', 'R', 'T', '1'};
+constexpr std::size_t header_size = export_magic.size() + 4;
+constexpr std::uint8_t object_tag = 'O';
+constexpr std::uint8_t chunk_tag = 'C';
+constexpr std::uint8_t trailer_tag = 'E';
+constexpr std::size_t object_size = 1 + 8 + 4 + 8 + 8 + 4 + 4 + 1;
+constexpr std::size_t chunk_size = 1 + 4 + 8 + 8 + 1;
+constexpr std::size_t trailer_size = 1 + 8 + 8;
+
+// Buffered records are written out once they reach this size.
+constexpr std::size_t flush_threshold = 1 << 16;
+
+template <typename T> void put(std::vector<std::uint8_t> &buf, T value) {
+    static_assert(std::is_unsigned_v<T>);
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        buf.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+}
+
+// The caller must ensure that the buffer is long enough.
+template <typename T>
+auto get(std::vector<std::uint8_t> const &buf, std::size_t &pos) -> T {
+    static_assert(std::is_unsigned_v<T>);
+    T value = 0;
+    for (std::size_t i = 0; i < sizeof(T); ++i)
+        value |= static_cast<T>(T(buf[pos + i]) << (8 * i));
+    pos += sizeof(T);
+    return value;
+}
+
+} // namespace
+
+state_export_writer::state_export_writer(std::filesystem::path const &path,
+                                         std::uint32_t log2_granularity)
+    : path(path), tmp_path(path) {
+    tmp_path += ".tmp";
+    stream.open(tmp_path, std::ios::binary | std::ios::trunc);
+    if (not stream) {
+        spdlog::error("{}: cannot create state export", tmp_path.string());
+        return;
+    }
+    buf.insert(buf.end(), export_magic.begin(), export_magic.end());
+    put(buf, log2_granularity);
+}
+
+state_export_writer::~state_export_writer() {
+    if (finished)
+        return;
+    std::error_code ec;
+    if (stream.is_open()) {
+        stream.close();
+        std::filesystem::remove(tmp_path, ec);
+    }
+}
+
+void state_export_writer::add(exported_object const &obj) {
+    buf.push_back(object_tag);
+    put(buf, obj.key);
+    put(buf, obj.segment_id);
+    put(buf, obj.offset);
+    put(buf, obj.size);
+    put(buf, obj.open_count);
+    put(buf, obj.voucher_count);
+    put(buf, obj.flags);
+    ++n_objects;
+    if (buf.size() >= flush_threshold)
+        (void)flush();
+}
+
+void state_export_writer::add(exported_chunk const &chk) {
+    buf.push_back(chunk_tag);
+    put(buf, chk.segment_id);
+    put(buf, chk.offset);
+    put(buf, chk.size);
+    put(buf, std::uint8_t(chk.in_use));
+    ++n_chunks;
+    if (buf.size() >= flush_threshold)
+        (void)flush();
+}
+
+auto state_export_writer::flush() -> bool {
+    if (not is_valid()) {
+        buf.clear(); // Already failed (and logged)
+        return false;
+    }
+    // NOLINTNEXTLINE(cppcoreguidelines-pro-type-reinterpret-cast)
+    stream.write(reinterpret_cast<char const *>(buf.data()),
+                 static_cast<std::streamsize>(buf.size()));
+    buf.clear();
+    if (not stream) {
+        spdlog::error("{}: cannot write state export", tmp_path.string());
+        return false;
+    }
+    return true;
+}
+
+auto state_export_writer::finish() -> bool {
+    buf.push_back(trailer_tag);
+    put(buf, n_objects);
+    put(buf, n_chunks);
+    if (not flush())
+        return false;
+    stream.close();
+    std::error_code ec;
+    if (not stream) {
+        spdlog::error("{}: cannot write state export", tmp_path.string());
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    finished = true;
+    std::filesystem::rename(tmp_path, path, ec);
+    if (ec) {
+        spdlog::error("{}: cannot rename state export: {} ({})",
+                      path.string(), ec.message(), ec.value());
+        std::filesystem::remove(tmp_path, ec);
+        return false;
+    }
+    return true;
+}
+
+auto read_state_export(std::filesystem::path const &path)
+    -> std::optional<state_export> {
+    std::ifstream s(path, std::ios::binary);
+    if (not s) {
+        spdlog::error("{}: cannot open state export", path.string());
+        return std::nullopt;
+    }
+    std::vector<std::uint8_t> const buf((std::istreambuf_iterator<char>(s)),
+                                        std::istreambuf_iterator<char>());
+    if (buf.size() < header_size ||
+        not std::equal(export_magic.begin(), export_magic.end(),
+                       buf.begin())) {
+        spdlog::error("{}: not a state export", path.string());
+        return std::nullopt;
+    }
+
+    state_export ret;
+    std::size_t pos = export_magic.size();
+    ret.log2_granularity = get<std::uint32_t>(buf, pos);
+    for (;;) {
+        auto const left = buf.size() - pos;
+        auto const tag = left > 0 ? buf[pos] : std::uint8_t(0);
+        if (tag == object_tag && left >= object_size) {
+            ++pos;
+            exported_object obj;
+            obj.key = get<std::uint64_t>(buf, pos);
+            obj.segment_id = get<std::uint32_t>(buf, pos);
+            obj.offset = get<std::uint64_t>(buf, pos);
+            obj.size = get<std::uint64_t>(buf, pos);
+            obj.open_count = get<std::uint32_t>(buf, pos);
+            obj.voucher_count = get<std::uint32_t>(buf, pos);
+            obj.flags = get<std::uint8_t>(buf, pos);
+            ret.objects.push_back(obj);
+        } else if (tag == chunk_tag && left >= chunk_size) {
+            ++pos;
+            exported_chunk chk;
+            chk.segment_id = get<std::uint32_t>(buf, pos);
+            chk.offset = get<std::uint64_t>(buf, pos);
+            chk.size = get<std::uint64_t>(buf, pos);
+            chk.in_use = get<std::uint8_t>(buf, pos) != 0;
+            ret.chunks.push_back(chk);
+        } else if (tag == trailer_tag && left == trailer_size) {
+            ++pos;
+            auto const n_objects = get<std::uint64_t>(buf, pos);
+            auto const n_chunks = get<std::uint64_t>(buf, pos);
+            if (n_objects == ret.objects.size() &&
+                n_chunks == ret.chunks.size())
+                return ret;
+            break;
+        } else {
+            break;
+        }
+    }
+    spdlog::error("{}: state export is truncated or corrupt", path.string());
+    return std::nullopt;
+}
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("state export") {
+    testing::tempdir const td;
+    auto const path = testing::unique_path(
+        td.path(), testing::make_test_filename(__FILE__, __LINE__));
+
+    CHECK_FALSE(read_state_export(path).has_value());
+
+    SUBCASE("round trip") {
+        {
+            state_export_writer w(path, 12);
+            REQUIRE(w.is_valid());
+            w.add(exported_object{0xffff'ffff'ffff'fffeuLL, 3, 8192, 12288,
+                                  2, 1, exported_object_flags::shared});
+            REQUIRE(w.flush());
+            w.add(exported_chunk{0, 0, 4096, true});
+            w.add(exported_chunk{0, 4096, 1 << 20, false});
+            w.add(exported_object{1, 0, 0, 4096, 0, 0,
+                                  exported_object_flags::primitive});
+            CHECK(w.object_count() == 2);
+            CHECK(w.chunk_count() == 2);
+            CHECK_FALSE(std::filesystem::exists(path));
+            REQUIRE(w.finish());
+        }
+        CHECK_FALSE(std::filesystem::exists(path.string() + ".tmp"));
+        auto const read = read_state_export(path);
+        REQUIRE(read.has_value());
+        CHECK(read->log2_granularity == 12);
+        REQUIRE(read->objects.size() == 2);
+        CHECK(read->objects[0].key == 0xffff'ffff'ffff'fffeuLL);
+        CHECK(read->objects[0].segment_id == 3);
+        CHECK(read->objects[0].offset == 8192);
+        CHECK(read->objects[0].size == 12288);
+        CHECK(read->objects[0].open_count == 2);
+        CHECK(read->objects[0].voucher_count == 1);
+        CHECK(read->objects[0].flags == exported_object_flags::shared);
+        CHECK(read->objects[1].key == 1);
+        REQUIRE(read->chunks.size() == 2);
+        CHECK(read->chunks[0].in_use);
+        CHECK(read->chunks[1].offset == 4096);
+        CHECK(read->chunks[1].size == 1 << 20);
+        CHECK_FALSE(read->chunks[1].in_use);
+
+        std::filesystem::resize_file(path,
+                                     std::filesystem::file_size(path) - 1);
+        CHECK_FALSE(read_state_export(path).has_value());
+    }
+
+    SUBCASE("unfinished") {
+        {
+            state_export_writer w(path, 12);
+            REQUIRE(w.is_valid());
+            w.add(exported_chunk{0, 0, 4096, true});
+            REQUIRE(w.flush());
+            CHECK(std::filesystem::exists(path.string() + ".tmp"));
+        }
+        CHECK_FALSE(std::filesystem::exists(path.string() + ".tmp"));
+        CHECK_FALSE(std::filesystem::exists(path));
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(path, ec);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
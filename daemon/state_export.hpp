@@ -0,0 +1,109 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <vector>
+
+namespace partake::daemon {
+
+// A dump of the repository's objects and the allocators' chunk maps, for
+// offline analysis of capacity and fragmentation. It is taken while the
+// daemon keeps serving requests, a slice at a time, so it is not a
+// consistent snapshot: objects created or destroyed while it is written may
+// or may not be included, and the chunk map (written after the objects)
+// may not match the objects exactly.
+
+namespace exported_object_flags {
+constexpr std::uint8_t primitive = 1; // Otherwise DEFAULT policy
+constexpr std::uint8_t shared = 2;
+constexpr std::uint8_t cold = 4; // In cold storage (size 0)
+constexpr std::uint8_t multi_extent = 8; // Only the first extent is given
+constexpr std::uint8_t pooled = 16;
+} // namespace exported_object_flags
+
+struct exported_object {
+    std::uint64_t key = 0;
+    std::uint32_t segment_id = 0;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+    std::uint32_t open_count = 0; // Sessions that have it open
+    std::uint32_t voucher_count = 0;
+    std::uint8_t flags = 0; // See exported_object_flags
+};
+
+struct exported_chunk {
+    std::uint32_t segment_id = 0;
+    std::uint64_t offset = 0;
+    std::uint64_t size = 0;
+    bool in_use = false;
+};
+
+struct state_export {
+    std::uint32_t log2_granularity = 0;
+    std::vector<exported_object> objects;
+    std::vector<exported_chunk> chunks;
+};
+
+// Writes a state export to a temporary file that is renamed to 'path' by
+// finish(), so that an incomplete export is never left at 'path'. Records
+// are buffered and written out by flush(), which the caller may call after
+// each slice. If destroyed before finish() succeeds, the temporary file is
+// removed.
+class state_export_writer {
+    std::filesystem::path path;
+    std::filesystem::path tmp_path;
+    std::ofstream stream;
+    std::vector<std::uint8_t> buf;
+    std::uint64_t n_objects = 0;
+    std::uint64_t n_chunks = 0;
+    bool finished = false;
+
+  public:
+    // Check is_valid() afterwards.
+    explicit state_export_writer(std::filesystem::path const &path,
+                                 std::uint32_t log2_granularity);
+
+    ~state_export_writer();
+    state_export_writer(state_export_writer const &) = delete;
+    auto operator=(state_export_writer const &) = delete;
+    state_export_writer(state_export_writer &&) = delete;
+    auto operator=(state_export_writer &&) = delete;
+
+    [[nodiscard]] auto is_valid() const noexcept -> bool {
+        return stream.is_open() && not stream.fail();
+    }
+
+    [[nodiscard]] auto object_count() const noexcept -> std::uint64_t {
+        return n_objects;
+    }
+
+    [[nodiscard]] auto chunk_count() const noexcept -> std::uint64_t {
+        return n_chunks;
+    }
+
+    void add(exported_object const &obj);
+
+    void add(exported_chunk const &chk);
+
+    // Log and return false on failure.
+    auto flush() -> bool;
+
+    // Write the trailer and move the file to 'path'. Log and return false
+    // on failure.
+    auto finish() -> bool;
+};
+
+// Log and return nullopt if the file cannot be read or is not a valid (and
+// complete) state export.
+auto read_state_export(std::filesystem::path const &path)
+    -> std::optional<state_export>;
+
+} // namespace partake::daemon
@@ -0,0 +1,85 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "stats.hpp"
+
+#include <doctest.h>
+
+#include <chrono>
+#include <cstddef>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("latency_histogram: bins") {
+    using h = latency_histogram;
+    CHECK(h::bin_index(0) == 0);
+    CHECK(h::bin_index(7) == 7);
+    CHECK(h::bin_index(8) == 8);
+    CHECK(h::bin_index(15) == 15);
+    CHECK(h::bin_index(16) == 16);
+    CHECK(h::bin_index(17) == 16);
+    CHECK(h::bin_index(18) == 17);
+    CHECK(h::bin_index(std::size_t(-1)) == h::bin_count - 1);
+
+    CHECK(h::bin_upper_bound(7) == 7);
+    CHECK(h::bin_upper_bound(15) == 15);
+    CHECK(h::bin_upper_bound(16) == 17);
+    CHECK(h::bin_upper_bound(h::bin_count - 1) == std::size_t(-1));
+    for (std::size_t i = 1; i < h::bin_count; ++i) {
+        CAPTURE(i);
+        CHECK(h::bin_index(h::bin_upper_bound(i)) == i);
+        CHECK(h::bin_index(h::bin_upper_bound(i - 1) + 1) == i);
+    }
+}
+
+TEST_CASE("latency_histogram: quantiles") {
+    using namespace std::chrono_literals;
+    latency_histogram h;
+    CHECK(h.count() == 0);
+    CHECK(h.quantile(0.5) == 0ns);
+
+    for (int i = 0; i < 99; ++i)
+        h.record(1000ns);
+    h.record(1ms);
+    CHECK(h.count() == 100);
+    CHECK(h.max() == 1ms);
+    CHECK(h.quantile(0.0) >= 1000ns);
+    CHECK(h.quantile(0.5) >= 1000ns);
+    CHECK(h.quantile(0.5) < 1125ns);
+    CHECK(h.quantile(0.99) < 1125ns);
+    CHECK(h.quantile(0.999) == 1ms); // Clamped to max
+    CHECK(h.quantile(1.0) == 1ms);
+
+    h.record(-5ns); // Treated as zero
+    CHECK(h.quantile(0.0) == 0ns);
+}
+
+TEST_CASE("request_stats") {
+    using namespace std::chrono_literals;
+    request_stats s;
+    s.record(protocol::AnyRequest::PingRequest, 100ns);
+    s.record(protocol::AnyRequest::PingRequest, 200ns);
+    s.record(protocol::AnyRequest::AllocRequest, 300ns);
+    CHECK(s.latency(protocol::AnyRequest::PingRequest).count() == 2);
+    CHECK(s.latency(protocol::AnyRequest::AllocRequest).count() == 1);
+    CHECK(s.latency(protocol::AnyRequest::OpenRequest).count() == 0);
+}
+
+TEST_CASE("daemon_stats: gauges") {
+    CHECK(daemon_stats().gauges().object_count == 0);
+    auto s = daemon_stats([] {
+        daemon_gauges g;
+        g.object_count = 3;
+        return g;
+    });
+    CHECK(s.gauges().object_count == 3);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
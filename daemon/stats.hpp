@@ -0,0 +1,163 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "allocator.hpp"
+#include "partake_protocol_generated.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+namespace partake::daemon {
+
+// Histogram of durations (in nanoseconds) with log-linear bins, in the manner
+// of HDR histograms: durations below 8 ns have exact bins, and each further
+// power of 2 is divided into 8 bins, so that the relative error of reported
+// values is at most 12.5%. Recording is a few instructions and never
+// allocates.
+class latency_histogram {
+    static constexpr std::size_t log2_sub_bins = 3;
+    static constexpr std::size_t sub_bins = std::size_t(1) << log2_sub_bins;
+    static constexpr std::size_t value_bits = 8 * sizeof(std::size_t);
+
+  public:
+    static constexpr std::size_t bin_count =
+        (value_bits - log2_sub_bins + 1) * sub_bins;
+
+  private:
+    std::array<std::uint64_t, bin_count> bins{};
+    std::uint64_t cnt = 0;
+    std::size_t max_ns = 0;
+
+  public:
+    void record(std::chrono::nanoseconds duration) noexcept {
+        auto const ns = static_cast<std::size_t>(
+            std::max<std::chrono::nanoseconds::rep>(duration.count(), 0));
+        ++bins[bin_index(ns)];
+        ++cnt;
+        max_ns = std::max(max_ns, ns);
+    }
+
+    [[nodiscard]] auto count() const noexcept -> std::uint64_t { return cnt; }
+
+    [[nodiscard]] auto max() const noexcept -> std::chrono::nanoseconds {
+        return std::chrono::nanoseconds(max_ns);
+    }
+
+    // Return an upper bound for the duration at quantile 'q' (0.0-1.0), or
+    // zero if nothing has been recorded.
+    [[nodiscard]] auto quantile(double q) const noexcept
+        -> std::chrono::nanoseconds {
+        if (cnt == 0)
+            return {};
+        auto const rank = std::max<std::uint64_t>(
+            1, static_cast<std::uint64_t>(
+                   std::ceil(std::clamp(q, 0.0, 1.0) * double(cnt))));
+        std::uint64_t seen = 0;
+        for (std::size_t i = 0; i < bin_count; ++i) {
+            seen += bins[i];
+            if (seen >= rank) {
+                return std::chrono::nanoseconds(
+                    std::min(bin_upper_bound(i), max_ns));
+            }
+        }
+        return max();
+    }
+
+    static auto bin_index(std::size_t ns) noexcept -> std::size_t {
+        if (ns < sub_bins)
+            return ns;
+        auto const msb = value_bits - 1 -
+                         static_cast<std::size_t>(internal::countl_zero(ns));
+        auto const sub = (ns >> (msb - log2_sub_bins)) & (sub_bins - 1);
+        return (msb - log2_sub_bins + 1) * sub_bins + sub;
+    }
+
+    static constexpr auto bin_upper_bound(std::size_t index) noexcept
+        -> std::size_t {
+        if (index < sub_bins)
+            return index;
+        auto const msb = index / sub_bins + log2_sub_bins - 1;
+        auto const width = std::size_t(1) << (msb - log2_sub_bins);
+        auto const lower = (sub_bins + index % sub_bins) * width;
+        return lower + (width - 1);
+    }
+};
+
+// Per-request-type counts and handling latencies.
+class request_stats {
+  public:
+    static constexpr std::size_t type_count =
+        std::size_t(protocol::AnyRequest::MAX) + 1;
+
+  private:
+    std::array<latency_histogram, type_count> latencies;
+
+  public:
+    void record(protocol::AnyRequest type,
+                std::chrono::nanoseconds latency) noexcept {
+        auto const i = static_cast<std::size_t>(type);
+        if (i < type_count)
+            latencies[i].record(latency);
+    }
+
+    [[nodiscard]] auto latency(protocol::AnyRequest type) const noexcept
+        -> latency_histogram const & {
+        return latencies[static_cast<std::size_t>(type)];
+    }
+};
+
+class allocation_profiler;
+
+// Current values gathered from across the daemon when stats are requested.
+struct daemon_gauges {
+    std::size_t object_count = 0; // Including vouchers
+    std::size_t voucher_count = 0;
+    std::size_t segment_count = 0;
+    allocator_stats shmem;
+    std::size_t client_count = 0;
+    std::size_t queued_messages = 0; // Awaiting write, all clients
+    std::size_t max_client_queued_messages = 0;
+    // Only valid while handling the stats request; null if not available.
+    allocation_profiler const *alloc_profiler = nullptr;
+};
+
+// Daemon-wide statistics. Request stats are recorded by request handlers;
+// gauges are gathered through the function given at construction.
+class daemon_stats {
+    request_stats reqs;
+    std::function<daemon_gauges()> gather;
+
+  public:
+    explicit daemon_stats(std::function<daemon_gauges()> gather_gauges = {})
+        : gather(std::move(gather_gauges)) {}
+
+    // No move or copy (pointer taken by request handlers)
+    ~daemon_stats() = default;
+    daemon_stats(daemon_stats const &) = delete;
+    auto operator=(daemon_stats const &) = delete;
+    daemon_stats(daemon_stats &&) = delete;
+    auto operator=(daemon_stats &&) = delete;
+
+    [[nodiscard]] auto requests() noexcept -> request_stats & { return reqs; }
+
+    [[nodiscard]] auto requests() const noexcept -> request_stats const & {
+        return reqs;
+    }
+
+    [[nodiscard]] auto gauges() const -> daemon_gauges {
+        return gather ? gather() : daemon_gauges{};
+    }
+};
+
+} // namespace partake::daemon
@@ -0,0 +1,800 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+// Randomized stress test of the session state machine: many simulated
+// sessions share one repository and issue random interleavings of Alloc,
+// Share, Open (with and without waiting and timeouts, by key or voucher),
+// Unshare, CreateVoucher, and Close, and are disconnected at random. A model
+// of what each client holds is used to check that each request completes
+// exactly once with a permitted status, that nothing completes after its
+// session has gone away, and that no objects or allocations are leaked.
+//
+// Requests are interleaved on a single thread (as they are in partaked,
+// whose sessions are all accessed on one strand); allocation is faked, with
+// a capacity limit so that allocation sometimes fails.
+
+#include "allocator.hpp"
+#include "asio.hpp"
+#include "handle.hpp"
+#include "key_sequence.hpp"
+#include "object.hpp"
+#include "repository.hpp"
+#include "session.hpp"
+#include "time_point.hpp"
+#include "token.hpp"
+#include "voucher_queue.hpp"
+
+#include <CLI/CLI.hpp>
+#include <fmt/core.h>
+#include <gsl/span>
+#include <tl/expected.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace partake::daemon {
+
+namespace {
+
+struct stress_config {
+    std::size_t sessions = 1000;
+    std::uint64_t ops = 10'000'000;
+    std::uint64_t seed = 1;
+    unsigned voucher_ttl_ms = 5;
+    std::size_t capacity = std::size_t(64) << 20;
+};
+
+class stress_allocator;
+
+// Resource handed out by stress_allocator, which it notifies when destroyed.
+class stress_resource {
+    stress_allocator *allocr = nullptr;
+    std::size_t sz = 0;
+
+  public:
+    stress_resource() noexcept = default;
+
+    explicit stress_resource(stress_allocator *allocator,
+                             std::size_t size) noexcept
+        : allocr(allocator), sz(size) {}
+
+    ~stress_resource();
+
+    stress_resource(stress_resource const &) = delete;
+    auto operator=(stress_resource const &) = delete;
+
+    stress_resource(stress_resource &&other) noexcept
+        : allocr(std::exchange(other.allocr, nullptr)),
+          sz(std::exchange(other.sz, 0)) {}
+
+    auto operator=(stress_resource &&rhs) noexcept -> stress_resource & {
+        stress_resource(std::move(rhs)).swap(*this);
+        return *this;
+    }
+
+    void swap(stress_resource &other) noexcept {
+        std::swap(allocr, other.allocr);
+        std::swap(sz, other.sz);
+    }
+
+    explicit operator bool() const noexcept { return allocr != nullptr; }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t { return sz; }
+};
+
+// Allocator without memory, which fails when 'capacity' would be exceeded.
+class stress_allocator {
+    std::size_t cap;
+    std::size_t used = 0;
+    std::size_t live = 0;
+
+  public:
+    explicit stress_allocator(std::size_t capacity) : cap(capacity) {}
+
+    auto allocate(std::size_t size, int /* numa_node */,
+                  std::size_t /* alignment */) -> stress_resource {
+        if (size == 0 || size > cap - used)
+            return {};
+        used += size;
+        ++live;
+        return stress_resource(this, size);
+    }
+
+    auto allocate(std::size_t size, int numa_node, std::size_t alignment,
+                  std::size_t /* sub_pool */) -> stress_resource {
+        return allocate(size, numa_node, alignment);
+    }
+
+    // NOLINTNEXTLINE(readability-convert-member-functions-to-static)
+    auto bytes(stress_resource const & /* rsrc */)
+        -> gsl::span<std::uint8_t> {
+        return {};
+    }
+
+    [[nodiscard]] auto max_allocation_size() const noexcept -> std::size_t {
+        return cap;
+    }
+
+    [[nodiscard]] auto stats() const noexcept -> allocator_stats {
+        return {cap, cap - used, cap - used, 1};
+    }
+
+    [[nodiscard]] auto live_count() const noexcept -> std::size_t {
+        return live;
+    }
+
+    void release(std::size_t size) noexcept {
+        used -= size;
+        --live;
+    }
+};
+
+stress_resource::~stress_resource() {
+    if (allocr != nullptr)
+        allocr->release(sz);
+}
+
+enum class op_kind : std::size_t {
+    alloc,
+    share,
+    open,
+    unshare,
+    voucher,
+    close,
+    disconnect,
+    count_
+};
+
+constexpr std::array<char const *, std::size_t(op_kind::count_)> op_names{
+    "alloc", "share", "open", "unshare", "voucher", "close", "disconnect"};
+
+// Relative frequencies of the operations, in the order of op_kind.
+constexpr std::array<unsigned, std::size_t(op_kind::count_)> op_weights{
+    10, 8, 30, 6, 10, 35, 1};
+
+struct op_counts {
+    std::uint64_t ok = 0;
+    std::uint64_t failed = 0;
+    std::uint64_t deferred = 0;
+};
+
+class stress_test {
+    using object_type = object<stress_resource>;
+    using voucher_queue_type = voucher_queue<object_type>;
+    using repository_type =
+        repository<object_type, key_sequence, voucher_queue_type>;
+    using handle_type = handle<object_type>;
+    using session_type =
+        session<stress_allocator, repository_type, handle_type>;
+
+    static constexpr std::size_t max_held = 16;          // Keys per client
+    static constexpr std::size_t ring_size = 4096;       // Published keys
+    static constexpr std::uint64_t poll_interval = 1024; // Requests
+    static constexpr std::size_t max_reported = 10;
+
+    // A request's completion, shared by all of its callbacks.
+    struct completion {
+        bool done = false;
+        bool canceled = false; // Session went away
+    };
+
+    // What a client holds open, as far as it can tell from its replies.
+    struct held_object {
+        unsigned opens = 0;
+        bool writable = false;
+        bool unshare_pending = false;
+        protocol::Policy policy = protocol::Policy::DEFAULT;
+    };
+
+    struct client {
+        session_type sess;
+        std::unordered_map<common::token, held_object> held;
+        std::vector<std::shared_ptr<completion>> pending;
+    };
+
+    struct published {
+        common::token key;
+        protocol::Policy policy = protocol::Policy::DEFAULT;
+    };
+
+    stress_config cfg;
+    std::mt19937_64 rng;
+
+    asio::io_context ctx;
+    steady_clock_traits clk_traits;
+    voucher_queue_type vq;
+    stress_allocator allocr;
+    repository_type repo;
+
+    std::vector<published> shared_keys;  // Ring
+    std::vector<published> voucher_keys; // Ring
+    std::size_t shared_next = 0;
+    std::size_t voucher_next = 0;
+
+    std::uint32_t next_session_id = 1;
+    std::vector<client> clients; // Destroyed before the repository
+
+    std::array<op_counts, std::size_t(op_kind::count_)> counts{};
+    std::uint64_t violations = 0;
+
+  public:
+    explicit stress_test(stress_config const &config)
+        : cfg(config), rng(config.seed), clk_traits(ctx.get_executor()),
+          vq(clk_traits, std::chrono::milliseconds(1)),
+          allocr(config.capacity), repo(key_sequence(config.seed), vq),
+          clients(config.sessions) {
+        for (auto &c : clients)
+            c.sess = new_session();
+    }
+
+    ~stress_test() = default;
+    stress_test(stress_test const &) = delete;
+    auto operator=(stress_test const &) = delete;
+    stress_test(stress_test &&) = delete;
+    auto operator=(stress_test &&) = delete;
+
+    void run() {
+        std::discrete_distribution<std::size_t> pick_op(op_weights.begin(),
+                                                        op_weights.end());
+        std::uniform_int_distribution<std::size_t> pick_client(
+            0, clients.size() - 1);
+        for (std::uint64_t i = 0; i < cfg.ops; ++i) {
+            auto const ci = pick_client(rng);
+            switch (op_kind(pick_op(rng))) {
+            case op_kind::alloc:
+                do_alloc(ci);
+                break;
+            case op_kind::share:
+                do_share(ci);
+                break;
+            case op_kind::open:
+                do_open(ci);
+                break;
+            case op_kind::unshare:
+                do_unshare(ci);
+                break;
+            case op_kind::voucher:
+                do_voucher(ci);
+                break;
+            case op_kind::close:
+                do_close(ci);
+                break;
+            default:
+                disconnect(ci);
+                break;
+            }
+            if (i % poll_interval == poll_interval - 1)
+                poll();
+        }
+    }
+
+    // Disconnect all clients and check that nothing remains.
+    void finish() {
+        for (std::size_t ci = 0; ci < clients.size(); ++ci) {
+            cancel_pending(ci);
+            clients[ci] = client();
+        }
+        vq.drop_all();
+        ctx.poll();
+        if (repo.object_count() != 0)
+            violation(fmt::format("{} objects remain after all sessions "
+                                  "closed",
+                                  repo.object_count()));
+        if (allocr.live_count() != 0)
+            violation(fmt::format("{} allocations leaked",
+                                  allocr.live_count()));
+        if (repo.wait_deadlines().size() != 0)
+            violation(fmt::format("{} wait deadlines remain",
+                                  repo.wait_deadlines().size()));
+    }
+
+    void print_report(double seconds) const {
+        std::uint64_t total = 0;
+        for (auto const &c : counts)
+            total += c.ok + c.failed;
+        fmt::print("{} sessions, {} requests in {:.3f} s ({:.0f} ops/s)\n",
+                   cfg.sessions, total, seconds,
+                   seconds > 0.0 ? double(total) / seconds : 0.0);
+        fmt::print("  {:<10} {:>12} {:>12} {:>12}\n", "request", "ok",
+                   "failed", "deferred");
+        for (std::size_t k = 0; k < counts.size(); ++k)
+            fmt::print("  {:<10} {:>12} {:>12} {:>12}\n", op_names[k],
+                       counts[k].ok, counts[k].failed, counts[k].deferred);
+        fmt::print("{} violations\n", violations);
+    }
+
+    [[nodiscard]] auto violation_count() const noexcept -> std::uint64_t {
+        return violations;
+    }
+
+  private:
+    auto new_session() -> session_type {
+        return session_type(next_session_id++, allocr, repo,
+                            std::chrono::milliseconds(cfg.voucher_ttl_ms));
+    }
+
+    void violation(std::string const &what) {
+        if (violations++ < max_reported)
+            fmt::print(stderr, "violation: {}\n", what);
+    }
+
+    void count(op_kind k, bool ok) {
+        auto &c = counts[std::size_t(k)];
+        ++(ok ? c.ok : c.failed);
+    }
+
+    // Mark a completion; return false (and report) if it must not happen.
+    auto complete(completion &comp, char const *op) -> bool {
+        if (comp.canceled) {
+            violation(fmt::format("{} completed after disconnect", op));
+            return false;
+        }
+        if (comp.done) {
+            violation(fmt::format("{} completed twice", op));
+            return false;
+        }
+        comp.done = true;
+        return true;
+    }
+
+    // Keep track of a request that did not complete immediately.
+    void defer(std::size_t ci, op_kind k, std::shared_ptr<completion> comp) {
+        ++counts[std::size_t(k)].deferred;
+        auto &pending = clients[ci].pending;
+        if (pending.size() >= max_held) {
+            pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                         [](auto const &p) {
+                                             return p->done;
+                                         }),
+                          pending.end());
+        }
+        pending.push_back(std::move(comp));
+    }
+
+    void cancel_pending(std::size_t ci) {
+        for (auto &p : clients[ci].pending)
+            p->canceled = true;
+        clients[ci].pending.clear();
+    }
+
+    void publish(std::vector<published> &ring, std::size_t &next,
+                 published item) {
+        if (ring.size() < ring_size) {
+            ring.push_back(item);
+        } else {
+            ring[next] = item;
+            next = (next + 1) % ring_size;
+        }
+    }
+
+    auto random_published(std::vector<published> const &ring)
+        -> std::optional<published> {
+        if (ring.empty())
+            return std::nullopt;
+        return ring[std::uniform_int_distribution<std::size_t>(
+            0, ring.size() - 1)(rng)];
+    }
+
+    // Return a held key of client 'ci' satisfying 'pred', if any.
+    template <typename Pred>
+    auto random_held(std::size_t ci, Pred pred)
+        -> std::optional<common::token> {
+        auto &held = clients[ci].held;
+        std::vector<common::token> candidates;
+        for (auto const &[key, h] : held) {
+            if (pred(h))
+                candidates.push_back(key);
+        }
+        if (candidates.empty())
+            return std::nullopt;
+        return candidates[std::uniform_int_distribution<std::size_t>(
+            0, candidates.size() - 1)(rng)];
+    }
+
+    auto chance(double p) -> bool {
+        return std::bernoulli_distribution(p)(rng);
+    }
+
+    auto random_timeout() -> std::chrono::milliseconds {
+        if (not chance(0.3))
+            return {};
+        return std::chrono::milliseconds(
+            std::uniform_int_distribution<int>(1, 5)(rng));
+    }
+
+    void poll() {
+        ctx.poll();
+        (void)repo.wait_deadlines().expire(clock::now());
+
+        // Every proper object (and no voucher) holds an allocation.
+        auto const proper = repo.object_count() - repo.voucher_count();
+        if (proper != allocr.live_count())
+            violation(fmt::format("{} proper objects but {} allocations",
+                                  proper, allocr.live_count()));
+
+        // Every held key has a handle.
+        for (auto const &c : clients) {
+            if (c.sess.handle_count() < c.held.size())
+                violation(fmt::format("session {} has {} handles but holds "
+                                      "{} keys",
+                                      c.sess.session_id(),
+                                      c.sess.handle_count(), c.held.size()));
+        }
+    }
+
+    void do_alloc(std::size_t ci) {
+        auto &c = clients[ci];
+        if (c.held.size() >= max_held)
+            return do_close(ci);
+        auto const size =
+            std::uniform_int_distribution<std::size_t>(1, 1 << 16)(rng);
+        auto const policy = chance(0.1) ? protocol::Policy::PRIMITIVE
+                                        : protocol::Policy::DEFAULT;
+        completion comp;
+        c.sess.alloc(
+            size, policy, -1, 0,
+            [&](common::token key, stress_resource const &rsrc) {
+                if (not complete(comp, "alloc"))
+                    return;
+                count(op_kind::alloc, true);
+                if (rsrc.size() != size)
+                    violation("alloc returned wrong size");
+                auto &h = c.held[key];
+                if (h.opens != 0)
+                    violation("alloc returned a held key");
+                h = {1, policy == protocol::Policy::DEFAULT, false, policy};
+                if (policy == protocol::Policy::PRIMITIVE)
+                    publish(shared_keys, shared_next, {key, policy});
+            },
+            [&](protocol::Status status) {
+                if (not complete(comp, "alloc"))
+                    return;
+                count(op_kind::alloc, false);
+                if (status != protocol::Status::OUT_OF_SHMEM)
+                    violation(fmt::format("alloc failed with status {}",
+                                          int(status)));
+            });
+        if (not comp.done)
+            violation("alloc did not complete");
+    }
+
+    void do_share(std::size_t ci) {
+        auto &c = clients[ci];
+        auto key = random_held(ci, [](auto const &h) { return h.writable; });
+        bool const expect_ok = key.has_value();
+        if (not key)
+            key = random_held(ci, [](auto const & /* h */) { return true; });
+        if (not key)
+            return do_alloc(ci);
+        // Update the model first: sharing may complete our own waiting Open.
+        auto &h = c.held[*key];
+        h.writable = false;
+        auto const policy = h.policy;
+        completion comp;
+        c.sess.share(
+            *key,
+            [&] {
+                if (not complete(comp, "share"))
+                    return;
+                count(op_kind::share, true);
+                if (not expect_ok)
+                    violation("share of non-writable object succeeded");
+                publish(shared_keys, shared_next, {*key, policy});
+            },
+            [&](protocol::Status status) {
+                if (not complete(comp, "share"))
+                    return;
+                count(op_kind::share, false);
+                if (expect_ok || status != protocol::Status::NO_SUCH_OBJECT)
+                    violation(fmt::format("share failed with status {}",
+                                          int(status)));
+            });
+        if (not comp.done)
+            violation("share did not complete");
+    }
+
+    void do_open(std::size_t ci) {
+        auto &c = clients[ci];
+        if (c.held.size() >= max_held)
+            return do_close(ci);
+        auto target = random_published(chance(0.35) ? voucher_keys
+                                                     : shared_keys);
+        if (not target)
+            return do_alloc(ci);
+        // Occasionally ask for the wrong policy, which must fail.
+        bool const wrong_policy = chance(0.02);
+        auto const policy = wrong_policy
+                                ? (target->policy == protocol::Policy::DEFAULT
+                                       ? protocol::Policy::PRIMITIVE
+                                       : protocol::Policy::DEFAULT)
+                                : target->policy;
+        bool const wait = chance(0.5);
+        auto const timeout = wait ? random_timeout()
+                                  : std::chrono::milliseconds(0);
+
+        auto comp = std::make_shared<completion>();
+        auto opened = [this, ci, comp, policy,
+                       wrong_policy](common::token key,
+                                     stress_resource const & /* rsrc */) {
+            if (not complete(*comp, "open"))
+                return;
+            count(op_kind::open, true);
+            if (wrong_policy)
+                violation("open with wrong policy succeeded");
+            auto &h = clients[ci].held[key];
+            if (h.opens == 0)
+                h.policy = policy;
+            else if (h.writable)
+                violation("open of writable object succeeded");
+            ++h.opens;
+        };
+        auto failed = [this, comp](protocol::Status status, bool deferred,
+                                   bool may_time_out, bool may_be_busy) {
+            if (not complete(*comp, "open"))
+                return;
+            count(op_kind::open, false);
+            if (status == protocol::Status::NO_SUCH_OBJECT ||
+                (status == protocol::Status::TIMED_OUT && may_time_out) ||
+                (status == protocol::Status::OBJECT_BUSY && may_be_busy))
+                return;
+            violation(fmt::format("open failed with status {}{}",
+                                  int(status), deferred ? " (deferred)" : ""));
+        };
+        c.sess.open(
+            target->key, policy, wait, clock::now(), opened,
+            [failed, wait](protocol::Status status) {
+                failed(status, false, false, not wait);
+            },
+            opened,
+            [failed, timeout](protocol::Status status) {
+                failed(status, true, timeout.count() > 0, false);
+            },
+            timeout);
+        if (not comp->done) {
+            if (not wait)
+                violation("open without waiting did not complete");
+            defer(ci, op_kind::open, comp);
+        }
+    }
+
+    void do_unshare(std::size_t ci) {
+        auto &c = clients[ci];
+        auto key = random_held(ci, [](auto const &h) {
+            return not h.writable && not h.unshare_pending;
+        });
+        if (not key)
+            return do_share(ci);
+        auto const orig_key = *key;
+        bool const primitive =
+            c.held[orig_key].policy == protocol::Policy::PRIMITIVE;
+        bool const wait = chance(0.5);
+        auto const timeout = wait ? random_timeout()
+                                  : std::chrono::milliseconds(0);
+
+        auto comp = std::make_shared<completion>();
+        auto unshared = [this, ci, comp, orig_key](common::token new_key) {
+            if (not complete(*comp, "unshare"))
+                return;
+            count(op_kind::unshare, true);
+            auto &held = clients[ci].held;
+            auto const it = held.find(orig_key);
+            if (it == held.end() || it->second.opens != 1) {
+                violation("unshare succeeded without unique ownership");
+                return;
+            }
+            held.erase(it);
+            auto &h = held[new_key];
+            if (h.opens != 0)
+                violation("unshare returned a held key");
+            h = {1, true, false, protocol::Policy::DEFAULT};
+        };
+        auto failed = [this, ci, comp, orig_key, primitive](
+                          protocol::Status status, bool deferred,
+                          bool may_time_out, bool may_be_busy) {
+            if (not complete(*comp, "unshare"))
+                return;
+            count(op_kind::unshare, false);
+            auto &held = clients[ci].held;
+            if (auto const it = held.find(orig_key); it != held.end())
+                it->second.unshare_pending = false;
+            if (primitive && status == protocol::Status::NO_SUCH_OBJECT)
+                return;
+            if (primitive)
+                violation("unshare of primitive object did not fail");
+            // Deferred NO_SUCH_OBJECT: the handle was closed while waiting.
+            if ((status == protocol::Status::NO_SUCH_OBJECT && deferred) ||
+                (status == protocol::Status::TIMED_OUT && may_time_out) ||
+                (status == protocol::Status::OBJECT_BUSY && may_be_busy) ||
+                (status == protocol::Status::OBJECT_RESERVED && not deferred))
+                return;
+            violation(fmt::format("unshare failed with status {}{}",
+                                  int(status), deferred ? " (deferred)" : ""));
+        };
+        c.sess.unshare(
+            orig_key, wait, unshared,
+            [failed, wait](protocol::Status status) {
+                failed(status, false, false, not wait);
+            },
+            unshared,
+            [failed, timeout](protocol::Status status) {
+                failed(status, true, timeout.count() > 0, false);
+            },
+            timeout);
+        if (not comp->done) {
+            if (not wait)
+                violation("unshare without waiting did not complete");
+            c.held[orig_key].unshare_pending = true;
+            defer(ci, op_kind::unshare, comp);
+        }
+    }
+
+    void do_voucher(std::size_t ci) {
+        auto &c = clients[ci];
+        std::optional<published> target;
+        bool const own = chance(0.7);
+        if (own) {
+            if (auto const key = random_held(
+                    ci, [](auto const & /* h */) { return true; }))
+                target = published{*key, c.held[*key].policy};
+        } else {
+            target = random_published(shared_keys);
+        }
+        if (not target)
+            return do_alloc(ci);
+        auto const n = std::uniform_int_distribution<unsigned>(1, 3)(rng);
+        completion comp;
+        c.sess.create_voucher(
+            target->key, n, clock::now(),
+            [&](common::token key) {
+                if (not complete(comp, "voucher"))
+                    return;
+                count(op_kind::voucher, true);
+                for (unsigned i = 0; i < n; ++i)
+                    publish(voucher_keys, voucher_next,
+                            {key, target->policy});
+            },
+            [&](protocol::Status status) {
+                if (not complete(comp, "voucher"))
+                    return;
+                count(op_kind::voucher, false);
+                if (own || status != protocol::Status::NO_SUCH_OBJECT)
+                    violation(fmt::format("voucher failed with status {}",
+                                          int(status)));
+            });
+        if (not comp.done)
+            violation("voucher did not complete");
+    }
+
+    void do_close(std::size_t ci) {
+        auto &c = clients[ci];
+        std::optional<common::token> key;
+        bool expect_ok = not chance(0.05);
+        if (expect_ok)
+            key = random_held(ci, [](auto const & /* h */) { return true; });
+        if (not key) {
+            // A key that this client does not hold must fail.
+            auto const other = random_published(shared_keys);
+            if (not other || c.held.count(other->key) != 0)
+                return;
+            key = other->key;
+            expect_ok = false;
+        }
+        if (expect_ok) {
+            // Update the model first: closing may complete a waiting
+            // Unshare, which then finds the remaining open count.
+            auto const it = c.held.find(*key);
+            if (--it->second.opens == 0)
+                c.held.erase(it);
+        }
+        completion comp;
+        c.sess.close(
+            *key,
+            [&] {
+                if (not complete(comp, "close"))
+                    return;
+                count(op_kind::close, true);
+                if (not expect_ok)
+                    violation("close of key not held succeeded");
+            },
+            [&](protocol::Status status) {
+                if (not complete(comp, "close"))
+                    return;
+                count(op_kind::close, false);
+                if (expect_ok || status != protocol::Status::NO_SUCH_OBJECT)
+                    violation(fmt::format("close failed with status {}",
+                                          int(status)));
+            });
+        if (not comp.done)
+            violation("close did not complete");
+    }
+
+    void disconnect(std::size_t ci) {
+        auto &c = clients[ci];
+        count(op_kind::disconnect, true);
+        cancel_pending(ci);
+        c.held.clear();
+        if (chance(0.5)) {
+            // Stepwise teardown, as done for clients with many handles.
+            while (not c.sess.close_some_handles(4)) {
+            }
+        }
+        c.sess = new_session();
+    }
+};
+
+auto parse_cli_args(int argc, char const *const *argv)
+    -> tl::expected<stress_config, int> {
+    using namespace std::string_literals;
+
+    stress_config ret;
+
+    CLI::App app;
+    app.option_defaults()->disable_flag_override();
+    app.description("Randomized stress test of partaked session state.\n");
+
+    app.add_option("--sessions", ret.sessions,
+                   "Number of simulated sessions (default: 1000)")
+        ->type_name("COUNT")
+        ->check(CLI::PositiveNumber);
+
+    app.add_option("--ops", ret.ops,
+                   "Number of requests to issue (default: 10000000)")
+        ->type_name("COUNT");
+
+    app.add_option("--seed", ret.seed, "Random seed (default: 1)")
+        ->type_name("NUMBER");
+
+    app.add_option("--voucher-ttl-ms", ret.voucher_ttl_ms,
+                   "Voucher time to live (default: 5)")
+        ->type_name("MILLISECONDS")
+        ->check(CLI::PositiveNumber);
+
+    app.add_option("--capacity", ret.capacity,
+                   "Bytes that can be allocated (default: 64 MiB)")
+        ->type_name("BYTES")
+        ->check(CLI::PositiveNumber);
+
+    app.set_help_flag("-h,--help", "Display this help and exit"s);
+
+    try {
+        app.parse(argc, argv);
+        return ret;
+    } catch (CLI::ParseError const &err) { // Includes --help
+        return tl::unexpected(app.exit(err));
+    }
+}
+
+} // namespace
+
+} // namespace partake::daemon
+
+auto main(int argc, char const *const argv[]) -> int {
+    using namespace partake::daemon;
+    auto const cfg = parse_cli_args(argc, argv);
+    if (not cfg)
+        return cfg.error();
+
+    stress_test test(*cfg);
+    auto const start = std::chrono::steady_clock::now();
+    test.run();
+    auto const elapsed = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start);
+    test.finish();
+    test.print_report(elapsed.count());
+    return test.violation_count() == 0 ? 0 : 1;
+}
@@ -8,12 +8,16 @@
 
 #include <doctest.h>
 
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
 namespace partake::daemon {
 
 namespace {
 
-// Element must inherit hook and have key() method.
-struct elem : token_hash_table<elem>::hook {
+// Element must have key() method.
+struct elem {
     common::token ky;
     elem(common::token key) : ky(key) {}
     [[nodiscard]] auto key() const -> common::token { return ky; }
@@ -32,7 +36,36 @@ TEST_CASE("token_hash_table") {
     t.insert(e);
     CHECK(t.find(token(42))->ky.as_u64() == 42);
     CHECK(t.iterator_to(e) == t.find(token(42)));
-    t.erase(t.iterator_to(e)); // Table must be empty before destruction.
+    t.erase(t.iterator_to(e));
+    CHECK(t.empty());
+    CHECK(t.find(token(42)) == t.end());
+}
+
+TEST_CASE("token_hash_table: colliding keys") {
+    using common::token;
+    token_hash_table<elem> t;
+    REQUIRE(t.capacity() == 16);
+    // Keys that share the control byte (low 7 bits) and the initial group
+    // (all groups, since there is only one at this capacity).
+    std::vector<elem> v;
+    v.reserve(14);
+    for (std::uint64_t i = 0; i < 14; ++i)
+        v.emplace_back(token((i << 11) | 5));
+    for (elem &e : v)
+        t.insert(e);
+    CHECK(t.size() == 14);
+    CHECK(t.capacity() == 16);
+    for (elem &e : v)
+        CHECK(&*t.find(e.key()) == &e);
+    CHECK(t.find(token((14 << 11) | 5)) == t.end());
+
+    t.erase(t.iterator_to(v[3]));
+    CHECK(t.find(v[3].key()) == t.end());
+    CHECK(&*t.find(v[4].key()) == &v[4]);
+    t.insert(v[3]);
+    CHECK(&*t.find(v[3].key()) == &v[3]);
+    while (not t.empty())
+        t.erase(t.begin());
 }
 
 TEST_CASE("token_hash_table: foreach") {
@@ -66,11 +99,69 @@ TEST_CASE("token_hash_table: rehash") {
         t.insert(e);
         t.rehash_if_appropriate();
     }
+    CHECK(t.size() == 1000);
+    CHECK(t.capacity() >= 1000);
+    for (elem &e : v)
+        CHECK(&*t.find(e.key()) == &e);
 
     while (not t.empty()) {
         t.erase(t.begin());
         t.rehash_if_appropriate(true);
     }
+    CHECK(t.capacity() == 16);
+}
+
+TEST_CASE("token_hash_table: tombstones are cleared") {
+    token_hash_table<elem> t(64);
+    std::vector<elem> v;
+    v.reserve(2000);
+    for (std::uint64_t i = 0; i < 2000; ++i)
+        v.emplace_back(common::token(i));
+    // Repeated insertion and erasure does not grow the table.
+    for (elem &e : v) {
+        t.insert(e);
+        t.erase(t.iterator_to(e));
+    }
+    CHECK(t.empty());
+    CHECK(t.capacity() == 64);
+}
+
+TEST_CASE("token_hash_table: incremental resize") {
+    token_hash_table<elem> t(2048);
+    std::vector<elem> v;
+    v.reserve(4000);
+    for (std::uint64_t i = 0; i < 4000; ++i)
+        v.emplace_back(common::token(i));
+
+    std::size_t i = 0;
+    while (not t.is_resizing()) {
+        REQUIRE(i < v.size());
+        t.insert(v[i++]);
+    }
+    CHECK(t.capacity() == 4096);
+    auto const inserted = i;
+
+    // All elements are found and visited while the resize is in progress.
+    t.insert(v[i++]);
+    REQUIRE(t.is_resizing());
+    for (std::size_t j = 0; j < i; ++j)
+        CHECK(&*t.find(v[j].key()) == &v[j]);
+    CHECK(std::size_t(std::distance(t.begin(), t.end())) == i);
+    t.erase(t.iterator_to(v[0]));
+    CHECK(t.find(v[0].key()) == t.end());
+
+    // Each housekeeping call makes bounded progress.
+    t.rehash_if_appropriate();
+    CHECK(t.is_resizing());
+    t.rehash_if_appropriate();
+    CHECK_FALSE(t.is_resizing());
+    CHECK(t.size() == inserted);
+    for (std::size_t j = 1; j < i; ++j)
+        CHECK(&*t.find(v[j].key()) == &v[j]);
+
+    t.finish_resize();
+    while (not t.empty())
+        t.erase(t.begin());
 }
 
 // NOLINTEND(readability-magic-numbers)
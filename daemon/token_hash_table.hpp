@@ -6,85 +6,447 @@
 
 #pragma once
 
+#include "allocator.hpp"
 #include "token.hpp"
 
-#include <boost/intrusive/unordered_set.hpp>
-
 #include <algorithm>
+#include <cassert>
 #include <cstddef>
-#include <type_traits>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <utility>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) ||                                   \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTAKE_TOKEN_HASH_TABLE_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define PARTAKE_TOKEN_HASH_TABLE_NEON 1
+#include <arm_neon.h>
+#endif
+
 namespace partake::daemon {
 
-// Wrapper around intrusive unordered set to hide some implementation details.
+namespace internal {
+
+// Control bytes of the token hash table. A full slot has the low 7 bits of
+// its key's hash, so that the high bit distinguishes empty and deleted slots.
+using hash_ctrl = std::int8_t;
+constexpr unsigned hash_ctrl_bits = 7;
+constexpr hash_ctrl hash_ctrl_empty = -128;
+constexpr hash_ctrl hash_ctrl_deleted = -2;
+
+// A group of control bytes that is examined at once when probing. The match
+// functions return a bitmask with bit i set if the i-th control byte of the
+// group matches.
+class hash_probe_group {
+  public:
+    static constexpr std::size_t width = 16;
+
+  private:
+#if defined(PARTAKE_TOKEN_HASH_TABLE_SSE2)
+    __m128i ctrl;
+
+  public:
+    explicit hash_probe_group(hash_ctrl const *ctrls) noexcept
+        : ctrl(_mm_loadu_si128(reinterpret_cast<__m128i const *>(ctrls))) {}
+
+    [[nodiscard]] auto match(hash_ctrl h) const noexcept -> std::uint32_t {
+        return static_cast<std::uint32_t>(
+            _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h), ctrl)));
+    }
+
+    // Empty or deleted.
+    [[nodiscard]] auto match_free() const noexcept -> std::uint32_t {
+        return static_cast<std::uint32_t>(_mm_movemask_epi8(ctrl));
+    }
+#elif defined(PARTAKE_TOKEN_HASH_TABLE_NEON)
+    int8x16_t ctrl;
+
+    static auto to_bitmask(uint8x16_t m) noexcept -> std::uint32_t {
+        // NOLINTBEGIN(readability-magic-numbers)
+        static constexpr std::uint8_t bits[16] = {
+            1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        // NOLINTEND(readability-magic-numbers)
+        auto const b = vandq_u8(m, vld1q_u8(bits));
+        return std::uint32_t(vaddv_u8(vget_low_u8(b))) |
+               (std::uint32_t(vaddv_u8(vget_high_u8(b))) << 8);
+    }
+
+  public:
+    explicit hash_probe_group(hash_ctrl const *ctrls) noexcept
+        : ctrl(vld1q_s8(ctrls)) {}
+
+    [[nodiscard]] auto match(hash_ctrl h) const noexcept -> std::uint32_t {
+        return to_bitmask(vceqq_s8(ctrl, vdupq_n_s8(h)));
+    }
+
+    [[nodiscard]] auto match_free() const noexcept -> std::uint32_t {
+        return to_bitmask(vcltzq_s8(ctrl));
+    }
+#else
+    hash_ctrl const *ctrl;
+
+  public:
+    explicit hash_probe_group(hash_ctrl const *ctrls) noexcept
+        : ctrl(ctrls) {}
+
+    [[nodiscard]] auto match(hash_ctrl h) const noexcept -> std::uint32_t {
+        std::uint32_t ret = 0;
+        for (std::size_t i = 0; i < width; ++i)
+            ret |= std::uint32_t(ctrl[i] == h) << i;
+        return ret;
+    }
+
+    [[nodiscard]] auto match_free() const noexcept -> std::uint32_t {
+        std::uint32_t ret = 0;
+        for (std::size_t i = 0; i < width; ++i)
+            ret |= std::uint32_t(ctrl[i] < 0) << i;
+        return ret;
+    }
+#endif
+
+    [[nodiscard]] auto match_empty() const noexcept -> std::uint32_t {
+        return match(hash_ctrl_empty);
+    }
+};
+
+} // namespace internal
+
+// Hash table of elements (not owned) keyed by token, using open addressing in
+// the manner of Swiss tables. Each slot stores the key together with the
+// element pointer, so that lookups do not need to access the elements
+// themselves (other than the one found). Slots are probed in aligned groups
+// of 16, whose control bytes are compared at once using SSE2 or NEON (where
+// available).
+//
+// Resizing is incremental: the slots are reallocated, but elements are moved
+// from the old slots a bounded number at a time, on each insertion and each
+// call to rehash_if_appropriate(). While this is in progress, lookups check
+// both sets of slots. This avoids stalling a request for the time it takes
+// to rehash millions of elements.
+//
+// Element must have a key() member function, whose value must not change
+// while the element is in the table. Keys must be unique.
+//
+// Erasure does not move other elements; inserting and rehashing may move
+// elements, which invalidates all iterators.
 template <typename E> class token_hash_table {
   public:
-    using hook = boost::intrusive::unordered_set_base_hook<>;
     using element_type = E;
-    // Element must inherit from hook, but we cannot test here because it will
-    // be an incomplete type.
 
   private:
-    struct key_getter {
-        using type = common::token;
-        auto operator()(element_type const &h) const -> type {
-            return h.key();
-        }
+    using group = internal::hash_probe_group;
+    using ctrl_t = internal::hash_ctrl;
+
+    // Slots visited (in the old table) per insertion while resizing. Must be
+    // at least 2 so that the resize completes before the new slots fill up
+    // when growing.
+    static constexpr std::size_t migration_slots_per_insert = 8;
+
+    // Slots visited per call to rehash_if_appropriate() while resizing.
+    static constexpr std::size_t migration_slots_per_call = 1024;
+
+    struct slot {
+        common::token key;
+        element_type *elem;
     };
 
-    using table_impl_type = boost::intrusive::unordered_set<
-        element_type, boost::intrusive::base_hook<hook>,
-        boost::intrusive::hash<std::hash<common::token>>,
-        boost::intrusive::key_of_value<key_getter>,
-        boost::intrusive::power_2_buckets<true>>;
+    // A set of slots with their control bytes.
+    struct slot_table {
+        std::vector<ctrl_t> ctrls; // Size is capacity
+        std::vector<slot> slots;   // Size is capacity
+        std::size_t cnt = 0;
+        std::size_t tombstones = 0;
+
+        slot_table() noexcept = default;
 
-    std::vector<typename table_impl_type::bucket_type> buckets;
-    table_impl_type table;
+        explicit slot_table(std::size_t slot_count)
+            : ctrls(slot_count, internal::hash_ctrl_empty),
+              slots(slot_count) {
+            assert(slot_count >= group::width);
+            assert((slot_count & (slot_count - 1)) == 0);
+        }
+
+        [[nodiscard]] auto capacity() const noexcept -> std::size_t {
+            return ctrls.size();
+        }
+
+        // Return capacity() if not found.
+        [[nodiscard]] auto find(common::token key) const noexcept
+            -> std::size_t {
+            if (cnt == 0) // Also covers empty (zero-capacity) state
+                return capacity();
+            auto const h = std::hash<common::token>()(key);
+            auto const h2 = ctrl_of(h);
+            auto const group_mask = capacity() / group::width - 1;
+            auto g = (h >> internal::hash_ctrl_bits) & group_mask;
+            for (std::size_t step = 1;; ++step) {
+                auto const base = g * group::width;
+                auto const grp = group(&ctrls[base]);
+                for (auto m = grp.match(h2); m != 0; m &= m - 1) {
+                    auto const i =
+                        base + std::size_t(internal::countr_zero(m));
+                    if (slots[i].key == key)
+                        return i;
+                }
+                if (grp.match_empty() != 0 || step > group_mask)
+                    return capacity();
+                g = (g + step) & group_mask; // Triangular probing
+            }
+        }
+
+        // Key must not be present and there must be at least one free slot.
+        void insert(common::token key, element_type *elem) noexcept {
+            auto const h = std::hash<common::token>()(key);
+            auto const group_mask = capacity() / group::width - 1;
+            auto g = (h >> internal::hash_ctrl_bits) & group_mask;
+            for (std::size_t step = 1;; ++step) {
+                auto const base = g * group::width;
+                auto const m = group(&ctrls[base]).match_free();
+                if (m != 0) {
+                    auto const i =
+                        base + std::size_t(internal::countr_zero(m));
+                    if (ctrls[i] == internal::hash_ctrl_deleted)
+                        --tombstones;
+                    ctrls[i] = ctrl_of(h);
+                    slots[i] = slot{key, elem};
+                    ++cnt;
+                    return;
+                }
+                assert(step <= group_mask);
+                g = (g + step) & group_mask;
+            }
+        }
+
+        void erase(std::size_t i) noexcept {
+            assert(ctrls[i] >= 0);
+            // Probing for any key stops at a group with an empty slot, so a
+            // slot in such a group can be emptied rather than marked deleted.
+            auto const g = i & ~(group::width - 1);
+            if (group(&ctrls[g]).match_empty() != 0) {
+                ctrls[i] = internal::hash_ctrl_empty;
+            } else {
+                ctrls[i] = internal::hash_ctrl_deleted;
+                ++tombstones;
+            }
+            --cnt;
+        }
+    };
+
+    // Elements are in 'cur', or, while resizing, possibly in 'old' at or
+    // after index 'migrated'. 'old' has zero capacity when not resizing.
+    slot_table cur;
+    slot_table old;
+    std::size_t migrated = 0;
 
   public:
-    explicit token_hash_table(std::size_t initial_buckets = 8)
-        : buckets(initial_buckets),
-          table(typename table_impl_type::bucket_traits(buckets.data(),
-                                                        buckets.size())) {}
+    explicit token_hash_table(std::size_t initial_capacity = group::width)
+        : cur(capacity_for(initial_capacity)) {}
+
+    // Positions in 'old' come before those in 'cur'.
+    class iterator {
+        token_hash_table *tbl = nullptr;
+        std::size_t idx = 0;
+
+        friend class token_hash_table;
 
-    // For now, only non-const member functions are wrapped, since we don't use
-    // const ones anywhere.
+        explicit iterator(token_hash_table *table, std::size_t index) noexcept
+            : tbl(table), idx(index) {}
 
-    using iterator = typename table_impl_type::iterator;
+        [[nodiscard]] auto get_slot() const noexcept -> slot & {
+            auto const old_cap = tbl->old.capacity();
+            return idx < old_cap ? tbl->old.slots[idx]
+                                 : tbl->cur.slots[idx - old_cap];
+        }
+
+        void skip_free() noexcept {
+            auto const old_cap = tbl->old.capacity();
+            while (idx < old_cap && tbl->old.ctrls[idx] < 0)
+                ++idx;
+            if (idx < old_cap)
+                return;
+            auto const end_idx = old_cap + tbl->cur.capacity();
+            while (idx < end_idx && tbl->cur.ctrls[idx - old_cap] < 0)
+                ++idx;
+        }
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = element_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = element_type *;
+        using reference = element_type &;
+
+        iterator() noexcept = default;
+
+        auto operator*() const noexcept -> reference {
+            return *get_slot().elem;
+        }
+
+        auto operator->() const noexcept -> pointer { return get_slot().elem; }
+
+        auto operator++() noexcept -> iterator & {
+            ++idx;
+            skip_free();
+            return *this;
+        }
+
+        auto operator++(int) noexcept -> iterator {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+
+        friend auto operator==(iterator const &lhs,
+                               iterator const &rhs) noexcept -> bool {
+            return lhs.tbl == rhs.tbl && lhs.idx == rhs.idx;
+        }
+
+        friend auto operator!=(iterator const &lhs,
+                               iterator const &rhs) noexcept -> bool {
+            return not(lhs == rhs);
+        }
+    };
+
+    // For now, only non-const member functions are provided (other than
+    // size queries), since we don't use const ones anywhere.
+
+    auto begin() noexcept -> iterator {
+        auto it = iterator(this, 0);
+        it.skip_free();
+        return it;
+    }
+
+    auto end() noexcept -> iterator {
+        return iterator(this, old.capacity() + cur.capacity());
+    }
+
+    [[nodiscard]] auto empty() const noexcept -> bool { return size() == 0; }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return cur.cnt + old.cnt;
+    }
 
-    auto begin() noexcept -> iterator { return table.begin(); }
-    auto end() noexcept -> iterator { return table.end(); }
+    // Capacity of the slots that new elements are inserted into.
+    [[nodiscard]] auto capacity() const noexcept -> std::size_t {
+        return cur.capacity();
+    }
 
-    [[nodiscard]] auto empty() const noexcept -> bool { return table.empty(); }
+    [[nodiscard]] auto is_resizing() const noexcept -> bool {
+        return old.capacity() > 0;
+    }
 
     [[nodiscard]] auto iterator_to(element_type &e) noexcept -> iterator {
-        return table.iterator_to(e);
+        auto it = find(e.key());
+        assert(it != end());
+        assert(&*it == &e);
+        return it;
     }
 
-    void insert(element_type &e) { table.insert(e); }
-    void erase(iterator it) { table.erase(it); }
+    void insert(element_type &e) {
+        auto const key = e.key();
+        assert(find(key) == end());
 
-    auto find(common::token key) -> iterator { return table.find(key); }
+        // While resizing, the remaining old elements must also fit.
+        if (cur.cnt + cur.tombstones + old.cnt + 1 > max_load(capacity())) {
+            finish_resize();
+            if (cur.cnt + cur.tombstones + 1 > max_load(capacity())) {
+                // Grow unless most of the used slots are tombstones.
+                auto const grow = cur.cnt + 1 > max_load(capacity()) / 2;
+                start_resize(grow ? 2 * capacity() : capacity());
+            }
+        }
+        cur.insert(key, &e);
+        migrate(migration_slots_per_insert);
+    }
+
+    void erase(iterator it) noexcept {
+        assert(it.tbl == this);
+        auto const old_cap = old.capacity();
+        if (it.idx < old_cap)
+            old.erase(it.idx);
+        else
+            cur.erase(it.idx - old_cap);
+    }
+
+    auto find(common::token key) noexcept -> iterator {
+        auto const i = cur.find(key);
+        if (i < cur.capacity())
+            return iterator(this, old.capacity() + i);
+        auto const j = old.find(key);
+        if (j < old.capacity())
+            return iterator(this, j);
+        return end();
+    }
 
     // Iterators will be invalidated
     void rehash_if_appropriate(bool allow_shrink = true) {
-        auto const current = table.bucket_count();
-        auto const usage = table.size();
+        if (is_resizing()) {
+            migrate(migration_slots_per_call);
+            return;
+        }
+
+        auto const current = capacity();
 
         // Load factor thresholds used here are tentative (not profiled).
-        std::size_t new_count = current;
-        if (usage > current / 2 * 3)
-            new_count = 2 * current;
-        else if (allow_shrink && usage < current / 8)
-            new_count = std::max(std::size_t(8), current / 4);
-        if (new_count == current)
+        // Growth happens on insertion; here we shrink or clear tombstones.
+        std::size_t new_cap = current;
+        if (allow_shrink && cur.cnt < current / 8)
+            new_cap = std::max(group::width, current / 4);
+        if (new_cap == current && cur.tombstones <= current / 8)
             return;
+        start_resize(new_cap);
+        migrate(migration_slots_per_call);
+    }
+
+    // Complete any resize in progress. Iterators will be invalidated.
+    void finish_resize() noexcept { migrate(old.capacity()); }
 
-        decltype(buckets) wk(new_count);
-        table.rehash(
-            typename table_impl_type::bucket_traits(wk.data(), wk.size()));
-        buckets.swap(wk);
+  private:
+    static constexpr auto max_load(std::size_t slot_count) noexcept
+        -> std::size_t {
+        return slot_count / 8 * 7;
+    }
+
+    static auto capacity_for(std::size_t count) noexcept -> std::size_t {
+        std::size_t cap = group::width;
+        while (cap < count)
+            cap *= 2;
+        return cap;
+    }
+
+    static auto ctrl_of(std::size_t hash) noexcept -> ctrl_t {
+        return static_cast<ctrl_t>(hash &
+                                   ((1u << internal::hash_ctrl_bits) - 1));
+    }
+
+    void start_resize(std::size_t new_capacity) {
+        assert(not is_resizing());
+        new_capacity = std::max(group::width, new_capacity);
+        assert(cur.cnt <= max_load(new_capacity));
+        old = std::exchange(cur, slot_table(new_capacity));
+        migrated = 0;
+    }
+
+    // Move elements from old to cur, visiting up to max_slots old slots.
+    void migrate(std::size_t max_slots) noexcept {
+        if (not is_resizing())
+            return;
+        auto const stop = std::min(old.capacity(), migrated + max_slots);
+        for (; migrated < stop && old.cnt > 0; ++migrated) {
+            if (old.ctrls[migrated] >= 0) {
+                auto const &s = old.slots[migrated];
+                cur.insert(s.key, s.elem);
+                old.erase(migrated);
+            }
+        }
+        if (old.cnt == 0) {
+            old = slot_table();
+            migrated = 0;
+        }
     }
 };
 
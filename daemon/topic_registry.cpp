@@ -0,0 +1,63 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "topic_registry.hpp"
+
+#include <doctest.h>
+
+#include <vector>
+
+namespace partake::daemon {
+
+namespace {
+
+struct value : ref_counted<value> {
+    int v;
+    explicit value(int i) : v(i) {}
+};
+
+} // namespace
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("topic_registry") {
+    topic_registry<value> reg;
+    std::vector<int> notified_a;
+    std::vector<int> notified_b;
+
+    CHECK(reg.publish("t", make_ref<value>(1)) == 0);
+
+    auto const sa = reg.subscribe("t", [&](ref_ptr<value> const &o) {
+        notified_a.push_back(o->v);
+    });
+    auto const sb = reg.subscribe("t", [&](ref_ptr<value> const &o) {
+        notified_b.push_back(o->v);
+    });
+    CHECK(sa != 0);
+    CHECK(sb != sa);
+    CHECK(reg.subscriber_count("t") == 2);
+    CHECK(reg.subscriber_count("u") == 0);
+
+    CHECK(reg.publish("t", make_ref<value>(2)) == 2);
+    CHECK(reg.publish("u", make_ref<value>(3)) == 0);
+    CHECK(notified_a == std::vector<int>{2});
+    CHECK(notified_b == std::vector<int>{2});
+
+    reg.unsubscribe(sa);
+    CHECK(reg.subscriber_count("t") == 1);
+    CHECK(reg.publish("t", make_ref<value>(4)) == 1);
+    CHECK(notified_a == std::vector<int>{2});
+    CHECK(notified_b == std::vector<int>{2, 4});
+
+    reg.unsubscribe(sa); // No-op
+    reg.unsubscribe(sb);
+    CHECK(reg.subscriber_count("t") == 0);
+    CHECK(reg.publish("t", make_ref<value>(5)) == 0);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "ref_counted.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace partake::daemon {
+
+// Named topics to which objects can be published, with subscriptions that are
+// notified of each published object (in order of subscription). Topics exist
+// only while they have subscribers; publishing to a topic without subscribers
+// does nothing.
+//
+// Notification functions must not subscribe or unsubscribe.
+template <typename Object> class topic_registry {
+  public:
+    using object_type = Object;
+    using notify_func = std::function<void(ref_ptr<object_type> const &)>;
+
+  private:
+    struct subscription {
+        std::uint64_t id;
+        notify_func notify;
+    };
+
+    std::unordered_map<std::string, std::vector<subscription>> topics;
+    std::unordered_map<std::uint64_t, std::string> topic_of_subscription;
+    std::uint64_t last_id = 0;
+
+  public:
+    topic_registry() = default;
+
+    // No move or copy (sessions keep subscription ids)
+    ~topic_registry() = default;
+    topic_registry(topic_registry const &) = delete;
+    auto operator=(topic_registry const &) = delete;
+    topic_registry(topic_registry &&) = delete;
+    auto operator=(topic_registry &&) = delete;
+
+    // Return the (nonzero) subscription id.
+    auto subscribe(std::string_view topic, notify_func notify)
+        -> std::uint64_t {
+        auto const id = ++last_id;
+        auto [it, inserted] =
+            topic_of_subscription.try_emplace(id, std::string(topic));
+        assert(inserted);
+        topics[it->second].push_back({id, std::move(notify)});
+        return id;
+    }
+
+    void unsubscribe(std::uint64_t subscription_id) {
+        auto it = topic_of_subscription.find(subscription_id);
+        if (it == topic_of_subscription.end())
+            return;
+        auto topic_it = topics.find(it->second);
+        assert(topic_it != topics.end());
+        auto &subs = topic_it->second;
+        subs.erase(std::find_if(subs.begin(), subs.end(),
+                                [subscription_id](subscription const &s) {
+                                    return s.id == subscription_id;
+                                }));
+        if (subs.empty())
+            topics.erase(topic_it);
+        topic_of_subscription.erase(it);
+    }
+
+    // Return the number of subscriptions notified.
+    auto publish(std::string_view topic, ref_ptr<object_type> const &obj)
+        -> std::size_t {
+        auto it = topics.find(std::string(topic));
+        if (it == topics.end())
+            return 0;
+        for (auto const &sub : it->second)
+            sub.notify(obj);
+        return it->second.size();
+    }
+
+    [[nodiscard]] auto subscriber_count(std::string_view topic) const
+        -> std::size_t {
+        auto it = topics.find(std::string(topic));
+        return it == topics.end() ? 0 : it->second.size();
+    }
+};
+
+} // namespace partake::daemon
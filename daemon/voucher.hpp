@@ -6,41 +6,42 @@
 
 #pragma once
 
+#include "ref_counted.hpp"
 #include "time_point.hpp"
+#include "voucher_list.hpp"
 #include "voucher_queue.hpp"
 
 #include <cassert>
-#include <memory>
-#include <optional>
 
 namespace partake::daemon {
 
-template <typename Object> class voucher {
+// Linked (via the base hook) into its target's voucher_list while it
+// exists.
+template <typename Object>
+class voucher : public voucher_list<voucher<Object>>::hook {
   public:
     using object_type = Object;
-    using queue_type = voucher_queue<object_type>;
 
   private:
-    std::shared_ptr<object_type> tgt;
+    ref_ptr<object_type> tgt;
     unsigned ct; // Only decremented after construction
     time_point expiry;
 
-    std::optional<typename queue_type::handle_type> handle_in_queue;
+    voucher_queue_node<object_type> qnode;
 
   public:
-    explicit voucher(std::shared_ptr<object_type> target, unsigned count,
+    explicit voucher(ref_ptr<object_type> target, unsigned count,
                      time_point expiration)
         : tgt(std::move(target)), ct(count), expiry(expiration) {}
 
-    ~voucher() { assert(not handle_in_queue.has_value()); }
+    ~voucher() { assert(not qnode.is_linked()); }
 
     voucher(voucher const &) = delete;
     auto operator=(voucher const &) = delete;
     voucher(voucher &&) = delete;
     auto operator=(voucher &&) = delete;
 
-    [[nodiscard]] auto target() const noexcept
-        -> std::shared_ptr<object_type> {
+    [[nodiscard]] auto target() const noexcept -> ref_ptr<object_type> {
         return tgt;
     }
 
@@ -63,19 +64,14 @@ template <typename Object> class voucher {
         return true;
     }
 
-    // TODO: Instead of clear_queued(), use an RAII object that can be placed
-    // in the queue and auto-clears on destruction (still need function to get
-    // handle-in-queue)
-
-    void set_queued(typename queue_type::handle_type handle) {
-        assert(not handle_in_queue.has_value());
-        handle_in_queue = handle;
+    // Used by the queue, which holds ownership of the voucher (via the node)
+    // while it is queued.
+    auto queue_node() noexcept -> voucher_queue_node<object_type> & {
+        return qnode;
     }
 
-    auto clear_queued() -> std::optional<typename queue_type::handle_type> {
-        auto ret = handle_in_queue;
-        handle_in_queue.reset();
-        return ret;
+    [[nodiscard]] auto is_queued() const noexcept -> bool {
+        return qnode.is_linked();
     }
 };
 
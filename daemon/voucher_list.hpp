@@ -0,0 +1,49 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <boost/intrusive/list.hpp>
+
+#include <cstddef>
+
+namespace partake::daemon {
+
+// The vouchers targeting a proper object, so that they can be found without
+// scanning the voucher queue.
+template <typename Voucher> class voucher_list {
+    struct list_tag;
+
+  public:
+    using voucher_type = Voucher;
+    using hook = typename boost::intrusive::list_base_hook<
+        boost::intrusive::tag<list_tag>>;
+
+  private:
+    using list_impl_type =
+        boost::intrusive::list<voucher_type,
+                               boost::intrusive::base_hook<hook>>;
+
+    list_impl_type list;
+
+  public:
+    using iterator = typename list_impl_type::iterator;
+
+    auto begin() noexcept -> iterator { return list.begin(); }
+    auto end() noexcept -> iterator { return list.end(); }
+
+    [[nodiscard]] auto empty() const noexcept -> bool { return list.empty(); }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return list.size();
+    }
+
+    void push_back(voucher_type &v) { list.push_back(v); }
+
+    void erase(voucher_type &v) { list.erase(list.iterator_to(v)); }
+};
+
+} // namespace partake::daemon
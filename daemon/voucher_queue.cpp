@@ -12,7 +12,7 @@
 
 #include <functional>
 #include <memory>
-#include <optional>
+#include <vector>
 
 namespace partake::daemon {
 
@@ -56,10 +56,9 @@ struct mock_clock_traits {
     // NOLINTEND(modernize-use-trailing-return-type)
 };
 
-struct mock_voucher {
+struct mock_voucher : ref_counted<mock_voucher> {
     time_point exp;
-    using queue_type = voucher_queue<mock_voucher, mock_clock_traits>;
-    std::optional<typename queue_type::handle_type> h;
+    voucher_queue_node<mock_voucher> node;
 
     explicit mock_voucher(time_point expiration) : exp(expiration) {}
 
@@ -68,13 +67,9 @@ struct mock_voucher {
 
     [[nodiscard]] auto expiration() const -> time_point { return exp; }
 
-    void set_queued(typename queue_type::handle_type qh) { h = qh; }
+    auto queue_node() -> voucher_queue_node<mock_voucher> & { return node; }
 
-    auto clear_queued() -> std::optional<typename queue_type::handle_type> {
-        auto ret = h;
-        h.reset();
-        return ret;
-    }
+    [[nodiscard]] auto is_queued() const -> bool { return node.is_linked(); }
 };
 
 } // namespace
@@ -93,7 +88,7 @@ TEST_CASE("voucher_queue") {
     ALLOW_CALL(*empty_impl, cancel());
     vq.drop_all(); // Should be no-op on empty queue.
 
-    auto v1 = std::make_shared<mock_voucher>(time_point(100s));
+    auto v1 = make_ref<mock_voucher>(time_point(100s));
 
     using trompeloeil::_;
 
@@ -111,19 +106,19 @@ TEST_CASE("voucher_queue") {
         vq.enqueue(v1);
         CHECK(handler);
         CHECK_FALSE(vq.empty());
-        CHECK(v1->h.has_value());
+        CHECK(v1->is_queued());
 
         SUBCASE("drop") {
             vq.drop(v1);
             CHECK(vq.empty());
-            CHECK_FALSE(v1->h.has_value());
+            CHECK_FALSE(v1->is_queued());
         }
 
         SUBCASE("fire; expired") {
             ALLOW_CALL(mock_clock::instance(), now()).RETURN(time_point(100s));
             handler({});
             CHECK(vq.empty());
-            CHECK_FALSE(v1->h.has_value());
+            CHECK_FALSE(v1->is_queued());
         }
 
         SUBCASE("fire; unexpired") {
@@ -142,14 +137,14 @@ TEST_CASE("voucher_queue") {
             handler({});
             CHECK(handler2);
             CHECK_FALSE(vq.empty());
-            CHECK(v1->h.has_value());
+            CHECK(v1->is_queued());
 
             SUBCASE("fire; now expired") {
                 ALLOW_CALL(mock_clock::instance(), now())
                     .RETURN(time_point(100s));
                 handler({});
                 CHECK(vq.empty());
-                CHECK_FALSE(v1->h.has_value());
+                CHECK_FALSE(v1->is_queued());
             }
         }
     }
@@ -170,10 +165,107 @@ TEST_CASE("voucher_queue") {
         vq.enqueue(v1);
         CHECK(handler);
         CHECK_FALSE(vq.empty());
-        CHECK(v1->h.has_value());
+        CHECK(v1->is_queued());
     }
 }
 
+TEST_CASE("voucher_queue: timing wheel") {
+    using namespace std::chrono_literals;
+    using trompeloeil::_;
+
+    mock_clock_traits ct;
+    auto timer_impl = std::make_shared<mock_timer_impl>();
+    mock_timer const timer{timer_impl};
+    ALLOW_CALL(ct, make_timer()).RETURN(timer);
+    std::vector<time_point> scheduled;
+    ALLOW_CALL(ct, make_timer(_))
+        .LR_SIDE_EFFECT(scheduled.push_back(_1))
+        .RETURN(timer);
+    std::function<void(boost::system::error_code)> handler;
+    ALLOW_CALL(*timer_impl, async_wait(_)).LR_SIDE_EFFECT(handler = _1);
+    ALLOW_CALL(*timer_impl, cancel());
+    time_point now;
+    ALLOW_CALL(mock_clock::instance(), now()).LR_RETURN(now);
+
+    voucher_queue<mock_voucher, mock_clock_traits> vq(ct);
+
+    // v1 and v3 share a slot of the wheel (64 slots of 1 s).
+    auto v1 = make_ref<mock_voucher>(time_point(100s));
+    auto v2 = make_ref<mock_voucher>(time_point(130s));
+    auto v3 = make_ref<mock_voucher>(time_point(164s));
+    vq.enqueue(v1);
+    vq.enqueue(v2);
+    vq.enqueue(v3);
+    REQUIRE(scheduled.size() == 1); // Later expirations do not reschedule.
+    CHECK(scheduled.back() == time_point(101s));
+
+    now = time_point(101s);
+    handler({});
+    CHECK_FALSE(v1->is_queued());
+    CHECK(v2->is_queued());
+    CHECK(v3->is_queued());
+    REQUIRE(scheduled.size() == 2);
+    CHECK(scheduled.back() == time_point(131s));
+
+    vq.drop(v2);
+    CHECK_FALSE(v2->is_queued());
+
+    now = time_point(131s);
+    handler({});
+    CHECK(v3->is_queued());
+    REQUIRE(scheduled.size() == 3);
+    CHECK(scheduled.back() == time_point(165s));
+
+    now = time_point(165s);
+    handler({});
+    CHECK_FALSE(v3->is_queued());
+    CHECK(vq.empty());
+    CHECK(scheduled.size() == 3);
+}
+
+TEST_CASE("voucher_queue: batching window") {
+    using namespace std::chrono_literals;
+    using trompeloeil::_;
+
+    mock_clock_traits ct;
+    auto timer_impl = std::make_shared<mock_timer_impl>();
+    mock_timer const timer{timer_impl};
+    ALLOW_CALL(ct, make_timer()).RETURN(timer);
+    std::vector<time_point> scheduled;
+    ALLOW_CALL(ct, make_timer(_))
+        .LR_SIDE_EFFECT(scheduled.push_back(_1))
+        .RETURN(timer);
+    std::function<void(boost::system::error_code)> handler;
+    ALLOW_CALL(*timer_impl, async_wait(_)).LR_SIDE_EFFECT(handler = _1);
+    ALLOW_CALL(*timer_impl, cancel());
+    time_point now;
+    ALLOW_CALL(mock_clock::instance(), now()).LR_RETURN(now);
+
+    voucher_queue<mock_voucher, mock_clock_traits> vq(ct, 100ms);
+
+    auto v1 = make_ref<mock_voucher>(time_point(100250ms));
+    auto v2 = make_ref<mock_voucher>(time_point(100290ms));
+    auto v3 = make_ref<mock_voucher>(time_point(100500ms));
+    vq.enqueue(v1);
+    vq.enqueue(v2);
+    vq.enqueue(v3);
+    REQUIRE(scheduled.size() == 1);
+    CHECK(scheduled.back() == time_point(100350ms));
+
+    // v1 and v2 are dropped by the same wakeup.
+    now = time_point(100350ms);
+    handler({});
+    CHECK_FALSE(v1->is_queued());
+    CHECK_FALSE(v2->is_queued());
+    CHECK(v3->is_queued());
+    REQUIRE(scheduled.size() == 2);
+    CHECK(scheduled.back() == time_point(100600ms));
+
+    now = time_point(100600ms);
+    handler({});
+    CHECK(vq.empty());
+}
+
 // NOLINTEND(readability-magic-numbers)
 
 } // namespace partake::daemon
@@ -7,14 +7,20 @@
 #pragma once
 
 #include "asio.hpp"
+#include "ref_counted.hpp"
 #include "time_point.hpp"
 
-#include <boost/heap/fibonacci_heap.hpp>
+#include <boost/intrusive/list.hpp>
 #include <gsl/pointers>
 
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <functional>
-#include <memory>
+#include <limits>
 #include <type_traits>
 #include <utility>
 
@@ -23,117 +29,206 @@ namespace partake::daemon {
 // Overridable traits to inject into voucher_queue. The time_point type is
 // fixed as it needs to be globally consistent.
 class steady_clock_traits {
-    gsl::not_null<asio::io_context *> asio_context;
+    asio::any_io_executor exec;
 
   public:
     using timer_type = asio::steady_timer;
     static_assert(std::is_same_v<clock, timer_type::clock_type>);
 
-    explicit steady_clock_traits(asio::io_context &context)
-        : asio_context(&context) {}
+    // Timer handlers are run by 'executor' (which may be a strand).
+    explicit steady_clock_traits(asio::any_io_executor executor)
+        : exec(std::move(executor)) {}
 
     static auto now() noexcept -> time_point { return clock::now(); }
 
-    auto make_timer() -> timer_type {
-        return asio::steady_timer(*asio_context);
-    }
+    auto make_timer() -> timer_type { return asio::steady_timer(exec); }
 
     auto make_timer(time_point tp) -> timer_type {
-        return asio::steady_timer(*asio_context, tp);
+        return asio::steady_timer(exec, tp);
     }
 };
 
+// Node embedded in each voucher, through which voucher_queue holds (and owns)
+// the voucher while it is queued.
+template <typename Object>
+struct voucher_queue_node : boost::intrusive::list_base_hook<> {
+    ref_ptr<Object> owner;
+    time_point expiration;
+};
+
+// Expiration queue for vouchers, implemented as a hashed timing wheel: each
+// voucher is linked (via its embedded node, so without allocation) into the
+// slot for its expiration time, at the granularity of the batching window.
+// Enqueuing and dropping are O(1). Expiration visits only the slots passed
+// since the last expiration, plus vouchers in them that are due in a later
+// revolution of the wheel (which are rare unless the TTL is much longer than
+// 64 windows).
+//
+// The expiration timer is scheduled one window after the earliest
+// expiration, so that vouchers expiring within a window are dropped by a
+// single wakeup. A shorter window drops expired vouchers (and releases their
+// objects) sooner; a longer one wakes up less often.
+//
+// The Object must provide as_voucher().queue_node() and
+// as_voucher().expiration().
 template <typename Object, typename ClockTraits = steady_clock_traits>
 class voucher_queue {
   public:
     using object_type = Object; // May be incomplete type.
     using clock_traits_type = ClockTraits;
+    using node_type = voucher_queue_node<object_type>;
 
   private:
-    using element_type = std::pair<time_point, std::shared_ptr<object_type>>;
+    using slot_type = boost::intrusive::list<node_type>;
+
+    // Extra delay when scheduling expiration task, to avoid waking up on every
+    // voucher expiration. Also used as the slot granularity.
+    clock::duration slot_duration;
+    static constexpr std::size_t slot_count = 64;
+    static_assert(slot_count <= 64); // Bits of nonempty_slots
+
+    std::array<slot_type, slot_count> slots;
+    std::uint64_t nonempty_slots = 0; // Bit i set iff slots[i] not empty
+    std::size_t cnt = 0;
+
+    // Slots for ticks before this have been visited since anything was
+    // enqueued in them.
+    std::int64_t first_unvisited_tick =
+        std::numeric_limits<std::int64_t>::max();
 
-    struct element_compare {
-        auto operator()(element_type const &lhs,
-                        element_type const &rhs) const noexcept {
-            // Sort earlier time points to front of max-heap.
-            return std::greater{}(lhs.first, rhs.first);
-        }
-    };
-
-    // We use a Fibonacci heap (priority queue) for the voucher expiration
-    // queue. It is ideal because it allows erasure of elements given a
-    // pointer, and has good time complexity for our use case: insertion is
-    // constant, deletion is amortized log N but in practice constant if no
-    // pop-min has been performed since insertion. Pop-min is log N, but can be
-    // avoided by apps that do not let vouchers expire.
-    using queue_impl_type =
-        boost::heap::fibonacci_heap<element_type,
-                                    boost::heap::compare<element_compare>>;
-    // TODO Consider using std::pmr::unsynchronized_pool_resource-based
-    // allocator (but must measure to justify).
-
-    queue_impl_type queue;
     gsl::not_null<clock_traits_type *> clk_traits;
     typename clock_traits_type::timer_type expiration_timer;
     time_point expiration_scheduled_time = time_point::max();
 
-    // Extra delay when scheduling expiration task, to avoid waking up on every
-    // voucher expiration.
-    // TODO Make configurable.
-    static constexpr auto expiration_extra_delay = std::chrono::seconds(1);
-
   public:
-    using handle_type = typename queue_impl_type::handle_type;
+    static constexpr auto default_batching_window = std::chrono::seconds(1);
+
+    // The 'batching_window' must be positive.
+    explicit voucher_queue(
+        clock_traits_type &clock_traits,
+        clock::duration batching_window = default_batching_window)
+        : slot_duration(batching_window), clk_traits(&clock_traits),
+          expiration_timer(clk_traits->make_timer()) {
+        assert(slot_duration > clock::duration::zero());
+    }
 
-    explicit voucher_queue(clock_traits_type &clock_traits)
-        : clk_traits(&clock_traits),
-          expiration_timer(clk_traits->make_timer()) {}
+    ~voucher_queue() { unlink_all(); }
 
-    ~voucher_queue() = default;
     voucher_queue(voucher_queue const &) = delete;
     auto operator=(voucher_queue const &) = delete;
     voucher_queue(voucher_queue &&) = delete;
     auto operator=(voucher_queue &&) = delete;
 
-    [[nodiscard]] auto empty() const noexcept -> bool { return queue.empty(); }
-
-    void enqueue(std::shared_ptr<object_type> const &voucher) {
-        auto exp = voucher->as_voucher().expiration();
-        handle_type const h = queue.push({exp, voucher});
-        voucher->as_voucher().set_queued(h);
+    [[nodiscard]] auto empty() const noexcept -> bool { return cnt == 0; }
+
+    void enqueue(ref_ptr<object_type> const &voucher) {
+        auto &node = voucher->as_voucher().queue_node();
+        assert(not node.is_linked());
+        auto const exp = voucher->as_voucher().expiration();
+        node.owner = voucher;
+        node.expiration = exp;
+        auto const t = tick_of(exp);
+        auto const i = slot_index(t);
+        slots[i].push_back(node);
+        nonempty_slots |= std::uint64_t(1) << i;
+        ++cnt;
+        first_unvisited_tick = std::min(first_unvisited_tick, t);
         schedule_expiration(exp);
     }
 
-    void drop(std::shared_ptr<object_type> const &voucher) {
-        auto h = voucher->as_voucher().clear_queued();
-        if (h.has_value())
-            queue.erase(h.value());
+    void drop(ref_ptr<object_type> const &voucher) {
+        auto &node = voucher->as_voucher().queue_node();
+        if (node.is_linked())
+            unlink(node);
         // Let expiration timer reschedule (if necessary) when it activates.
     }
 
     void drop_all() {
         expiration_timer.cancel();
         expiration_scheduled_time = time_point::max();
-        for (auto const &[e, v] : queue)
-            v->as_voucher().clear_queued();
-        queue.clear();
+        unlink_all();
     }
 
   private:
+    [[nodiscard]] auto tick_of(time_point tp) const noexcept
+        -> std::int64_t {
+        auto const d = tp.time_since_epoch();
+        auto tick = static_cast<std::int64_t>(d / slot_duration);
+        if (d < d.zero() && d % slot_duration != d.zero())
+            --tick; // Round toward negative infinity
+        return tick;
+    }
+
+    static auto slot_index(std::int64_t tick) noexcept -> std::size_t {
+        auto const n = static_cast<std::int64_t>(slot_count);
+        return static_cast<std::size_t>(((tick % n) + n) % n);
+    }
+
+    [[nodiscard]] auto start_of_tick(std::int64_t tick) const noexcept
+        -> time_point {
+        return time_point(std::chrono::duration_cast<time_point::duration>(
+            slot_duration * tick));
+    }
+
+    void unlink(node_type &node) {
+        auto const i = slot_index(tick_of(node.expiration));
+        auto &slot = slots[i];
+        slot.erase(slot.iterator_to(node));
+        if (slot.empty())
+            nonempty_slots &= ~(std::uint64_t(1) << i);
+        --cnt;
+        // Releasing ownership may destroy the voucher, including 'node'.
+        auto owner = std::move(node.owner);
+    }
+
+    void unlink_all() {
+        for (auto &slot : slots) {
+            while (not slot.empty())
+                unlink(slot.front());
+        }
+        first_unvisited_tick = std::numeric_limits<std::int64_t>::max();
+    }
+
     void drop_expired(time_point now) {
-        // In theory we could also drop vouchers that are invalid for reasons
-        // other than expiration. However, it would likely be slow to do that
-        // here. Also, vouchers with no remaining count will have been removed
-        // at the time of claim. The only vouchers that could remain are those
-        // targetting objects that were subsequently unshared. At least for
-        // now, we let such vouchers linger until they expire based on time,
-        // because eagerly dropping them here would require scanning the whole
-        // queue, which may be more work than we want to perform here.
-        while (not queue.empty() && queue.top().first <= now) {
-            auto const &voucher = queue.top().second;
-            voucher->as_voucher().clear_queued();
-            queue.pop();
+        // Vouchers with no remaining count will have been removed at the
+        // time of claim, so only expiration needs to be handled here.
+        // Vouchers that expired since their slot was last visited are also
+        // dropped early when their target is unshared (see
+        // repository::drop_stale_vouchers(), which finds them through the
+        // target's voucher_list rather than by scanning the queue).
+        auto const now_tick = tick_of(now);
+        if (first_unvisited_tick > now_tick)
+            return;
+        auto const n = static_cast<std::int64_t>(slot_count);
+        auto const first = std::max(first_unvisited_tick, now_tick - n + 1);
+        for (auto t = first; t <= now_tick; ++t) {
+            auto &slot = slots[slot_index(t)];
+            for (auto it = slot.begin(); it != slot.end();) {
+                auto &node = *it++;
+                if (node.expiration <= now)
+                    unlink(node);
+            }
         }
+        // The current slot may still contain unexpired vouchers.
+        first_unvisited_tick = now_tick;
+    }
+
+    // Return a time no later than the earliest expiration (assuming 'now' is
+    // no earlier than the last call to drop_expired()), or time_point::max()
+    // if empty.
+    [[nodiscard]] auto next_expiration_bound(time_point now) const noexcept
+        -> time_point {
+        if (nonempty_slots == 0)
+            return time_point::max();
+        auto const now_tick = tick_of(now);
+        auto const start = slot_index(now_tick);
+        std::size_t k = 0;
+        while ((nonempty_slots & (std::uint64_t(1)
+                                  << ((start + k) % slot_count))) == 0)
+            ++k;
+        if (k == 0)
+            return now;
+        return start_of_tick(now_tick + static_cast<std::int64_t>(k));
     }
 
     void schedule_expiration(time_point expiration) {
@@ -142,14 +237,15 @@ class voucher_queue {
 
         expiration_timer.cancel();
 
-        expiration_scheduled_time = expiration + expiration_extra_delay;
+        expiration_scheduled_time = expiration + slot_duration;
         expiration_timer = clk_traits->make_timer(expiration_scheduled_time);
         expiration_timer.async_wait([this](boost::system::error_code err) {
             if (not err) {
                 expiration_scheduled_time = time_point::max();
-                drop_expired(clock_traits_type::now());
-                if (not queue.empty())
-                    schedule_expiration(queue.top().first);
+                auto const now = clock_traits_type::now();
+                drop_expired(now);
+                if (not empty())
+                    schedule_expiration(next_expiration_bound(now));
             }
         });
     }
@@ -0,0 +1,90 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "wait_deadline_queue.hpp"
+
+#include <doctest.h>
+
+#include <chrono>
+#include <vector>
+
+namespace partake::daemon {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("wait_deadline_queue") {
+    using std::chrono::milliseconds;
+    wait_deadline_queue q;
+    int const owner1 = 0;
+    int const owner2 = 0;
+    std::vector<int> expired;
+    auto const t0 = time_point();
+    auto const expirer = [&](int i) {
+        return [&, i] { expired.push_back(i); };
+    };
+
+    CHECK(q.next_deadline() == time_point::max());
+    auto const id1 = q.new_id();
+    auto const id2 = q.new_id();
+    auto const id3 = q.new_id();
+    CHECK(id1 != 0);
+    CHECK(id1 != id2);
+    q.add(&owner1, id1, t0 + milliseconds(30), expirer(1));
+    q.add(&owner2, id2, t0 + milliseconds(10), expirer(2));
+    q.add(&owner1, id3, t0 + milliseconds(20), expirer(3));
+    CHECK(q.size() == 3);
+    CHECK(q.next_deadline() == t0 + milliseconds(10));
+
+    SUBCASE("expired in deadline order") {
+        CHECK(q.expire(t0 + milliseconds(5)) == 0);
+        CHECK(q.expire(t0 + milliseconds(20)) == 2);
+        CHECK(expired == std::vector<int>{2, 3});
+        CHECK(q.next_deadline() == t0 + milliseconds(30));
+        CHECK(q.expire(t0 + milliseconds(100)) == 1);
+        CHECK(expired == std::vector<int>{2, 3, 1});
+        CHECK(q.size() == 0);
+    }
+
+    SUBCASE("canceled") {
+        q.cancel(id2);
+        q.cancel(id2);
+        CHECK(q.size() == 2);
+        CHECK(q.next_deadline() == t0 + milliseconds(20));
+        CHECK(q.expire(t0 + milliseconds(100)) == 2);
+        CHECK(expired == std::vector<int>{3, 1});
+        q.cancel(id1); // Already expired
+    }
+
+    SUBCASE("dropped by owner") {
+        q.drop(&owner1);
+        CHECK(q.size() == 1);
+        q.drop(&owner1); // No effect
+        q.cancel(id1);
+        CHECK(q.expire(t0 + milliseconds(100)) == 1);
+        CHECK(expired == std::vector<int>{2});
+        q.drop(&owner2); // Already expired
+
+        auto const id4 = q.new_id();
+        q.add(&owner1, id4, t0 + milliseconds(200), expirer(4));
+        q.cancel(id4);
+        q.drop(&owner1);
+        CHECK(q.size() == 0);
+    }
+
+    SUBCASE("expiration may cancel") {
+        auto const id4 = q.new_id();
+        q.add(&owner2, id4, t0 + milliseconds(15), [&] {
+            expired.push_back(4);
+            q.cancel(id3);
+        });
+        CHECK(q.expire(t0 + milliseconds(100)) == 3);
+        CHECK(expired == std::vector<int>{2, 4, 1});
+    }
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::daemon
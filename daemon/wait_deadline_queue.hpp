@@ -0,0 +1,130 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "small_function.hpp"
+#include "time_point.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+namespace partake::daemon {
+
+// Deadlines of waiting requests (Open and Unshare with a timeout, from all
+// sessions). When a request completes before its deadline, the session
+// cancels the deadline; otherwise expire() (called from a timer set for
+// next_deadline()) calls its expiration function, which completes the
+// request with a timeout status. Sessions also keep the expiration of their
+// lease on leased opens here (see session::renew_leases()).
+//
+// Ids are obtained from new_id() before adding, so that they can be captured
+// by the pending request that must cancel the deadline.
+class wait_deadline_queue {
+  public:
+    using id_type = std::uint64_t; // Never 0
+    using expire_func = small_function<void()>;
+
+  private:
+    struct entry {
+        void const *owner;
+        expire_func expire;
+    };
+
+    struct deadline {
+        time_point when;
+        void const *owner;
+    };
+
+    std::map<std::pair<time_point, id_type>, entry> entries;
+    std::unordered_map<id_type, deadline> deadlines;
+    // So that drop() need not visit the deadlines of other owners (with
+    // leases, every session may have one).
+    std::unordered_map<void const *, std::unordered_set<id_type>> by_owner;
+    id_type next = 1;
+
+    void forget(id_type id, void const *owner) {
+        deadlines.erase(id);
+        auto const it = by_owner.find(owner);
+        it->second.erase(id);
+        if (it->second.empty())
+            by_owner.erase(it);
+    }
+
+  public:
+    wait_deadline_queue() = default;
+
+    // No move or copy (expiration functions may refer to the queue's owner)
+    ~wait_deadline_queue() = default;
+    wait_deadline_queue(wait_deadline_queue const &) = delete;
+    auto operator=(wait_deadline_queue const &) = delete;
+    wait_deadline_queue(wait_deadline_queue &&) = delete;
+    auto operator=(wait_deadline_queue &&) = delete;
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return entries.size();
+    }
+
+    [[nodiscard]] auto new_id() noexcept -> id_type { return next++; }
+
+    void add(void const *owner, id_type id, time_point deadline,
+             expire_func expire) {
+        entries.emplace(std::pair(deadline, id),
+                        entry{owner, std::move(expire)});
+        deadlines.emplace(id, wait_deadline_queue::deadline{deadline, owner});
+        by_owner[owner].insert(id);
+    }
+
+    // Remove the deadline without calling its expiration function. No-op if
+    // it has already expired or been canceled.
+    void cancel(id_type id) {
+        auto const it = deadlines.find(id);
+        if (it == deadlines.end())
+            return;
+        entries.erase(std::pair(it->second.when, id));
+        forget(id, it->second.owner);
+    }
+
+    // Remove all deadlines of 'owner', without calling them.
+    void drop(void const *owner) {
+        auto const it = by_owner.find(owner);
+        if (it == by_owner.end())
+            return;
+        for (auto const id : it->second) {
+            auto const dl = deadlines.find(id);
+            entries.erase(std::pair(dl->second.when, id));
+            deadlines.erase(dl);
+        }
+        by_owner.erase(it);
+    }
+
+    // Earliest deadline; time_point::max() if none.
+    [[nodiscard]] auto next_deadline() const noexcept -> time_point {
+        if (entries.empty())
+            return time_point::max();
+        return entries.begin()->first.first;
+    }
+
+    // Call the expiration functions of deadlines not later than 'now', in
+    // order. Each is removed before being called, so it may add or cancel
+    // deadlines. Return the number expired.
+    auto expire(time_point now) -> std::size_t {
+        std::size_t n = 0;
+        while (not entries.empty() && entries.begin()->first.first <= now) {
+            auto node = entries.extract(entries.begin());
+            forget(node.key().second, node.mapped().owner);
+            node.mapped().expire();
+            ++n;
+        }
+        return n;
+    }
+};
+
+} // namespace partake::daemon
@@ -0,0 +1,186 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "cli.hpp"
+
+#include <CLI/CLI.hpp>
+#include <doctest.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <map>
+#include <string>
+
+namespace partake::loadgen {
+
+namespace {
+
+struct cli_args {
+    std::string socket;
+    pattern pat = pattern::voucher;
+    unsigned producers = 1;
+    unsigned consumers = 1;
+    std::size_t size = 4096;
+    double duration = 10.0;
+    std::size_t queue_depth = 64;
+    bool no_touch = false;
+};
+
+constexpr auto partake_version =
+#ifdef PARTAKE_VERSION
+#define PARTAKE_STRINGIFY_INTERNAL(s) #s                   // NOLINT
+#define PARTAKE_STRINGIFY(s) PARTAKE_STRINGIFY_INTERNAL(s) // NOLINT
+    PARTAKE_STRINGIFY(PARTAKE_VERSION);
+#else
+    "development build";
+#endif
+
+constexpr auto extra_help =
+    R"(Patterns:
+  --pattern=voucher: Producers allocate an object, write it, share it
+      with a voucher, and close it; consumers open the voucher, read
+      the object, and close it (default).
+  --pattern=unshare: Each producer keeps one object, which it writes,
+      shares with a voucher, and unshares (waiting for the consumer to
+      close it) in a loop.
+  --pattern=primitive: As voucher, but with PRIMITIVE objects.
+  Vouchers are passed from producers to consumers through an in-process
+  queue (--queue-depth).
+
+Report:
+  Throughput is the number of objects consumed per second. Latencies
+  are of round trips to partaked, by operation.
+)";
+
+auto parse_cli_args_unvalidated(int argc, char const *const *argv)
+    -> tl::expected<cli_args, int> {
+    using namespace std::string_literals;
+
+    cli_args ret;
+
+    CLI::App app;
+    app.option_defaults()->disable_flag_override();
+    app.description("Load generator for partaked.\n");
+    app.footer(extra_help);
+    app.get_formatter()->column_width(26); // NOLINT(readability-magic-numbers)
+
+    app.add_option("-s,--socket", ret.socket,
+                   "Filename of socket for connecting to partaked")
+        ->type_name("NAME")
+        ->required();
+
+    app.add_option("--pattern", ret.pat, "Workload pattern (default: voucher)")
+        ->type_name("NAME")
+        ->transform(CLI::CheckedTransformer(
+            std::map<std::string, pattern>{
+                {"voucher", pattern::voucher},
+                {"unshare", pattern::unshare},
+                {"primitive", pattern::primitive},
+            },
+            CLI::ignore_case));
+
+    app.add_option("-p,--producers", ret.producers,
+                   "Number of producer connections (default: 1)")
+        ->type_name("COUNT");
+
+    app.add_option("-c,--consumers", ret.consumers,
+                   "Number of consumer connections (default: 1)")
+        ->type_name("COUNT");
+
+    app.add_option("--size", ret.size, "Object size (default: 4096)")
+        ->type_name("BYTES");
+
+    app.add_option("-d,--duration", ret.duration,
+                   "Duration of load (default: 10)")
+        ->type_name("SECONDS");
+
+    app.add_option("--queue-depth", ret.queue_depth,
+                   "Maximum vouchers in flight (default: 64)")
+        ->type_name("COUNT");
+
+    app.add_flag("--no-touch", ret.no_touch,
+                 "Do not map segments or write/read object data");
+
+    app.set_help_flag("-h,--help", "Display this help and exit"s);
+    app.set_version_flag("-V,--version",
+                         "partake-loadgen "s + partake_version);
+
+    try {
+        app.parse(argc, argv);
+        return ret;
+    } catch (CLI::ParseError const &err) { // Includes --help, --version
+        return tl::unexpected(app.exit(err));
+    }
+}
+
+auto validate_cli_args(cli_args const &args)
+    -> tl::expected<loadgen_config, std::string> {
+    using namespace std::string_literals;
+    loadgen_config ret;
+
+    if (args.socket.empty())
+        return tl::unexpected("--socket is required"s);
+    ret.socket = args.socket;
+    ret.pat = args.pat;
+
+    if (args.producers == 0 || args.consumers == 0)
+        return tl::unexpected("--producers and --consumers must be positive"s);
+    ret.producers = args.producers;
+    ret.consumers = args.consumers;
+
+    if (args.size == 0)
+        return tl::unexpected("--size must be positive"s);
+    ret.object_size = args.size;
+
+    if (not(args.duration > 0.0) || not std::isfinite(args.duration))
+        return tl::unexpected("--duration must be positive"s);
+    ret.duration = std::chrono::milliseconds(
+        static_cast<std::chrono::milliseconds::rep>(
+            std::ceil(args.duration * 1000.0)));
+
+    if (args.queue_depth == 0)
+        return tl::unexpected("--queue-depth must be positive"s);
+    ret.queue_depth = args.queue_depth;
+
+    ret.touch = not args.no_touch;
+    return ret;
+}
+
+} // namespace
+
+TEST_CASE("loadgen: validate_cli_args") {
+    cli_args args;
+    CHECK_FALSE(validate_cli_args(args).has_value());
+    args.socket = "sock";
+    auto cfg = validate_cli_args(args);
+    REQUIRE(cfg.has_value());
+    CHECK(cfg->duration == std::chrono::seconds(10));
+    CHECK(cfg->touch);
+
+    args.duration = 0.0;
+    CHECK_FALSE(validate_cli_args(args).has_value());
+    args.duration = 0.0001;
+    CHECK(validate_cli_args(args)->duration == std::chrono::milliseconds(1));
+    args.consumers = 0;
+    CHECK_FALSE(validate_cli_args(args).has_value());
+}
+
+auto parse_cli_args(int argc, char const *const *argv)
+    -> tl::expected<loadgen_config, int> {
+    return parse_cli_args_unvalidated(argc, argv)
+        .and_then([](cli_args const &args) {
+            return validate_cli_args(args).map_error(
+                [](std::string const &msg) {
+                    std::cerr << msg << '\n';
+                    std::cerr << "Run with --help for more information.\n";
+                    return 1;
+                });
+        });
+}
+
+} // namespace partake::loadgen
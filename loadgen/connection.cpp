@@ -0,0 +1,124 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "connection.hpp"
+
+#include "message.hpp"
+
+#include <fmt/core.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+#include <unistd.h>
+
+namespace partake::loadgen {
+
+connection::connection()
+    : sock(ioctx), readbuf(2 * common::max_message_frame_len) {}
+
+auto connection::connect(std::string const &socket_path, std::string_view name)
+    -> tl::expected<void, std::string> {
+    boost::system::error_code err;
+    sock.connect(asio::local::stream_protocol::endpoint(socket_path), err);
+    if (err) {
+        return tl::unexpected(
+            fmt::format("cannot connect to {}: {}", socket_path,
+                        err.message()));
+    }
+
+    auto status = protocol::Status::OK;
+    return roundtrip(
+               [&](request_batch &b) {
+                   auto &f = b.builder();
+                   b.add(protocol::CreateHelloRequest(
+                       f, static_cast<std::uint32_t>(::getpid()),
+                       f.CreateString(name.data(), name.size())));
+               },
+               [&](protocol::Response const *resp) {
+                   status = resp->status();
+               })
+        .and_then([&]() -> tl::expected<void, std::string> {
+            if (status != protocol::Status::OK) {
+                return tl::unexpected(
+                    fmt::format("hello failed: {}",
+                                protocol::EnumNameStatus(status)));
+            }
+            return {};
+        });
+}
+
+void connection::disconnect() {
+    if (not sock.is_open())
+        return;
+    fbb.Clear();
+    auto batch = request_batch(fbb, next_seqno);
+    batch.add(protocol::CreateQuitRequest(fbb));
+    fbb.FinishSizePrefixed(protocol::CreateRequestMessage(
+        fbb, fbb.CreateVector(batch.requests())));
+    (void)write_message(gsl::span<std::uint8_t const>(fbb.GetBufferPointer(),
+                                                      fbb.GetSize()));
+    boost::system::error_code ignored;
+    sock.shutdown(asio::local::stream_protocol::socket::shutdown_both,
+                  ignored);
+    sock.close(ignored);
+}
+
+auto connection::write_message(gsl::span<std::uint8_t const> msg)
+    -> tl::expected<void, std::string> {
+    // As with async_message_writer, pad to the frame alignment.
+    static constexpr std::array<std::uint8_t, common::message_frame_alignment>
+        zeros{};
+    auto const pad =
+        common::internal::round_size_up_to_alignment(msg.size()) - msg.size();
+    std::array<asio::const_buffer, 2> const bufs{
+        asio::buffer(msg.data(), msg.size()),
+        asio::buffer(zeros.data(), pad)};
+    boost::system::error_code err;
+    asio::write(sock, bufs, err);
+    if (err)
+        return tl::unexpected(fmt::format("write: {}", err.message()));
+    return {};
+}
+
+auto connection::read_message()
+    -> tl::expected<gsl::span<std::uint8_t const>, std::string> {
+    for (;;) {
+        auto const avail = gsl::span<std::uint8_t const>(readbuf).subspan(
+            data_start, data_end - data_start);
+        auto const frame_size =
+            common::internal::read_message_frame_size(avail);
+        if (frame_size > common::max_message_frame_len)
+            return tl::unexpected(std::string("response message too long"));
+        if (frame_size > 0 && frame_size <= avail.size()) {
+            auto const frame = avail.first(frame_size);
+            data_start += frame_size;
+            auto verifier =
+                flatbuffers::Verifier(frame.data(), frame.size());
+            if (not verifier.VerifySizePrefixedBuffer<
+                    protocol::ResponseMessage>(nullptr))
+                return tl::unexpected(std::string("invalid response message"));
+            return frame;
+        }
+
+        // Move the partial frame to the front and read more.
+        std::copy(readbuf.begin() + static_cast<std::ptrdiff_t>(data_start),
+                  readbuf.begin() + static_cast<std::ptrdiff_t>(data_end),
+                  readbuf.begin());
+        data_end -= data_start;
+        data_start = 0;
+        boost::system::error_code err;
+        auto const n = sock.read_some(
+            asio::buffer(readbuf.data() + data_end, readbuf.size() - data_end),
+            err);
+        if (err)
+            return tl::unexpected(fmt::format("read: {}", err.message()));
+        data_end += n;
+    }
+}
+
+} // namespace partake::loadgen
@@ -0,0 +1,135 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "asio.hpp"
+#include "partake_protocol_generated.h"
+
+#include <flatbuffers/flatbuffers.h>
+#include <gsl/span>
+#include <tl/expected.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace partake::loadgen {
+
+// Requests to be sent together in one RequestMessage.
+class request_batch {
+    flatbuffers::FlatBufferBuilder *fbb;
+    std::uint64_t *next_seqno;
+    std::vector<flatbuffers::Offset<protocol::Request>> reqs;
+
+  public:
+    explicit request_batch(flatbuffers::FlatBufferBuilder &builder,
+                           std::uint64_t &seqno_counter)
+        : fbb(&builder), next_seqno(&seqno_counter) {}
+
+    [[nodiscard]] auto builder() noexcept -> flatbuffers::FlatBufferBuilder & {
+        return *fbb;
+    }
+
+    // Add a request (which must have been built with builder()) and return
+    // its seqno.
+    template <typename R> auto add(flatbuffers::Offset<R> request) {
+        auto const seqno = (*next_seqno)++;
+        reqs.push_back(protocol::CreateRequest(
+            *fbb, seqno, protocol::AnyRequestTraits<R>::enum_value,
+            request.Union()));
+        return seqno;
+    }
+
+    [[nodiscard]] auto size() const noexcept -> std::size_t {
+        return reqs.size();
+    }
+
+    [[nodiscard]] auto requests() const noexcept
+        -> std::vector<flatbuffers::Offset<protocol::Request>> const & {
+        return reqs;
+    }
+};
+
+// A blocking connection to partaked, for use by a single thread. Each round
+// trip sends one RequestMessage and waits until every request in it has been
+// responded to (possibly in several ResponseMessages).
+class connection {
+    asio::io_context ioctx;
+    asio::local::stream_protocol::socket sock;
+    std::vector<std::uint8_t> readbuf;
+    std::size_t data_start = 0; // Start of unhandled data
+    std::size_t data_end = 0;   // End of data read so far
+    std::uint64_t next_seqno = 1;
+    flatbuffers::FlatBufferBuilder fbb;
+
+  public:
+    connection();
+
+    // No move or copy (socket refers to ioctx)
+    ~connection() = default;
+    connection(connection const &) = delete;
+    auto operator=(connection const &) = delete;
+    connection(connection &&) = delete;
+    auto operator=(connection &&) = delete;
+
+    // Connect and send Hello.
+    auto connect(std::string const &socket_path, std::string_view name)
+        -> tl::expected<void, std::string>;
+
+    // Send Quit and close the socket.
+    void disconnect();
+
+    // Call 'add_requests' with a request_batch to fill, send the batch, and
+    // call 'handle_response' with each protocol::Response const * until all
+    // have been received.
+    template <typename AddRequests, typename HandleResponse>
+    auto roundtrip(AddRequests add_requests, HandleResponse handle_response)
+        -> tl::expected<void, std::string> {
+        fbb.Clear();
+        auto batch = request_batch(fbb, next_seqno);
+        add_requests(batch);
+        auto const count = batch.size();
+        fbb.FinishSizePrefixed(protocol::CreateRequestMessage(
+            fbb, fbb.CreateVector(batch.requests())));
+        auto written = write_message(
+            gsl::span<std::uint8_t const>(fbb.GetBufferPointer(),
+                                          fbb.GetSize()));
+        if (not written)
+            return written;
+
+        std::size_t received = 0;
+        while (received < count) {
+            auto msg = read_message();
+            if (not msg)
+                return tl::unexpected(std::move(msg).error());
+            auto const *resps = flatbuffers::GetSizePrefixedRoot<
+                                    protocol::ResponseMessage>(msg->data())
+                                    ->responses();
+            if (resps == nullptr)
+                continue;
+            for (auto const *resp : *resps) {
+                handle_response(resp);
+                ++received;
+            }
+        }
+        return {};
+    }
+
+  private:
+    auto write_message(gsl::span<std::uint8_t const> msg)
+        -> tl::expected<void, std::string>;
+
+    // Return the next (verified) ResponseMessage frame, which remains valid
+    // until the next call.
+    auto read_message() -> tl::expected<gsl::span<std::uint8_t const>,
+                                        std::string>;
+};
+
+} // namespace partake::loadgen
@@ -0,0 +1,40 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "latency_recorder.hpp"
+
+#include <doctest.h>
+
+namespace partake::loadgen {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("latency_recorder") {
+    using namespace std::chrono_literals;
+    latency_recorder r;
+    CHECK(r.count() == 0);
+    CHECK(r.quantile(0.5) == 0ns);
+
+    for (int i = 100; i > 0; --i)
+        r.record(std::chrono::nanoseconds(i));
+    CHECK(r.count() == 100);
+    CHECK(r.quantile(0.0) == 1ns);
+    CHECK(r.quantile(0.5) == 50ns);
+    CHECK(r.quantile(0.99) == 99ns);
+    CHECK(r.quantile(0.999) == 100ns);
+    CHECK(r.quantile(1.0) == 100ns);
+
+    latency_recorder s;
+    s.record(1000ns);
+    r.merge(s);
+    CHECK(r.count() == 101);
+    CHECK(r.quantile(1.0) == 1000ns);
+    CHECK(r.quantile(0.5) == 51ns);
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::loadgen
@@ -0,0 +1,55 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace partake::loadgen {
+
+// Records every sample, so that quantiles are exact. (At a few million round
+// trips per second, this is tens of MiB per minute per operation type.)
+class latency_recorder {
+    std::vector<std::chrono::nanoseconds> samples;
+    bool sorted = true;
+
+  public:
+    void record(std::chrono::nanoseconds latency) {
+        if (not samples.empty() && latency < samples.back())
+            sorted = false;
+        samples.push_back(latency);
+    }
+
+    void merge(latency_recorder const &other) {
+        samples.insert(samples.end(), other.samples.begin(),
+                       other.samples.end());
+        sorted = false;
+    }
+
+    [[nodiscard]] auto count() const noexcept -> std::size_t {
+        return samples.size();
+    }
+
+    // Return the sample at quantile 'q' (0.0-1.0; nearest rank), or zero if
+    // empty.
+    [[nodiscard]] auto quantile(double q) -> std::chrono::nanoseconds {
+        if (samples.empty())
+            return {};
+        if (not sorted) {
+            std::sort(samples.begin(), samples.end());
+            sorted = true;
+        }
+        auto const rank = static_cast<std::size_t>(
+            std::ceil(std::clamp(q, 0.0, 1.0) * double(samples.size())));
+        return samples[std::max<std::size_t>(rank, 1) - 1];
+    }
+};
+
+} // namespace partake::loadgen
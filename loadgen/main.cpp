@@ -0,0 +1,31 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "cli.hpp"
+#include "workload.hpp"
+
+#include <iostream>
+
+namespace {
+
+using namespace partake::loadgen;
+
+auto run(loadgen_config const &cfg) -> tl::expected<void, int> {
+    auto result = run_load(cfg);
+    if (not result) {
+        std::cerr << result.error() << '\n';
+        return tl::unexpected(1);
+    }
+    print_report(cfg, *result);
+    return {};
+}
+
+} // namespace
+
+auto main(int argc, char const *const argv[]) -> int {
+    auto const result = parse_cli_args(argc, argv).and_then(run);
+    return result.has_value() ? 0 : result.error();
+}
@@ -0,0 +1,37 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "token_queue.hpp"
+
+#include <doctest.h>
+
+#include <thread>
+
+namespace partake::loadgen {
+
+// NOLINTBEGIN(readability-magic-numbers)
+
+TEST_CASE("token_queue") {
+    token_queue q(2);
+    CHECK(q.push(1));
+    CHECK(q.push(2));
+
+    std::thread producer([&] { CHECK(q.push(3)); }); // Blocks until pop
+    CHECK(q.pop() == 1);
+    producer.join();
+    CHECK(q.pop() == 2);
+    CHECK(q.pop() == 3);
+
+    CHECK(q.push(4));
+    q.close();
+    CHECK_FALSE(q.push(5));
+    CHECK(q.pop() == 4); // Drained after close
+    CHECK_FALSE(q.pop().has_value());
+}
+
+// NOLINTEND(readability-magic-numbers)
+
+} // namespace partake::loadgen
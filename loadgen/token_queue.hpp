@@ -0,0 +1,64 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace partake::loadgen {
+
+// Bounded blocking queue through which producers hand keys (vouchers) to
+// consumers, standing in for whatever channel applications use.
+class token_queue {
+    std::mutex mut;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+    std::deque<std::uint64_t> keys;
+    std::size_t cap;
+    bool closed = false;
+
+  public:
+    explicit token_queue(std::size_t capacity) : cap(capacity) {}
+
+    // Block while full. Return false if closed.
+    auto push(std::uint64_t key) -> bool {
+        std::unique_lock lock(mut);
+        not_full.wait(lock, [&] { return closed || keys.size() < cap; });
+        if (closed)
+            return false;
+        keys.push_back(key);
+        not_empty.notify_one();
+        return true;
+    }
+
+    // Block while empty. Return nullopt once closed and drained.
+    auto pop() -> std::optional<std::uint64_t> {
+        std::unique_lock lock(mut);
+        not_empty.wait(lock, [&] { return closed || not keys.empty(); });
+        if (keys.empty())
+            return std::nullopt;
+        auto const key = keys.front();
+        keys.pop_front();
+        not_full.notify_one();
+        return key;
+    }
+
+    // Wake all waiters; pushes fail from now on but queued keys can still
+    // be popped.
+    void close() {
+        std::lock_guard lock(mut);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+};
+
+} // namespace partake::loadgen
@@ -0,0 +1,517 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "workload.hpp"
+
+#include "connection.hpp"
+#include "segment_cache.hpp"
+#include "token_queue.hpp"
+
+#include <doctest.h>
+#include <fmt/core.h>
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace partake::loadgen {
+
+auto operation_name(operation op) noexcept -> std::string_view {
+    switch (op) {
+    case operation::alloc:
+        return "alloc";
+    case operation::publish:
+        return "publish";
+    case operation::unshare:
+        return "unshare";
+    case operation::open:
+        return "open";
+    case operation::close:
+        return "close";
+    }
+    return "unknown";
+}
+
+TEST_CASE("operation_name") {
+    CHECK(operation_name(operation::alloc) == "alloc");
+    CHECK(operation_name(operation::close) == "close");
+}
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+struct object_mapping {
+    std::uint64_t key = 0;
+    std::uint32_t segment = 0;
+    std::uint64_t offset = 0;
+};
+
+auto status_error(std::string_view what, protocol::Status status)
+    -> tl::unexpected<std::string> {
+    return tl::unexpected(fmt::format("{}: unexpected status {}", what,
+                                      protocol::EnumNameStatus(status)));
+}
+
+// State common to producers and consumers.
+class worker {
+  protected:
+    loadgen_config const *cfg;
+    std::unique_ptr<connection> conn;
+    client::segment_cache segments;
+    worker_stats stat;
+
+    explicit worker(loadgen_config const &config,
+                    std::unique_ptr<connection> &&client_connection)
+        : cfg(&config), conn(std::move(client_connection)) {}
+
+    template <typename AddRequests, typename HandleResponse>
+    auto timed_roundtrip(operation op, AddRequests add_requests,
+                         HandleResponse handle_response)
+        -> tl::expected<void, std::string> {
+        auto const start = clock::now();
+        auto ret = conn->roundtrip(add_requests, handle_response);
+        stat.latency(op).record(clock::now() - start);
+        return ret;
+    }
+
+    // Return the object's address, mapping its segment if necessary.
+    auto object_data(object_mapping const &obj)
+        -> tl::expected<std::uint8_t *, std::string> {
+        if (auto *base = segments.find(obj.segment); base != nullptr)
+            return base + obj.offset;
+        if (segments.is_known(obj.segment))
+            return map_known_segment(obj);
+
+        auto status = protocol::Status::OK;
+        tl::expected<std::uint8_t *, std::string> base =
+            tl::unexpected(std::string("no segment spec"));
+        auto r = conn->roundtrip(
+            [&](request_batch &b) {
+                b.add(protocol::CreateGetSegmentRequest(b.builder(),
+                                                        obj.segment));
+            },
+            [&](protocol::Response const *resp) {
+                status = resp->status();
+                auto const *gs = resp->response_as_GetSegmentResponse();
+                if (gs != nullptr && gs->segment() != nullptr) {
+                    base = segments.map(obj.segment, *gs->segment())
+                               .map_error([&](std::error_code ec) {
+                                   return fmt::format("segment {}: {}",
+                                                      obj.segment,
+                                                      ec.message());
+                               });
+                }
+            });
+        if (not r)
+            return tl::unexpected(std::move(r).error());
+        if (status != protocol::Status::OK)
+            return status_error("get segment", status);
+        return base.map([&](std::uint8_t *b) { return b + obj.offset; });
+    }
+
+  private:
+    auto map_known_segment(object_mapping const &obj)
+        -> tl::expected<std::uint8_t *, std::string> {
+        return segments.map(obj.segment)
+            .map([&](std::uint8_t *b) { return b + obj.offset; })
+            .map_error([&](std::error_code ec) {
+                return fmt::format("segment {}: {}", obj.segment,
+                                   ec.message());
+            });
+    }
+
+  public:
+    [[nodiscard]] auto stats() const noexcept -> worker_stats const & {
+        return stat;
+    }
+};
+
+auto mapping_of(protocol::Mapping const *m) -> object_mapping {
+    return {m->key(), m->segment(), m->offset()};
+}
+
+class producer : public worker {
+    token_queue *queue;
+    clock::time_point deadline;
+    std::uint8_t fill = 0;
+
+  public:
+    explicit producer(loadgen_config const &config,
+                      std::unique_ptr<connection> &&client_connection,
+                      token_queue &tokens, clock::time_point end_time)
+        : worker(config, std::move(client_connection)), queue(&tokens),
+          deadline(end_time) {}
+
+    auto run() -> tl::expected<void, std::string> {
+        if (cfg->pat == pattern::unshare)
+            return run_unshare();
+        return run_alloc();
+    }
+
+  private:
+    // Return nullopt if out of shared memory.
+    auto alloc(protocol::Policy policy)
+        -> tl::expected<std::optional<object_mapping>, std::string> {
+        auto status = protocol::Status::OK;
+        std::optional<object_mapping> obj;
+        auto r = timed_roundtrip(
+            operation::alloc,
+            [&](request_batch &b) {
+                b.add(protocol::CreateAllocRequest(
+                    b.builder(), cfg->object_size, policy));
+            },
+            [&](protocol::Response const *resp) {
+                status = resp->status();
+                auto const *ar = resp->response_as_AllocResponse();
+                if (ar != nullptr && ar->object() != nullptr) {
+                    obj = mapping_of(ar->object());
+                    if (auto const *spec = ar->segment())
+                        segments.add_spec(obj->segment, *spec);
+                }
+            });
+        if (not r)
+            return tl::unexpected(std::move(r).error());
+        if (status == protocol::Status::OUT_OF_SHMEM) {
+            ++stat.out_of_shmem;
+            std::this_thread::yield();
+            return std::nullopt;
+        }
+        if (status != protocol::Status::OK || not obj)
+            return status_error("alloc", status);
+        return obj;
+    }
+
+    auto write(object_mapping const &obj) -> tl::expected<void, std::string> {
+        if (not cfg->touch)
+            return {};
+        return object_data(obj).map([&](std::uint8_t *data) {
+            std::memset(data, ++fill, cfg->object_size);
+        });
+    }
+
+    // Publish the object with a voucher and, unless 'keep_open', close it.
+    auto publish(object_mapping const &obj, bool keep_open)
+        -> tl::expected<std::uint64_t, std::string> {
+        auto const primitive = cfg->pat == pattern::primitive;
+        auto status = protocol::Status::OK;
+        std::uint64_t voucher = 0;
+        auto r = timed_roundtrip(
+            operation::publish,
+            [&](request_batch &b) {
+                auto &f = b.builder();
+                if (primitive)
+                    b.add(protocol::CreateCreateVoucherRequest(f, obj.key));
+                else
+                    b.add(protocol::CreateShareAndCreateVoucherRequest(
+                        f, obj.key));
+                if (not keep_open)
+                    b.add(protocol::CreateCloseRequest(f, obj.key));
+            },
+            [&](protocol::Response const *resp) {
+                if (resp->status() != protocol::Status::OK)
+                    status = resp->status();
+                if (auto const *cv = resp->response_as_CreateVoucherResponse())
+                    voucher = cv->key();
+                if (auto const *scv =
+                        resp->response_as_ShareAndCreateVoucherResponse())
+                    voucher = scv->key();
+            });
+        if (not r)
+            return tl::unexpected(std::move(r).error());
+        if (status != protocol::Status::OK)
+            return status_error("publish", status);
+        return voucher;
+    }
+
+    auto run_alloc() -> tl::expected<void, std::string> {
+        auto const policy = cfg->pat == pattern::primitive
+                                ? protocol::Policy::PRIMITIVE
+                                : protocol::Policy::DEFAULT;
+        while (clock::now() < deadline) {
+            auto obj = alloc(policy);
+            if (not obj)
+                return tl::unexpected(std::move(obj).error());
+            if (not obj.value())
+                continue;
+            auto voucher = write(**obj).and_then(
+                [&] { return publish(**obj, false); });
+            if (not voucher)
+                return tl::unexpected(std::move(voucher).error());
+            if (not queue->push(*voucher))
+                break;
+            ++stat.objects;
+        }
+        return {};
+    }
+
+    auto unshare(object_mapping &obj) -> tl::expected<void, std::string> {
+        auto status = protocol::Status::OK;
+        auto r = timed_roundtrip(
+            operation::unshare,
+            [&](request_batch &b) {
+                b.add(protocol::CreateUnshareRequest(b.builder(), obj.key));
+            },
+            [&](protocol::Response const *resp) {
+                status = resp->status();
+                if (auto const *ur = resp->response_as_UnshareResponse())
+                    obj.key = ur->key();
+            });
+        if (not r)
+            return r;
+        if (status != protocol::Status::OK)
+            return status_error("unshare", status);
+        return {};
+    }
+
+    auto close(object_mapping const &obj) -> tl::expected<void, std::string> {
+        auto status = protocol::Status::OK;
+        auto r = timed_roundtrip(
+            operation::close,
+            [&](request_batch &b) {
+                b.add(protocol::CreateCloseRequest(b.builder(), obj.key));
+            },
+            [&](protocol::Response const *resp) { status = resp->status(); });
+        if (not r)
+            return r;
+        if (status != protocol::Status::OK)
+            return status_error("close", status);
+        return {};
+    }
+
+    auto run_unshare() -> tl::expected<void, std::string> {
+        std::optional<object_mapping> obj;
+        while (not obj && clock::now() < deadline) {
+            auto a = alloc(protocol::Policy::DEFAULT);
+            if (not a)
+                return tl::unexpected(std::move(a).error());
+            obj = *a;
+        }
+        if (not obj)
+            return {};
+
+        while (clock::now() < deadline) {
+            auto voucher =
+                write(*obj).and_then([&] { return publish(*obj, true); });
+            if (not voucher)
+                return tl::unexpected(std::move(voucher).error());
+            if (not queue->push(*voucher))
+                break;
+            ++stat.objects;
+            if (auto r = unshare(*obj); not r)
+                return r;
+        }
+        return close(*obj);
+    }
+};
+
+class consumer : public worker {
+    token_queue *queue;
+    std::uint8_t checksum = 0;
+
+  public:
+    explicit consumer(loadgen_config const &config,
+                      std::unique_ptr<connection> &&client_connection,
+                      token_queue &tokens)
+        : worker(config, std::move(client_connection)), queue(&tokens) {}
+
+    auto run() -> tl::expected<void, std::string> {
+        auto const policy = cfg->pat == pattern::primitive
+                                ? protocol::Policy::PRIMITIVE
+                                : protocol::Policy::DEFAULT;
+        while (auto voucher = queue->pop()) {
+            auto status = protocol::Status::OK;
+            object_mapping obj;
+            auto r = timed_roundtrip(
+                operation::open,
+                [&](request_batch &b) {
+                    b.add(protocol::CreateOpenRequest(b.builder(), *voucher,
+                                                      policy, false));
+                },
+                [&](protocol::Response const *resp) {
+                    status = resp->status();
+                    auto const *op = resp->response_as_OpenResponse();
+                    if (op != nullptr && op->object() != nullptr) {
+                        obj = mapping_of(op->object());
+                        if (auto const *spec = op->segment())
+                            segments.add_spec(obj.segment, *spec);
+                    }
+                });
+            if (not r)
+                return r;
+            if (status == protocol::Status::NO_SUCH_OBJECT) {
+                ++stat.stale_vouchers;
+                continue;
+            }
+            if (status != protocol::Status::OK)
+                return status_error("open", status);
+
+            if (auto rd = read(obj); not rd)
+                return rd;
+
+            r = timed_roundtrip(
+                operation::close,
+                [&](request_batch &b) {
+                    b.add(protocol::CreateCloseRequest(b.builder(), obj.key));
+                },
+                [&](protocol::Response const *resp) {
+                    status = resp->status();
+                });
+            if (not r)
+                return r;
+            if (status != protocol::Status::OK)
+                return status_error("close", status);
+            ++stat.objects;
+        }
+        return {};
+    }
+
+  private:
+    // Touch every cache line of the object.
+    auto read(object_mapping const &obj) -> tl::expected<void, std::string> {
+        if (not cfg->touch)
+            return {};
+        return object_data(obj).map([&](std::uint8_t const *data) {
+            static constexpr std::size_t line = 64;
+            std::uint8_t sum = checksum;
+            for (std::size_t i = 0; i < cfg->object_size; i += line)
+                sum = static_cast<std::uint8_t>(sum ^ data[i]);
+            checksum = sum;
+        });
+    }
+};
+
+} // namespace
+
+auto run_load(loadgen_config const &cfg)
+    -> tl::expected<loadgen_result, std::string> {
+    // Connect everyone before starting the clock.
+    auto const connect =
+        [&](std::string_view role,
+            unsigned i) -> tl::expected<std::unique_ptr<connection>,
+                                        std::string> {
+        auto conn = std::make_unique<connection>();
+        auto r = conn->connect(cfg.socket,
+                               fmt::format("loadgen-{}-{}", role, i));
+        if (not r)
+            return tl::unexpected(std::move(r).error());
+        return conn;
+    };
+
+    token_queue queue(cfg.queue_depth);
+    auto const start = clock::now();
+    auto const deadline = start + cfg.duration;
+    std::vector<std::unique_ptr<producer>> producers;
+    std::vector<std::unique_ptr<consumer>> consumers;
+    for (unsigned i = 0; i < cfg.producers; ++i) {
+        auto conn = connect("producer", i);
+        if (not conn)
+            return tl::unexpected(std::move(conn).error());
+        producers.push_back(std::make_unique<producer>(
+            cfg, std::move(*conn), queue, deadline));
+    }
+    for (unsigned i = 0; i < cfg.consumers; ++i) {
+        auto conn = connect("consumer", i);
+        if (not conn)
+            return tl::unexpected(std::move(conn).error());
+        consumers.push_back(
+            std::make_unique<consumer>(cfg, std::move(*conn), queue));
+    }
+
+    std::mutex error_mutex;
+    std::string first_error;
+    auto const report_error = [&](std::string &&err) {
+        std::lock_guard lock(error_mutex);
+        if (first_error.empty())
+            first_error = std::move(err);
+        queue.close();
+    };
+
+    std::vector<std::thread> producer_threads;
+    std::vector<std::thread> consumer_threads;
+    for (auto &c : consumers) {
+        consumer_threads.emplace_back([&report_error, w = c.get()] {
+            if (auto r = w->run(); not r)
+                report_error(std::move(r).error());
+        });
+    }
+    for (auto &p : producers) {
+        producer_threads.emplace_back([&report_error, w = p.get()] {
+            if (auto r = w->run(); not r)
+                report_error(std::move(r).error());
+        });
+    }
+    for (auto &t : producer_threads)
+        t.join();
+    queue.close(); // Consumers drain remaining vouchers.
+    for (auto &t : consumer_threads)
+        t.join();
+    auto const elapsed = clock::now() - start;
+
+    if (not first_error.empty())
+        return tl::unexpected(first_error);
+
+    loadgen_result ret;
+    ret.elapsed = elapsed;
+    for (auto const &p : producers)
+        ret.producers.merge(p->stats());
+    for (auto const &c : consumers)
+        ret.consumers.merge(c->stats());
+    return ret;
+}
+
+void print_report(loadgen_config const &cfg, loadgen_result &result) {
+    auto const secs = std::chrono::duration<double>(result.elapsed).count();
+    auto const objects = result.consumers.objects;
+    auto const pattern_name = cfg.pat == pattern::unshare     ? "unshare"
+                              : cfg.pat == pattern::primitive ? "primitive"
+                                                              : "voucher";
+    fmt::print("pattern: {}; producers: {}; consumers: {}; object size: {}\n",
+               pattern_name, cfg.producers, cfg.consumers, cfg.object_size);
+    fmt::print("elapsed: {:.3f} s\n", secs);
+    fmt::print("objects consumed: {} ({:.0f}/s, {:.1f} MiB/s)\n", objects,
+               double(objects) / secs,
+               double(objects) * double(cfg.object_size) / secs /
+                   (1024.0 * 1024.0));
+    if (result.producers.out_of_shmem > 0) {
+        fmt::print("allocations failed (out of shmem): {}\n",
+                   result.producers.out_of_shmem);
+    }
+    if (result.consumers.stale_vouchers > 0) {
+        fmt::print("vouchers expired before open: {}\n",
+                   result.consumers.stale_vouchers);
+    }
+
+    fmt::print("\n{:<9} {:<8} {:>10} {:>12} {:>9} {:>9} {:>9} {:>9}\n",
+               "role", "op", "count", "ops/s", "p50 us", "p99 us",
+               "p999 us", "max us");
+    auto const print_ops = [&](std::string_view role, worker_stats &stats) {
+        for (std::size_t i = 0; i < operation_count; ++i) {
+            auto const op = static_cast<operation>(i);
+            auto &lat = stats.latency(op);
+            if (lat.count() == 0)
+                continue;
+            auto const us = [&](double q) {
+                return std::chrono::duration<double, std::micro>(
+                           lat.quantile(q))
+                    .count();
+            };
+            fmt::print("{:<9} {:<8} {:>10} {:>12.0f} {:>9.1f} {:>9.1f} "
+                       "{:>9.1f} {:>9.1f}\n",
+                       role, operation_name(op), lat.count(),
+                       double(lat.count()) / secs, us(0.5), us(0.99),
+                       us(0.999), us(1.0));
+        }
+    };
+    print_ops("producer", result.producers);
+    print_ops("consumer", result.consumers);
+}
+
+} // namespace partake::loadgen
@@ -0,0 +1,90 @@
+/*
+ * This file is part of the partake project
+ * Copyright 2020-2023 Board of Regents of the University of Wisconsin System
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include "latency_recorder.hpp"
+
+#include <tl/expected.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace partake::loadgen {
+
+enum class pattern {
+    // Producer: Alloc, write, ShareAndCreateVoucher + Close. Consumer: Open
+    // voucher, read, Close.
+    voucher,
+    // Producer keeps one object: write, ShareAndCreateVoucher, Unshare (which
+    // waits for the consumer to close), repeat. Consumer as for voucher.
+    unshare,
+    // As voucher, but with PRIMITIVE objects (CreateVoucher instead of
+    // ShareAndCreateVoucher).
+    primitive,
+};
+
+struct loadgen_config {
+    std::string socket;
+    pattern pat = pattern::voucher;
+    unsigned producers = 1;
+    unsigned consumers = 1;
+    std::size_t object_size = 4096;
+    std::chrono::milliseconds duration = std::chrono::seconds(10);
+    std::size_t queue_depth = 64; // Vouchers in flight between workers
+    bool touch = true;            // Write and read object data
+};
+
+// Round trips whose latency is recorded.
+enum class operation : std::size_t {
+    alloc,   // Alloc
+    publish, // (Share)AndCreateVoucher, plus Close unless unshare pattern
+    unshare, // Unshare (includes waiting for consumer)
+    open,    // Open voucher
+    close,   // Close
+};
+
+constexpr std::size_t operation_count = 5;
+
+[[nodiscard]] auto operation_name(operation op) noexcept -> std::string_view;
+
+struct worker_stats {
+    std::array<latency_recorder, operation_count> latencies;
+    std::uint64_t objects = 0; // Published or consumed
+    std::uint64_t out_of_shmem = 0;
+    std::uint64_t stale_vouchers = 0; // Expired before consumer opened
+
+    [[nodiscard]] auto latency(operation op) -> latency_recorder & {
+        return latencies[static_cast<std::size_t>(op)];
+    }
+
+    void merge(worker_stats const &other) {
+        for (std::size_t i = 0; i < operation_count; ++i)
+            latencies[i].merge(other.latencies[i]);
+        objects += other.objects;
+        out_of_shmem += other.out_of_shmem;
+        stale_vouchers += other.stale_vouchers;
+    }
+};
+
+struct loadgen_result {
+    worker_stats producers;
+    worker_stats consumers;
+    std::chrono::nanoseconds elapsed{};
+};
+
+// Connect all workers, run the load for the configured duration, and gather
+// statistics.
+auto run_load(loadgen_config const &cfg)
+    -> tl::expected<loadgen_result, std::string>;
+
+void print_report(loadgen_config const &cfg, loadgen_result &result);
+
+} // namespace partake::loadgen